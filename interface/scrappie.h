@@ -32,6 +32,9 @@ extern "C" {
         size_t start;
         size_t end;
         float *raw;
+        int16_t *sample;
+        float offset;
+        float unit;
     } raw_table;
 
 /*  Matrix definitions from scrappie_matrix.h  */
@@ -51,6 +54,55 @@ extern "C" {
 
     scrappie_matrix free_scrappie_matrix(scrappie_matrix mat);
 
+/*  Reentrant basecalling from basecall_context.h  */
+    enum homopolymer_calculation {
+        HOMOPOLYMER_NOCHANGE,
+        HOMOPOLYMER_MEAN,
+        HOMOPOLYMER_INVALID
+    };
+
+    typedef struct {
+        size_t trim_start;
+        size_t trim_end;
+        size_t varseg_chunk;
+        float varseg_thresh;
+        float min_prob;
+        float tempW;
+        float tempb;
+        float stay_pen;
+        float skip_pen;
+        float local_pen;
+        bool use_slip;
+        enum homopolymer_calculation homopolymer;
+        bool quality;
+        size_t nthread;
+        size_t batch_size;
+    } basecall_context_param;
+
+    typedef struct basecall_context basecall_context;
+
+    typedef struct {
+        char *basecall;
+        char *quality;
+        float score;
+        int *pos;
+        size_t nblock;
+        size_t start;
+        size_t end;
+    } basecall_result;
+
+    basecall_context *make_basecall_context(const char *model,
+                                            const basecall_context_param * param);
+    basecall_context *free_basecall_context(basecall_context * context);
+    bool basecall_context_call(const basecall_context * context,
+                               const float *signal, size_t n,
+                               basecall_result * res);
+    size_t basecall_context_call_batch(const basecall_context * context,
+                                       const float *const *signal,
+                                       const size_t * n, size_t nread,
+                                       basecall_result * res);
+    void basecall_result_release(basecall_result * res);
+
 #    ifdef __cplusplus
 }
 #    endif
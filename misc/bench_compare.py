@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+"""  Compare two runs of scrappie_bench and flag benchmarks that got slower
+
+Benchmarks are matched by name and size.  A benchmark is flagged as slower
+when its best time per call has increased by more than the threshold.  Where
+both runs counted hardware events (scrappie_bench --counters), the change in
+each counter per call is reported too, which helps to explain a change in
+time, e.g. more branch misses.  Results are written as tab separated values
+and the exit status is non-zero if any benchmark got slower.
+"""
+import argparse
+import json
+import sys
+
+COUNTERS = ['cycles', 'instructions', 'cache_misses', 'branch_misses']
+
+parser = argparse.ArgumentParser(description='Compare results of scrappie_bench')
+parser.add_argument('baseline', help='Results of baseline run, as TSV or JSON lines')
+parser.add_argument('current', help='Results of current run, as TSV or JSON lines')
+parser.add_argument('--threshold', default=5.0, type=float,
+                    help='Percentage increase in time for a benchmark to be flagged as slower')
+parser.add_argument('--all', default=False, action='store_true',
+                    help='Report all benchmarks rather than only those that got slower')
+
+
+def read_results(fn):
+    """ Read results of scrappie_bench
+
+    :returns: tuple of (commit, dictionary of (benchmark, size) to result)
+    """
+    results = {}
+    commit = 'unknown'
+    with open(fn) as fh:
+        lines = [line.rstrip('\n') for line in fh if line.strip()]
+    if len(lines) > 0 and lines[0].startswith('{'):
+        records = [json.loads(line) for line in lines]
+    else:
+        header = lines[0].split('\t') if len(lines) > 0 else []
+        records = [dict(zip(header, line.split('\t'))) for line in lines[1:]]
+    for rec in records:
+        result = {'seconds': float(rec['best_seconds'])}
+        for counter in COUNTERS:
+            if counter in rec and rec[counter] != 'NA':
+                result[counter] = float(rec[counter])
+        commit = rec.get('commit', commit)
+        results[(rec['benchmark'], rec['size'])] = result
+    return commit, results
+
+
+def change(old, new):
+    """ Percentage change from old to new
+    """
+    return 100.0 * (new - old) / old if old > 0 else float('nan')
+
+
+if __name__ == '__main__':
+    args = parser.parse_args()
+    base_commit, baseline = read_results(args.baseline)
+    curr_commit, current = read_results(args.current)
+
+    print('# Baseline {}, current {}'.format(base_commit, curr_commit))
+    print('\t'.join(['benchmark', 'size', 'baseline_seconds', 'current_seconds', 'time_change'] +
+                    [c + '_change' for c in COUNTERS] + ['status']))
+    nslower = 0
+    for key in sorted(set(baseline) & set(current)):
+        old, new = baseline[key], current[key]
+        time_change = change(old['seconds'], new['seconds'])
+        status = 'slower' if time_change > args.threshold else (
+            'faster' if time_change < -args.threshold else 'same')
+        nslower += status == 'slower'
+        if status != 'slower' and not args.all:
+            continue
+        counter_change = ['{:+.1f}%'.format(change(old[c], new[c])) if old.get(c, 0) > 0 and c in new else 'NA'
+                          for c in COUNTERS]
+        print('\t'.join([key[0], key[1], '{:e}'.format(old['seconds']), '{:e}'.format(new['seconds']),
+                         '{:+.1f}%'.format(time_change)] + counter_change + [status]))
+
+    missing = sorted(set(baseline) ^ set(current))
+    for name, size in missing:
+        sys.stderr.write('Benchmark {} ({}) is only in one of the runs\n'.format(name, size))
+    sys.exit(1 if nslower > 0 else 0)
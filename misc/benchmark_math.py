@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+"""  Compare accuracy tiers of scrappie's activation functions
+
+Basecalls the reads in a directory with every accuracy tier (--math) of each
+model, reporting the throughput of each run and the accuracy of its calls.
+Accuracy is measured against a reference sequence where a FASTA file sharing
+the name of the read exists, and as agreement with the calls of the accurate
+tier.  Results are written as tab separated values.
+"""
+import argparse
+import glob
+import json
+import os
+import subprocess
+import sys
+import time
+
+TIERS = ['accurate', 'fast', 'fastest']
+
+parser = argparse.ArgumentParser(description='Benchmark accuracy tiers of activation functions')
+parser.add_argument('--scrappie', default='build/scrappie', help='Path to scrappie executable')
+parser.add_argument('--reads', default='reads', help='Directory of fast5 files and references')
+parser.add_argument('--models', default='rgrgr_r94,rnnrf_r94,raw_r94',
+                    help='Comma separated list of raw models')
+parser.add_argument('--threads', default=1, type=int, help='Number of reads to call in parallel')
+parser.add_argument('--repeats', default=3, type=int, help='Number of runs of each tier, fastest kept')
+
+
+def edit_distance(a, b):
+    """ Levenshtein distance by Myers' bit-parallel algorithm
+    """
+    if len(a) == 0:
+        return len(b)
+    peq = {}
+    for i, c in enumerate(a):
+        peq[c] = peq.get(c, 0) | (1 << i)
+    full = (1 << len(a)) - 1
+    top = 1 << (len(a) - 1)
+    pv, mv, score = full, 0, len(a)
+    for c in b:
+        eq = peq.get(c, 0)
+        xv = eq | mv
+        xh = (((eq & pv) + pv) ^ pv) | eq
+        ph = mv | ~(xh | pv)
+        mh = pv & xh
+        if ph & top:
+            score += 1
+        elif mh & top:
+            score -= 1
+        ph = (ph << 1) | 1
+        mh = mh << 1
+        pv = (mh | ~(xv | ph)) & full
+        mv = ph & xv & full
+    return score
+
+
+def identity(ref, seq):
+    return 1.0 - edit_distance(ref, seq) / float(max(len(ref), 1))
+
+
+def read_fasta(fn):
+    """ Read FASTA file
+
+    :returns: dictionary of read name to (header, sequence)
+    """
+    reads = {}
+    name = None
+    with open(fn) as fh:
+        for line in fh:
+            line = line.strip()
+            if line.startswith('>'):
+                fields = line[1:].split(None, 1)
+                name = os.path.basename(fields[0])
+                reads[name] = [fields[1] if len(fields) > 1 else '', '']
+            elif name is not None:
+                reads[name][1] += line
+    return {k: tuple(v) for k, v in reads.items()}
+
+
+def basecall(args, model, tier, fast5):
+    """ Basecall reads, keeping the quickest of several runs
+
+    :returns: tuple of (seconds, dictionary of read name to sequence, number of samples)
+    """
+    best = None
+    for _ in range(args.repeats):
+        start = time.time()
+        out = subprocess.run([args.scrappie, 'raw', '--model', model, '--math', tier,
+                              '-#', str(args.threads)] + fast5,
+                             check=True, stdout=subprocess.PIPE, universal_newlines=True).stdout
+        elapsed = time.time() - start
+        if best is None or elapsed < best[0]:
+            best = (elapsed, out)
+    calls = {}
+    nsample = 0
+    lines = best[1].splitlines()
+    for header, seq in zip(lines[0::2], lines[1::2]):
+        fields = header[1:].split(None, 1)
+        calls[os.path.basename(fields[0])] = seq
+        nsample += json.loads(fields[1]).get('nsample', 0) if len(fields) > 1 else 0
+    return best[0], calls, nsample
+
+
+if __name__ == '__main__':
+    args = parser.parse_args()
+    fast5 = sorted(glob.glob(os.path.join(args.reads, '*.fast5')))
+    if len(fast5) == 0:
+        sys.exit('No fast5 files found in {}'.format(args.reads))
+    references = {}
+    for fn in glob.glob(os.path.join(args.reads, '*.fa')):
+        for name, (_, seq) in read_fasta(fn).items():
+            references[name] = seq
+
+    print('\t'.join(['model', 'tier', 'seconds', 'samples_per_second', 'bases_per_second',
+                     'reference_identity', 'agreement_with_accurate']))
+    for model in args.models.split(','):
+        accurate_calls = None
+        for tier in TIERS:
+            elapsed, calls, nsample = basecall(args, model, tier, fast5)
+            if accurate_calls is None:
+                accurate_calls = calls
+            nbase = sum(len(seq) for seq in calls.values())
+            with_ref = [name for name in calls if name in references]
+            ref_identity = (sum(identity(references[name], calls[name]) for name in with_ref) /
+                            len(with_ref)) if with_ref else float('nan')
+            agreement = sum(identity(accurate_calls[name], calls[name])
+                            for name in calls if name in accurate_calls) / len(calls)
+            print('{}\t{}\t{:.3f}\t{:.0f}\t{:.0f}\t{:.5f}\t{:.5f}'.format(
+                model, tier, elapsed, nsample / elapsed, nbase / elapsed, ref_identity, agreement))
+            sys.stdout.flush()
@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+"""  Read binary column files written by scrappie
+
+Column files hold event tables and summaries of reads, as written by
+'scrappie event_table --format columns', 'scrappie events --columns' and
+'scrappie raw --columns'.  The file is mapped and each column is returned as a
+memoryview of the mapped bytes, or a numpy array over them when numpy is
+available, so nothing is copied however large the file.  Strings are decoded
+on access.  The layout must agree with src/column_file.h
+
+As a script, prints the tables of a file as tab separated values.
+"""
+import argparse
+import mmap
+import struct
+import sys
+
+MAGIC = b'SCRPCOLS'
+VERSION = 1
+HEADER = struct.Struct('=8sIIQQ32s128s64s')
+DESCRIPTOR = struct.Struct('=32sIIQQQQ8s')
+#  Format of memoryview cast and numpy dtype of each type of column
+TYPES = {0: ('i', 'i4'), 1: ('Q', 'u8'), 2: ('f', 'f4'), 3: ('d', 'f8'), 4: ('Q', 'u8')}
+STRING = 4
+
+try:
+    import numpy
+except ImportError:
+    numpy = None
+
+
+def _name(field):
+    return field.split(b'\0', 1)[0].decode()
+
+
+class StringColumn(object):
+    """ Column of strings, offsets into an array of characters as in Arrow
+    """
+    def __init__(self, offsets, data):
+        self.offsets = offsets
+        self.data = data
+
+    def __len__(self):
+        return len(self.offsets) - 1
+
+    def __getitem__(self, i):
+        if i < 0:
+            i += len(self)
+        if not 0 <= i < len(self):
+            raise IndexError('row out of range')
+        return bytes(self.data[self.offsets[i]:self.offsets[i + 1]]).decode()
+
+
+class Batch(object):
+    """ Rows of a table stored by column
+    """
+    def __init__(self, buf, offset):
+        (magic, version, ncolumn, self.nrow, self.size, table, label,
+         _) = HEADER.unpack_from(buf, offset)
+        if magic != MAGIC or version != VERSION:
+            raise ValueError('invalid column batch at byte {}'.format(offset))
+        if self.size == 0 or offset + self.size > len(buf):
+            raise ValueError('truncated column batch at byte {}'.format(offset))
+        self.table = _name(table)
+        self.label = _name(label)
+        self.columns = {}
+        for i in range(ncolumn):
+            (name, ctype, _, coffset, nbyte, data_offset, data_nbyte,
+             _) = DESCRIPTOR.unpack_from(buf, offset + HEADER.size + i * DESCRIPTOR.size)
+            values = self._values(buf, offset + coffset, nbyte, ctype)
+            if ctype == STRING:
+                start = offset + data_offset
+                values = StringColumn(values, buf[start:start + data_nbyte])
+            self.columns[_name(name)] = values
+
+    @staticmethod
+    def _values(buf, start, nbyte, ctype):
+        fmt, dtype = TYPES[ctype]
+        if numpy is not None:
+            return numpy.frombuffer(buf, dtype=dtype, count=nbyte // numpy.dtype(dtype).itemsize,
+                                    offset=start)
+        return buf[start:start + nbyte].cast(fmt)
+
+    def __getitem__(self, name):
+        return self.columns[name]
+
+
+def open_column_file(filename):
+    """ Map column file and index its batches
+
+    :returns: list of Batch, in order of file.  Columns refer to the mapped
+    file, which stays mapped while any of them does.
+    """
+    with open(filename, 'rb') as fh:
+        buf = memoryview(mmap.mmap(fh.fileno(), 0, access=mmap.ACCESS_READ))
+    batches = []
+    offset = 0
+    while offset < len(buf):
+        batch = Batch(buf, offset)
+        batches.append(batch)
+        offset += batch.size
+    return batches
+
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Print tables of a scrappie column file')
+    parser.add_argument('file', help='Column file to read')
+    parser.add_argument('--table', default=None, help='Only print batches of this table')
+    args = parser.parse_args()
+
+    for batch in open_column_file(args.file):
+        if args.table is not None and batch.table != args.table:
+            continue
+        names = list(batch.columns)
+        print('# {}\t{}'.format(batch.table, batch.label))
+        print('\t'.join(names))
+        for row in range(batch.nrow):
+            print('\t'.join(str(batch[name][row]) for name in names))
+    sys.stdout.flush()
@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+"""  Write binary model files for scrappie's --model-file option
+
+Converts a model header, as written by the parse_*.py scripts, into a binary
+model file that scrappie maps at run time rather than compiling in.  The
+layout must agree with src/model_file.h
+"""
+import argparse
+import array
+import math
+import re
+import struct
+
+MAGIC = b'SCRPMODL'
+VERSION = 1
+ALIGN = 64
+MODEL_NAME_LEN = 32
+TENSOR_NAME_LEN = 40
+
+parser = argparse.ArgumentParser(description='Convert model header to binary model file')
+parser.add_argument('model', help='Name of model, e.g. rgrgr_r94')
+parser.add_argument('header', help='Model header to read')
+parser.add_argument('output', help='Binary model file to write')
+
+array_re = re.compile(r'float\s+__(\w+)\[\d*\]\s*=\s*\{([^}]*)\}', re.S)
+mat_re = re.compile(r'_Mat\s+_(\w+)\s*=\s*\{([^}]*)\}', re.S)
+field_re = re.compile(r'\.(\w+)\s*=\s*(\w+)')
+
+
+def align(offset):
+    return ALIGN * ((offset + ALIGN - 1) // ALIGN)
+
+
+def padded_stride(nr):
+    return 4 * int(math.ceil(nr / 4.0))
+
+
+def read_header(fn):
+    """ Read tensors from model header
+
+    :returns: list of (name, nr, nc, data) where data are padded column major floats
+    """
+    with open(fn) as fh:
+        text = fh.read()
+    arrays = {name: array.array('f', [float.fromhex(v) if 'x' in v else float(v)
+                                      for v in body.replace('\n', ' ').split(',') if v.strip()])
+              for name, body in array_re.findall(text)}
+    tensors = []
+    for name, body in mat_re.findall(text):
+        fields = dict(field_re.findall(body))
+        nr, nc, stride = int(fields['nr']), int(fields['nc']), int(fields['stride'])
+        data = arrays[fields['f'].lstrip('_')] if 'f' in fields else arrays[name]
+        assert stride == padded_stride(nr), 'Tensor {} is not in padded layout'.format(name)
+        assert len(data) == nc * stride, 'Tensor {} has wrong number of elements'.format(name)
+        tensors.append((name, nr, nc, data))
+    return tensors
+
+
+def write_model_file(fn, model, tensors):
+    """ Write binary model file
+
+    :param fn: Name of file to write
+    :param model: Name of model
+    :param tensors: list of (name, nr, nc, data) where data are padded column major floats
+    """
+    assert len(model) < MODEL_NAME_LEN
+    directory_offset = align(struct.calcsize('=8sII32sQ8x'))
+    offset = align(directory_offset + len(tensors) * ALIGN)
+    directory = []
+    for name, nr, nc, data in tensors:
+        assert len(name) < TENSOR_NAME_LEN
+        directory.append(struct.pack('={}sIIQ8x'.format(TENSOR_NAME_LEN), name.encode(), nr, nc, offset))
+        offset = align(offset + 4 * len(data))
+
+    with open(fn, 'wb') as fh:
+        fh.write(struct.pack('=8sII32sQ8x', MAGIC, VERSION, len(tensors), model.encode(), directory_offset))
+        fh.write(b'\0' * (directory_offset - fh.tell()))
+        for entry in directory:
+            fh.write(entry)
+        for (name, nr, nc, data), entry in zip(tensors, directory):
+            tensor_offset = struct.unpack_from('=Q', entry, TENSOR_NAME_LEN + 8)[0]
+            fh.write(b'\0' * (tensor_offset - fh.tell()))
+            fh.write(array.array('f', data).tobytes())
+
+
+if __name__ == '__main__':
+    args = parser.parse_args()
+    write_model_file(args.output, args.model, read_header(args.header))
@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+"""  Basecall fast5 files with a running scrappie server
+
+Each file is sent as a request to a server started with `scrappie serve` and
+the records of its reads are written to stdout, in the order the files were
+given.  Paths are made absolute since they are opened by the server.  Errors
+reported by the server are written to stderr and the exit status is non-zero
+if there were any.
+"""
+import argparse
+import os
+import socket
+import sys
+
+parser = argparse.ArgumentParser(description='Basecall fast5 files with scrappie serve')
+group = parser.add_mutually_exclusive_group(required=True)
+group.add_argument('--socket', help='Unix domain socket server is listening on')
+group.add_argument('--port', type=int, help='TCP port server is listening on')
+parser.add_argument('--host', default='127.0.0.1', help='Host of server listening on TCP port')
+parser.add_argument('--format', default='fasta', choices=['fasta', 'sam'],
+                    help='Format the server was started with, which sets the lines per record')
+parser.add_argument('files', nargs='+', help='fast5 files to basecall')
+
+
+def connect(args):
+    if args.socket is not None:
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        sock.connect(args.socket)
+        return sock
+    return socket.create_connection((args.host, args.port))
+
+
+if __name__ == '__main__':
+    args = parser.parse_args()
+    lines_per_record = 2 if args.format == 'fasta' else 1
+
+    sock = connect(args)
+    requests = ''.join('fast5 {}\n'.format(os.path.abspath(fn)) for fn in args.files)
+    sock.sendall(requests.encode())
+    sock.shutdown(socket.SHUT_WR)
+
+    nerror = 0
+    with sock.makefile('r') as fh:
+        for fn in args.files:
+            status = fh.readline().rstrip('\n')
+            if status.startswith('ok '):
+                for _ in range(int(status[3:]) * lines_per_record):
+                    sys.stdout.write(fh.readline())
+            else:
+                nerror += 1
+                sys.stderr.write('{}: {}\n'.format(fn, status))
+    sys.exit(1 if nerror > 0 else 0)
@@ -23,6 +23,11 @@ else:
 ffibuilder = FFI()
 ffibuilder.set_source("libscrappy",
     r"""
+      #if defined(_OPENMP)
+      #    include <omp.h>
+      #endif
+      #include <string.h>
+
       #include "decode.h"
       #include "networks.h"
       #include "scrappie_common.h"
@@ -30,6 +35,13 @@ ffibuilder.set_source("libscrappy",
       #include "scrappie_seq_helpers.h"
       #include "scrappie_matrix.h"
 
+      typedef struct {
+        char * basecall;
+        float score;
+        int * pos;
+        size_t nblock;
+      } scrappy_basecall;
+
       int get_raw_model_stride_from_string(const char * modelstr){
         // Obtain the model stride from its str name
         // avoid the intermediate errx from C signalling bad model
@@ -42,23 +54,118 @@ ffibuilder.set_source("libscrappy",
         }
       }
 
+      static int scrappy_nthread(int nthread){
+      #if defined(_OPENMP)
+        return (nthread > 0) ? nthread : omp_get_max_threads();
+      #else
+        return 1;
+      #endif
+      }
+
+      /*  Posteriors of a batch of trimmed and scaled reads, evaluated in
+       *  parallel on the OpenMP thread pool.  Posteriors of reads that
+       *  fail are NULL.  Returns number of reads that failed, or -1 if the
+       *  model is not recognised.
+       */
+      int scrappy_posterior_batch(const raw_table * rts, size_t nread, const char * modelstr,
+                                  float min_prob, float tempW, float tempb, bool return_log,
+                                  int nthread, scrappie_matrix * posts){
+        const enum raw_model_type model = get_raw_model(modelstr);
+        if(SCRAPPIE_MODEL_INVALID == model){
+          return -1;
+        }
+        posterior_function_ptr calcpost = get_posterior_function(model);
+        int nfail = 0;
+        #pragma omp parallel for schedule(dynamic) num_threads(scrappy_nthread(nthread)) reduction(+:nfail)
+        for(size_t i=0 ; i < nread ; i++){
+          posts[i] = (rts[i].start < rts[i].end)
+                   ? calcpost(rts[i], min_prob, tempW, tempb, return_log) : NULL;
+          nfail += (NULL == posts[i]);
+        }
+        return nfail;
+      }
+
+      /*  Basecall a batch of trimmed and scaled reads in parallel on the
+       *  OpenMP thread pool, as scrappy's calc_post followed by decode_post.
+       *  Calls of reads that fail have a NULL basecall.  Returns number of
+       *  reads that failed, or -1 if the model is not recognised.
+       */
+      int scrappy_basecall_batch(const raw_table * rts, size_t nread, const char * modelstr,
+                                 float min_prob, float stay_pen, float skip_pen, float local_pen,
+                                 bool use_slip, int nthread, scrappy_basecall * calls){
+        const enum raw_model_type model = get_raw_model(modelstr);
+        if(SCRAPPIE_MODEL_INVALID == model){
+          return -1;
+        }
+        posterior_function_ptr calcpost = get_posterior_function(model);
+        int nfail = 0;
+        #pragma omp parallel for schedule(dynamic) num_threads(scrappy_nthread(nthread)) reduction(+:nfail)
+        for(size_t i=0 ; i < nread ; i++){
+          memset(calls + i, 0, sizeof(scrappy_basecall));
+          scrappie_matrix post = (rts[i].start < rts[i].end)
+                               ? calcpost(rts[i], min_prob, 1.0f, 1.0f, true) : NULL;
+          int * path = (NULL != post) ? calloc(post->nc + 1, sizeof(int)) : NULL;
+          int * pos = (NULL != post) ? calloc(post->nc + 1, sizeof(int)) : NULL;
+          if(NULL != path && NULL != pos){
+            const size_t nblock = post->nc;
+            if(SCRAPPIE_MODEL_RNNRF_R9_4 == model){
+              calls[i].score = decode_crf(post, path);
+              calls[i].basecall = crfpath_to_basecall(path, nblock, pos);
+            } else {
+              calls[i].score = decode_transducer(post, stay_pen, skip_pen, local_pen, path, use_slip);
+              calls[i].basecall = overlapper(path, nblock + 1, post->nr - 1, pos);
+            }
+            calls[i].nblock = nblock;
+          }
+          if(NULL == calls[i].basecall){
+            free(pos);
+            pos = NULL;
+            nfail += 1;
+          }
+          calls[i].pos = pos;
+          free(path);
+          post = free_scrappie_matrix(post);
+        }
+        return nfail;
+      }
+
+      void scrappy_free_basecall(scrappy_basecall * call){
+        free(call->basecall);
+        free(call->pos);
+        memset(call, 0, sizeof(scrappy_basecall));
+      }
+
     """,
     libraries=libraries,
     library_dirs=library_dirs,
     include_dirs=[src_dir],
     sources=[
         os.path.join(src_dir, '{}.c'.format(x)) for x in
-        r'''decode
+        r'''banding
+            basecall_stream
+            conv_decode
+            decode
+            decode_fixed
             event_detection
+            homopolymer
             layers
+            model_file
             networks
             nnfeatures
+            posterior_file
             scrappie_common
             scrappie_matrix
+            scrappie_numa
+            scrappie_profile
             scrappie_seq_helpers
+            scrappie_simd
+            simulate
+            sparse_posterior
+            squiggle_cache
             util'''.split()
     ],
-    extra_compile_args=['-std=c99', '-msse3', '-O3']
+    extra_compile_args=['-std=c99', '-msse3', '-O3', '-fopenmp', '-D_GNU_SOURCE'],
+    extra_link_args=['-fopenmp']
 )
 
 with open('pyscrap.h', 'r') as fh:
@@ -71,6 +178,9 @@ typedef struct {
   size_t start;
   size_t end;
   float *raw;
+  int16_t *sample;
+  float offset;
+  float unit;
 } raw_table;
 
 typedef struct {
@@ -82,6 +192,13 @@ typedef struct {
 } _Mat;
 typedef _Mat *scrappie_matrix;
 typedef _Mat const *const_scrappie_matrix;
+
+typedef struct {
+  char * basecall;
+  float score;
+  int * pos;
+  size_t nblock;
+} scrappy_basecall;
 """ + pyscrap_function_prototypes)
 
 if __name__ == "__main__":
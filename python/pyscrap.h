@@ -24,6 +24,8 @@ scrappie_matrix nanonet_rnnrf_r94_transitions(const raw_table signal, float min_
 float decode_crf(const_scrappie_matrix trans, int * path);
 char * crfpath_to_basecall(int const * path, size_t npos, int * pos);
 scrappie_matrix posterior_crf(const_scrappie_matrix trans);
+float decode_crf_quality(const_scrappie_matrix trans, int * path, float * perr);
+char * crfpath_to_quality(int const * path, float const * perr, size_t npos);
 
 // Squiggle generation
 scrappie_matrix squiggle_r94(int const * sequence, size_t n, bool transform_units);
@@ -36,6 +38,12 @@ float squiggle_match_viterbi(const raw_table signal, float rate, const_scrappie_
 float squiggle_match_forward(const raw_table signal, float rate, const_scrappie_matrix params,
                              float prob_back, float local_pen, float skip_pen,
                              float minscore);
+float squiggle_match_viterbi_banded(const raw_table signal, float rate, const_scrappie_matrix params,
+                                    float prob_back, float local_pen, float skip_pen,
+                                    float minscore, size_t band, int32_t * path_padded);
+float squiggle_match_forward_banded(const raw_table signal, float rate, const_scrappie_matrix params,
+                                    float prob_back, float local_pen, float skip_pen,
+                                    float minscore, size_t band);
 
 // Block-based mapping
 bool are_bounds_sane(size_t const * low, size_t const * high,
@@ -54,8 +62,18 @@ float map_to_sequence_viterbi(const_scrappie_matrix logpost,
 float map_to_sequence_viterbi_banded(const_scrappie_matrix logpost,
                                      float stay_pen, float skip_pen, float local_pen,
                                      int const *seq, size_t seqlen,
-                                     size_t const * poslow, size_t const * poshigh);
+                                     size_t const * poslow, size_t const * poshigh,
+                                     int *path);
 
 // Misc
 int * encode_bases_to_integers(char const * seq, size_t n, size_t state_len);
 int get_raw_model_stride_from_string(const char * modelstr);
+
+// Batches of reads, evaluated on the OpenMP thread pool
+int scrappy_posterior_batch(const raw_table * rts, size_t nread, const char * modelstr,
+                            float min_prob, float tempW, float tempb, bool return_log,
+                            int nthread, scrappie_matrix * posts);
+int scrappy_basecall_batch(const raw_table * rts, size_t nread, const char * modelstr,
+                           float min_prob, float stay_pen, float skip_pen, float local_pen,
+                           bool use_slip, int nthread, scrappy_basecall * calls);
+void scrappy_free_basecall(scrappy_basecall * call);
@@ -47,10 +47,13 @@ guess_state_properties = _gsp()
 
 
 class RawTable(object):
-    def __init__(self, data, start=0, end=None):
+    def __init__(self, data, start=0, end=None, copy=True):
         """Representation of a scrappie `raw_table`.
 
         :param data: `nd.array` containing raw data.
+        :param copy: copy the data. If False, data that is already a
+            contiguous array of `ftype` is used in place, and so is modified
+            by `scale`.
 
         ..note:: The class stores a reference to a contiguous numpy array of
             the correct type to be passed to the extension library. The class
@@ -61,7 +64,10 @@ class RawTable(object):
         if end is None:
             end = len(data)
 
-        self._data = np.ascontiguousarray(data.astype(ftype, order='C', copy=True))
+        if copy:
+            self._data = np.ascontiguousarray(data.astype(ftype, order='C', copy=True))
+        else:
+            self._data = np.ascontiguousarray(data, dtype=ftype)
         rt = ffi.new('raw_table *')
         rt.uuid = ffi.NULL
         rt.n = len(self._data)
@@ -147,12 +153,22 @@ def _scale_raw(rt):
 
 
 class ScrappyMatrix(object):
-    def __init__(self, scrappy_matrix):
+    def __init__(self, scrappy_matrix, copy=True):
         """Container to manage lifetime of a bare scrappie_matrix.
         Can be initialised by a pointer to a `scrappy_matrix` or a numpy `ndarray`.
+
+        :param copy: copy an `ndarray`. If False, an array already in the
+            padded layout of a `scrappie_matrix` (see `_is_scrappie_layout`),
+            such as a view of another `ScrappyMatrix`, is used in place.
         """
+        # Object owning the memory of a matrix that is not to be freed
+        self._base = None
         if isinstance(scrappy_matrix, np.ndarray):
-            self._data = _numpy_to_scrappy_matrix(scrappy_matrix)
+            if not copy and _is_scrappie_layout(scrappy_matrix):
+                self._data = _wrap_numpy(scrappy_matrix)
+                self._base = scrappy_matrix
+            else:
+                self._data = _numpy_to_scrappy_matrix(scrappy_matrix)
         elif isinstance(scrappy_matrix, ffi.CData):
             self._data = scrappy_matrix
         else:
@@ -160,7 +176,30 @@ class ScrappyMatrix(object):
                 '`scrappy_matrix pointer or `ndarray`.')
 
     def __del__(self):
-        _free_matrix(self._data)
+        if self._base is None:
+            _free_matrix(self._data)
+
+    @property
+    def __array_interface__(self):
+        """Numpy view of matrix, of shape (blocks, states), sharing its memory.
+        Padding due to SSE vectors is skipped by the stride between blocks.
+        """
+        return {
+            'shape': (self._data.nc, self._data.nr),
+            'typestr': np.dtype(ftype).str,
+            'data': (int(ffi.cast('uintptr_t', self._data.data.f)), False),
+            'strides': (size_ftype * self._data.stride, size_ftype),
+            'version': 3,
+        }
+
+    def view(self):
+        """Numpy view of matrix without copying.
+
+        :returns: a non-contiguous `np.ndarray` of shape (blocks, states) that
+            shares memory with, and keeps alive, this matrix. States are in
+            scrappie order (stay is last).
+        """
+        return np.asarray(self)
 
     @property
     def shape(self):
@@ -221,6 +260,8 @@ class ScrappyMatrixView(ScrappyMatrix):
         self._data = ffi.new("scrappie_matrix", init=init_data)
         self._data.data.f += start * self._data.stride
         self._data.nc = stop - start
+        # keep the viewed matrix alive for as long as the view
+        self._base = scrappy_matrix_obj
 
     def __del__(self):
         pass  # This is a view, we don't want underlying data garbage collected
@@ -236,6 +277,31 @@ def _numpy_to_scrappy_matrix(numpy_array):
     return lib.mat_from_array(buf, nr, nc)
 
 
+def _is_scrappie_layout(numpy_array):
+    """Whether a `ndarray` of shape (blocks, states) can be used in place as the
+    data of a `scrappie_matrix`: `ftype`, rows of states padded to a multiple
+    of the SSE vector length and aligned as scrappie allocates them.
+    """
+    if numpy_array.ndim != 2 or numpy_array.dtype != ftype or numpy_array.shape[0] == 0:
+        return False
+    nrq = (numpy_array.shape[1] + vsize - 1) // vsize
+    return (numpy_array.strides[1] == size_ftype and
+            numpy_array.strides[0] == size_ftype * vsize * nrq and
+            numpy_array.ctypes.data % (size_ftype * vsize) == 0)
+
+
+def _wrap_numpy(numpy_array):
+    """A `scrappie_matrix` sharing the memory of a `ndarray` in scrappie layout.
+
+    ..note:: the matrix must not be freed and the array must outlive it.
+    """
+    nc, nr = numpy_array.shape
+    nrq = (nr + vsize - 1) // vsize
+    matrix = ffi.new("scrappie_matrix", init=[nr, nrq, nc, vsize * nrq])
+    matrix.data.f = ffi.cast("float *", numpy_array.ctypes.data)
+    return matrix
+
+
 def _free_matrix(matrix):
     """Free a `scrappie_matrix`.
 
@@ -301,6 +367,38 @@ def calc_post(rt, model='rgrgr_r94', min_prob=1e-6, log=True, tempW=1.0, tempb=1
             return ScrappyMatrix(matrix)
 
 
+def _nthread(threads):
+    # 0 has the C library use the size of the OpenMP thread pool
+    return 0 if threads is None else threads
+
+
+def calc_post_batch(rts, model='rgrgr_r94', min_prob=1e-6, log=True, tempW=1.0, tempb=1.0,
+                    threads=None):
+    """Run a network over a batch of reads in parallel.
+
+    The reads are evaluated on the C library's OpenMP thread pool without
+    holding the GIL.
+
+    :param rts: list of trimmed and scaled `RawTable`.
+    :param threads: number of threads, default is the size of the OpenMP
+        thread pool (OMP_NUM_THREADS).
+
+    :returns: list of `ScrappyMatrix`, `None` for reads that failed.
+    """
+    if not log and model == 'rnnrf_r94':
+        raise ValueError("Returning non-log transformed matrix not supported for model type 'rnnrf_r94'.")
+    if not all(isinstance(rt, RawTable) for rt in rts):
+        raise TypeError('`rts` should be a list of RawTable.')
+    if model not in _models_:
+        raise KeyError("Model type '{}' not recognised.".format(model))
+
+    p_rts = ffi.new("raw_table[]", [rt.data() for rt in rts])
+    posts = ffi.new("scrappie_matrix[]", len(rts))
+    lib.scrappy_posterior_batch(p_rts, len(rts), model.encode(), min_prob, tempW, tempb, log,
+                                _nthread(threads), posts)
+    return [ScrappyMatrix(posts[i]) if posts[i] != ffi.NULL else None for i in range(len(rts))]
+
+
 def decode_post(post, model='rgrgr_r94', **kwargs):
     """Decode a posterior to retrieve basecall, score, and states. This
     function merely dispatches to a relevant function governed by the model.
@@ -367,6 +465,32 @@ def _decode_post_crf(post):
     return ffi.string(basecall).decode(), score, pos
 
 
+def decode_post_crf_quality(post):
+    """Decode a posterior of a conditional random field, with the quality of
+    each base, in a single fused pass over the transitions.
+
+    :param post: a `ScrappyMatrix` containing CRF transitions.
+
+    :returns: tuple containing (basecall, FASTQ quality string, score, call
+        positions per raw data block). The basecall, score and positions are
+        as `decode_post` with model 'rnnrf_r94'.
+    """
+    if not isinstance(post, ScrappyMatrix):
+        raise TypeError('`post` should be a ScrappyMatrix.')
+    nblock, nstate = post.shape
+
+    path = ffi.new("int[{}]".format(nblock + 1))
+    perr = ffi.new("float[{}]".format(nblock + 1))
+    score = lib.decode_crf_quality(post.data(), path, perr)
+
+    pos = np.ascontiguousarray(np.zeros(nblock + 1, dtype=np.int32))
+    p_pos = ffi.cast("int *", ffi.from_buffer(pos))
+    basecall = lib.crfpath_to_basecall(path, nblock, p_pos)
+    quality = lib.crfpath_to_quality(path, perr, nblock)
+
+    return ffi.string(basecall).decode(), ffi.string(quality).decode(), score, pos
+
+
 # Network and decoder functions used above
 _models_ = {
     'rgrgr_r94': lib.nanonet_rgrgr_r94_posterior,
@@ -429,6 +553,46 @@ def basecall_raw(data, model='rgrgr_r94', with_base_probs=False, **kwargs):
 
     return seq, score, pos, raw.start, raw.end, base_probs
 
+def basecall_raw_batch(datas, model='rgrgr_r94', threads=None, min_prob=1e-6,
+                       stay_pen=0.0, skip_pen=0.0, local_pen=2.0, use_slip=False):
+    """Basecall a batch of reads in parallel.
+
+    Each read is called as `basecall_raw` would, but the networks and
+    decoding of all reads run on the C library's OpenMP thread pool without
+    holding the GIL.
+
+    :param datas: list of `ndarray` containing raw signal data.
+    :param model: model to use in calculating basecall.
+    :param threads: number of threads, default is the size of the OpenMP
+        thread pool (OMP_NUM_THREADS).
+    :param stay_pen, skip_pen, local_pen, use_slip: see `_decode_post`,
+        only used by transducer models.
+
+    :returns: list of tuples, as `basecall_raw` without base probabilities,
+        containing (basecall, score, per-block call positions, data start
+        index, data end index, `None`). Reads that failed are `None`.
+    """
+    if model not in _models_:
+        raise KeyError("Model type '{}' not recognised.".format(model))
+
+    raws = [RawTable(data).trim().scale() for data in datas]
+    p_rts = ffi.new("raw_table[]", [raw.data() for raw in raws])
+    calls = ffi.new("scrappy_basecall[]", len(raws))
+    lib.scrappy_basecall_batch(p_rts, len(raws), model.encode(), min_prob, stay_pen, skip_pen,
+                               local_pen, use_slip, _nthread(threads), calls)
+
+    results = []
+    for raw, call in zip(raws, calls):
+        if call.basecall == ffi.NULL:
+            results.append(None)
+            continue
+        pos = np.frombuffer(ffi.buffer(call.pos, ffi.sizeof("int") * (call.nblock + 1)),
+                            dtype=np.int32).copy()
+        results.append((ffi.string(call.basecall).decode(), call.score, pos, raw.start, raw.end, None))
+        lib.scrappy_free_basecall(ffi.addressof(call))
+    return results
+
+
 def basecall_raw_python(data):
     """Basecall from raw data in a numpy array with python implementation of Viterbi.
     also verifies that the basecall matches that of C implementation
@@ -449,10 +613,12 @@ def basecall_raw_python(data):
 
     return seq
 
-def basecall_raw_viterbi_conv(data, PATH_TO_CPP_EXEC,msg_len):
+def basecall_raw_viterbi_conv(data, PATH_TO_CPP_EXEC,msg_len, band=0):
     """Basecall from raw data in a numpy array with convolutional code decoding using Viterbi.
 
     :param data: `ndarray` containing raw signal data.
+    :param band: number of trellis positions either side of the expected
+        position searched at each block, 0 to search all positions.
 
     :returns: basecall (in bits)
     """
@@ -473,7 +639,7 @@ def basecall_raw_viterbi_conv(data, PATH_TO_CPP_EXEC,msg_len):
         for v in r:
             f.write(struct.pack('f',v))
     f.close()
-    subprocess.run([PATH_TO_CPP_EXEC,'decode','tmp.'+rnd,'tmp.dec.'+rnd,str(msg_len)])
+    subprocess.run([PATH_TO_CPP_EXEC,'decode','tmp.'+rnd,'tmp.dec.'+rnd,str(msg_len),str(band)])
     with open('tmp.dec.'+rnd) as f:
         seq = f.read()
     os.remove('tmp.'+rnd)    
@@ -901,7 +1067,7 @@ def sequence_to_squiggle(sequence, model='squiggle_r94', rescale=False):
 
 def map_signal_to_squiggle(data, sequence, model='squiggle_r94', rate=1.0,
                            back_prob=0.0, local_pen=2.0, skip_pen=5000.0,
-                           min_score=5.0):
+                           min_score=5.0, band=0):
     """Align a squiggle to a sequence using a simulated squiggle.
 
     :param data: `ndarray` containing raw signal data.
@@ -912,6 +1078,8 @@ def map_signal_to_squiggle(data, sequence, model='squiggle_r94', rate=1.0,
     :param local_pen: penalty for local alignment.
     :param skip_pen: penalty for skipping position in sequence.
     :param min_score: floor on match score.
+    :param band: width of band of squiggle positions considered for each
+        sample, 0 for unbanded.
 
     :returns: tuple containing (alignment score, alignment path)
     """
@@ -923,8 +1091,8 @@ def map_signal_to_squiggle(data, sequence, model='squiggle_r94', rate=1.0,
     path = np.ascontiguousarray(np.zeros(raw._rt.n, dtype=np.int32))
     p_path = ffi.cast("int32_t *", ffi.from_buffer(path))
 
-    score = lib.squiggle_match_viterbi(raw.data(), rate, squiggle.data(), back_prob,
-                                       local_pen, skip_pen, min_score, p_path)
+    score = lib.squiggle_match_viterbi_banded(raw.data(), rate, squiggle.data(), back_prob,
+                                              local_pen, skip_pen, min_score, band, p_path)
 
     return score, path
 
@@ -942,8 +1110,7 @@ def map_post_to_sequence(post, sequence, stay_pen=0, skip_pen=0, local_pen=4.0,
     :param skip_pen: penalty for two-state movement from one block to next.
     :param local_pen: penalty for local alignment through blocks
     :param viterbi: use Viterbi algorithm rather than forward.
-    :param path: calculate alignment path (only valid for `viterbi==True`
-        and `bands==None`).
+    :param path: calculate alignment path (only valid for `viterbi==True`).
     :param bands: two sequences containing lower and upper extremal allowed
         positions for each block. Should be length corresponding to number
         of blocks of `post`. If a single number is given, a diagonal band with
@@ -1005,11 +1172,12 @@ def map_post_to_sequence(post, sequence, stay_pen=0, skip_pen=0, local_pen=4.0,
             raise ValueError('Supplied banding structure is not valid.')
 
         if viterbi:
-            func = lib.map_to_sequence_viterbi_banded
+            score = lib.map_to_sequence_viterbi_banded(
+                post.data(), stay_pen, skip_pen, local_pen, p_seq, seq_len, p_poslow, p_poshigh,
+                p_path)
         else:
-            func = lib.map_to_sequence_forward_banded
-        score = func(
-            post.data(), stay_pen, skip_pen, local_pen, p_seq, seq_len, p_poslow, p_poshigh)
+            score = lib.map_to_sequence_forward_banded(
+                post.data(), stay_pen, skip_pen, local_pen, p_seq, seq_len, p_poslow, p_poshigh)
 
     score = _none_if_null(score)
     if score is None:
@@ -1051,11 +1219,25 @@ def _basecall():
         help='Number of threads to use.')
     parser.add_argument('--process', action='store_true',
         help='Use ProcesPool rather than ThreadPool.')
+    parser.add_argument('--batch', default=0, type=int,
+        help='Call reads in batches of this size on the C thread pool (0 is off).')
 
     args = parser.parse_args()
 
     worker = functools.partial(basecall_raw, model=args.model)
-    if args.threads is None:
+    if args.batch > 0:
+        reads = _raw_gen(args.fast5)
+        while True:
+            batch = list(itertools.islice(reads, args.batch))
+            if len(batch) == 0:
+                break
+            fnames, datas = zip(*batch)
+            results = basecall_raw_batch(datas, model=args.model, threads=args.threads)
+            for fname, res in zip(fnames, results):
+                if res is not None:
+                    seq, score, _, start, end, _ = res
+                    print(">{} {} {}-{}\n{}".format(fname, score, start, end, seq))
+    elif args.threads is None:
         for fname, data in _raw_gen(args.fast5):
             seq, score, _, start, end, _ = worker(data)
             print(">{} {} {}-{}\n{}".format(fname, score, start, end, seq))
@@ -134,6 +134,37 @@ class TestScrappy(unittest.TestCase):
                 pass
 
 
+    def test_031_batch_call(self):
+        datas = list(self.signals.values())
+        for model in (self.model, 'rnnrf_r94'):
+            expected = [scrappy.basecall_raw(data, model=model) for data in datas]
+            results = scrappy.basecall_raw_batch(datas, model=model, threads=2)
+            self.assertEqual(len(results), len(datas))
+            for res, exp in zip(results, expected):
+                self.assertEqual(res[0], exp[0], 'batch call is same as single call.')
+                self.assertAlmostEqual(res[1], exp[1], places=3)
+                np.testing.assert_array_equal(res[2], exp[2])
+                self.assertSequenceEqual(res[3:5], exp[3:5])
+
+        rts = [scrappy.RawTable(data).trim().scale() for data in datas]
+        posts = scrappy.calc_post_batch(rts, self.model, threads=2)
+        for rt, post in zip(rts, posts):
+            single = scrappy.calc_post(rt, self.model)
+            np.testing.assert_array_equal(post.view(), single.view())
+
+
+    def test_032_crf_quality(self):
+        rt = scrappy.RawTable(self.one_signal)
+        rt.trim().scale()
+        post = scrappy.calc_post(rt, 'rnnrf_r94', log=True)
+        seq, score, pos = scrappy.decode_post(post, 'rnnrf_r94')
+        qseq, qual, qscore, qpos = scrappy.decode_post_crf_quality(post)
+        self.assertEqual(qseq, seq, 'fused decoding gives same call.')
+        self.assertAlmostEqual(qscore, score, places=3)
+        self.assertEqual(len(qual), len(qseq), 'one quality per base.')
+        self.assertTrue(all('!' <= q <= 'S' for q in qual), 'qualities are Phred 0 to 50.')
+
+
     def test_040_squiggle_map_r94(self):
         # Just check mapping runs without fail
         score, path = scrappy.map_signal_to_squiggle(self.one_signal, self.one_ref, model='squiggle_r94')
@@ -234,4 +265,28 @@ class TestScrappy(unittest.TestCase):
         np.testing.assert_allclose(np_original[110:150,], np_smaller, err_msg='Slice contains correct data.')
 
 
+    def test_066_matrix_numpy_view(self):
+        rt = scrappy.RawTable(self.one_signal)
+        rt.trim().scale()
+        original = scrappy.calc_post(rt, self.model, log=True)
+
+        view = original.view()
+        self.assertSequenceEqual(view.shape, original.shape, 'View is (blocks, states).')
+        self.assertFalse(view.flags.owndata)
+        np.testing.assert_array_equal(view, original.data(as_numpy=True, sloika=False))
+        np.testing.assert_array_equal(original[100:200].view(), view[100:200])
+
+        # View shares memory and survives the matrix
+        view[0, 0] = 1.0
+        self.assertEqual(original.data(as_numpy=True, sloika=False)[0, 0], 1.0)
+        del original
+        self.assertEqual(view[0, 0], 1.0)
+
+        wrapped = scrappy.ScrappyMatrix(view, copy=False)
+        self.assertIsNotNone(wrapped._base, 'Padded view is used in place.')
+        copied = scrappy.ScrappyMatrix(view)
+        scores = [scrappy.decode_post(x)[1] for x in (wrapped, copied)]
+        self.assertEqual(scores[0], scores[1], 'Same score from wrapped and copied matrix.')
+
+
 
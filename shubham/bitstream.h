@@ -0,0 +1,253 @@
+// Bit streams packed 64 bits to a word, and their files, shared by
+// viterbi.cpp and viterbi_nanopore.cpp.
+//
+// Bit i of a stream is bit i % 64 of word i / 64. Streams are read from and
+// written to files in chunks, so messages need not be held in memory as a
+// whole. Three file formats are used:
+//   text    one character '0' or '1' per bit
+//   bases   one character ACGT per pair of bits b0 b1, base 2 * b0 + b1
+//   packed  the 8 byte magic "SCRPBITS", the number of bits as a 64-bit
+//           integer, then the words of the stream, in native byte order
+// Files of bits are read as text or packed, recognised by the magic.
+#ifndef SHUBHAM_BITSTREAM_H_
+#define SHUBHAM_BITSTREAM_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+const char bitstream_magic[8] = {'S', 'C', 'R', 'P', 'B', 'I', 'T', 'S'};
+// bits read or written at a time by the chunked readers and writers
+const uint64_t bitstream_chunk_bits = (uint64_t)1 << 23;
+
+enum class bit_format_t { text, bases, packed };
+
+inline bit_format_t parse_bit_format(const std::string &str) {
+  if (str == "text") return bit_format_t::text;
+  if (str == "bases") return bit_format_t::bases;
+  if (str == "packed") return bit_format_t::packed;
+  throw std::runtime_error("format must be text, bases or packed");
+}
+
+class bitstream_t {
+ public:
+  bitstream_t() = default;
+  explicit bitstream_t(const uint64_t n) : nbit(n), data((n + 63) / 64, 0) {}
+  explicit bitstream_t(const std::vector<bool> &bits) : bitstream_t(bits.size()) {
+    for (uint64_t i = 0; i < nbit; i++)
+      if (bits[i]) data[i / 64] |= (uint64_t)1 << (i % 64);
+  }
+
+  uint64_t size() const { return nbit; }
+  bool empty() const { return nbit == 0; }
+  bool operator[](const uint64_t i) const { return (data[i / 64] >> (i % 64)) & 1; }
+  void set(const uint64_t i, const bool b) {
+    const uint64_t m = (uint64_t)1 << (i % 64);
+    data[i / 64] = b ? (data[i / 64] | m) : (data[i / 64] & ~m);
+  }
+  void push_back(const bool b) { append(b, 1); }
+  // append the n low bits of bits, lowest first, for n up to 64
+  void append(const uint64_t bits, const uint32_t n) {
+    if (n == 0) return;
+    const uint64_t v = (n < 64) ? (bits & (((uint64_t)1 << n) - 1)) : bits;
+    const uint32_t off = nbit % 64;
+    if (off == 0) data.push_back(0);
+    data.back() |= v << off;
+    if (off + n > 64) data.push_back(v >> (64 - off));
+    nbit += n;
+  }
+  // n bits from position i, up to 64, bit i lowest
+  uint64_t get(const uint64_t i, const uint32_t n) const {
+    if (n == 0) return 0;
+    const uint32_t off = i % 64;
+    uint64_t v = data[i / 64] >> off;
+    if (off + n > 64) v |= data[i / 64 + 1] << (64 - off);
+    return (n < 64) ? (v & (((uint64_t)1 << n) - 1)) : v;
+  }
+  void append(const bitstream_t &other) {
+    uint64_t i = 0;
+    for (; i + 64 <= other.nbit; i += 64) append(other.get(i, 64), 64);
+    append(other.get(i, other.nbit - i), other.nbit - i);
+  }
+  void resize(const uint64_t n) {
+    data.resize((n + 63) / 64, 0);
+    if (n % 64 != 0) data.back() &= ((uint64_t)1 << (n % 64)) - 1;
+    nbit = n;
+  }
+  void clear() { resize(0); }
+  void reserve(const uint64_t n) { data.reserve((n + 63) / 64); }
+  std::vector<bool> to_vector() const {
+    std::vector<bool> bits(nbit);
+    for (uint64_t i = 0; i < nbit; i++) bits[i] = (*this)[i];
+    return bits;
+  }
+  const uint64_t *words() const { return data.data(); }
+  uint64_t *words() { return data.data(); }
+
+ private:
+  uint64_t nbit = 0;
+  std::vector<uint64_t> data;
+};
+
+// Read a file of bits, text or packed, a chunk at a time
+class bitstream_reader {
+ public:
+  explicit bitstream_reader(const std::string &infile)
+      : fh(std::fopen(infile.c_str(), "rb")) {
+    if (fh == nullptr) throw std::runtime_error("failed to open " + infile);
+    char magic[sizeof(bitstream_magic)];
+    const size_t nmagic = std::fread(magic, 1, sizeof(magic), fh);
+    if (nmagic == sizeof(magic) &&
+        std::memcmp(magic, bitstream_magic, sizeof(magic)) == 0) {
+      packed = true;
+      if (std::fread(&remaining, sizeof(remaining), 1, fh) != 1)
+        throw std::runtime_error("truncated packed bit file " + infile);
+    } else {
+      // characters read while looking for a magic are bits of a text file
+      text.assign(magic, magic + nmagic);
+      text_used = nmagic;
+    }
+  }
+  ~bitstream_reader() { std::fclose(fh); }
+  bitstream_reader(const bitstream_reader &) = delete;
+  bitstream_reader &operator=(const bitstream_reader &) = delete;
+
+  // replace chunk with up to max_bits further bits, false at end of file
+  bool read(bitstream_t &chunk, const uint64_t max_bits = bitstream_chunk_bits) {
+    chunk.clear();
+    if (packed) {
+      const uint64_t n = (remaining < max_bits) ? remaining : max_bits;
+      // chunks other than the last are whole words, so are read directly
+      const uint64_t nread = (n < remaining) ? n - n % 64 : n;
+      if (nread == 0) return false;
+      chunk.resize(nread);
+      const uint64_t nword = (nread + 63) / 64;
+      if (std::fread(chunk.words(), sizeof(uint64_t), nword, fh) != nword)
+        throw std::runtime_error("truncated packed bit file");
+      chunk.resize(nread);
+      remaining -= nread;
+      return true;
+    }
+    const uint64_t nmax = (max_bits > text_used) ? max_bits : text_used;
+    text.resize(nmax);
+    const size_t nread = text_used + std::fread(text.data() + text_used, 1, nmax - text_used, fh);
+    text_used = 0;
+    chunk.reserve(nread);
+    uint64_t word = 0;
+    uint32_t nw = 0;
+    for (size_t i = 0; i < nread; i++) {
+      const char c = text[i];
+      if (c != '0' && c != '1')
+        throw std::runtime_error("invalid character in input file");
+      word |= (uint64_t)(c == '1') << nw;
+      if (++nw == 64) {
+        chunk.append(word, 64);
+        word = 0;
+        nw = 0;
+      }
+    }
+    chunk.append(word, nw);
+    return !chunk.empty();
+  }
+
+ private:
+  std::FILE *fh = nullptr;
+  bool packed = false;
+  uint64_t remaining = 0;
+  // buffer of characters of a text file, the first text_used of which were
+  // read by the constructor while looking for a magic
+  std::vector<char> text;
+  size_t text_used = 0;
+};
+
+// Write a file of bits, in any format, a chunk at a time
+class bitstream_writer {
+ public:
+  bitstream_writer(const std::string &outfile, const bit_format_t format)
+      : fh(std::fopen(outfile.c_str(), "wb")), format(format) {
+    if (fh == nullptr) throw std::runtime_error("failed to open " + outfile);
+    if (format == bit_format_t::packed) {
+      // number of bits is filled in by close
+      const uint64_t nbit = 0;
+      std::fwrite(bitstream_magic, 1, sizeof(bitstream_magic), fh);
+      std::fwrite(&nbit, sizeof(nbit), 1, fh);
+    }
+  }
+  ~bitstream_writer() {
+    if (fh != nullptr) std::fclose(fh);
+  }
+  bitstream_writer(const bitstream_writer &) = delete;
+  bitstream_writer &operator=(const bitstream_writer &) = delete;
+
+  void write(const bitstream_t &chunk) {
+    pending.append(chunk);
+    flush(false);
+  }
+  void close() {
+    flush(true);
+    if (format == bit_format_t::packed) {
+      if (std::fseek(fh, sizeof(bitstream_magic), SEEK_SET) != 0 ||
+          std::fwrite(&nwritten, sizeof(nwritten), 1, fh) != 1)
+        throw std::runtime_error("failed to write packed bit file");
+    }
+    const bool ok = std::fclose(fh) == 0;
+    fh = nullptr;
+    if (!ok) throw std::runtime_error("failed to write bit file");
+  }
+
+ private:
+  // write the pending bits, keeping back a partial word or base unless last
+  void flush(const bool last) {
+    const uint64_t n = pending.size();
+    if (format == bit_format_t::bases && last && n % 2 != 0)
+      throw std::runtime_error("length not even");
+    const uint64_t nout =
+        last ? n : ((format == bit_format_t::packed) ? n - n % 64 : n - n % 2);
+    if (nout == 0) return;
+    bool ok = true;
+    if (format == bit_format_t::packed) {
+      const uint64_t nword = (nout + 63) / 64;
+      ok = std::fwrite(pending.words(), sizeof(uint64_t), nword, fh) == nword;
+    } else {
+      const char *digits = (format == bit_format_t::bases) ? "ACGT" : "01";
+      const uint32_t step = (format == bit_format_t::bases) ? 2 : 1;
+      chars.resize(nout / step);
+      for (uint64_t i = 0, c = 0; i < nout; i += step, c++) {
+        // bases have the first bit of each pair as the high bit
+        const uint64_t v = pending.get(i, step);
+        chars[c] = digits[(step == 2) ? 2 * (v & 1) + (v >> 1) : v];
+      }
+      ok = std::fwrite(chars.data(), 1, chars.size(), fh) == chars.size();
+    }
+    if (!ok) throw std::runtime_error("failed to write bit file");
+    nwritten += nout;
+    bitstream_t rest;
+    for (uint64_t i = nout; i < n; i++) rest.push_back(pending[i]);
+    pending = rest;
+  }
+
+  std::FILE *fh = nullptr;
+  bit_format_t format;
+  bitstream_t pending;
+  std::vector<char> chars;
+  uint64_t nwritten = 0;
+};
+
+inline bitstream_t read_bitstream(const std::string &infile) {
+  bitstream_reader reader(infile);
+  bitstream_t bits, chunk;
+  while (reader.read(chunk)) bits.append(chunk);
+  return bits;
+}
+
+inline void write_bitstream(const bitstream_t &bits, const std::string &outfile,
+                            const bit_format_t format) {
+  bitstream_writer writer(outfile, format);
+  writer.write(bits);
+  writer.close();
+}
+
+#endif  // SHUBHAM_BITSTREAM_H_
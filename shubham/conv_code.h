@@ -0,0 +1,386 @@
+// Convolutional codes shared by viterbi.cpp and viterbi_nanopore.cpp.
+//
+// Each code is a template on its memory and generator polynomials so the
+// trellis tables are computed at compile time. The codes used in our
+// simulations are all instantiated and one is picked at runtime with
+// --mem and --gen, along with the initial state and sync markers. An outer
+// CRC can be carried in the message (--crc) and checked by list decoding
+// (--list). Messages are encoded as streams, a chunk at a time, and files of
+// bits are read and written as text or packed (see bitstream.h).
+// Needs C++14, e.g. g++ -O3 -std=c++14 viterbi_nanopore.cpp
+#ifndef SHUBHAM_CONV_CODE_H_
+#define SHUBHAM_CONV_CODE_H_
+
+#include <emmintrin.h>
+
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "bitstream.h"
+
+const uint8_t n_out_conv = 2;
+
+// memory, generator polynomials (octal) of the precompiled codes. The first
+// code listed for a memory is used when no generator is given.
+#define CONV_CODE_LIST(X) \
+  X(6, 0171, 0133)        /* mem 6 from CCSDS */ \
+  X(8, 0515, 0677)        /* mem 8 from GL paper */ \
+  X(11, 05537, 06131)     /* mem 11 from GL paper */ \
+  X(14, 075063, 056711)   /* mem 14 from GL paper */
+
+constexpr uint8_t parity(const uint32_t x) {
+  return (x == 0) ? 0 : (x & 1) ^ parity(x >> 1);
+}
+
+template <uint32_t nstate>
+struct conv_tables_t {
+  uint32_t prev_state[nstate][2];
+  uint32_t next_state[nstate][2];
+  uint8_t output[n_out_conv][nstate][2];
+  // output of the transition into each state from prev_state[state][bit]
+  // as a base 2 * output[0] + output[1], laid out for vector loads
+  uint32_t base_in[2][nstate];
+};
+
+template <uint8_t mem, uint32_t G0, uint32_t G1>
+constexpr conv_tables_t<(uint32_t)1 << mem> make_conv_tables() {
+  constexpr uint32_t nstate = (uint32_t)1 << mem;
+  conv_tables_t<nstate> tables{};
+  for (uint32_t cur_state = 0; cur_state < nstate; cur_state++) {
+    tables.next_state[cur_state][0] = (cur_state >> 1);
+    tables.next_state[cur_state][1] = ((cur_state | nstate) >> 1);
+    tables.prev_state[cur_state][0] = (cur_state << 1) & (nstate - 1);
+    tables.prev_state[cur_state][1] = ((cur_state << 1) | 1) & (nstate - 1);
+    tables.output[0][cur_state][0] = parity(cur_state & G0);
+    tables.output[0][cur_state][1] = parity((cur_state | nstate) & G0);
+    tables.output[1][cur_state][0] = parity(cur_state & G1);
+    tables.output[1][cur_state][1] = parity((cur_state | nstate) & G1);
+  }
+  for (uint32_t cur_state = 0; cur_state < nstate; cur_state++) {
+    const uint32_t curr_bit = cur_state >> (mem - 1);
+    for (uint32_t bit = 0; bit < 2; bit++) {
+      const uint32_t prev = tables.prev_state[cur_state][bit];
+      tables.base_in[bit][cur_state] = 2 * tables.output[0][prev][curr_bit] +
+                                       tables.output[1][prev][curr_bit];
+    }
+  }
+  return tables;
+}
+
+template <uint8_t MEM, uint32_t G0, uint32_t G1>
+struct conv_code {
+  static constexpr uint8_t mem = MEM;
+  static constexpr uint32_t nstate = (uint32_t)1 << MEM;
+  static constexpr conv_tables_t<nstate> tables =
+      make_conv_tables<MEM, G0, G1>();
+};
+
+template <uint8_t MEM, uint32_t G0, uint32_t G1>
+constexpr conv_tables_t<conv_code<MEM, G0, G1>::nstate>
+    conv_code<MEM, G0, G1>::tables;
+
+// One add-compare-select step of hard decision Viterbi decoding, four states
+// at a time. A state whose newest (top) bit is b is reached from the two
+// states 2c and 2c + 1, where c is the state without its top bit, so each
+// pair of vectors of previous scores is deinterleaved once and used for both
+// values of b. Scores are the negated number of bit errors.
+//   received: the two channel output bits as a base 2 * r0 + r1
+//   sync_ok: whether each value of the message bit is allowed at this step
+template <class code>
+void viterbi_acs_step(const float *prev_score, float *curr_score,
+                      uint32_t *traceback, const uint32_t received,
+                      const bool sync_ok[2]) {
+  static_assert(code::nstate % 8 == 0, "vectorised code needs 8 states");
+  const uint32_t half = code::nstate / 2;
+  const __m128 neg_inf = _mm_set1_ps(-std::numeric_limits<float>::infinity());
+  const __m128i recv = _mm_set1_epi32(received);
+  const __m128i one = _mm_set1_epi32(1);
+  for (uint32_t c = 0; c < half; c += 4) {
+    const __m128 lo = _mm_loadu_ps(prev_score + 2 * c);
+    const __m128 hi = _mm_loadu_ps(prev_score + 2 * c + 4);
+    const __m128 src[2] = {_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)),
+                           _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1))};
+    const __m128i src_idx0 =
+        _mm_add_epi32(_mm_set1_epi32(2 * c), _mm_setr_epi32(0, 2, 4, 6));
+    const __m128i src_idx1 = _mm_add_epi32(src_idx0, one);
+    for (uint32_t bit = 0; bit < 2; bit++) {
+      const uint32_t st2 = c + bit * half;
+      __m128i *tb = (__m128i *)(traceback + st2);
+      if (!sync_ok[bit]) {
+        _mm_storeu_ps(curr_score + st2, neg_inf);
+        _mm_storeu_si128(tb, _mm_setzero_si128());
+        continue;
+      }
+      __m128 score[2];
+      for (uint32_t prev_bit = 0; prev_bit < 2; prev_bit++) {
+        const __m128i diff = _mm_xor_si128(
+            _mm_loadu_si128((const __m128i *)(code::tables.base_in[prev_bit] + st2)),
+            recv);
+        const __m128i nerr =
+            _mm_add_epi32(_mm_and_si128(diff, one), _mm_srli_epi32(diff, 1));
+        score[prev_bit] = _mm_sub_ps(src[prev_bit], _mm_cvtepi32_ps(nerr));
+      }
+      // ties go to the first previous state, as in the scalar decoder
+      const __m128 better = _mm_cmpgt_ps(score[1], score[0]);
+      const __m128i better_i = _mm_castps_si128(better);
+      _mm_storeu_ps(curr_score + st2, _mm_or_ps(_mm_and_ps(better, score[1]),
+                                                _mm_andnot_ps(better, score[0])));
+      _mm_storeu_si128(tb, _mm_or_si128(_mm_and_si128(better_i, src_idx1),
+                                        _mm_andnot_si128(better_i, src_idx0)));
+    }
+  }
+}
+
+// parameters of the code that are chosen at runtime
+struct conv_config_t {
+  uint8_t mem;
+  uint32_t G[n_out_conv];  // 0 to use the default generator for mem
+  uint32_t initial_state;
+  std::vector<bool> sync_marker;
+  uint32_t sync_marker_period;
+  // bits of CRC in the last data (not sync marker) bits of the message, 0
+  // for no CRC
+  uint32_t crc_width = 0;
+  // paths kept per state when decoding, the best passing the CRC is chosen
+  uint32_t list_size = 1;
+  // format of bit files written, text, bases or packed, empty for the
+  // default of each mode
+  std::string output_format;
+};
+
+inline bit_format_t output_format(const conv_config_t &config,
+                                  const bit_format_t default_format) {
+  return config.output_format.empty() ? default_format
+                                      : parse_bit_format(config.output_format);
+}
+
+const uint32_t max_list_size = 16;
+
+// whether a message bit is allowed at position pos given the sync markers
+inline bool sync_allows(const conv_config_t &config, const uint32_t pos,
+                        const bool bit) {
+  if (config.sync_marker.empty()) return true;
+  const uint32_t i = pos % config.sync_marker_period;
+  return i >= config.sync_marker.size() || bit == config.sync_marker[i];
+}
+
+// positions of the message not taken by sync markers, which carry the data
+// and the CRC
+inline std::vector<uint32_t> data_positions(const conv_config_t &config,
+                                            const uint32_t msg_len) {
+  std::vector<uint32_t> pos;
+  for (uint32_t i = 0; i < msg_len; i++) {
+    const bool is_sync = !config.sync_marker.empty() &&
+                         i % config.sync_marker_period < config.sync_marker.size();
+    if (!is_sync) pos.push_back(i);
+  }
+  return pos;
+}
+
+// CRC of bits, most significant bit first, with zero initial value
+inline uint32_t crc_of_bits(const std::vector<bool> &bits, const uint32_t width) {
+  uint32_t poly;
+  switch (width) {
+    case 8: poly = 0x07; break;                // CRC-8
+    case 16: poly = 0x1021; break;             // CRC-16-CCITT
+    case 32: poly = 0x04C11DB7; break;         // CRC-32
+    default: throw std::runtime_error("CRC width must be 8, 16 or 32");
+  }
+  const uint64_t mask = ((uint64_t)1 << width) - 1;
+  uint64_t reg = 0;
+  for (bool bit : bits) {
+    const bool feedback = ((reg >> (width - 1)) & 1) ^ bit;
+    reg = (reg << 1) & mask;
+    if (feedback) reg ^= poly;
+  }
+  return (uint32_t)reg;
+}
+
+// Split the data bits of msg into those covered by the CRC and the CRC
+// stored in the last crc_width data bits
+inline void split_crc(const std::vector<bool> &msg, const conv_config_t &config,
+                      std::vector<bool> &payload, uint32_t &stored) {
+  const std::vector<uint32_t> pos = data_positions(config, msg.size());
+  if (pos.size() < config.crc_width)
+    throw std::runtime_error("message too short for CRC");
+  const uint32_t npayload = pos.size() - config.crc_width;
+  payload.clear();
+  for (uint32_t i = 0; i < npayload; i++) payload.push_back(msg[pos[i]]);
+  stored = 0;
+  for (uint32_t i = npayload; i < pos.size(); i++)
+    stored = (stored << 1) | msg[pos[i]];
+}
+
+inline bool check_crc(const std::vector<bool> &msg, const conv_config_t &config) {
+  if (config.crc_width == 0) return true;
+  std::vector<bool> payload;
+  uint32_t stored;
+  split_crc(msg, config, payload, stored);
+  return crc_of_bits(payload, config.crc_width) == stored;
+}
+
+// overwrite the last crc_width data bits of msg with the CRC of the others
+inline void set_crc(std::vector<bool> &msg, const conv_config_t &config) {
+  std::vector<bool> payload;
+  uint32_t stored;
+  split_crc(msg, config, payload, stored);
+  const uint32_t crc = crc_of_bits(payload, config.crc_width);
+  const std::vector<uint32_t> pos = data_positions(config, msg.size());
+  for (uint32_t i = 0; i < config.crc_width; i++)
+    msg[pos[pos.size() - 1 - i]] = (crc >> i) & 1;
+}
+
+inline std::vector<bool> parse_bits(const std::string &str) {
+  std::vector<bool> bits;
+  for (char c : str) {
+    if (c != '0' && c != '1')
+      throw std::runtime_error("invalid bit string " + str);
+    bits.push_back(c == '1');
+  }
+  return bits;
+}
+
+// Remove --mem, --gen, --init, --sync, --period, --crc, --list and --format options
+// from the command line, updating config, and return the remaining
+// arguments.
+//   --mem 11          memory of code
+//   --gen 05537,06131 generator polynomials in octal
+//   --init 10010110   initial state in binary
+//   --sync 110        sync marker bits, or none
+//   --period 9        period of sync markers
+//   --crc 16          width of CRC at end of message (8, 16 or 32)
+//   --list 8          paths kept per state by list decoding
+//   --format packed   format of bit files written: text, bases or packed
+inline std::vector<std::string> parse_conv_options(int argc, char **argv,
+                                                   conv_config_t &config) {
+  std::vector<std::string> args;
+  bool mem_given = false, gen_given = false;
+  for (int i = 0; i < argc; i++) {
+    std::string arg(argv[i]);
+    if (arg.compare(0, 2, "--") != 0) {
+      args.push_back(arg);
+      continue;
+    }
+    if (i + 1 >= argc) throw std::runtime_error("no value for option " + arg);
+    std::string val(argv[++i]);
+    if (arg == "--mem") {
+      config.mem = std::stoul(val);
+      mem_given = true;
+    } else if (arg == "--gen") {
+      size_t comma = val.find(',');
+      if (comma == std::string::npos)
+        throw std::runtime_error("--gen expects two octal polynomials G0,G1");
+      config.G[0] = std::stoul(val.substr(0, comma), nullptr, 8);
+      config.G[1] = std::stoul(val.substr(comma + 1), nullptr, 8);
+      gen_given = true;
+    } else if (arg == "--init") {
+      config.initial_state = std::stoul(val, nullptr, 2);
+    } else if (arg == "--sync") {
+      config.sync_marker = (val == "none") ? std::vector<bool>() : parse_bits(val);
+    } else if (arg == "--period") {
+      config.sync_marker_period = std::stoul(val);
+    } else if (arg == "--crc") {
+      config.crc_width = std::stoul(val);
+      if (config.crc_width != 8 && config.crc_width != 16 &&
+          config.crc_width != 32)
+        throw std::runtime_error("CRC width must be 8, 16 or 32");
+    } else if (arg == "--format") {
+      parse_bit_format(val);
+      config.output_format = val;
+    } else if (arg == "--list") {
+      config.list_size = std::stoul(val);
+      if (config.list_size < 1 || config.list_size > max_list_size)
+        throw std::runtime_error("list size must be between 1 and " +
+                                 std::to_string(max_list_size));
+    } else {
+      throw std::runtime_error("unknown option " + arg);
+    }
+  }
+  if (mem_given && !gen_given) config.G[0] = config.G[1] = 0;
+  if (!config.sync_marker.empty() &&
+      config.sync_marker_period < config.sync_marker.size())
+    throw std::runtime_error("sync marker longer than its period");
+  if (config.initial_state >> config.mem)
+    throw std::runtime_error("initial state has more bits than memory");
+  return args;
+}
+
+// Streaming encoder. Bits are encoded as they are given, in chunks of any
+// length, the state being carried from one chunk to the next; finish adds
+// the terminating bits that return the encoder to state 0. Each message bit
+// gives the two output bits output[0] then output[1] of its transition,
+// looked up together and gathered into whole words of output.
+template <class code>
+class conv_encoder_t {
+ public:
+  explicit conv_encoder_t(const uint32_t initial_state) : state(initial_state) {
+    for (uint32_t st = 0; st < code::nstate; st++)
+      for (uint32_t bit = 0; bit < 2; bit++)
+        out_pair[st][bit] = code::tables.output[0][st][bit] |
+                        (code::tables.output[1][st][bit] << 1);
+  }
+
+  // append the encoding of bits to out
+  void encode(const bitstream_t &bits, bitstream_t &out) {
+    out.reserve(out.size() + n_out_conv * bits.size());
+    for (uint64_t i = 0; i < bits.size(); i += 32) {
+      const uint32_t n = (bits.size() - i < 32) ? bits.size() - i : 32;
+      uint64_t word = bits.get(i, n), encoded = 0;
+      for (uint32_t j = 0; j < n; j++, word >>= 1) {
+        const uint32_t bit = word & 1;
+        encoded |= (uint64_t)out_pair[state][bit] << (2 * j);
+        state = code::tables.next_state[state][bit];
+      }
+      out.append(encoded, 2 * n);
+    }
+  }
+
+  // append terminating bits to out, throwing if they fail to reach state 0
+  void finish(bitstream_t &out) {
+    encode(bitstream_t(code::mem), out);
+    if (state != 0) throw std::runtime_error("state after encoding not 0");
+  }
+
+ private:
+  uint32_t state;
+  uint8_t out_pair[code::nstate][2];
+};
+
+// Encode the message in infile, a chunk at a time, writing the channel
+// output to outfile
+template <class code>
+void encode_file(const std::string &infile, const std::string &outfile,
+                 const conv_config_t &config, const bit_format_t format) {
+  bitstream_reader reader(infile);
+  bitstream_writer writer(outfile, format);
+  conv_encoder_t<code> encoder(config.initial_state);
+  bitstream_t chunk, encoded;
+  while (reader.read(chunk)) {
+    encoded.clear();
+    encoder.encode(chunk, encoded);
+    writer.write(encoded);
+  }
+  encoded.clear();
+  encoder.finish(encoded);
+  writer.write(encoded);
+  writer.close();
+}
+
+// Call f.template run<code>() for the precompiled code matching config
+template <class F>
+int dispatch_conv_code(const conv_config_t &config, const F &f) {
+#define DISPATCH_CONV_CODE(M, G0, G1)                                   \
+  if (config.mem == M &&                                                \
+      ((config.G[0] == G0 && config.G[1] == G1) ||                      \
+       (config.G[0] == 0 && config.G[1] == 0)))                         \
+    return f.template run<conv_code<M, G0, G1>>();
+  CONV_CODE_LIST(DISPATCH_CONV_CODE)
+#undef DISPATCH_CONV_CODE
+  throw std::runtime_error(
+      "no precompiled convolutional code for given memory and generator");
+}
+
+#endif  // SHUBHAM_CONV_CODE_H_
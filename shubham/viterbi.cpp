@@ -6,125 +6,75 @@
 #include <stdexcept>
 #include <limits>
 
-// convolutional code related parameters
-const uint8_t mem_conv = 6;
-const uint8_t nstate_conv = 64;
-const uint8_t n_out_conv = 2;
-typedef std::array<std::array<uint8_t,2>,nstate_conv> conv_arr_t;
-const uint8_t G[n_out_conv] = {0171, 0133};//octal
+#include "conv_code.h"
 
-void generate_conv_arrays(conv_arr_t &prev_state, conv_arr_t &next_state, conv_arr_t *output);
-std::vector<bool> encode(std::vector<bool> &msg, conv_arr_t&next_state, conv_arr_t *output);
-std::vector<bool> read_bit_array(std::string &infile);
-void write_bit_array(std::vector<bool> &outvec, std::string &outfile);
-std::vector<bool> viterbi_decode(std::vector<bool> &channel_output, conv_arr_t&prev_state, conv_arr_t&next_state, conv_arr_t *output);
+// convolutional code related parameters, defaults can be changed with
+// --mem, --gen, --init, --sync and --period (see conv_code.h)
+const conv_config_t default_config = {6, {0171, 0133}, 0, {}, 0}; // mem 6 from CCSDS
 
-int main(int argc, char **argv) {
-    // generate convolutional code matrices
-    conv_arr_t prev_state, next_state, output[n_out_conv];
-    generate_conv_arrays(prev_state, next_state, output);
-    if (argc < 4) throw std::runtime_error("not enough arguments. Call as ./a.out [encode/decode] infile outfile");
-    std::string mode = std::string(argv[1]);
-    if (mode != "encode" && mode != "decode")
-        throw std::runtime_error("invalid mode");
-    std::string infile = std::string(argv[2]), outfile = std::string(argv[3]);
-    if (mode == "encode") {
-        std::vector<bool> msg = read_bit_array(infile);
-        std::vector<bool> encoded_msg = encode(msg, next_state, output);
-        write_bit_array(encoded_msg, outfile);
-    }
-    if (mode == "decode") {
-        std::vector<bool> channel_output = read_bit_array(infile);
-        std::vector<bool> decoded_msg = viterbi_decode(channel_output, prev_state, next_state, output);
-        write_bit_array(decoded_msg, outfile);
-    }
-    return 0;
-}
+template <class code>
+std::vector<bool> viterbi_decode(std::vector<bool> &channel_output, const conv_config_t &config);
 
-void generate_conv_arrays(conv_arr_t &prev_state, conv_arr_t &next_state, conv_arr_t *output) {
-    for (uint8_t cur_state = 0; cur_state < nstate_conv; cur_state++) {
-        next_state[cur_state][0] = (cur_state>>1);
-        next_state[cur_state][1] = ((cur_state|nstate_conv)>>1);
-        prev_state[cur_state][0] = (cur_state<<1)&(nstate_conv-1);
-        prev_state[cur_state][1] = ((cur_state<<1)|1)&(nstate_conv-1);
-        output[0][cur_state][0] = __builtin_parity((cur_state&G[0]));
-        output[0][cur_state][1] = __builtin_parity(((cur_state|nstate_conv)&G[0]));
-        output[1][cur_state][0] = __builtin_parity((cur_state&G[1]));
-        output[1][cur_state][1] = __builtin_parity(((cur_state|nstate_conv)&G[1]));
-    } 
-    return;
-}
+// encode or decode with the convolutional code chosen at runtime
+struct conv_main_t {
+    std::string mode, infile, outfile;
+    conv_config_t config;
 
-std::vector<bool> encode(std::vector<bool> &msg, conv_arr_t&next_state, conv_arr_t *output) {
-    std::vector<bool> encoded_msg;
-    uint8_t cur_state = 0;
-    for (bool msg_bit : msg) {
-        encoded_msg.push_back(output[0][cur_state][msg_bit]);
-        encoded_msg.push_back(output[1][cur_state][msg_bit]);
-        cur_state = next_state[cur_state][msg_bit];
-    }
-    // add terminating bits
-    for (uint8_t i = 0; i < mem_conv; i++) { 
-        encoded_msg.push_back(output[0][cur_state][0]);
-        encoded_msg.push_back(output[1][cur_state][0]);
-        cur_state = next_state[cur_state][0];
-    }
-    if (cur_state != 0)
-        throw std::runtime_error("state after encoding not 0");
-    return encoded_msg;
-}
-
-std::vector<bool> read_bit_array(std::string &infile) {
-    std::ifstream fin(infile);
-    std::vector<bool> vec;
-    char ch;
-    while (fin >> std::noskipws >> ch) {
-        switch(ch) {
-            case '0': vec.push_back(0); break;
-            case '1': vec.push_back(1); break;
-            default: throw std::runtime_error("invalid character in input file");          
+    template <class code>
+    int run() const {
+        std::string infile = this->infile, outfile = this->outfile;
+        const bit_format_t format = output_format(config, bit_format_t::text);
+        if (mode == "encode") {
+            // streamed, so the message is never held in memory as a whole
+            encode_file<code>(infile, outfile, config, format);
         }
+        if (mode == "decode") {
+            std::vector<bool> channel_output = read_bitstream(infile).to_vector();
+            std::vector<bool> decoded_msg = viterbi_decode<code>(channel_output, config);
+            write_bitstream(bitstream_t(decoded_msg), outfile, format);
+        }
+        return 0;
     }
-    fin.close();
-    return vec;
-}
+};
 
-void write_bit_array(std::vector<bool> &outvec, std::string &outfile) {
-    std::ofstream fout(outfile);
-    for(bool b : outvec) 
-        fout << (b?'1':'0');
-    fout.close();
+int main(int argc, char **argv) {
+    conv_main_t conv_main;
+    conv_main.config = default_config;
+    std::vector<std::string> args = parse_conv_options(argc, argv, conv_main.config);
+    if (args.size() < 4) throw std::runtime_error("not enough arguments. Call as ./a.out [encode/decode] infile outfile [--mem m] [--gen G0,G1] [--init bits] [--sync bits] [--period p] [--format text/packed]");
+    conv_main.mode = args[1];
+    if (conv_main.mode != "encode" && conv_main.mode != "decode")
+        throw std::runtime_error("invalid mode");
+    conv_main.infile = args[2];
+    conv_main.outfile = args[3];
+    return dispatch_conv_code(conv_main.config, conv_main);
 }
 
-std::vector<bool> viterbi_decode(std::vector<bool> &channel_output, conv_arr_t&prev_state, conv_arr_t&next_state, conv_arr_t *output) {
-    double INF = std::numeric_limits<double>::infinity();
+template <class code>
+std::vector<bool> viterbi_decode(std::vector<bool> &channel_output, const conv_config_t &config) {
+    const uint8_t mem_conv = code::mem;
+    const uint32_t nstate_conv = code::nstate;
+    float INF = std::numeric_limits<float>::infinity();
     uint32_t out_size = channel_output.size();
     if (out_size%n_out_conv != 0) throw std::runtime_error("length not multiple of n_out_conv");
     uint32_t in_size = out_size/n_out_conv;
     if (in_size < (uint32_t)mem_conv) throw std::runtime_error("too small channel output");
-    std::vector<std::array<uint8_t,nstate_conv>> traceback(in_size);
-    std::array<double,nstate_conv> curr_score, prev_score;
-    curr_score[0] = 0.0;
-    for (uint8_t init_state = 1; init_state < nstate_conv; init_state++)
-        curr_score[init_state] = -INF; // initial state is 0, so rest have score -inf
+    std::vector<std::array<uint32_t,nstate_conv>> traceback(in_size);
+    // scores are whole numbers of bit errors so float is exact
+    std::vector<float> curr_score(nstate_conv, -INF), prev_score(nstate_conv);
+    curr_score[config.initial_state] = 0.0; // rest have score -inf
     for (uint32_t t = 0; t < in_size; t++) {
-        prev_score = curr_score;
-        for (uint8_t st2 = 0; st2 < nstate_conv; st2++) {
-            // st2 = next state
-            uint8_t st1 = prev_state[st2][0];
-            bool curr_bit = (st2>>(mem_conv-1));
-            curr_score[st2] = prev_score[st1] - (double)(channel_output[2*t]!=output[0][st1][curr_bit]) - (double)(channel_output[2*t+1]!=output[1][st1][curr_bit]);
-            traceback[t][st2] = st1;
-            st1 = prev_state[st2][1];
-            double score = prev_score[st1] - (double)(channel_output[2*t]!=output[0][st1][curr_bit]) - (double)(channel_output[2*t+1]!=output[1][st1][curr_bit]);
-            if (score > curr_score[st2]) {
-                curr_score[st2] = score;
-                traceback[t][st2] = st1;
-            }
-        }
+        std::swap(prev_score, curr_score);
+        // sync_markers
+        bool sync_ok[2] = {true, true};
+        if (t < in_size - mem_conv)
+            for (uint32_t bit = 0; bit < 2; bit++)
+                sync_ok[bit] = sync_allows(config, t, bit);
+        uint32_t received = 2*channel_output[2*t] + channel_output[2*t+1];
+        viterbi_acs_step<code>(prev_score.data(), curr_score.data(), traceback[t].data(), received, sync_ok);
     }
     std::vector<bool> decoded_msg(in_size);
-    uint8_t cur_state = 0; // we already know the last state is 0
+    uint32_t cur_state = 0; // we already know the last state is 0
     decoded_msg[in_size-1] = (cur_state>>(mem_conv-1));
     for (uint32_t t = in_size-1; t > 0; t--) {
         cur_state = traceback[t][cur_state];
@@ -1,187 +1,319 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <array>
+#include <chrono>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <limits>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <vector>
 
+#include "../src/posterior_file.h"
+#include "conv_code.h"
+
 const uint8_t NBASE = 4;
 const char int2base[NBASE] = {'A', 'C', 'G', 'T'};
 const bool base2bit[NBASE][2] = {{0, 0}, {0, 1}, {1, 0}, {1, 1}};
 const uint8_t nstate_crf = 5;
 typedef std::array<std::array<float, nstate_crf>, nstate_crf> crf_mat_t;
+static_assert(sizeof(crf_mat_t) == nstate_crf * nstate_crf * sizeof(float),
+              "crf_mat_t must match layout of a block of posterior file");
+
+// CRF transition matrices of a read, either mapped without copying from a
+// binary posterior file written by scrappie raw --posterior, or read from a
+// headerless file of floats
+class crf_post_t {
+ public:
+  explicit crf_post_t(const std::string &infile, const uint32_t record = 0);
+  ~crf_post_t();
+  crf_post_t(const crf_post_t &) = delete;
+  crf_post_t &operator=(const crf_post_t &) = delete;
+  const crf_mat_t &operator[](const uint32_t t) const { return data[t]; }
+  uint32_t size() const { return nblk; }
+  std::string read_id;
 
-// convolutional code related parameters
-const uint8_t mem_conv = 
-// 6; // mem 6 from CCSDS
-8; // mem 8 from GL paper
-// 11; // mem 11 from GL paper
-// 14; // mem 14 from GL paper
-const uint32_t nstate_conv = 1<<mem_conv;
-const uint8_t n_out_conv = 2;
-typedef std::array<std::array<uint32_t, 2>, nstate_conv> conv_arr_t;
-const uint32_t G[n_out_conv] = //octal
-// {0171, 0133};  // mem 6 from CCSDS
-{0515, 0677}; // mem 8 from GL paper
-// {05537, 06131}; // mem 11 from GL paper
-// {075063, 056711}; // mem 14 from GL paper
-const uint32_t initial_state_conv = //binary
-0; // 0 initial state
-// 0b100101; // mem 6
-// 0b10010110; // mem 8
-// 0b10010110001; // mem 11
-// 0b10010110001101; // mem 14
+ private:
+  void *map = nullptr;
+  size_t map_size = 0;
+  std::vector<crf_mat_t> owned;
+  const crf_mat_t *data = nullptr;
+  uint32_t nblk = 0;
+};
 
+// convolutional code related parameters, defaults can be changed with
+// --mem, --gen, --init, --sync and --period (see conv_code.h)
+const conv_config_t default_config = {
+    8,             // mem 8 from GL paper
+    {0515, 0677},  // octal generator for mem 8 from GL paper
+    0,             // initial state, binary 0b10010110 also used for mem 8
+    {1, 1, 0},     // sync marker
+    9};            // sync marker period
 // when using sync_markers, initial_state = 0 should work just fine
-const uint32_t sync_marker_length = 
-// 0;
-// 1
-// 2;
-3;
-const char sync_marker[sync_marker_length] = 
-// {};
-// {1};
-// {1,0};
-{1,1,0};
-const uint32_t sync_marker_period = 
-9;
-
-void generate_conv_arrays(conv_arr_t &prev_state, conv_arr_t &next_state,
-                          conv_arr_t *output);
-
-std::vector<bool> encode(const std::vector<bool> &msg,
-                         const conv_arr_t &next_state,
-                         const conv_arr_t *output);
-
-std::vector<bool> read_bit_array(const std::string &infile);
-
-void write_bit_array(const std::vector<bool> &outvec,
-                     const std::string &outfile);
 
 void write_char_array(const std::vector<char> &vec, const std::string &outfile);
 
-void write_bit_array_in_bases(const std::vector<bool> &outvec,
-                              const std::string &outfile);
-
 std::vector<crf_mat_t> read_crf_post(const std::string &infile);
 
-std::vector<char> decode_post_no_conv(const std::vector<crf_mat_t> &post);
+std::vector<char> decode_post_no_conv(const crf_post_t &post);
 
 std::vector<char> crfpath_to_basecall(const std::vector<uint8_t> &path);
 
+template <class code>
 uint32_t get_state_idx(const uint32_t st_pos, const uint32_t st_conv,
                      const uint32_t st_crf);
 
+template <class code>
 uint32_t state_idx_to_pos(const uint32_t st);
 
-std::vector<bool> decode_post_conv(const std::vector<crf_mat_t> &post,
-                                   const conv_arr_t &prev_state,
-                                   const conv_arr_t &next_state,
-                                   const conv_arr_t *output,
-                                   const uint32_t msg_len);
+template <class code>
+uint32_t state_idx_to_crf(const uint32_t st);
+
+// range of trellis positions [lo, hi] considered for each block
+struct pos_band_t {
+  uint32_t lo, hi;
+};
+
+std::vector<pos_band_t> get_pos_bands(const uint32_t nblk,
+                                      const uint32_t nstate_pos,
+                                      const uint32_t band);
+
+// Traceback decisions packed into 4 bits per state, two states per byte.
+// Only the states within the band of each block are stored.
+class packed_traceback {
+ public:
+  packed_traceback() = default;
+  packed_traceback(const std::vector<pos_band_t> &bands,
+                   const uint32_t nstate_per_pos);
+  // resize for new bands, keeping the memory already allocated
+  void reset(const std::vector<pos_band_t> &bands,
+             const uint32_t nstate_per_pos);
+  // set decisions for four consecutive states starting at a multiple of 4
+  void set4(const uint32_t t, const uint32_t st, const __m128i decision);
+  uint8_t get(const uint32_t t, const uint32_t st) const;
+
+ private:
+  std::vector<uint32_t> first_state;
+  std::vector<uint64_t> offset;
+  std::vector<uint8_t> data;
+};
+
+uint8_t make_decision(const uint8_t st1_crf, const uint8_t conv_bit);
+
+template <class code>
+uint32_t decision_to_prev_state(const uint32_t st2, const uint8_t decision);
+
+// bits of the conv state at a trellis position that are already known from
+// the initial state, sync markers or terminating zeros. A state st is only
+// reachable if (st & mask) == value.
+struct known_bits_t {
+  uint32_t mask, value;
+};
+
+template <class code>
+std::vector<known_bits_t> get_known_bits(const conv_config_t &config,
+                                         const uint32_t msg_len);
+
+template <class code>
+void post_conv_acs_pos(const crf_mat_t &post_t, const float *prev_score,
+                       float *curr_score, packed_traceback &traceback,
+                       const uint32_t t, const uint32_t pos,
+                       const known_bits_t &known);
+
+// Traceback of list decoding, a byte for each of the list_size entries of
+// every state within the band: the decision in the low 4 bits and the rank
+// of the entry of the previous state it extends in the high 4 bits.
+class list_traceback {
+ public:
+  void reset(const std::vector<pos_band_t> &bands,
+             const uint32_t nstate_per_pos, const uint32_t list_size);
+  uint8_t *entries(const uint32_t t, const uint32_t st) {
+    return data.data() + offset[t] + (uint64_t)(st - first_state[t]) * list_size;
+  }
+  uint8_t get(const uint32_t t, const uint32_t st, const uint32_t rank) const {
+    return data[offset[t] + (uint64_t)(st - first_state[t]) * list_size + rank];
+  }
+
+ private:
+  uint32_t list_size = 1;
+  std::vector<uint32_t> first_state;
+  std::vector<uint64_t> offset;
+  std::vector<uint8_t> data;
+};
+
+// buffers of decode_post_conv, kept between calls to avoid reallocating
+// them for every read
+struct decode_workspace_t {
+  std::vector<float> curr_score, prev_score;
+  packed_traceback traceback;
+  std::vector<uint32_t> path;
+  std::vector<uint8_t> crfpath;
+  // list decoding, scores are list_size consecutive entries per state
+  list_traceback list_tb;
+  std::vector<std::vector<uint32_t>> list_paths;
+};
+
+template <class code>
+std::vector<bool> decode_post_conv(const crf_post_t &post,
+                                   const conv_config_t &config,
+                                   const uint32_t msg_len,
+                                   const uint32_t band = 0);
+
+template <class code>
+std::vector<bool> decode_post_conv(const crf_post_t &post,
+                                   const conv_config_t &config,
+                                   const uint32_t msg_len,
+                                   const uint32_t band,
+                                   decode_workspace_t &ws);
+
+template <class code>
+void viterbi_post_conv_segment(const crf_post_t &post,
+                               const conv_config_t &config,
+                               const uint32_t msg_len,
+                               const std::vector<pos_band_t> &bands,
+                               const uint32_t t_start, const uint32_t t_end,
+                               decode_workspace_t &ws);
+
+template <class code>
+void list_viterbi_post_conv(const crf_post_t &post,
+                            const conv_config_t &config,
+                            const uint32_t msg_len,
+                            const std::vector<pos_band_t> &bands,
+                            decode_workspace_t &ws);
+
+template <class code>
+std::vector<bool> path_to_msg(const std::vector<uint32_t> &path,
+                              const conv_config_t &config,
+                              const uint32_t msg_len,
+                              std::vector<uint8_t> &crfpath);
 
+void warn_if_crc_fails(const std::vector<bool> &msg,
+                       const conv_config_t &config);
+
+template <class code>
+std::vector<bool> decode_post_conv_parallel(const crf_post_t &post,
+                                            const conv_config_t &config,
+                                            const uint32_t msg_len,
+                                            const uint32_t band,
+                                            uint32_t nsegment,
+                                            const uint32_t overlap);
+
+// one trial of batch decoding, read from a line of the manifest
+struct batch_trial_t {
+  std::string post_file, msg_file;
+  uint32_t msg_len, band;
+};
+
+// result of one trial, edit_distance is -1 if the true message is unknown
+struct batch_result_t {
+  bool decoded;
+  int64_t edit_distance;
+  double seconds;
+  std::vector<bool> msg;
+  std::string error;
+};
+
+std::vector<batch_trial_t> read_batch_manifest(const std::string &infile);
+
+uint32_t edit_distance(const std::vector<bool> &a, const std::vector<bool> &b);
+
+template <class code>
+std::vector<batch_result_t> decode_batch(
+    const std::vector<batch_trial_t> &trials, const conv_config_t &config);
+
+void write_batch_results(const std::vector<batch_trial_t> &trials,
+                         const std::vector<batch_result_t> &results,
+                         const std::string &outfile);
+
+template <class code>
 std::vector<bool> viterbi_decode(const std::vector<bool> &channel_output,
-                                 const conv_arr_t &prev_state, const conv_arr_t &next_state,
-                                 const conv_arr_t *output,
+                                 const conv_config_t &config,
                                  const bool must_be_perfect = false);
 
+// encode or decode with the convolutional code chosen at runtime
+struct conv_main_t {
+  std::string mode, infile, outfile;
+  uint32_t msg_len, band, nsegment, overlap;
+  conv_config_t config;
+
+  template <class code>
+  int run() const {
+    if (mode == "encode") {
+      // streamed, so the message is never held in memory as a whole
+      encode_file<code>(infile, outfile, config,
+                        output_format(config, bit_format_t::bases));
+    }
+    if (mode == "addcrc") {
+      // fill the CRC of a message before encoding it
+      std::vector<bool> msg = read_bitstream(infile).to_vector();
+      set_crc(msg, config);
+      write_bitstream(bitstream_t(msg), outfile,
+                      output_format(config, bit_format_t::text));
+    }
+    if (mode == "batch") {
+      std::vector<batch_trial_t> trials = read_batch_manifest(infile);
+      std::vector<batch_result_t> results = decode_batch<code>(trials, config);
+      write_batch_results(trials, results, outfile);
+    }
+    if (mode == "decode") {
+      crf_post_t post(infile);
+      // default overlap of time-parallel decoding, in blocks
+      const uint32_t seg_overlap = (overlap > 0) ? overlap : 50 * (code::mem + 1);
+      std::vector<bool> decoded_msg =
+          (nsegment > 1)
+              ? decode_post_conv_parallel<code>(post, config, msg_len, band,
+                                                nsegment, seg_overlap)
+              : decode_post_conv<code>(post, config, msg_len, band);
+      write_bitstream(bitstream_t(decoded_msg), outfile,
+                      output_format(config, bit_format_t::text));
+      // for testing
+      //        std::vector<char> basecall = decode_post_no_conv(post);
+      //        write_char_array(basecall, outfile);
+    }
+    return 0;
+  }
+};
+
 int main(int argc, char **argv) {
-  // generate convolutional code matrices
-  conv_arr_t prev_state, next_state, output[n_out_conv];
-  generate_conv_arrays(prev_state, next_state, output);
-  if (argc < 4)
+  conv_main_t conv_main;
+  conv_main.config = default_config;
+  std::vector<std::string> args =
+      parse_conv_options(argc, argv, conv_main.config);
+  if (args.size() < 4)
     throw std::runtime_error(
-        "not enough arguments. Call as ./a.out [encode/decode] infile outfile "
-        "[msg_len_for_decode]");
-  std::string mode = std::string(argv[1]);
-  if (mode != "encode" && mode != "decode")
+        "not enough arguments. Call as ./a.out [encode/decode/batch/addcrc] "
+        "infile outfile [msg_len_for_decode] [band_for_decode] "
+        "[nsegment_for_decode] [overlap_for_decode] [--mem m] [--gen G0,G1] "
+        "[--init bits] [--sync bits] [--period p] [--crc w] [--list L] "
+        "[--format text/bases/packed]");
+  conv_main.mode = args[1];
+  if (conv_main.mode != "encode" && conv_main.mode != "decode" &&
+      conv_main.mode != "batch" && conv_main.mode != "addcrc")
     throw std::runtime_error("invalid mode");
-  std::string infile = std::string(argv[2]), outfile = std::string(argv[3]);
-  if (mode == "encode") {
-    std::vector<bool> msg = read_bit_array(infile);
-    std::vector<bool> encoded_msg = encode(msg, next_state, output);
-    write_bit_array_in_bases(encoded_msg, outfile);
-  }
-  if (mode == "decode") {
-    if (argc < 5)
+  if (conv_main.mode == "addcrc" && conv_main.config.crc_width == 0)
+    throw std::runtime_error("addcrc needs the width of the CRC, --crc w");
+  conv_main.infile = args[2];
+  conv_main.outfile = args[3];
+  if (conv_main.mode == "decode") {
+    if (args.size() < 5)
       throw std::runtime_error(
           "not enough arguments. Call as ./a.out [encode/decode] infile "
-          "outfile [msg_len_for_decode]");
-    uint32_t msg_len = std::stoull(std::string(argv[4]));
-    std::vector<crf_mat_t> post = read_crf_post(infile);
-    std::vector<bool> decoded_msg =
-        decode_post_conv(post, prev_state, next_state, output, msg_len);
-    write_bit_array(decoded_msg, outfile);
-    // for testing
-    //        std::vector<char> basecall = decode_post_no_conv(post);
-    //        write_char_array(basecall, outfile);
-  }
-  return 0;
-}
-
-void generate_conv_arrays(conv_arr_t &prev_state, conv_arr_t &next_state,
-                          conv_arr_t *output) {
-  for (uint32_t cur_state = 0; cur_state < nstate_conv; cur_state++) {
-    next_state[cur_state][0] = (cur_state >> 1);
-    next_state[cur_state][1] = ((cur_state | nstate_conv) >> 1);
-    prev_state[cur_state][0] = (cur_state << 1) & (nstate_conv - 1);
-    prev_state[cur_state][1] = ((cur_state << 1) | 1) & (nstate_conv - 1);
-    output[0][cur_state][0] = __builtin_parity((cur_state & G[0]));
-    output[0][cur_state][1] =
-        __builtin_parity(((cur_state | nstate_conv) & G[0]));
-    output[1][cur_state][0] = __builtin_parity((cur_state & G[1]));
-    output[1][cur_state][1] =
-        __builtin_parity(((cur_state | nstate_conv) & G[1]));
-  }
-  return;
-}
-
-std::vector<bool> encode(const std::vector<bool> &msg,
-                         const conv_arr_t &next_state,
-                         const conv_arr_t *output) {
-  std::vector<bool> encoded_msg;
-  uint32_t cur_state = initial_state_conv;
-  for (bool msg_bit : msg) {
-    encoded_msg.push_back(output[0][cur_state][msg_bit]);
-    encoded_msg.push_back(output[1][cur_state][msg_bit]);
-    cur_state = next_state[cur_state][msg_bit];
-  }
-  // add terminating bits
-  for (uint8_t i = 0; i < mem_conv; i++) {
-    encoded_msg.push_back(output[0][cur_state][0]);
-    encoded_msg.push_back(output[1][cur_state][0]);
-    cur_state = next_state[cur_state][0];
-  }
-  if (cur_state != 0) throw std::runtime_error("state after encoding not 0");
-  return encoded_msg;
-}
-
-std::vector<bool> read_bit_array(const std::string &infile) {
-  std::ifstream fin(infile);
-  std::vector<bool> vec;
-  char ch;
-  while (fin >> std::noskipws >> ch) {
-    switch (ch) {
-      case '0':
-        vec.push_back(0);
-        break;
-      case '1':
-        vec.push_back(1);
-        break;
-      default:
-        throw std::runtime_error("invalid character in input file");
-    }
+          "outfile [msg_len_for_decode] [band_for_decode]");
+    conv_main.msg_len = std::stoull(args[4]);
+    // band of 0 searches all positions of the trellis at every block
+    conv_main.band = (args.size() > 5) ? std::stoull(args[5]) : 0;
+    // more than one segment decodes segments of the read in parallel, with
+    // overlap blocks shared between neighbours (0 for default)
+    conv_main.nsegment = (args.size() > 6) ? std::stoull(args[6]) : 1;
+    conv_main.overlap = (args.size() > 7) ? std::stoull(args[7]) : 0;
   }
-  fin.close();
-  return vec;
-}
-
-void write_bit_array(const std::vector<bool> &outvec,
-                     const std::string &outfile) {
-  std::ofstream fout(outfile);
-  for (bool b : outvec) fout << (b ? '1' : '0');
-  fout.close();
+  return dispatch_conv_code(conv_main.config, conv_main);
 }
 
 void write_char_array(const std::vector<char> &vec,
@@ -191,16 +323,6 @@ void write_char_array(const std::vector<char> &vec,
   fout.close();
 }
 
-void write_bit_array_in_bases(const std::vector<bool> &outvec,
-                              const std::string &outfile) {
-  std::ofstream fout(outfile);
-  uint32_t len = outvec.size();
-  if (len % 2 != 0) throw std::runtime_error("length not even");
-  for (uint32_t i = 0; i < len / 2; i++)
-    fout << int2base[2 * outvec[2 * i] + outvec[2 * i + 1]];
-  fout.close();
-}
-
 std::vector<crf_mat_t> read_crf_post(const std::string &infile) {
   std::ifstream fin(infile, std::ios::binary);
   std::vector<crf_mat_t> post;
@@ -219,7 +341,65 @@ std::vector<crf_mat_t> read_crf_post(const std::string &infile) {
   return post;
 }
 
-std::vector<char> decode_post_no_conv(const std::vector<crf_mat_t> &post) {
+crf_post_t::crf_post_t(const std::string &infile, const uint32_t record) {
+  int fd = open(infile.c_str(), O_RDONLY);
+  if (fd < 0) throw std::runtime_error("can't open posterior file " + infile);
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw std::runtime_error("can't stat posterior file " + infile);
+  }
+  char magic[sizeof(POSTERIOR_FILE_MAGIC) - 1] = {0};
+  bool is_container = pread(fd, magic, sizeof(magic), 0) == sizeof(magic) &&
+                      memcmp(magic, POSTERIOR_FILE_MAGIC, sizeof(magic)) == 0;
+  if (!is_container) {
+    close(fd);
+    owned = read_crf_post(infile);
+    data = owned.data();
+    nblk = owned.size();
+    return;
+  }
+  map_size = st.st_size;
+  map = mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    map = nullptr;
+    throw std::runtime_error("can't map posterior file " + infile);
+  }
+  auto fail = [this](const std::string &msg) {
+    munmap(map, map_size);
+    map = nullptr;
+    throw std::runtime_error(msg);
+  };
+  // walk along records to the one wanted
+  size_t offset = 0;
+  const posterior_record_header *header = nullptr;
+  for (uint32_t i = 0; i <= record; i++) {
+    if (map_size - offset < sizeof(posterior_record_header))
+      fail("no record " + std::to_string(record) + " in posterior file " +
+           infile);
+    header = (const posterior_record_header *)((const char *)map + offset);
+    if (memcmp(header->magic, POSTERIOR_FILE_MAGIC, sizeof(magic)) != 0 ||
+        header->version != POSTERIOR_FILE_VERSION ||
+        header->record_size > map_size - offset ||
+        header->record_size < sizeof(posterior_record_header) +
+                                  header->nblk * header->nstate * sizeof(float))
+      fail("invalid record in posterior file " + infile);
+    offset += header->record_size;
+  }
+  if (header->nstate != nstate_crf * nstate_crf)
+    fail("posterior file does not hold 5x5 CRF transitions");
+  data = (const crf_mat_t *)(header + 1);
+  nblk = header->nblk;
+  read_id = std::string(header->read_id,
+                        strnlen(header->read_id, POSTERIOR_READ_ID_LEN));
+}
+
+crf_post_t::~crf_post_t() {
+  if (map != nullptr) munmap(map, map_size);
+}
+
+std::vector<char> decode_post_no_conv(const crf_post_t &post) {
   // just basecalling without convolutional code (for testing purposes)
   float INF = std::numeric_limits<float>::infinity();
   uint32_t nblk = post.size();
@@ -266,83 +446,473 @@ std::vector<char> crfpath_to_basecall(const std::vector<uint8_t> &path) {
   return basecall;
 }
 
+// conv state is innermost so that consecutive conv states with the same
+// position and CRF state fill a vector
+template <class code>
 uint32_t get_state_idx(const uint32_t st_pos, const uint32_t st_conv,
                      const uint32_t st_crf) {
-  return st_pos * nstate_conv * nstate_crf + st_conv * nstate_crf + st_crf;
+  return st_pos * code::nstate * nstate_crf + st_crf * code::nstate + st_conv;
 }
 
+template <class code>
 uint32_t state_idx_to_pos(const uint32_t st) {
-  return st / ((uint32_t)nstate_conv * nstate_crf);
+  return st / ((uint32_t)code::nstate * nstate_crf);
+}
+
+template <class code>
+uint32_t state_idx_to_crf(const uint32_t st) {
+  return (st / code::nstate) % nstate_crf;
+}
+
+std::vector<pos_band_t> get_pos_bands(const uint32_t nblk,
+                                      const uint32_t nstate_pos,
+                                      const uint32_t band) {
+  // band for the states reached after block t. The expected position moves
+  // linearly from the first to the last position of the trellis, and the
+  // band is also limited to positions that can be reached from the start
+  // and can still reach the end, since each block moves at most one position.
+  const uint32_t last_pos = nstate_pos - 1;
+  std::vector<pos_band_t> bands(nblk, pos_band_t{0, last_pos});
+  if (band == 0) return bands;
+  for (uint32_t t = 0; t < nblk; t++) {
+    const uint32_t expected = ((uint64_t)(t + 1) * last_pos) / nblk;
+    const uint32_t reach_lo =
+        (last_pos + t + 1 > nblk) ? last_pos + t + 1 - nblk : 0;
+    const uint32_t reach_hi = std::min(last_pos, t + 1);
+    bands[t].lo = std::max(reach_lo, (expected > band) ? expected - band : 0);
+    bands[t].hi = std::min(reach_hi, expected + band);
+  }
+  return bands;
+}
+
+packed_traceback::packed_traceback(const std::vector<pos_band_t> &bands,
+                                   const uint32_t nstate_per_pos) {
+  reset(bands, nstate_per_pos);
+}
+
+void packed_traceback::reset(const std::vector<pos_band_t> &bands,
+                             const uint32_t nstate_per_pos) {
+  // every state within the band is written before it is read, so the data
+  // need not be cleared
+  first_state.resize(bands.size());
+  offset.assign(bands.size() + 1, 0);
+  for (uint32_t t = 0; t < bands.size(); t++) {
+    first_state[t] = bands[t].lo * nstate_per_pos;
+    const uint64_t nstate_blk =
+        (uint64_t)(bands[t].hi - bands[t].lo + 1) * nstate_per_pos;
+    offset[t + 1] = offset[t] + (nstate_blk + 1) / 2;
+  }
+  data.resize(offset[bands.size()]);
+}
+
+void packed_traceback::set4(const uint32_t t, const uint32_t st,
+                            const __m128i decision) {
+  uint32_t d[4];
+  _mm_storeu_si128((__m128i *)d, decision);
+  uint8_t *byte = data.data() + offset[t] + (st - first_state[t]) / 2;
+  byte[0] = d[0] | (d[1] << 4);
+  byte[1] = d[2] | (d[3] << 4);
+}
+
+uint8_t packed_traceback::get(const uint32_t t, const uint32_t st) const {
+  const uint32_t i = st - first_state[t];
+  return (data[offset[t] + i / 2] >> (4 * (i % 2))) & 0xF;
+}
+
+void list_traceback::reset(const std::vector<pos_band_t> &bands,
+                           const uint32_t nstate_per_pos,
+                           const uint32_t list_size_) {
+  list_size = list_size_;
+  first_state.resize(bands.size());
+  offset.assign(bands.size() + 1, 0);
+  for (uint32_t t = 0; t < bands.size(); t++) {
+    first_state[t] = bands[t].lo * nstate_per_pos;
+    offset[t + 1] = offset[t] + (uint64_t)(bands[t].hi - bands[t].lo + 1) *
+                                    nstate_per_pos * list_size;
+  }
+  data.resize(offset[bands.size()]);
+}
+
+uint8_t make_decision(const uint8_t st1_crf, const uint8_t conv_bit) {
+  // 3 bits for the previous CRF state, 1 bit for which previous conv state
+  return st1_crf | (conv_bit << 3);
+}
+
+template <class code>
+uint32_t decision_to_prev_state(const uint32_t st2, const uint8_t decision) {
+  // the position and conv state of the previous state are implied by st2:
+  // unchanged when st2 is blank, otherwise one position back and one of the
+  // two previous conv states
+  const uint32_t st2_pos = state_idx_to_pos<code>(st2);
+  const uint32_t st2_conv = st2 % code::nstate;
+  const uint8_t st1_crf = decision & 0x7;
+  if (state_idx_to_crf<code>(st2) == nstate_crf - 1)
+    return get_state_idx<code>(st2_pos, st2_conv, st1_crf);
+  return get_state_idx<code>(
+      st2_pos - 1, code::tables.prev_state[st2_conv][decision >> 3], st1_crf);
 }
 
-std::vector<bool> decode_post_conv(const std::vector<crf_mat_t> &post,
-                                   const conv_arr_t &prev_state,
-                                   const conv_arr_t &next_state,
-                                   const conv_arr_t *output,
-                                   const uint32_t msg_len) {
+template <class code>
+std::vector<known_bits_t> get_known_bits(const conv_config_t &config,
+                                         const uint32_t msg_len) {
+  // Bit mem - 1 - j of the conv state at position pos is the message bit at
+  // pos - 1 - j. Bits before the message come from the initial state and
+  // those after it are the terminating zeros.
+  const int64_t mem = code::mem;
+  std::vector<known_bits_t> known(msg_len + mem + 1, known_bits_t{0, 0});
+  for (int64_t pos = 0; pos <= msg_len + mem; pos++) {
+    for (int64_t j = 0; j < mem; j++) {
+      const int64_t i = pos - 1 - j;
+      const uint32_t state_bit = (uint32_t)1 << (mem - 1 - j);
+      uint32_t bit;
+      if (i < 0) {
+        bit = (config.initial_state >> (mem - 1 - (-1 - i))) & 1;
+      } else if (i >= msg_len) {
+        bit = 0;
+      } else if (!config.sync_marker.empty() &&
+                 (size_t)(i % config.sync_marker_period) <
+                     config.sync_marker.size()) {
+        bit = config.sync_marker[i % config.sync_marker_period];
+      } else {
+        continue;
+      }
+      known[pos].mask |= state_bit;
+      known[pos].value |= bit ? state_bit : 0;
+    }
+  }
+  return known;
+}
+
+// whether none of the four conv states from c, a multiple of 4, is reachable
+inline bool conv_chunk_unreachable(const uint32_t c, const known_bits_t &known) {
+  return ((c ^ known.value) & known.mask & ~(uint32_t)3) != 0;
+}
+
+// value of table for the base in each lane
+inline __m128 lookup_base(const __m128 table, const __m128i base) {
+#ifdef __AVX__
+  return _mm_permutevar_ps(table, base);
+#else
+  __m128 res = _mm_setzero_ps();
+  const __m128 entry[4] = {_mm_shuffle_ps(table, table, _MM_SHUFFLE(0, 0, 0, 0)),
+                           _mm_shuffle_ps(table, table, _MM_SHUFFLE(1, 1, 1, 1)),
+                           _mm_shuffle_ps(table, table, _MM_SHUFFLE(2, 2, 2, 2)),
+                           _mm_shuffle_ps(table, table, _MM_SHUFFLE(3, 3, 3, 3))};
+  for (int b = 0; b < 4; b++) {
+    const __m128 is_b = _mm_castsi128_ps(_mm_cmpeq_epi32(base, _mm_set1_epi32(b)));
+    res = _mm_or_ps(res, _mm_and_ps(is_b, entry[b]));
+  }
+  return res;
+#endif
+}
+
+template <class code>
+void post_conv_acs_pos(const crf_mat_t &post_t, const float *prev_score,
+                       float *curr_score, packed_traceback &traceback,
+                       const uint32_t t, const uint32_t pos,
+                       const known_bits_t &known) {
+  // Add-compare-select for all states at trellis position pos after block t,
+  // four conv states at a time. If the state is blank, the previous state has
+  // the same pos and conv state. Otherwise the previous state is one position
+  // back, in one of the two previous conv states, and the CRF state must be
+  // the base output by that conv transition. So each state has only two
+  // non-blank predecessors conv states, each giving a single base.
+  //
+  // States that can't be reached because of known bits of the conv state
+  // (sync markers) are skipped and keep the score -INF they were cleared to.
+  // Their traceback is never read.
+  const uint32_t nstate_conv = code::nstate, half = nstate_conv / 2;
+  const uint32_t nstate_per_pos = nstate_conv * nstate_crf;
+  const float *prev_pos = prev_score + pos * nstate_per_pos;
+  float *curr_pos = curr_score + pos * nstate_per_pos;
+  const uint32_t first_st = pos * nstate_per_pos;
+  const __m128 neg_inf = _mm_set1_ps(-std::numeric_limits<float>::infinity());
+  const __m128i zero = _mm_setzero_si128();
+
+  // blank
+  const uint8_t blank = nstate_crf - 1;
+  for (uint32_t c = 0; c < nstate_conv; c += 4) {
+    if (conv_chunk_unreachable(c, known)) continue;
+    __m128 best = neg_inf;
+    __m128i decision = zero;
+    for (uint8_t st1_crf = 0; st1_crf < nstate_crf; st1_crf++) {
+      const __m128 score =
+          _mm_add_ps(_mm_loadu_ps(prev_pos + st1_crf * nstate_conv + c),
+                     _mm_set1_ps(post_t[blank][st1_crf]));
+      const __m128 better = _mm_cmpgt_ps(score, best);
+      const __m128i better_i = _mm_castps_si128(better);
+      best = _mm_or_ps(_mm_and_ps(better, score), _mm_andnot_ps(better, best));
+      decision = _mm_or_si128(
+          _mm_and_si128(better_i, _mm_set1_epi32(make_decision(st1_crf, 0))),
+          _mm_andnot_si128(better_i, decision));
+    }
+    _mm_storeu_ps(curr_pos + blank * nstate_conv + c, best);
+    traceback.set4(t, first_st + blank * nstate_conv + c, decision);
+  }
+
+  // not blank
+  if (pos == 0) {
+    // must have blank for pos 0
+    for (uint32_t i = 0; i < blank * nstate_conv; i += 4) {
+      _mm_storeu_ps(curr_pos + i, neg_inf);
+      traceback.set4(t, first_st + i, zero);
+    }
+    return;
+  }
+  // score of each base from each previous CRF state, for lookup by lane
+  __m128 post_base[nstate_crf];
+  for (uint8_t st1_crf = 0; st1_crf < nstate_crf; st1_crf++)
+    post_base[st1_crf] = _mm_setr_ps(post_t[0][st1_crf], post_t[1][st1_crf],
+                                     post_t[2][st1_crf], post_t[3][st1_crf]);
+  const float *prev_before = prev_pos - nstate_per_pos;
+  for (uint32_t c = 0; c < half; c += 4) {
+    const bool unreachable[2] = {conv_chunk_unreachable(c, known),
+                                 conv_chunk_unreachable(c + half, known)};
+    if (unreachable[0] && unreachable[1]) continue;
+    // conv states 2c and 2c + 1 lead to both c and c + half, depending on
+    // the new bit, so deinterleave their scores once for both
+    __m128 src[2][nstate_crf];
+    for (uint8_t st1_crf = 0; st1_crf < nstate_crf; st1_crf++) {
+      const float *p = prev_before + st1_crf * nstate_conv + 2 * c;
+      const __m128 lo = _mm_loadu_ps(p), hi = _mm_loadu_ps(p + 4);
+      src[0][st1_crf] = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+      src[1][st1_crf] = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+    }
+    for (uint32_t bit = 0; bit < 2; bit++) {
+      if (unreachable[bit]) continue;
+      const uint32_t st2_conv = c + bit * half;
+      const __m128i base_in[2] = {
+          _mm_loadu_si128((const __m128i *)(code::tables.base_in[0] + st2_conv)),
+          _mm_loadu_si128((const __m128i *)(code::tables.base_in[1] + st2_conv))};
+      // best entry through each of the two previous conv states
+      __m128 best[2];
+      __m128i decision[2];
+      for (uint8_t conv_bit = 0; conv_bit < 2; conv_bit++) {
+        best[conv_bit] = neg_inf;
+        decision[conv_bit] = zero;
+        for (uint8_t st1_crf = 0; st1_crf < nstate_crf; st1_crf++) {
+          const __m128 score =
+              _mm_add_ps(src[conv_bit][st1_crf],
+                         lookup_base(post_base[st1_crf], base_in[conv_bit]));
+          const __m128 better = _mm_cmpgt_ps(score, best[conv_bit]);
+          const __m128i better_i = _mm_castps_si128(better);
+          best[conv_bit] = _mm_or_ps(_mm_and_ps(better, score),
+                                     _mm_andnot_ps(better, best[conv_bit]));
+          decision[conv_bit] = _mm_or_si128(
+              _mm_and_si128(better_i,
+                            _mm_set1_epi32(make_decision(st1_crf, conv_bit))),
+              _mm_andnot_si128(better_i, decision[conv_bit]));
+        }
+      }
+      // each goes to the CRF state of its base, ties to the first conv state
+      for (uint8_t st2_crf = 0; st2_crf < blank; st2_crf++) {
+        const __m128i crf = _mm_set1_epi32(st2_crf);
+        const __m128 valid0 = _mm_castsi128_ps(_mm_cmpeq_epi32(base_in[0], crf));
+        const __m128 valid1 = _mm_castsi128_ps(_mm_cmpeq_epi32(base_in[1], crf));
+        __m128 st_best = _mm_or_ps(_mm_and_ps(valid0, best[0]),
+                                   _mm_andnot_ps(valid0, neg_inf));
+        __m128i st_decision =
+            _mm_and_si128(_mm_castps_si128(valid0), decision[0]);
+        const __m128 better =
+            _mm_and_ps(valid1, _mm_cmpgt_ps(best[1], st_best));
+        const __m128i better_i = _mm_castps_si128(better);
+        st_best = _mm_or_ps(_mm_and_ps(better, best[1]),
+                            _mm_andnot_ps(better, st_best));
+        st_decision = _mm_or_si128(_mm_and_si128(better_i, decision[1]),
+                                   _mm_andnot_si128(better_i, st_decision));
+        _mm_storeu_ps(curr_pos + st2_crf * nstate_conv + st2_conv, st_best);
+        traceback.set4(t, first_st + st2_crf * nstate_conv + st2_conv,
+                       st_decision);
+      }
+    }
+  }
+}
+
+template <class code>
+std::vector<bool> decode_post_conv(const crf_post_t &post,
+                                   const conv_config_t &config,
+                                   const uint32_t msg_len,
+                                   const uint32_t band) {
+  decode_workspace_t ws;
+  return decode_post_conv<code>(post, config, msg_len, band, ws);
+}
+
+template <class code>
+void viterbi_post_conv_segment(const crf_post_t &post,
+                               const conv_config_t &config,
+                               const uint32_t msg_len,
+                               const std::vector<pos_band_t> &bands,
+                               const uint32_t t_start, const uint32_t t_end,
+                               decode_workspace_t &ws) {
+  // Viterbi search over blocks [t_start, t_end), leaving the best path in
+  // ws.path where ws.path[i] is the state after block t_start + i - 1. The
+  // first segment starts from the initial state and the last segment must
+  // finish in the final state. Other segments start with all states in band
+  // equally likely and finish in their best state, as for the warm-up and
+  // overlap of time-parallel decoding.
+  const uint8_t mem_conv = code::mem;
+  const uint32_t nstate_conv = code::nstate;
+  const uint32_t nstate_per_pos = nstate_conv * nstate_crf;
   float INF = std::numeric_limits<float>::infinity();
   uint32_t nstate_pos =
       msg_len + mem_conv +
       1;  // number of states denoting the position in convolution trellis
   // 0 to msg_len + mem_conv
-  uint64_t nstate_total_64 = nstate_pos * nstate_crf * nstate_conv;
+  uint64_t nstate_total_64 = (uint64_t)nstate_pos * nstate_per_pos;
   if (nstate_total_64 >= ((uint64_t)1<<32)) throw std::runtime_error("Too many states, can't fit in 32 bits");
   uint32_t nstate_total = (uint32_t)nstate_total_64;
-  uint32_t nblk = post.size();
-  if (post.size() < msg_len + mem_conv)
-    throw std::runtime_error("Too small post matrix");
-  std::vector<std::vector<uint32_t>> traceback(nblk, std::vector<uint32_t>(nstate_total));
-  std::vector<float> curr_score(nstate_total, -INF), prev_score(nstate_total);
-  curr_score[get_state_idx(0, initial_state_conv, nstate_crf - 1)] =
-      0.0;  // only valid initial state is pos 0, conv code at initial_state_conv, blank.
+  const uint32_t nblk = t_end - t_start;
+  // 4 bits of decision per state rather than a 32 bit state index
+  packed_traceback &traceback = ws.traceback;
+  traceback.reset(std::vector<pos_band_t>(bands.begin() + t_start,
+                                          bands.begin() + t_end),
+                  nstate_per_pos);
+  // scores are -INF outside the band of the block they belong to
+  std::vector<float> &curr_score = ws.curr_score, &prev_score = ws.prev_score;
+  curr_score.assign(nstate_total, -INF);
+  prev_score.assign(nstate_total, -INF);
+  pos_band_t curr_band = {0, 0}, prev_band = {0, 0};
+  const std::vector<known_bits_t> known = get_known_bits<code>(config, msg_len);
+  if (t_start == 0) {
+    curr_score[get_state_idx<code>(0, config.initial_state, nstate_crf - 1)] =
+        0.0;  // only valid initial state is pos 0, conv code at initial_state, blank.
+  } else {
+    curr_band = bands[t_start - 1];
+    std::fill(curr_score.begin() + get_state_idx<code>(curr_band.lo, 0, 0),
+              curr_score.begin() + get_state_idx<code>(curr_band.hi + 1, 0, 0),
+              0.0f);
+  }
 
   // forward Viterbi pass
+  for (uint32_t t = t_start; t < t_end; t++) {
+    // reuse the scores from two blocks ago, clearing only their band
+    std::swap(prev_score, curr_score);
+    std::fill(curr_score.begin() + get_state_idx<code>(prev_band.lo, 0, 0),
+              curr_score.begin() + get_state_idx<code>(prev_band.hi + 1, 0, 0),
+              -INF);
+    prev_band = curr_band;
+    curr_band = bands[t];
+    for (uint32_t st2_pos = curr_band.lo; st2_pos <= curr_band.hi; st2_pos++)
+      post_conv_acs_pos<code>(post[t], prev_score.data(), curr_score.data(),
+                              traceback, t - t_start, st2_pos, known[st2_pos]);
+  }
+
+  // traceback
+  std::vector<uint32_t> &path = ws.path;
+  path.resize(nblk + 1);
+  float score = -INF;
+  if (t_end == post.size()) {
+    uint32_t st_pos = msg_len+mem_conv, st_conv = 0;  // last state
+    for (uint8_t st_crf = 0; st_crf < nstate_crf; st_crf++) {
+      uint32_t st = get_state_idx<code>(st_pos, st_conv, st_crf);
+      if (curr_score[st] > score) {
+        score = curr_score[st];
+        path[nblk] = st;
+      }
+    }
+  } else {
+    for (uint32_t st = get_state_idx<code>(curr_band.lo, 0, 0);
+         st < get_state_idx<code>(curr_band.hi + 1, 0, 0); st++) {
+      if (curr_score[st] > score) {
+        score = curr_score[st];
+        path[nblk] = st;
+      }
+    }
+  }
+  if (score == -INF)
+    throw std::runtime_error("no valid path within band, try a wider band");
+  for (uint32_t t = nblk; t > 0; t--)
+    path[t - 1] =
+        decision_to_prev_state<code>(path[t], traceback.get(t - 1, path[t]));
+}
+
+// insert a candidate into a list sorted best first, after any entries with
+// the same score so ties keep the earlier candidate as Viterbi does
+inline void list_insert(float *score, uint8_t *entry, const uint32_t list_size,
+                        const float cand, const uint8_t cand_entry) {
+  uint32_t i = list_size - 1;
+  if (!(cand > score[i])) return;
+  for (; i > 0 && cand > score[i - 1]; i--) {
+    score[i] = score[i - 1];
+    entry[i] = entry[i - 1];
+  }
+  score[i] = cand;
+  entry[i] = cand_entry;
+}
+
+template <class code>
+void list_viterbi_post_conv(const crf_post_t &post,
+                            const conv_config_t &config,
+                            const uint32_t msg_len,
+                            const std::vector<pos_band_t> &bands,
+                            decode_workspace_t &ws) {
+  // Parallel list Viterbi: every state keeps the list_size best paths into
+  // it rather than only the best, each extending one of the entries of a
+  // previous state. The best entry of each state is the Viterbi survivor, so
+  // the first path found is the one viterbi_post_conv_segment finds. The
+  // list_size best paths into the final state are left in ws.list_paths,
+  // best first, where each path is as ws.path.
+  const uint32_t L = config.list_size;
+  const uint32_t nstate_conv = code::nstate;
+  const uint32_t nstate_per_pos = nstate_conv * nstate_crf;
+  const uint8_t blank = nstate_crf - 1;
+  const float INF = std::numeric_limits<float>::infinity();
+  const uint32_t last_pos = msg_len + code::mem;
+  const uint64_t nstate_total_64 = (uint64_t)(last_pos + 1) * nstate_per_pos;
+  if (nstate_total_64 * L >= ((uint64_t)1 << 32))
+    throw std::runtime_error("Too many states, can't fit in 32 bits");
+  const uint32_t nblk = post.size();
+  ws.list_tb.reset(bands, nstate_per_pos, L);
+  std::vector<float> &curr_score = ws.curr_score, &prev_score = ws.prev_score;
+  curr_score.assign(nstate_total_64 * L, -INF);
+  prev_score.assign(nstate_total_64 * L, -INF);
+  pos_band_t curr_band = {0, 0}, prev_band = {0, 0};
+  const std::vector<known_bits_t> known = get_known_bits<code>(config, msg_len);
+  curr_score[(uint64_t)get_state_idx<code>(0, config.initial_state, blank) * L] = 0.0;
+
   for (uint32_t t = 0; t < nblk; t++) {
-    prev_score = curr_score;
-    // st2 is next state, st1 is previous
-    for (uint32_t st2_pos = 0; st2_pos < nstate_pos; st2_pos++) {
-      for (uint32_t st2_conv = 0; st2_conv < nstate_conv; st2_conv++) {
+    std::swap(prev_score, curr_score);
+    std::fill(curr_score.begin() + (uint64_t)get_state_idx<code>(prev_band.lo, 0, 0) * L,
+              curr_score.begin() + (uint64_t)get_state_idx<code>(prev_band.hi + 1, 0, 0) * L,
+              -INF);
+    prev_band = curr_band;
+    curr_band = bands[t];
+    const crf_mat_t &post_t = post[t];
+    for (uint32_t pos = curr_band.lo; pos <= curr_band.hi; pos++) {
+      for (uint32_t c = 0; c < nstate_conv; c++) {
+        // unreachable states keep score -INF and their traceback isn't read
+        if ((c ^ known[pos].value) & known[pos].mask) continue;
         for (uint8_t st2_crf = 0; st2_crf < nstate_crf; st2_crf++) {
-          uint32_t st2 = get_state_idx(st2_pos, st2_conv, st2_crf);
-          curr_score[st2] = -INF;
-          // now we consider two possibilities: if st2_crf is blank, then
-          // previous state has same pos and conv states, otherwise previous
-          // state has one less pos and may or may not have a valid previous
-          // conv state depending on the base in question
-          if (st2_crf == nstate_crf - 1) {
-            // blank
+          const uint32_t st2 = get_state_idx<code>(pos, c, st2_crf);
+          float *score = curr_score.data() + (uint64_t)st2 * L;
+          uint8_t *entry = ws.list_tb.entries(t, st2);
+          std::fill(entry, entry + L, 0);
+          if (st2_crf == blank) {
             for (uint8_t st1_crf = 0; st1_crf < nstate_crf; st1_crf++) {
-              uint32_t st1 = get_state_idx(st2_pos, st2_conv, st1_crf);
-              float score = prev_score[st1] + post[t][st2_crf][st1_crf];
-              if (score > curr_score[st2]) {
-                curr_score[st2] = score;
-                traceback[t][st2] = st1;
+              const float *prev = prev_score.data() +
+                  (uint64_t)get_state_idx<code>(pos, c, st1_crf) * L;
+              // entries are sorted, so stop at the first that doesn't enter
+              for (uint32_t r = 0; r < L; r++) {
+                const float cand = prev[r] + post_t[blank][st1_crf];
+                if (!(cand > score[L - 1])) break;
+                list_insert(score, entry, L, cand,
+                            make_decision(st1_crf, 0) | (r << 4));
               }
             }
-          } else {
-            // not blank
-            if (st2_pos == 0) continue;  // must have blank for pos 0
-            uint32_t st1_pos = st2_pos - 1;
-            // look at two possible previous states of convolutional code and
-            // see if the output for the transition matches the base st2_crf
-            bool curr_conv_bit = (st2_conv >> (mem_conv - 1));
-            // sync_markers
-            if (st1_pos < msg_len && (st1_pos%sync_marker_period < sync_marker_length))
-                if (curr_conv_bit != sync_marker[st1_pos%sync_marker_period])
-                    continue; // invalid transition
-            for (uint8_t conv_bit = 0; conv_bit < 2; conv_bit++) {
-              uint32_t st1_conv = prev_state[st2_conv][conv_bit];
-              if (2 * output[0][st1_conv][curr_conv_bit] +
-                      output[1][st1_conv][curr_conv_bit] ==
-                  st2_crf) {
-                for (uint8_t st1_crf = 0; st1_crf < nstate_crf; st1_crf++) {
-                  uint32_t st1 = get_state_idx(st1_pos, st1_conv, st1_crf);
-                  float score = prev_score[st1] + post[t][st2_crf][st1_crf];
-                  if (score > curr_score[st2]) {
-                    curr_score[st2] = score;
-                    traceback[t][st2] = st1;
-                  }
-                }
+            continue;
+          }
+          if (pos == 0) continue;
+          for (uint8_t conv_bit = 0; conv_bit < 2; conv_bit++) {
+            if (code::tables.base_in[conv_bit][c] != st2_crf) continue;
+            const uint32_t st1_conv = code::tables.prev_state[c][conv_bit];
+            for (uint8_t st1_crf = 0; st1_crf < nstate_crf; st1_crf++) {
+              const float *prev = prev_score.data() +
+                  (uint64_t)get_state_idx<code>(pos - 1, st1_conv, st1_crf) * L;
+              for (uint32_t r = 0; r < L; r++) {
+                const float cand = prev[r] + post_t[st2_crf][st1_crf];
+                if (!(cand > score[L - 1])) break;
+                list_insert(score, entry, L, cand,
+                            make_decision(st1_crf, conv_bit) | (r << 4));
               }
             }
           }
@@ -351,22 +921,60 @@ std::vector<bool> decode_post_conv(const std::vector<crf_mat_t> &post,
     }
   }
 
-  // traceback
-  std::vector<uint32_t> path(nblk + 1);
-  std::vector<uint8_t> crfpath(nblk + 1);
-  float score = -INF;
-  uint32_t st_pos = msg_len+mem_conv, st_conv = 0;  // last state
+  // best list_size entries over the CRF states of the final position
+  std::vector<float> final_score(L, -INF);
+  std::vector<uint32_t> final_st(L), final_rank(L);
   for (uint8_t st_crf = 0; st_crf < nstate_crf; st_crf++) {
-    uint32_t st = get_state_idx(st_pos, st_conv, st_crf);
-    if (curr_score[st] > score) {
-      score = curr_score[st];
-      path[nblk] = st;
+    const uint32_t st = get_state_idx<code>(last_pos, 0, st_crf);
+    for (uint32_t r = 0; r < L; r++) {
+      const float cand = curr_score[(uint64_t)st * L + r];
+      uint32_t i = L;
+      for (; i > 0 && cand > final_score[i - 1]; i--) {
+        if (i < L) {
+          final_score[i] = final_score[i - 1];
+          final_st[i] = final_st[i - 1];
+          final_rank[i] = final_rank[i - 1];
+        }
+      }
+      if (i < L) {
+        final_score[i] = cand;
+        final_st[i] = st;
+        final_rank[i] = r;
+      }
     }
   }
-  for (uint32_t t = nblk; t > 0; t--) path[t - 1] = traceback[t - 1][path[t]];
-  for (uint32_t t = 0; t < nblk+1; t++) crfpath[t] = path[t]%nstate_crf;
+  if (final_score[0] == -INF)
+    throw std::runtime_error("no valid path within band, try a wider band");
+  ws.list_paths.clear();
+  for (uint32_t k = 0; k < L && final_score[k] > -INF; k++) {
+    std::vector<uint32_t> path(nblk + 1);
+    path[nblk] = final_st[k];
+    uint32_t rank = final_rank[k];
+    for (uint32_t t = nblk; t > 0; t--) {
+      const uint8_t e = ws.list_tb.get(t - 1, path[t], rank);
+      path[t - 1] = decision_to_prev_state<code>(path[t], e & 0xF);
+      rank = e >> 4;
+    }
+    ws.list_paths.push_back(std::move(path));
+  }
+}
+
+void warn_if_crc_fails(const std::vector<bool> &msg,
+                       const conv_config_t &config) {
+  if (!check_crc(msg, config))
+    std::cerr << "decoded message fails CRC check\n";
+}
+
+template <class code>
+std::vector<bool> path_to_msg(const std::vector<uint32_t> &path,
+                              const conv_config_t &config,
+                              const uint32_t msg_len,
+                              std::vector<uint8_t> &crfpath) {
+  // message from the basecall of a path through the whole trellis
+  crfpath.resize(path.size());
+  for (uint32_t t = 0; t < path.size(); t++) crfpath[t] = state_idx_to_crf<code>(path[t]);
   std::vector<char> basecall = crfpath_to_basecall(crfpath);
-  if (basecall.size() != msg_len + mem_conv)
+  if (basecall.size() != msg_len + code::mem)
     throw std::runtime_error("incorrect decoded length");
   // convert basecall to bool vector and then decode using viterbi decode
   // function
@@ -393,15 +1001,159 @@ std::vector<bool> decode_post_conv(const std::vector<crf_mat_t> &post,
         throw std::runtime_error("unexpected character in basecall");
     }
   }
-  return viterbi_decode(channel_output, prev_state, next_state, output, true);
+  return viterbi_decode<code>(channel_output, config, true);
+}
+
+template <class code>
+std::vector<bool> decode_post_conv(const crf_post_t &post,
+                                   const conv_config_t &config,
+                                   const uint32_t msg_len,
+                                   const uint32_t band,
+                                   decode_workspace_t &ws) {
+  // band is the number of positions either side of the expected position
+  // searched at each block, 0 to search the full trellis
+  const uint32_t nblk = post.size();
+  if (post.size() < msg_len + code::mem)
+    throw std::runtime_error("Too small post matrix");
+  std::vector<pos_band_t> bands =
+      get_pos_bands(nblk, msg_len + code::mem + 1, band);
+  if (config.list_size <= 1) {
+    viterbi_post_conv_segment<code>(post, config, msg_len, bands, 0, nblk, ws);
+    std::vector<bool> msg = path_to_msg<code>(ws.path, config, msg_len, ws.crfpath);
+    warn_if_crc_fails(msg, config);
+    return msg;
+  }
+  // List decoding, the first message passing the CRC check is chosen. Paths
+  // differing only in their alignment to the signal give the same message,
+  // so each message is only checked once. Without a CRC, or if no message
+  // passes, this is the best path as from Viterbi.
+  list_viterbi_post_conv<code>(post, config, msg_len, bands, ws);
+  std::vector<std::vector<bool>> msgs;
+  for (const std::vector<uint32_t> &path : ws.list_paths) {
+    std::vector<bool> msg = path_to_msg<code>(path, config, msg_len, ws.crfpath);
+    if (std::find(msgs.begin(), msgs.end(), msg) != msgs.end()) continue;
+    if (config.crc_width == 0 || check_crc(msg, config)) return msg;
+    msgs.push_back(std::move(msg));
+  }
+  std::cerr << "no decoded message of list passes CRC check\n";
+  return msgs[0];
+}
+
+template <class code>
+std::vector<bool> decode_post_conv_parallel(const crf_post_t &post,
+                                            const conv_config_t &config,
+                                            const uint32_t msg_len,
+                                            const uint32_t band,
+                                            uint32_t nsegment,
+                                            const uint32_t overlap) {
+  // Time-parallel decoding. The blocks are split into nsegment segments,
+  // each decoded independently (OMP_NUM_THREADS, compile with -fopenmp)
+  // with overlap blocks of warm-up before it and of look-ahead after it.
+  // Neighbouring paths are spliced at the block nearest the boundary where
+  // they pass through the same state. If they never agree the overlap was
+  // too short for the survivors to merge and the message is decoded serially.
+  const uint32_t nblk = post.size();
+  if (post.size() < msg_len + code::mem)
+    throw std::runtime_error("Too small post matrix");
+  // segments must be longer than their overlaps with both neighbours, and
+  // list decoding is only done serially
+  nsegment = std::min(nsegment, nblk / (2 * overlap + 1));
+  if (config.list_size > 1) nsegment = 1;
+  if (nsegment <= 1) return decode_post_conv<code>(post, config, msg_len, band);
+  std::vector<pos_band_t> bands =
+      get_pos_bands(nblk, msg_len + code::mem + 1, band);
+  std::vector<uint32_t> boundary(nsegment + 1), seg_start(nsegment);
+  for (uint32_t k = 0; k <= nsegment; k++)
+    boundary[k] = ((uint64_t)k * nblk) / nsegment;
+  std::vector<std::vector<uint32_t>> paths(nsegment);
+  std::vector<std::string> errors(nsegment);
+#pragma omp parallel
+  {
+    decode_workspace_t ws;
+#pragma omp for schedule(dynamic)
+    for (int32_t k = 0; k < (int32_t)nsegment; k++) {
+      seg_start[k] = (boundary[k] > overlap) ? boundary[k] - overlap : 0;
+      const uint32_t seg_end = std::min(nblk, boundary[k + 1] + overlap);
+      try {
+        viterbi_post_conv_segment<code>(post, config, msg_len, bands,
+                                        seg_start[k], seg_end, ws);
+        paths[k] = ws.path;
+      } catch (const std::exception &e) {
+        errors[k] = e.what();
+      }
+    }
+  }
+  for (const std::string &error : errors)
+    if (!error.empty()) throw std::runtime_error(error);
+
+  // Splice, path k covers states at times seg_start[k] to seg_start[k] +
+  // paths[k].size() - 1. A segment that starts away from the beginning can
+  // only place itself in the message up to the period of the sync markers,
+  // so its path may be displaced by a whole number of periods. Paths agree
+  // when their CRF and conv states are the same, and the later path is then
+  // moved to the position of the earlier one.
+  const uint32_t nstate_per_pos = code::nstate * nstate_crf;
+  const int64_t last_pos = msg_len + code::mem;
+  std::vector<uint32_t> path;
+  path.reserve(nblk + 1);
+  uint32_t splice = 0;
+  bool spliced = true;
+  for (uint32_t k = 0; spliced && k + 1 < nsegment; k++) {
+    const uint32_t b = boundary[k + 1];
+    const uint32_t lo = seg_start[k + 1];
+    const uint32_t hi = seg_start[k] + paths[k].size() - 1;
+    uint32_t next_splice = 0;
+    int64_t offset = 0;
+    bool agree = false;
+    for (uint32_t d = 0; !agree && (b + d <= hi || b >= lo + d); d++) {
+      for (const uint32_t t : {b + d, b - d}) {
+        if (t < lo || t > hi) continue;
+        const uint32_t st1 = paths[k][t - seg_start[k]];
+        const uint32_t st2 = paths[k + 1][t - seg_start[k + 1]];
+        offset = (int64_t)(st1 / nstate_per_pos) - (st2 / nstate_per_pos);
+        if (st1 % nstate_per_pos == st2 % nstate_per_pos &&
+            (config.sync_marker.empty() ||
+             offset % config.sync_marker_period == 0)) {
+          next_splice = t;
+          agree = true;
+          break;
+        }
+      }
+    }
+    spliced = agree;
+    for (uint32_t &st : paths[k + 1]) {
+      const int64_t pos = (int64_t)(st / nstate_per_pos) + offset;
+      spliced = spliced && pos >= 0 && pos <= last_pos;
+      st += offset * nstate_per_pos;
+    }
+    path.insert(path.end(), paths[k].begin() + (splice - seg_start[k]),
+                paths[k].begin() + (next_splice - seg_start[k]));
+    splice = next_splice;
+  }
+  // the last segment must still finish at the last position
+  spliced = spliced && paths.back().back() / nstate_per_pos == last_pos;
+  if (!spliced) {
+    std::cerr << "survivors of neighbouring segments disagree, decoding "
+                 "serially; try a longer overlap\n";
+    return decode_post_conv<code>(post, config, msg_len, band);
+  }
+  const uint32_t k = nsegment - 1;
+  path.insert(path.end(), paths[k].begin() + (splice - seg_start[k]),
+              paths[k].end());
+  std::vector<uint8_t> crfpath;
+  std::vector<bool> msg = path_to_msg<code>(path, config, msg_len, crfpath);
+  warn_if_crc_fails(msg, config);
+  return msg;
 }
 
+template <class code>
 std::vector<bool> viterbi_decode(const std::vector<bool> &channel_output,
-                                 const conv_arr_t &prev_state, const conv_arr_t &next_state,
-                                 const conv_arr_t *output,
+                                 const conv_config_t &config,
                                  const bool must_be_perfect) {
   // must_be_perfect flag for cases when we expect 0 errors (e.g., when called
   // from decode_post_conv)
+  const uint8_t mem_conv = code::mem;
+  const uint32_t nstate_conv = code::nstate;
   float INF = std::numeric_limits<float>::infinity();
   uint32_t out_size = channel_output.size();
   if (out_size % n_out_conv != 0)
@@ -411,32 +1163,17 @@ std::vector<bool> viterbi_decode(const std::vector<bool> &channel_output,
     throw std::runtime_error("too small channel output");
   std::vector<std::array<uint32_t, nstate_conv>> traceback(in_size);
   std::vector<float> curr_score(nstate_conv, -INF), prev_score(nstate_conv);
-  curr_score[initial_state_conv] = 0.0;
+  curr_score[config.initial_state] = 0.0;
   for (uint32_t t = 0; t < in_size; t++) {
-    prev_score = curr_score;
-    for (uint32_t st2 = 0; st2 < nstate_conv; st2++) {
-      // st2 = next state
-      uint32_t st1 = prev_state[st2][0];
-      bool curr_bit = (st2 >> (mem_conv - 1));
-      // sync_markers
-      if (t < in_size - mem_conv && (t%sync_marker_period < sync_marker_length))
-        if (curr_bit != sync_marker[t%sync_marker_period])
-            continue; // invalid transition
-      curr_score[st2] =
-          prev_score[st1] -
-          (float)(channel_output[2 * t] != output[0][st1][curr_bit]) -
-          (float)(channel_output[2 * t + 1] != output[1][st1][curr_bit]);
-      traceback[t][st2] = st1;
-      st1 = prev_state[st2][1];
-      float score =
-          prev_score[st1] -
-          (float)(channel_output[2 * t] != output[0][st1][curr_bit]) -
-          (float)(channel_output[2 * t + 1] != output[1][st1][curr_bit]);
-      if (score > curr_score[st2]) {
-        curr_score[st2] = score;
-        traceback[t][st2] = st1;
-      }
-    }
+    std::swap(prev_score, curr_score);
+    // sync_markers, states entered by an invalid bit get score -INF
+    bool sync_ok[2] = {true, true};
+    if (t < in_size - mem_conv)
+      for (uint32_t bit = 0; bit < 2; bit++)
+        sync_ok[bit] = sync_allows(config, t, bit);
+    uint32_t received = 2 * channel_output[2 * t] + channel_output[2 * t + 1];
+    viterbi_acs_step<code>(prev_score.data(), curr_score.data(),
+                           traceback[t].data(), received, sync_ok);
   }
   if (must_be_perfect && (curr_score[0] != 0.0))
     throw std::runtime_error(
@@ -451,3 +1188,113 @@ std::vector<bool> viterbi_decode(const std::vector<bool> &channel_output,
   decoded_msg.resize(in_size - mem_conv);
   return decoded_msg;
 }
+
+std::vector<batch_trial_t> read_batch_manifest(const std::string &infile) {
+  // one trial per line: posterior_file msg_len [band] [true_msg_file]
+  // blank lines and lines starting with # are ignored
+  std::ifstream fin(infile);
+  if (!fin) throw std::runtime_error("can't open manifest " + infile);
+  std::vector<batch_trial_t> trials;
+  std::string line;
+  while (std::getline(fin, line)) {
+    std::istringstream fields(line);
+    batch_trial_t trial = {"", "", 0, 0};
+    if (!(fields >> trial.post_file) || trial.post_file[0] == '#') continue;
+    if (!(fields >> trial.msg_len))
+      throw std::runtime_error("no message length for " + trial.post_file);
+    if (fields >> trial.band) fields >> trial.msg_file;
+    trials.push_back(trial);
+  }
+  return trials;
+}
+
+uint32_t edit_distance(const std::vector<bool> &a, const std::vector<bool> &b) {
+  // Levenshtein distance keeping a single row of the table
+  std::vector<uint32_t> row(b.size() + 1);
+  for (uint32_t j = 0; j <= b.size(); j++) row[j] = j;
+  for (uint32_t i = 1; i <= a.size(); i++) {
+    uint32_t diag = row[0];
+    row[0] = i;
+    for (uint32_t j = 1; j <= b.size(); j++) {
+      const uint32_t up = row[j];
+      row[j] = std::min({up + 1, row[j - 1] + 1,
+                         diag + (a[i - 1] != b[j - 1] ? 1u : 0u)});
+      diag = up;
+    }
+  }
+  return row[b.size()];
+}
+
+template <class code>
+std::vector<batch_result_t> decode_batch(
+    const std::vector<batch_trial_t> &trials, const conv_config_t &config) {
+  // trials are independent, so are shared dynamically between threads
+  // (OMP_NUM_THREADS, compile with -fopenmp), each with its own buffers
+  std::vector<batch_result_t> results(trials.size());
+#pragma omp parallel
+  {
+    decode_workspace_t ws;
+#pragma omp for schedule(dynamic)
+    for (int64_t i = 0; i < (int64_t)trials.size(); i++) {
+      const batch_trial_t &trial = trials[i];
+      batch_result_t &res = results[i];
+      res.decoded = false;
+      res.edit_distance = -1;
+      const auto start = std::chrono::steady_clock::now();
+      try {
+        crf_post_t post(trial.post_file);
+        res.msg = decode_post_conv<code>(post, config, trial.msg_len,
+                                         trial.band, ws);
+        res.decoded = true;
+      } catch (const std::exception &e) {
+        res.error = e.what();
+      }
+      res.seconds = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start)
+                        .count();
+      if (!trial.msg_file.empty()) {
+        try {
+          res.edit_distance = edit_distance(res.msg, read_bitstream(trial.msg_file).to_vector());
+        } catch (const std::exception &e) {
+          res.error += std::string(res.error.empty() ? "" : "; ") + e.what();
+        }
+      }
+    }
+  }
+  return results;
+}
+
+void write_batch_results(const std::vector<batch_trial_t> &trials,
+                         const std::vector<batch_result_t> &results,
+                         const std::string &outfile) {
+  // tab separated, one row per trial in manifest order. success is 1 when
+  // the decoded message equals the true message, NA if it's not known.
+  std::ofstream fout(outfile);
+  fout << "trial\tposterior\tmsg_len\tband\tdecoded\tsuccess\t"
+          "edit_distance\tseconds\tmessage\terror\n";
+  uint32_t ndecoded = 0, nsuccess = 0, nknown = 0;
+  double total_seconds = 0.0;
+  for (uint32_t i = 0; i < trials.size(); i++) {
+    const batch_trial_t &trial = trials[i];
+    const batch_result_t &res = results[i];
+    const bool known = res.edit_distance >= 0;
+    const bool success = res.decoded && res.edit_distance == 0;
+    ndecoded += res.decoded;
+    nknown += known;
+    nsuccess += success;
+    total_seconds += res.seconds;
+    fout << i << '\t' << trial.post_file << '\t' << trial.msg_len << '\t'
+         << trial.band << '\t' << res.decoded << '\t';
+    if (known)
+      fout << success << '\t' << res.edit_distance;
+    else
+      fout << "NA\tNA";
+    fout << '\t' << res.seconds << '\t';
+    for (bool b : res.msg) fout << (b ? '1' : '0');
+    fout << '\t' << (res.error.empty() ? "-" : res.error) << '\n';
+  }
+  std::cerr << "decoded " << ndecoded << " of " << trials.size()
+            << " trials, " << nsuccess << " of " << nknown
+            << " with known message correct, " << total_seconds
+            << " s decoding\n";
+}
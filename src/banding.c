@@ -0,0 +1,338 @@
+#include <assert.h>
+#include <err.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "banding.h"
+#include "decode.h"
+#include "scrappie_seq_helpers.h"
+#include "scrappie_stdlib.h"
+#include "util.h"
+
+#define BIG_FLOAT 1.e30f
+
+//  Length of k-mer used to anchor basecall to sequence
+static const size_t seed_kmer_len = 12;
+//  Chains with fewer anchors per basecall k-mer suggest the basecall does not match the sequence
+static const float min_anchor_density = 0.02f;
+//  Number of times the margin is doubled when the path hits the edge of the band
+static const size_t max_band_retries = 3;
+
+typedef struct {
+    int kmer;
+    int pos;
+} kmer_pos;
+
+static int kmer_pos_cmp(const void * a, const void * b) {
+    const kmer_pos * ka = (const kmer_pos *) a;
+    const kmer_pos * kb = (const kmer_pos *) b;
+    if (ka->kmer != kb->kmer) {
+        return (ka->kmer < kb->kmer) ? -1 : 1;
+    }
+    return (ka->pos < kb->pos) ? -1 : (ka->pos > kb->pos);
+}
+
+
+/**  Position of unique occurrence of k-mer in sorted table
+ *
+ *   @returns Position of k-mer or -1 if it does not occur exactly once
+ **/
+static int unique_kmer_position(kmer_pos const * table, size_t n, int kmer) {
+    size_t lo = 0;
+    size_t hi = n;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (table[mid].kmer < kmer) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == n || table[lo].kmer != kmer) {
+        return -1;
+    }
+    if (lo + 1 < n && table[lo + 1].kmer == kmer) {
+        return -1;
+    }
+    return table[lo].pos;
+}
+
+
+/**  Estimate the sequence position of each block from a basecall
+ *
+ *   k-mers occurring exactly once in the sequence are looked up in the
+ *   basecall, and the longest chain of anchors increasing in both basecall and
+ *   sequence is kept (longest increasing subsequence).  The position of each
+ *   block is linearly interpolated between anchors, and extrapolated with unit
+ *   slope beyond the first and last anchors, so may lie outside the sequence.
+ *
+ *   @param basecall  Basecall of read, null terminated
+ *   @param callpos   Position in basecall of each block [nblock], non-decreasing
+ *   @param nblock    Number of blocks
+ *   @param bases     Sequence to map to
+ *   @param nbase     Length of bases
+ *   @param k         Length of anchoring k-mer, at most 15
+ *
+ *   @returns Array [nblock] of estimated positions or NULL if too few anchors were found
+ **/
+int * seed_positions_from_basecall(char const * basecall, int const * callpos, size_t nblock,
+                                   char const * bases, size_t nbase, size_t k) {
+    RETURN_NULL_IF(NULL == basecall, NULL);
+    RETURN_NULL_IF(NULL == callpos, NULL);
+    RETURN_NULL_IF(NULL == bases, NULL);
+    assert(k > 0 && k <= 15);
+
+    const size_t ncall = strlen(basecall);
+    if (ncall < k || nbase < k || 0 == nblock) {
+        return NULL;
+    }
+    const size_t ncallk = ncall - k + 1;
+    const size_t nbasek = nbase - k + 1;
+
+    int * callk = encode_bases_to_integers(basecall, ncall, k);
+    int * basek = encode_bases_to_integers(bases, nbase, k);
+    kmer_pos * table = calloc(nbasek, sizeof(kmer_pos));
+    //  Anchors, in order of basecall position, then chain through them
+    int * anchor_call = calloc(ncallk, sizeof(int));
+    int * anchor_seq = calloc(ncallk, sizeof(int));
+    int * tail = calloc(ncallk, sizeof(int));
+    int * prev = calloc(ncallk, sizeof(int));
+    int * seedpos = NULL;
+    if (NULL == callk || NULL == basek || NULL == table || NULL == anchor_call
+        || NULL == anchor_seq || NULL == tail || NULL == prev) {
+        goto clean;
+    }
+
+    for (size_t i = 0; i < nbasek; i++) {
+        table[i].kmer = basek[i];
+        table[i].pos = i;
+    }
+    qsort(table, nbasek, sizeof(kmer_pos), kmer_pos_cmp);
+
+    size_t nanchor = 0;
+    for (size_t i = 0; i < ncallk; i++) {
+        const int pos = unique_kmer_position(table, nbasek, callk[i]);
+        if (pos >= 0) {
+            anchor_call[nanchor] = i;
+            anchor_seq[nanchor] = pos;
+            nanchor += 1;
+        }
+    }
+
+    //  Longest chain strictly increasing in sequence position.  tail[l] is the
+    //  anchor ending the best chain of length l + 1 found so far.
+    size_t nchain = 0;
+    for (size_t i = 0; i < nanchor; i++) {
+        size_t lo = 0;
+        size_t hi = nchain;
+        while (lo < hi) {
+            const size_t mid = lo + (hi - lo) / 2;
+            if (anchor_seq[tail[mid]] < anchor_seq[i]) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        prev[i] = (lo > 0) ? tail[lo - 1] : -1;
+        tail[lo] = i;
+        if (lo == nchain) {
+            nchain += 1;
+        }
+    }
+    if (nchain < 2 || nchain < min_anchor_density * ncallk) {
+        goto clean;
+    }
+
+    //  Recover chain, reusing the anchor arrays from the front
+    {
+        int idx = tail[nchain - 1];
+        for (size_t i = nchain; i > 0; i--) {
+            tail[i - 1] = idx;
+            idx = prev[idx];
+        }
+        for (size_t i = 0; i < nchain; i++) {
+            prev[i] = anchor_call[tail[i]];
+            tail[i] = anchor_seq[tail[i]];
+        }
+    }
+    int const * chain_call = prev;
+    int const * chain_seq = tail;
+
+    seedpos = calloc(nblock, sizeof(int));
+    if (NULL == seedpos) {
+        goto clean;
+    }
+    for (size_t blk = 0, j = 0; blk < nblock; blk++) {
+        const int p = callpos[blk];
+        while (j + 1 < nchain && chain_call[j + 1] <= p) {
+            j += 1;
+        }
+        if (p < chain_call[0]) {
+            seedpos[blk] = chain_seq[0] - (chain_call[0] - p);
+        } else if (j + 1 == nchain) {
+            seedpos[blk] = chain_seq[j] + (p - chain_call[j]);
+        } else {
+            const float slope = (float)(chain_seq[j + 1] - chain_seq[j])
+                              / (float)(chain_call[j + 1] - chain_call[j]);
+            seedpos[blk] = chain_seq[j] + (int)lroundf(slope * (p - chain_call[j]));
+        }
+    }
+
+ clean:
+    free(prev);
+    free(tail);
+    free(anchor_seq);
+    free(anchor_call);
+    free(table);
+    free(basek);
+    free(callk);
+
+    return seedpos;
+}
+
+
+/**  Band around estimated positions
+ *
+ *   Each block is allowed positions within margin of its estimate.  The band
+ *   is then widened where necessary so it starts at zero, ends at seqlen, is
+ *   monotonic and consecutive blocks overlap.
+ *
+ *   @param seedpos  Estimated position of each block [nblock], may lie outside sequence
+ *   @param nblock   Number of blocks
+ *   @param seqlen   Length of sequence
+ *   @param margin   Number of positions allowed either side of estimate
+ *   @param poslow, poshigh  Bounds [out], low inclusive, high exclusive
+ *
+ *   @returns Whether bounds are sane
+ **/
+bool band_from_seed_positions(int const * seedpos, size_t nblock, size_t seqlen, size_t margin,
+                              size_t * poslow, size_t * poshigh) {
+    RETURN_NULL_IF(NULL == seedpos, false);
+    RETURN_NULL_IF(NULL == poslow, false);
+    RETURN_NULL_IF(NULL == poshigh, false);
+    RETURN_NULL_IF(0 == nblock, false);
+
+    const long lseqlen = seqlen;
+    for (size_t blk = 0; blk < nblock; blk++) {
+        const long low = (long)seedpos[blk] - (long)margin;
+        const long high = (long)seedpos[blk] + (long)margin + 1;
+        poslow[blk] = (low < 0) ? 0 : ((low > lseqlen) ? seqlen : (size_t)low);
+        poshigh[blk] = (high < 0) ? 0 : ((high > lseqlen) ? seqlen : (size_t)high);
+    }
+    poslow[0] = 0;
+    poshigh[nblock - 1] = seqlen;
+
+    //  Monotonic bounds, widening rather than narrowing
+    for (size_t blk = nblock - 1; blk > 0; blk--) {
+        if (poslow[blk - 1] > poslow[blk]) {
+            poslow[blk - 1] = poslow[blk];
+        }
+    }
+    for (size_t blk = 1; blk < nblock; blk++) {
+        if (poshigh[blk] < poshigh[blk - 1]) {
+            poshigh[blk] = poshigh[blk - 1];
+        }
+        if (poslow[blk] > poshigh[blk - 1]) {
+            poslow[blk] = poshigh[blk - 1];
+        }
+    }
+
+    return are_bounds_sane(poslow, poshigh, nblock, seqlen);
+}
+
+
+/**  Viterbi mapping of posterior to sequence within automatically derived band
+ *
+ *   The read is basecalled with the fixed-point transducer decoder and the basecall
+ *   anchored to the sequence to estimate a band (see
+ *   seed_positions_from_basecall).  If the best path within the band runs along
+ *   the edge of the band, the margin is doubled and the mapping repeated.
+ *   When no band can be derived, or every band tried is unsatisfactory, the
+ *   full map_to_sequence_viterbi is used instead.
+ *
+ *   @param logpost   Log posterior probability of state at each block.  Stay is last state.
+ *   @param stay_pen  Penalty for staying
+ *   @param skip_pen  Penalty for skipping
+ *   @param local_pen Penalty for local mapping (stay in start or ends state)
+ *   @param bases     Sequence to map to, null terminated
+ *   @param seq       Sequence encoded into same history states as basecalls
+ *   @param seqlen    Length of seq
+ *   @param margin    Initial number of positions allowed either side of seed
+ *   @param path      Viterbi path [out].  If NULL, no path is returned
+ *
+ *   @returns score
+ **/
+float map_to_sequence_viterbi_seeded(const_scrappie_matrix logpost, float stay_pen, float skip_pen,
+                                     float local_pen, char const * bases, int const * seq, size_t seqlen,
+                                     size_t margin, int * path) {
+    float logscore = NAN;
+    RETURN_NULL_IF(NULL == logpost, logscore);
+    RETURN_NULL_IF(NULL == bases, logscore);
+    RETURN_NULL_IF(NULL == seq, logscore);
+
+    const size_t nblock = logpost->nc;
+    const size_t nbase = strlen(bases);
+
+    //  Transducer path has an initial state before the first block
+    int * callpath = calloc(nblock + 1, sizeof(int));
+    int * callpos = calloc(nblock + 1, sizeof(int));
+    int * bandpath = calloc(nblock, sizeof(int));
+    size_t * poslow = calloc(nblock, sizeof(size_t));
+    size_t * poshigh = calloc(nblock, sizeof(size_t));
+    char * basecall = NULL;
+    int * seedpos = NULL;
+    bool mapped = false;
+    if (NULL == callpath || NULL == callpos || NULL == bandpath || NULL == poslow || NULL == poshigh) {
+        goto clean;
+    }
+
+    decode_transducer_fixed(logpost, stay_pen, skip_pen, local_pen, callpath, false);
+    basecall = overlapper(callpath, nblock + 1, logpost->nr - 1, callpos);
+    seedpos = seed_positions_from_basecall(basecall, callpos + 1, nblock, bases, nbase, seed_kmer_len);
+    if (NULL == seedpos) {
+        goto clean;
+    }
+
+    for (size_t attempt = 0, m = margin; attempt <= max_band_retries && !mapped; attempt++, m *= 2) {
+        if (!band_from_seed_positions(seedpos, nblock, seqlen, m, poslow, poshigh)) {
+            break;
+        }
+        logscore = map_to_sequence_viterbi_banded(logpost, stay_pen, skip_pen, local_pen, seq, seqlen,
+                                                  poslow, poshigh, bandpath);
+        if (!isfinite(logscore) || logscore <= -0.5f * BIG_FLOAT) {
+            continue;
+        }
+        //  Accept if no block was constrained by the band
+        mapped = true;
+        for (size_t blk = 0; blk < nblock && mapped; blk++) {
+            if (bandpath[blk] < 0) {
+                continue;
+            }
+            const size_t pos = bandpath[blk];
+            if ((pos == poslow[blk] && poslow[blk] > 0) || (pos + 1 == poshigh[blk] && poshigh[blk] < seqlen)) {
+                mapped = false;
+            }
+        }
+    }
+
+ clean:
+    if (mapped) {
+        if (NULL != path) {
+            for (size_t blk = 0; blk < nblock; blk++) {
+                path[blk] = bandpath[blk];
+            }
+        }
+    } else {
+        logscore = map_to_sequence_viterbi(logpost, stay_pen, skip_pen, local_pen, seq, seqlen, path);
+    }
+
+    free(seedpos);
+    free(basecall);
+    free(poshigh);
+    free(poslow);
+    free(bandpath);
+    free(callpos);
+    free(callpath);
+
+    return logscore;
+}
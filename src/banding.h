@@ -0,0 +1,28 @@
+#pragma once
+#ifndef BANDING_H
+#    define BANDING_H
+
+/**  Automatic bands for mapping posteriors to a sequence
+ *
+ *   The banded mapping functions need, for every block, the range of sequence
+ *   positions the path may occupy.  Here the range is derived from a cheap
+ *   seed: the read is basecalled, unique k-mers shared between basecall and
+ *   sequence are chained into a colinear set of anchors, and the anchors are
+ *   interpolated to give an estimated position for each block.  The band is
+ *   the estimate widened by a margin and tidied so that it satisfies
+ *   are_bounds_sane.
+ **/
+
+#    include <stdbool.h>
+#    include <stddef.h>
+#    include "scrappie_matrix.h"
+
+int * seed_positions_from_basecall(char const * basecall, int const * callpos, size_t nblock,
+                                   char const * bases, size_t nbase, size_t k);
+bool band_from_seed_positions(int const * seedpos, size_t nblock, size_t seqlen, size_t margin,
+                              size_t * poslow, size_t * poshigh);
+float map_to_sequence_viterbi_seeded(const_scrappie_matrix logpost, float stay_pen, float skip_pen,
+                                     float local_pen, char const * bases, int const * seq, size_t seqlen,
+                                     size_t margin, int * path);
+
+#endif                          /* BANDING_H */
@@ -0,0 +1,219 @@
+#include <err.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "basecall_context.h"
+#include "decode.h"
+#include "scrappie_common.h"
+#include "scrappie_stdlib.h"
+
+struct basecall_context {
+    enum raw_model_type model;
+    basecall_context_param param;
+};
+
+
+/**  Make a context for basecalling reads
+ *
+ *   @param model  Name of raw model, as given to scrappie raw
+ *   @param param  Parameters of basecalling, defaults if NULL
+ *
+ *   @returns Context, to be freed with free_basecall_context, or NULL on failure
+ **/
+basecall_context * make_basecall_context(const char * model, const basecall_context_param * param) {
+    RETURN_NULL_IF(NULL == model, NULL);
+    const enum raw_model_type model_type = get_raw_model(model);
+    if (SCRAPPIE_MODEL_INVALID == model_type) {
+        warnx("Unrecognised model %s.", model);
+        return NULL;
+    }
+    const basecall_context_param p = (NULL != param) ? *param : basecall_context_defaults;
+    RETURN_NULL_IF(p.homopolymer >= HOMOPOLYMER_INVALID, NULL);
+    RETURN_NULL_IF(0 == p.nthread || 0 == p.batch_size, NULL);
+    if (p.quality && SCRAPPIE_MODEL_RNNRF_R9_4 != model_type) {
+        warnx("Qualities are only found for CRF models.");
+        return NULL;
+    }
+
+    basecall_context * context = calloc(1, sizeof(basecall_context));
+    RETURN_NULL_IF(NULL == context, NULL);
+    context->model = model_type;
+    context->param = p;
+    return context;
+}
+
+
+basecall_context * free_basecall_context(basecall_context * context) {
+    free(context);
+    return NULL;
+}
+
+
+void basecall_result_release(basecall_result * res) {
+    if (NULL == res) {
+        return;
+    }
+    free(res->basecall);
+    free(res->quality);
+    free(res->pos);
+    *res = (basecall_result){0};
+}
+
+
+/**  View of signal, trimmed and normalised
+ *
+ *   The signal is neither copied nor modified: trimming moves the start and
+ *   end of the view and normalisation is applied as features are created.
+ *
+ *   @returns Table of signal, with raw NULL if all of the signal is trimmed
+ **/
+static raw_table prepare_signal(const basecall_context * context, const float * signal, size_t n) {
+    const basecall_context_param * p = &context->param;
+    //  Signal is only read through the view, so const is safely cast away
+    raw_table rt = trim_raw_view((raw_table){NULL, n, 0, n, (float *)signal}, p->trim_start, p->trim_end,
+                                 p->varseg_chunk, p->varseg_thresh);
+    if (rt.start >= rt.end) {
+        return (raw_table){0};
+    }
+    return medmad_normalise_raw(rt);
+}
+
+
+/**  Decode posterior of a read, as scrappie raw does by default
+ *
+ *   @returns true on success
+ **/
+static bool decode_posterior(const basecall_context * context, const_scrappie_matrix post,
+                             raw_table rt, basecall_result * res) {
+    const basecall_context_param * p = &context->param;
+    const size_t nblock = post->nc;
+    int * path = calloc(nblock + 1, sizeof(int));
+    int * pos = calloc(nblock + 1, sizeof(int));
+    if (NULL == path || NULL == pos) {
+        free(pos);
+        free(path);
+        return false;
+    }
+
+    float score = NAN;
+    char * basecall = NULL;
+    char * quality = NULL;
+    if (SCRAPPIE_MODEL_RNNRF_R9_4 != context->model) {
+        basecall = decode_transducer_basecall(post, p->stay_pen, p->skip_pen, p->local_pen, p->use_slip,
+                                              p->homopolymer, path, pos, &score);
+    } else if (p->quality) {
+        float * perr = calloc(nblock + 1, sizeof(float));
+        if (NULL != perr) {
+            score = decode_crf_quality(post, path, perr);
+            basecall = crfpath_to_basecall(path, nblock, pos);
+            quality = crfpath_to_quality(path, perr, nblock);
+        }
+        free(perr);
+    } else {
+        score = decode_crf(post, path);
+        basecall = crfpath_to_basecall(path, nblock, pos);
+    }
+    free(path);
+
+    if (NULL == basecall || (p->quality && NULL == quality)) {
+        free(quality);
+        free(basecall);
+        free(pos);
+        return false;
+    }
+    *res = (basecall_result){basecall, quality, score, pos, nblock, rt.start, rt.end};
+    return true;
+}
+
+
+/**  Basecall a read
+ *
+ *   May be called from any number of threads at once on the same context.
+ *
+ *   @param signal  Signal of read in pA [n], not modified
+ *   @param res [out]  Basecall, to be released with basecall_result_release.
+ *   Zeroed on failure
+ *
+ *   @returns true on success, false if read could not be called
+ **/
+bool basecall_context_call(const basecall_context * context, const float * signal, size_t n,
+                           basecall_result * res) {
+    RETURN_NULL_IF(NULL == res, false);
+    *res = (basecall_result){0};
+    RETURN_NULL_IF(NULL == context, false);
+    RETURN_NULL_IF(NULL == signal, false);
+
+    raw_table rt = prepare_signal(context, signal, n);
+    if (NULL == rt.raw) {
+        return false;
+    }
+    const basecall_context_param * p = &context->param;
+    scrappie_matrix post = get_posterior_function(context->model)(rt, p->min_prob, p->tempW, p->tempb, true);
+    const bool ok = (NULL != post) && decode_posterior(context, post, rt, res);
+    post = free_scrappie_matrix(post);
+    return ok;
+}
+
+
+/**  Basecall a batch of reads
+ *
+ *   Reads are evaluated batch_size at a time on nthread threads.  May be
+ *   called from any number of threads at once on the same context.
+ *
+ *   @param signal  Signal of each read in pA [nread][n[i]], not modified
+ *   @param n  Length of signal of each read [nread]
+ *   @param res [out]  Basecall of each read [nread], to be released with
+ *   basecall_result_release.  Zeroed for reads that could not be called
+ *
+ *   @returns Number of reads called
+ **/
+size_t basecall_context_call_batch(const basecall_context * context, const float * const * signal,
+                                   const size_t * n, size_t nread, basecall_result * res) {
+    RETURN_NULL_IF(NULL == res, 0);
+    for (size_t i = 0; i < nread; i++) {
+        res[i] = (basecall_result){0};
+    }
+    RETURN_NULL_IF(NULL == context, 0);
+    RETURN_NULL_IF(NULL == signal, 0);
+    RETURN_NULL_IF(NULL == n, 0);
+
+    const basecall_context_param * p = &context->param;
+    posterior_batch_function_ptr calcpost = get_posterior_batch_function(context->model);
+    const size_t batch_size = p->batch_size;
+    const size_t nsub = (nread + batch_size - 1) / batch_size;
+    size_t ncalled = 0;
+#pragma omp parallel for schedule(dynamic) num_threads(p->nthread) reduction(+:ncalled)
+    for (size_t sub = 0; sub < nsub; sub++) {
+        const size_t start = sub * batch_size;
+        const size_t end = (start + batch_size < nread) ? (start + batch_size) : nread;
+        //  Reads that are trimmed away are dropped from the batch evaluated
+        size_t * index = calloc(end - start, sizeof(size_t));
+        raw_table * rts = calloc(end - start, sizeof(raw_table));
+        size_t nvalid = 0;
+        for (size_t i = start; NULL != index && NULL != rts && i < end; i++) {
+            if (NULL == signal[i]) {
+                continue;
+            }
+            raw_table rt = prepare_signal(context, signal[i], n[i]);
+            if (NULL != rt.raw) {
+                index[nvalid] = i;
+                rts[nvalid] = rt;
+                nvalid += 1;
+            }
+        }
+        scrappie_matrix * post = (nvalid > 0) ? calcpost(rts, nvalid, p->min_prob, p->tempW, p->tempb, true) : NULL;
+        for (size_t j = 0; j < nvalid; j++) {
+            if (NULL != post && NULL != post[j] && decode_posterior(context, post[j], rts[j], res + index[j])) {
+                ncalled += 1;
+            }
+            if (NULL != post) {
+                post[j] = free_scrappie_matrix(post[j]);
+            }
+        }
+        free(post);
+        free(rts);
+        free(index);
+    }
+    return ncalled;
+}
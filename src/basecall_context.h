@@ -0,0 +1,86 @@
+#pragma once
+#ifndef BASECALL_CONTEXT_H
+#    define BASECALL_CONTEXT_H
+
+/**  Reentrant basecalling of reads from raw signal
+ *
+ *   A context holds everything the raw basecaller takes from its command
+ *   line: the model, the trimming of signal, the penalties of the decoder
+ *   and the number of threads used by batch calls.  Nothing in a context
+ *   changes once it is made, and each call allocates its own workspace, so
+ *   any number of threads may call on the same context without locking.
+ *
+ *   A batch call divides its reads into batches of batch_size, each of
+ *   which is evaluated by the batched posterior function of the model, on a
+ *   team of nthread OpenMP threads.  A batch call made from within a
+ *   parallel region runs on the calling thread, see the nesting of OpenMP.
+ **/
+
+#    include <stdbool.h>
+#    include <stddef.h>
+#    include "homopolymer.h"
+#    include "networks.h"
+
+typedef struct {
+    size_t trim_start;
+    size_t trim_end;
+    size_t varseg_chunk;
+    float varseg_thresh;
+    float min_prob;
+    float tempW;
+    float tempb;
+    float stay_pen;
+    float skip_pen;
+    float local_pen;
+    bool use_slip;
+    enum homopolymer_calculation homopolymer;
+    //  Find quality of each base, CRF models only
+    bool quality;
+    //  Threads and reads evaluated together by batch calls
+    size_t nthread;
+    size_t batch_size;
+} basecall_context_param;
+
+static basecall_context_param const basecall_context_defaults = {
+    .trim_start = 200,
+    .trim_end = 10,
+    .varseg_chunk = 100,
+    .varseg_thresh = 0.0f,
+    .min_prob = 1e-5f,
+    .tempW = 1.0f,
+    .tempb = 1.0f,
+    .stay_pen = 0.0f,
+    .skip_pen = 0.0f,
+    .local_pen = 2.0f,
+    .use_slip = false,
+    .homopolymer = HOMOPOLYMER_MEAN,
+    .quality = false,
+    .nthread = 1,
+    .batch_size = 8
+};
+
+typedef struct basecall_context basecall_context;
+
+//  Basecall of a read, to be released with basecall_result_release
+typedef struct {
+    char * basecall;
+    //  Phred quality of each base as FASTQ, NULL unless asked for
+    char * quality;
+    float score;
+    //  Position in basecall of each block
+    int * pos;
+    size_t nblock;
+    //  Samples of signal called, after trimming
+    size_t start;
+    size_t end;
+} basecall_result;
+
+basecall_context * make_basecall_context(const char * model, const basecall_context_param * param);
+basecall_context * free_basecall_context(basecall_context * context);
+bool basecall_context_call(const basecall_context * context, const float * signal, size_t n,
+                           basecall_result * res);
+size_t basecall_context_call_batch(const basecall_context * context, const float * const * signal,
+                                   const size_t * n, size_t nread, basecall_result * res);
+void basecall_result_release(basecall_result * res);
+
+#endif                          /* BASECALL_CONTEXT_H */
@@ -0,0 +1,359 @@
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include "basecall_stream.h"
+#include "decode.h"
+#include "layers.h"
+#include "scrappie_stdlib.h"
+#include "util.h"
+
+
+/**  Make a stream for basecalling signal as it arrives
+ *
+ *   @param model  Raw model, which must have a recurrent_network description
+ *   @param param  Parameters of stream
+ *
+ *   @returns Stream, to be freed with free_basecall_stream, or NULL on failure
+ **/
+basecall_stream * make_basecall_stream(const enum raw_model_type model, const basecall_stream_param param) {
+    recurrent_network net;
+    if (!get_recurrent_network(model, &net)) {
+        warnx("Model %s cannot be streamed.", raw_model_string(model));
+        return NULL;
+    }
+    basecall_stream * stream = calloc(1, sizeof(basecall_stream));
+    RETURN_NULL_IF(NULL == stream, NULL);
+
+    stream->model = model;
+    stream->net = net;
+    stream->param = param;
+    //  Window of convolution of signal, padded as in convolution_activation
+    const int winlen = net.conv_W->nrq;
+    const int stride = net.stride;
+    stream->context = iceil((winlen - 1) / 2, stride);
+    const size_t min_lookahead = iceil(winlen / 2, stride);
+    stream->lookahead = iceil(param.lookahead, stride);
+    if (stream->lookahead < min_lookahead) {
+        stream->lookahead = min_lookahead;
+    }
+    if (0 == stream->param.calibration) {
+        stream->param.calibration = 1;
+    }
+    stream->shift = 0.0f;
+    stream->scale = 1.0f;
+    //  Forward layers start from a state of zero
+    for (size_t l = 0; l < net.nlayer; l++) {
+        if (!net.layer[l].backward) {
+            stream->state[l] = make_scrappie_matrix(net.layer[l].sW2->nc, 1);
+            if (NULL == stream->state[l]) {
+                return free_basecall_stream(stream);
+            }
+        }
+    }
+    return stream;
+}
+
+
+basecall_stream * free_basecall_stream(basecall_stream * stream) {
+    if (NULL != stream) {
+        for (size_t l = 0; l < RECURRENT_NETWORK_MAX_LAYER; l++) {
+            stream->state[l] = free_scrappie_matrix(stream->state[l]);
+        }
+        stream->post = free_scrappie_matrix(stream->post);
+        free(stream->signal);
+        free(stream);
+    }
+    return NULL;
+}
+
+
+static inline float normalise_sample(const basecall_stream * stream, float x) {
+    //  As medmad_normalise_raw, a constant signal normalises to zero
+    return (stream->scale > 0.0f) ? ((x - stream->shift) / stream->scale) : 0.0f;
+}
+
+
+static bool append_signal(basecall_stream * stream, const float * signal, size_t n) {
+    if (stream->nsignal + n > stream->capacity) {
+        size_t capacity = (stream->capacity > 0) ? stream->capacity : 4096;
+        while (capacity < stream->nsignal + n) {
+            capacity *= 2;
+        }
+        float * buf = realloc(stream->signal, capacity * sizeof(float));
+        RETURN_NULL_IF(NULL == buf, false);
+        stream->signal = buf;
+        stream->capacity = capacity;
+    }
+    float * dest = stream->signal + stream->nsignal;
+    for (size_t i = 0; i < n; i++) {
+        dest[i] = stream->calibrated ? normalise_sample(stream, signal[i]) : signal[i];
+    }
+    stream->nsignal += n;
+    return true;
+}
+
+
+/**  Fix normalisation of signal from that which has arrived so far
+ **/
+static void calibrate_stream(basecall_stream * stream) {
+    float med = 0.0f, mad = 0.0f;
+    if (stream->nsignal > 0) {
+        medmadf(stream->signal, stream->nsignal, NULL, &med, &mad);
+    }
+    stream->shift = med;
+    stream->scale = mad;
+    for (size_t i = 0; i < stream->nsignal; i++) {
+        stream->signal[i] = normalise_sample(stream, stream->signal[i]);
+    }
+    stream->calibrated = true;
+}
+
+
+static bool commit_posterior(basecall_stream * stream, const_scrappie_matrix post) {
+    const size_t nblock = stream->ncommitted + post->nc;
+    if (NULL == stream->post || nblock > stream->post->nc) {
+        size_t capacity = (NULL != stream->post) ? stream->post->nc : 1024;
+        while (capacity < nblock) {
+            capacity *= 2;
+        }
+        scrappie_matrix grown = make_scrappie_matrix(post->nr, capacity);
+        RETURN_NULL_IF(NULL == grown, false);
+        if (NULL != stream->post) {
+            memcpy(grown->data.f, stream->post->data.f,
+                   stream->ncommitted * stream->post->stride * sizeof(float));
+            stream->post = free_scrappie_matrix(stream->post);
+        }
+        stream->post = grown;
+    }
+    assert(stream->post->stride == post->stride);
+    memcpy(stream->post->data.f + stream->ncommitted * post->stride, post->data.f,
+           post->nc * post->stride * sizeof(float));
+    stream->ncommitted = nblock;
+    return true;
+}
+
+
+/**  Forward layer over window, carrying its state from the last committed block
+ *
+ *   The layer is run over the blocks to be committed, starting from the
+ *   carried state and updating it, then over the remaining lookahead.
+ *
+ *   @param X  Input [isize x nc], may be the same matrix as output
+ *   @param ncommit  Number of blocks to be committed
+ *   @param state  State after last committed block, updated [size x 1]
+ *   @param output  Output [size x nc]
+ *
+ *   @returns true on success
+ **/
+static bool stream_forward_layer(const recurrent_layer * layer, bool residual, const_scrappie_matrix X,
+                                 size_t ncommit, scrappie_matrix state, scrappie_matrix output) {
+    RETURN_NULL_IF(NULL == output, false);
+    assert(ncommit > 0 && ncommit <= X->nc);
+    assert(X->nc == output->nc);
+    _Mat xView = *X, oView = *output;
+    xView.nc = oView.nc = ncommit;
+    RETURN_NULL_IF(NULL == gru_forward_fused_from_state(&xView, layer->iW, layer->b, layer->sW, layer->sW2,
+                                                        residual, state, state, &oView), false);
+    if (ncommit < X->nc) {
+        xView.nc = oView.nc = X->nc - ncommit;
+        xView.data.v = X->data.v + ncommit * X->nrq;
+        oView.data.v = output->data.v + ncommit * output->nrq;
+        RETURN_NULL_IF(NULL == gru_forward_fused_from_state(&xView, layer->iW, layer->b, layer->sW, layer->sW2,
+                                                            residual, state, NULL, &oView), false);
+    }
+    return true;
+}
+
+
+/**  Run network over the signal not yet committed and commit what is ready
+ *
+ *   @param final  Whether the stream has ended, so all blocks are committed
+ *
+ *   @returns Number of blocks committed or -1 on failure
+ **/
+static int process_stream(basecall_stream * stream, bool final) {
+    const recurrent_network * net = &stream->net;
+    const size_t stride = net->stride;
+    const size_t nsample = stream->offset + stream->nsignal;
+    //  Only complete blocks are evaluated until the stream ends
+    const size_t nblock = final ? iceil(nsample, stride) : (nsample / stride);
+    const size_t lookahead = final ? 0 : stream->lookahead;
+    if (nblock <= stream->ncommitted + lookahead) {
+        return 0;
+    }
+    const size_t ncommit = nblock - stream->ncommitted - lookahead;
+
+    const size_t context = (stream->ncommitted < stream->context) ? stream->ncommitted : stream->context;
+    const size_t start = (stream->ncommitted - context) * stride;
+    const size_t end = final ? nsample : (nblock * stride);
+    assert(start >= stream->offset);
+
+    scrappie_matrix features = mat_from_array(stream->signal + start - stream->offset, 1, end - start);
+    scrappie_matrix conv = convolution_activation(features, net->conv_W, net->conv_b, stride,
+                                                  net->activation, NULL);
+    features = free_scrappie_matrix(features);
+    RETURN_NULL_IF(NULL == conv, -1);
+    assert(conv->nc == nblock - stream->ncommitted + context);
+
+    //  Drop blocks that were only evaluated to give the convolution its context
+    _Mat window = *conv;
+    window.nc -= context;
+    window.data.v += context * conv->nrq;
+
+    scrappie_matrix gru = NULL;
+    const_scrappie_matrix input = &window;
+    for (size_t l = 0; l < net->nlayer; l++) {
+        const recurrent_layer * layer = net->layer + l;
+        if (layer->backward) {
+            gru = gru_backward_fused(input, layer->iW, layer->b, layer->sW, layer->sW2, net->residual, gru);
+        } else {
+            if (NULL == gru) {
+                gru = make_scrappie_matrix(layer->sW2->nc, input->nc);
+            }
+            if (!stream_forward_layer(layer, net->residual, input, ncommit, stream->state[l], gru)) {
+                gru = free_scrappie_matrix(gru);
+            }
+        }
+        if (NULL == gru) {
+            break;
+        }
+        input = gru;
+    }
+    conv = free_scrappie_matrix(conv);
+    RETURN_NULL_IF(NULL == gru, -1);
+
+    _Mat ready = *gru;
+    ready.nc = ncommit;
+    scrappie_matrix post = NULL;
+    if (net->crf) {
+        post = globalnorm(&ready, net->out_W, net->out_b, NULL);
+    } else {
+        post = softmax_with_temperature(&ready, net->out_W, net->out_b, stream->param.tempW,
+                                        stream->param.tempb, NULL);
+        if (NULL != post) {
+            robustlog_activation_inplace(post, stream->param.min_prob);
+        }
+    }
+    gru = free_scrappie_matrix(gru);
+    RETURN_NULL_IF(NULL == post, -1);
+    const bool ok = commit_posterior(stream, post);
+    post = free_scrappie_matrix(post);
+    RETURN_NULL_IF(!ok, -1);
+
+    //  Discard signal that no future window will include
+    const size_t next_context = (stream->ncommitted < stream->context) ? stream->ncommitted : stream->context;
+    const size_t keep_from = (stream->ncommitted - next_context) * stride;
+    if (keep_from > stream->offset) {
+        const size_t ndiscard = keep_from - stream->offset;
+        memmove(stream->signal, stream->signal + ndiscard, (stream->nsignal - ndiscard) * sizeof(float));
+        stream->nsignal -= ndiscard;
+        stream->offset = keep_from;
+    }
+
+    return ncommit;
+}
+
+
+/**  Push a chunk of signal to the stream
+ *
+ *   @param stream  Stream, not yet finished
+ *   @param signal  Chunk of signal in pA
+ *   @param n  Length of chunk
+ *
+ *   @returns Number of blocks committed by this push or -1 on failure
+ **/
+int basecall_stream_push(basecall_stream * stream, const float * signal, size_t n) {
+    RETURN_NULL_IF(NULL == stream, -1);
+    RETURN_NULL_IF(stream->finished, -1);
+    RETURN_NULL_IF(NULL == signal && n > 0, -1);
+    if (!append_signal(stream, signal, n)) {
+        return -1;
+    }
+    if (!stream->calibrated) {
+        if (stream->nsignal < stream->param.calibration) {
+            return 0;
+        }
+        calibrate_stream(stream);
+    }
+    return process_stream(stream, false);
+}
+
+
+/**  End the stream, committing all remaining blocks
+ *
+ *   @returns Number of blocks committed or -1 on failure
+ **/
+int basecall_stream_finish(basecall_stream * stream) {
+    RETURN_NULL_IF(NULL == stream, -1);
+    RETURN_NULL_IF(stream->finished, -1);
+    if (!stream->calibrated) {
+        calibrate_stream(stream);
+    }
+    stream->finished = true;
+    return process_stream(stream, true);
+}
+
+
+/**  Posterior of the committed blocks of the stream
+ *
+ *   For CRF models, the transitions of each push are globally normalised
+ *   separately, which changes each block by a constant.
+ *
+ *   @returns View of posterior, valid until the next push, with no columns
+ *   if nothing has been committed
+ **/
+_Mat basecall_stream_posterior(const basecall_stream * stream) {
+    _Mat view = {0, 0, 0, 0, {NULL}};
+    if (NULL != stream && NULL != stream->post) {
+        view = *stream->post;
+        view.nc = stream->ncommitted;
+    }
+    return view;
+}
+
+
+/**  Basecall of the committed blocks of the stream
+ *
+ *   The whole of the committed posterior is decoded, so earlier bases may
+ *   change as more signal arrives.
+ *
+ *   @param stay_pen, skip_pen, local_pen  Penalties for transducer models
+ *   @param score  Score of basecall [out]
+ *   @param pos  Position of each block in basecall, of length one more than
+ *   the number of committed blocks, to be freed by caller.  May be NULL [out]
+ *
+ *   @returns Basecall, to be freed by caller, or NULL if nothing has been
+ *   committed or on failure
+ **/
+char * basecall_stream_basecall(const basecall_stream * stream, float stay_pen, float skip_pen,
+                                float local_pen, float * score, int ** pos) {
+    RETURN_NULL_IF(NULL == stream, NULL);
+    RETURN_NULL_IF(0 == stream->ncommitted, NULL);
+    const _Mat post = basecall_stream_posterior(stream);
+    const size_t nblock = post.nc;
+
+    int * path = calloc(nblock + 1, sizeof(int));
+    int * blockpos = calloc(nblock + 1, sizeof(int));
+    char * basecall = NULL;
+    float pathscore = NAN;
+    if (NULL != path && NULL != blockpos) {
+        if (stream->net.crf) {
+            pathscore = decode_crf(&post, path);
+            basecall = crfpath_to_basecall(path, nblock, blockpos);
+        } else {
+            pathscore = decode_transducer(&post, stay_pen, skip_pen, local_pen, path, false);
+            basecall = overlapper(path, nblock + 1, post.nr - 1, blockpos);
+        }
+    }
+    free(path);
+    if (NULL != score) {
+        *score = pathscore;
+    }
+    if (NULL != pos && NULL != basecall) {
+        *pos = blockpos;
+    } else {
+        free(blockpos);
+    }
+    return basecall;
+}
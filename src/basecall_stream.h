@@ -0,0 +1,76 @@
+#pragma once
+#ifndef BASECALL_STREAM_H
+#    define BASECALL_STREAM_H
+
+/**  Basecalling of signal as it arrives
+ *
+ *   A stream is fed chunks of signal, in pA, as they are read from the
+ *   device.  Once enough signal has arrived to estimate its normalisation,
+ *   each push runs the network over the signal not yet committed and
+ *   commits all blocks except the last lookahead blocks, whose backward
+ *   recurrent layers have yet to see enough of the future.  Forward
+ *   recurrent layers carry their state from the last committed block so
+ *   committed signal is never revisited, other than the few samples the
+ *   convolution needs for context.
+ *
+ *   Only models whose recurrent layers are unidirectional, see
+ *   get_recurrent_network, may be streamed.
+ **/
+
+#    include <stdbool.h>
+#    include <stddef.h>
+#    include "networks.h"
+#    include "scrappie_matrix.h"
+
+typedef struct {
+    //  Number of samples from which the median and MAD of the signal are found
+    size_t calibration;
+    //  Number of samples of signal beyond a block before it is committed
+    size_t lookahead;
+    float min_prob;
+    float tempW;
+    float tempb;
+} basecall_stream_param;
+
+static basecall_stream_param const basecall_stream_defaults = {
+    .calibration = 2000,
+    .lookahead = 4000,
+    .min_prob = 1e-5f,
+    .tempW = 1.0f,
+    .tempb = 1.0f
+};
+
+typedef struct {
+    enum raw_model_type model;
+    recurrent_network net;
+    basecall_stream_param param;
+    //  Blocks after a block before it is committed
+    size_t lookahead;
+    //  Blocks before the first committed block needed by the convolution
+    size_t context;
+    //  Median and MAD of signal, fixed once calibrated
+    bool calibrated;
+    float shift;
+    float scale;
+    //  Signal from sample offset of stream onwards, normalised once calibrated
+    float * signal;
+    size_t nsignal;
+    size_t capacity;
+    size_t offset;
+    //  State of each forward layer after the last committed block, NULL for backward layers
+    scrappie_matrix state[RECURRENT_NETWORK_MAX_LAYER];
+    //  Posterior of committed blocks, in the first ncommitted columns
+    scrappie_matrix post;
+    size_t ncommitted;
+    bool finished;
+} basecall_stream;
+
+basecall_stream * make_basecall_stream(const enum raw_model_type model, const basecall_stream_param param);
+basecall_stream * free_basecall_stream(basecall_stream * stream);
+int basecall_stream_push(basecall_stream * stream, const float * signal, size_t n);
+int basecall_stream_finish(basecall_stream * stream);
+_Mat basecall_stream_posterior(const basecall_stream * stream);
+char * basecall_stream_basecall(const basecall_stream * stream, float stay_pen, float skip_pen,
+                                float local_pen, float * score, int ** pos);
+
+#endif                          /* BASECALL_STREAM_H */
@@ -0,0 +1,464 @@
+#include <err.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "column_file.h"
+#include "scrappie_stdlib.h"
+
+
+static size_t align_column(size_t n) {
+    return COLUMN_FILE_ALIGN * ((n + COLUMN_FILE_ALIGN - 1) / COLUMN_FILE_ALIGN);
+}
+
+
+/**  Bytes of each value of a numeric column, or of each offset of a string column
+ **/
+static size_t column_type_size(enum column_type type) {
+    switch (type) {
+    case COLUMN_TYPE_INT32:
+    case COLUMN_TYPE_FLOAT32:
+        return 4;
+    case COLUMN_TYPE_UINT64:
+    case COLUMN_TYPE_FLOAT64:
+    case COLUMN_TYPE_STRING:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+
+/**  Copy string into fixed length field, truncating and padding with nul
+ **/
+static void copy_field(char * field, size_t len, const char * str) {
+    memset(field, 0, len);
+    if (NULL != str) {
+        const size_t slen = strlen(str);
+        memcpy(field, str, (slen < len - 1) ? slen : len - 1);
+    }
+}
+
+
+/**  Append rows of a table to buffer as a single batch
+ *
+ *   Batches are formed by each worker in a buffer of its own, so the only
+ *   work left for the ordered output is a single write of the buffer.  The
+ *   buffer should only contain batches, so that each batch starts aligned.
+ *
+ *   @param buf  Buffer to append to
+ *   @param table  Name of table
+ *   @param label  Label of batch, or NULL for none
+ *   @param nrow  Number of rows
+ *   @param columns  Array [ncolumn] of columns, each of nrow values
+ *   @param ncolumn  Number of columns
+ *
+ *   @returns true on success.  On failure the buffer is unchanged
+ **/
+bool column_batch_append(output_buffer * buf, const char * table, const char * label, size_t nrow,
+                         column_values const * columns, size_t ncolumn) {
+    RETURN_NULL_IF(NULL == buf, false);
+    RETURN_NULL_IF(NULL == columns && ncolumn > 0, false);
+
+    //  Descriptors and layout of batch
+    column_descriptor * desc = calloc(ncolumn + 1, sizeof(column_descriptor));
+    RETURN_NULL_IF(NULL == desc, false);
+    size_t offset = align_column(sizeof(column_batch_header) + ncolumn * sizeof(column_descriptor));
+    for (size_t i = 0; i < ncolumn; i++) {
+        const size_t size = column_type_size(columns[i].type);
+        if (0 == size || (NULL == columns[i].values && nrow > 0)) {
+            warnx("Invalid column \"%s\" of table \"%s\"", columns[i].name, table);
+            free(desc);
+            return false;
+        }
+        copy_field(desc[i].name, COLUMN_NAME_LEN, columns[i].name);
+        desc[i].type = columns[i].type;
+        desc[i].offset = offset;
+        if (COLUMN_TYPE_STRING == columns[i].type) {
+            desc[i].nbyte = (nrow + 1) * size;
+            size_t nchar = 0;
+            char const * const * str = columns[i].values;
+            for (size_t r = 0; r < nrow; r++) {
+                nchar += (NULL != str[r]) ? strlen(str[r]) : 0;
+            }
+            desc[i].data_offset = align_column(offset + desc[i].nbyte);
+            desc[i].data_nbyte = nchar;
+            offset = align_column(desc[i].data_offset + nchar);
+        } else {
+            desc[i].nbyte = nrow * size;
+            offset = align_column(offset + desc[i].nbyte);
+        }
+    }
+
+    column_batch_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, COLUMN_FILE_MAGIC, sizeof(header.magic));
+    header.version = COLUMN_FILE_VERSION;
+    header.ncolumn = ncolumn;
+    header.nrow = nrow;
+    header.batch_size = offset;
+    copy_field(header.table, COLUMN_TABLE_LEN, table);
+    copy_field(header.label, COLUMN_LABEL_LEN, label);
+
+    const size_t start = buf->n;
+    bool ok = output_buffer_append(buf, &header, sizeof(header))
+        && output_buffer_append(buf, desc, ncolumn * sizeof(column_descriptor));
+    for (size_t i = 0; ok && i < ncolumn; i++) {
+        ok = output_buffer_append(buf, NULL, start + desc[i].offset - buf->n);
+        if (ok && COLUMN_TYPE_STRING == columns[i].type) {
+            char const * const * str = columns[i].values;
+            uint64_t soffset = 0;
+            for (size_t r = 0; ok && r < nrow; r++) {
+                ok = output_buffer_append(buf, &soffset, sizeof(soffset));
+                soffset += (NULL != str[r]) ? strlen(str[r]) : 0;
+            }
+            ok = ok && output_buffer_append(buf, &soffset, sizeof(soffset))
+                && output_buffer_append(buf, NULL, start + desc[i].data_offset - buf->n);
+            for (size_t r = 0; ok && r < nrow; r++) {
+                if (NULL != str[r]) {
+                    ok = output_buffer_append(buf, str[r], strlen(str[r]));
+                }
+            }
+        } else if (ok) {
+            ok = output_buffer_append(buf, columns[i].values, desc[i].nbyte);
+        }
+    }
+    ok = ok && output_buffer_append(buf, NULL, start + header.batch_size - buf->n);
+    free(desc);
+
+    if (!ok) {
+        //  Leave buffer as it was
+        buf->n = start;
+    }
+    return ok;
+}
+
+
+/**  Check batch header found at offset in file of given size, and its columns
+ **/
+static bool valid_batch(const column_batch_header * batch, size_t offset, size_t nbyte) {
+    if (nbyte - offset < sizeof(column_batch_header)) {
+        return false;
+    }
+    if (0 != memcmp(batch->magic, COLUMN_FILE_MAGIC, sizeof(batch->magic))
+        || COLUMN_FILE_VERSION != batch->version) {
+        return false;
+    }
+    if (0 != batch->batch_size % COLUMN_FILE_ALIGN || batch->batch_size > nbyte - offset
+        || batch->batch_size < sizeof(column_batch_header)
+        || batch->ncolumn > (batch->batch_size - sizeof(column_batch_header)) / sizeof(column_descriptor)) {
+        return false;
+    }
+    const column_descriptor * desc = (const column_descriptor *)(batch + 1);
+    for (size_t i = 0; i < batch->ncolumn; i++) {
+        const size_t size = column_type_size(desc[i].type);
+        const uint64_t nvalue = batch->nrow + ((COLUMN_TYPE_STRING == desc[i].type) ? 1 : 0);
+        if (0 == size || desc[i].nbyte != nvalue * size || 0 != desc[i].offset % COLUMN_FILE_ALIGN
+            || desc[i].offset > batch->batch_size || desc[i].nbyte > batch->batch_size - desc[i].offset) {
+            return false;
+        }
+        if (COLUMN_TYPE_STRING == desc[i].type) {
+            const uint64_t * soffset = column_batch_values(batch, desc + i);
+            if (desc[i].data_offset > batch->batch_size
+                || desc[i].data_nbyte > batch->batch_size - desc[i].data_offset
+                || 0 != soffset[0] || desc[i].data_nbyte != soffset[batch->nrow]) {
+                return false;
+            }
+            for (size_t r = 0; r < batch->nrow; r++) {
+                if (soffset[r] > soffset[r + 1]) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+
+/**  Map column file into memory
+ *
+ *   The file is mapped read-only and not copied, so columns are available
+ *   immediately however large the file.
+ *
+ *   @param filename  Path to column file
+ *
+ *   @returns Mapped file, with index of batches, or NULL if the file could
+ *   not be mapped or is not a valid column file.
+ **/
+column_file * open_column_file(const char * filename) {
+    RETURN_NULL_IF(NULL == filename, NULL);
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        warnx("Failed to open column file \"%s\"", filename);
+        return NULL;
+    }
+    struct stat st;
+    if (0 != fstat(fd, &st) || 0 == st.st_size) {
+        warnx("Column file \"%s\" is empty or unreadable", filename);
+        close(fd);
+        return NULL;
+    }
+    const size_t nbyte = st.st_size;
+    void * map = mmap(NULL, nbyte, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == map) {
+        warnx("Failed to map column file \"%s\"", filename);
+        return NULL;
+    }
+
+    //  Count and validate batches before building index
+    size_t nbatch = 0;
+    for (size_t offset = 0; offset < nbyte; nbatch++) {
+        const column_batch_header * batch = (const void *)((const char *)map + offset);
+        if (!valid_batch(batch, offset, nbyte)) {
+            warnx("Invalid column batch at byte %zu of \"%s\"", offset, filename);
+            munmap(map, nbyte);
+            return NULL;
+        }
+        offset += batch->batch_size;
+    }
+
+    column_file * cf = calloc(1, sizeof(column_file));
+    const column_batch_header ** index = calloc(nbatch, sizeof(*index));
+    if (NULL == cf || NULL == index) {
+        free(index);
+        free(cf);
+        munmap(map, nbyte);
+        return NULL;
+    }
+    for (size_t i = 0, offset = 0; i < nbatch; i++) {
+        index[i] = (const void *)((const char *)map + offset);
+        offset += index[i]->batch_size;
+    }
+    *cf = (column_file){map, nbyte, nbatch, index};
+    return cf;
+}
+
+
+column_file * free_column_file(column_file * cf) {
+    if (NULL != cf) {
+        munmap(cf->map, cf->nbyte);
+        free(cf->batch);
+        free(cf);
+    }
+    return NULL;
+}
+
+
+/**  Descriptor of column of batch with given name, NULL if there is none
+ **/
+const column_descriptor * column_batch_find(const column_batch_header * batch, const char * name) {
+    RETURN_NULL_IF(NULL == batch, NULL);
+    RETURN_NULL_IF(NULL == name, NULL);
+    const column_descriptor * desc = (const column_descriptor *)(batch + 1);
+    for (size_t i = 0; i < batch->ncolumn; i++) {
+        if (0 == strncmp(desc[i].name, name, COLUMN_NAME_LEN)) {
+            return desc + i;
+        }
+    }
+    return NULL;
+}
+
+
+/**  Values of column, or offsets of a string column
+ *
+ *   Values are aligned to COLUMN_FILE_ALIGN bytes
+ **/
+const void * column_batch_values(const column_batch_header * batch, const column_descriptor * column) {
+    RETURN_NULL_IF(NULL == batch, NULL);
+    RETURN_NULL_IF(NULL == column, NULL);
+    return (const char *)batch + column->offset;
+}
+
+
+/**  String of row of a string column, which is not nul terminated
+ *
+ *   @param len  Set to length of string
+ *
+ *   @returns Start of string, or NULL if column is not a string column or row is out of range
+ **/
+const char * column_batch_string(const column_batch_header * batch, const column_descriptor * column,
+                                 size_t i, size_t * len) {
+    RETURN_NULL_IF(NULL == batch, NULL);
+    RETURN_NULL_IF(NULL == column, NULL);
+    RETURN_NULL_IF(COLUMN_TYPE_STRING != column->type || i >= batch->nrow, NULL);
+    const uint64_t * soffset = column_batch_values(batch, column);
+    if (NULL != len) {
+        *len = soffset[i + 1] - soffset[i];
+    }
+    return (const char *)batch + column->data_offset + soffset[i];
+}
+
+
+/**  Append table of events of a read as a batch of table "events"
+ *
+ *   Columns are start, length, mean and stdv of each event and, if
+ *   annotated, the position and state assigned to it by basecalling.
+ *
+ *   @param label  Name of read
+ *
+ *   @returns true on success.  On failure the buffer is unchanged
+ **/
+bool column_batch_append_events(output_buffer * buf, const char * label, const event_table et,
+                                bool annotated) {
+    RETURN_NULL_IF(NULL == buf, false);
+    RETURN_NULL_IF(NULL == et.event && et.n > 0, false);
+
+    uint64_t * start = calloc(et.n + 1, sizeof(uint64_t));
+    float * length = calloc(et.n + 1, sizeof(float));
+    float * mean = calloc(et.n + 1, sizeof(float));
+    float * stdv = calloc(et.n + 1, sizeof(float));
+    int32_t * pos = calloc(et.n + 1, sizeof(int32_t));
+    int32_t * state = calloc(et.n + 1, sizeof(int32_t));
+    bool ok = (NULL != start && NULL != length && NULL != mean && NULL != stdv && NULL != pos && NULL != state);
+    if (ok) {
+        for (size_t i = 0; i < et.n; i++) {
+            start[i] = et.event[i].start;
+            length[i] = et.event[i].length;
+            mean[i] = et.event[i].mean;
+            stdv[i] = et.event[i].stdv;
+            pos[i] = et.event[i].pos;
+            state[i] = et.event[i].state;
+        }
+        const column_values columns[] = {
+            {"start", COLUMN_TYPE_UINT64, start},
+            {"length", COLUMN_TYPE_FLOAT32, length},
+            {"mean", COLUMN_TYPE_FLOAT32, mean},
+            {"stdv", COLUMN_TYPE_FLOAT32, stdv},
+            {"pos", COLUMN_TYPE_INT32, pos},
+            {"state", COLUMN_TYPE_INT32, state},
+        };
+        const size_t ncolumn = sizeof(columns) / sizeof(columns[0]);
+        ok = column_batch_append(buf, "events", label, et.n, columns, annotated ? ncolumn : ncolumn - 2);
+    }
+    free(state);
+    free(pos);
+    free(stdv);
+    free(mean);
+    free(length);
+    free(start);
+    return ok;
+}
+
+
+static char * copy_string(const char * str) {
+    const size_t len = (NULL != str) ? strlen(str) : 0;
+    char * copy = malloc(len + 1);
+    RETURN_NULL_IF(NULL == copy, NULL);
+    memcpy(copy, (NULL != str) ? str : "", len + 1);
+    return copy;
+}
+
+
+/**  Add summary of read to table, writing a batch to file if the table is full
+ *
+ *   @param table  Table of summaries, initially zeroed
+ *   @param fh  File to write batches to
+ *   @param read  Name of read
+ *   @param uuid  Identifier of read, or NULL if unknown
+ *   @param nsample  Number of samples of signal called
+ *   @param nblock  Number of blocks, or events, of posterior
+ *   @param nbase  Length of basecall
+ *   @param score  Score of basecall, normalised by number of blocks
+ *   @param seconds  Time taken to call read
+ *
+ *   @returns true on success
+ **/
+bool read_summary_add(read_summary_table * table, FILE * fh, const char * read, const char * uuid,
+                      uint64_t nsample, uint64_t nblock, uint64_t nbase, float score, float seconds) {
+    RETURN_NULL_IF(NULL == table, false);
+    if (0 == table->capacity) {
+        //  Room for a batch, written whenever it fills
+        const size_t n = READ_SUMMARY_BATCH;
+        table->read = calloc(n, sizeof(char *));
+        table->uuid = calloc(n, sizeof(char *));
+        table->nsample = calloc(n, sizeof(uint64_t));
+        table->nblock = calloc(n, sizeof(uint64_t));
+        table->nbase = calloc(n, sizeof(uint64_t));
+        table->score = calloc(n, sizeof(float));
+        table->seconds = calloc(n, sizeof(float));
+        table->capacity = n;
+        if (NULL == table->read || NULL == table->uuid || NULL == table->nsample || NULL == table->nblock
+            || NULL == table->nbase || NULL == table->score || NULL == table->seconds) {
+            read_summary_release(table);
+            return false;
+        }
+    }
+
+    const size_t i = table->n;
+    table->read[i] = copy_string(read);
+    table->uuid[i] = copy_string(uuid);
+    if (NULL == table->read[i] || NULL == table->uuid[i]) {
+        free(table->read[i]);
+        free(table->uuid[i]);
+        return false;
+    }
+    table->nsample[i] = nsample;
+    table->nblock[i] = nblock;
+    table->nbase[i] = nbase;
+    table->score[i] = score;
+    table->seconds[i] = seconds;
+    table->n += 1;
+
+    return (table->n < table->capacity) || read_summary_flush(table, fh);
+}
+
+
+/**  Write rows of table to file as a batch, leaving the table empty
+ *
+ *   @returns true on success, or if there were no rows
+ **/
+bool read_summary_flush(read_summary_table * table, FILE * fh) {
+    RETURN_NULL_IF(NULL == table, false);
+    if (0 == table->n) {
+        return true;
+    }
+    RETURN_NULL_IF(NULL == fh, false);
+
+    const column_values columns[] = {
+        {"read", COLUMN_TYPE_STRING, table->read},
+        {"uuid", COLUMN_TYPE_STRING, table->uuid},
+        {"nsample", COLUMN_TYPE_UINT64, table->nsample},
+        {"nblock", COLUMN_TYPE_UINT64, table->nblock},
+        {"sequence_length", COLUMN_TYPE_UINT64, table->nbase},
+        {"normalised_score", COLUMN_TYPE_FLOAT32, table->score},
+        {"seconds", COLUMN_TYPE_FLOAT32, table->seconds},
+    };
+    output_buffer buf = {NULL, 0, 0};
+    const bool ok = column_batch_append(&buf, "summary", NULL, table->n, columns,
+                                        sizeof(columns) / sizeof(columns[0]))
+        && write_output_buffer(fh, &buf);
+    output_buffer_release(&buf);
+
+    for (size_t i = 0; i < table->n; i++) {
+        free(table->read[i]);
+        free(table->uuid[i]);
+    }
+    table->n = 0;
+    return ok;
+}
+
+
+/**  Free memory of table, without writing any rows left in it
+ **/
+void read_summary_release(read_summary_table * table) {
+    if (NULL == table) {
+        return;
+    }
+    for (size_t i = 0; i < table->n; i++) {
+        free(table->read[i]);
+        free(table->uuid[i]);
+    }
+    free(table->read);
+    free(table->uuid);
+    free(table->nsample);
+    free(table->nblock);
+    free(table->nbase);
+    free(table->score);
+    free(table->seconds);
+    *table = (read_summary_table){0};
+}
@@ -0,0 +1,123 @@
+#pragma once
+#ifndef COLUMN_FILE_H
+#    define COLUMN_FILE_H
+
+/**  Binary container for tables stored by column
+ *
+ *   A file is a sequence of batches, each holding some rows of a table and
+ *   starting on a multiple of COLUMN_FILE_ALIGN bytes.  A batch is a fixed
+ *   size header, a descriptor of each column, then the values of each column
+ *   stored contiguously from a multiple of COLUMN_FILE_ALIGN bytes past the
+ *   start of the batch, so a mapped file is used in place.  Numeric columns
+ *   are arrays of nrow values.  String columns are laid out as in Arrow: nrow
+ *   + 1 offsets, as uint64, into an array of characters without terminating
+ *   nuls, string i being from offset i to offset i + 1.  Values are stored in
+ *   native byte order.
+ *
+ *   Batches of different tables may be mixed in one file and each batch
+ *   carries a label, such as the read its rows are of.  misc/column_file.py
+ *   reads files from Python without copying them.
+ **/
+
+#    include <stdbool.h>
+#    include <stddef.h>
+#    include <stdint.h>
+#    include <stdio.h>
+#    include "scrappie_output.h"
+#    include "scrappie_structures.h"
+
+#    define COLUMN_FILE_MAGIC "SCRPCOLS"
+#    define COLUMN_FILE_VERSION 1
+#    define COLUMN_FILE_ALIGN 64
+#    define COLUMN_TABLE_LEN 32
+#    define COLUMN_LABEL_LEN 128
+#    define COLUMN_NAME_LEN 32
+
+enum column_type {
+    COLUMN_TYPE_INT32 = 0,
+    COLUMN_TYPE_UINT64,
+    COLUMN_TYPE_FLOAT32,
+    COLUMN_TYPE_FLOAT64,
+    COLUMN_TYPE_STRING,
+    COLUMN_TYPE_INVALID
+};
+
+//  Header of each batch, 256 bytes
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t ncolumn;
+    uint64_t nrow;
+    //  Bytes from start of this batch to start of the next
+    uint64_t batch_size;
+    char table[COLUMN_TABLE_LEN];
+    char label[COLUMN_LABEL_LEN];
+    char reserved[64];
+} column_batch_header;
+
+//  Descriptor of a column of a batch, following the header, 80 bytes
+typedef struct {
+    char name[COLUMN_NAME_LEN];
+    uint32_t type;
+    uint32_t reserved;
+    //  Bytes from start of batch to values, or to offsets of strings, and their length
+    uint64_t offset;
+    uint64_t nbyte;
+    //  Bytes from start of batch to characters of strings, and their length
+    uint64_t data_offset;
+    uint64_t data_nbyte;
+    char reserved2[8];
+} column_descriptor;
+
+//  Values of a column to be written, nrow numbers or nrow nul terminated strings
+typedef struct {
+    const char * name;
+    enum column_type type;
+    const void * values;
+} column_values;
+
+typedef struct {
+    void * map;
+    size_t nbyte;
+    size_t nbatch;
+    const column_batch_header ** batch;
+} column_file;
+
+/**  Summaries of reads, one row per read, written as batches of table "summary"
+ *
+ *   Rows are gathered as reads are output and written every
+ *   READ_SUMMARY_BATCH rows, so batches are large enough to be read by
+ *   column.
+ **/
+#    define READ_SUMMARY_BATCH 4096
+
+typedef struct {
+    size_t n, capacity;
+    char ** read;
+    char ** uuid;
+    uint64_t * nsample;
+    uint64_t * nblock;
+    uint64_t * nbase;
+    float * score;
+    float * seconds;
+} read_summary_table;
+
+bool column_batch_append(output_buffer * buf, const char * table, const char * label, size_t nrow,
+                         column_values const * columns, size_t ncolumn);
+
+column_file * open_column_file(const char * filename);
+column_file * free_column_file(column_file * cf);
+const column_descriptor * column_batch_find(const column_batch_header * batch, const char * name);
+const void * column_batch_values(const column_batch_header * batch, const column_descriptor * column);
+const char * column_batch_string(const column_batch_header * batch, const column_descriptor * column,
+                                 size_t i, size_t * len);
+
+bool column_batch_append_events(output_buffer * buf, const char * label, const event_table et,
+                                bool annotated);
+
+bool read_summary_add(read_summary_table * table, FILE * fh, const char * read, const char * uuid,
+                      uint64_t nsample, uint64_t nblock, uint64_t nbase, float score, float seconds);
+bool read_summary_flush(read_summary_table * table, FILE * fh);
+void read_summary_release(read_summary_table * table);
+
+#endif                          /* COLUMN_FILE_H */
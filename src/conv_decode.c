@@ -0,0 +1,1062 @@
+#include <assert.h>
+#include <err.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "conv_decode.h"
+#include "scrappie_stdlib.h"
+#include "util.h"
+
+#define NSTATE_CRF 5
+#define CRF_BLANK 4
+
+
+/**  Parity of bits of x
+ **/
+static inline uint8_t parity(uint32_t x) {
+    x ^= x >> 16;
+    x ^= x >> 8;
+    x ^= x >> 4;
+    x ^= x >> 2;
+    x ^= x >> 1;
+    return x & 1;
+}
+
+
+/**  Default generator polynomials for codes of a given memory
+ *
+ *   Codes are those used in the simulations of shubham/conv_code.h.
+ *
+ *   @param mem  Memory of code
+ *   @param gen [out]  Generator polynomials
+ *
+ *   @returns true if a default exists for mem
+ **/
+bool default_conv_generator(int mem, uint32_t gen[2]) {
+    switch (mem) {
+    case 6:
+        //  CCSDS
+        gen[0] = 0171;
+        gen[1] = 0133;
+        return true;
+    case 8:
+        gen[0] = 0515;
+        gen[1] = 0677;
+        return true;
+    case 11:
+        gen[0] = 05537;
+        gen[1] = 06131;
+        return true;
+    case 14:
+        gen[0] = 075063;
+        gen[1] = 056711;
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+/**  Create rate 1/2 convolutional code
+ *
+ *   @param mem  Memory of code, between CONV_MIN_MEM and CONV_MAX_MEM
+ *   @param gen  Generator polynomials, or NULL to use default for mem
+ *   @param initial_state  State of code before first bit
+ *   @param sync_marker  String of '0' and '1' for bits of sync marker, or
+ *   NULL or empty for no sync marker
+ *   @param sync_period  Period of sync markers, at least length of marker
+ *
+ *   @returns Code or NULL if parameters are invalid
+ **/
+conv_code * make_conv_code(int mem, const uint32_t gen[2], uint32_t initial_state,
+                           const char * sync_marker, size_t sync_period) {
+    if (mem < CONV_MIN_MEM || mem > CONV_MAX_MEM) {
+        warnx("Memory of convolutional code must be between %d and %d", CONV_MIN_MEM, CONV_MAX_MEM);
+        return NULL;
+    }
+    const uint32_t nstate = (uint32_t)1 << mem;
+    uint32_t code_gen[2];
+    if (NULL != gen) {
+        code_gen[0] = gen[0];
+        code_gen[1] = gen[1];
+    } else if (!default_conv_generator(mem, code_gen)) {
+        warnx("No default generator for convolutional code of memory %d", mem);
+        return NULL;
+    }
+    if ((code_gen[0] >> (mem + 1)) || (code_gen[1] >> (mem + 1))) {
+        warnx("Generator polynomials have more than %d bits", mem + 1);
+        return NULL;
+    }
+    if (initial_state >= nstate) {
+        warnx("Initial state has more bits than memory of code");
+        return NULL;
+    }
+    const size_t sync_length = strlen(sync_marker);
+    if (sync_length > CONV_MAX_SYNC) {
+        warnx("Sync marker longer than %d bits", CONV_MAX_SYNC);
+        return NULL;
+    }
+    if (sync_length > 0 && sync_period < sync_length) {
+        warnx("Sync marker longer than its period");
+        return NULL;
+    }
+
+    conv_code * code = calloc(1, sizeof(conv_code));
+    RETURN_NULL_IF(NULL == code, NULL);
+    *code = (conv_code){mem, nstate, {code_gen[0], code_gen[1]}, initial_state,
+                        sync_length, sync_period};
+    for (size_t i = 0; i < sync_length; i++) {
+        if ('0' != sync_marker[i] && '1' != sync_marker[i]) {
+            warnx("Invalid character '%c' in sync marker", sync_marker[i]);
+            free(code);
+            return NULL;
+        }
+        code->sync_marker[i] = ('1' == sync_marker[i]);
+    }
+
+    code->output = calloc(2 * nstate, sizeof(uint8_t));
+    code->base_in = calloc(2 * nstate, sizeof(uint32_t));
+    if (NULL == code->output || NULL == code->base_in) {
+        return free_conv_code(code);
+    }
+    for (uint32_t st = 0; st < nstate; st++) {
+        for (uint32_t bit = 0; bit < 2; bit++) {
+            const uint32_t reg = st | (bit << mem);
+            code->output[2 * st + bit] = 2 * parity(reg & code_gen[0]) + parity(reg & code_gen[1]);
+        }
+    }
+    for (uint32_t st = 0; st < nstate; st++) {
+        const uint32_t top_bit = st >> (mem - 1);
+        for (uint32_t bit = 0; bit < 2; bit++) {
+            const uint32_t prev = ((st << 1) | bit) & (nstate - 1);
+            code->base_in[bit * nstate + st] = code->output[2 * prev + top_bit];
+        }
+    }
+
+    return code;
+}
+
+
+conv_code * free_conv_code(conv_code * code) {
+    if (NULL != code) {
+        free(code->base_in);
+        free(code->output);
+        free(code);
+    }
+    return NULL;
+}
+
+
+/**  Whether a message bit is allowed at pos given the sync markers
+ **/
+bool conv_sync_allows(const conv_code * code, size_t pos, int bit) {
+    assert(NULL != code);
+    if (0 == code->sync_length) {
+        return true;
+    }
+    const size_t i = pos % code->sync_period;
+    return i >= code->sync_length || (bool)bit == code->sync_marker[i];
+}
+
+
+/**  Encode message as sequence of bases
+ *
+ *   @param code  Convolutional code
+ *   @param msg  Message bits
+ *   @param msg_len  Length of message
+ *
+ *   @returns Array of msg_len + mem bases, including the bases of the
+ *   terminating zero bits, or NULL on failure
+ **/
+int * conv_encode_bases(const conv_code * code, const bool * msg, size_t msg_len) {
+    RETURN_NULL_IF(NULL == code, NULL);
+    RETURN_NULL_IF(NULL == msg, NULL);
+
+    const size_t nbase = msg_len + code->mem;
+    int * bases = calloc(nbase, sizeof(int));
+    RETURN_NULL_IF(NULL == bases, NULL);
+
+    uint32_t st = code->initial_state;
+    for (size_t i = 0; i < nbase; i++) {
+        const uint32_t bit = (i < msg_len) ? msg[i] : 0;
+        bases[i] = code->output[2 * st + bit];
+        st = (st | (bit << code->mem)) >> 1;
+    }
+    assert(0 == st);
+    return bases;
+}
+
+
+typedef struct {
+    size_t lo, hi;
+} pos_band;
+
+
+/**  Range of trellis positions searched after each block
+ *
+ *   The expected position moves linearly from the first to the last position
+ *   of the trellis, and the band is also limited to positions that can be
+ *   reached from the start and can still reach the end, since each block
+ *   moves at most one position.
+ *
+ *   @param bands [out]  Array of nblk bands
+ *   @param band  Number of positions either side of expected, 0 for all
+ **/
+static void get_pos_bands(pos_band * bands, size_t nblk, size_t npos, size_t band) {
+    const size_t last_pos = npos - 1;
+    for (size_t t = 0; t < nblk; t++) {
+        bands[t] = (pos_band){0, last_pos};
+        if (0 == band) {
+            continue;
+        }
+        const size_t expected = ((t + 1) * last_pos) / nblk;
+        const size_t reach_lo = (last_pos + t + 1 > nblk) ? last_pos + t + 1 - nblk : 0;
+        const size_t reach_hi = (t + 1 < last_pos) ? t + 1 : last_pos;
+        const size_t band_lo = (expected > band) ? expected - band : 0;
+        const size_t band_hi = expected + band;
+        bands[t].lo = (reach_lo > band_lo) ? reach_lo : band_lo;
+        bands[t].hi = (reach_hi < band_hi) ? reach_hi : band_hi;
+    }
+}
+
+
+/**  Traceback of four bit decisions per state, stored only within band
+ *
+ *   A decision is the previous CRF state in the low three bits and which of
+ *   the two previous conv states in the top bit.
+ **/
+typedef struct {
+    uint8_t * data;
+    size_t * offset;
+    size_t * first_state;
+} packed_traceback;
+
+
+static inline uint32_t make_decision(uint32_t st1_crf, uint32_t conv_bit) {
+    return st1_crf | (conv_bit << 3);
+}
+
+
+static inline void traceback_set4(packed_traceback tb, size_t t, size_t st, __m128i decision) {
+    uint32_t d[4];
+    _mm_storeu_si128((__m128i *) d, decision);
+    uint8_t * byte = tb.data + tb.offset[t] + (st - tb.first_state[t]) / 2;
+    byte[0] = d[0] | (d[1] << 4);
+    byte[1] = d[2] | (d[3] << 4);
+}
+
+
+static inline uint8_t traceback_get(packed_traceback tb, size_t t, size_t st) {
+    const size_t i = st - tb.first_state[t];
+    return (tb.data[tb.offset[t] + i / 2] >> (4 * (i % 2))) & 0xF;
+}
+
+
+/**  Bits of the conv state already known at a trellis position
+ *
+ *   Known from the initial state, sync markers or terminating zeros.  A state
+ *   st is only reachable if (st & mask) == value.
+ **/
+typedef struct {
+    uint32_t mask, value;
+} known_bits;
+
+
+/**  Known bits of the conv state for each position of the trellis
+ *
+ *   Bit mem - 1 - j of the conv state at position pos is the message bit at
+ *   pos - 1 - j.
+ *
+ *   @param known [out]  Array of msg_len + mem + 1 known bits
+ **/
+static void get_known_bits(const conv_code * code, size_t msg_len, known_bits * known) {
+    const int64_t mem = code->mem;
+    for (int64_t pos = 0; pos <= (int64_t)msg_len + mem; pos++) {
+        known[pos] = (known_bits){0, 0};
+        for (int64_t j = 0; j < mem; j++) {
+            const int64_t i = pos - 1 - j;
+            const uint32_t state_bit = (uint32_t)1 << (mem - 1 - j);
+            uint32_t bit = 0;
+            if (i < 0) {
+                //  Bit of initial state
+                bit = (code->initial_state >> (mem + i)) & 1;
+            } else if (i >= (int64_t)msg_len) {
+                //  Terminating zero
+                bit = 0;
+            } else if (code->sync_length > 0 && (size_t)i % code->sync_period < code->sync_length) {
+                bit = code->sync_marker[i % code->sync_period];
+            } else {
+                continue;
+            }
+            known[pos].mask |= state_bit;
+            known[pos].value |= bit ? state_bit : 0;
+        }
+    }
+}
+
+
+/**  Whether none of the four conv states from c, a multiple of 4, is reachable
+ **/
+static inline bool conv_chunk_unreachable(uint32_t c, known_bits known) {
+    return 0 != ((c ^ known.value) & known.mask & ~(uint32_t)3);
+}
+
+
+/**  Entry of four element table for the base in each lane
+ **/
+static inline __m128 lookup_base(__m128 table, __m128i base) {
+#ifdef __AVX__
+    return _mm_permutevar_ps(table, base);
+#else
+    const __m128 entry[4] = {
+        _mm_shuffle_ps(table, table, _MM_SHUFFLE(0, 0, 0, 0)),
+        _mm_shuffle_ps(table, table, _MM_SHUFFLE(1, 1, 1, 1)),
+        _mm_shuffle_ps(table, table, _MM_SHUFFLE(2, 2, 2, 2)),
+        _mm_shuffle_ps(table, table, _MM_SHUFFLE(3, 3, 3, 3))
+    };
+    __m128 res = _mm_setzero_ps();
+    for (int b = 0; b < 4; b++) {
+        const __m128 is_b = _mm_castsi128_ps(_mm_cmpeq_epi32(base, _mm_set1_epi32(b)));
+        res = _mm_or_ps(res, _mm_and_ps(is_b, entry[b]));
+    }
+    return res;
+#endif
+}
+
+
+/**  Add-compare-select for all states at trellis position pos
+ *
+ *   States are laid out [pos][crf][conv] so four conv states with the same
+ *   position and CRF state fill a vector.  A blank state is entered from the
+ *   same position and conv state.  Otherwise the previous state is one
+ *   position back, in one of the two previous conv states, and the CRF state
+ *   must be the base output by that conv transition.  Each state therefore
+ *   has only two non-blank predecessor conv states, each giving one base.
+ *
+ *   States that can't be reached because of known bits of the conv state are
+ *   skipped, keeping the score -INFINITY they were cleared to.  Their
+ *   traceback is never read.
+ *
+ *   @param post_t  CRF transition matrix of block, [to][from]
+ *   @param known  Known bits of conv state at pos
+ **/
+static void post_conv_acs_pos(const conv_code * code, const float * post_t,
+                              const float * prev_score, float * curr_score,
+                              packed_traceback tb, size_t t, size_t pos,
+                              known_bits known) {
+    const size_t nstate_conv = code->nstate;
+    const size_t half = nstate_conv / 2;
+    const size_t nstate_per_pos = NSTATE_CRF * nstate_conv;
+    const size_t first_st = pos * nstate_per_pos;
+    const float * prev_pos = prev_score + first_st;
+    float * curr_pos = curr_score + first_st;
+    const __m128 neg_inf = _mm_set1_ps(-INFINITY);
+    const __m128i zero = _mm_setzero_si128();
+
+    //  Blank
+    for (size_t c = 0; c < nstate_conv; c += 4) {
+        if (conv_chunk_unreachable(c, known)) {
+            continue;
+        }
+        __m128 best = neg_inf;
+        __m128i decision = zero;
+        for (uint32_t st1_crf = 0; st1_crf < NSTATE_CRF; st1_crf++) {
+            const __m128 score = _mm_add_ps(_mm_loadu_ps(prev_pos + st1_crf * nstate_conv + c),
+                                            _mm_set1_ps(post_t[CRF_BLANK * NSTATE_CRF + st1_crf]));
+            const __m128 better = _mm_cmpgt_ps(score, best);
+            const __m128i better_i = _mm_castps_si128(better);
+            best = _mm_or_ps(_mm_and_ps(better, score), _mm_andnot_ps(better, best));
+            decision = _mm_or_si128(_mm_and_si128(better_i, _mm_set1_epi32(make_decision(st1_crf, 0))),
+                                    _mm_andnot_si128(better_i, decision));
+        }
+        _mm_storeu_ps(curr_pos + CRF_BLANK * nstate_conv + c, best);
+        traceback_set4(tb, t, first_st + CRF_BLANK * nstate_conv + c, decision);
+    }
+
+    //  Not blank
+    if (0 == pos) {
+        //  Must be blank at first position
+        for (size_t i = 0; i < CRF_BLANK * nstate_conv; i += 4) {
+            _mm_storeu_ps(curr_pos + i, neg_inf);
+            traceback_set4(tb, t, first_st + i, zero);
+        }
+        return;
+    }
+    //  Score of each base from each previous CRF state, for lookup by lane
+    __m128 post_base[NSTATE_CRF];
+    for (uint32_t st1_crf = 0; st1_crf < NSTATE_CRF; st1_crf++) {
+        post_base[st1_crf] = _mm_setr_ps(post_t[st1_crf], post_t[NSTATE_CRF + st1_crf],
+                                         post_t[2 * NSTATE_CRF + st1_crf], post_t[3 * NSTATE_CRF + st1_crf]);
+    }
+    const float * prev_before = prev_pos - nstate_per_pos;
+    for (size_t c = 0; c < half; c += 4) {
+        const bool unreachable[2] = {conv_chunk_unreachable(c, known),
+                                     conv_chunk_unreachable(c + half, known)};
+        if (unreachable[0] && unreachable[1]) {
+            continue;
+        }
+        //  Conv states 2c and 2c + 1 lead to both c and c + half, depending
+        //  on the new bit, so deinterleave their scores once for both
+        __m128 src[2][NSTATE_CRF];
+        for (uint32_t st1_crf = 0; st1_crf < NSTATE_CRF; st1_crf++) {
+            const float * p = prev_before + st1_crf * nstate_conv + 2 * c;
+            const __m128 lo = _mm_loadu_ps(p);
+            const __m128 hi = _mm_loadu_ps(p + 4);
+            src[0][st1_crf] = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+            src[1][st1_crf] = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+        }
+        for (uint32_t bit = 0; bit < 2; bit++) {
+            if (unreachable[bit]) {
+                continue;
+            }
+            const size_t st2_conv = c + bit * half;
+            const __m128i base_in[2] = {
+                _mm_loadu_si128((const __m128i *)(code->base_in + st2_conv)),
+                _mm_loadu_si128((const __m128i *)(code->base_in + nstate_conv + st2_conv))
+            };
+            //  Best entry through each of the two previous conv states
+            __m128 best[2];
+            __m128i decision[2];
+            for (uint32_t conv_bit = 0; conv_bit < 2; conv_bit++) {
+                best[conv_bit] = neg_inf;
+                decision[conv_bit] = zero;
+                for (uint32_t st1_crf = 0; st1_crf < NSTATE_CRF; st1_crf++) {
+                    const __m128 score = _mm_add_ps(src[conv_bit][st1_crf],
+                                                    lookup_base(post_base[st1_crf], base_in[conv_bit]));
+                    const __m128 better = _mm_cmpgt_ps(score, best[conv_bit]);
+                    const __m128i better_i = _mm_castps_si128(better);
+                    best[conv_bit] = _mm_or_ps(_mm_and_ps(better, score), _mm_andnot_ps(better, best[conv_bit]));
+                    decision[conv_bit] = _mm_or_si128(_mm_and_si128(better_i,
+                                                                    _mm_set1_epi32(make_decision(st1_crf, conv_bit))),
+                                                      _mm_andnot_si128(better_i, decision[conv_bit]));
+                }
+            }
+            //  Each goes to the CRF state of its base, ties to the first conv state
+            for (uint32_t st2_crf = 0; st2_crf < CRF_BLANK; st2_crf++) {
+                const __m128i crf = _mm_set1_epi32(st2_crf);
+                const __m128 valid0 = _mm_castsi128_ps(_mm_cmpeq_epi32(base_in[0], crf));
+                const __m128 valid1 = _mm_castsi128_ps(_mm_cmpeq_epi32(base_in[1], crf));
+                __m128 st_best = _mm_or_ps(_mm_and_ps(valid0, best[0]), _mm_andnot_ps(valid0, neg_inf));
+                __m128i st_decision = _mm_and_si128(_mm_castps_si128(valid0), decision[0]);
+                const __m128 better = _mm_and_ps(valid1, _mm_cmpgt_ps(best[1], st_best));
+                const __m128i better_i = _mm_castps_si128(better);
+                st_best = _mm_or_ps(_mm_and_ps(better, best[1]), _mm_andnot_ps(better, st_best));
+                st_decision = _mm_or_si128(_mm_and_si128(better_i, decision[1]),
+                                           _mm_andnot_si128(better_i, st_decision));
+                _mm_storeu_ps(curr_pos + st2_crf * nstate_conv + st2_conv, st_best);
+                traceback_set4(tb, t, first_st + st2_crf * nstate_conv + st2_conv, st_decision);
+            }
+        }
+    }
+}
+
+
+/**  Decode convolutionally coded message from CRF transition matrix
+ *
+ *   Viterbi search over the joint trellis of CRF state, position in the
+ *   message and state of the convolutional code.  The path must start in a
+ *   blank at the initial state of the code and finish at the last position
+ *   in code state zero, so the basecall along the best path is always a
+ *   valid code word and the message is read from the code states visited.
+ *
+ *   @param trans  CRF transition matrix, as from the rnnrf models (log-space,
+ *   destination state major, one column per block)
+ *   @param code  Convolutional code
+ *   @param msg_len  Length of message
+ *   @param band  Number of positions either side of the expected position
+ *   searched at each block, 0 to search the full trellis
+ *   @param msg [out]  Decoded message, array of msg_len bits
+ *
+ *   @returns score of best path or NAN if no path was found
+ **/
+float decode_post_conv(const_scrappie_matrix trans, const conv_code * code, size_t msg_len,
+                       size_t band, bool * msg) {
+    RETURN_NULL_IF(NULL == trans, NAN);
+    RETURN_NULL_IF(NULL == code, NAN);
+    RETURN_NULL_IF(NULL == msg, NAN);
+    assert(NSTATE_CRF * NSTATE_CRF == trans->nr);
+
+    const size_t nblk = trans->nc;
+    const size_t nstate_conv = code->nstate;
+    const size_t nstate_per_pos = NSTATE_CRF * nstate_conv;
+    //  Positions 0 to msg_len + mem in trellis
+    const size_t npos = msg_len + code->mem + 1;
+    if (nblk < npos - 1) {
+        //  Too few blocks to emit message
+        return NAN;
+    }
+    const size_t nstate_total = npos * nstate_per_pos;
+    float score = NAN;
+
+    pos_band * bands = calloc(nblk, sizeof(pos_band));
+    packed_traceback tb = {NULL, calloc(nblk + 1, sizeof(size_t)), calloc(nblk, sizeof(size_t))};
+    float * curr_score = malloc(nstate_total * sizeof(float));
+    float * prev_score = malloc(nstate_total * sizeof(float));
+    size_t * path = calloc(nblk + 1, sizeof(size_t));
+    known_bits * known = calloc(npos, sizeof(known_bits));
+    if (NULL == bands || NULL == tb.offset || NULL == tb.first_state || NULL == curr_score
+        || NULL == prev_score || NULL == path || NULL == known) {
+        goto cleanup;
+    }
+
+    get_pos_bands(bands, nblk, npos, band);
+    get_known_bits(code, msg_len, known);
+    for (size_t t = 0; t < nblk; t++) {
+        tb.first_state[t] = bands[t].lo * nstate_per_pos;
+        const size_t nstate_blk = (bands[t].hi - bands[t].lo + 1) * nstate_per_pos;
+        tb.offset[t + 1] = tb.offset[t] + (nstate_blk + 1) / 2;
+    }
+    tb.data = calloc(tb.offset[nblk], sizeof(uint8_t));
+    if (NULL == tb.data) {
+        goto cleanup;
+    }
+
+    //  Scores are -INFINITY outside the band of the block they belong to
+    for (size_t st = 0; st < nstate_total; st++) {
+        curr_score[st] = -INFINITY;
+        prev_score[st] = -INFINITY;
+    }
+    //  Only valid initial state is first position, initial code state and blank
+    curr_score[CRF_BLANK * nstate_conv + code->initial_state] = 0.0f;
+    pos_band curr_band = {0, 0};
+    pos_band prev_band = {0, 0};
+
+    for (size_t t = 0; t < nblk; t++) {
+        //  Reuse the scores from two blocks ago, clearing only their band
+        float * tmp = prev_score;
+        prev_score = curr_score;
+        curr_score = tmp;
+        for (size_t st = prev_band.lo * nstate_per_pos; st < (prev_band.hi + 1) * nstate_per_pos; st++) {
+            curr_score[st] = -INFINITY;
+        }
+        prev_band = curr_band;
+        curr_band = bands[t];
+
+        const float * post_t = trans->data.f + t * trans->stride;
+        for (size_t pos = curr_band.lo; pos <= curr_band.hi; pos++) {
+            post_conv_acs_pos(code, post_t, prev_score, curr_score, tb, t, pos, known[pos]);
+        }
+    }
+
+    //  Best final state is at last position with code state zero
+    score = -INFINITY;
+    for (size_t st_crf = 0; st_crf < NSTATE_CRF; st_crf++) {
+        const size_t st = (npos - 1) * nstate_per_pos + st_crf * nstate_conv;
+        if (curr_score[st] > score) {
+            score = curr_score[st];
+            path[nblk] = st;
+        }
+    }
+    if (!isfinite(score)) {
+        //  No valid path within band
+        score = NAN;
+        goto cleanup;
+    }
+
+    for (size_t t = nblk; t > 0; t--) {
+        const size_t st2 = path[t];
+        const uint8_t decision = traceback_get(tb, t - 1, st2);
+        const size_t st2_pos = st2 / nstate_per_pos;
+        const size_t st2_conv = st2 % nstate_conv;
+        const size_t st1_crf = decision & 0x7;
+        if (CRF_BLANK == (st2 / nstate_conv) % NSTATE_CRF) {
+            path[t - 1] = st2_pos * nstate_per_pos + st1_crf * nstate_conv + st2_conv;
+        } else {
+            //  Newest bit of code state is message bit entering position
+            if (st2_pos - 1 < msg_len) {
+                msg[st2_pos - 1] = st2_conv >> (code->mem - 1);
+            }
+            const size_t st1_conv = ((st2_conv << 1) | (decision >> 3)) & (nstate_conv - 1);
+            path[t - 1] = (st2_pos - 1) * nstate_per_pos + st1_crf * nstate_conv + st1_conv;
+        }
+    }
+    assert(0 == path[0] / nstate_per_pos);
+
+cleanup:
+    free(known);
+    free(path);
+    free(prev_score);
+    free(curr_score);
+    free(tb.data);
+    free(tb.first_state);
+    free(tb.offset);
+    free(bands);
+
+    return score;
+}
+
+
+//  Smallest probability of a base passed between the CRF and the code, so
+//  neither stage can rule out a base the other finds likely
+#define CONV_BCJR_MIN_PROB 1e-6f
+
+
+/**  Normalise probabilities of the four bases at each position
+ *
+ *   Each probability is bounded below by CONV_BCJR_MIN_PROB.  A position with
+ *   no weight on any base becomes uniform.
+ **/
+static void normalise_base_probs(float * prob, size_t nbase) {
+    for (size_t i = 0; i < nbase; i++) {
+        float * p = prob + 4 * i;
+        const float sum = p[0] + p[1] + p[2] + p[3];
+        for (int b = 0; b < 4; b++) {
+            p[b] = (sum > 0.0f) ? fmaxf(p[b] / sum, CONV_BCJR_MIN_PROB) : 0.25f;
+        }
+    }
+}
+
+
+//  Log of zero probability.  Finite, so differences between impossible
+//  scores stay finite and lanes of a vector need no special cases
+#define CONV_LOG_ZERO -1e30f
+//  Padding at each end of a row of scores, so positions either side of a
+//  vector of positions may be loaded
+#define CRF_ROW_PAD 4
+
+
+/**  Length of a row of scores for each position, padded
+ **/
+static inline size_t crf_row_stride(size_t npos) {
+    return 4 * ((npos + 3) / 4) + 2 * CRF_ROW_PAD;
+}
+
+
+static void fill_log_zero(float * x, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        x[i] = CONV_LOG_ZERO;
+    }
+}
+
+
+/**  Positions, in vectors of four, that may be occupied after t blocks
+ *
+ *   @param lo [out]  First position
+ *   @param hi [out]  One past last position, a multiple of four
+ **/
+static void crf_column_range(const pos_band * bands, size_t t, size_t * lo, size_t * hi) {
+    const pos_band occupied = (t > 0) ? bands[t - 1] : (pos_band){0, 0};
+    *lo = occupied.lo & ~(size_t)3;
+    *hi = (occupied.hi + 4) & ~(size_t)3;
+}
+
+
+/**  Horizontal sum of vector
+ **/
+static inline float hsum_ps(__m128 x) {
+    const __m128 y = _mm_add_ps(x, _mm_movehl_ps(x, x));
+    return _mm_cvtss_f32(_mm_add_ss(y, _mm_shuffle_ps(y, y, _MM_SHUFFLE(1, 1, 1, 1))));
+}
+
+
+static inline float hmax_ps(__m128 x) {
+    const __m128 y = _mm_max_ps(x, _mm_movehl_ps(x, x));
+    return _mm_cvtss_f32(_mm_max_ss(y, _mm_shuffle_ps(y, y, 1)));
+}
+
+
+static inline __m128 logsumexp5_ps(const __m128 * x) {
+    __m128 m = x[0];
+    for (size_t i = 1; i < NSTATE_CRF; i++) {
+        m = _mm_max_ps(m, x[i]);
+    }
+    __m128 sum = _mm_setzero_ps();
+    for (size_t i = 0; i < NSTATE_CRF; i++) {
+        sum = _mm_add_ps(sum, expfv(_mm_sub_ps(x[i], m)));
+    }
+    return _mm_add_ps(m, logfv(sum));
+}
+
+
+/**  Subtract constant from scores of positions [lo, hi) of each CRF state
+ **/
+static void shift_crf_column(float * col, size_t stride, size_t lo, size_t hi, float shift) {
+    const __m128 vshift = _mm_set1_ps(shift);
+    for (size_t st = 0; st < NSTATE_CRF; st++) {
+        float * c = col + st * stride + CRF_ROW_PAD;
+        for (size_t pos = lo; pos < hi; pos += 4) {
+            _mm_storeu_ps(c + pos, _mm_sub_ps(_mm_loadu_ps(c + pos), vshift));
+        }
+    }
+}
+
+
+/**  Posterior of each base of the code word from the CRF
+ *
+ *   Forwards-backwards over the CRF, as posterior_crf, with the states also
+ *   counting the bases emitted so far, so it is known which base of the code
+ *   word each transition into a non-blank state emits.  Paths start in a
+ *   blank having emitted nothing and end having emitted all nbase bases.
+ *
+ *   Scores are logarithms, each forward and backward column shifted so its
+ *   largest is zero: on long reads the mass of paths ending on the last base
+ *   may be smaller than a float can hold relative to that of paths that
+ *   don't.  A column is laid out [crf][pos], so each recursion is over a
+ *   vector of contiguous positions.  Vectors partly outside the band of a
+ *   block are computed whole, which only widens the band.
+ *
+ *   The posterior returned is extrinsic: the prior of each base is excluded
+ *   from its own posterior, as is needed to iterate with the code.
+ *
+ *   @param trans  CRF transition matrix
+ *   @param nbase  Number of bases in code word
+ *   @param bands  Positions that may be occupied after each block
+ *   @param prior  Prior probability of each base of code word, [pos][base]
+ *   @param alpha  Workspace [(nblk + 1) * NSTATE_CRF * crf_row_stride(nbase + 1)]
+ *   @param work  Workspace [(2 * NSTATE_CRF + 8) * crf_row_stride(nbase + 1)]
+ *   @param ext [out]  Extrinsic probability of each base, as prior
+ *
+ *   @returns true on success, false if no path emits exactly nbase bases
+ **/
+static bool crf_base_posterior(const_scrappie_matrix trans, size_t nbase, const pos_band * bands,
+                               const float * prior, float * alpha, float * work, float * ext) {
+    const size_t nblk = trans->nc;
+    const size_t npos = nbase + 1;
+    const size_t stride = crf_row_stride(npos);
+    const size_t ncol = NSTATE_CRF * stride;
+    float * next = work;
+    float * curr = work + ncol;
+    //  Log prior and extrinsic probabilities, [base][pos].  Positions past
+    //  the last base have no prior, so no path emits more than nbase bases
+    float * prior_t = work + 2 * ncol;
+    float * ext_t = prior_t + 4 * stride;
+    fill_log_zero(prior_t, 4 * stride);
+    memset(ext_t, 0, 4 * stride * sizeof(float));
+    for (size_t pos = 0; pos < nbase; pos++) {
+        for (size_t b = 0; b < 4; b++) {
+            prior_t[b * stride + CRF_ROW_PAD + pos] = logf(prior[4 * pos + b]);
+        }
+    }
+    const float * q = prior_t + CRF_ROW_PAD;
+    __m128 x[NSTATE_CRF];
+
+    //  Forwards pass
+    fill_log_zero(alpha, (nblk + 1) * ncol);
+    alpha[CRF_BLANK * stride + CRF_ROW_PAD] = 0.0f;
+    for (size_t t = 0; t < nblk; t++) {
+        const float * post_t = trans->data.f + t * trans->stride;
+        const float * prev = alpha + t * ncol + CRF_ROW_PAD;
+        float * acurr = alpha + (t + 1) * ncol + CRF_ROW_PAD;
+        size_t lo, hi;
+        crf_column_range(bands, t + 1, &lo, &hi);
+        __m128 vmax = _mm_set1_ps(CONV_LOG_ZERO);
+        for (size_t pos = lo; pos < hi; pos += 4) {
+            //  Blank at same position
+            for (size_t st1 = 0; st1 < NSTATE_CRF; st1++) {
+                x[st1] = _mm_add_ps(_mm_loadu_ps(prev + st1 * stride + pos),
+                                    _mm_set1_ps(post_t[CRF_BLANK * NSTATE_CRF + st1]));
+            }
+            __m128 c = logsumexp5_ps(x);
+            _mm_storeu_ps(acurr + CRF_BLANK * stride + pos, c);
+            vmax = _mm_max_ps(vmax, c);
+            //  Base of next position
+            for (size_t st2 = 0; st2 < CRF_BLANK; st2++) {
+                for (size_t st1 = 0; st1 < NSTATE_CRF; st1++) {
+                    x[st1] = _mm_add_ps(_mm_loadu_ps(prev + st1 * stride + pos - 1),
+                                        _mm_set1_ps(post_t[st2 * NSTATE_CRF + st1]));
+                }
+                c = _mm_add_ps(logsumexp5_ps(x), _mm_loadu_ps(q + st2 * stride + pos - 1));
+                _mm_storeu_ps(acurr + st2 * stride + pos, c);
+                vmax = _mm_max_ps(vmax, c);
+            }
+        }
+        const float shift = hmax_ps(vmax);
+        RETURN_NULL_IF(!(shift > 0.5f * CONV_LOG_ZERO), false);
+        shift_crf_column(acurr - CRF_ROW_PAD, stride, lo, hi, shift);
+    }
+    //  Only paths finishing at the last position count
+    RETURN_NULL_IF(npos - 1 != bands[nblk - 1].hi, false);
+
+    //  Backwards pass, accumulating posterior of transitions into base states
+    fill_log_zero(next, ncol);
+    for (size_t st = 0; st < NSTATE_CRF; st++) {
+        next[st * stride + CRF_ROW_PAD + npos - 1] = 0.0f;
+    }
+    for (size_t t = nblk; t > 0; t--) {
+        //  Transitions of block t - 1 from positions occupied before it
+        const float * post_t = trans->data.f + (t - 1) * trans->stride;
+        const float * a = alpha + (t - 1) * ncol + CRF_ROW_PAD;
+        const float * n = next + CRF_ROW_PAD;
+        float * c = curr + CRF_ROW_PAD;
+        size_t lo, hi;
+        crf_column_range(bands, t - 1, &lo, &hi);
+        fill_log_zero(curr, ncol);
+        __m128 vmax = _mm_set1_ps(CONV_LOG_ZERO);
+        __m128 vmax_total = _mm_set1_ps(CONV_LOG_ZERO);
+        for (size_t pos = lo; pos < hi; pos += 4) {
+            for (size_t st1 = 0; st1 < NSTATE_CRF; st1++) {
+                x[CRF_BLANK] = _mm_add_ps(_mm_set1_ps(post_t[CRF_BLANK * NSTATE_CRF + st1]),
+                                          _mm_loadu_ps(n + CRF_BLANK * stride + pos));
+                for (size_t st2 = 0; st2 < CRF_BLANK; st2++) {
+                    const __m128 emit = _mm_add_ps(_mm_loadu_ps(q + st2 * stride + pos),
+                                                   _mm_loadu_ps(n + st2 * stride + pos + 1));
+                    x[st2] = _mm_add_ps(_mm_set1_ps(post_t[st2 * NSTATE_CRF + st1]), emit);
+                }
+                const __m128 cst = logsumexp5_ps(x);
+                _mm_storeu_ps(c + st1 * stride + pos, cst);
+                vmax = _mm_max_ps(vmax, cst);
+                vmax_total = _mm_max_ps(vmax_total, _mm_add_ps(cst, _mm_loadu_ps(a + st1 * stride + pos)));
+            }
+        }
+        const float max_total = hmax_ps(vmax_total);
+        RETURN_NULL_IF(!(max_total > 0.5f * CONV_LOG_ZERO), false);
+        __m128 vsum = _mm_setzero_ps();
+        for (size_t st = 0; st < NSTATE_CRF; st++) {
+            for (size_t pos = lo; pos < hi; pos += 4) {
+                const __m128 ab = _mm_add_ps(_mm_loadu_ps(a + st * stride + pos),
+                                             _mm_loadu_ps(c + st * stride + pos));
+                vsum = _mm_add_ps(vsum, expfv(_mm_sub_ps(ab, _mm_set1_ps(max_total))));
+            }
+        }
+        const __m128 ltotal = _mm_set1_ps(max_total + logf(hsum_ps(vsum)));
+
+        for (size_t pos = lo; pos < hi; pos += 4) {
+            for (size_t st2 = 0; st2 < CRF_BLANK; st2++) {
+                for (size_t st1 = 0; st1 < NSTATE_CRF; st1++) {
+                    x[st1] = _mm_add_ps(_mm_loadu_ps(a + st1 * stride + pos),
+                                        _mm_set1_ps(post_t[st2 * NSTATE_CRF + st1]));
+                }
+                const __m128 y = _mm_add_ps(logsumexp5_ps(x), _mm_loadu_ps(n + st2 * stride + pos + 1));
+                float * e = ext_t + st2 * stride + CRF_ROW_PAD + pos;
+                _mm_storeu_ps(e, _mm_add_ps(_mm_loadu_ps(e), expfv(_mm_sub_ps(y, ltotal))));
+            }
+        }
+
+        shift_crf_column(curr, stride, lo, hi, hmax_ps(vmax));
+        float * tmp = next;
+        next = curr;
+        curr = tmp;
+    }
+
+    for (size_t pos = 0; pos < nbase; pos++) {
+        for (size_t b = 0; b < 4; b++) {
+            ext[4 * pos + b] = ext_t[b * stride + CRF_ROW_PAD + pos];
+        }
+    }
+    normalise_base_probs(ext, nbase);
+    return true;
+}
+
+
+/**  Rescale vector of probabilities to sum to one
+ *
+ *   @returns false if the sum is zero
+ **/
+static bool rescale_probs(float * x, size_t n) {
+    __m128 sumv = _mm_setzero_ps();
+    for (size_t i = 0; i < n; i += 4) {
+        sumv = _mm_add_ps(sumv, _mm_loadu_ps(x + i));
+    }
+    const float sum = hsum_ps(sumv);
+    RETURN_NULL_IF(!(sum > 0.0f), false);
+    const __m128 scale = _mm_set1_ps(1.0f / sum);
+    for (size_t i = 0; i < n; i += 4) {
+        _mm_storeu_ps(x + i, _mm_mul_ps(scale, _mm_loadu_ps(x + i)));
+    }
+    return true;
+}
+
+
+/**  BCJR (forwards-backwards) decoding of code from probabilities of its bases
+ *
+ *   Runs on the trellis of the code alone, four states to a vector, with the
+ *   states laid out as decode_post_conv: the two predecessors of conv states
+ *   c and c + half are 2c and 2c + 1.  Bits fixed by the initial state, sync
+ *   markers and terminating zeros have prior probability zero of differing.
+ *
+ *   @param code  Convolutional code
+ *   @param msg_len  Length of message
+ *   @param pbase  Probability of each base of code word [(msg_len + mem) * 4]
+ *   @param alpha  Workspace [(msg_len + mem + 1) * nstate]
+ *   @param beta  Workspace [2 * nstate]
+ *   @param ext [out]  Extrinsic probability of each base of code word, as
+ *   pbase, excluding the probability of the base itself
+ *   @param pone [out]  Posterior probability each message bit is one [msg_len]
+ *
+ *   @returns true on success, false if no code word is possible
+ **/
+static bool conv_bcjr(const conv_code * code, size_t msg_len, const float * pbase, float * alpha,
+                      float * beta, float * ext, float * pone) {
+    const size_t nstate = code->nstate;
+    const size_t half = nstate / 2;
+    const size_t nbase = msg_len + code->mem;
+    const __m128i base_id[4] = {_mm_set1_epi32(0), _mm_set1_epi32(1), _mm_set1_epi32(2), _mm_set1_epi32(3)};
+
+    //  Forwards pass
+    memset(alpha, 0, nstate * sizeof(float));
+    alpha[code->initial_state] = 1.0f;
+    for (size_t i = 0; i < nbase; i++) {
+        const float * prev = alpha + i * nstate;
+        float * curr = alpha + (i + 1) * nstate;
+        const __m128 table = _mm_loadu_ps(pbase + 4 * i);
+        for (int bit = 0; bit < 2; bit++) {
+            const bool allowed = (i < msg_len) ? conv_sync_allows(code, i, bit) : (0 == bit);
+            for (size_t c = 0; c < half; c += 4) {
+                const size_t st2 = c + bit * half;
+                if (!allowed) {
+                    _mm_storeu_ps(curr + st2, _mm_setzero_ps());
+                    continue;
+                }
+                const __m128 lo = _mm_loadu_ps(prev + 2 * c);
+                const __m128 hi = _mm_loadu_ps(prev + 2 * c + 4);
+                const __m128 even = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+                const __m128 odd = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+                const __m128i base0 = _mm_loadu_si128((const __m128i *)(code->base_in + st2));
+                const __m128i base1 = _mm_loadu_si128((const __m128i *)(code->base_in + nstate + st2));
+                _mm_storeu_ps(curr + st2, _mm_add_ps(_mm_mul_ps(even, lookup_base(table, base0)),
+                                                     _mm_mul_ps(odd, lookup_base(table, base1))));
+            }
+        }
+        RETURN_NULL_IF(!rescale_probs(curr, nstate), false);
+    }
+    //  Code word must finish in state zero
+    RETURN_NULL_IF(!(alpha[nbase * nstate] > 0.0f), false);
+
+    //  Backwards pass, accumulating posterior of each transition by its base
+    float * next = beta;
+    float * curr = beta + nstate;
+    memset(next, 0, nstate * sizeof(float));
+    next[0] = 1.0f;
+    for (size_t i = nbase; i > 0; i--) {
+        const size_t pos = i - 1;
+        const float * a = alpha + pos * nstate;
+        const __m128 table = _mm_loadu_ps(pbase + 4 * pos);
+        //  Weight of transitions emitting each base, by bit
+        __m128 acc[2][4];
+        for (int bit = 0; bit < 2; bit++) {
+            for (int b = 0; b < 4; b++) {
+                acc[bit][b] = _mm_setzero_ps();
+            }
+        }
+        for (size_t c = 0; c < half; c += 4) {
+            const __m128 lo = _mm_loadu_ps(a + 2 * c);
+            const __m128 hi = _mm_loadu_ps(a + 2 * c + 4);
+            const __m128 asrc[2] = {_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)),
+                                    _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1))};
+            __m128 bsrc[2] = {_mm_setzero_ps(), _mm_setzero_ps()};
+            for (int bit = 0; bit < 2; bit++) {
+                const bool allowed = (pos < msg_len) ? conv_sync_allows(code, pos, bit) : (0 == bit);
+                if (!allowed) {
+                    continue;
+                }
+                const size_t st2 = c + bit * half;
+                const __m128 bnext = _mm_loadu_ps(next + st2);
+                for (int conv_bit = 0; conv_bit < 2; conv_bit++) {
+                    const __m128i base = _mm_loadu_si128((const __m128i *)(code->base_in + conv_bit * nstate + st2));
+                    bsrc[conv_bit] = _mm_add_ps(bsrc[conv_bit], _mm_mul_ps(lookup_base(table, base), bnext));
+                    const __m128 w = _mm_mul_ps(asrc[conv_bit], bnext);
+                    for (int b = 0; b < 4; b++) {
+                        const __m128 is_b = _mm_castsi128_ps(_mm_cmpeq_epi32(base, base_id[b]));
+                        acc[bit][b] = _mm_add_ps(acc[bit][b], _mm_and_ps(is_b, w));
+                    }
+                }
+            }
+            //  Interleave back to states 2c, 2c + 1, ...
+            _mm_storeu_ps(curr + 2 * c, _mm_unpacklo_ps(bsrc[0], bsrc[1]));
+            _mm_storeu_ps(curr + 2 * c + 4, _mm_unpackhi_ps(bsrc[0], bsrc[1]));
+        }
+
+        float wbit[2] = {0.0f, 0.0f};
+        for (int b = 0; b < 4; b++) {
+            const float w0 = hsum_ps(acc[0][b]);
+            const float w1 = hsum_ps(acc[1][b]);
+            ext[4 * pos + b] = w0 + w1;
+            wbit[0] += w0 * pbase[4 * pos + b];
+            wbit[1] += w1 * pbase[4 * pos + b];
+        }
+        RETURN_NULL_IF(!(wbit[0] + wbit[1] > 0.0f), false);
+        if (pos < msg_len) {
+            pone[pos] = wbit[1] / (wbit[0] + wbit[1]);
+        }
+        RETURN_NULL_IF(!rescale_probs(curr, nstate), false);
+        float * tmp = next;
+        next = curr;
+        curr = tmp;
+    }
+
+    normalise_base_probs(ext, nbase);
+    return true;
+}
+
+
+/**  Decode convolutionally coded message by iterating BCJR on CRF and code
+ *
+ *   An alternative to decode_post_conv that never forms the product of the
+ *   CRF and code trellises.  Forwards-backwards on the CRF, counting bases
+ *   emitted, gives the probability of each base of the code word; BCJR on the
+ *   code trellis alone turns these into probabilities of the message bits
+ *   and new probabilities for each base, which are fed back to the CRF as
+ *   priors.  Only extrinsic information is passed between the two, as for
+ *   turbo decoding.  The cost of each iteration is that of the CRF pass,
+ *   O(nblk * msg_len), plus that of the code, O(msg_len * 2^mem), rather
+ *   than their product.
+ *
+ *   Parameters as decode_post_conv with
+ *   @param niter  Number of iterations between CRF and code, at least one
+ *
+ *   @returns log probability of the decoded message, the sum over message
+ *   bits of the log posterior probability of the bit decoded, or NAN on
+ *   failure
+ **/
+float decode_post_conv_bcjr(const_scrappie_matrix trans, const conv_code * code, size_t msg_len,
+                            size_t band, size_t niter, bool * msg) {
+    RETURN_NULL_IF(NULL == trans, NAN);
+    RETURN_NULL_IF(NULL == code, NAN);
+    RETURN_NULL_IF(NULL == msg, NAN);
+    RETURN_NULL_IF(0 == niter, NAN);
+    assert(NSTATE_CRF * NSTATE_CRF == trans->nr);
+
+    const size_t nblk = trans->nc;
+    const size_t nbase = msg_len + code->mem;
+    const size_t npos = nbase + 1;
+    if (nblk < nbase) {
+        //  Too few blocks to emit message
+        return NAN;
+    }
+    float score = NAN;
+
+    pos_band * bands = calloc(nblk, sizeof(pos_band));
+    float * crf_alpha = calloc((nblk + 1) * NSTATE_CRF * crf_row_stride(npos), sizeof(float));
+    float * crf_work = calloc((2 * NSTATE_CRF + 8) * crf_row_stride(npos), sizeof(float));
+    float * conv_alpha = calloc((nbase + 1) * code->nstate, sizeof(float));
+    float * conv_beta = calloc(2 * code->nstate, sizeof(float));
+    float * prior = calloc(nbase * 4, sizeof(float));
+    float * pcrf = calloc(nbase * 4, sizeof(float));
+    float * pone = calloc(msg_len, sizeof(float));
+    if (NULL == bands || NULL == crf_alpha || NULL == crf_work || NULL == conv_alpha
+        || NULL == conv_beta || NULL == prior || NULL == pcrf || NULL == pone) {
+        goto cleanup;
+    }
+
+    //  Positions that can't be reached from start or can't reach the end have
+    //  no probability so are skipped, even when searching the full trellis
+    get_pos_bands(bands, nblk, npos, (0 == band) ? npos : band);
+    for (size_t i = 0; i < nbase * 4; i++) {
+        prior[i] = 0.25f;
+    }
+    for (size_t iter = 0; iter < niter; iter++) {
+        if (!crf_base_posterior(trans, nbase, bands, prior, crf_alpha, crf_work, pcrf)
+            || !conv_bcjr(code, msg_len, pcrf, conv_alpha, conv_beta, prior, pone)) {
+            goto cleanup;
+        }
+    }
+
+    score = 0.0f;
+    for (size_t i = 0; i < msg_len; i++) {
+        msg[i] = pone[i] > 0.5f;
+        score += logf(msg[i] ? pone[i] : (1.0f - pone[i]));
+    }
+
+cleanup:
+    free(pone);
+    free(pcrf);
+    free(prior);
+    free(conv_beta);
+    free(conv_alpha);
+    free(crf_work);
+    free(crf_alpha);
+    free(bands);
+
+    return score;
+}
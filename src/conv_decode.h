@@ -0,0 +1,54 @@
+#pragma once
+#ifndef CONV_DECODE_H
+#    define CONV_DECODE_H
+
+/**  Decoding of convolutionally coded messages from CRF posteriors
+ *
+ *   A message of msg_len bits is encoded with a rate 1/2 convolutional code,
+ *   terminated by mem zero bits, and each pair of output bits written as a
+ *   base 2 * out0 + out1 (A = 00, C = 01, G = 10, T = 11).  The decoder
+ *   searches the product of the CRF and the code trellis for the most likely
+ *   message, as shubham/viterbi_nanopore.cpp does for a posterior file.
+ *   decode_post_conv_bcjr instead iterates soft decoding of the CRF and of
+ *   the code separately, at a cost independent of the product of their
+ *   state spaces.
+ **/
+
+#    include <stdbool.h>
+#    include <stdint.h>
+#    include "scrappie_matrix.h"
+
+#    define CONV_MIN_MEM 3
+#    define CONV_MAX_MEM 16
+#    define CONV_MAX_SYNC 64
+
+typedef struct {
+    int mem;
+    uint32_t nstate;
+    uint32_t gen[2];
+    uint32_t initial_state;
+    //  Sync marker bits, repeated every sync_period message bits
+    size_t sync_length;
+    size_t sync_period;
+    bool sync_marker[CONV_MAX_SYNC];
+    //  Base output when bit enters state, 2 * nstate as [state][bit]
+    uint8_t * output;
+    //  Base output on entering each state from its two previous states,
+    //  2 * nstate as [bit][state].  State c with bit b on top is entered from
+    //  2c + b' for b' in {0, 1}, dropping the top bit.
+    uint32_t * base_in;
+} conv_code;
+
+bool default_conv_generator(int mem, uint32_t gen[2]);
+conv_code * make_conv_code(int mem, const uint32_t gen[2], uint32_t initial_state,
+                           const char * sync_marker, size_t sync_period);
+conv_code * free_conv_code(conv_code * code);
+bool conv_sync_allows(const conv_code * code, size_t pos, int bit);
+
+int * conv_encode_bases(const conv_code * code, const bool * msg, size_t msg_len);
+float decode_post_conv(const_scrappie_matrix trans, const conv_code * code, size_t msg_len,
+                       size_t band, bool * msg);
+float decode_post_conv_bcjr(const_scrappie_matrix trans, const conv_code * code, size_t msg_len,
+                            size_t band, size_t niter, bool * msg);
+
+#endif                          /* CONV_DECODE_H */
@@ -2,11 +2,16 @@
 #include <math.h>
 
 #include "decode.h"
+#include "decode_crf5.h"
+#include "layers.h"
+#include "scrappie_seq_helpers.h"
 #include "scrappie_stdlib.h"
 #include "util.h"
 
 #define NBASE 4
 #define BIG_FLOAT 1.e30f
+//  Highest Phred quality given to a base called from a CRF
+#define CRF_MAX_QUALITY 50
 
 #ifndef __SSE2__
 #    error "Compilation of function decode_transducer requires a processor that supports at least SSE2"
@@ -56,28 +61,38 @@ float viterbi_backtrace(float const *score, size_t n, const_scrappie_imatrix tra
     return logscore;
 }
 
-float viterbi_local_backtrace(float const *score, size_t n, const_scrappie_imatrix traceback, int * seq){
-    RETURN_NULL_IF(NULL == score, NAN);
-    RETURN_NULL_IF(NULL == seq, NAN);
-
-    const size_t nblock = traceback->nc;
-    for(size_t i=0 ; i <= nblock ; i++){
-        // Initialise entries to stay
-        seq[i] = -1;
-    }
-
-    int last_state = argmaxf(score, n + 2);
-    float logscore = score[last_state];
-    for(size_t i=0 ; i < nblock ; i++){
-        const size_t ri = nblock - i - 1;
+/**  Backtrace through a segment of blocks for local Viterbi
+ *
+ *   @param traceback  Traceback for segment, first column is block blk_offset
+ *   @param nblk Number of blocks in segment
+ *   @param blk_offset  Block at which segment starts
+ *   @param last_state  State at end of segment
+ *   @param seq  Sequence of states for whole read [out].  Entry blk + 1
+ *               corresponds to block blk.
+ *
+ *   @returns State at start of segment
+ **/
+static int viterbi_local_backtrace_segment(const_scrappie_imatrix traceback, size_t nblk,
+                                           size_t blk_offset, int last_state, int * seq){
+    for(size_t i=0 ; i < nblk ; i++){
+        const size_t ri = nblk - i - 1;
         const int state = traceback->data.f[ri * traceback->stride + last_state];
         if(state >= 0){
-            seq[ri + 1] = last_state;
+            seq[blk_offset + ri + 1] = last_state;
             last_state = state;
         }
     }
-    seq[0] = last_state;
+    return last_state;
+}
+
 
+/**  Replace local start and end states by stays
+ *
+ *   @param n Number of states, excluding start and end states
+ *   @param nblock Number of blocks
+ *   @param seq  Sequence of states [nblock + 1], modified in place
+ **/
+static void viterbi_local_transcode_ends(size_t n, size_t nblock, int * seq){
     //  Transcode start to stay
     for(size_t i=0 ; i < nblock ; i++){
         if(seq[i] == n){
@@ -94,10 +109,28 @@ float viterbi_local_backtrace(float const *score, size_t n, const_scrappie_imatr
             break;
         }
     }
+}
+
+float viterbi_local_backtrace(float const *score, size_t n, const_scrappie_imatrix traceback, int * seq){
+    RETURN_NULL_IF(NULL == score, NAN);
+    RETURN_NULL_IF(NULL == seq, NAN);
+
+    const size_t nblock = traceback->nc;
+    for(size_t i=0 ; i <= nblock ; i++){
+        // Initialise entries to stay
+        seq[i] = -1;
+    }
+
+    int last_state = argmaxf(score, n + 2);
+    float logscore = score[last_state];
+    last_state = viterbi_local_backtrace_segment(traceback, nblock, 0, last_state, seq);
+    seq[0] = last_state;
+    viterbi_local_transcode_ends(n, nblock, seq);
 
     return logscore;
 }
 
+
 float argmax_decoder(const_scrappie_matrix logpost, int *seq) {
     RETURN_NULL_IF(NULL == logpost, NAN);
     RETURN_NULL_IF(NULL == seq, NAN);
@@ -121,27 +154,238 @@ float argmax_decoder(const_scrappie_matrix logpost, int *seq) {
     return logscore;
 }
 
-float decode_transducer(const_scrappie_matrix logpost, float stay_pen, float skip_pen, float local_pen, int *seq,
-                        bool allow_slip) {
-    float logscore = NAN;
-    RETURN_NULL_IF(NULL == logpost, logscore);
-    RETURN_NULL_IF(NULL == seq, logscore);
-
-    const int nblock = logpost->nc;
-    const int nstate = logpost->nr;
-    const int nhistory = nstate - 1;
+static inline void assert_transducer_dimensions(int nhistory, bool allow_slip) {
     assert((nhistory % 4) == 0);
+    assert(((nhistory / 4) % 4) == 0);
+    assert(((nhistory / 16) % 4) == 0);
+    if (allow_slip) {
+        assert(((nhistory / 64) % 4) == 0);
+    }
+}
+
+/**  One block of Viterbi recursion for decode_transducer
+ *
+ *   @param logpost Log posterior matrix
+ *   @param blk Block to process
+ *   @param stay_pen, skip_pen, local_pen, allow_slip  As for decode_transducer
+ *   @param prev_score Scores at end of previous block [nhistory + 2]
+ *   @param score Scores at end of this block [out, nhistory + 2]
+ *   @param tmp, itmp  Workspace [nhistory]
+ *   @param tb Traceback for this block [out, nhistory + 2]
+ **/
+static void decode_transducer_step(const_scrappie_matrix logpost, size_t blk, float stay_pen,
+                                   float skip_pen, float local_pen, bool allow_slip,
+                                   const_scrappie_matrix prev_score, scrappie_matrix score,
+                                   scrappie_matrix tmp, scrappie_imatrix itmp, __m128i * tb) {
+    const int nhistory = logpost->nr - 1;
     const int32_t nhistoryq = nhistory / 4;
     const __m128i nhistoryqv = _mm_set1_epi32(nhistoryq);
-    assert((nhistoryq % 4) == 0);
     const int32_t nhistoryqq = nhistoryq / 4;
     const __m128i nhistoryqqv = _mm_set1_epi32(nhistoryqq);
-    assert((nhistoryqq % 4) == 0);
     const int32_t nhistoryqqq = nhistoryqq / 4;
     const __m128i nhistoryqqqv = _mm_set1_epi32(nhistoryqqq);
+    const size_t offsetPq = blk * logpost->nrq;
+    const size_t offsetP = offsetPq * 4;
+    int32_t * tbf = (int32_t *)tb;
+
+    // Stay
+    const __m128 stay_m128 =
+        _mm_set1_ps(logpost->data.f[offsetP + nhistory] - stay_pen);
+    const __m128i negone_m128i = _mm_set1_epi32(-1);
+    for (int i = 0; i < nhistoryq; i++) {
+        // Traceback for stay is negative
+        score->data.v[i] = prev_score->data.v[i] + stay_m128;
+        tb[i] = negone_m128i;
+    }
+
+    // Step
+    // Following three loops find maximum over suffix and record index
+    for (int i = 0; i < nhistoryqq; i++) {
+        tmp->data.v[i] = prev_score->data.v[i];
+        itmp->data.v[i] = _mm_setzero_si128();
+    }
+    for (int r = 1; r < NBASE; r++) {
+        const size_t offset = r * nhistoryqq;
+        const __m128i itmp_fill = _mm_set1_epi32(r);
+        for (int i = 0; i < nhistoryqq; i++) {
+            __m128i mask = _mm_castps_si128(_mm_cmplt_ps(tmp->data.v[i],
+                                                         prev_score->data.
+                                                         v[offset + i]));
+            tmp->data.v[i] =
+                _mm_max_ps(tmp->data.v[i], prev_score->data.v[offset + i]);
+            itmp->data.v[i] =
+                _mm_or_si128(_mm_andnot_si128(mask, itmp->data.v[i]),
+                             _mm_and_si128(mask, itmp_fill));
+        }
+    }
+    const __m128i c0123_m128i = _mm_setr_epi32(0, 1, 2, 3);
+    for (int i = 0; i < nhistoryqq; i++) {
+        itmp->data.v[i] =
+            _mm_add_epi32(_mm_mullo_epi32(itmp->data.v[i], nhistoryqv),
+                          _mm_add_epi32(c0123_m128i,
+                                        _mm_set1_epi32(i * 4)));
+    }
+
+    for (int pref = 0; pref < nhistoryq; pref++) {
+        const size_t i = pref;
+        const __m128 step_score =
+            logpost->data.v[offsetPq + i] + _mm_set1_ps(tmp->data.f[pref]);
+        __m128i mask =
+            _mm_castps_si128(_mm_cmplt_ps(score->data.v[i], step_score));
+        score->data.v[i] = _mm_max_ps(score->data.v[i], step_score);
+        tb[i] =
+            _mm_or_si128(_mm_andnot_si128
+                         (mask, tb[i]),
+                         _mm_and_si128(mask,
+                                       _mm_set1_epi32(itmp->data.f[pref])));
+    }
+
+    // Skip
+    const __m128 skip_penv = _mm_set1_ps(skip_pen);
+    for (int i = 0; i < nhistoryqqq; i++) {
+        tmp->data.v[i] = prev_score->data.v[i];
+        itmp->data.v[i] = _mm_setzero_si128();
+    }
+    for (int r = 1; r < NBASE * NBASE; r++) {
+        const size_t offset = r * nhistoryqqq;
+        const __m128i itmp_fill = _mm_set1_epi32(r);
+        for (int i = 0; i < nhistoryqqq; i++) {
+            __m128i mask = _mm_castps_si128(_mm_cmplt_ps(tmp->data.v[i],
+                                                         prev_score->data.
+                                                         v[offset + i]));
+            tmp->data.v[i] =
+                _mm_max_ps(tmp->data.v[i], prev_score->data.v[offset + i]);
+            itmp->data.v[i] =
+                _mm_or_si128(_mm_andnot_si128(mask, itmp->data.v[i]),
+                             _mm_and_si128(mask, itmp_fill));
+        }
+    }
+    for (int i = 0; i < nhistoryqqq; i++) {
+        itmp->data.v[i] =
+            _mm_add_epi32(_mm_mullo_epi32(itmp->data.v[i], nhistoryqqv),
+                          _mm_add_epi32(c0123_m128i,
+                                        _mm_set1_epi32(i * 4)));
+    }
+    for (int pref = 0; pref < nhistoryqq; pref++) {
+        for (int i = 0; i < NBASE; i++) {
+            const size_t oi = pref * NBASE + i;
+            // This cycling through prefixes
+            const __m128 skip_score = logpost->data.v[offsetPq + oi]
+                + _mm_set1_ps(tmp->data.f[pref])
+                - skip_penv;
+            __m128i mask =
+                _mm_castps_si128(_mm_cmplt_ps
+                                 (score->data.v[oi], skip_score));
+            score->data.v[oi] = _mm_max_ps(score->data.v[oi], skip_score);
+            tb[oi] =
+                _mm_or_si128(_mm_andnot_si128
+                             (mask, tb[oi]),
+                             _mm_and_si128(mask,
+                                           _mm_set1_epi32(itmp->
+                                                          data.f[pref])));
+        }
+    }
+
+    // Slip
     if (allow_slip) {
-        assert((nhistoryqqq % 4) == 0);
+        const int32_t nhistoryqqqq = nhistoryqqq / 4;
+        const __m128 slip_penv = _mm_set1_ps(2.0 * skip_pen);
+        for (int i = 0; i < nhistoryqqqq; i++) {
+            tmp->data.v[i] = prev_score->data.v[i];
+            itmp->data.v[i] = _mm_setzero_si128();
+        }
+        for (int r = 1; r < NBASE * NBASE * NBASE; r++) {
+            const size_t offset = r * nhistoryqqqq;
+            const __m128i itmp_fill = _mm_set1_epi32(r);
+            for (int i = 0; i < nhistoryqqqq; i++) {
+                __m128i mask = _mm_castps_si128(_mm_cmplt_ps(tmp->data.v[i],
+                                                             prev_score->
+                                                             data.v[offset +
+                                                                    i]));
+                tmp->data.v[i] =
+                    _mm_max_ps(tmp->data.v[i],
+                               prev_score->data.v[offset + i]);
+                itmp->data.v[i] =
+                    _mm_or_si128(_mm_andnot_si128(mask, itmp->data.v[i]),
+                                 _mm_and_si128(mask, itmp_fill));
+            }
+        }
+        for (int i = 0; i < nhistoryqqqq; i++) {
+            itmp->data.v[i] =
+                _mm_add_epi32(_mm_mullo_epi32
+                              (itmp->data.v[i], nhistoryqqqv),
+                              _mm_add_epi32(c0123_m128i,
+                                            _mm_set1_epi32(i * 4)));
+        }
+        for (int pref = 0; pref < nhistoryqqq; pref++) {
+            for (int i = 0; i < NBASE * NBASE; i++) {
+                const size_t oi = pref * NBASE * NBASE + i;
+                // This cycling through prefixes
+                const __m128 skip_score = logpost->data.v[offsetPq + oi]
+                    + _mm_set1_ps(tmp->data.f[pref])
+                    - slip_penv;
+                __m128i mask =
+                    _mm_castps_si128(_mm_cmplt_ps
+                                     (score->data.v[oi], skip_score));
+                score->data.v[oi] =
+                    _mm_max_ps(score->data.v[oi], skip_score);
+                tb[oi] =
+                    _mm_or_si128(_mm_andnot_si128
+                                 (mask, tb[oi]),
+                                 _mm_and_si128(mask,
+                                               _mm_set1_epi32(itmp->data.f
+                                                              [pref])));
+            }
+        }
     }
+
+    // Remain in start state (stay or local penalty)
+    score->data.f[nhistory] = prev_score->data.f[nhistory]
+                            + fmaxf(-local_pen, logpost->data.f[offsetP + nhistory] - stay_pen);
+    tbf[nhistory] = nhistory;
+    // Exit start state
+    for(int hst=0 ; hst < nhistory ; hst++){
+        const float scoref = prev_score->data.f[nhistory] + logpost->data.f[offsetP + hst];
+        if(scoref > score->data.f[hst]){
+            score->data.f[hst] = scoref;
+            tbf[hst] = nhistory;
+        }
+    }
+
+    // Remain in end state (stay or local penalty)
+    score->data.f[nhistory + 1] = prev_score->data.f[nhistory + 1]
+                                + fmax(-local_pen, logpost->data.f[offsetP + nhistory] - stay_pen);
+    tbf[nhistory + 1] = nhistory + 1;
+    // Enter end state
+    for(int hst=0 ; hst < nhistory ; hst++){
+        const float scoref = prev_score->data.f[hst] - local_pen;
+        if(scoref > score->data.f[nhistory + 1]){
+            score->data.f[nhistory + 1] = scoref;
+            tbf[nhistory + 1] = hst;
+        }
+    }
+}
+
+struct transducer_walk;
+static float viterbi_local_backtrace_walk(float const *score, size_t n, const_scrappie_imatrix traceback,
+                                          int * seq, struct transducer_walk * walk);
+
+/**  Viterbi decoding of transducer
+ *
+ *   @param walk  Walk fed with the path during the traceback, or NULL
+ **/
+static float decode_transducer_impl(const_scrappie_matrix logpost, float stay_pen, float skip_pen,
+                                    float local_pen, int *seq, bool allow_slip,
+                                    struct transducer_walk * walk) {
+    float logscore = NAN;
+    RETURN_NULL_IF(NULL == logpost, logscore);
+    RETURN_NULL_IF(NULL == seq, logscore);
+
+    const int nblock = logpost->nc;
+    const int nstate = logpost->nr;
+    const int nhistory = nstate - 1;
+    assert_transducer_dimensions(nhistory, allow_slip);
+    const int32_t nhistoryq = nhistory / 4;
     //  Forwards memory + traceback
     scrappie_matrix score = make_scrappie_matrix(nhistory + 2, 1);
     scrappie_matrix prev_score = make_scrappie_matrix(nhistory + 2, 1);
@@ -161,206 +405,482 @@ float decode_transducer(const_scrappie_matrix logpost, float stay_pen, float ski
 
     //  Forwards Viterbi iteration
     for (int blk = 0; blk < nblock; blk++) {
-        const size_t offsetTq = blk * traceback->nrq;
-        const size_t offsetT = offsetTq * 4;
-        const size_t offsetPq = blk * logpost->nrq;
-        const size_t offsetP = offsetPq * 4;
         // Swap score and previous score
         {
             scrappie_matrix tmptr = score;
             score = prev_score;
             prev_score = tmptr;
         }
+        decode_transducer_step(logpost, blk, stay_pen, skip_pen, local_pen, allow_slip,
+                               prev_score, score, tmp, itmp, traceback->data.v + blk * traceback->nrq);
+    }
 
-        // Stay
-        const __m128 stay_m128 =
-            _mm_set1_ps(logpost->data.f[offsetP + nhistory] - stay_pen);
-        const __m128i negone_m128i = _mm_set1_epi32(-1);
-        for (int i = 0; i < nhistoryq; i++) {
-            // Traceback for stay is negative
-            score->data.v[i] = prev_score->data.v[i] + stay_m128;
-            traceback->data.v[offsetTq + i] = negone_m128i;
-        }
+    //  Viterbi traceback
+    logscore = (NULL == walk)
+        ? viterbi_local_backtrace(score->data.f, nhistory, traceback, seq)
+        : viterbi_local_backtrace_walk(score->data.f, nhistory, traceback, seq, walk);
 
-        // Step
-        // Following three loops find maximum over suffix and record index
-        for (int i = 0; i < nhistoryqq; i++) {
-            tmp->data.v[i] = prev_score->data.v[i];
-            itmp->data.v[i] = _mm_setzero_si128();
-        }
-        for (int r = 1; r < NBASE; r++) {
-            const size_t offset = r * nhistoryqq;
-            const __m128i itmp_fill = _mm_set1_epi32(r);
-            for (int i = 0; i < nhistoryqq; i++) {
-                __m128i mask = _mm_castps_si128(_mm_cmplt_ps(tmp->data.v[i],
-                                                             prev_score->data.
-                                                             v[offset + i]));
-                tmp->data.v[i] =
-                    _mm_max_ps(tmp->data.v[i], prev_score->data.v[offset + i]);
-                itmp->data.v[i] =
-                    _mm_or_si128(_mm_andnot_si128(mask, itmp->data.v[i]),
-                                 _mm_and_si128(mask, itmp_fill));
-            }
+    assert(validate_ivector(seq, nblock, -1, nhistory - 1, __FILE__, __LINE__));
+
+cleanup:
+    traceback = free_scrappie_imatrix(traceback);
+    itmp = free_scrappie_imatrix(itmp);
+    tmp = free_scrappie_matrix(tmp);
+    prev_score = free_scrappie_matrix(prev_score);
+    score = free_scrappie_matrix(score);
+
+    return logscore;
+}
+
+float decode_transducer(const_scrappie_matrix logpost, float stay_pen, float skip_pen, float local_pen, int *seq,
+                        bool allow_slip) {
+    return decode_transducer_impl(logpost, stay_pen, skip_pen, local_pen, seq, allow_slip, NULL);
+}
+
+/**  Posterior for block of transducer decoding
+ *
+ *   A dense posterior is used directly.  A sparse posterior is expanded into
+ *   the single column col and the block index reset to zero.
+ **/
+static inline const_scrappie_matrix transducer_block_post(const_scrappie_matrix logpost,
+                                                          const_sparse_posterior sparse,
+                                                          scrappie_matrix col, size_t * blk) {
+    if (NULL == sparse) {
+        return logpost;
+    }
+    sparse_posterior_to_matrix(sparse, *blk, 1, col);
+    *blk = 0;
+    return col;
+}
+
+//  Checkpointed decoding from either a dense or a sparse posterior
+static float decode_transducer_checkpointed_impl(const_scrappie_matrix logpost,
+                                                 const_sparse_posterior sparse, float stay_pen,
+                                                 float skip_pen, float local_pen, int *seq,
+                                                 bool allow_slip) {
+    float logscore = NAN;
+    RETURN_NULL_IF(NULL == seq, logscore);
+
+    const size_t nblock = (NULL == sparse) ? logpost->nc : sparse->nblock;
+    const int nstate = (NULL == sparse) ? logpost->nr : (int)sparse->nstate;
+    const int nhistory = nstate - 1;
+    assert_transducer_dimensions(nhistory, allow_slip);
+    const int32_t nhistoryq = nhistory / 4;
+    const size_t seglen = (nblock > 0) ? ceilf(sqrtf((float)nblock)) : 1;
+    const size_t nseg = iceil(nblock, seglen);
+
+    scrappie_matrix score = make_scrappie_matrix(nhistory + 2, 1);
+    scrappie_matrix prev_score = make_scrappie_matrix(nhistory + 2, 1);
+    scrappie_matrix tmp = make_scrappie_matrix(nhistory, 1);
+    scrappie_imatrix itmp = make_scrappie_imatrix(nhistory, 1);
+    scrappie_matrix checkpoint = make_scrappie_matrix(nhistory + 2, nseg + 1);
+    scrappie_imatrix traceback = make_scrappie_imatrix(nhistory + 2, seglen);
+    scrappie_matrix col = (NULL == sparse) ? NULL : make_scrappie_matrix(nstate, 1);
+    if(NULL == score || NULL == prev_score || NULL == tmp || NULL == itmp
+       || NULL == checkpoint || NULL == traceback || (NULL != sparse && NULL == col)){
+        goto cleanup;
+    }
+
+    //  Initialise
+    for (int i = 0; i < nhistoryq; i++) {
+        score->data.v[i] = _mm_set1_ps(-BIG_FLOAT);
+    }
+    score->data.f[nhistory] = 0.0f;
+    score->data.f[nhistory + 1] = -BIG_FLOAT;
+
+    //  Forwards Viterbi iteration, storing score at start of each segment
+    for (size_t blk = 0; blk < nblock; blk++) {
+        if (0 == blk % seglen) {
+            memcpy(checkpoint->data.v + (blk / seglen) * checkpoint->nrq, score->data.v,
+                   score->nrq * sizeof(__m128));
         }
-        const __m128i c0123_m128i = _mm_setr_epi32(0, 1, 2, 3);
-        for (int i = 0; i < nhistoryqq; i++) {
-            itmp->data.v[i] =
-                _mm_add_epi32(_mm_mullo_epi32(itmp->data.v[i], nhistoryqv),
-                              _mm_add_epi32(c0123_m128i,
-                                            _mm_set1_epi32(i * 4)));
+        {
+            scrappie_matrix tmptr = score;
+            score = prev_score;
+            prev_score = tmptr;
         }
+        size_t pblk = blk;
+        const_scrappie_matrix post = transducer_block_post(logpost, sparse, col, &pblk);
+        decode_transducer_step(post, pblk, stay_pen, skip_pen, local_pen, allow_slip,
+                               prev_score, score, tmp, itmp, traceback->data.v + (blk % seglen) * traceback->nrq);
+    }
 
-        for (int pref = 0; pref < nhistoryq; pref++) {
-            const size_t i = pref;
-            const __m128 step_score =
-                logpost->data.v[offsetPq + i] + _mm_set1_ps(tmp->data.f[pref]);
-            __m128i mask =
-                _mm_castps_si128(_mm_cmplt_ps(score->data.v[i], step_score));
-            score->data.v[i] = _mm_max_ps(score->data.v[i], step_score);
-            traceback->data.v[offsetTq + i] =
-                _mm_or_si128(_mm_andnot_si128
-                             (mask, traceback->data.v[offsetTq + i]),
-                             _mm_and_si128(mask,
-                                           _mm_set1_epi32(itmp->data.f[pref])));
+    for(size_t i=0 ; i <= nblock ; i++){
+        // Initialise entries to stay
+        seq[i] = -1;
+    }
+    int last_state = argmaxf(score->data.f, nhistory + 2);
+    logscore = score->data.f[last_state];
+
+    //  Recalculate traceback for each segment, from last to first, and backtrace
+    for (size_t seg = nseg; seg > 0; seg--) {
+        const size_t blk_start = (seg - 1) * seglen;
+        const size_t blk_end = (blk_start + seglen < nblock) ? (blk_start + seglen) : nblock;
+        memcpy(score->data.v, checkpoint->data.v + (seg - 1) * checkpoint->nrq,
+               score->nrq * sizeof(__m128));
+        for (size_t blk = blk_start; blk < blk_end; blk++) {
+            {
+                scrappie_matrix tmptr = score;
+                score = prev_score;
+                prev_score = tmptr;
+            }
+            size_t pblk = blk;
+            const_scrappie_matrix post = transducer_block_post(logpost, sparse, col, &pblk);
+            decode_transducer_step(post, pblk, stay_pen, skip_pen, local_pen, allow_slip,
+                                   prev_score, score, tmp, itmp,
+                                   traceback->data.v + (blk - blk_start) * traceback->nrq);
         }
+        last_state = viterbi_local_backtrace_segment(traceback, blk_end - blk_start, blk_start,
+                                                     last_state, seq);
+    }
+    seq[0] = last_state;
+    viterbi_local_transcode_ends(nhistory, nblock, seq);
 
-        // Skip
-        const __m128 skip_penv = _mm_set1_ps(skip_pen);
-        for (int i = 0; i < nhistoryqqq; i++) {
-            tmp->data.v[i] = prev_score->data.v[i];
-            itmp->data.v[i] = _mm_setzero_si128();
-        }
-        for (int r = 1; r < NBASE * NBASE; r++) {
-            const size_t offset = r * nhistoryqqq;
-            const __m128i itmp_fill = _mm_set1_epi32(r);
-            for (int i = 0; i < nhistoryqqq; i++) {
-                __m128i mask = _mm_castps_si128(_mm_cmplt_ps(tmp->data.v[i],
-                                                             prev_score->data.
-                                                             v[offset + i]));
-                tmp->data.v[i] =
-                    _mm_max_ps(tmp->data.v[i], prev_score->data.v[offset + i]);
-                itmp->data.v[i] =
-                    _mm_or_si128(_mm_andnot_si128(mask, itmp->data.v[i]),
-                                 _mm_and_si128(mask, itmp_fill));
+    assert(validate_ivector(seq, nblock, -1, nhistory - 1, __FILE__, __LINE__));
+
+cleanup:
+    col = free_scrappie_matrix(col);
+    traceback = free_scrappie_imatrix(traceback);
+    checkpoint = free_scrappie_matrix(checkpoint);
+    itmp = free_scrappie_imatrix(itmp);
+    tmp = free_scrappie_matrix(tmp);
+    prev_score = free_scrappie_matrix(prev_score);
+    score = free_scrappie_matrix(score);
+
+    return logscore;
+}
+
+/**  Viterbi decoding of transducer with checkpointed traceback
+ *
+ *   Identical results to decode_transducer but, rather than storing the
+ *   traceback for every block, scores are stored at checkpoints every
+ *   sqrt(nblock) blocks and the traceback recalculated segment by segment
+ *   from the end of the read.  Memory is O(sqrt(nblock) * nstate) at the
+ *   cost of a second forwards pass.
+ *
+ *   Parameters as for decode_transducer
+ **/
+float decode_transducer_checkpointed(const_scrappie_matrix logpost, float stay_pen, float skip_pen,
+                                     float local_pen, int *seq, bool allow_slip) {
+    RETURN_NULL_IF(NULL == logpost, NAN);
+    return decode_transducer_checkpointed_impl(logpost, NULL, stay_pen, skip_pen, local_pen,
+                                               seq, allow_slip);
+}
+
+/**  Viterbi decoding of transducer from a sparse posterior
+ *
+ *   Identical to decode_transducer_checkpointed applied to the dense
+ *   expansion of the sparse posterior, but only one block of the posterior
+ *   is expanded at a time.
+ *
+ *   @param post Sparse posterior, as produced by a *_sparse_posterior network function
+ *
+ *   Other parameters as for decode_transducer
+ **/
+float decode_transducer_sparse(const_sparse_posterior post, float stay_pen, float skip_pen,
+                               float local_pen, int *seq, bool allow_slip) {
+    RETURN_NULL_IF(NULL == post, NAN);
+    return decode_transducer_checkpointed_impl(NULL, post, stay_pen, skip_pen, local_pen,
+                                               seq, allow_slip);
+}
+
+/**  Candidate for entering state st during pruned Viterbi
+ *
+ *   Scores start each block at -BIG_FLOAT and are only replaced by strictly
+ *   better candidates, so ties are broken as in decode_transducer_step.
+ **/
+static inline void pruned_relax(int st, float cand, int prev, float * score, int * tb) {
+    if (cand > score[st]) {
+        score[st] = cand;
+        tb[st] = prev;
+    }
+}
+
+/**  Candidates for entering four consecutive states from the same state
+ *
+ *   @param st  First state, a multiple of four
+ **/
+static inline void pruned_relax4(int st, __m128 cand, int prev, float * score, int * tb) {
+    const __m128 curr = _mm_loadu_ps(score + st);
+    const __m128 better = _mm_cmpgt_ps(cand, curr);
+    const __m128i better_i = _mm_castps_si128(better);
+    const __m128i curr_tb = _mm_loadu_si128((const __m128i *)(tb + st));
+    _mm_storeu_ps(score + st, _mm_or_ps(_mm_and_ps(better, cand), _mm_andnot_ps(better, curr)));
+    _mm_storeu_si128((__m128i *)(tb + st),
+                     _mm_or_si128(_mm_and_si128(better_i, _mm_set1_epi32(prev)),
+                                  _mm_andnot_si128(better_i, curr_tb)));
+}
+
+/**  Candidates for entering the nto consecutive states from the same state
+ *
+ *   @param to  First state entered, a multiple of four
+ *   @param nto  Number of states entered, a multiple of four
+ **/
+static inline void pruned_relax_block(int to, int nto, const float * post, float prev_score,
+                                      float pen, int prev, float * score, int * tb) {
+    const __m128 prev_v = _mm_set1_ps(prev_score);
+    const __m128 pen_v = _mm_set1_ps(pen);
+    for (int i = 0; i < nto; i += 4) {
+        const __m128 cand = _mm_sub_ps(_mm_add_ps(_mm_loadu_ps(post + to + i), prev_v), pen_v);
+        pruned_relax4(to + i, cand, prev, score, tb);
+    }
+}
+
+static int intcmp(const void * x, const void * y) {
+    return *(const int *)x - *(const int *)y;
+}
+
+/**  Value of k-th largest element of array, zero based
+ *
+ *   Quickselect, partially reordering x in place
+ **/
+static float kth_largestf(float * x, size_t n, size_t k) {
+    assert(k < n);
+    size_t lo = 0, hi = n - 1;
+    while (lo < hi) {
+        const float pivot = x[lo + (hi - lo) / 2];
+        size_t i = lo, j = hi;
+        while (i <= j) {
+            while (x[i] > pivot) {
+                i++;
             }
-        }
-        for (int i = 0; i < nhistoryqqq; i++) {
-            itmp->data.v[i] =
-                _mm_add_epi32(_mm_mullo_epi32(itmp->data.v[i], nhistoryqqv),
-                              _mm_add_epi32(c0123_m128i,
-                                            _mm_set1_epi32(i * 4)));
-        }
-        for (int pref = 0; pref < nhistoryqq; pref++) {
-            for (int i = 0; i < NBASE; i++) {
-                const size_t oi = pref * NBASE + i;
-                // This cycling through prefixes
-                const __m128 skip_score = logpost->data.v[offsetPq + oi]
-                    + _mm_set1_ps(tmp->data.f[pref])
-                    - skip_penv;
-                __m128i mask =
-                    _mm_castps_si128(_mm_cmplt_ps
-                                     (score->data.v[oi], skip_score));
-                score->data.v[oi] = _mm_max_ps(score->data.v[oi], skip_score);
-                traceback->data.v[offsetTq + oi] =
-                    _mm_or_si128(_mm_andnot_si128
-                                 (mask, traceback->data.v[offsetTq + oi]),
-                                 _mm_and_si128(mask,
-                                               _mm_set1_epi32(itmp->
-                                                              data.f[pref])));
+            while (x[j] < pivot) {
+                j--;
+            }
+            if (i <= j) {
+                const float tmp = x[i];
+                x[i] = x[j];
+                x[j] = tmp;
+                i++;
+                if (0 == j) {
+                    break;
+                }
+                j--;
             }
         }
+        if (k <= j) {
+            hi = j;
+        } else if (k >= i) {
+            lo = i;
+        } else {
+            break;
+        }
+    }
+    return x[k];
+}
+
+/**  Viterbi decoding of transducer, keeping only the best states of each block
+ *
+ *   After each block, only states scoring within beam of the best state, and
+ *   at most max_states of them, are kept and extended into the next block.
+ *   The traceback is stored only for the states kept, as (state, previous
+ *   state) pairs sorted by state, so its size is proportional to the number
+ *   of states kept rather than nblock * nstate.  Most of the posterior of a
+ *   good read sits in a handful of states, so a modest beam gives the same
+ *   path as decode_transducer.  With an infinite beam and max_states zero
+ *   the result is that of decode_transducer.
+ *
+ *   @param beam  Score below best state of block at which states are pruned
+ *   @param max_states  Maximum number of states to keep each block (0 is
+ *   unlimited).  States tied with the last kept are also kept.
+ *
+ *   Other parameters as for decode_transducer
+ **/
+float decode_transducer_pruned(const_scrappie_matrix logpost, float stay_pen, float skip_pen,
+                               float local_pen, float beam, size_t max_states, int *seq,
+                               bool allow_slip) {
+    float logscore = NAN;
+    RETURN_NULL_IF(NULL == logpost, logscore);
+    RETURN_NULL_IF(NULL == seq, logscore);
+    assert(beam > 0.0f);
+
+    const size_t nblock = logpost->nc;
+    const int nstate = logpost->nr;
+    const int nhistory = nstate - 1;
+    assert_transducer_dimensions(nhistory, allow_slip);
+    const int start_state = nhistory;
+    const int end_state = nhistory + 1;
+    const int nstep = nhistory / NBASE;
+    const int nskip = nstep / NBASE;
+    const int nslip = nskip / NBASE;
+    const float slip_pen = 2.0 * skip_pen;
+
+    float * score = calloc(nhistory + 2, sizeof(float));
+    float * prev_score = calloc(nhistory + 2, sizeof(float));
+    float * kept_score = calloc(nhistory + 2, sizeof(float));
+    int * tb = calloc(nhistory + 2, sizeof(int));
+    int * active = calloc(nhistory + 2, sizeof(int));
+    //  Sparse traceback, entries of block blk are [tb_offset[blk], tb_offset[blk + 1])
+    size_t * tb_offset = calloc(nblock + 1, sizeof(size_t));
+    size_t tb_capacity = 16 * (nblock + 1);
+    int * tb_state = malloc(tb_capacity * sizeof(int));
+    int * tb_prev = malloc(tb_capacity * sizeof(int));
+    if (NULL == score || NULL == prev_score || NULL == kept_score || NULL == tb || NULL == active
+        || NULL == tb_offset || NULL == tb_state || NULL == tb_prev) {
+        warnx("Failed to allocate memory for pruned Viterbi decoding");
+        goto cleanup;
+    }
+
+    //  Initialise, only the start state is active
+    size_t nactive = 1;
+    active[0] = start_state;
+    score[start_state] = 0.0f;
 
-        // Slip
+    for (size_t blk = 0; blk < nblock; blk++) {
+        {
+            float * tmptr = score;
+            score = prev_score;
+            prev_score = tmptr;
+        }
+        const __m128 neg_big = _mm_set1_ps(-BIG_FLOAT);
+        for (int st = 0; st < nhistory; st += 4) {
+            _mm_storeu_ps(score + st, neg_big);
+        }
+        score[start_state] = -BIG_FLOAT;
+        score[end_state] = -BIG_FLOAT;
+        const float * post = logpost->data.f + blk * logpost->stride;
+        const float stay_score = post[nhistory] - stay_pen;
+        //  Active list is sorted so start and end states, if active, are last
+        const bool end_active = (nactive > 0 && end_state == active[nactive - 1]);
+        const bool start_active = (nactive > end_active && start_state == active[nactive - 1 - end_active]);
+        const size_t nactive_history = nactive - start_active - end_active;
+
+        //  Moves in the same order as decode_transducer_step so ties are
+        //  broken the same way
+        for (size_t i = 0; i < nactive_history; i++) {
+            const int st = active[i];
+            pruned_relax(st, prev_score[st] + stay_score, -1, score, tb);
+        }
+        for (size_t i = 0; i < nactive_history; i++) {
+            const int st = active[i];
+            pruned_relax_block((st % nstep) * NBASE, NBASE, post, prev_score[st], 0.0f, st,
+                               score, tb);
+        }
+        for (size_t i = 0; i < nactive_history; i++) {
+            const int st = active[i];
+            pruned_relax_block((st % nskip) * NBASE * NBASE, NBASE * NBASE, post, prev_score[st],
+                               skip_pen, st, score, tb);
+        }
         if (allow_slip) {
-            const int32_t nhistoryqqqq = nhistoryqqq / 4;
-            const __m128 slip_penv = _mm_set1_ps(2.0 * skip_pen);
-            for (int i = 0; i < nhistoryqqqq; i++) {
-                tmp->data.v[i] = prev_score->data.v[i];
-                itmp->data.v[i] = _mm_setzero_si128();
+            for (size_t i = 0; i < nactive_history; i++) {
+                const int st = active[i];
+                pruned_relax_block((st % nslip) * NBASE * NBASE * NBASE, NBASE * NBASE * NBASE,
+                                   post, prev_score[st], slip_pen, st, score, tb);
             }
-            for (int r = 1; r < NBASE * NBASE * NBASE; r++) {
-                const size_t offset = r * nhistoryqqqq;
-                const __m128i itmp_fill = _mm_set1_epi32(r);
-                for (int i = 0; i < nhistoryqqqq; i++) {
-                    __m128i mask = _mm_castps_si128(_mm_cmplt_ps(tmp->data.v[i],
-                                                                 prev_score->
-                                                                 data.v[offset +
-                                                                        i]));
-                    tmp->data.v[i] =
-                        _mm_max_ps(tmp->data.v[i],
-                                   prev_score->data.v[offset + i]);
-                    itmp->data.v[i] =
-                        _mm_or_si128(_mm_andnot_si128(mask, itmp->data.v[i]),
-                                     _mm_and_si128(mask, itmp_fill));
+        }
+        if (start_active) {
+            pruned_relax(start_state, prev_score[start_state] + fmaxf(-local_pen, stay_score),
+                         start_state, score, tb);
+            pruned_relax_block(0, nhistory, post, prev_score[start_state], 0.0f, start_state,
+                               score, tb);
+        }
+        if (end_active) {
+            pruned_relax(end_state, prev_score[end_state] + fmax(-local_pen, stay_score),
+                         end_state, score, tb);
+        }
+        for (size_t i = 0; i < nactive_history; i++) {
+            const int st = active[i];
+            pruned_relax(end_state, prev_score[st] - local_pen, st, score, tb);
+        }
+
+        //  Prune.  States not entered this block still score -BIG_FLOAT.
+        //  Scanning all states, four at a time, keeps the active list
+        //  sorted for less than it costs to sort it.
+        __m128 best_v = neg_big;
+        for (int st = 0; st < nhistory; st += 4) {
+            best_v = _mm_max_ps(best_v, _mm_loadu_ps(score + st));
+        }
+        float best_lane[4];
+        _mm_storeu_ps(best_lane, best_v);
+        const float best = fmaxf(fmaxf(fmaxf(best_lane[0], best_lane[1]), fmaxf(best_lane[2], best_lane[3])),
+                                 fmaxf(score[start_state], score[end_state]));
+        float threshold = best - beam;
+        nactive = 0;
+        for (int pass = 0; pass < 1 + (max_states > 0); pass++) {
+            nactive = 0;
+            const __m128 threshold_v = _mm_set1_ps(threshold);
+            for (int st = 0; st < nhistory; st += 4) {
+                int mask = _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(score + st), threshold_v));
+                for (; mask; mask &= mask - 1) {
+                    active[nactive++] = st + __builtin_ctz(mask);
                 }
             }
-            for (int i = 0; i < nhistoryqqqq; i++) {
-                itmp->data.v[i] =
-                    _mm_add_epi32(_mm_mullo_epi32
-                                  (itmp->data.v[i], nhistoryqqqv),
-                                  _mm_add_epi32(c0123_m128i,
-                                                _mm_set1_epi32(i * 4)));
-            }
-            for (int pref = 0; pref < nhistoryqqq; pref++) {
-                for (int i = 0; i < NBASE * NBASE; i++) {
-                    const size_t oi = pref * NBASE * NBASE + i;
-                    // This cycling through prefixes
-                    const __m128 skip_score = logpost->data.v[offsetPq + oi]
-                        + _mm_set1_ps(tmp->data.f[pref])
-                        - slip_penv;
-                    __m128i mask =
-                        _mm_castps_si128(_mm_cmplt_ps
-                                         (score->data.v[oi], skip_score));
-                    score->data.v[oi] =
-                        _mm_max_ps(score->data.v[oi], skip_score);
-                    traceback->data.v[offsetTq + oi] =
-                        _mm_or_si128(_mm_andnot_si128
-                                     (mask, traceback->data.v[offsetTq + oi]),
-                                     _mm_and_si128(mask,
-                                                   _mm_set1_epi32(itmp->data.f
-                                                                  [pref])));
+            for (int st = start_state; st <= end_state; st++) {
+                if (score[st] >= threshold) {
+                    active[nactive++] = st;
                 }
             }
-        }
-
-        // Remain in start state (stay or local penalty)
-        score->data.f[nhistory] = prev_score->data.f[nhistory]
-                                + fmaxf(-local_pen, logpost->data.f[offsetP + nhistory] - stay_pen);
-        traceback->data.f[offsetT + nhistory] = nhistory;
-        // Exit start state
-        for(int hst=0 ; hst < nhistory ; hst++){
-            const float scoref = prev_score->data.f[nhistory] + logpost->data.f[offsetP + hst];
-            if(scoref > score->data.f[hst]){
-                score->data.f[hst] = scoref;
-                traceback->data.f[offsetT + hst] = nhistory;
+            if (max_states == 0 || nactive <= max_states) {
+                break;
+            }
+            //  Too many states within beam, keep only the best
+            for (size_t i = 0; i < nactive; i++) {
+                kept_score[i] = score[active[i]];
             }
+            threshold = kth_largestf(kept_score, nactive, max_states - 1);
         }
 
-        // Remain in end state (stay or local penalty)
-        score->data.f[nhistory + 1] = prev_score->data.f[nhistory + 1]
-                                    + fmax(-local_pen, logpost->data.f[offsetP + nhistory] - stay_pen);
-        traceback->data.f[offsetT + nhistory + 1] = nhistory + 1;
-        // Enter end state
-        for(int hst=0 ; hst < nhistory ; hst++){
-            const float scoref = prev_score->data.f[hst] - local_pen;
-            if(scoref > score->data.f[nhistory + 1]){
-                score->data.f[nhistory + 1] = scoref;
-                traceback->data.f[offsetT + nhistory + 1] = hst;
+        //  Store sparse traceback
+        if (tb_offset[blk] + nactive > tb_capacity) {
+            while (tb_offset[blk] + nactive > tb_capacity) {
+                tb_capacity *= 2;
             }
+            int * new_state = realloc(tb_state, tb_capacity * sizeof(int));
+            if (NULL != new_state) {
+                tb_state = new_state;
+            }
+            int * new_prev = realloc(tb_prev, tb_capacity * sizeof(int));
+            if (NULL != new_prev) {
+                tb_prev = new_prev;
+            }
+            if (NULL == new_state || NULL == new_prev) {
+                warnx("Failed to allocate memory for pruned Viterbi traceback");
+                goto cleanup;
+            }
+        }
+        for (size_t i = 0; i < nactive; i++) {
+            tb_state[tb_offset[blk] + i] = active[i];
+            tb_prev[tb_offset[blk] + i] = tb[active[i]];
         }
+        tb_offset[blk + 1] = tb_offset[blk] + nactive;
     }
 
     //  Viterbi traceback
-    logscore = viterbi_local_backtrace(score->data.f, nhistory, traceback, seq);
+    for (size_t i = 0; i <= nblock; i++) {
+        // Initialise entries to stay
+        seq[i] = -1;
+    }
+    int last_state = active[0];
+    for (size_t i = 1; i < nactive; i++) {
+        if (score[active[i]] > score[last_state]) {
+            last_state = active[i];
+        }
+    }
+    logscore = score[last_state];
+    for (size_t ri = nblock; ri > 0; ri--) {
+        const int * entry = bsearch(&last_state, tb_state + tb_offset[ri - 1],
+                                    tb_offset[ri] - tb_offset[ri - 1], sizeof(int), intcmp);
+        assert(NULL != entry);
+        const int state = tb_prev[entry - tb_state];
+        if (state >= 0) {
+            seq[ri] = last_state;
+            last_state = state;
+        }
+    }
+    seq[0] = last_state;
+    viterbi_local_transcode_ends(nhistory, nblock, seq);
 
     assert(validate_ivector(seq, nblock, -1, nhistory - 1, __FILE__, __LINE__));
 
 cleanup:
-    traceback = free_scrappie_imatrix(traceback);
-    itmp = free_scrappie_imatrix(itmp);
-    tmp = free_scrappie_matrix(tmp);
-    prev_score = free_scrappie_matrix(prev_score);
-    score = free_scrappie_matrix(score);
+    free(tb_prev);
+    free(tb_state);
+    free(tb_offset);
+    free(active);
+    free(tb);
+    free(kept_score);
+    free(prev_score);
+    free(score);
 
     return logscore;
 }
@@ -509,6 +1029,271 @@ char *overlapper(const int *seq, size_t n, int nkmer, int *pos) {
     return bases;
 }
 
+/**  Walk over a transducer path from its end, as it is traced back
+ *
+ *   Does the work of homopolymer_path followed by overlapper as each state
+ *   of the path is found, so the path is neither searched for homopolymer
+ *   runs nor collapsed to a basecall afterwards.
+ *
+ *   A homopolymer run of findRuns is a stretch of stays and the kmer of a
+ *   repeated base, and whether it is a run depends on the state before it.
+ *   The stretch following the last state seen is held back until that state
+ *   is known; blocks [k + 1, end) are stays and, if base >= 0, the stretch is
+ *   [start, end) from its first repeated kmer.  Once resolved, the stretch
+ *   is corrected in place and its kmers emitted.
+ *
+ *   Each kmer adds its overlap with the next kmer to the basecall, which is
+ *   filled backwards from the end of its buffer.  Positions are stored less
+ *   the total number of bases, only known once the walk is finished.
+ **/
+struct transducer_walk {
+    const_scrappie_matrix post;
+    int * seq;
+    int * pos;
+    int nblock;
+    int nkmer;
+    int kmer_len;
+    //  Homopolymer kmers of each base and their suffices of length kmer_len - 1, kmer_len - 2
+    int rep[4];
+    int rep1[4];
+    int rep2[4];
+    //  Stretch held back
+    int base;
+    int start;
+    int end;
+    //  Next kmer of path emitted
+    int knext;
+    int nbase;
+    char * buf;
+    char * bases;
+};
+
+static bool transducer_walk_init(struct transducer_walk * walk, const_scrappie_matrix post,
+                                 enum homopolymer_calculation homopolymer, size_t nblock,
+                                 int nkmer, int * seq, int * pos) {
+    const int kmer_len = position_highest_bit(nkmer) / 2;
+    //  Each kmer adds at most kmer_len bases
+    char * buf = malloc(kmer_len * (nblock + 1) + 1);
+    RETURN_NULL_IF(NULL == buf, false);
+    *walk = (struct transducer_walk){
+        .post = (HOMOPOLYMER_MEAN == homopolymer) ? post : NULL,
+        .seq = seq,
+        .pos = pos,
+        .nblock = nblock,
+        .nkmer = nkmer,
+        .kmer_len = kmer_len,
+        .base = -1,
+        .end = nblock,
+        .knext = -1,
+        .buf = buf,
+        .bases = buf + kmer_len * (nblock + 1)};
+    for(int b=0 ; b < 4 ; b++){
+        walk->rep[b] = repeatblock(b, kmer_len);
+        walk->rep1[b] = repeatblock(b, kmer_len - 1);
+        walk->rep2[b] = repeatblock(b, kmer_len - 2);
+    }
+    return true;
+}
+
+/**  Emit kmer of block k, the overlap of the next kmer with it being added to the basecall
+ **/
+static inline void transducer_walk_emit(struct transducer_walk * walk, int k){
+    const int knext = walk->knext;
+    int last = walk->nblock;
+    if(knext >= 0){
+        const int ol = overlap(walk->seq[k], walk->seq[knext], walk->nkmer);
+        for(int kmer=walk->seq[knext], i=0 ; i < ol ; i++, kmer >>= 2){
+            *--walk->bases = base_lookup[kmer & 3];
+        }
+        walk->nbase += ol;
+        last = knext - 1;
+    }
+    if(NULL != walk->pos){
+        for(int i=k ; i <= last ; i++){
+            walk->pos[i] = -walk->nbase;
+        }
+    }
+    walk->knext = k;
+}
+
+/**  Resolve stretch held back, the state of block k preceding it
+ *
+ *   Runs are found as findRuns, the kmer length being at least three so
+ *   at most one run follows any state.
+ **/
+static void transducer_walk_resolve(struct transducer_walk * walk, int k){
+    int * seq = walk->seq;
+    const int nstay_end = (walk->base >= 0) ? walk->start : walk->end;
+    if(k >= 0 && NULL != walk->post && k + 1 <= walk->nblock - 3){
+        const int p = seq[k];
+        const int b = p & 3;
+        const int fkm1 = 1 << (2 * (walk->kmer_len - 1));
+        const int fkm2 = 1 << (2 * (walk->kmer_len - 2));
+        const int c = walk->base;
+        if(p != walk->rep[b] && p % fkm1 == walk->rep1[b] && (nstay_end > k + 1 || c == b)){
+            const int end = (c == b) ? walk->end : nstay_end;
+            homopolymer_correct_run(walk->post, seq, k + 1, end - k - 1, b);
+        } else if(c >= 0 && p % fkm2 == walk->rep2[c] && p % fkm1 != walk->rep1[c]
+                  && walk->start < walk->nblock - 1){
+            homopolymer_correct_run(walk->post, seq, walk->start, walk->end - walk->start, c);
+        }
+    }
+
+    for(int i=walk->end - 1 ; i > k ; i--){
+        if(seq[i] >= 0){
+            transducer_walk_emit(walk, i);
+        }
+    }
+
+    if(k >= 0 && iskmerhomopolymer(seq[k], walk->kmer_len)){
+        walk->base = seq[k] & 3;
+        walk->start = k;
+        walk->end = nstay_end;
+    } else {
+        if(k >= 0){
+            transducer_walk_emit(walk, k);
+        }
+        walk->base = -1;
+        walk->end = k;
+    }
+}
+
+/**  Add state of block k to walk, blocks being added from the last to the first
+ **/
+static inline void transducer_walk_push(struct transducer_walk * walk, int k){
+    const int state = walk->seq[k];
+    if(k == walk->nblock){
+        //  Last block is never part of a homopolymer run
+        if(state >= 0){
+            transducer_walk_emit(walk, k);
+        }
+        return;
+    }
+    if(state < 0){
+        return;
+    }
+    if(walk->base >= 0 && state == walk->rep[walk->base]){
+        walk->start = k;
+        return;
+    }
+    transducer_walk_resolve(walk, k);
+}
+
+/**  Finish walk
+ *
+ *   @returns Basecall, or NULL if the path has no kmers.  The buffer of the walk is freed.
+ **/
+static char * transducer_walk_finish(struct transducer_walk * walk){
+    transducer_walk_resolve(walk, -1);
+    const int st = walk->knext;
+    if(st < 0){
+        free(walk->buf);
+        return NULL;
+    }
+    for(int kmer=walk->seq[st], i=0 ; i < walk->kmer_len ; i++, kmer >>= 2){
+        *--walk->bases = base_lookup[kmer & 3];
+    }
+    if(NULL != walk->pos){
+        for(int i=0 ; i < st ; i++){
+            walk->pos[i] = 0;
+        }
+        for(int i=st ; i <= walk->nblock ; i++){
+            walk->pos[i] += walk->nbase;
+        }
+    }
+    const size_t length = walk->nbase + walk->kmer_len;
+    memmove(walk->buf, walk->bases, length);
+    walk->buf[length] = '\0';
+    char * basecall = realloc(walk->buf, length + 1);
+    return (NULL != basecall) ? basecall : walk->buf;
+}
+
+/**  Traceback of local Viterbi, as viterbi_local_backtrace, feeding a walk
+ **/
+static float viterbi_local_backtrace_walk(float const *score, size_t n, const_scrappie_imatrix traceback,
+                                          int * seq, struct transducer_walk * walk){
+    const size_t nblock = traceback->nc;
+    int last_state = argmaxf(score, n + 2);
+    const float logscore = score[last_state];
+    for(size_t i=0 ; i < nblock ; i++){
+        const size_t ri = nblock - i - 1;
+        const int state = traceback->data.f[ri * traceback->stride + last_state];
+        int this_state = -1;
+        if(state >= 0){
+            this_state = last_state;
+            last_state = state;
+        }
+        //  Local start and end states are stays
+        seq[ri + 1] = (this_state < (int)n) ? this_state : -1;
+        transducer_walk_push(walk, ri + 1);
+    }
+    seq[0] = (last_state < (int)n) ? last_state : -1;
+    transducer_walk_push(walk, 0);
+
+    return logscore;
+}
+
+
+/**  Basecall from transducer path, correcting homopolymers
+ *
+ *   Same result as homopolymer_path followed by overlapper, from a single
+ *   walk over the path.
+ *
+ *   @param logpost  Log posterior matrix the path was decoded from
+ *   @param seq  Path [logpost->nc + 1], homopolymer runs corrected in place
+ *   @param homopolymer  Homopolymer calculation
+ *   @param pos  Position in basecall of each block [out, logpost->nc + 1], or NULL
+ *
+ *   @returns Basecall or NULL on failure
+ **/
+char *homopolymer_overlapper(const_scrappie_matrix logpost, int *seq,
+                             enum homopolymer_calculation homopolymer, int *pos) {
+    RETURN_NULL_IF(NULL == logpost, NULL);
+    RETURN_NULL_IF(NULL == seq, NULL);
+    const int nblock = logpost->nc;
+    struct transducer_walk walk;
+    RETURN_NULL_IF(!transducer_walk_init(&walk, logpost, homopolymer, nblock, logpost->nr - 1, seq, pos), NULL);
+    for(int k=nblock ; k >= 0 ; k--){
+        transducer_walk_push(&walk, k);
+    }
+    return transducer_walk_finish(&walk);
+}
+
+
+/**  Viterbi decoding of transducer to a basecall
+ *
+ *   Homopolymer runs are corrected and the basecall assembled during the
+ *   traceback, the same result as decode_transducer followed by
+ *   homopolymer_path and overlapper.
+ *
+ *   @param homopolymer  Homopolymer calculation
+ *   @param seq  Path, corrected for homopolymers [out, logpost->nc + 1]
+ *   @param pos  Position in basecall of each block [out, logpost->nc + 1], or NULL
+ *   @param score  Score of path [out], or NULL
+ *
+ *   Other parameters as for decode_transducer
+ *
+ *   @returns Basecall or NULL on failure
+ **/
+char *decode_transducer_basecall(const_scrappie_matrix logpost, float stay_pen, float skip_pen,
+                                 float local_pen, bool allow_slip,
+                                 enum homopolymer_calculation homopolymer, int *seq, int *pos,
+                                 float *score) {
+    RETURN_NULL_IF(NULL == logpost, NULL);
+    RETURN_NULL_IF(NULL == seq, NULL);
+    struct transducer_walk walk;
+    RETURN_NULL_IF(!transducer_walk_init(&walk, logpost, homopolymer, logpost->nc, logpost->nr - 1, seq, pos), NULL);
+    const float logscore = decode_transducer_impl(logpost, stay_pen, skip_pen, local_pen, seq, allow_slip, &walk);
+    if(NULL != score){
+        *score = logscore;
+    }
+    if(isnan(logscore)){
+        free(walk.buf);
+        return NULL;
+    }
+    return transducer_walk_finish(&walk);
+}
+
 int calibrated_dwell(int hdwell, int inhomo, const dwell_model dm) {
     const int b = inhomo & 3;
     return (int)roundf(((float)hdwell - dm.base_adj[b]) / dm.scale);
@@ -834,225 +1619,396 @@ float sloika_viterbi(const_scrappie_matrix logpost, float stay_pen, float skip_p
     return logscore;
 }
 
-/*
-// decode with constraint that no consecutive base is same
-// NOTE: the implementation below is greedy and wrong, I am now reading up on how to do this 
-// correctly. It's wrong because we don't consider all states, e.g., for paths ending with a blank,
-// we should store the best path for all the 4 possible bases that came before.
+/**  Store terms of forward recursion for up to four destination states
+ *
+ *   @param tv Transitions into four destination states from one source state
+ *   @param fprev Forward score of source state
+ *   @param nvalid Number of destination states that exist
+ *   @param nstate Number of states
+ *   @param ftmp Term of first destination state [out], those of the others
+ *   following at a stride of nstate
+ **/
+static inline void crf_store_forward_terms(__m128 tv, float fprev, size_t nvalid, size_t nstate,
+                                           float * ftmp){
+    float term[4];
+    _mm_storeu_ps(term, _mm_add_ps(tv, _mm_set1_ps(fprev)));
+    for(size_t i=0 ; i < nvalid ; i++){
+        ftmp[i * nstate] = term[i];
+    }
+}
+
+
+/**  One block of Viterbi recursion for decode_crf
+ *
+ *   Destination states are processed four at a time, with the maximum and
+ *   argmax over source states found with vector compare and select.  Source
+ *   states are visited in increasing order and only a strictly better score
+ *   replaces the best so far, so ties are broken exactly as a scalar
+ *   recursion would.
+ *
+ *   @param trans CRF transition matrix
+ *   @param blk Block to process
+ *   @param nstate Number of states
+ *   @param prev Scores at end of previous block [nstate]
+ *   @param curr Scores at end of this block [out, nstate rounded up to a multiple of four]
+ *   @param tb Traceback for this block [out, nstate]
+ *   @param fprev Forward scores at end of previous block [nstate], or NULL
+ *   @param ftmp Terms of forward recursion for this block, trans + fprev, as
+ *   used by crf_logsumexp_block [out, nstate * nstate].  Only written if fprev
+ *   is not NULL, while the transitions are loaded for the Viterbi recursion.
+ **/
+static inline void decode_crf_step(const_scrappie_matrix trans, size_t blk, size_t nstate,
+                                   float const * prev, float * curr, uint8_t * tb,
+                                   float const * fprev, float * ftmp){
+    float const * tblk = trans->data.f + blk * trans->stride;
+    for(size_t st1=0 ; st1 < nstate ; st1 += 4){
+        // st1 .. st1 + 3 are to-states (in -ACGT), states past the end are repeats of the last
+        float const * t0 = tblk + st1 * nstate;
+        float const * t1 = tblk + ((st1 + 1 < nstate) ? (st1 + 1) : (nstate - 1)) * nstate;
+        float const * t2 = tblk + ((st1 + 2 < nstate) ? (st1 + 2) : (nstate - 1)) * nstate;
+        float const * t3 = tblk + ((st1 + 3 < nstate) ? (st1 + 3) : (nstate - 1)) * nstate;
+
+        const size_t nvalid = (st1 + 4 < nstate) ? 4 : (nstate - st1);
+
+        const __m128 tv0 = _mm_setr_ps(t0[0], t1[0], t2[0], t3[0]);
+        __m128 best = _mm_add_ps(tv0, _mm_set1_ps(prev[0]));
+        __m128i arg = _mm_setzero_si128();
+        if(NULL != fprev){
+            crf_store_forward_terms(tv0, fprev[0], nvalid, nstate, ftmp + st1 * nstate);
+        }
+        for(size_t st2=1 ; st2 < nstate ; st2++){
+            // st2 is from-state (in -ACGT)
+            const __m128 tv = _mm_setr_ps(t0[st2], t1[st2], t2[st2], t3[st2]);
+            const __m128 score = _mm_add_ps(tv, _mm_set1_ps(prev[st2]));
+            if(NULL != fprev){
+                crf_store_forward_terms(tv, fprev[st2], nvalid, nstate, ftmp + st1 * nstate + st2);
+            }
+            const __m128 better = _mm_cmpgt_ps(score, best);
+            best = _mm_or_ps(_mm_and_ps(better, score), _mm_andnot_ps(better, best));
+            arg = _mm_or_si128(_mm_and_si128(_mm_castps_si128(better), _mm_set1_epi32(st2)),
+                               _mm_andnot_si128(_mm_castps_si128(better), arg));
+        }
+        _mm_storeu_ps(curr + st1, best);
+
+        int32_t argv[4];
+        _mm_storeu_si128((__m128i *)argv, arg);
+        for(size_t i=0 ; i < nvalid ; i++){
+            tb[st1 + i] = argv[i];
+        }
+    }
+}
 
+// original decode
 float decode_crf(const_scrappie_matrix trans, int * path){
     RETURN_NULL_IF(NULL == trans, NAN);
     RETURN_NULL_IF(NULL == path, NAN);
     const size_t nblk = trans->nc;
     const size_t nstate = roundf(sqrtf((float)trans->nr));
     assert(nstate * nstate == trans->nr);
-    float * mem = calloc(2 * nstate, sizeof(float));
-    scrappie_imatrix tb = make_scrappie_imatrix(nstate, nblk);
+    //  Traceback is stored as bytes
+    assert(nstate <= 256);
+    const size_t nstatep = 4 * iceil(nstate, 4);
+    float * mem = calloc(2 * nstatep, sizeof(float));
+    uint8_t * tb = calloc(nstate * nblk, sizeof(uint8_t));
     if(NULL == mem || NULL == tb){
-        tb = free_scrappie_imatrix(tb);
+        free(tb);
         free(mem);
         return NAN;
     }
-    
-    size_t prev_non_blank_base = nstate; // initialize with impossible value
-    // this is the last non-blank base on the path ending with blank
-
     float * curr = mem;
-    float * prev = mem + nstate;
+    float * prev = mem + nstatep;
 
 
     //  Forwards Viterbi pass
     for(size_t blk=0 ; blk < nblk ; blk++){
-        const size_t offset = blk * trans->stride;
-        const size_t tboffset = blk * tb->stride;
         {   // Swap
             float * tmp = curr;
             curr = prev;
             prev = tmp;
         }
-
-        for(size_t st1=0 ; st1 < nstate ; st1++){
-	    // st1 is to-state (in -ACGT)
-            const size_t offsetS = offset + st1 * nstate;
-	    if (st1 == 0)
-		curr[st1] = -INFINITY; // not allowed
-	    else
-                curr[st1] = trans->data.f[offsetS + 0] + prev[0];
-            tb->data.f[tboffset + st1] = 0;
-            for(size_t st2=1 ; st2 < nstate ; st2++){
-		// st2 is from-state (in -ACGT)
-		size_t prev_base = st2;
-		if (st2 == nstate - 1) // blank
-			prev_base = prev_non_blank_base;
-                float score = trans->data.f[offsetS + st2] + prev[st2];
-		if (st1 == prev_base)
-			score = -INFINITY;
-                if(score > curr[st1]){
-                    curr[st1] = score;
-                    tb->data.f[tboffset + st1] = st2;
-
-                }
-            }
-	    if (st1 == nstate - 1 && tb->data.f[tboffset + st1] != nstate - 1) {
-		// transition from non-blank to blank, update prev_non_blank_base
-		prev_non_blank_base = tb->data.f[tboffset + st1];
-	    }
-        }
+        decode_crf_step(trans, blk, nstate, prev, curr, tb + blk * nstate, NULL, NULL);
     }
 
     //  Traceback
     const float score = valmaxf(curr, nstate);
     path[nblk] = argmaxf(curr, nstate);
     for(size_t blk=nblk ; blk > 0 ; blk--){
-        const size_t offset = (blk - 1) * tb->stride;
-        path[blk - 1] = tb->data.f[offset + path[blk]];
+        const size_t offset = (blk - 1) * nstate;
+        path[blk - 1] = tb[offset + path[blk]];
     }
 
-    tb = free_scrappie_imatrix(tb);
+    free(tb);
     free(mem);
 
     return score;
 }
-*/
-/*
-// decode under assumption that we have sequence of length 5 (repeat_len) homopolymers
-// NOTE: the implementation below is greedy and wrong, I am now reading up on how to do this 
-// correctly
-float decode_crf(const_scrappie_matrix trans, int * path){
-    int repeat_len = 5;
-    int cur_segment_len[5] = {0,0,0,0,0};
-    // cur_segment_len stores the length of the current homopolymer in the best path
-    // ending with each of the 5 states. 0 means previous h.p. has ended so a new one can
-    // can start. non-zero means that the next symbol can be blank or the current homopolymer 
-    // base
-    int next_segment_len[5];
-    size_t hp_base_ending_blank = 5;
-    // the current homopolymer base in the best path ending with blank (for best paths ending with
-    // other bases, the current homopolymer base is that base so no need to store.
-    // initialize with impossible value 5 so poses no constraint initially.
+
+
+/*  Policies for the specialised decoders of the 5-state CRF, see decode_crf5.h
+ *
+ *  Unconstrained: the states of the CRF themselves.
+ */
+#define crf5_free_NSTATE CRF5_NSTATE
+static inline int crf5_free_crf(int e){
+    return e;
+}
+static inline int crf5_free_next(int e, int st){
+    (void)e;
+    return st;
+}
+static inline int crf5_free_start(int e){
+    (void)e;
+    return 1;
+}
+CRF5_DEFINE_DECODER(crf5_free)
+
+/*  No base is followed by itself, either directly or across blanks.
+ *  States 0 to 3 are the bases, 4 + b a blank after base b and 8 a blank
+ *  before any base has been emitted.
+ */
+#define crf5_norep_NSTATE 9
+static inline int crf5_norep_crf(int e){
+    return (e < CRF5_BLANK) ? e : CRF5_BLANK;
+}
+static inline int crf5_norep_last(int e){
+    return (e < 8) ? (e % CRF5_BLANK) : -1;
+}
+static inline int crf5_norep_next(int e, int st){
+    const int last = crf5_norep_last(e);
+    if(CRF5_BLANK == st){
+        return (last < 0) ? 8 : (CRF5_BLANK + last);
+    }
+    return (st == last) ? -1 : st;
+}
+static inline int crf5_norep_start(int e){
+    return e < CRF5_BLANK || 8 == e;
+}
+CRF5_DEFINE_DECODER(crf5_norep)
+
+/*  No run of a base longer than CRF5_MAX_HOMOPOLYMER, blanks within a run
+ *  not ending it.  With L the maximum length, state b * L + r - 1 is the
+ *  r-th consecutive emission of base b, 4L + b * L + r - 1 a blank after
+ *  it and 8L a blank before any base has been emitted.
+ */
+#define CRF5_HP_L CRF5_MAX_HOMOPOLYMER
+#define crf5_hp_NSTATE (8 * CRF5_HP_L + 1)
+static inline int crf5_hp_crf(int e){
+    return (e < 4 * CRF5_HP_L) ? (e / CRF5_HP_L) : CRF5_BLANK;
+}
+static inline int crf5_hp_next(int e, int st){
+    if(8 * CRF5_HP_L == e){
+        return (CRF5_BLANK == st) ? e : (st * CRF5_HP_L);
+    }
+    //  Run of base b of length r, whether or not e is a blank
+    const int run = e % (4 * CRF5_HP_L);
+    const int b = run / CRF5_HP_L;
+    const int r = run % CRF5_HP_L + 1;
+    if(CRF5_BLANK == st){
+        return 4 * CRF5_HP_L + run;
+    }
+    if(st != b){
+        return st * CRF5_HP_L;
+    }
+    return (r < CRF5_HP_L) ? (run + 1) : -1;
+}
+static inline int crf5_hp_start(int e){
+    return (e < 4 * CRF5_HP_L && 0 == e % CRF5_HP_L) || 8 * CRF5_HP_L == e;
+}
+CRF5_DEFINE_DECODER(crf5_hp)
+
+
+/**  Viterbi decoding of the 5-state CRF
+ *
+ *   Identical results to decode_crf, with the number of states fixed at
+ *   compile time.
+ *
+ *   Parameters as for decode_crf
+ **/
+float decode_crf5(const_scrappie_matrix trans, int * path){
+    return crf5_free_decode(trans, path);
+}
+
+
+/**  Viterbi decoding of the 5-state CRF where no base follows itself
+ *
+ *   The best path where no base state is followed by the same base state,
+ *   either directly or with only blanks between: no homopolymer is called.
+ *
+ *   Parameters as for decode_crf
+ **/
+float decode_crf5_no_repeat(const_scrappie_matrix trans, int * path){
+    return crf5_norep_decode(trans, path);
+}
+
+
+/**  Viterbi decoding of the 5-state CRF with bounded homopolymers
+ *
+ *   The best path emitting no more than CRF5_MAX_HOMOPOLYMER of the same
+ *   base consecutively, blanks between them not ending the run.
+ *
+ *   Parameters as for decode_crf
+ **/
+float decode_crf5_bounded_homopolymer(const_scrappie_matrix trans, int * path){
+    return crf5_hp_decode(trans, path);
+}
+
+
+/**  Viterbi decoding of CRF with checkpointed traceback
+ *
+ *   Identical results to decode_crf but scores are only stored every
+ *   sqrt(nblk) blocks, the traceback of each segment being recalculated
+ *   from its checkpoint during the backtrace.  Memory is
+ *   O(sqrt(nblk) * nstate) at the cost of a second forwards pass.
+ *
+ *   Parameters as for decode_crf
+ **/
+float decode_crf_checkpointed(const_scrappie_matrix trans, int * path){
     RETURN_NULL_IF(NULL == trans, NAN);
     RETURN_NULL_IF(NULL == path, NAN);
     const size_t nblk = trans->nc;
     const size_t nstate = roundf(sqrtf((float)trans->nr));
     assert(nstate * nstate == trans->nr);
-    float * mem = calloc(2 * nstate, sizeof(float));
-    scrappie_imatrix tb = make_scrappie_imatrix(nstate, nblk);
-    if(NULL == mem || NULL == tb){
-        tb = free_scrappie_imatrix(tb);
+    assert(nstate <= 256);
+    const size_t nstatep = 4 * iceil(nstate, 4);
+    const size_t seglen = (nblk > 0) ? ceilf(sqrtf((float)nblk)) : 1;
+    const size_t nseg = iceil(nblk, seglen);
+
+    float * mem = calloc(2 * nstatep, sizeof(float));
+    float * checkpoint = calloc((nseg + 1) * nstate, sizeof(float));
+    uint8_t * tb = calloc(nstate * seglen, sizeof(uint8_t));
+    if(NULL == mem || NULL == checkpoint || NULL == tb){
+        free(tb);
+        free(checkpoint);
         free(mem);
         return NAN;
     }
-
     float * curr = mem;
-    float * prev = mem + nstate;
+    float * prev = mem + nstatep;
 
-
-    //  Forwards Viterbi pass
+    //  Forwards Viterbi pass, storing score at start of each segment
     for(size_t blk=0 ; blk < nblk ; blk++){
-        const size_t offset = blk * trans->stride;
-        const size_t tboffset = blk * tb->stride;
+        if(0 == blk % seglen){
+            memcpy(checkpoint + (blk / seglen) * nstate, curr, nstate * sizeof(float));
+        }
         {   // Swap
             float * tmp = curr;
             curr = prev;
             prev = tmp;
         }
-
-        for(size_t st1=0 ; st1 < nstate ; st1++){
-	    // st1 is to-state (in -ACGT)
-            const size_t offsetS = offset + st1 * nstate;
-            if (cur_segment_len[0] != 0 && st1 != 0 && st1 != nstate - 1) 
-                curr[st1] = -INFINITY; // not allowed if previous A segment len is non-zero and current symbol is not A or blank
-            else
-                curr[st1] = trans->data.f[offsetS + 0] + prev[0];
-            tb->data.f[tboffset + st1] = 0;
-            for(size_t st2=1 ; st2 < nstate ; st2++){
-		// st2 is from-state (in -ACGT)
-                size_t prev_base = st2;
-                if (st2 == nstate - 1) // blank
-                    prev_base = hp_base_ending_blank;
-                float score = trans->data.f[offsetS + st2] + prev[st2];
-                if (cur_segment_len[st2] != 0 && st1 != prev_base && st1 != nstate - 1)
-                    score = -INFINITY;
-                if(score > curr[st1]){
-                    curr[st1] = score;
-                    tb->data.f[tboffset + st1] = st2;
-                }
-            }
-
-        }
-        for(size_t st1=0 ; st1 < nstate ; st1++){
-            if (st1 != nstate - 1) // not blank, so update cur_segment_len[st1]
-                next_segment_len[st1] = (cur_segment_len[tb->data.f[tboffset + st1]] + 1)%repeat_len;
-            else {
-                // blank so update hp_base_ending_blank if best st2 is non-blank
-                if (tb->data.f[tboffset + st1] != nstate - 1) {
-                    hp_base_ending_blank = tb->data.f[tboffset + st1];
-                    next_segment_len[nstate-1] = cur_segment_len[hp_base_ending_blank];
-                }
-		else
-                    next_segment_len[nstate-1] = cur_segment_len[nstate-1];
-            }    
-        }
-        for(size_t st1=0 ; st1 < nstate ; st1++)
-            cur_segment_len[st1] = next_segment_len[st1];
+        decode_crf_step(trans, blk, nstate, prev, curr, tb + (blk % seglen) * nstate, NULL, NULL);
     }
 
-    //  Traceback
     const float score = valmaxf(curr, nstate);
     path[nblk] = argmaxf(curr, nstate);
-    for(size_t blk=nblk ; blk > 0 ; blk--){
-        const size_t offset = (blk - 1) * tb->stride;
-        path[blk - 1] = tb->data.f[offset + path[blk]];
+
+    //  Recalculate traceback for each segment, from last to first, and backtrace
+    for(size_t seg=nseg ; seg > 0 ; seg--){
+        const size_t blk_start = (seg - 1) * seglen;
+        const size_t blk_end = (blk_start + seglen < nblk) ? (blk_start + seglen) : nblk;
+        memcpy(curr, checkpoint + (seg - 1) * nstate, nstate * sizeof(float));
+        for(size_t blk=blk_start ; blk < blk_end ; blk++){
+            {   // Swap
+                float * tmp = curr;
+                curr = prev;
+                prev = tmp;
+            }
+            decode_crf_step(trans, blk, nstate, prev, curr, tb + (blk - blk_start) * nstate, NULL,
+                            NULL);
+        }
+        for(size_t blk=blk_end ; blk > blk_start ; blk--){
+            const size_t offset = (blk - 1 - blk_start) * nstate;
+            path[blk - 1] = tb[offset + path[blk]];
+        }
     }
 
-    tb = free_scrappie_imatrix(tb);
+    free(tb);
+    free(checkpoint);
     free(mem);
 
     return score;
 }
-*/
 
-// original decode
-float decode_crf(const_scrappie_matrix trans, int * path){
+
+char * crfpath_to_basecall(int const * path, size_t npos, int * pos){
+    RETURN_NULL_IF(NULL == path, NULL);
+    RETURN_NULL_IF(NULL == pos, NULL);
+
+    int nbase = 0;
+    for(size_t pos=0 ; pos < npos ; pos++){
+        if(path[pos] < NBASE){
+            nbase += 1;
+        }
+    }
+
+    char * basecall = calloc(nbase + 1, sizeof(char));
+    RETURN_NULL_IF(NULL == basecall, NULL);
+
+    for(size_t pos=0, bpos=0 ; pos < npos ; pos++){
+        if(path[pos] < NBASE){
+            assert(bpos < nbase);
+            basecall[bpos] = base_lookup[path[pos]];
+            bpos += 1;
+        }
+    }
+
+    return basecall;
+}
+
+
+/**  Viterbi decoding of CRF with the posterior probability of each state of the path
+ *
+ *   The forward recursion is run alongside the Viterbi recursion, sharing the
+ *   loads of the transitions of each block, and the backward recursion
+ *   accompanies neither, so two passes over the transitions find the path and
+ *   the probability that each state of the path is in error.  The full
+ *   posterior is never stored: only the forward scores, as posterior_crf, and
+ *   the traceback.  The path and score are identical to those of decode_crf.
+ *
+ *   @param trans CRF transition matrix
+ *   @param path Viterbi path [out, nblk + 1]
+ *   @param perr Posterior probability that state of path at each position is
+ *   wrong [out, nblk + 1]
+ *
+ *   @returns score of path, NAN on failure
+ **/
+float decode_crf_quality(const_scrappie_matrix trans, int * path, float * perr){
     RETURN_NULL_IF(NULL == trans, NAN);
     RETURN_NULL_IF(NULL == path, NAN);
+    RETURN_NULL_IF(NULL == perr, NAN);
     const size_t nblk = trans->nc;
     const size_t nstate = roundf(sqrtf((float)trans->nr));
     assert(nstate * nstate == trans->nr);
-    float * mem = calloc(2 * nstate, sizeof(float));
-    scrappie_imatrix tb = make_scrappie_imatrix(nstate, nblk);
-    if(NULL == mem || NULL == tb){
-        tb = free_scrappie_imatrix(tb);
+    assert(nstate <= 256);
+    const size_t nstatep = 4 * iceil(nstate, 4);
+    float * mem = calloc(2 * nstatep + 2 * nstate, sizeof(float));
+    float * fwd = calloc(nstate * (nblk + 1), sizeof(float));
+    uint8_t * tb = calloc(nstate * nblk, sizeof(uint8_t));
+    scrappie_matrix tmp = make_scrappie_matrix(trans->nr, 1);
+    if(NULL == mem || NULL == fwd || NULL == tb || NULL == tmp){
+        tmp = free_scrappie_matrix(tmp);
+        free(tb);
+        free(fwd);
         free(mem);
         return NAN;
     }
     float * curr = mem;
-    float * prev = mem + nstate;
+    float * prev = mem + nstatep;
 
-
-    //  Forwards Viterbi pass
+    //  Forwards Viterbi and forward passes.  Forward scores of each block are
+    //  shifted so the largest is zero, as posterior_crf.
     for(size_t blk=0 ; blk < nblk ; blk++){
-        const size_t offset = blk * trans->stride;
-        const size_t tboffset = blk * tb->stride;
         {   // Swap
-            float * tmp = curr;
+            float * tmpptr = curr;
             curr = prev;
-            prev = tmp;
+            prev = tmpptr;
         }
-
-        for(size_t st1=0 ; st1 < nstate ; st1++){
-	    // st1 is to-state (in -ACGT)
-            const size_t offsetS = offset + st1 * nstate;
-            curr[st1] = trans->data.f[offsetS + 0] + prev[0];
-            tb->data.f[tboffset + st1] = 0;
-            for(size_t st2=1 ; st2 < nstate ; st2++){
-		// st2 is from-state (in -ACGT)
-                const float score = trans->data.f[offsetS + st2] + prev[st2];
-                if(score > curr[st1]){
-                    curr[st1] = score;
-                    tb->data.f[tboffset + st1] = st2;
-                }
-            }
+        float * fcurr = fwd + (blk + 1) * nstate;
+        decode_crf_step(trans, blk, nstate, prev, curr, tb + blk * nstate, fwd + blk * nstate,
+                        tmp->data.f);
+        crf_logsumexp_block(tmp->data.f, nstate, true, fcurr);
+        const float maxscore = valmaxf(fcurr, nstate);
+        for(size_t st=0 ; st < nstate ; st++){
+            fcurr[st] -= maxscore;
         }
     }
 
@@ -1060,40 +2016,92 @@ float decode_crf(const_scrappie_matrix trans, int * path){
     const float score = valmaxf(curr, nstate);
     path[nblk] = argmaxf(curr, nstate);
     for(size_t blk=nblk ; blk > 0 ; blk--){
-        const size_t offset = (blk - 1) * tb->stride;
-        path[blk - 1] = tb->data.f[offset + path[blk]];
+        const size_t offset = (blk - 1) * nstate;
+        path[blk - 1] = tb[offset + path[blk]];
+    }
+
+    //  Backward pass, combining with forward scores for the state of the path
+    float * bprev = mem + 2 * nstatep;
+    float * bcurr = bprev + nstate;
+    for(size_t st=0 ; st < nstate ; st++){
+        // Initialisation
+        bcurr[st] = 0.0f;
+    }
+    for(size_t blk=nblk + 1 ; blk > 0 ; blk--){
+        const float * fcol = fwd + (blk - 1) * nstate;
+        if(blk <= nblk){
+            {   // Swap
+                float * tmpptr = bcurr;
+                bcurr = bprev;
+                bprev = tmpptr;
+            }
+            crf_backward_step(trans->data.f + (blk - 1) * trans->stride, nstate, bprev, bcurr,
+                              tmp->data.f);
+            const float maxscore = valmaxf(bcurr, nstate);
+            for(size_t st=0 ; st < nstate ; st++){
+                bcurr[st] -= maxscore;
+            }
+        }
+
+        //  Probability of error summed over other states, rather than as one
+        //  minus the probability of the state, so it is accurate when small
+        float tot = -HUGE_VALF;
+        for(size_t st=0 ; st < nstate ; st++){
+            tot = fmaxf(tot, fcol[st] + bcurr[st]);
+        }
+        float sum = 0.0f;
+        float err = 0.0f;
+        for(size_t st=0 ; st < nstate ; st++){
+            const float p = expf(fcol[st] + bcurr[st] - tot);
+            sum += p;
+            err += (path[blk - 1] == (int)st) ? 0.0f : p;
+        }
+        perr[blk - 1] = err / sum;
     }
 
-    tb = free_scrappie_imatrix(tb);
+    tmp = free_scrappie_matrix(tmp);
+    free(tb);
+    free(fwd);
     free(mem);
 
     return score;
 }
 
 
-char * crfpath_to_basecall(int const * path, size_t npos, int * pos){
+/**  Phred qualities of the bases called from a CRF path
+ *
+ *   @param path Path through CRF, as crfpath_to_basecall
+ *   @param perr Probability that state of path is wrong at each position, as
+ *   from decode_crf_quality [npos]
+ *   @param npos Number of positions of path to call
+ *
+ *   @returns Qualities as FASTQ characters, one for each base of
+ *   crfpath_to_basecall, capped at CRF_MAX_QUALITY.  NULL on failure.
+ **/
+char * crfpath_to_quality(int const * path, float const * perr, size_t npos){
     RETURN_NULL_IF(NULL == path, NULL);
-    RETURN_NULL_IF(NULL == pos, NULL);
+    RETURN_NULL_IF(NULL == perr, NULL);
 
-    int nbase = 0;
+    size_t nbase = 0;
     for(size_t pos=0 ; pos < npos ; pos++){
         if(path[pos] < NBASE){
             nbase += 1;
         }
     }
 
-    char * basecall = calloc(nbase + 1, sizeof(char));
-    RETURN_NULL_IF(NULL == basecall, NULL);
+    char * quality = calloc(nbase + 1, sizeof(char));
+    RETURN_NULL_IF(NULL == quality, NULL);
 
     for(size_t pos=0, bpos=0 ; pos < npos ; pos++){
         if(path[pos] < NBASE){
-            assert(bpos < nbase);
-            basecall[bpos] = base_lookup[path[pos]];
+            const float q = -10.0f * log10f(perr[pos]);
+            const int iq = (q < CRF_MAX_QUALITY) ? (int)(q + 0.5f) : CRF_MAX_QUALITY;
+            quality[bpos] = '!' + iq;
             bpos += 1;
         }
     }
 
-    return basecall;
+    return quality;
 }
 
 
@@ -1112,80 +2120,73 @@ scrappie_matrix posterior_crf(const_scrappie_matrix trans){
     const size_t nblk = trans->nc;
 
     scrappie_matrix post = make_scrappie_matrix(nstate, nblk + 1);
-    RETURN_NULL_IF(NULL == post, NULL);
-
-
-    //  Forwards pass
+    scrappie_matrix tmp = make_scrappie_matrix(trans->nr, 1);
+    float * tmpmem = calloc(2 * nstate, sizeof(float));
+    if(NULL == post || NULL == tmp || NULL == tmpmem){
+        free(tmpmem);
+        tmp = free_scrappie_matrix(tmp);
+        post = free_scrappie_matrix(post);
+        return NULL;
+    }
+
+    //  Forwards pass, stored in the posterior matrix.  Each block is shifted
+    //  so its largest score is zero, which leaves the posterior unchanged
+    //  but keeps scores small enough to be represented accurately.
     for(size_t st=0 ; st < nstate ; st++){
         // Initialisation
         post->data.f[st] = 0.0f;
     }
     for(size_t blk=0 ; blk < nblk ; blk++){
-        const size_t offset = blk * trans->stride;
-        const size_t offset_post = blk * post->stride;
-
-        const float * prev = post->data.f + offset_post;
-        float * curr = post->data.f + offset_post + post->stride;
-
-        for(size_t st1=0 ; st1 < nstate ; st1++){
-            const size_t offsetS = offset + st1 * nstate;
-            curr[st1] = trans->data.f[offsetS + 0] + prev[0];
-            for(size_t st2=1 ; st2 < nstate ; st2++){
-                curr[st1] = logsumexpf(curr[st1], trans->data.f[offsetS + st2] + prev[st2]);
-            }
+        const float * prev = post->data.f + blk * post->stride;
+        float * curr = post->data.f + (blk + 1) * post->stride;
+        crf_forward_step(trans->data.f + blk * trans->stride, nstate, prev, curr, tmp->data.f);
+        const float maxscore = valmaxf(curr, nstate);
+        for(size_t st=0 ; st < nstate ; st++){
+            curr[st] -= maxscore;
         }
     }
 
-    // Backwards pass
-    float * tmpmem = malloc(2 * nstate * sizeof(float));
+    // Backwards pass, combining with forwards and normalising each block
     float * prev = tmpmem;
     float * curr = tmpmem + nstate;
     for(size_t st=0 ; st < nstate ; st++){
         // Initialisation
         curr[st] = 0.0f;
     }
-    // Normalisation of last block
-    float tot = 0.0f;
-    for(size_t st=0 ; st < nstate ; st++){
-        tot = logsumexpf(tot, post->data.f[nblk * post->stride + st]);
-    }
-    for(size_t st=0 ; st < nstate ; st++){
-        post->data.f[nblk * post->stride + st] = expf(post->data.f[nblk * post->stride + st] - tot);
-    }
-    for(size_t blk=nblk ; blk > 0 ; blk--){
-        const size_t blkm1 = blk - 1;
-        const size_t offset = blkm1 * trans->stride;
-        const size_t offset_post = blkm1 * post->stride;
-
-        {   // Swap
-            float * tmp = curr;
-            curr = prev;
-            prev = tmp;
-        }
-
-        for(size_t st=0 ; st < nstate ; st++){
-            curr[st] = trans->data.f[offset + st] + prev[0];
-        }
-        for(size_t st1=1 ; st1 < nstate ; st1++){
-            const size_t offsetS = offset + st1 * nstate;
-            for(size_t st2=0 ; st2 < nstate ; st2++){
-                curr[st2] = logsumexpf(curr[st2], trans->data.f[offsetS + st2] + prev[st1]);
+    for(size_t blk=nblk + 1 ; blk > 0 ; blk--){
+        float * pcol = post->data.f + (blk - 1) * post->stride;
+        if(blk <= nblk){
+            {   // Swap
+                float * tmpptr = curr;
+                curr = prev;
+                prev = tmpptr;
+            }
+            crf_backward_step(trans->data.f + (blk - 1) * trans->stride, nstate, prev, curr,
+                              tmp->data.f);
+            const float maxscore = valmaxf(curr, nstate);
+            for(size_t st=0 ; st < nstate ; st++){
+                curr[st] -= maxscore;
             }
         }
 
         // Normalisation
-        float tot = 0.0f;
+        float tot = -HUGE_VALF;
         for(size_t st=0 ; st < nstate ; st++){
-            post->data.f[offset_post + st] += curr[st];
-            tot = logsumexpf(tot, post->data.f[offset_post + st]);
+            pcol[st] += curr[st];
+            tot = fmaxf(tot, pcol[st]);
         }
+        float sum = 0.0f;
         for(size_t st=0 ; st < nstate ; st++){
-            post->data.f[offset_post + st] = expf(post->data.f[offset_post + st] - tot);
+            pcol[st] = expf(pcol[st] - tot);
+            sum += pcol[st];
+        }
+        for(size_t st=0 ; st < nstate ; st++){
+            pcol[st] /= sum;
         }
     }
 
     free(tmpmem);
-
+    tmp = free_scrappie_matrix(tmp);
 
     return post;
 }
@@ -1193,6 +2194,214 @@ scrappie_matrix posterior_crf(const_scrappie_matrix trans){
 
 
 static float LARGE_VAL = 1e30f;
+//  Number of times the band of a squiggle mapping is widened before falling back to a full mapping
+#define SQUIGGLE_BAND_RETRIES 3
+
+
+/**  Parameters of squiggle matching derived from the predicted squiggle
+ *
+ *   Location, scale and log-scale of each position are laid out contiguously so
+ *   emissions for a run of positions may be calculated using vector instructions.
+ **/
+struct squiggle_match_params {
+    float * location;
+    float * scale;
+    //  Log-scale plus log(2), the constant part of the Laplace log-density
+    float * logscale;
+    //  Probability of moving on from each position
+    float * move_prob;
+    //  Penalties for states, ordered start .. positions .. end
+    float * move_pen;
+    float * stay_pen;
+};
+
+static void free_squiggle_match_params(struct squiggle_match_params * smp){
+    free(smp->location);
+    free(smp->scale);
+    free(smp->logscale);
+    free(smp->move_prob);
+    free(smp->move_pen);
+    free(smp->stay_pen);
+}
+
+static bool squiggle_match_params_init(const_scrappie_matrix params, float rate, float prob_back,
+                                       struct squiggle_match_params * smp){
+    const size_t ldp = params->stride;
+    const size_t npos = params->nc;
+    const size_t nfstate = npos + 2;
+    //  Padded so vector loads at the end of the squiggle stay within bounds
+    const size_t npos_pad = 4 * ((npos + 3) / 4);
+
+    *smp = (struct squiggle_match_params){0};
+    smp->move_prob = calloc(npos, sizeof(float));
+    smp->move_pen = calloc(nfstate, sizeof(float));
+    smp->stay_pen = calloc(nfstate, sizeof(float));
+    if(0 != scrappie_memalign((void **)&smp->location, 16, npos_pad * sizeof(float))
+       || 0 != scrappie_memalign((void **)&smp->scale, 16, npos_pad * sizeof(float))
+       || 0 != scrappie_memalign((void **)&smp->logscale, 16, npos_pad * sizeof(float))
+       || NULL == smp->move_prob || NULL == smp->move_pen || NULL == smp->stay_pen){
+        free_squiggle_match_params(smp);
+        return false;
+    }
+
+    for(size_t pos=0 ; pos < npos_pad ; pos++){
+        //  Padding never contributes to a state
+        smp->location[pos] = 0.0f;
+        smp->scale[pos] = 1.0f;
+        smp->logscale[pos] = 0.0f;
+    }
+    for(size_t pos=0 ; pos < npos ; pos++){
+        smp->location[pos] = params->data.f[pos * ldp + 0];
+        smp->scale[pos] = expf(params->data.f[pos * ldp + 1]);
+        smp->logscale[pos] = params->data.f[pos * ldp + 1] + (float)M_LN2;
+    }
+
+    const float lograte = logf(rate);
+    float mean_move_pen = 0.0f;
+    float mean_stay_pen = 0.0f;
+    for(size_t pos=0 ; pos < npos ; pos++){
+        const float mp = (1.0f - prob_back) * plogisticf(params->data.f[pos * ldp + 2] + lograte);
+        smp->move_prob[pos] = mp;
+        smp->move_pen[pos + 1] = logf(mp);
+        smp->stay_pen[pos + 1] = log1pf(-mp - prob_back);
+        mean_move_pen += smp->move_pen[pos + 1];
+        mean_stay_pen += smp->stay_pen[pos + 1];
+    }
+    mean_move_pen /= npos;
+    mean_stay_pen /= npos;
+
+    smp->move_pen[0] = mean_move_pen;
+    smp->move_pen[nfstate - 1] = mean_move_pen;
+    smp->stay_pen[0] = mean_stay_pen;
+    smp->stay_pen[nfstate - 1] = mean_stay_pen;
+
+    return true;
+}
+
+
+/**  Emission scores of a sample for a run of positions
+ *
+ *   Floored Laplace log-density, four positions at a time.  The run is rounded
+ *   up to a multiple of four so `score` must have room for the padding.
+ *
+ *   @param x Sample
+ *   @param smp Parameters of squiggle
+ *   @param pos Position at start of run, must be a multiple of four
+ *   @param n Length of run
+ *   @param minscore Minimum possible emission
+ *   @param score [OUT] Emission scores of run, aligned to 16 bytes
+ **/
+static inline void squiggle_match_emissions(float x, const struct squiggle_match_params * smp,
+                                            size_t pos, size_t n, float minscore, float * score){
+    assert(0 == pos % 4);
+    const __m128 xv = _mm_set1_ps(x);
+    const __m128 floorv = _mm_set1_ps(-minscore);
+    const __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    for(size_t i=0 ; i < n ; i += 4){
+        const __m128 loc = _mm_load_ps(smp->location + pos + i);
+        const __m128 sc = _mm_load_ps(smp->scale + pos + i);
+        const __m128 logsc = _mm_load_ps(smp->logscale + pos + i);
+        const __m128 dev = _mm_and_ps(absmask, _mm_sub_ps(xv, loc));
+        const __m128 ll = _mm_sub_ps(_mm_sub_ps(_mm_setzero_ps(), _mm_div_ps(dev, sc)), logsc);
+        _mm_store_ps(score + i, _mm_max_ps(floorv, ll));
+    }
+}
+
+
+/**  Band of positions occupied by a squiggle match
+ *
+ *   The band is a window of fixed width that follows the expected position of
+ *   the match through the squiggle.  The expected position advances by the
+ *   probability of moving on from the current position, as given by the dwell
+ *   model at the requested rate, rescaled so the expected duration of the
+ *   whole squiggle is the length of the signal.  The band never moves on by
+ *   more than the match itself can (two positions) in a single sample, so
+ *   consecutive bands always overlap.
+ **/
+struct squiggle_band {
+    size_t npos;
+    size_t width;
+    //  First position of band
+    size_t lo;
+    //  Expected position of match
+    float centre;
+    //  Ratio of expected duration of squiggle to length of signal
+    float rate_scale;
+};
+
+static struct squiggle_band squiggle_band_init(size_t npos, size_t width, size_t nsample,
+                                               float const * move_prob){
+    float expected_duration = 0.0f;
+    for(size_t pos=0 ; pos < npos ; pos++){
+        expected_duration += 1.0f / move_prob[pos];
+    }
+    return (struct squiggle_band){npos, width, 0, 0.0f, expected_duration / nsample};
+}
+
+static void squiggle_band_update(struct squiggle_band * band, float const * move_prob){
+    if(band->width == band->npos){
+        return;
+    }
+    const size_t cpos = (size_t)band->centre;
+    band->centre = fminf(band->centre + band->rate_scale * move_prob[cpos], band->npos - 1);
+
+    const float lo = band->centre - 0.5f * band->width;
+    const size_t maxlo = band->npos - band->width;
+    size_t newlo = (lo <= 0.0f) ? 0 : (size_t)lrintf(lo);
+    if(newlo > band->lo + 2){
+        newlo = band->lo + 2;
+    }
+    band->lo = (newlo > maxlo) ? maxlo : newlo;
+}
+
+
+/**  Local index of state within band
+ *
+ *   States in a band are start, forward positions, end then backward
+ *   positions.
+ *
+ *   @returns Index of state or -1 if state is outside of band
+ **/
+static inline ptrdiff_t squiggle_band_index(size_t st, size_t lo, size_t width, size_t nfstate){
+    if(0 == st){
+        return 0;
+    }
+    if(nfstate - 1 == st){
+        return width + 1;
+    }
+    const bool is_back = st >= nfstate;
+    const size_t pos = is_back ? st - nfstate : st - 1;
+    if(pos < lo || pos >= lo + width){
+        return -1;
+    }
+    return is_back ? (ptrdiff_t)(width + 2 + pos - lo) : (ptrdiff_t)(1 + pos - lo);
+}
+
+
+/**  Whether state is at an edge of band that is not an end of squiggle
+ **/
+static inline bool squiggle_band_is_edge(size_t st, size_t lo, size_t width, size_t npos){
+    const size_t nfstate = npos + 2;
+    if(0 == st || nfstate - 1 == st){
+        return false;
+    }
+    const size_t pos = (st >= nfstate) ? st - nfstate : st - 1;
+    return (pos == lo && lo > 0) || (pos + 1 == lo + width && lo + width < npos);
+}
+
+
+/**  Set states of a previous band that are not in the current band to -LARGE_VAL
+ **/
+static inline void squiggle_band_clear(float * score, size_t oldlo, size_t lo, size_t width,
+                                       size_t nfstate){
+    for(size_t pos=oldlo ; pos < oldlo + width ; pos++){
+        if(pos < lo || pos >= lo + width){
+            score[pos + 1] = -LARGE_VAL;
+            score[nfstate + pos] = -LARGE_VAL;
+        }
+    }
+}
+
 
 /**  Map a signal to a predicted squiggle using variant of dynamic time-warping
  *
@@ -1214,6 +2423,22 @@ static float LARGE_VAL = 1e30f;
 float squiggle_match_viterbi(const raw_table signal, float rate, const_scrappie_matrix params,
                              float prob_back, float local_pen, float skip_pen, float minscore,
                              int32_t * path_padded){
+    return squiggle_match_viterbi_banded(signal, rate, params, prob_back, local_pen, skip_pen,
+                                         minscore, 0, path_padded);
+}
+
+
+/**  Viterbi mapping of signal to squiggle within a band of given width
+ *
+ *   @param width Width of band, no more than the length of the squiggle
+ *   @param touches_edge [OUT] Whether the path meets an edge of the band
+ *   that is not also an end of the squiggle
+ *
+ *   @returns score
+ **/
+static float squiggle_match_viterbi_width(const raw_table signal, float rate, const_scrappie_matrix params,
+                                          float prob_back, float local_pen, float skip_pen, float minscore,
+                                          size_t width, int32_t * path_padded, bool * touches_edge){
     RETURN_NULL_IF(NULL == signal.raw, NAN);
     RETURN_NULL_IF(NULL == params, NAN);
     RETURN_NULL_IF(NULL == path_padded, NAN);
@@ -1226,29 +2451,33 @@ float squiggle_match_viterbi(const raw_table signal, float rate, const_scrappie_
 
     const float * rawsig = signal.raw + signal.start;
     const size_t nsample = signal.end - signal.start;
-    const size_t ldp = params->stride;
     const size_t npos = params->nc;
     const size_t nfstate = npos + 2;
     const size_t nstate = npos + nfstate;
+    assert(width > 0 && width <= npos);
+    //  Start, forward positions, end and backward positions of band
+    const size_t nbandstate = 2 * width + 2;
 
     const float move_back_pen = logf(prob_back);
     const float stay_in_back_pen = logf(0.5f);
     const float move_from_back_pen = logf(0.5f);
 
-    float * move_pen = calloc(nfstate, sizeof(float));
+    struct squiggle_match_params smp;
+    if(!squiggle_match_params_init(params, rate, prob_back, &smp)){
+        return NAN;
+    }
+    const float * move_pen = smp.move_pen;
+    const float * stay_pen = smp.stay_pen;
+
     float * fwd = calloc(2 * nstate, sizeof(float));
-    float * scale = calloc(npos, sizeof(float));
-    float * stay_pen = calloc(nfstate, sizeof(float));
-    int32_t * traceback = calloc(nsample * nstate, sizeof(int32_t));
-    if(NULL == move_pen || NULL == fwd || NULL == scale ||
-       NULL == stay_pen || NULL == traceback){
+    float * emission = NULL;
+    size_t * band_lo = calloc(nsample, sizeof(size_t));
+    int32_t * traceback = calloc(nsample * nbandstate, sizeof(int32_t));
+    if(NULL == fwd || NULL == band_lo || NULL == traceback
+       || 0 != scrappie_memalign((void **)&emission, 16, (width + 8) * sizeof(float))){
         goto clean;
     }
 
-    for(size_t pos=0 ; pos < npos ; pos++){
-        //  Create array of scales
-        scale[pos] = expf(params->data.f[pos * ldp + 1]);
-    }
     for(size_t i=0 ; i < signal.n ; i++){
         path_padded[i] = -1;
     }
@@ -1257,118 +2486,139 @@ float squiggle_match_viterbi(const raw_table signal, float rate, const_scrappie_
     int32_t * path = path_padded + signal.start;
 
 
-    {
-        const float lograte = logf(rate);
-        float mean_move_pen = 0.0f;
-        float mean_stay_pen = 0.0f;
-        for(size_t pos=0 ; pos < npos ; pos++){
-            const float mp = (1.0f - prob_back) * plogisticf(params->data.f[pos * ldp + 2] + lograte);
-            move_pen[pos + 1] = logf(mp);
-            stay_pen[pos + 1] = log1pf(-mp - prob_back);
-            mean_move_pen += move_pen[pos + 1];
-            mean_stay_pen += stay_pen[pos + 1];
-        }
-        mean_move_pen /= npos;
-        mean_stay_pen /= npos;
-
-        move_pen[0] = mean_move_pen;
-        move_pen[nfstate - 1] = mean_move_pen;
-        stay_pen[0] = mean_stay_pen;
-        stay_pen[nfstate - 1] = mean_stay_pen;
-    }
-
-    for(size_t st=0 ; st < nstate ; st++){
+    for(size_t st=0 ; st < 2 * nstate ; st++){
         // States are start .. positions .. end
         fwd[st] = -LARGE_VAL;
     }
     // Must begin in start state
     fwd[0] = 0.0;
 
+    struct squiggle_band sband = squiggle_band_init(npos, width, nsample, smp.move_prob);
+    //  First position of band last stored in each half of fwd
+    size_t buf_lo[2] = {0, 0};
 
     for(size_t sample=0 ; sample < nsample ; sample++){
         const size_t fwd_prev_off = (sample % 2) * nstate;
         const size_t fwd_curr_off = ((sample + 1) % 2) * nstate;
-        const size_t tr_off = sample * nstate;
-
-        for(size_t st=0 ; st < nfstate ; st++){
-            //  Stay in start, end or normal position
-            fwd[fwd_curr_off + st] = fwd[fwd_prev_off + st] + stay_pen[st];
-            traceback[tr_off + st] = st;
-        }
-        for(size_t st=0 ; st < npos ; st++){
+        float * fprev = fwd + fwd_prev_off;
+        float * fcurr = fwd + fwd_curr_off;
+        int32_t * tb = traceback + sample * nbandstate;
+        const size_t lo = sband.lo;
+        const size_t hi = lo + width;
+        const size_t prev_lo = buf_lo[sample % 2];
+        const size_t prev_hi = prev_lo + width;
+        //  Traceback of forward and backward positions in band
+        int32_t * tbf = tb + 1;
+        int32_t * tbb = tb + width + 2;
+
+        squiggle_band_clear(fcurr, buf_lo[(sample + 1) % 2], lo, width, nfstate);
+        buf_lo[(sample + 1) % 2] = lo;
+        band_lo[sample] = lo;
+
+        //  Stay in start, end or normal position
+        fcurr[0] = fprev[0] + stay_pen[0];
+        tb[0] = 0;
+        fcurr[nfstate - 1] = fprev[nfstate - 1] + stay_pen[nfstate - 1];
+        tb[width + 1] = nfstate - 1;
+        for(size_t pos=lo ; pos < hi ; pos++){
+            fcurr[pos + 1] = fprev[pos + 1] + stay_pen[pos + 1];
+            tbf[pos - lo] = pos + 1;
+        }
+        for(size_t pos=lo ; pos < hi ; pos++){
             //  Stay in back position
-            const size_t idx = nfstate + st;
-            fwd[fwd_curr_off + idx] = fwd[fwd_prev_off + idx] + stay_in_back_pen;
-            traceback[tr_off + idx] = idx;
+            const size_t idx = nfstate + pos;
+            fcurr[idx] = fprev[idx] + stay_in_back_pen;
+            tbb[pos - lo] = idx;
         }
-        for(size_t st=1 ; st < nfstate ; st++){
+        for(size_t pos=lo ; pos < hi ; pos++){
             //  Move to next position
-            const float step_score = fwd[fwd_prev_off + st - 1] + move_pen[st - 1];
-            if(step_score > fwd[fwd_curr_off + st]){
-                fwd[fwd_curr_off + st] = step_score;
-                traceback[tr_off + st] = st - 1;
+            const size_t st = pos + 1;
+            const float step_score = fprev[st - 1] + move_pen[st - 1];
+            if(step_score > fcurr[st]){
+                fcurr[st] = step_score;
+                tbf[pos - lo] = st - 1;
+            }
+        }
+        {
+            const size_t st = nfstate - 1;
+            const float step_score = fprev[st - 1] + move_pen[st - 1];
+            if(step_score > fcurr[st]){
+                fcurr[st] = step_score;
+                tb[width + 1] = st - 1;
             }
         }
-        for(size_t st=2 ; st < nfstate ; st++){
+        for(size_t pos=(lo > 1) ? lo : 1 ; pos < hi ; pos++){
             //  Skip to next position
-            const float skip_score = fwd[fwd_prev_off + st - 2] + move_pen[st - 2] - skip_pen;
-            if(skip_score > fwd[fwd_curr_off + st]){
-                fwd[fwd_curr_off + st] = skip_score;
-                traceback[tr_off + st] = st - 2;
+            const size_t st = pos + 1;
+            const float skip_score = fprev[st - 2] + move_pen[st - 2] - skip_pen;
+            if(skip_score > fcurr[st]){
+                fcurr[st] = skip_score;
+                tbf[pos - lo] = st - 2;
             }
         }
-        for(size_t destpos=1 ; destpos < npos ; destpos++){
+        {
+            const size_t st = nfstate - 1;
+            const float skip_score = fprev[st - 2] + move_pen[st - 2] - skip_pen;
+            if(skip_score > fcurr[st]){
+                fcurr[st] = skip_score;
+                tb[width + 1] = st - 2;
+            }
+        }
+        for(size_t destpos=(lo > 1) ? lo : 1 ; destpos < hi ; destpos++){
             const size_t destst = destpos + 1;
             //  Move from start into sequence
-            const float score = fwd[fwd_prev_off] + move_pen[0] - local_pen * destpos;
-            if(score > fwd[fwd_curr_off + destst]){
-                fwd[fwd_curr_off + destst] = score;
-                traceback[tr_off + destst] = 0;
+            const float score = fprev[0] + move_pen[0] - local_pen * destpos;
+            if(score > fcurr[destst]){
+                fcurr[destst] = score;
+                tbf[destpos - lo] = 0;
             }
         }
-        for(size_t origpos=0 ; origpos < (npos - 1) ; origpos++){
+        for(size_t origpos=prev_lo ; origpos < prev_hi && origpos < (npos - 1) ; origpos++){
+            //  Positions outside of previous band have score -LARGE_VAL
             const size_t destst = nfstate - 1;
             const size_t origst = origpos + 1;
             const size_t deltapos = npos - 1 - origpos;
             //  Move from sequence into end
-            const float score = fwd[fwd_prev_off + origst] + move_pen[origst] - local_pen * deltapos;
-            if(score > fwd[fwd_curr_off + destst]){
-                fwd[fwd_curr_off + destst] = score;
-                traceback[tr_off + destst] = origst;
+            const float score = fprev[origst] + move_pen[origst] - local_pen * deltapos;
+            if(score > fcurr[destst]){
+                fcurr[destst] = score;
+                tb[width + 1] = origst;
             }
         }
-        for(size_t st=1 ; st < npos ; st++){
+        for(size_t pos=lo ; pos < hi && pos < (npos - 1) ; pos++){
             // Move to back
-            const float back_score = fwd[fwd_prev_off + st + 1] + move_back_pen;
-            if(back_score > fwd[fwd_curr_off + nfstate + st - 1]){
-                fwd[fwd_curr_off + nfstate + st - 1] = back_score;
-                traceback[tr_off + nfstate + st - 1] = st + 1;
+            const float back_score = fprev[pos + 2] + move_back_pen;
+            if(back_score > fcurr[nfstate + pos]){
+                fcurr[nfstate + pos] = back_score;
+                tbb[pos - lo] = pos + 2;
             }
         }
-        for(size_t st=1 ; st < npos ; st++){
+        for(size_t pos=(lo > 1) ? lo : 1 ; pos < hi ; pos++){
             // Move from back
-            const float back_score = fwd[fwd_prev_off + nfstate + st - 1] + move_from_back_pen;
-            if(back_score > fwd[fwd_curr_off + st + 1]){
-                fwd[fwd_curr_off + st + 1] = back_score;
-                traceback[tr_off + st + 1] = nfstate + st - 1;
+            const float back_score = fprev[nfstate + pos - 1] + move_from_back_pen;
+            if(back_score > fcurr[pos + 1]){
+                fcurr[pos + 1] = back_score;
+                tbf[pos - lo] = nfstate + pos - 1;
             }
         }
 
-
-        for(size_t pos=0 ; pos < npos ; pos++){
+        {
             //  Add on score for samples
-            const float location = params->data.f[pos * ldp + 0];
-            const float logscale = params->data.f[pos * ldp + 1];
-            const float logscore = fmaxf(-minscore, loglaplace(rawsig[sample], location, scale[pos], logscale));
-            //  State to add to is offset by one because of start state
-            fwd[fwd_curr_off + pos + 1] += logscore;
-            fwd[fwd_curr_off + nfstate + pos] += logscore;
+            const size_t offset = lo % 4;
+            squiggle_match_emissions(rawsig[sample], &smp, lo - offset, width + offset, minscore, emission);
+            const float * em = emission + offset;
+            for(size_t pos=lo ; pos < hi ; pos++){
+                //  State to add to is offset by one because of start state
+                fcurr[pos + 1] += em[pos - lo];
+                fcurr[nfstate + pos] += em[pos - lo];
+            }
         }
 
         // Score for start and end states
-        fwd[fwd_curr_off + 0] -= local_pen;
-        fwd[fwd_curr_off + nfstate - 1] -= local_pen;
+        fcurr[0] -= local_pen;
+        fcurr[nfstate - 1] -= local_pen;
 
+        squiggle_band_update(&sband, smp.move_prob);
     }
 
     //  Score of best path and final states.  Could be either last position or end state
@@ -1380,10 +2630,13 @@ float squiggle_match_viterbi(const raw_table signal, float rate, const_scrappie_
         path[nsample - 1] = nfstate - 1;
     }
 
+    *touches_edge = false;
     for(size_t sample=1 ; sample < nsample ; sample++){
         const size_t rs = nsample - sample;
-        const size_t tr_off = rs * nstate;
-        path[rs - 1] = traceback[tr_off + path[rs]];
+        const ptrdiff_t idx = squiggle_band_index(path[rs], band_lo[rs], width, nfstate);
+        //  Only reachable from outside of band if there is no valid path
+        path[rs - 1] = (idx < 0) ? 0 : traceback[rs * nbandstate + idx];
+        *touches_edge |= (idx < 0) || squiggle_band_is_edge(path[rs - 1], band_lo[rs - 1], width, npos);
     }
 
     // Correct path so start and end states are encoded as -1, other states as positions
@@ -1414,15 +2667,56 @@ float squiggle_match_viterbi(const raw_table signal, float rate, const_scrappie_
 
 clean:
     free(traceback);
-    free(stay_pen);
-    free(scale);
+    free(band_lo);
+    free(emission);
     free(fwd);
-    free(move_pen);
+    free_squiggle_match_params(&smp);
 
     return final_score;
 }
 
 
+/**  Map a signal to a predicted squiggle, restricting the match to a moving band
+ *
+ *   As `squiggle_match_viterbi` but, for each sample, only a window of `band`
+ *   positions of the squiggle are considered, along with the start and end
+ *   states.  The band follows the expected position of the match, see
+ *   `squiggle_band`, so time and memory for the traceback are proportional to
+ *   the width of the band rather than the length of the squiggle.  This
+ *   assumes that the signal covers most of the squiggle.
+ *
+ *   Should the path meet the edge of the band, the mapping is repeated with
+ *   a band twice as wide, falling back to a full mapping after several
+ *   attempts.
+ *
+ *   @param band Width of band.  Zero, or a width larger than the squiggle, is a
+ *   full mapping identical to `squiggle_match_viterbi`
+ *
+ *   @returns score
+ **/
+float squiggle_match_viterbi_banded(const raw_table signal, float rate, const_scrappie_matrix params,
+                                    float prob_back, float local_pen, float skip_pen, float minscore,
+                                    size_t band, int32_t * path_padded){
+    RETURN_NULL_IF(NULL == params, NAN);
+    const size_t npos = params->nc;
+    size_t width = (0 == band || band > npos) ? npos : band;
+
+    bool touches_edge = false;
+    for(int retry=0 ; retry <= SQUIGGLE_BAND_RETRIES ; retry++){
+        const float score = squiggle_match_viterbi_width(signal, rate, params, prob_back, local_pen,
+                                                         skip_pen, minscore, width, path_padded,
+                                                         &touches_edge);
+        if(!touches_edge || width == npos || !isfinite(score)){
+            return score;
+        }
+        width = (2 * width < npos) ? 2 * width : npos;
+    }
+
+    return squiggle_match_viterbi_width(signal, rate, params, prob_back, local_pen, skip_pen,
+                                        minscore, npos, path_padded, &touches_edge);
+}
+
+
 /**  Score a signal against a predicted squiggle using variant of dynamic time-warping
  *
  *   Uses a local mapping so not all of signal may be mapped and not every position of the
@@ -1440,6 +2734,24 @@ clean:
  **/
 float squiggle_match_forward(const raw_table signal, float rate, const_scrappie_matrix params,
                              float prob_back, float local_pen, float skip_pen, float minscore){
+    return squiggle_match_forward_banded(signal, rate, params, prob_back, local_pen, skip_pen,
+                                         minscore, 0);
+}
+
+
+/**  Score a signal against a predicted squiggle, restricting the match to a moving band
+ *
+ *   As `squiggle_match_forward` but only states within a band that follows the
+ *   match are considered, see `squiggle_match_viterbi_banded`.
+ *
+ *   @param band Width of band.  Zero, or a width larger than the squiggle, is a
+ *   full mapping identical to `squiggle_match_forward`
+ *
+ *   @returns score
+ **/
+float squiggle_match_forward_banded(const raw_table signal, float rate, const_scrappie_matrix params,
+                                    float prob_back, float local_pen, float skip_pen, float minscore,
+                                    size_t band){
     RETURN_NULL_IF(NULL == signal.raw, NAN);
     RETURN_NULL_IF(NULL == params, NAN);
     assert(signal.start < signal.end);
@@ -1451,119 +2763,125 @@ float squiggle_match_forward(const raw_table signal, float rate, const_scrappie_
 
     const float * rawsig = signal.raw + signal.start;
     const size_t nsample = signal.end - signal.start;
-    const size_t ldp = params->stride;
     const size_t npos = params->nc;
     const size_t nfstate = npos + 2;
     const size_t nstate = npos + nfstate;
+    const size_t width = (0 == band || band > npos) ? npos : band;
 
     const float move_back_pen = logf(prob_back);
     const float stay_in_back_pen = logf(0.5f);
     const float move_from_back_pen = logf(0.5f);
 
-    float * move_pen = calloc(nfstate, sizeof(float));
-    float * fwd = calloc(2 * nstate, sizeof(float));
-    float * scale = calloc(npos, sizeof(float));
-    float * stay_pen = calloc(nfstate, sizeof(float));
-    if(NULL == move_pen || NULL == fwd || NULL == scale ||
-       NULL == stay_pen){
-        goto clean;
-    }
-
-    for(size_t pos=0 ; pos < npos ; pos++){
-        //  Create array of scales
-        scale[pos] = expf(params->data.f[pos * ldp + 1]);
+    struct squiggle_match_params smp;
+    if(!squiggle_match_params_init(params, rate, prob_back, &smp)){
+        return NAN;
     }
+    const float * move_pen = smp.move_pen;
+    const float * stay_pen = smp.stay_pen;
 
-    {
-        const float lograte = logf(rate);
-        float mean_move_pen = 0.0f;
-        float mean_stay_pen = 0.0f;
-        for(size_t pos=0 ; pos < npos ; pos++){
-            const float mp = (1.0f - prob_back) * plogisticf(params->data.f[pos * ldp + 2] + lograte);
-            move_pen[pos + 1] = logf(mp);
-            stay_pen[pos + 1] = log1pf(-mp - prob_back);
-            mean_move_pen += move_pen[pos + 1];
-            mean_stay_pen += stay_pen[pos + 1];
-        }
-        mean_move_pen /= npos;
-        mean_stay_pen /= npos;
-
-        move_pen[0] = mean_move_pen;
-        move_pen[nfstate - 1] = mean_move_pen;
-        stay_pen[0] = mean_stay_pen;
-        stay_pen[nfstate - 1] = mean_stay_pen;
+    float * fwd = calloc(2 * nstate, sizeof(float));
+    float * emission = NULL;
+    if(NULL == fwd || 0 != scrappie_memalign((void **)&emission, 16, (width + 8) * sizeof(float))){
+        goto clean;
     }
 
-    for(size_t st=0 ; st < nstate ; st++){
+    for(size_t st=0 ; st < 2 * nstate ; st++){
         // States are start .. positions .. end
         fwd[st] = -LARGE_VAL;
     }
     // Must begin in start state
     fwd[0] = 0.0;
 
+    struct squiggle_band sband = squiggle_band_init(npos, width, nsample, smp.move_prob);
+    size_t buf_lo[2] = {0, 0};
 
     for(size_t sample=0 ; sample < nsample ; sample++){
-        const size_t fwd_prev_off = (sample % 2) * nstate;
-        const size_t fwd_curr_off = ((sample + 1) % 2) * nstate;
-
-        for(size_t st=0 ; st < nfstate ; st++){
-            //  Stay in start, end or normal position
-            fwd[fwd_curr_off + st] = fwd[fwd_prev_off + st] + stay_pen[st];
-        }
-        for(size_t st=0 ; st < npos ; st++){
+        float * fprev = fwd + (sample % 2) * nstate;
+        float * fcurr = fwd + ((sample + 1) % 2) * nstate;
+        const size_t lo = sband.lo;
+        const size_t hi = lo + width;
+        const size_t prev_lo = buf_lo[sample % 2];
+        const size_t prev_hi = prev_lo + width;
+
+        squiggle_band_clear(fcurr, buf_lo[(sample + 1) % 2], lo, width, nfstate);
+        buf_lo[(sample + 1) % 2] = lo;
+
+        //  Stay in start, end or normal position
+        fcurr[0] = fprev[0] + stay_pen[0];
+        fcurr[nfstate - 1] = fprev[nfstate - 1] + stay_pen[nfstate - 1];
+        for(size_t pos=lo ; pos < hi ; pos++){
+            fcurr[pos + 1] = fprev[pos + 1] + stay_pen[pos + 1];
+        }
+        for(size_t pos=lo ; pos < hi ; pos++){
             //  Stay in back position
-            const size_t idx = nfstate + st;
-            fwd[fwd_curr_off + idx] = fwd[fwd_prev_off + idx] + stay_in_back_pen;
+            const size_t idx = nfstate + pos;
+            fcurr[idx] = fprev[idx] + stay_in_back_pen;
         }
-        for(size_t st=1 ; st < nfstate ; st++){
+        for(size_t pos=lo ; pos < hi ; pos++){
             //  Move to next position
-            const float step_score = fwd[fwd_prev_off + st - 1] + move_pen[st - 1];
-            fwd[fwd_curr_off + st] = logsumexpf(fwd[fwd_curr_off + st], step_score);
+            const size_t st = pos + 1;
+            const float step_score = fprev[st - 1] + move_pen[st - 1];
+            fcurr[st] = logsumexpf(fcurr[st], step_score);
+        }
+        {
+            const size_t st = nfstate - 1;
+            const float step_score = fprev[st - 1] + move_pen[st - 1];
+            fcurr[st] = logsumexpf(fcurr[st], step_score);
         }
-        for(size_t st=2 ; st < nfstate ; st++){
+        for(size_t pos=(lo > 1) ? lo : 1 ; pos < hi ; pos++){
             //  Skip to next position
-            const float skip_score = fwd[fwd_prev_off + st - 2] + move_pen[st - 2] - skip_pen;
-            fwd[fwd_curr_off + st] = logsumexpf(fwd[fwd_curr_off + st], skip_score);
+            const size_t st = pos + 1;
+            const float skip_score = fprev[st - 2] + move_pen[st - 2] - skip_pen;
+            fcurr[st] = logsumexpf(fcurr[st], skip_score);
         }
-        for(size_t destpos=1 ; destpos < npos ; destpos++){
+        {
+            const size_t st = nfstate - 1;
+            const float skip_score = fprev[st - 2] + move_pen[st - 2] - skip_pen;
+            fcurr[st] = logsumexpf(fcurr[st], skip_score);
+        }
+        for(size_t destpos=(lo > 1) ? lo : 1 ; destpos < hi ; destpos++){
             const size_t destst = destpos + 1;
             //  Move from start into sequence
-            const float score = fwd[fwd_prev_off] + move_pen[0] - local_pen * destpos;
-            fwd[fwd_curr_off + destst] = logsumexpf(fwd[fwd_curr_off + destst], score);
+            const float score = fprev[0] + move_pen[0] - local_pen * destpos;
+            fcurr[destst] = logsumexpf(fcurr[destst], score);
         }
-        for(size_t origpos=0 ; origpos < (npos - 1) ; origpos++){
+        for(size_t origpos=prev_lo ; origpos < prev_hi && origpos < (npos - 1) ; origpos++){
+            //  Positions outside of previous band have score -LARGE_VAL
             const size_t destst = nfstate - 1;
             const size_t origst = origpos + 1;
             const size_t deltapos = npos - 1 - origpos;
             //  Move from sequence into end
-            const float score = fwd[fwd_prev_off + origst] + move_pen[origst] - local_pen * deltapos;
-            fwd[fwd_curr_off + destst] = logsumexpf(fwd[fwd_curr_off + destst], score);
+            const float score = fprev[origst] + move_pen[origst] - local_pen * deltapos;
+            fcurr[destst] = logsumexpf(fcurr[destst], score);
         }
-        for(size_t st=1 ; st < npos ; st++){
+        for(size_t pos=lo ; pos < hi && pos < (npos - 1) ; pos++){
             // Move to back
-            const float back_score = fwd[fwd_prev_off + st + 1] + move_back_pen;
-            fwd[fwd_curr_off + nfstate + st - 1] = logsumexpf(fwd[fwd_curr_off + nfstate + st - 1], back_score);
+            const float back_score = fprev[pos + 2] + move_back_pen;
+            fcurr[nfstate + pos] = logsumexpf(fcurr[nfstate + pos], back_score);
         }
-        for(size_t st=1 ; st < npos ; st++){
+        for(size_t pos=(lo > 1) ? lo : 1 ; pos < hi ; pos++){
             // Move from back
-            const float back_score = fwd[fwd_prev_off + nfstate + st - 1] + move_from_back_pen;
-            fwd[fwd_curr_off + st + 1] = logsumexpf(fwd[fwd_curr_off + st + 1], back_score);
+            const float back_score = fprev[nfstate + pos - 1] + move_from_back_pen;
+            fcurr[pos + 1] = logsumexpf(fcurr[pos + 1], back_score);
         }
 
-        for(size_t pos=0 ; pos < npos ; pos++){
+        {
             //  Add on score for samples
-            const float location = params->data.f[pos * ldp + 0];
-            const float logscale = params->data.f[pos * ldp + 1];
-            const float logscore = fmaxf(-minscore, loglaplace(rawsig[sample], location, scale[pos], logscale));
-            //  State to add to is offset by one because of start state
-            fwd[fwd_curr_off + pos + 1] += logscore;
-            fwd[fwd_curr_off + nfstate + pos] += logscore;
+            const size_t offset = lo % 4;
+            squiggle_match_emissions(rawsig[sample], &smp, lo - offset, width + offset, minscore, emission);
+            const float * em = emission + offset;
+            for(size_t pos=lo ; pos < hi ; pos++){
+                //  State to add to is offset by one because of start state
+                fcurr[pos + 1] += em[pos - lo];
+                fcurr[nfstate + pos] += em[pos - lo];
+            }
         }
 
         // Score for start and end states
-        fwd[fwd_curr_off + 0] -= local_pen;
-        fwd[fwd_curr_off + nfstate - 1] -= local_pen;
+        fcurr[0] -= local_pen;
+        fcurr[nfstate - 1] -= local_pen;
 
+        squiggle_band_update(&sband, smp.move_prob);
     }
 
     //  Score of best path and final states.  Could be either last position or end state
@@ -1571,10 +2889,9 @@ float squiggle_match_forward(const raw_table signal, float rate, const_scrappie_
     final_score = logsumexpf(fwd[fwd_offset + nfstate - 2], fwd[fwd_offset + nfstate - 1]);
 
 clean:
-    free(stay_pen);
-    free(scale);
+    free(emission);
     free(fwd);
-    free(move_pen);
+    free_squiggle_match_params(&smp);
 
     return final_score;
 }
@@ -1872,6 +3189,9 @@ bool are_bounds_sane(size_t const * low, size_t const * high, size_t nblock, siz
  *
  *   Local-Global mapping through sequence calculating scores of best path from basecall posterior (banded)
  *
+ *   The recursion is that of map_to_sequence_viterbi restricted to the band, so the two agree whenever
+ *   the best path lies inside the band.  Traceback is only stored for positions inside the band.
+ *
  *   @param logpost   Log posterior probability of state at each block.  Stay is last state.
  *   @param stay_pen  Penalty for staying
  *   @param skip_pen  Penalty for skipping
@@ -1879,11 +3199,13 @@ bool are_bounds_sane(size_t const * low, size_t const * high, size_t nblock, siz
  *   @param seq       Sequence encoded into same history states as basecalls
  *   @param seqlen    Length of seq
  *   @param poslow, poshigh  Arrays of lowest and highest coordinate for each block. Low inclusive, high exclusive
+ *   @param path      Viterbi path [out].  If NULL, no path is returned
  *
  *   @returns score
  **/
 float map_to_sequence_viterbi_banded(const_scrappie_matrix logpost, float stay_pen, float skip_pen, float local_pen,
-                                     int const *seq, size_t seqlen, size_t const * poslow, size_t const * poshigh){
+                                     int const *seq, size_t seqlen, size_t const * poslow, size_t const * poshigh,
+                                     int * path){
     float logscore = NAN;
     RETURN_NULL_IF(NULL == logpost, logscore);
     RETURN_NULL_IF(NULL == seq, logscore);
@@ -1898,14 +3220,34 @@ float map_to_sequence_viterbi_banded(const_scrappie_matrix logpost, float stay_p
     const size_t START_STATE = seqlen;
     const size_t END_STATE = seqlen + 1;
 
+    //  Moves stored in traceback
+    enum {MOVE_STAY = 0, MOVE_STEP, MOVE_SKIP, MOVE_FROM_START};
+
 
     // Verify assumptions about bounds
     RETURN_NULL_IF(!are_bounds_sane(poslow, poshigh, nblock, seqlen), logscore);
 
-    // Memeory. First state is stay in previous position
+    // Memory.  Traceback for block blk starts at tboffset[blk]
     float * cscore = calloc(nseqstate, sizeof(float));
     float * pscore = calloc(nseqstate, sizeof(float));
-    if(NULL == cscore || NULL == pscore){
+    size_t * tboffset = NULL;
+    uint8_t * traceback = NULL;
+    uint8_t * endtrace = NULL;
+    if(NULL != path){
+        tboffset = calloc(nblock + 1, sizeof(size_t));
+        if(NULL != tboffset){
+            for(size_t blk=0 ; blk < nblock ; blk++){
+                tboffset[blk + 1] = tboffset[blk] + poshigh[blk] - poslow[blk];
+            }
+            traceback = calloc(tboffset[nblock] + 1, sizeof(uint8_t));
+        }
+        endtrace = calloc(nblock, sizeof(uint8_t));
+    }
+    if(NULL == cscore || NULL == pscore ||
+       (NULL != path && (NULL == tboffset || NULL == traceback || NULL == endtrace))){
+        free(endtrace);
+        free(traceback);
+        free(tboffset);
         free(pscore);
         free(cscore);
         return logscore;
@@ -1914,41 +3256,19 @@ float map_to_sequence_viterbi_banded(const_scrappie_matrix logpost, float stay_p
 
     //  Initialise
     for(size_t pos=0 ; pos < nseqstate ; pos++){
-        pscore[pos] = -BIG_FLOAT;
         cscore[pos] = -BIG_FLOAT;
     }
-    pscore[START_STATE] = 0.0;
+    cscore[START_STATE] = 0.0;
 
     // Forwards Viterbi
-    {  // First block
-        // Stay in start state (local penalty or stay)
-        cscore[START_STATE] = pscore[START_STATE] + fmaxf(-local_pen, logpost->data.f[STAY]);
-        // Stay in end state (local penalty or stay)
-        cscore[END_STATE] = pscore[END_STATE] + fmaxf(-local_pen, logpost->data.f[STAY]);
-
-        cscore[0] = fmaxf(cscore[0], pscore[0] + logpost->data.f[STAY] - stay_pen);
-        if(poshigh[0] > 0){
-            // Step
-            const size_t stepto = seq[1];
-            const float step_score = logpost->data.f[stepto];
-            cscore[1] = step_score;
-        }
-        if(poshigh[0] > 1){
-            // Skip
-            const size_t stepto = seq[2];
-            const float skip_score = logpost->data.f[stepto] - skip_pen;
-            cscore[2] = skip_score;
-        }
-        // Move directly from start to end without mapping -- always allow
-        cscore[END_STATE] = fmaxf(cscore[END_STATE], pscore[START_STATE] - local_pen);
-        // Move from start into sequence -- lower bound for first block must be zero
-        cscore[0] = fmaxf(cscore[0], pscore[START_STATE] + logpost->data.f[seq[0]]);
-        // Move from sequence into end
-        cscore[END_STATE] = fmaxf(cscore[END_STATE], pscore[seqlen - 1] - local_pen);
-    }
-
-    for(size_t blk=1 ; blk < nblock ; blk++){
+    for(size_t blk=0 ; blk < nblock ; blk++){
         const size_t lpoffset = blk * logpost->stride;
+        //  Band of previous block.  Nothing but the start state is occupied before the first block
+        const size_t plow = (blk > 0) ? poslow[blk - 1] : 0;
+        const size_t phigh = (blk > 0) ? poshigh[blk - 1] : 0;
+        const size_t low = poslow[blk];
+        const size_t high = poshigh[blk];
+        uint8_t * tb = (NULL != path) ? (traceback + tboffset[blk]) : NULL;
         {   // Swap vectors
             float * tmp = pscore;
             pscore = cscore;
@@ -1960,44 +3280,104 @@ float map_to_sequence_viterbi_banded(const_scrappie_matrix logpost, float stay_p
         // Stay in end state (local penalty or stay)
         cscore[END_STATE] = pscore[END_STATE] + fmaxf(-local_pen, logpost->data.f[lpoffset + STAY]);
 
+        for(size_t pos=low ; pos < high ; pos++){
+            //  Unreachable positions trace back to start
+            cscore[pos] = -BIG_FLOAT;
+            if(NULL != tb){
+                tb[pos - low] = MOVE_FROM_START;
+            }
+        }
 
-        for(size_t pos=poslow[blk] ; pos < poshigh[blk - 1] ; pos++){
-            //  Stay
+        for(size_t pos=imax(low, plow) ; pos < imin(high, phigh) ; pos++){
+            //  Stay in ordinary state
             cscore[pos] = pscore[pos] - stay_pen + logpost->data.f[lpoffset + STAY];
+            if(NULL != tb){
+                tb[pos - low] = MOVE_STAY;
+            }
         }
 
-        const size_t min_step_idx = imax(poslow[blk], poslow[blk - 1] + 1);
-        const size_t max_step_idx = imin(poshigh[blk], poshigh[blk - 1] + 1);
-        for(size_t pos=min_step_idx ; pos < max_step_idx ; pos++){
-            // step -- pos is position going _to_
-            const size_t stepto = seq[pos];
-            const float step_score = pscore[pos - 1] + logpost->data.f[lpoffset + stepto];
-            cscore[pos] = fmaxf(step_score, cscore[pos]);
+        for(size_t pos=imax(low, plow + 1) ; pos < imin(high, phigh + 1) ; pos++){
+            //  Step
+            const size_t newstate = seq[pos];
+            const float step_score = pscore[pos - 1] + logpost->data.f[lpoffset + newstate];
+            if(step_score > cscore[pos]){
+                cscore[pos] = step_score;
+                if(NULL != tb){
+                    tb[pos - low] = MOVE_STEP;
+                }
+            }
         }
 
-        const size_t min_skip_idx = imax(poslow[blk], poslow[blk - 1] + 2);
-        const size_t max_skip_idx = imin(poshigh[blk], poshigh[blk - 1] + 2);
-        for(size_t pos=min_skip_idx ; pos < max_skip_idx ; pos++){
-            // skip -- pos is position going _to_
-            const size_t skipto = seq[pos];
-            const float skip_score = pscore[pos - 2] - skip_pen
-                                   + logpost->data.f[lpoffset + skipto];
-            cscore[pos] = fmaxf(skip_score, cscore[pos]);
+        for(size_t pos=imax(low, plow + 2) ; pos < imin(high, phigh + 2) ; pos++){
+            //  Skip
+            const size_t newstate = seq[pos];
+            const float skip_score = pscore[pos - 2] - skip_pen + logpost->data.f[lpoffset + newstate];
+            if(skip_score > cscore[pos]){
+                cscore[pos] = skip_score;
+                if(NULL != tb){
+                    tb[pos - low] = MOVE_SKIP;
+                }
+            }
         }
 
-        // Move directly from start to end without mapping -- always allow
-        //cscore[END_STATE] = fmaxf(cscore[END_STATE], pscore[START_STATE] - local_pen);
-        // Move from start into sequence -- only allowed if lower bound is zero
-        if(0 == poslow[blk]){
-            cscore[0] = fmaxf(cscore[0], pscore[START_STATE] + logpost->data.f[lpoffset + seq[0]]);
+        // Move from start into sequence -- only allowed if first position is in band
+        if(0 == low && high > 0
+           && pscore[START_STATE] + logpost->data.f[lpoffset + seq[0]] > cscore[0]){
+            cscore[0] = pscore[START_STATE] + logpost->data.f[lpoffset + seq[0]];
+            if(NULL != tb){
+                tb[0] = MOVE_FROM_START;
+            }
+        }
+        // Move from sequence into end -- only allowed if last position was in band
+        if(NULL != path){
+            endtrace[blk] = MOVE_STAY;
+        }
+        if(phigh == seqlen && plow < seqlen && pscore[seqlen - 1] - local_pen > cscore[END_STATE]){
+            cscore[END_STATE] = pscore[seqlen - 1] - local_pen;
+            if(NULL != path){
+                endtrace[blk] = MOVE_STEP;
+            }
         }
-        // Move from sequence into end
-        cscore[END_STATE] = fmaxf(cscore[END_STATE], pscore[seqlen - 1] - local_pen);
     }
 
+    //  The last block always has seqlen as an upper bound
+    const bool end_in_seq = (poslow[nblock - 1] < seqlen) && (cscore[seqlen - 1] > cscore[END_STATE]);
+    logscore = end_in_seq ? cscore[seqlen - 1] : cscore[END_STATE];
 
-    logscore = fmax(cscore[seqlen - 1], cscore[END_STATE]);
+    if(NULL != path){
+        size_t state = end_in_seq ? (seqlen - 1) : END_STATE;
+        for(size_t blk=nblock ; blk > 0 ; blk--){
+            path[blk - 1] = state;
+            if(END_STATE == state){
+                state = (MOVE_STEP == endtrace[blk - 1]) ? (seqlen - 1) : END_STATE;
+            } else if(START_STATE != state){
+                switch(traceback[tboffset[blk - 1] + state - poslow[blk - 1]]){
+                case MOVE_STAY:
+                    break;
+                case MOVE_STEP:
+                    state -= 1;
+                    break;
+                case MOVE_SKIP:
+                    state -= 2;
+                    break;
+                case MOVE_FROM_START:
+                    state = START_STATE;
+                    break;
+                default:
+                    assert(false);
+                }
+            }
+        }
+        for(size_t blk=0 ; blk < nblock ; blk++){
+            if(START_STATE == path[blk] || END_STATE == path[blk]){
+                path[blk] = -1;
+            }
+        }
+    }
 
+    free(endtrace);
+    free(traceback);
+    free(tboffset);
     free(pscore);
     free(cscore);
 
@@ -2,8 +2,10 @@
 #ifndef DECODE_H
 #    define DECODE_H
 #    include <stdbool.h>
+#    include "homopolymer.h"
 #    include "scrappie_matrix.h"
 #    include "scrappie_structures.h"
+#    include "sparse_posterior.h"
 
 typedef struct {
     float scale;
@@ -12,7 +14,22 @@ typedef struct {
 
 float decode_transducer(const_scrappie_matrix logpost, float stay_pen, float skip_pen,
                         float local_pen, int *seq, bool allow_slip);
+float decode_transducer_checkpointed(const_scrappie_matrix logpost, float stay_pen, float skip_pen,
+                                     float local_pen, int *seq, bool allow_slip);
+float decode_transducer_pruned(const_scrappie_matrix logpost, float stay_pen, float skip_pen,
+                               float local_pen, float beam, size_t max_states, int *seq,
+                               bool allow_slip);
+float decode_transducer_sparse(const_sparse_posterior post, float stay_pen, float skip_pen,
+                               float local_pen, int *seq, bool allow_slip);
+float decode_transducer_fixed(const_scrappie_matrix logpost, float stay_pen, float skip_pen,
+                              float local_pen, int *seq, bool allow_slip);
+char *decode_transducer_basecall(const_scrappie_matrix logpost, float stay_pen, float skip_pen,
+                                 float local_pen, bool allow_slip,
+                                 enum homopolymer_calculation homopolymer, int *seq, int *pos,
+                                 float *score);
 char *overlapper(const int *seq, size_t n, int nkmer, int *pos);
+char *homopolymer_overlapper(const_scrappie_matrix logpost, int *seq,
+                             enum homopolymer_calculation homopolymer, int *pos);
 char *homopolymer_dwell_correction(const event_table et, const int *seq,
                                    size_t nstate, size_t basecall_len);
 char *dwell_corrected_overlapper(const int *seq, const int *dwell, int n,
@@ -25,8 +42,16 @@ float argmax_decoder(const_scrappie_matrix logpost, int *seq);
 char *ctc_remove_stays_and_repeats(const int *seq, size_t n, int *pos);
 
 float decode_crf(const_scrappie_matrix trans, int * path);
+float decode_crf_checkpointed(const_scrappie_matrix trans, int * path);
+//  Longest run of a base called by decode_crf5_bounded_homopolymer
+#define CRF5_MAX_HOMOPOLYMER 3
+float decode_crf5(const_scrappie_matrix trans, int * path);
+float decode_crf5_no_repeat(const_scrappie_matrix trans, int * path);
+float decode_crf5_bounded_homopolymer(const_scrappie_matrix trans, int * path);
 scrappie_matrix posterior_crf(const_scrappie_matrix trans);
 char * crfpath_to_basecall(int const * path, size_t npos, int * pos);
+float decode_crf_quality(const_scrappie_matrix trans, int * path, float * perr);
+char * crfpath_to_quality(int const * path, float const * perr, size_t npos);
 
 float squiggle_match_viterbi(const raw_table signal, float rate, const_scrappie_matrix params,
                              float prob_back, float local_pen, float skip_pen, float minscore,
@@ -34,16 +59,24 @@ float squiggle_match_viterbi(const raw_table signal, float rate, const_scrappie_
 
 float squiggle_match_forward(const raw_table signal, float rate, const_scrappie_matrix params,
                              float prob_back, float local_pen, float skip_pen, float minscore);
+float squiggle_match_viterbi_banded(const raw_table signal, float rate, const_scrappie_matrix params,
+                                    float prob_back, float local_pen, float skip_pen, float minscore,
+                                    size_t band, int32_t * path_padded);
+float squiggle_match_forward_banded(const raw_table signal, float rate, const_scrappie_matrix params,
+                                    float prob_back, float local_pen, float skip_pen, float minscore,
+                                    size_t band);
 
 
 bool are_bounds_sane(size_t const * low, size_t const * high, size_t nblock, size_t seqlen);
 float map_to_sequence_viterbi(const_scrappie_matrix logpost, float stay_pen, float skip_pen,
                               float local_pen, int const *seq, size_t seqlen, int * path);
+float map_to_sequence_viterbi_fixed(const_scrappie_matrix logpost, float stay_pen, float skip_pen,
+                                    float local_pen, int const *seq, size_t seqlen, int * path);
 float map_to_sequence_forward(const_scrappie_matrix logpost, float stay_pen, float skip_pen,
                               float local_pen, int const *seq, size_t seqlen);
 float map_to_sequence_viterbi_banded(const_scrappie_matrix logpost, float stay_pen, float skip_pen,
                                      float local_pen, int const *seq, size_t seqlen,
-                                     size_t const * poslow, size_t const * poshigh);
+                                     size_t const * poslow, size_t const * poshigh, int * path);
 float map_to_sequence_forward_banded(const_scrappie_matrix logpost, float stay_pen, float skip_pen,
                                      float local_pen, int const *seq, size_t seqlen,
                                      size_t const * poslow, size_t const * poshigh);
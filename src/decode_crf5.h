@@ -0,0 +1,106 @@
+#pragma once
+#ifndef DECODE_CRF5_H
+#    define DECODE_CRF5_H
+
+/**  Viterbi decoders of the 5-state CRF specialised at compile time
+ *
+ *   A constraint on the sequence called is a policy: a space of states that
+ *   expands those of the CRF, bases ACGT then blank, by what must be
+ *   remembered to apply the constraint, such as the last base emitted.  A
+ *   policy NAME is four definitions, visible where the decoder is defined:
+ *
+ *     NAME##_NSTATE          Number of expanded states, at most 256
+ *     NAME##_crf(e)          CRF state of expanded state e
+ *     NAME##_next(e, st)     Expanded state entered from e by a transition
+ *                            into CRF state st, or -1 if it is forbidden
+ *     NAME##_start(e)        Whether a path may start in e
+ *
+ *   CRF5_DEFINE_DECODER(NAME) then defines
+ *
+ *     static float NAME##_decode(const_scrappie_matrix trans, int * path)
+ *
+ *   with the arguments and result of decode_crf, the path being of CRF
+ *   states.  The functions of the policy must be pure functions of their
+ *   arguments, so with the number of states fixed every loop of a block has
+ *   a constant trip count and is unrolled: each block is a fixed sequence of
+ *   additions and selections on registers, forbidden transitions removed
+ *   at compile time.  Source states are visited in increasing order and
+ *   only a strictly better score replaces the best so far, as decode_crf.
+ *   The traceback is read without branches.
+ *
+ *   Paths are scored by the transitions of the CRF alone; the expanded
+ *   states only forbid paths.
+ **/
+
+#    include <math.h>
+#    include <stdint.h>
+#    include <stdlib.h>
+#    include <string.h>
+#    include "scrappie_matrix.h"
+#    include "scrappie_stdlib.h"
+
+#    define CRF5_NSTATE 5
+#    define CRF5_BLANK 4
+
+#    define CRF5_UNROLL _Pragma("GCC unroll 256")
+
+#    define CRF5_DEFINE_DECODER(NAME) \
+static inline void NAME##_step(float const * t, float const * prev, float * curr, uint8_t * tb) { \
+    CRF5_UNROLL \
+    for (int e = 0; e < NAME##_NSTATE; e++) { \
+        curr[e] = -INFINITY; \
+        tb[e] = 0; \
+    } \
+    CRF5_UNROLL \
+    for (int e = 0; e < NAME##_NSTATE; e++) { \
+        const int from = NAME##_crf(e); \
+        CRF5_UNROLL \
+        for (int st = 0; st < CRF5_NSTATE; st++) { \
+            const int e2 = NAME##_next(e, st); \
+            if (e2 < 0) { \
+                continue; \
+            } \
+            const float score = t[st * CRF5_NSTATE + from] + prev[e]; \
+            const int better = score > curr[e2]; \
+            curr[e2] = better ? score : curr[e2]; \
+            tb[e2] = better ? e : tb[e2]; \
+        } \
+    } \
+} \
+\
+static float NAME##_decode(const_scrappie_matrix trans, int * path) { \
+    RETURN_NULL_IF(NULL == trans, NAN); \
+    RETURN_NULL_IF(NULL == path, NAN); \
+    RETURN_NULL_IF(CRF5_NSTATE * CRF5_NSTATE != trans->nr, NAN); \
+    const size_t nblk = trans->nc; \
+    uint8_t * tb = calloc(NAME##_NSTATE * nblk + 1, sizeof(uint8_t)); \
+    RETURN_NULL_IF(NULL == tb, NAN); \
+\
+    float score[NAME##_NSTATE]; \
+    float next[NAME##_NSTATE]; \
+    CRF5_UNROLL \
+    for (int e = 0; e < NAME##_NSTATE; e++) { \
+        score[e] = NAME##_start(e) ? 0.0f : -INFINITY; \
+    } \
+    for (size_t blk = 0; blk < nblk; blk++) { \
+        NAME##_step(trans->data.f + blk * trans->stride, score, next, tb + blk * NAME##_NSTATE); \
+        memcpy(score, next, sizeof(score)); \
+    } \
+\
+    int best = 0; \
+    CRF5_UNROLL \
+    for (int e = 1; e < NAME##_NSTATE; e++) { \
+        best = (score[e] > score[best]) ? e : best; \
+    } \
+    const float total = score[best]; \
+    for (size_t blk = nblk; blk > 0; blk--) { \
+        path[blk] = NAME##_crf(best); \
+        best = tb[(blk - 1) * NAME##_NSTATE + best]; \
+    } \
+    path[0] = NAME##_crf(best); \
+\
+    free(tb); \
+    return total; \
+}
+
+#endif                          /* DECODE_CRF5_H */
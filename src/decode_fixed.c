@@ -0,0 +1,601 @@
+//  Viterbi decoding and mapping using 16-bit fixed-point scores
+//
+//  Scores are stored as saturating 16-bit integers, in units of
+//  1 / FIXED_SCALE nats, and renormalised every block so the best state has
+//  score zero.  Eight states are processed per SSE2 instruction rather than
+//  the four of the floating point decoders.  Only the choice of path is made
+//  in fixed-point; the score returned is recalculated for that path in
+//  floating point with the same expressions as the floating point decoders.
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "decode.h"
+#include "scrappie_stdlib.h"
+#include "util.h"
+
+#ifndef __SSE2__
+#    error "Compilation of function decode_transducer_fixed requires a processor that supports at least SSE2"
+#endif
+
+//  Steps per nat.  Scores more than INT16_MAX / FIXED_SCALE nats below the
+//  best state of a block saturate.
+#define FIXED_SCALE 64.0f
+#define FIXED_VEC 8
+#define BIG_FLOAT 1.e30f
+
+typedef int16_t fixed_t;
+
+
+static inline fixed_t quantise_score(float x) {
+    const float q = rintf(x * FIXED_SCALE);
+    if (q <= INT16_MIN) {
+        return INT16_MIN;
+    }
+    if (q >= INT16_MAX) {
+        return INT16_MAX;
+    }
+    return (fixed_t)q;
+}
+
+static inline fixed_t saturate_score(int32_t x) {
+    if (x <= INT16_MIN) {
+        return INT16_MIN;
+    }
+    if (x >= INT16_MAX) {
+        return INT16_MAX;
+    }
+    return (fixed_t)x;
+}
+
+/**  Quantise column of log posterior
+ *
+ *   @param x Column to quantise, aligned [nrq * 4]
+ *   @param nrq  Number of vectors of four floats in x
+ *   @param q Quantised column [out, aligned, at least 2 * ceil(nrq / 2) * 4]
+ **/
+static void quantise_column(const __m128 * x, size_t nrq, __m128i * q) {
+    const __m128 scale = _mm_set1_ps(FIXED_SCALE);
+    for (size_t i = 0; i < nrq; i += 2) {
+        const __m128i lo = _mm_cvtps_epi32(_mm_mul_ps(x[i], scale));
+        const __m128i hi = (i + 1 < nrq) ? _mm_cvtps_epi32(_mm_mul_ps(x[i + 1], scale))
+                                         : _mm_set1_epi32(INT16_MIN);
+        q[i / 2] = _mm_packs_epi32(lo, hi);
+    }
+}
+
+static inline fixed_t hmax_epi16(__m128i x) {
+    x = _mm_max_epi16(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2)));
+    x = _mm_max_epi16(x, _mm_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1)));
+    x = _mm_max_epi16(x, _mm_shufflelo_epi16(x, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (fixed_t)_mm_extract_epi16(x, 0);
+}
+
+static inline __m128i blend_epi16(__m128i mask, __m128i x, __m128i y) {
+    //  Select y where mask is set, x otherwise
+    return _mm_or_si128(_mm_andnot_si128(mask, x), _mm_and_si128(mask, y));
+}
+
+/**  Maximum of scores over prefixes of history states
+ *
+ *   tmp[j] = max_r score[r * n + j] for r < nprefix, with itmp[j] the state
+ *   achieving the maximum.  The lowest such state is taken on ties.
+ **/
+static void fixed_prefix_max(const fixed_t * score, size_t n, size_t nprefix, fixed_t * tmp,
+                             fixed_t * itmp) {
+    if (0 == n % FIXED_VEC) {
+        const __m128i c01234567 = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+        for (size_t j = 0; j < n; j += FIXED_VEC) {
+            __m128i best = _mm_load_si128((const __m128i *)(score + j));
+            const __m128i idx0 = _mm_add_epi16(c01234567, _mm_set1_epi16(j));
+            __m128i ibest = idx0;
+            for (size_t r = 1; r < nprefix; r++) {
+                const __m128i cand = _mm_load_si128((const __m128i *)(score + r * n + j));
+                const __m128i mask = _mm_cmpgt_epi16(cand, best);
+                best = _mm_max_epi16(best, cand);
+                ibest = blend_epi16(mask, ibest, _mm_add_epi16(idx0, _mm_set1_epi16(r * n)));
+            }
+            _mm_store_si128((__m128i *)(tmp + j), best);
+            _mm_store_si128((__m128i *)(itmp + j), ibest);
+        }
+    } else {
+        for (size_t j = 0; j < n; j++) {
+            tmp[j] = score[j];
+            itmp[j] = j;
+            for (size_t r = 1; r < nprefix; r++) {
+                if (score[r * n + j] > tmp[j]) {
+                    tmp[j] = score[r * n + j];
+                    itmp[j] = r * n + j;
+                }
+            }
+        }
+    }
+}
+
+/**  Apply moves from prefix maxima into history states
+ *
+ *   State st may be entered from the state itmp[st / nsuffix] with score
+ *   tmp[st / nsuffix] + qpost[st] - pen.
+ **/
+static void fixed_apply_moves(const fixed_t * tmp, const fixed_t * itmp, size_t nhistory,
+                              size_t nsuffix, fixed_t pen, const fixed_t * qpost, fixed_t * score,
+                              fixed_t * tb) {
+    const __m128i penv = _mm_set1_epi16(pen);
+    __m128i * scorev = (__m128i *)score;
+    __m128i * tbv = (__m128i *)tb;
+    const __m128i * qpostv = (const __m128i *)qpost;
+    if (4 == nsuffix && (nhistory / 4) % FIXED_VEC == 0) {
+        //  Broadcast each prefix maximum to its four suffixes by unpacking
+        for (size_t j = 0; j < nhistory / 4; j += FIXED_VEC) {
+            const __m128i t = _mm_load_si128((const __m128i *)(tmp + j));
+            const __m128i it = _mm_load_si128((const __m128i *)(itmp + j));
+            const __m128i tlo = _mm_unpacklo_epi16(t, t);
+            const __m128i thi = _mm_unpackhi_epi16(t, t);
+            const __m128i itlo = _mm_unpacklo_epi16(it, it);
+            const __m128i ithi = _mm_unpackhi_epi16(it, it);
+            const __m128i bt[4] = {_mm_unpacklo_epi32(tlo, tlo), _mm_unpackhi_epi32(tlo, tlo),
+                                   _mm_unpacklo_epi32(thi, thi), _mm_unpackhi_epi32(thi, thi)};
+            const __m128i bit[4] = {_mm_unpacklo_epi32(itlo, itlo), _mm_unpackhi_epi32(itlo, itlo),
+                                    _mm_unpacklo_epi32(ithi, ithi), _mm_unpackhi_epi32(ithi, ithi)};
+            for (size_t u = 0; u < 4; u++) {
+                const size_t v = j / 2 + u;
+                const __m128i cand = _mm_subs_epi16(_mm_adds_epi16(bt[u], qpostv[v]), penv);
+                const __m128i mask = _mm_cmpgt_epi16(cand, scorev[v]);
+                scorev[v] = _mm_max_epi16(scorev[v], cand);
+                tbv[v] = blend_epi16(mask, tbv[v], bit[u]);
+            }
+        }
+    } else if (0 == nsuffix % FIXED_VEC) {
+        for (size_t j = 0; j < nhistory / nsuffix; j++) {
+            const __m128i t = _mm_set1_epi16(tmp[j]);
+            const __m128i it = _mm_set1_epi16(itmp[j]);
+            for (size_t v = j * nsuffix / FIXED_VEC; v < (j + 1) * nsuffix / FIXED_VEC; v++) {
+                const __m128i cand = _mm_subs_epi16(_mm_adds_epi16(t, qpostv[v]), penv);
+                const __m128i mask = _mm_cmpgt_epi16(cand, scorev[v]);
+                scorev[v] = _mm_max_epi16(scorev[v], cand);
+                tbv[v] = blend_epi16(mask, tbv[v], it);
+            }
+        }
+    } else {
+        for (size_t st = 0; st < nhistory; st++) {
+            const fixed_t cand = saturate_score((int32_t)tmp[st / nsuffix] + qpost[st] - pen);
+            if (cand > score[st]) {
+                score[st] = cand;
+                tb[st] = itmp[st / nsuffix];
+            }
+        }
+    }
+}
+
+/**  One block of fixed-point Viterbi recursion for decode_transducer_fixed
+ *
+ *   @param qpost Quantised log posterior for block [nhistory + 1]
+ *   @param nhistory Number of history states
+ *   @param qstay, qskip, qslip, qlocal  Quantised penalties
+ *   @param prev_score Scores at end of previous block [nstride]
+ *   @param score Scores at end of this block [out, nstride]
+ *   @param tmp, itmp  Workspace [nhistory / 4]
+ *   @param tb Traceback for this block [out, nstride]
+ *
+ *   @returns Score by which block was renormalised
+ **/
+static fixed_t decode_transducer_fixed_step(const fixed_t * qpost, size_t nhistory, size_t nstride,
+                                            fixed_t qstay, fixed_t qskip, fixed_t qslip,
+                                            fixed_t qlocal, bool allow_slip,
+                                            const fixed_t * prev_score, fixed_t * score,
+                                            fixed_t * tmp, fixed_t * itmp, fixed_t * tb) {
+    const __m128i * prevv = (const __m128i *)prev_score;
+    __m128i * scorev = (__m128i *)score;
+    __m128i * tbv = (__m128i *)tb;
+    const size_t nhistoryv = nhistory / FIXED_VEC;
+
+    // Stay
+    const fixed_t qstay_blk = saturate_score((int32_t)qpost[nhistory] + qstay);
+    const __m128i qstayv = _mm_set1_epi16(qstay_blk);
+    const __m128i negone = _mm_set1_epi16(-1);
+    for (size_t i = 0; i < nhistoryv; i++) {
+        scorev[i] = _mm_adds_epi16(prevv[i], qstayv);
+        tbv[i] = negone;
+    }
+
+    // Step, skip and slip
+    fixed_prefix_max(prev_score, nhistory / 4, 4, tmp, itmp);
+    fixed_apply_moves(tmp, itmp, nhistory, 4, 0, qpost, score, tb);
+    fixed_prefix_max(prev_score, nhistory / 16, 16, tmp, itmp);
+    fixed_apply_moves(tmp, itmp, nhistory, 16, qskip, qpost, score, tb);
+    if (allow_slip) {
+        fixed_prefix_max(prev_score, nhistory / 64, 64, tmp, itmp);
+        fixed_apply_moves(tmp, itmp, nhistory, 64, qslip, qpost, score, tb);
+    }
+
+    // Remain in start and end states (stay or local penalty)
+    const int32_t qremain = (qlocal > qstay_blk) ? qlocal : qstay_blk;
+    score[nhistory] = saturate_score((int32_t)prev_score[nhistory] + qremain);
+    tb[nhistory] = nhistory;
+    score[nhistory + 1] = saturate_score((int32_t)prev_score[nhistory + 1] + qremain);
+    tb[nhistory + 1] = nhistory + 1;
+
+    // Exit start state
+    {
+        const __m128i start = _mm_set1_epi16(prev_score[nhistory]);
+        const __m128i startidx = _mm_set1_epi16(nhistory);
+        const __m128i * qpostv = (const __m128i *)qpost;
+        for (size_t i = 0; i < nhistoryv; i++) {
+            const __m128i cand = _mm_adds_epi16(start, qpostv[i]);
+            const __m128i mask = _mm_cmpgt_epi16(cand, scorev[i]);
+            scorev[i] = _mm_max_epi16(scorev[i], cand);
+            tbv[i] = blend_epi16(mask, tbv[i], startidx);
+        }
+    }
+
+    // Enter end state from best history state
+    {
+        __m128i best = prevv[0];
+        for (size_t i = 1; i < nhistoryv; i++) {
+            best = _mm_max_epi16(best, prevv[i]);
+        }
+        const fixed_t best_score = hmax_epi16(best);
+        const fixed_t cand = saturate_score((int32_t)best_score + qlocal);
+        if (cand > score[nhistory + 1]) {
+            size_t hst = 0;
+            while (prev_score[hst] != best_score) {
+                hst++;
+            }
+            score[nhistory + 1] = cand;
+            tb[nhistory + 1] = hst;
+        }
+    }
+
+    // Padding never wins
+    for (size_t i = nhistory + 2; i < nstride; i++) {
+        score[i] = INT16_MIN;
+    }
+
+    // Renormalise so best state has score zero
+    __m128i best = scorev[0];
+    for (size_t i = 1; i < nstride / FIXED_VEC; i++) {
+        best = _mm_max_epi16(best, scorev[i]);
+    }
+    const fixed_t norm = hmax_epi16(best);
+    const __m128i normv = _mm_set1_epi16(norm);
+    for (size_t i = 0; i < nstride / FIXED_VEC; i++) {
+        scorev[i] = _mm_subs_epi16(scorev[i], normv);
+    }
+
+    return norm;
+}
+
+/**  Floating point score of transducer move
+ *
+ *   Expressions are as decode_transducer_step so a path found by fixed-point
+ *   decoding has exactly the same score as when found by floating point.
+ *
+ *   @param lp Log posterior for block
+ *   @param prev Score before move
+ *   @param src, dest  States before and after move.  src is negative for a stay.
+ *
+ *   @returns Score after move
+ **/
+static float transducer_move_score(const float * lp, float prev, int src, int dest, int nhistory,
+                                   float stay_pen, float skip_pen, float local_pen,
+                                   bool allow_slip) {
+    if (src < 0) {
+        return prev + (lp[nhistory] - stay_pen);
+    }
+    if (dest == nhistory || (dest == nhistory + 1 && src == nhistory + 1)) {
+        return prev + fmaxf(-local_pen, lp[nhistory] - stay_pen);
+    }
+    if (dest == nhistory + 1) {
+        return prev - local_pen;
+    }
+    if (src == nhistory) {
+        return prev + lp[dest];
+    }
+    float score = -BIG_FLOAT;
+    if (dest / 4 == src % (nhistory / 4)) {
+        score = fmaxf(score, lp[dest] + prev);
+    }
+    if (dest / 16 == src % (nhistory / 16)) {
+        score = fmaxf(score, lp[dest] + prev - skip_pen);
+    }
+    if (allow_slip && dest / 64 == src % (nhistory / 64)) {
+        score = fmaxf(score, lp[dest] + prev - (float)(2.0 * skip_pen));
+    }
+    return score;
+}
+
+/**  Viterbi decoding of transducer using 16-bit fixed-point scores
+ *
+ *   The path is chosen using quantised scores, as described at the top of
+ *   this file, and may occasionally differ from decode_transducer where
+ *   paths have near identical scores.  The score returned is that of the
+ *   path chosen, calculated in floating point.
+ *
+ *   Parameters as for decode_transducer
+ **/
+float decode_transducer_fixed(const_scrappie_matrix logpost, float stay_pen, float skip_pen,
+                              float local_pen, int *seq, bool allow_slip) {
+    float logscore = NAN;
+    RETURN_NULL_IF(NULL == logpost, logscore);
+    RETURN_NULL_IF(NULL == seq, logscore);
+
+    const size_t nblock = logpost->nc;
+    const int nhistory = logpost->nr - 1;
+    assert((nhistory % 64) == 0);
+    assert(nhistory + 2 <= INT16_MAX);
+    const size_t nstride = FIXED_VEC * iceil(nhistory + 2, FIXED_VEC);
+    const size_t nqpost = FIXED_VEC * iceil(logpost->nrq, 2);
+
+    const fixed_t qstay = quantise_score(-stay_pen);
+    const fixed_t qskip = quantise_score(skip_pen);
+    const fixed_t qslip = quantise_score(2.0f * skip_pen);
+    const fixed_t qlocal = quantise_score(-local_pen);
+
+    fixed_t * mem = NULL;
+    fixed_t * traceback = NULL;
+    int * state = calloc(nblock + 1, sizeof(int));
+    if (NULL == state
+        || 0 != scrappie_memalign((void **)&mem, 16, (4 * nstride + nqpost) * sizeof(fixed_t))
+        || 0 != scrappie_memalign((void **)&traceback, 16, (nblock + 1) * nstride * sizeof(fixed_t))) {
+        goto cleanup;
+    }
+    fixed_t * score = mem;
+    fixed_t * prev_score = mem + nstride;
+    fixed_t * tmp = mem + 2 * nstride;
+    fixed_t * itmp = mem + 3 * nstride;
+    fixed_t * qpost = mem + 4 * nstride;
+
+    //  Initialise
+    for (size_t i = 0; i < nstride; i++) {
+        score[i] = INT16_MIN;
+    }
+    score[nhistory] = 0;
+
+    //  Forwards Viterbi iteration
+    for (size_t blk = 0; blk < nblock; blk++) {
+        {
+            fixed_t * tmptr = score;
+            score = prev_score;
+            prev_score = tmptr;
+        }
+        quantise_column(logpost->data.v + blk * logpost->nrq, logpost->nrq, (__m128i *)qpost);
+        (void)decode_transducer_fixed_step(qpost, nhistory, nstride, qstay, qskip, qslip, qlocal,
+                                           allow_slip, prev_score, score, tmp, itmp,
+                                           traceback + blk * nstride);
+    }
+
+    //  Traceback, recording full state including start and end
+    for (size_t i = 0; i <= nblock; i++) {
+        seq[i] = -1;
+    }
+    int last_state = 0;
+    for (int i = 1; i < nhistory + 2; i++) {
+        if (score[i] > score[last_state]) {
+            last_state = i;
+        }
+    }
+    for (size_t i = 0; i < nblock; i++) {
+        const size_t ri = nblock - i - 1;
+        const int src = traceback[ri * nstride + last_state];
+        state[ri + 1] = last_state;
+        if (src >= 0) {
+            seq[ri + 1] = last_state;
+            last_state = src;
+        }
+    }
+    state[0] = last_state;
+    seq[0] = last_state;
+
+    //  Rescore path in floating point
+    logscore = (nhistory == state[0]) ? 0.0f : -BIG_FLOAT;
+    for (size_t blk = 0; blk < nblock; blk++) {
+        const int src = (-1 == seq[blk + 1]) ? -1 : state[blk];
+        logscore = transducer_move_score(logpost->data.f + blk * logpost->stride, logscore, src,
+                                         state[blk + 1], nhistory, stay_pen, skip_pen, local_pen,
+                                         allow_slip);
+    }
+
+    //  Replace start and end states by stays
+    for (size_t i = 0; i < nblock && nhistory == seq[i]; i++) {
+        seq[i] = -1;
+    }
+    for (int i = nblock; i >= 0 && nhistory + 1 == seq[i]; i--) {
+        seq[i] = -1;
+    }
+
+    assert(validate_ivector(seq, nblock, -1, nhistory - 1, __FILE__, __LINE__));
+
+cleanup:
+    free(traceback);
+    free(mem);
+    free(state);
+
+    return logscore;
+}
+
+
+/**  Map posterior to sequence using 16-bit fixed-point scores
+ *
+ *   As map_to_sequence_viterbi but the path is chosen using quantised
+ *   scores, eight positions of the sequence at a time, and the traceback
+ *   stores the move (stay, step or skip) as a single byte per position
+ *   rather than the previous position.  The score returned is that of the
+ *   path chosen, calculated in floating point.
+ *
+ *   Parameters as for map_to_sequence_viterbi
+ **/
+float map_to_sequence_viterbi_fixed(const_scrappie_matrix logpost, float stay_pen, float skip_pen,
+                                    float local_pen, int const *seq, size_t seqlen, int *path){
+    float logscore = NAN;
+    RETURN_NULL_IF(NULL == logpost, logscore);
+    RETURN_NULL_IF(NULL == seq, logscore);
+    RETURN_NULL_IF(0 == seqlen, logscore);
+
+    const size_t nblock = logpost->nc;
+    const size_t STAY = logpost->nr - 1;
+    const size_t START_STATE = seqlen;
+    const size_t END_STATE = seqlen + 1;
+
+    //  Positions are stored offset by two so the previous one and two
+    //  positions can be loaded unaligned.  Traceback rounded to pairs of vectors.
+    const size_t npos = 2 * FIXED_VEC * iceil(seqlen, 2 * FIXED_VEC);
+    const size_t OFFSET = FIXED_VEC;
+    const size_t nqpost = FIXED_VEC * iceil(logpost->nrq, 2);
+
+    const fixed_t qstay = quantise_score(-stay_pen);
+    const fixed_t qskip = quantise_score(-skip_pen);
+    const fixed_t qlocal = quantise_score(-local_pen);
+
+    fixed_t * mem = NULL;
+    int8_t * traceback = calloc(nblock * (npos + 2), sizeof(int8_t));
+    if (NULL == traceback
+        || 0 != scrappie_memalign((void **)&mem, 16,
+                                  (2 * (npos + OFFSET) + npos + nqpost) * sizeof(fixed_t))) {
+        goto cleanup;
+    }
+    fixed_t * cscore = mem;
+    fixed_t * pscore = mem + npos + OFFSET;
+    fixed_t * emit = mem + 2 * (npos + OFFSET);
+    fixed_t * qpost = emit + npos;
+    fixed_t cstart = 0, cend = INT16_MIN;
+
+    //  Initialise
+    for (size_t i = 0; i < 2 * (npos + OFFSET) + npos; i++) {
+        mem[i] = INT16_MIN;
+    }
+
+    // Forwards Viterbi
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i two = _mm_set1_epi16(2);
+    const __m128i qskipv = _mm_set1_epi16(qskip);
+    for (size_t blk = 0; blk < nblock; blk++) {
+        int8_t * tb = traceback + blk * (npos + 2);
+        {   // Swap vectors
+            fixed_t * tmp = pscore;
+            pscore = cscore;
+            cscore = tmp;
+        }
+        const fixed_t pstart = cstart, pend = cend;
+
+        quantise_column(logpost->data.v + blk * logpost->nrq, logpost->nrq, (__m128i *)qpost);
+        for (size_t pos = 0; pos < seqlen; pos++) {
+            emit[pos] = qpost[seq[pos]];
+        }
+
+        //  Stay, step and skip for ordinary states
+        const __m128i qstayv = _mm_set1_epi16(saturate_score((int32_t)qpost[STAY] + qstay));
+        const __m128i * emitv = (const __m128i *)emit;
+        __m128i * cscorev = (__m128i *)(cscore + OFFSET);
+        for (size_t v = 0; v < npos / FIXED_VEC; v += 2) {
+            __m128i move[2];
+            for (size_t u = 0; u < 2; u++) {
+                const fixed_t * p = pscore + OFFSET + (v + u) * FIXED_VEC;
+                const __m128i stay = _mm_adds_epi16(_mm_load_si128((const __m128i *)p), qstayv);
+                const __m128i step = _mm_adds_epi16(_mm_loadu_si128((const __m128i *)(p - 1)),
+                                                    emitv[v + u]);
+                const __m128i skip = _mm_adds_epi16(_mm_adds_epi16(_mm_loadu_si128((const __m128i *)(p - 2)),
+                                                                   qskipv), emitv[v + u]);
+                __m128i best = stay;
+                __m128i mvu = zero;
+                __m128i mask = _mm_cmpgt_epi16(step, best);
+                best = _mm_max_epi16(best, step);
+                mvu = blend_epi16(mask, mvu, one);
+                mask = _mm_cmpgt_epi16(skip, best);
+                best = _mm_max_epi16(best, skip);
+                move[u] = blend_epi16(mask, mvu, two);
+                cscorev[v + u] = best;
+            }
+            _mm_storeu_si128((__m128i *)(tb + v * FIXED_VEC), _mm_packs_epi16(move[0], move[1]));
+        }
+        for (size_t pos = seqlen; pos < npos; pos++) {
+            cscore[OFFSET + pos] = INT16_MIN;
+        }
+
+        // Stay in start and end states (local penalty or stay)
+        const int32_t qremain = (qlocal > qpost[STAY]) ? qlocal : qpost[STAY];
+        cstart = saturate_score((int32_t)pstart + qremain);
+        cend = saturate_score((int32_t)pend + qremain);
+        tb[npos + 1] = 0;
+        // Move from start into sequence
+        const fixed_t enter = saturate_score((int32_t)pstart + emit[0]);
+        if (enter > cscore[OFFSET]) {
+            cscore[OFFSET] = enter;
+            tb[0] = 1;
+        }
+        // Move from sequence into end
+        const fixed_t leave = saturate_score((int32_t)pscore[OFFSET + seqlen - 1] + qlocal);
+        if (leave > cend) {
+            cend = leave;
+            tb[npos + 1] = 1;
+        }
+
+        // Renormalise so best state has score zero
+        __m128i best = _mm_set1_epi16((cstart > cend) ? cstart : cend);
+        for (size_t v = 0; v < npos / FIXED_VEC; v++) {
+            best = _mm_max_epi16(best, cscorev[v]);
+        }
+        const fixed_t norm = hmax_epi16(best);
+        const __m128i normv = _mm_set1_epi16(norm);
+        for (size_t v = 0; v < npos / FIXED_VEC; v++) {
+            cscorev[v] = _mm_subs_epi16(cscorev[v], normv);
+        }
+        cstart = saturate_score((int32_t)cstart - norm);
+        cend = saturate_score((int32_t)cend - norm);
+    }
+
+    //  Traceback, then rescore path in floating point
+    int * fullpath = (NULL != path) ? path : calloc(nblock, sizeof(int));
+    if (NULL == fullpath) {
+        goto cleanup;
+    }
+    size_t st = (cscore[OFFSET + seqlen - 1] > cend) ? (seqlen - 1) : END_STATE;
+    for (size_t i = 0; i < nblock; i++) {
+        const size_t blk = nblock - i - 1;
+        const int8_t * tb = traceback + blk * (npos + 2);
+        fullpath[blk] = st;
+        if (END_STATE == st) {
+            st = (1 == tb[npos + 1]) ? (seqlen - 1) : END_STATE;
+        } else if (START_STATE != st) {
+            st = (0 == st && 1 == tb[0]) ? START_STATE : st - tb[st];
+        }
+    }
+
+    logscore = (START_STATE == st) ? 0.0f : -BIG_FLOAT;
+    size_t prev = START_STATE;
+    for (size_t blk = 0; blk < nblock; blk++) {
+        const float * lp = logpost->data.f + blk * logpost->stride;
+        const size_t curr = fullpath[blk];
+        if (START_STATE == curr || (END_STATE == curr && END_STATE == prev)) {
+            logscore = logscore + fmaxf(-local_pen, lp[STAY]);
+        } else if (END_STATE == curr) {
+            logscore = logscore - local_pen;
+        } else if (START_STATE == prev) {
+            logscore = logscore + lp[seq[0]];
+        } else if (curr == prev) {
+            logscore = logscore - stay_pen + lp[STAY];
+        } else if (curr == prev + 1) {
+            logscore = logscore + lp[seq[curr]];
+        } else {
+            logscore = logscore - skip_pen + lp[seq[curr]];
+        }
+        prev = curr;
+    }
+
+    if (NULL != path) {
+        for (size_t blk = 0; blk < nblock; blk++) {
+            if (START_STATE == path[blk] || END_STATE == path[blk]) {
+                path[blk] = -1;
+            }
+        }
+    } else {
+        free(fullpath);
+    }
+
+cleanup:
+    free(mem);
+    free(traceback);
+
+    return logscore;
+}
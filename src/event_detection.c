@@ -1,4 +1,5 @@
 #include <float.h>
+#include <immintrin.h>
 #include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -114,6 +115,88 @@ float *compute_tstat(const double *sum, const double *sumsq,
     return tstat;
 }
 
+/**  Feed the t-statistics for one sample to the short and long peak detectors
+ *
+ *   @param short_detector  Detector for short window (in/out)
+ *   @param long_detector   Detector for long window (in/out)
+ *   @param i               Index of sample
+ *   @param value           float[2] t-statistics for short and long windows
+ *   @param peak_height     Height a peak must rise above its surroundings
+ *   @param peaks           size_t[2] Positions of any peaks emitted (out)
+ *   @param source          int[2] Detector, 0 short or 1 long, that emitted each peak (out)
+ *
+ *   @returns Number of peaks emitted, at most two
+ **/
+static size_t short_long_peak_step(DetectorPtr short_detector, DetectorPtr long_detector,
+                                   size_t i, float const * value, const float peak_height,
+                                   size_t * peaks, int * source) {
+    const size_t ndetector = 2;
+    DetectorPtr detectors[] = { short_detector, long_detector };
+
+    size_t peak_count = 0;
+    for (size_t k = 0; k < ndetector; k++) {
+        DetectorPtr detector = detectors[k];
+        //Carry on if we've been masked out
+        if (detector->masked_to >= i) {
+            continue;
+        }
+
+        float current_value = value[k];
+
+        if (detector->peak_pos == detector->DEF_PEAK_POS) {
+            //CASE 1: We've not yet recorded a maximum
+            if (current_value < detector->peak_value) {
+                //Either record a deeper minimum...
+                detector->peak_value = current_value;
+            } else if (current_value - detector->peak_value >
+                       peak_height) {
+                // ...or we've seen a qualifying maximum
+                detector->peak_value = current_value;
+                detector->peak_pos = i;
+                //otherwise, wait to rise high enough to be considered a peak
+            }
+        } else {
+            //CASE 2: In an existing peak, waiting to see if it is good
+            if (current_value > detector->peak_value) {
+                //Update the peak
+                detector->peak_value = current_value;
+                detector->peak_pos = i;
+            }
+            //Dominate other tstat signals if we're going to fire at some point
+            if (detector == short_detector) {
+                if (detector->peak_value > detector->threshold) {
+                    long_detector->masked_to =
+                        detector->peak_pos + detector->window_length;
+                    long_detector->peak_pos =
+                        long_detector->DEF_PEAK_POS;
+                    long_detector->peak_value =
+                        long_detector->DEF_PEAK_VAL;
+                    long_detector->valid_peak = false;
+                }
+            }
+            //Have we convinced ourselves we've seen a peak
+            if (detector->peak_value - current_value > peak_height
+                && detector->peak_value > detector->threshold) {
+                detector->valid_peak = true;
+            }
+            //Finally, check the distance if this is a good peak
+            if (detector->valid_peak
+                && (i - detector->peak_pos) >
+                detector->window_length / 2) {
+                //Emit the boundary and reset
+                peaks[peak_count] = detector->peak_pos;
+                source[peak_count] = k;
+                peak_count++;
+                detector->peak_pos = detector->DEF_PEAK_POS;
+                detector->peak_value = current_value;
+                detector->valid_peak = false;
+            }
+        }
+    }
+
+    return peak_count;
+}
+
 /**
  *
  *   @returns array of length nsample whose elements contain peak positions
@@ -126,77 +209,45 @@ size_t *short_long_peak_detector(DetectorPtr short_detector,
     RETURN_NULL_IF(NULL == short_detector->signal, NULL);
     RETURN_NULL_IF(NULL == long_detector->signal, NULL);
 
-    const size_t ndetector = 2;
-    DetectorPtr detectors[] = { short_detector, long_detector };
-
     size_t *peaks = calloc(short_detector->signal_length, sizeof(size_t));
     RETURN_NULL_IF(NULL == peaks, NULL);
 
     size_t peak_count = 0;
     for (size_t i = 0; i < short_detector->signal_length; i++) {
-        for (size_t k = 0; k < ndetector; k++) {
-            DetectorPtr detector = detectors[k];
-            //Carry on if we've been masked out
-            if (detector->masked_to >= i) {
-                continue;
-            }
-
-            float current_value = detector->signal[i];
-
-            if (detector->peak_pos == detector->DEF_PEAK_POS) {
-                //CASE 1: We've not yet recorded a maximum
-                if (current_value < detector->peak_value) {
-                    //Either record a deeper minimum...
-                    detector->peak_value = current_value;
-                } else if (current_value - detector->peak_value >
-                           peak_height) {
-                    // ...or we've seen a qualifying maximum
-                    detector->peak_value = current_value;
-                    detector->peak_pos = i;
-                    //otherwise, wait to rise high enough to be considered a peak
-                }
-            } else {
-                //CASE 2: In an existing peak, waiting to see if it is good
-                if (current_value > detector->peak_value) {
-                    //Update the peak
-                    detector->peak_value = current_value;
-                    detector->peak_pos = i;
-                }
-                //Dominate other tstat signals if we're going to fire at some point
-                if (detector == short_detector) {
-                    if (detector->peak_value > detector->threshold) {
-                        long_detector->masked_to =
-                            detector->peak_pos + detector->window_length;
-                        long_detector->peak_pos =
-                            long_detector->DEF_PEAK_POS;
-                        long_detector->peak_value =
-                            long_detector->DEF_PEAK_VAL;
-                        long_detector->valid_peak = false;
-                    }
-                }
-                //Have we convinced ourselves we've seen a peak
-                if (detector->peak_value - current_value > peak_height
-                    && detector->peak_value > detector->threshold) {
-                    detector->valid_peak = true;
-                }
-                //Finally, check the distance if this is a good peak
-                if (detector->valid_peak
-                    && (i - detector->peak_pos) >
-                    detector->window_length / 2) {
-                    //Emit the boundary and reset
-                    peaks[peak_count] = detector->peak_pos;
-                    peak_count++;
-                    detector->peak_pos = detector->DEF_PEAK_POS;
-                    detector->peak_value = current_value;
-                    detector->valid_peak = false;
-                }
-            }
-        }
+        const float value[2] = { short_detector->signal[i], long_detector->signal[i] };
+        int source[2];
+        peak_count += short_long_peak_step(short_detector, long_detector, i, value, peak_height,
+                                           peaks + peak_count, source);
     }
 
     return peaks;
 }
 
+/**  Create an event from the cumulative sums at its boundaries
+ *
+ *  @param start Index of lower bound
+ *  @param end Index of upper bound
+ *  @param sum_start, sum_end Cumulative sum of signal at lower and upper bound
+ *  @param sumsq_start, sumsq_end Cumulative sum of squares at lower and upper bound
+ *
+ *  @returns An initialised event.
+ **/
+static event_t event_from_sums(size_t start, size_t end, double sum_start, double sum_end,
+                               double sumsq_start, double sumsq_end) {
+    event_t event = { 0 };
+    event.pos = -1;
+    event.state = -1;
+
+    event.start = (uint64_t)start;
+    event.length = (float)(end - start);
+    event.mean = (float)(sum_end - sum_start) / event.length;
+    const float deltasqr = (sumsq_end - sumsq_start);
+    const float var = deltasqr / event.length - event.mean * event.mean;
+    event.stdv = sqrtf(fmaxf(var, 0.0f));
+
+    return event;
+}
+
 /**  Create an event given boundaries
  *
  *   Note: Bounds are CADLAG (i.e. lower bound is contained in the interval but
@@ -215,20 +266,10 @@ event_t create_event(size_t start, size_t end, double const *sums,
     assert(start < nsample);
     assert(end <= nsample);
 
-    event_t event = { 0 };
-    event.pos = -1;
-    event.state = -1;
-    RETURN_NULL_IF(NULL == sums, event);
-    RETURN_NULL_IF(NULL == sumsqs, event);
+    RETURN_NULL_IF(NULL == sums, ((event_t){.pos = -1, .state = -1}));
+    RETURN_NULL_IF(NULL == sumsqs, ((event_t){.pos = -1, .state = -1}));
 
-    event.start = (uint64_t)start;
-    event.length = (float)(end - start);
-    event.mean = (float)(sums[end] - sums[start]) / event.length;
-    const float deltasqr = (sumsqs[end] - sumsqs[start]);
-    const float var = deltasqr / event.length - event.mean * event.mean;
-    event.stdv = sqrtf(fmaxf(var, 0.0f));
-
-    return event;
+    return event_from_sums(start, end, sums[start], sums[end], sumsqs[start], sumsqs[end]);
 }
 
 event_table create_events(size_t const *peaks, double const *sums,
@@ -265,56 +306,301 @@ event_table create_events(size_t const *peaks, double const *sums,
     return et;
 }
 
-event_table detect_events(raw_table const rt, detector_param const edparam) {
-
-    event_table et = { 0 };
-    RETURN_NULL_IF(NULL == rt.raw, et);
-    const size_t nsample = rt.end - rt.start;
-
-    double *sums = calloc(nsample + 1, sizeof(double));
-    double *sumsqs = calloc(nsample + 1, sizeof(double));
-
-    compute_sum_sumsq(rt.raw + rt.start, sums, sumsqs, nsample);
-    float *tstat1 = compute_tstat(sums, sumsqs, nsample, edparam.window_length1);
-    float *tstat2 = compute_tstat(sums, sumsqs, nsample, edparam.window_length2);
-
-    Detector short_detector = {
+static Detector detector_init(float threshold, size_t window_length) {
+    return (Detector){
         .DEF_PEAK_POS = -1,
         .DEF_PEAK_VAL = FLT_MAX,
-        .signal = tstat1,
-        .signal_length = nsample,
-        .threshold = edparam.threshold1,
-        .window_length = edparam.window_length1,
+        .signal = NULL,
+        .signal_length = 0,
+        .threshold = threshold,
+        .window_length = window_length,
         .masked_to = 0,
         .peak_pos = -1,
         .peak_value = FLT_MAX,
         .valid_peak = false
     };
+}
+
+
+/**  Streaming event detector
+ *
+ *   State of event detection part way through a signal.  Only the cumulative
+ *   sums in a window around the current sample are retained, held in a ring
+ *   buffer, so memory use is independent of the length of the signal.
+ **/
+struct event_detector {
+    detector_param param;
+    //  Length of the longer window, and so the lag before a t-statistic is known
+    size_t lag;
+    //  Ring buffer of cumulative sums, element i held at i & ring_mask
+    size_t ring_mask;
+    double *sum;
+    double *sumsq;
+    //  Number of samples seen, sum and sum of squares of them
+    size_t nsample;
+    double total;
+    double totalsq;
+    //  Next sample whose t-statistics are to be fed to the peak detectors
+    size_t next;
+    //  Peak detectors, short then long, and cumulative sums at their current peaks
+    Detector detector[2];
+    double peak_sum[2];
+    double peak_sumsq[2];
+    //  Start of the event in progress and cumulative sums there
+    size_t event_start;
+    double event_sum;
+    double event_sumsq;
+};
+
+
+event_detector * make_event_detector(detector_param const edparam) {
+    event_detector * ed = calloc(1, sizeof(event_detector));
+    RETURN_NULL_IF(NULL == ed, NULL);
+
+    ed->param = edparam;
+    ed->lag = (edparam.window_length1 > edparam.window_length2) ? edparam.window_length1 : edparam.window_length2;
+    //  Need cumulative sums from lag before to lag after the sample being fed to the detectors
+    size_t nring = 1;
+    while (nring < 2 * ed->lag + 2) {
+        nring <<= 1;
+    }
+    ed->ring_mask = nring - 1;
+    ed->sum = calloc(nring, sizeof(double));
+    ed->sumsq = calloc(nring, sizeof(double));
+    if (NULL == ed->sum || NULL == ed->sumsq) {
+        return free_event_detector(ed);
+    }
+
+    ed->detector[0] = detector_init(edparam.threshold1, edparam.window_length1);
+    ed->detector[1] = detector_init(edparam.threshold2, edparam.window_length2);
+
+    return ed;
+}
+
+
+event_detector * free_event_detector(event_detector * ed) {
+    if (NULL != ed) {
+        free(ed->sumsq);
+        free(ed->sum);
+        free(ed);
+    }
+    return NULL;
+}
+
+
+/**  Windowed t-statistics for the short and long windows at a sample
+ *
+ *   Both t-statistics are calculated together, one in each lane of a vector.
+ *   Arithmetic, including the mix of single and double precision, is as
+ *   compute_tstat so results are identical.
+ *
+ *   @param ed  Detector with cumulative sums for lag either side of sample i
+ *   @param i   Index of sample
+ *   @param n   Number of samples in whole signal, or a lower bound if not yet known
+ *   @param tstat float[2] t-statistics for short and long windows (out)
+ **/
+static void event_detector_tstat(event_detector const * ed, size_t i, size_t n, float * tstat) {
+    const size_t w1 = ed->param.window_length1;
+    const size_t w2 = ed->param.window_length2;
+    const size_t mask = ed->ring_mask;
+    //  t-test not defined for fewer than two points or near the boundaries
+    const bool valid1 = w1 >= 2 && i >= w1 && i + w1 <= n;
+    const bool valid2 = w2 >= 2 && i >= w2 && i + w2 <= n;
+    if (!valid1 && !valid2) {
+        tstat[0] = 0.0f;
+        tstat[1] = 0.0f;
+        return;
+    }
+    const size_t lo1 = valid1 ? i - w1 : i;
+    const size_t lo2 = valid2 ? i - w2 : i;
+    const size_t hi1 = valid1 ? i + w1 : i;
+    const size_t hi2 = valid2 ? i + w2 : i;
+
+    const __m128d w_lengthd = _mm_set_pd((double)w2, (double)w1);
+    const __m128 w_lengthf = _mm_set_ps(1.0f, 1.0f, (float)w2, (float)w1);
+    const __m128d sum_mid = _mm_set1_pd(ed->sum[i & mask]);
+    const __m128d sumsq_mid = _mm_set1_pd(ed->sumsq[i & mask]);
+
+    const __m128d sum1 = _mm_sub_pd(sum_mid, _mm_set_pd(ed->sum[lo2 & mask], ed->sum[lo1 & mask]));
+    const __m128d sumsq1 = _mm_sub_pd(sumsq_mid, _mm_set_pd(ed->sumsq[lo2 & mask], ed->sumsq[lo1 & mask]));
+    const __m128 sum2 = _mm_cvtpd_ps(_mm_sub_pd(_mm_set_pd(ed->sum[hi2 & mask], ed->sum[hi1 & mask]), sum_mid));
+    const __m128 sumsq2 = _mm_cvtpd_ps(_mm_sub_pd(_mm_set_pd(ed->sumsq[hi2 & mask], ed->sumsq[hi1 & mask]),
+                                                  sumsq_mid));
+
+    const __m128 mean1 = _mm_cvtpd_ps(_mm_div_pd(sum1, w_lengthd));
+    const __m128 mean2 = _mm_div_ps(sum2, w_lengthf);
+    __m128d combined_var = _mm_sub_pd(_mm_div_pd(sumsq1, w_lengthd), _mm_cvtps_pd(_mm_mul_ps(mean1, mean1)));
+    combined_var = _mm_add_pd(combined_var, _mm_cvtps_pd(_mm_div_ps(sumsq2, w_lengthf)));
+    combined_var = _mm_sub_pd(combined_var, _mm_cvtps_pd(_mm_mul_ps(mean2, mean2)));
+    // Prevent problem due to very small variances
+    const __m128 combined_varf = _mm_max_ps(_mm_cvtpd_ps(combined_var), _mm_set1_ps(FLT_MIN));
+
+    const __m128d abs_mask = _mm_castsi128_pd(_mm_set1_epi64x(0x7fffffffffffffffLL));
+    const __m128d delta_mean = _mm_and_pd(abs_mask, _mm_cvtps_pd(_mm_sub_ps(mean2, mean1)));
+    const __m128d stderr_mean = _mm_sqrt_pd(_mm_cvtps_pd(_mm_div_ps(combined_varf, w_lengthf)));
+
+    float t[4];
+    _mm_storeu_ps(t, _mm_cvtpd_ps(_mm_div_pd(delta_mean, stderr_mean)));
+    tstat[0] = valid1 ? t[0] : 0.0f;
+    tstat[1] = valid2 ? t[1] : 0.0f;
+}
+
+
+/**  Feed t-statistics of next sample to peak detectors, emitting any events
+ *
+ *   @param ed      Detector (in/out)
+ *   @param n       Number of samples in whole signal, or a lower bound if not yet known
+ *   @param events  Buffer with room for at least two events (out)
+ *
+ *   @returns Number of events emitted
+ **/
+static size_t event_detector_feed(event_detector * ed, size_t n, event_t * events) {
+    const size_t i = ed->next++;
+    const size_t mask = ed->ring_mask;
+    float tstat[2];
+    event_detector_tstat(ed, i, n, tstat);
+
+    size_t peaks[2];
+    int source[2];
+    const size_t npeak = short_long_peak_step(ed->detector + 0, ed->detector + 1, i, tstat,
+                                              ed->param.peak_height, peaks, source);
+
+    for (size_t k = 0; k < npeak; k++) {
+        const int d = source[k];
+        events[k] = event_from_sums(ed->event_start, peaks[k], ed->event_sum, ed->peak_sum[d],
+                                    ed->event_sumsq, ed->peak_sumsq[d]);
+        ed->event_start = peaks[k];
+        ed->event_sum = ed->peak_sum[d];
+        ed->event_sumsq = ed->peak_sumsq[d];
+    }
+
+    for (size_t k = 0; k < 2; k++) {
+        if (ed->detector[k].peak_pos == (int)i) {
+            //  Peak has moved to this sample;  record cumulative sums for when it is emitted
+            ed->peak_sum[k] = ed->sum[i & mask];
+            ed->peak_sumsq[k] = ed->sumsq[i & mask];
+        }
+    }
+
+    return npeak;
+}
 
-    Detector long_detector = {
-        .DEF_PEAK_POS = -1,
-        .DEF_PEAK_VAL = FLT_MAX,
-        .signal = tstat2,
-        .signal_length = nsample,
-        .threshold = edparam.threshold2,
-        .window_length = edparam.window_length2,
-        .masked_to = 0,
-        .peak_pos = -1,
-        .peak_value = FLT_MAX,
-        .valid_peak = false
-    };
 
-    size_t *peaks =
-        short_long_peak_detector(&short_detector, &long_detector,
-                                 edparam.peak_height);
+/**  Push samples through a streaming event detector
+ *
+ *   Events are emitted as soon as their end is known.  Samples are consumed
+ *   until either all have been used or the event buffer is nearly full, so a
+ *   caller should drain the buffer and push any remaining samples again.
+ *
+ *   @param ed         Detector (in/out)
+ *   @param x          float[n] Samples of signal
+ *   @param n          Number of samples
+ *   @param events     Buffer for events emitted (out)
+ *   @param max_event  Capacity of event buffer, in events
+ *   @param nevent     Number of events emitted (out)
+ *
+ *   @returns Number of samples consumed
+ **/
+size_t event_detector_push(event_detector * ed, float const * x, size_t n, event_t * events,
+                           size_t max_event, size_t * nevent) {
+    RETURN_NULL_IF(NULL == ed, 0);
+    RETURN_NULL_IF(NULL == nevent, 0);
+    *nevent = 0;
+    RETURN_NULL_IF(NULL == x, 0);
+    RETURN_NULL_IF(NULL == events, 0);
+
+    const size_t mask = ed->ring_mask;
+    size_t i = 0;
+    //  Each sample fed to the detectors may emit up to two events
+    for (; i < n && max_event - *nevent >= 2; i++) {
+        ed->total += x[i];
+        ed->totalsq += x[i] * x[i];
+        ed->nsample += 1;
+        ed->sum[ed->nsample & mask] = ed->total;
+        ed->sumsq[ed->nsample & mask] = ed->totalsq;
+        if (ed->next + ed->lag <= ed->nsample) {
+            *nevent += event_detector_feed(ed, ed->nsample, events + *nevent);
+        }
+    }
+
+    return i;
+}
+
+
+/**  Number of events a buffer must be able to hold for event_detector_finish
+ **/
+size_t event_detector_finish_capacity(event_detector const * ed) {
+    RETURN_NULL_IF(NULL == ed, 0);
+    return 2 * (ed->nsample - ed->next) + 1;
+}
 
-    et = create_events(peaks, sums, sumsqs, nsample);
 
-    free(peaks);
-    free(tstat2);
-    free(tstat1);
-    free(sumsqs);
-    free(sums);
+/**  Finish streaming event detection, emitting the remaining events
+ *
+ *   @param ed         Detector (in/out)
+ *   @param events     Buffer for events emitted, of at least
+ *                     event_detector_finish_capacity events (out)
+ *   @param max_event  Capacity of event buffer, in events
+ *
+ *   @returns Number of events emitted
+ **/
+size_t event_detector_finish(event_detector * ed, event_t * events, size_t max_event) {
+    RETURN_NULL_IF(NULL == ed, 0);
+    RETURN_NULL_IF(NULL == events, 0);
+    RETURN_NULL_IF(max_event < event_detector_finish_capacity(ed), 0);
+    if (0 == ed->nsample) {
+        return 0;
+    }
+
+    size_t nevent = 0;
+    while (ed->next < ed->nsample) {
+        nevent += event_detector_feed(ed, ed->nsample, events + nevent);
+    }
+    // Last event -- ends at end of signal
+    events[nevent] = event_from_sums(ed->event_start, ed->nsample, ed->event_sum, ed->total,
+                                     ed->event_sumsq, ed->totalsq);
+
+    return nevent + 1;
+}
+
+
+event_table detect_events(raw_table const rt, detector_param const edparam) {
+
+    event_table et = { 0 };
+    RETURN_NULL_IF(NULL == rt.raw, et);
+    const size_t nsample = rt.end - rt.start;
+
+    event_detector * ed = make_event_detector(edparam);
+    RETURN_NULL_IF(NULL == ed, et);
+
+    //  Events are typically several samples long;  grow buffer as necessary
+    size_t max_event = nsample / 8 + 2;
+    event_t * events = malloc(max_event * sizeof(event_t));
+    size_t n = 0;
+    for (size_t pushed = 0; NULL != events && pushed < nsample;) {
+        size_t nevent = 0;
+        pushed += event_detector_push(ed, rt.raw + rt.start + pushed, nsample - pushed, events + n,
+                                      max_event - n, &nevent);
+        n += nevent;
+        const size_t capacity = n + event_detector_finish_capacity(ed) + 2;
+        if (capacity > max_event) {
+            max_event = (2 * max_event > capacity) ? 2 * max_event : capacity;
+            event_t * new_events = realloc(events, max_event * sizeof(event_t));
+            if (NULL == new_events) {
+                free(events);
+            }
+            events = new_events;
+        }
+    }
+    if (NULL != events) {
+        n += event_detector_finish(ed, events + n, max_event - n);
+    }
+    ed = free_event_detector(ed);
+    RETURN_NULL_IF(NULL == events, et);
+
+    et.event = events;
+    et.n = n;
+    et.end = et.n;
 
     return et;
 }
@@ -24,4 +24,13 @@ static detector_param const event_detection_defaults = {
 
 event_table detect_events(raw_table const rt, detector_param const edparam);
 
+typedef struct event_detector event_detector;
+
+event_detector * make_event_detector(detector_param const edparam);
+event_detector * free_event_detector(event_detector * ed);
+size_t event_detector_push(event_detector * ed, float const * x, size_t n, event_t * events,
+                           size_t max_event, size_t * nevent);
+size_t event_detector_finish_capacity(event_detector const * ed);
+size_t event_detector_finish(event_detector * ed, event_t * events, size_t max_event);
+
 #endif                          /* EVENT_DETECTION_H */
@@ -5,6 +5,7 @@
 #include <err.h>
 #include <math.h>
 #include <stdio.h>
+#include <zlib.h>
 #include "fast5_interface.h"
 #include "scrappie_stdlib.h"
 #include "util.h"
@@ -14,14 +15,6 @@ struct _gop_data {
     int latest;
 };
 
-typedef struct {
-    //  Information for scaling raw data from ADC values to pA
-    float digitisation;
-    float offset;
-    float range;
-    float sample_rate;
-} fast5_raw_scaling;
-
 float read_float_attribute(hid_t group, const char *attribute) {
     float val = NAN;
     if (group < 0) {
@@ -87,7 +80,7 @@ char * read_string_attribute(hid_t group, const char * attribute){
     } else {
         // Fixed length
         size_t asize = H5Tget_size(atype);
-        str = calloc(asize, sizeof(char));
+        str = calloc(asize + 1, sizeof(char));
         herr_t err = H5Aread(attr, atype, str);
         if(err < 0){
             warnx("Failed to copy attribute '%s'.", attribute);
@@ -106,10 +99,9 @@ cleanup1:
 
 
 
-fast5_raw_scaling get_raw_scaling(hid_t hdf5file) {
+fast5_raw_scaling get_raw_scaling(hid_t hdf5file, const char * scaling_path) {
     // Add 1e-5 to sensible sample rate as a sentinel value
     fast5_raw_scaling scaling = { NAN, NAN, NAN, NAN };
-    const char *scaling_path = "/UniqueGlobalKey/channel_id";
 
     hid_t scaling_group = H5Gopen(hdf5file, scaling_path, H5P_DEFAULT);
     if (scaling_group < 0) {
@@ -127,49 +119,42 @@ fast5_raw_scaling get_raw_scaling(hid_t hdf5file) {
     return scaling;
 }
 
-raw_table read_raw(const char *filename, bool scale_to_pA) {
-    assert(NULL != filename);
-    raw_table rawtbl = { NULL, 0, 0, 0, NULL };
 
-    hid_t hdf5file = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
-    if (hdf5file < 0) {
-        warnx("Failed to open %s for reading.", filename);
-        return rawtbl;
-    }
-    H5Eset_auto2(H5E_DEFAULT, NULL, NULL);
-
-    const char *root = "/Raw/Reads/";
-    const int rootstr_len = strlen(root);
-    ssize_t size =
-        H5Lget_name_by_idx(hdf5file, root, H5_INDEX_NAME, H5_ITER_INC, 0, NULL,
-                           0, H5P_DEFAULT);
-    if (size < 0) {
-        warnx("Failed find read name under %s.", root);
-        goto cleanup1;
-    }
-    char *name = calloc(1 + size, sizeof(char));
-    H5Lget_name_by_idx(hdf5file, root, H5_INDEX_NAME, H5_ITER_INC, 0, name,
-                       1 + size, H5P_DEFAULT);
+/**  Read raw signal of a single read from an open fast5 file
+ *
+ *   @param hdf5file  Open fast5 file
+ *   @param read_path  Group containing the Signal dataset and read_id attribute
+ *   @param scaling_path  Group containing the channel_id attributes
+ *   @param scale_to_pA  Whether to convert ADC values to pA
+ *   @param native  Keep the ADC values as int16 samples, with their scaling,
+ *   rather than converting to floats.  scale_to_pA is then ignored.
+ *
+ *   @returns raw_table, whose raw element, or sample element if native, is
+ *   NULL on failure
+ **/
+static raw_table read_raw_group(hid_t hdf5file, const char * read_path,
+                                const char * scaling_path, bool scale_to_pA, bool native) {
+    raw_table rawtbl = { NULL, 0, 0, 0, NULL };
+    const size_t read_path_len = strlen(read_path);
 
     // uuid pat
-    char * dset_path = calloc(rootstr_len + size + 1, sizeof(char));
-    (void)snprintf(dset_path, rootstr_len + size + 1, "%s%s", root, name);
-    hid_t ugroup = H5Gopen(hdf5file, dset_path, H5P_DEFAULT);
+    hid_t ugroup = H5Gopen(hdf5file, read_path, H5P_DEFAULT);
     if(ugroup < 0){
-        warnx("Failed to find read_id under %s.", dset_path);
-        goto cleanup1_1;
+        warnx("Failed to find read_id under %s.", read_path);
+        return rawtbl;
     }
     char * uuid = read_string_attribute(ugroup, "read_id");
     H5Gclose(ugroup);
 
     // Create group name
-    char *signal_path = calloc(rootstr_len + size + 8, sizeof(char));
-    (void)snprintf(signal_path, rootstr_len + size + 8, "%s%s/Signal", root, name);
+    char *signal_path = calloc(read_path_len + 8, sizeof(char));
+    (void)snprintf(signal_path, read_path_len + 8, "%s/Signal", read_path);
 
     hid_t dset = H5Dopen(hdf5file, signal_path, H5P_DEFAULT);
     if (dset < 0) {
         warnx("Failed to open dataset '%s' to read raw signal from.",
               signal_path);
+        free(uuid);
         goto cleanup2;
     }
 
@@ -177,27 +162,35 @@ raw_table read_raw(const char *filename, bool scale_to_pA) {
     if (space < 0) {
         warnx("Failed to create copy of dataspace for raw signal %s.",
               signal_path);
+        free(uuid);
         goto cleanup3;
     }
     hsize_t nsample;
     H5Sget_simple_extent_dims(space, &nsample, NULL);
-    float *rawptr = calloc(nsample, sizeof(float));
-    herr_t status =
-        H5Dread(dset, H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, rawptr);
+    void *rawptr = native ? calloc(nsample, sizeof(int16_t)) : calloc(nsample, sizeof(float));
+    herr_t status = (NULL == rawptr) ? -1
+        : H5Dread(dset, native ? H5T_NATIVE_INT16 : H5T_NATIVE_FLOAT, H5S_ALL, H5S_ALL, H5P_DEFAULT, rawptr);
     if (status < 0) {
         free(rawptr);
         free(uuid);
         warnx("Failed to read raw data from dataset %s.", signal_path);
         goto cleanup4;
     }
+    if (native) {
+        const fast5_raw_scaling scaling = get_raw_scaling(hdf5file, scaling_path);
+        rawtbl = (raw_table) {
+        uuid, nsample, 0, nsample, NULL, rawptr, scaling.offset, scaling.range / scaling.digitisation};
+        goto cleanup4;
+    }
+    float * signal = rawptr;
     rawtbl = (raw_table) {
-    uuid, nsample, 0, nsample, rawptr};
+    uuid, nsample, 0, nsample, signal};
 
     if (scale_to_pA) {
-        const fast5_raw_scaling scaling = get_raw_scaling(hdf5file);
+        const fast5_raw_scaling scaling = get_raw_scaling(hdf5file, scaling_path);
         const float raw_unit = scaling.range / scaling.digitisation;
         for (size_t i = 0; i < nsample; i++) {
-            rawptr[i] = (rawptr[i] + scaling.offset) * raw_unit;
+            signal[i] = (signal[i] + scaling.offset) * raw_unit;
         }
     }
 
@@ -207,54 +200,333 @@ raw_table read_raw(const char *filename, bool scale_to_pA) {
     H5Dclose(dset);
  cleanup2:
     free(signal_path);
- cleanup1_1:
-    free(dset_path);
-    free(name);
- cleanup1:
-    H5Fclose(hdf5file);
 
     return rawtbl;
 }
 
-void write_annotated_events(hid_t hdf5file, const char *readname,
-                            const event_table et, hsize_t chunk_size,
-                            int compression_level) {
-    assert(compression_level >= 0 && compression_level <= 9);
 
+/**  Name of link in group by index
+ *
+ *   @returns Name, to be freed by caller, or NULL on failure
+ **/
+static char * link_name_by_idx(hid_t hdf5file, const char * group, hsize_t idx) {
+    ssize_t size =
+        H5Lget_name_by_idx(hdf5file, group, H5_INDEX_NAME, H5_ITER_INC, idx, NULL,
+                           0, H5P_DEFAULT);
+    RETURN_NULL_IF(size < 0, NULL);
+    char *name = calloc(1 + size, sizeof(char));
+    RETURN_NULL_IF(NULL == name, NULL);
+    H5Lget_name_by_idx(hdf5file, group, H5_INDEX_NAME, H5_ITER_INC, idx, name,
+                       1 + size, H5P_DEFAULT);
+    return name;
+}
+
+
+/**  Open fast5 file for reading each read in turn
+ *
+ *   Files containing a single read, under /Raw/Reads/, and multi-read files,
+ *   with one /read_<id> group per read, are supported.  The file is kept
+ *   open until the reader is freed so the cost of opening it and reading its
+ *   metadata is paid once however many reads it contains.
+ *
+ *   @param filename  Path to fast5 file
+ *
+ *   @returns Reader, to be freed with free_fast5_reader, or NULL on failure
+ **/
+fast5_reader * open_fast5_reader(const char *filename) {
+    assert(NULL != filename);
+    hid_t hdf5file = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
+    if (hdf5file < 0) {
+        warnx("Failed to open %s for reading.", filename);
+        return NULL;
+    }
+    H5Eset_auto2(H5E_DEFAULT, NULL, NULL);
+
+    fast5_reader * reader = calloc(1, sizeof(fast5_reader));
+    if (NULL == reader) {
+        H5Fclose(hdf5file);
+        return NULL;
+    }
+    reader->hdf5file = hdf5file;
+    reader->multi = (H5Lexists(hdf5file, "Raw", H5P_DEFAULT) <= 0);
+    reader->nentry = 1;
+    reader->next = 0;
+    if (reader->multi) {
+        H5G_info_t info;
+        if (H5Gget_info(hdf5file, &info) < 0) {
+            warnx("Failed to find reads in %s.", filename);
+            return free_fast5_reader(reader);
+        }
+        reader->nentry = info.nlinks;
+    }
+
+    return reader;
+}
+
+
+fast5_reader * free_fast5_reader(fast5_reader * reader) {
+    if (NULL != reader) {
+        H5Fclose(reader->hdf5file);
+        free(reader);
+    }
+    return NULL;
+}
+
+
+/**  Whether the reader has any more entries
+ **/
+bool fast5_reader_finished(const fast5_reader * reader) {
+    return (NULL == reader) || (reader->next >= reader->nentry);
+}
+
+
+/**  Find the paths of the next read in a fast5 file
+ *
+ *   @param reader  Open reader
+ *   @param readname  For multi-read files, name of group containing read, to be
+ *   freed by caller.  Always NULL for single-read files [out]
+ *   @param read_path  Path to group containing raw signal, to be freed by caller [out]
+ *   @param scaling_path  Path to group containing scaling, to be freed by caller [out]
+ *
+ *   @returns true if a read was found.  The reader has moved past it whether or not
+ *   its paths could be allocated.
+ **/
+static bool reader_next_path(fast5_reader * reader, char ** readname, char ** read_path, char ** scaling_path) {
+    assert(NULL != readname);
+    *readname = NULL;
+    *read_path = NULL;
+    *scaling_path = NULL;
+    if (fast5_reader_finished(reader)) {
+        return false;
+    }
+
+    if (!reader->multi) {
+        reader->next = reader->nentry;
+        const char *root = "/Raw/Reads/";
+        const char *scaling = "/UniqueGlobalKey/channel_id";
+        char *name = link_name_by_idx(reader->hdf5file, root, 0);
+        if (NULL == name) {
+            warnx("Failed find read name under %s.", root);
+            return true;
+        }
+        const size_t read_path_len = strlen(root) + strlen(name) + 1;
+        *read_path = calloc(read_path_len, sizeof(char));
+        *scaling_path = calloc(strlen(scaling) + 1, sizeof(char));
+        if (NULL != *read_path && NULL != *scaling_path) {
+            (void)sprintf(*read_path, "%s%s", root, name);
+            (void)strcpy(*scaling_path, scaling);
+        }
+        free(name);
+        return true;
+    }
+
+    char *name = NULL;
+    for ( ; NULL == name && reader->next < reader->nentry ; reader->next++) {
+        name = link_name_by_idx(reader->hdf5file, "/", reader->next);
+        if (NULL != name && 0 != strncmp(name, "read_", 5)) {
+            //  Not a read, e.g. a group of file-wide metadata
+            free(name);
+            name = NULL;
+        }
+    }
+    if (NULL == name) {
+        return false;
+    }
+    *readname = name;
+
+    const size_t name_len = strlen(name);
+    const size_t path_len = name_len + 13;
+    *read_path = calloc(path_len, sizeof(char));
+    *scaling_path = calloc(path_len, sizeof(char));
+    if (NULL != *read_path && NULL != *scaling_path) {
+        (void)snprintf(*read_path, path_len, "/%s/Raw", name);
+        (void)snprintf(*scaling_path, path_len, "/%s/channel_id", name);
+    }
+    return true;
+}
+
+
+static raw_table reader_next(fast5_reader * reader, bool scale_to_pA, bool native, char ** readname) {
+    raw_table rawtbl = { NULL, 0, 0, 0, NULL };
+    char * read_path = NULL;
+    char * scaling_path = NULL;
+    if (reader_next_path(reader, readname, &read_path, &scaling_path)
+        && NULL != read_path && NULL != scaling_path) {
+        rawtbl = read_raw_group(reader->hdf5file, read_path, scaling_path, scale_to_pA, native);
+    }
+    free(scaling_path);
+    free(read_path);
+    return rawtbl;
+}
+
+
+/**  Read the next read from a fast5 file
+ *
+ *   Entries of a multi-read file that are not reads are skipped.
+ *
+ *   @param reader  Open reader
+ *   @param scale_to_pA  Whether to convert ADC values to pA
+ *   @param readname  For multi-read files, name of group containing read, to be
+ *   freed by caller, or NULL if there are no more reads.  Always NULL for
+ *   single-read files [out]
+ *
+ *   @returns raw_table, whose raw element is NULL on failure
+ **/
+raw_table fast5_reader_next(fast5_reader * reader, bool scale_to_pA, char ** readname) {
+    return reader_next(reader, scale_to_pA, false, readname);
+}
+
+
+/**  Read the next read from a fast5 file, keeping its native ADC values
+ *
+ *   The signal is left as the int16 samples stored in the file, together
+ *   with the scaling to pA, so a read occupies half the memory of a float
+ *   signal and no pass is made over it until it is used.
+ *
+ *   @param reader  Open reader
+ *   @param readname  As for fast5_reader_next [out]
+ *
+ *   @returns raw_table, whose sample element is NULL on failure
+ **/
+raw_table fast5_reader_next_native(fast5_reader * reader, char ** readname) {
+    return reader_next(reader, true, true, readname);
+}
+
+
+/**  Find the next read in a fast5 file, and optionally its length, without loading it
+ *
+ *   Only the extent of the signal's dataspace is read, so the cost is that of
+ *   opening the dataset rather than of reading and decompressing the signal.
+ *
+ *   @param reader  Open reader
+ *   @param entry  Entry of the read, to be passed to fast5_reader_seek [out]
+ *   @param readname  As for fast5_reader_next, or NULL if not wanted [out]
+ *   @param nsample  Number of samples in read, 0 if its signal could not be found,
+ *   or NULL if not wanted [out]
+ *
+ *   @returns true if a read was found, false if there are no more reads
+ **/
+bool fast5_reader_next_entry(fast5_reader * reader, hsize_t * entry, char ** readname, size_t * nsample) {
+    assert(NULL != entry);
+    *entry = (NULL != reader) ? reader->next : 0;
+    if (NULL != nsample) {
+        *nsample = 0;
+    }
+    char * name = NULL;
+    char * read_path = NULL;
+    char * scaling_path = NULL;
+    const bool found = reader_next_path(reader, &name, &read_path, &scaling_path);
+    if (NULL != readname) {
+        *readname = name;
+        name = NULL;
+    }
+    if (!found) {
+        return false;
+    }
+    //  Entries that are not reads may have been skipped
+    *entry = reader->multi ? reader->next - 1 : 0;
+
+    char * signal_path = (NULL != read_path && NULL != nsample)
+        ? calloc(strlen(read_path) + 8, sizeof(char)) : NULL;
+    if (NULL != signal_path) {
+        (void)sprintf(signal_path, "%s/Signal", read_path);
+        hid_t dset = H5Dopen(reader->hdf5file, signal_path, H5P_DEFAULT);
+        if (dset >= 0) {
+            hid_t space = H5Dget_space(dset);
+            hsize_t dims;
+            if (space >= 0 && 1 == H5Sget_simple_extent_ndims(space)
+                && H5Sget_simple_extent_dims(space, &dims, NULL) >= 0) {
+                *nsample = dims;
+            }
+            if (space >= 0) {
+                H5Sclose(space);
+            }
+            H5Dclose(dset);
+        }
+    }
+    free(signal_path);
+    free(scaling_path);
+    free(read_path);
+    free(name);
+    return true;
+}
+
+
+/**  Move reader so that the next read is that of an entry
+ *
+ *   @param reader  Open reader
+ *   @param entry  Entry of read, as found by fast5_reader_next_entry
+ **/
+void fast5_reader_seek(fast5_reader * reader, hsize_t entry) {
+    assert(NULL != reader);
+    reader->next = (entry < reader->nentry) ? entry : reader->nentry;
+}
+
+
+raw_table read_raw(const char *filename, bool scale_to_pA) {
+    assert(NULL != filename);
+    fast5_reader * reader = open_fast5_reader(filename);
+    RETURN_NULL_IF(NULL == reader, ((raw_table){ NULL, 0, 0, 0, NULL }));
+    char * readname = NULL;
+    raw_table rawtbl = fast5_reader_next(reader, scale_to_pA, &readname);
+    free(readname);
+    reader = free_fast5_reader(reader);
+    return rawtbl;
+}
+
+/**  Create memory and file representations of event table for HDF5
+ *
+ *   @param memtype  Memory representation [out]
+ *   @param filetype  File representation [out]
+ *
+ *   @returns true on success.  On failure, any type created has been closed.
+ **/
+static bool create_event_types(hid_t * memtype, hid_t * filetype) {
     // Memory representation
-    hid_t memtype = H5Tcreate(H5T_COMPOUND, sizeof(event_t));
-    if (memtype < 0) {
+    *memtype = H5Tcreate(H5T_COMPOUND, sizeof(event_t));
+    if (*memtype < 0) {
         warnx("Failed to create memroy representation for event table %s:%d.",
               __FILE__, __LINE__);
-        goto clean1;
+        return false;
     }
-    H5Tinsert(memtype, "start", HOFFSET(event_t, start), H5T_NATIVE_UINT64);
-    H5Tinsert(memtype, "length", HOFFSET(event_t, length), H5T_NATIVE_FLOAT);
-    H5Tinsert(memtype, "mean", HOFFSET(event_t, mean), H5T_NATIVE_FLOAT);
-    H5Tinsert(memtype, "stdv", HOFFSET(event_t, stdv), H5T_NATIVE_FLOAT);
-    H5Tinsert(memtype, "pos", HOFFSET(event_t, pos), H5T_NATIVE_INT);
+    H5Tinsert(*memtype, "start", HOFFSET(event_t, start), H5T_NATIVE_UINT64);
+    H5Tinsert(*memtype, "length", HOFFSET(event_t, length), H5T_NATIVE_FLOAT);
+    H5Tinsert(*memtype, "mean", HOFFSET(event_t, mean), H5T_NATIVE_FLOAT);
+    H5Tinsert(*memtype, "stdv", HOFFSET(event_t, stdv), H5T_NATIVE_FLOAT);
+    H5Tinsert(*memtype, "pos", HOFFSET(event_t, pos), H5T_NATIVE_INT);
 
     // File representation
-    hid_t filetype = H5Tcreate(H5T_COMPOUND, 4 * 5);
-    if (filetype < 0) {
+    *filetype = H5Tcreate(H5T_COMPOUND, 4 * 5);
+    if (*filetype < 0) {
         warnx("Failed to create file representation for event table %s:%d.",
               __FILE__, __LINE__);
-        goto clean2;
+        H5Tclose(*memtype);
+        return false;
     }
 
-    H5Tinsert(filetype, "start", 0, H5T_STD_U64LE);
-    H5Tinsert(filetype, "length", 4, H5T_IEEE_F32LE);
-    H5Tinsert(filetype, "mean", 4 * 2, H5T_IEEE_F32LE);
-    H5Tinsert(filetype, "stdv", 4 * 3, H5T_IEEE_F32LE);
-    H5Tinsert(filetype, "pos", 4 * 4, H5T_STD_I32LE);
+    H5Tinsert(*filetype, "start", 0, H5T_STD_U64LE);
+    H5Tinsert(*filetype, "length", 4, H5T_IEEE_F32LE);
+    H5Tinsert(*filetype, "mean", 4 * 2, H5T_IEEE_F32LE);
+    H5Tinsert(*filetype, "stdv", 4 * 3, H5T_IEEE_F32LE);
+    H5Tinsert(*filetype, "pos", 4 * 4, H5T_STD_I32LE);
+
+    return true;
+}
+
 
+/**  Create dataset for event table
+ *
+ *   @returns Dataset or a negative value on failure
+ **/
+static hid_t create_event_dataset(hid_t hdf5file, const char *readname, hid_t filetype,
+                                  hsize_t nevent, hsize_t chunk_size, int compression_level) {
     // Create dataset
-    const hsize_t dims = et.n;
+    const hsize_t dims = nevent;
     hid_t space = H5Screate_simple(1, &dims, NULL);
     if (space < 0) {
         warnx("Failed to allocate dataspace for event table %s:%d.", __FILE__,
               __LINE__);
-        goto clean3;
+        return -1;
     }
     // Enable compression if available
     hid_t properties = H5P_DEFAULT;
@@ -277,31 +549,310 @@ void write_annotated_events(hid_t hdf5file, const char *readname,
     if (dset < 0) {
         warnx("Failed to create dataset for event table %s:%d.", __FILE__,
               __LINE__);
-        goto clean4;
-    }
-    // Write data
-    herr_t writeret =
-        H5Dwrite(dset, memtype, H5S_ALL, H5S_ALL, H5P_DEFAULT, et.event);
-    if (writeret < 0) {
-        warnx("Failed to write dataset for event table %s:%d.", __FILE__,
-              __LINE__);
     }
 
- clean4:
     if (H5P_DEFAULT != properties) {
         H5Pclose(properties);
     }
-    H5Dclose(dset);
- clean3:
     H5Sclose(space);
- clean2:
+    return dset;
+}
+
+
+void write_annotated_events(hid_t hdf5file, const char *readname,
+                            const event_table et, hsize_t chunk_size,
+                            int compression_level) {
+    assert(compression_level >= 0 && compression_level <= 9);
+
+    hid_t memtype, filetype;
+    if (!create_event_types(&memtype, &filetype)) {
+        return;
+    }
+
+    hid_t dset = create_event_dataset(hdf5file, readname, filetype, et.n,
+                                      chunk_size, compression_level);
+    if (dset >= 0) {
+        // Write data
+        herr_t writeret =
+            H5Dwrite(dset, memtype, H5S_ALL, H5S_ALL, H5P_DEFAULT, et.event);
+        if (writeret < 0) {
+            warnx("Failed to write dataset for event table %s:%d.", __FILE__,
+                  __LINE__);
+        }
+        H5Dclose(dset);
+    }
+
     H5Tclose(filetype);
- clean1:
     H5Tclose(memtype);
 }
 
+
+/**  Encode event table ready for writing as a compressed HDF5 dataset
+ *
+ *   The events are converted to their file representation then each chunk
+ *   is shuffled and deflated exactly as the HDF5 filters set up by
+ *   write_annotated_events would.  This is the expensive part of writing and
+ *   may be done on many threads at once; write_encoded_events then only has
+ *   to store the chunks.
+ *
+ *   @param et  Event table
+ *   @param chunk_size  Chunk size for HDF5 output
+ *   @param compression_level  Gzip compression level, 1 to 9
+ *
+ *   @returns Encoded events.  On failure, or if the events are not to be
+ *   compressed, no chunks are encoded and write_annotated_events should be
+ *   used instead.
+ **/
+encoded_events encode_annotated_events(const event_table et, hsize_t chunk_size,
+                                       int compression_level) {
+    assert(compression_level >= 0 && compression_level <= 9);
+    encoded_events enc = {et.n, chunk_size, compression_level, 0, NULL, NULL};
+    //  A chunk may not be larger than a fixed size dataset
+    if (0 == compression_level || 0 == chunk_size || et.n < chunk_size || NULL == et.event) {
+        return enc;
+    }
+
+    hid_t memtype, filetype;
+    if (!create_event_types(&memtype, &filetype)) {
+        return enc;
+    }
+    const size_t msize = H5Tget_size(memtype);
+    const size_t fsize = H5Tget_size(filetype);
+    const size_t nchunk = (et.n + chunk_size - 1) / chunk_size;
+    const size_t chunk_nbyte = chunk_size * fsize;
+
+    //  Conversion is in place so buffer must hold larger of two representations
+    unsigned char * conv = calloc(nchunk * chunk_size, (msize > fsize) ? msize : fsize);
+    unsigned char * background = calloc(et.n, fsize);
+    unsigned char * shuffled = calloc(chunk_nbyte, sizeof(unsigned char));
+    enc.chunk = calloc(nchunk, sizeof(unsigned char *));
+    enc.chunk_nbyte = calloc(nchunk, sizeof(size_t));
+    if (NULL == conv || NULL == background || NULL == shuffled || NULL == enc.chunk || NULL == enc.chunk_nbyte) {
+        goto cleanup;
+    }
+    memcpy(conv, et.event, et.n * sizeof(event_t));
+    if (H5Tconvert(memtype, filetype, et.n, conv, background, H5P_DEFAULT) < 0) {
+        warnx("Failed to convert event table to file representation %s:%d.", __FILE__, __LINE__);
+        goto cleanup;
+    }
+    //  Padding of final chunk is the default fill value of zeros
+    memset(conv + et.n * fsize, 0, (nchunk * chunk_size - et.n) * fsize);
+
+    enc.nchunk = nchunk;
+    for (size_t c = 0; c < nchunk; c++) {
+        const unsigned char * chunk = conv + c * chunk_nbyte;
+        for (size_t i = 0; i < chunk_size; i++) {
+            for (size_t b = 0; b < fsize; b++) {
+                shuffled[b * chunk_size + i] = chunk[i * fsize + b];
+            }
+        }
+        uLongf nbyte = compressBound(chunk_nbyte);
+        enc.chunk[c] = malloc(nbyte);
+        if (NULL == enc.chunk[c]
+            || Z_OK != compress2(enc.chunk[c], &nbyte, shuffled, chunk_nbyte, compression_level)) {
+            warnx("Failed to compress event table %s:%d.", __FILE__, __LINE__);
+            free_encoded_events(&enc);
+            break;
+        }
+        enc.chunk_nbyte[c] = nbyte;
+    }
+
+cleanup:
+    if (0 == enc.nchunk) {
+        free(enc.chunk_nbyte);
+        free(enc.chunk);
+        enc.chunk_nbyte = NULL;
+        enc.chunk = NULL;
+    }
+    free(shuffled);
+    free(background);
+    free(conv);
+    H5Tclose(filetype);
+    H5Tclose(memtype);
+
+    return enc;
+}
+
+
+/**  Write event table encoded by encode_annotated_events
+ *
+ *   Produces the same dataset as write_annotated_events.
+ **/
+void write_encoded_events(hid_t hdf5file, const char *readname,
+                          const encoded_events enc) {
+    if (0 == enc.nchunk) {
+        return;
+    }
+    hid_t memtype, filetype;
+    if (!create_event_types(&memtype, &filetype)) {
+        return;
+    }
+
+    hid_t dset = create_event_dataset(hdf5file, readname, filetype, enc.nevent,
+                                      enc.chunk_size, enc.compression_level);
+    if (dset >= 0) {
+        for (size_t c = 0; c < enc.nchunk; c++) {
+            const hsize_t offset = c * enc.chunk_size;
+            //  Filter mask of zero, all filters have been applied
+            if (H5Dwrite_chunk(dset, H5P_DEFAULT, 0, &offset, enc.chunk_nbyte[c], enc.chunk[c]) < 0) {
+                warnx("Failed to write dataset for event table %s:%d.", __FILE__,
+                      __LINE__);
+                break;
+            }
+        }
+        H5Dclose(dset);
+    }
+
+    H5Tclose(filetype);
+    H5Tclose(memtype);
+}
+
+
+void free_encoded_events(encoded_events * enc) {
+    if (NULL == enc) {
+        return;
+    }
+    for (size_t c = 0; c < enc->nchunk; c++) {
+        free(enc->chunk[c]);
+    }
+    free(enc->chunk);
+    free(enc->chunk_nbyte);
+    enc->nchunk = 0;
+    enc->chunk = NULL;
+    enc->chunk_nbyte = NULL;
+}
+
 void write_annotated_raw(hid_t hdf5file, const char *readname,
                          const raw_table rt, hsize_t chunk_size,
                          int compression_level) {
     return;
 }
+
+
+static bool write_float_attribute(hid_t group, const char * attribute, float value) {
+    hid_t space = H5Screate(H5S_SCALAR);
+    RETURN_NULL_IF(space < 0, false);
+    hid_t attr = H5Acreate(group, attribute, H5T_IEEE_F64LE, space, H5P_DEFAULT, H5P_DEFAULT);
+    const bool status = (attr >= 0) && (H5Awrite(attr, H5T_NATIVE_FLOAT, &value) >= 0);
+    if (attr >= 0) {
+        H5Aclose(attr);
+    }
+    H5Sclose(space);
+    return status;
+}
+
+
+static bool write_string_attribute(hid_t group, const char * attribute, const char * value) {
+    hid_t space = H5Screate(H5S_SCALAR);
+    RETURN_NULL_IF(space < 0, false);
+    hid_t atype = H5Tcopy(H5T_C_S1);
+    H5Tset_size(atype, strlen(value) + 1);
+    H5Tset_strpad(atype, H5T_STR_NULLTERM);
+    hid_t attr = H5Acreate(group, attribute, atype, space, H5P_DEFAULT, H5P_DEFAULT);
+    const bool status = (attr >= 0) && (H5Awrite(attr, atype, value) >= 0);
+    if (attr >= 0) {
+        H5Aclose(attr);
+    }
+    H5Tclose(atype);
+    H5Sclose(space);
+    return status;
+}
+
+
+/**  Write raw signal of a read to a multi-read fast5 file
+ *
+ *   The read is written to the layout read by fast5_reader_next, the signal
+ *   to /read_<id>/Raw/Signal with the read_id as an attribute of
+ *   /read_<id>/Raw and its scaling to pA as attributes of
+ *   /read_<id>/channel_id.
+ *
+ *   @param hdf5file  File open for writing
+ *   @param read_id  Identifier of read
+ *   @param sample  ADC values of signal
+ *   @param nsample  Length of signal
+ *   @param scaling  Scaling of ADC values to pA
+ *   @param chunk_size  Chunk size for HDF5 output
+ *   @param compression_level  Gzip compression level, 0 for no compression
+ *
+ *   @returns true on success
+ **/
+bool write_raw_read(hid_t hdf5file, const char * read_id, const int16_t * sample,
+                    size_t nsample, const fast5_raw_scaling scaling, hsize_t chunk_size,
+                    int compression_level) {
+    assert(compression_level >= 0 && compression_level <= 9);
+    RETURN_NULL_IF(NULL == read_id, false);
+    RETURN_NULL_IF(NULL == sample && nsample > 0, false);
+
+    bool status = false;
+    const size_t path_len = strlen(read_id) + 20;
+    char * path = calloc(path_len, sizeof(char));
+    RETURN_NULL_IF(NULL == path, false);
+
+    (void)snprintf(path, path_len, "/read_%s", read_id);
+    hid_t rgroup = H5Gcreate(hdf5file, path, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    if (rgroup < 0) {
+        warnx("Failed to create group %s.", path);
+        goto cleanup1;
+    }
+    hid_t cgroup = H5Gcreate(rgroup, "channel_id", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    hid_t raw_group = H5Gcreate(rgroup, "Raw", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+    if (cgroup < 0 || raw_group < 0) {
+        warnx("Failed to create groups under %s.", path);
+        goto cleanup2;
+    }
+    if (!write_float_attribute(cgroup, "digitisation", scaling.digitisation)
+        || !write_float_attribute(cgroup, "offset", scaling.offset)
+        || !write_float_attribute(cgroup, "range", scaling.range)
+        || !write_float_attribute(cgroup, "sampling_rate", scaling.sample_rate)
+        || !write_string_attribute(raw_group, "read_id", read_id)) {
+        warnx("Failed to write attributes of read %s.", read_id);
+        goto cleanup2;
+    }
+
+    const hsize_t dims = nsample;
+    hid_t space = H5Screate_simple(1, &dims, NULL);
+    if (space < 0) {
+        warnx("Failed to allocate dataspace for raw signal %s:%d.", __FILE__, __LINE__);
+        goto cleanup2;
+    }
+    hid_t properties = H5P_DEFAULT;
+    //  A chunk may not be larger than a fixed size dataset
+    const hsize_t chunk = (nsample < chunk_size) ? nsample : chunk_size;
+    if (compression_level > 0 && chunk > 0) {
+        properties = H5Pcreate(H5P_DATASET_CREATE);
+        if (properties < 0) {
+            properties = H5P_DEFAULT;
+        } else {
+            H5Pset_deflate(properties, compression_level);
+            H5Pset_chunk(properties, 1, &chunk);
+        }
+    }
+    hid_t dset = H5Dcreate(raw_group, "Signal", H5T_STD_I16LE, space, H5P_DEFAULT, properties, H5P_DEFAULT);
+    if (dset < 0) {
+        warnx("Failed to create dataset for raw signal %s:%d.", __FILE__, __LINE__);
+    } else {
+        status = (0 == nsample)
+            || (H5Dwrite(dset, H5T_NATIVE_INT16, H5S_ALL, H5S_ALL, H5P_DEFAULT, sample) >= 0);
+        if (!status) {
+            warnx("Failed to write raw signal of read %s.", read_id);
+        }
+        H5Dclose(dset);
+    }
+    if (H5P_DEFAULT != properties) {
+        H5Pclose(properties);
+    }
+    H5Sclose(space);
+
+ cleanup2:
+    if (raw_group >= 0) {
+        H5Gclose(raw_group);
+    }
+    if (cgroup >= 0) {
+        H5Gclose(cgroup);
+    }
+    H5Gclose(rgroup);
+ cleanup1:
+    free(path);
+
+    return status;
+}
@@ -6,13 +6,54 @@
 #    include <stdbool.h>
 #    include "scrappie_structures.h"
 
+typedef struct {
+    hid_t hdf5file;
+    bool multi;
+    hsize_t nentry;
+    hsize_t next;
+} fast5_reader;
+
+typedef struct {
+    //  Information for scaling raw data from ADC values to pA
+    float digitisation;
+    float offset;
+    float range;
+    float sample_rate;
+} fast5_raw_scaling;
+
 raw_table read_raw(const char *filename, bool scale_to_pA);
+fast5_reader * open_fast5_reader(const char *filename);
+fast5_reader * free_fast5_reader(fast5_reader * reader);
+bool fast5_reader_finished(const fast5_reader * reader);
+raw_table fast5_reader_next(fast5_reader * reader, bool scale_to_pA, char ** readname);
+raw_table fast5_reader_next_native(fast5_reader * reader, char ** readname);
+bool fast5_reader_next_entry(fast5_reader * reader, hsize_t * entry, char ** readname, size_t * nsample);
+void fast5_reader_seek(fast5_reader * reader, hsize_t entry);
+
+/**  Event table encoded ready for writing as compressed chunks
+ **/
+typedef struct {
+    hsize_t nevent;
+    hsize_t chunk_size;
+    int compression_level;
+    size_t nchunk;
+    unsigned char ** chunk;
+    size_t * chunk_nbyte;
+} encoded_events;
 
 void write_annotated_events(hid_t hdf5file, const char *readname,
                             const event_table ev, hsize_t chunk_size,
                             int compression_level);
+encoded_events encode_annotated_events(const event_table et, hsize_t chunk_size,
+                                       int compression_level);
+void write_encoded_events(hid_t hdf5file, const char *readname,
+                          const encoded_events enc);
+void free_encoded_events(encoded_events * enc);
 void write_annotated_raw(hid_t hdf5file, const char *readname,
                          const raw_table rt, hsize_t chunk_size,
                          int compression_level);
+bool write_raw_read(hid_t hdf5file, const char * read_id, const int16_t * sample,
+                    size_t nsample, const fast5_raw_scaling scaling, hsize_t chunk_size,
+                    int compression_level);
 
 #endif                          /* EVENTS_H */
@@ -140,6 +140,10 @@ int findRuns(int *path, int **runstarts, int **runlengths, int **runbases,
             }
         }
     }
+    if (0 == runcount) {
+        //Nothing to shrink, and realloc of zero bytes may return NULL
+        return 0;
+    }
     //We allocated the arrays at the start using far too much space: reallocate to what we need
     *runstarts  = (int *)realloc(*runstarts,  runcount * sizeof(int));
     *runlengths = (int *)realloc(*runlengths, runcount * sizeof(int));
@@ -156,6 +160,81 @@ int findRuns(int *path, int **runstarts, int **runlengths, int **runbases,
     return runcount;
 }
 
+/**  Log posterior of state in block from either a dense or a sparse posterior
+ **/
+static inline float homopolymer_logpost(const_scrappie_matrix post, const_sparse_posterior sparse,
+                                         int blk, int state) {
+    if (NULL == sparse) {
+        return post->data.f[blk * post->stride + state];
+    }
+    return sparse_posterior_value(sparse, blk, state);
+}
+
+/**  Replace Viterbi length of a homopolymer run by its mean length
+ *
+ *   @param ambigfrom   location in path of the first ambiguous block of the run
+ *   @param runlength   number of ambiguous blocks in the run
+ *   @param runstate    index of the kmer of the repeated base
+ *   @param staystate   index of the stay in the posterior
+ **/
+static void homopolymer_correct_run_impl(const_scrappie_matrix post, const_sparse_posterior sparse,
+                                         int *viterbipath, int ambigfrom, int runlength,
+                                         int runstate, int staystate) {
+    //Calculate Viterbi (as a check against the existing sequence) and mean numbers of non-stays
+    //While we're at it, count number of non-stays in the existing sequence
+    int nviterbi = 0;
+    int ncalcviterbi = 0;
+    double nmean = 0.0;
+    int ambigto = ambigfrom + runlength - 1;        //location of the last ambiguous block
+    //Calculate normalised stay probabilities for each of the ambiguous locations
+    for (int i = ambigfrom; i <= ambigto; i++) {
+        // Note that in Scrappie,
+        // index in posteriors is shifted along one step from index
+        // in path, so that post[t*post->data.f+j] corresponds to path[t+1]
+        double psu = expf(homopolymer_logpost(post, sparse, i-1, staystate));   //Stay probability (un-normalised) - note posts are logged in Scrappie and shifted one step
+        double pru = expf(homopolymer_logpost(post, sparse, i-1, runstate));    //Repeat block probability (un-normalised)
+        double pr = pru / (pru + psu);      //Normalised repeat block probability
+        nmean = nmean + pr;
+        if (pr > 0.5)
+            ncalcviterbi = ncalcviterbi + 1;
+        if (viterbipath[i] == runstate)
+            nviterbi = nviterbi + 1;
+    }
+    int newn = (int)(nmean + 0.5);  //nmean is a float so need to round
+    //Make modification to the path if necessary
+    if (newn != nviterbi) {
+        for (int i = 0; i <= ambigto - ambigfrom; i++) {
+            //Fill in the right number of repeat blocks, putting stays for the rest
+            //(order doesn't matter since this path will be collapsed to a sequence)
+            if (i < newn) {
+                viterbipath[i + ambigfrom] = runstate;
+            } else
+                viterbipath[i + ambigfrom] = STAYPATH;
+        }
+    }
+}
+
+/**  Correct a single homopolymer run of a path to its mean length
+ *
+ *   The run is as found by findRuns, for callers finding runs themselves
+ *   during a traceback.
+ *
+ *   @param post        scrappie matrix of posterior probabilities (logged)
+ *   @param viterbipath vector of ints representing path, modified in place
+ *   @param start       location in path of the first ambiguous block of the run (at least one)
+ *   @param length      number of ambiguous blocks in the run
+ *   @param base        integer 0-3 representing the base which repeats
+ **/
+void homopolymer_correct_run(const_scrappie_matrix post, int *viterbipath, int start, int length,
+                             int base) {
+    const int kmerlength = kmerlength_fromnblocks(post->nr);
+    homopolymer_correct_run_impl(post, NULL, viterbipath, start, length,
+                                 repeatblock(base, kmerlength), post->nr - 1);
+}
+
+static int homopolymer_path_impl(const_scrappie_matrix post, const_sparse_posterior sparse,
+                                 int *viterbipath);
+
 /**  Find homopolymer runs in a path array and modify according to path calculations
  *   Details: hunt for homopolymer runs, calculate the mean run length using the posterior matrix,
  *   modify the given path so that instead of the Viterbi run length it has the mean
@@ -177,13 +256,38 @@ int homopolymer_path(const_scrappie_matrix post, int *viterbipath,
     if (pathCalculationFlag != HOMOPOLYMER_MEAN) {
         return 0;
     }
-    const int nsamples = (int)(post->nc);        //Number of locations (samples) in read
-    const int staystate = (int)(post->nr-1);     //index of the stay in posterior vectors (also the last element)
-    const int kmerlength = kmerlength_fromnblocks(post->nr);
+    RETURN_NULL_IF(NULL == post, -1);
+    return homopolymer_path_impl(post, NULL, viterbipath);
+}
+
+/**  As homopolymer_path but using a sparse posterior
+ *
+ *   States not kept in the sparse posterior take its floor value.
+ *
+ *   @param post                     sparse posterior probabilities (logged)
+ *   @param viterbipath              vector of ints representing path
+ *   @param pathCalculationFlag      set to HOMOPOLYMER_NOCHANGE or HOMOPOLYMER_MEAN
+ *
+ *   @return 0 on success, negative on failure
+ **/
+int homopolymer_path_sparse(const_sparse_posterior post, int *viterbipath,
+                            enum homopolymer_calculation pathCalculationFlag) {
+    if (pathCalculationFlag != HOMOPOLYMER_MEAN) {
+        return 0;
+    }
+    RETURN_NULL_IF(NULL == post, -1);
+    return homopolymer_path_impl(NULL, post, viterbipath);
+}
+
+static int homopolymer_path_impl(const_scrappie_matrix post, const_sparse_posterior sparse,
+                                 int *viterbipath) {
+    const size_t nstate = (NULL == sparse) ? post->nr : sparse->nstate;
+    const int nsamples = (int)((NULL == sparse) ? post->nc : sparse->nblock);        //Number of locations (samples) in read
+    const int staystate = (int)(nstate-1);     //index of the stay in posterior vectors (also the last element)
+    const int kmerlength = kmerlength_fromnblocks(nstate);
     int *runstarts;             //Location of start (first ambiguous location) in each homopol run
     int *runlengths;            //Length of ambiguous section
     int *runbases;              //Integer 0-3 representing the base which repeats in the homopol run
-    RETURN_NULL_IF(NULL == post, -1);
     RETURN_NULL_IF(NULL == viterbipath, -1);
     //Find homopolymer runs
     int runcount =
@@ -192,41 +296,9 @@ int homopolymer_path(const_scrappie_matrix post, int *viterbipath,
         return runcount;
     for (int nrun = 0; nrun < runcount; nrun++) //For each homopolymer run...
     {
-        //Calculate Viterbi (as a check against the existing sequence) and mean numbers of non-stays
-        //While we're at it, count number of non-stays in the existing sequence
-        int nviterbi = 0;
-        int ncalcviterbi = 0;
-        double nmean = 0.0;
         int runstate = repeatblock(runbases[nrun],kmerlength);  //index of a fivemer with the repeat base repeated 5x
-        int runlength = runlengths[nrun];
-        int ambigfrom = runstarts[nrun];        //location of the first ambiguous block in the homopol run
-        int ambigto = ambigfrom + runlength - 1;        //location of the last ambiguous block
-        //Calculate normalised stay probabilities for each of the ambiguous locations
-        for (int i = ambigfrom; i <= ambigto; i++) {
-            // Note that in Scrappie,
-            // index in posteriors is shifted along one step from index
-            // in path, so that post[t*post->data.f+j] corresponds to path[t+1]
-            double psu = expf(post->data.f[(i-1)*post->stride+staystate]);   //Stay probability (un-normalised) - note posts are logged in Scrappie and shifted one step
-            double pru = expf(post->data.f[(i-1)*post->stride+runstate ]);    //Repeat block probability (un-normalised)
-            double pr = pru / (pru + psu);      //Normalised repeat block probability
-            nmean = nmean + pr;
-            if (pr > 0.5)
-                ncalcviterbi = ncalcviterbi + 1;
-            if (viterbipath[i] == runstate)
-                nviterbi = nviterbi + 1;
-        }
-        int newn = (int)(nmean + 0.5);  //nmean is a float so need to round
-        //Make modification to the path if necessary
-        if (newn != nviterbi) {
-            for (int i = 0; i <= ambigto - ambigfrom; i++) {
-                //Fill in the right number of repeat blocks, putting stays for the rest
-                //(order doesn't matter since this path will be collapsed to a sequence)
-                if (i < newn) {
-                    viterbipath[i + ambigfrom] = runstate;
-                } else
-                    viterbipath[i + ambigfrom] = STAYPATH;
-            }
-        }
+        homopolymer_correct_run_impl(post, sparse, viterbipath, runstarts[nrun], runlengths[nrun],
+                                     runstate, staystate);
     }
     free(runstarts);
     free(runlengths);
@@ -4,6 +4,7 @@
 #    include <stdbool.h>
 #    include "scrappie_matrix.h"
 #    include "scrappie_structures.h"
+#    include "sparse_posterior.h"
 //Modes of operation (to be sent to the input pathCalculationFlag)
 enum homopolymer_calculation{
     HOMOPOLYMER_NOCHANGE,
@@ -12,4 +13,6 @@ enum homopolymer_calculation{
 
 enum homopolymer_calculation get_homopolymer_calculation(const char * calcstring);    
 int homopolymer_path(const_scrappie_matrix post, int *viterbipath, enum homopolymer_calculation pathCalculationFlag);
+int homopolymer_path_sparse(const_sparse_posterior post, int *viterbipath, enum homopolymer_calculation pathCalculationFlag);
+void homopolymer_correct_run(const_scrappie_matrix post, int *viterbipath, int start, int length, int base);
 #endif
\ No newline at end of file
@@ -5,6 +5,8 @@
 #endif
 #include <math.h>
 #include "layers.h"
+#include "scrappie_profile.h"
+#include "scrappie_simd.h"
 #include "scrappie_stdlib.h"
 #include "util.h"
 
@@ -14,12 +16,7 @@
  **/
 void tanh_activation_inplace(scrappie_matrix C) {
     RETURN_NULL_IF(NULL == C, );
-    for (size_t c = 0; c < C->nc; ++c) {
-        const size_t offset = c * C->nrq;
-        for (size_t r = 0; r < C->nrq; ++r) {
-            C->data.v[offset + r] = TANHFV(C->data.v[offset + r]);
-        }
-    }
+    tanhf_array_inplace(C->data.f, C->stride * C->nc);
     (void)validate_scrappie_matrix(C, -1.0, 1.0, 0.0, true, __FILE__, __LINE__);
 }
 
@@ -29,12 +26,7 @@ void tanh_activation_inplace(scrappie_matrix C) {
  **/
 void exp_activation_inplace(scrappie_matrix C) {
     RETURN_NULL_IF(NULL == C, );
-    for (size_t c = 0; c < C->nc; ++c) {
-        const size_t offset = c * C->nrq;
-        for (size_t r = 0; r < C->nrq; ++r) {
-            C->data.v[offset + r] = EXPFV(C->data.v[offset + r]);
-        }
-    }
+    expf_array_inplace(C->data.f, C->stride * C->nc);
     (void)validate_scrappie_matrix(C, 0.0, INFINITY, 1.0, true, __FILE__,
                                    __LINE__);
 }
@@ -45,12 +37,7 @@ void exp_activation_inplace(scrappie_matrix C) {
  **/
 void log_activation_inplace(scrappie_matrix C) {
     RETURN_NULL_IF(NULL == C, );
-    for (size_t c = 0; c < C->nc; ++c) {
-        const size_t offset = c * C->nrq;
-        for (size_t r = 0; r < C->nrq; ++r) {
-            C->data.v[offset + r] = LOGFV(C->data.v[offset + r]);
-        }
-    }
+    logf_array_inplace(C->data.f, C->stride * C->nc);
 }
 
 /**  Apply ELU activation function to a matrix element-wise
@@ -59,12 +46,7 @@ void log_activation_inplace(scrappie_matrix C) {
  **/
 void elu_activation_inplace(scrappie_matrix C) {
     RETURN_NULL_IF(NULL == C, );
-    for (size_t c = 0; c < C->nc; ++c) {
-        const size_t offset = c * C->nrq;
-        for (size_t r = 0; r < C->nrq; ++r) {
-            C->data.v[offset + r] = ELUFV(C->data.v[offset + r]);
-        }
-    }
+    eluf_array_inplace(C->data.f, C->stride * C->nc);
 }
 
 /** Apply robost log activation
@@ -156,10 +138,105 @@ scrappie_matrix window(const_scrappie_matrix input, size_t w, size_t stride) {
  *  a multiple of the SSE vector size (4).  The filter matrix must have been
  *  expanded accordingly.
  **/
+/*  Columns of output computed between applications of the activation  */
+#define CONVOLUTION_DIRECT_BLOCK 64
+
+/**  Direct convolution of an input with few channels
+ *
+ *   The input is copied once, without the padding of its rows, into a single
+ *   zero-padded array, so the window of each output starts stride * nr values
+ *   after that of the previous one.  Windows overlap in memory and are used in
+ *   place, rather than being copied out as window() does or padded to four
+ *   values per sample as the GEMM formulation requires, which for a single
+ *   channel signal would make three quarters of the work multiplication by
+ *   zero.  The activation is applied to each block of output while it is
+ *   still in cache.
+ *
+ *   @returns false on failure to allocate memory
+ **/
+static bool convolution_direct(const_scrappie_matrix X, const_scrappie_matrix W,
+                               const_scrappie_matrix b, size_t stride,
+                               scrappie_activation_ptr activation, scrappie_matrix C) {
+    const size_t nr = X->nr;
+    const size_t winlen = W->nrq / X->nrq;
+    const size_t padL = (winlen - 1) / 2;
+    const size_t nk = winlen * nr;
+    const size_t npanel = iceil(W->nc, SCRAPPIE_PANEL_WIDTH);
+    //  Samples spanned by all windows, including padding at either end
+    const size_t nsample = (C->nc - 1) * stride + winlen;
+
+    float * panels = NULL;
+    float * bias = NULL;
+    float * signal = NULL;
+    const bool failed =
+        0 != scrappie_memalign((void **)&panels, 64, npanel * nk * SCRAPPIE_PANEL_WIDTH * sizeof(float))
+        || 0 != scrappie_memalign((void **)&bias, 64, npanel * SCRAPPIE_PANEL_WIDTH * sizeof(float))
+        || 0 != scrappie_memalign((void **)&signal, 64, nsample * nr * sizeof(float));
+    if (failed) {
+        free(signal);
+        free(bias);
+        free(panels);
+        return false;
+    }
+
+    //  Tap k of the filter is channel k % nr of sample k / nr of the window
+    memset(panels, 0, npanel * nk * SCRAPPIE_PANEL_WIDTH * sizeof(float));
+    memset(bias, 0, npanel * SCRAPPIE_PANEL_WIDTH * sizeof(float));
+    for (size_t f = 0; f < W->nc; f++) {
+        float * pf = panels + (f / SCRAPPIE_PANEL_WIDTH) * nk * SCRAPPIE_PANEL_WIDTH
+                            + f % SCRAPPIE_PANEL_WIDTH;
+        float const * wf = W->data.f + f * W->stride;
+        for (size_t k = 0; k < nk; k++) {
+            pf[k * SCRAPPIE_PANEL_WIDTH] = wf[(k / nr) * X->stride + k % nr];
+        }
+        bias[f] = b->data.f[f];
+    }
+
+    memset(signal, 0, nsample * nr * sizeof(float));
+    const size_t ncopy = (X->nc < nsample - padL) ? X->nc : nsample - padL;
+    for (size_t i = 0; i < ncopy; i++) {
+        for (size_t ch = 0; ch < nr; ch++) {
+            signal[(i + padL) * nr + ch] = X->data.f[i * X->stride + ch];
+        }
+    }
+
+    for (size_t j = 0; j < C->nc; j += CONVOLUTION_DIRECT_BLOCK) {
+        const size_t ncol = (j + CONVOLUTION_DIRECT_BLOCK <= C->nc) ? CONVOLUTION_DIRECT_BLOCK : C->nc - j;
+        float * cj = C->data.f + j * C->stride;
+        panel_affine(panels, npanel, nk, signal + j * stride * nr, stride * nr, bias, 0,
+                     cj, C->stride, ncol);
+        if (NULL != activation) {
+            activation(cj, ncol * C->stride);
+        }
+    }
+
+    free(signal);
+    free(bias);
+    free(panels);
+    return true;
+}
+
 scrappie_matrix convolution(const_scrappie_matrix X, const_scrappie_matrix W,
                             const_scrappie_matrix b, size_t stride,
                             scrappie_matrix C) {
+    return convolution_activation(X, W, b, stride, NULL, C);
+}
+
+/**  Convolution followed by an activation function
+ *
+ *   Inputs of fewer than four channels, like the raw signal, are convolved
+ *   directly and the activation fused; otherwise the convolution is a
+ *   strided matrix multiplication and the activation applied afterwards.
+ *
+ *   @param activation  Function applied element-wise to the output, or NULL
+ *
+ *   @returns Output of convolution or NULL on failure
+ **/
+scrappie_matrix convolution_activation(const_scrappie_matrix X, const_scrappie_matrix W,
+                                       const_scrappie_matrix b, size_t stride,
+                                       scrappie_activation_ptr activation, scrappie_matrix C) {
     RETURN_NULL_IF(NULL == X, NULL);
+    scrappie_profile_begin(SCRAPPIE_STAGE_CONVOLUTION);
     assert(NULL != W);
     assert(NULL != b);
     assert(W->nc == b->nr);
@@ -175,6 +252,16 @@ scrappie_matrix convolution(const_scrappie_matrix X, const_scrappie_matrix W,
     C = remake_scrappie_matrix(C, nfilter, ncolC);
     RETURN_NULL_IF(NULL == C, NULL);
 
+    if (1 == X->nrq) {
+        if (!convolution_direct(X, W, b, stride, activation, C)) {
+            return free_scrappie_matrix(C);
+        }
+        assert(validate_scrappie_matrix
+               (C, NAN, NAN, 0.0, true, __FILE__, __LINE__));
+        scrappie_profile_end(SCRAPPIE_STAGE_CONVOLUTION);
+        return C;
+    }
+
     // Matrix strides
     const size_t ldC = C->stride;
     const size_t ldW = W->stride;
@@ -239,26 +326,47 @@ scrappie_matrix convolution(const_scrappie_matrix X, const_scrappie_matrix W,
                     X->data.f + offsetX_R + ldX * w, 1, 1.0,
                     C->data.f + offsetC_R + ldC * (w / stride), 1);
     }
+    if (NULL != activation) {
+        activation(C->data.f, C->stride * C->nc);
+    }
 
     assert(validate_scrappie_matrix
            (C, NAN, NAN, 0.0, true, __FILE__, __LINE__));
+    scrappie_profile_end(SCRAPPIE_STAGE_CONVOLUTION);
     return C;
 }
 
 scrappie_matrix feedforward_linear(const_scrappie_matrix X,
                                    const_scrappie_matrix W,
                                    const_scrappie_matrix b, scrappie_matrix C) {
-    return affine_map(X, W, b, C);
+    scrappie_profile_begin(SCRAPPIE_STAGE_FEEDFORWARD);
+    C = affine_map(X, W, b, C);
+    scrappie_profile_end(SCRAPPIE_STAGE_FEEDFORWARD);
+    return C;
+}
+
+/**  Linear feedforward layer applied to a window of the input
+ *
+ *   As feedforward_linear(window(X, w, 1), W, b, C) but the window is not
+ *   formed, see affine_map_window.
+ **/
+scrappie_matrix feedforward_linear_window(const_scrappie_matrix X, size_t w,
+                                          const_scrappie_matrix W,
+                                          const_scrappie_matrix b, scrappie_matrix C) {
+    scrappie_profile_begin(SCRAPPIE_STAGE_FEEDFORWARD);
+    C = affine_map_window(X, w, W, b, C);
+    scrappie_profile_end(SCRAPPIE_STAGE_FEEDFORWARD);
+    return C;
 }
 
 scrappie_matrix feedforward_tanh(const_scrappie_matrix X,
                                  const_scrappie_matrix W,
                                  const_scrappie_matrix b, scrappie_matrix C) {
-    C = affine_map(X, W, b, C);
+    scrappie_profile_begin(SCRAPPIE_STAGE_FEEDFORWARD);
+    C = affine_map_activation(X, W, b, tanhf_array_inplace, C);
+    scrappie_profile_end(SCRAPPIE_STAGE_FEEDFORWARD);
     RETURN_NULL_IF(NULL == C, NULL);
 
-    tanh_activation_inplace(C);
-
     assert(validate_scrappie_matrix
            (C, -1.0, 1.0, 0.0, true, __FILE__, __LINE__));
     return C;
@@ -267,11 +375,11 @@ scrappie_matrix feedforward_tanh(const_scrappie_matrix X,
 scrappie_matrix feedforward_exp(const_scrappie_matrix X,
                                 const_scrappie_matrix W,
                                 const_scrappie_matrix b, scrappie_matrix C) {
-    C = affine_map(X, W, b, C);
+    scrappie_profile_begin(SCRAPPIE_STAGE_FEEDFORWARD);
+    C = affine_map_activation(X, W, b, expf_array_inplace, C);
+    scrappie_profile_end(SCRAPPIE_STAGE_FEEDFORWARD);
     RETURN_NULL_IF(NULL == C, NULL);
 
-    exp_activation_inplace(C);
-
     assert(validate_scrappie_matrix
            (C, 0.0, NAN, 1.0, true, __FILE__, __LINE__));
     return C;
@@ -320,10 +428,12 @@ void residual_inplace(const_scrappie_matrix X, scrappie_matrix fX) {
 
 scrappie_matrix softmax(const_scrappie_matrix X, const_scrappie_matrix W,
                         const_scrappie_matrix b, scrappie_matrix C) {
+    scrappie_profile_begin(SCRAPPIE_STAGE_SOFTMAX);
     C = feedforward_exp(X, W, b, C);
     RETURN_NULL_IF(NULL == C, NULL);
 
     row_normalise_inplace(C);
+    scrappie_profile_end(SCRAPPIE_STAGE_SOFTMAX);
 
     assert(validate_scrappie_matrix
            (C, 0.0, 1.0, NAN, true, __FILE__, __LINE__));
@@ -341,6 +451,7 @@ scrappie_matrix softmax_with_temperature(scrappie_matrix X, const_scrappie_matri
                                          const_scrappie_matrix b, float tempW, float tempb,
                                          scrappie_matrix C) {
     RETURN_NULL_IF(NULL == X, NULL);
+    scrappie_profile_begin(SCRAPPIE_STAGE_SOFTMAX);
 
     shift_scale_matrix_inplace(X, 0.0f, tempW / tempb);
 
@@ -350,32 +461,137 @@ scrappie_matrix softmax_with_temperature(scrappie_matrix X, const_scrappie_matri
     shift_scale_matrix_inplace(C, 0.0f, tempb);
     exp_activation_inplace(C);
     row_normalise_inplace(C);
+    scrappie_profile_end(SCRAPPIE_STAGE_SOFTMAX);
 
     assert(validate_scrappie_matrix
            (C, 0.0, 1.0, NAN, true, __FILE__, __LINE__));
     return C;
 }
 
+/**  Softmax with temperature, keeping only the most probable states
+ *
+ *   Log posterior, as from softmax_with_temperature followed by
+ *   robustlog_activation_inplace, of only the k most probable history
+ *   states and the stay of each block.  The dense posterior is calculated
+ *   for SOFTMAX_TOPK_CHUNK blocks at a time, so is never held for the
+ *   whole read.
+ *
+ *   @param X  Input, scaled in place
+ *   @param min_prob  Minimum probability of robustlog, whose log is the
+ *   log posterior of the states not kept
+ *   @param k  Number of history states kept per block
+ *
+ *   @returns Sparse posterior or NULL on failure
+ **/
+#define SOFTMAX_TOPK_CHUNK 256
+sparse_posterior softmax_topk_with_temperature(scrappie_matrix X, const_scrappie_matrix W,
+                                               const_scrappie_matrix b, float tempW, float tempb,
+                                               float min_prob, size_t k) {
+    RETURN_NULL_IF(NULL == X, NULL);
+    RETURN_NULL_IF(0 == k || k >= W->nc, NULL);
+    scrappie_profile_begin(SCRAPPIE_STAGE_SOFTMAX);
+
+    shift_scale_matrix_inplace(X, 0.0f, tempW / tempb);
+
+    const size_t nblock = X->nc;
+    sparse_posterior sp = make_sparse_posterior(W->nc, nblock, k, logf(min_prob));
+    RETURN_NULL_IF(NULL == sp, NULL);
+
+    scrappie_matrix C = NULL;
+    for (size_t blk = 0; blk < nblock; blk += SOFTMAX_TOPK_CHUNK) {
+        const size_t nblk = (blk + SOFTMAX_TOPK_CHUNK < nblock) ? SOFTMAX_TOPK_CHUNK : (nblock - blk);
+        //  View of the columns of X for this chunk of blocks
+        const _Mat Xchunk = {.nr = X->nr, .nrq = X->nrq, .nc = nblk, .stride = X->stride,
+                             .data.v = X->data.v + blk * X->nrq};
+        C = feedforward_linear(&Xchunk, W, b, C);
+        if (NULL == C) {
+            return free_sparse_posterior(sp);
+        }
+        shift_scale_matrix_inplace(C, 0.0f, tempb);
+        exp_activation_inplace(C);
+        row_normalise_inplace(C);
+        robustlog_activation_inplace(C, min_prob);
+        for (size_t c = 0; c < nblk; c++) {
+            sparse_posterior_set_block(sp, blk + c, C->data.f + c * C->stride);
+        }
+    }
+    C = free_scrappie_matrix(C);
+    scrappie_profile_end(SCRAPPIE_STAGE_SOFTMAX);
+
+    return sp;
+}
+
 scrappie_matrix feedforward2_tanh(const_scrappie_matrix Xf,
                                   const_scrappie_matrix Xb,
                                   const_scrappie_matrix Wf,
                                   const_scrappie_matrix Wb,
                                   const_scrappie_matrix b, scrappie_matrix C) {
-    C = affine_map2(Xf, Xb, Wf, Wb, b, C);
+    scrappie_profile_begin(SCRAPPIE_STAGE_FEEDFORWARD);
+    C = affine_map2_activation(Xf, Xb, Wf, Wb, b, tanhf_array_inplace, C);
+    scrappie_profile_end(SCRAPPIE_STAGE_FEEDFORWARD);
     RETURN_NULL_IF(NULL == C, NULL);
 
-    tanh_activation_inplace(C);
-
     assert(validate_scrappie_matrix(C, -1.0, 1.0, 0.0, true, __FILE__, __LINE__));
     return C;
 }
 
+/**  Recurrent weights of a layer, with their sparse copy if they have one
+ *
+ *   W is the copy of the weights local to the calling thread.
+ **/
+typedef struct {
+    const_scrappie_matrix W;
+    bool sparse;
+    sparse_weights sw;
+} recurrent_weights;
+
+/**  Recurrent weights as used by the calling thread
+ *
+ *   Weights pruned so that enough of their blocks are zero are mapped by
+ *   their sparse copy, see find_sparse_weights; others are mapped densely.
+ **/
+static recurrent_weights find_recurrent_weights(const_scrappie_matrix W) {
+    recurrent_weights rw = {.W = NULL, .sparse = false};
+    rw.sparse = find_sparse_weights(W, &rw.sw);
+    rw.W = scrappie_local_weights(W);
+    return rw;
+}
+
+//  Weights mapped densely, as when they are not registered
+static recurrent_weights dense_recurrent_weights(const_scrappie_matrix W) {
+    return (recurrent_weights){.W = W, .sparse = false};
+}
+
+//  y += W^t x
+static void recurrent_map(recurrent_weights const * rw, float const * x, float * y) {
+    if (rw->sparse) {
+        sparse_affine_vector(&rw->sw, x, y);
+    } else {
+        cblas_sgemv(CblasColMajor, CblasTrans, rw->W->nr, rw->W->nc, 1.0, rw->W->data.f,
+                    rw->W->stride, x, 1, 1.0, y, 1);
+    }
+}
+
+static void gru_step_recurrent(const_scrappie_matrix x, const_scrappie_matrix istate,
+                               recurrent_weights const * sW, recurrent_weights const * sW2,
+                               scrappie_matrix xF, scrappie_matrix ostate);
+static void grumod_step_recurrent(const_scrappie_matrix x, const_scrappie_matrix istate,
+                                  recurrent_weights const * sW, scrappie_matrix xF,
+                                  scrappie_matrix ostate);
+static void lstm_step_recurrent(const_scrappie_matrix xAffine, const_scrappie_matrix out_prev,
+                                recurrent_weights const * sW, const_scrappie_matrix peep,
+                                scrappie_matrix xF, scrappie_matrix state,
+                                scrappie_matrix output);
+
 scrappie_matrix gru_forward(const_scrappie_matrix X, const_scrappie_matrix sW,
                             const_scrappie_matrix sW2, scrappie_matrix ostate) {
     RETURN_NULL_IF(NULL == X, NULL);
+    scrappie_profile_begin(SCRAPPIE_STAGE_GRU);
 
     assert(NULL != sW);
     assert(NULL != sW2);
+    const recurrent_weights rW = find_recurrent_weights(sW);
+    const recurrent_weights rW2 = find_recurrent_weights(sW2);
 
     const size_t bsize = X->nc;
     const size_t size = sW2->nc;
@@ -404,26 +620,30 @@ scrappie_matrix gru_forward(const_scrappie_matrix X, const_scrappie_matrix sW,
     xCol.nc = sCol1.nc = sCol2.nc = 1;
     sCol1.data.v = ostate->data.v + ostate->nrq;
     sCol2.data.v = ostate->data.v;
-    gru_step(&xCol, &sCol1, sW, sW2, tmp, &sCol2);
+    gru_step_recurrent(&xCol, &sCol1, &rW, &rW2, tmp, &sCol2);
     for (size_t i = 1; i < bsize; i++) {
         xCol.data.v = X->data.v + i * X->nrq;
         sCol1.data.v = ostate->data.v + (i - 1) * ostate->nrq;
         sCol2.data.v = ostate->data.v + i * ostate->nrq;
-        gru_step(&xCol, &sCol1, sW, sW2, tmp, &sCol2);
+        gru_step_recurrent(&xCol, &sCol1, &rW, &rW2, tmp, &sCol2);
     }
 
     tmp = free_scrappie_matrix(tmp);
 
     assert(validate_scrappie_matrix
            (ostate, -1.0, 1.0, 0.0, true, __FILE__, __LINE__));
+    scrappie_profile_end(SCRAPPIE_STAGE_GRU);
     return ostate;
 }
 
 scrappie_matrix gru_backward(const_scrappie_matrix X, const_scrappie_matrix sW,
                              const_scrappie_matrix sW2, scrappie_matrix ostate) {
     RETURN_NULL_IF(NULL == X, NULL);
+    scrappie_profile_begin(SCRAPPIE_STAGE_GRU);
     assert(NULL != sW);
     assert(NULL != sW2);
+    const recurrent_weights rW = find_recurrent_weights(sW);
+    const recurrent_weights rW2 = find_recurrent_weights(sW2);
 
     const size_t size = sW2->nc;
     const size_t bsize = X->nc;
@@ -453,25 +673,245 @@ scrappie_matrix gru_backward(const_scrappie_matrix X, const_scrappie_matrix sW,
     xCol.data.v = X->data.v + (X->nc - 1) * X->nrq;
     sCol1.data.v = ostate->data.v;
     sCol2.data.v = ostate->data.v + (ostate->nc - 1) * ostate->nrq;
-    gru_step(&xCol, &sCol1, sW, sW2, tmp, &sCol2);
+    gru_step_recurrent(&xCol, &sCol1, &rW, &rW2, tmp, &sCol2);
     for (size_t i = 1; i < bsize; i++) {
         const size_t index = bsize - i - 1;
         xCol.data.v = X->data.v + index * X->nrq;
         sCol1.data.v = ostate->data.v + (index + 1) * ostate->nrq;
         sCol2.data.v = ostate->data.v + index * ostate->nrq;
-        gru_step(&xCol, &sCol1, sW, sW2, tmp, &sCol2);
+        gru_step_recurrent(&xCol, &sCol1, &rW, &rW2, tmp, &sCol2);
     }
 
     tmp = free_scrappie_matrix(tmp);
 
     assert(validate_scrappie_matrix
            (ostate, -1.0, 1.0, 0.0, true, __FILE__, __LINE__));
+    scrappie_profile_end(SCRAPPIE_STAGE_GRU);
+    return ostate;
+}
+
+/**  GRU step with recurrent weights quantised to int8
+ *
+ *   As gru_step, the state being quantised as it is multiplied.
+ *
+ *   @param xq  Workspace [(size + 1) / 2]
+ **/
+static void gru_step_quantised(const_scrappie_matrix x, const_scrappie_matrix istate,
+                               quantised_weights const * sW, quantised_weights const * sW2,
+                               scrappie_matrix xF, int32_t * xq, scrappie_matrix ostate) {
+    const size_t size = istate->nr;
+    const size_t sizeq = size / 4;
+    assert(size % 4 == 0);
+    assert(x->nr == 3 * size);
+    assert(sW->nk == size);
+    assert(sW2->nk == size);
+
+    memcpy(xF->data.v, x->data.v, x->nrq * sizeof(__m128));
+    quantised_affine_vector(sW, istate->data.f, xq, xF->data.f, size + size);
+    logisticf_array_inplace(xF->data.f, size + size);
+
+    const float *z = xF->data.f;
+    __m128 *r = xF->data.v + sizeq;
+    float *hbar = xF->data.f + size + size;
+    for (size_t i = 0; i < sizeq; i++) {
+        r[i] *= istate->data.v[i];
+    }
+    quantised_affine_vector(sW2, (float *)r, xq, hbar, size);
+    tanhf_array_inplace(hbar, size);
+
+    gru_update_array(z, istate->data.f, hbar, ostate->data.f, size);
+}
+
+/**  Block of time steps whose input projection is held at once by fused GRU
+ *
+ *   A block of the projection, 3 * size x GRU_FUSED_BLOCK, and the recurrent
+ *   weights should together sit comfortably in L2 cache.
+ **/
+#define GRU_FUSED_BLOCK 64
+
+static scrappie_matrix gru_fused(const_scrappie_matrix X, const_scrappie_matrix iW,
+                                 const_scrappie_matrix b, const_scrappie_matrix sW,
+                                 const_scrappie_matrix sW2, bool residual, bool backward,
+                                 const_scrappie_matrix istate, scrappie_matrix fstate,
+                                 scrappie_matrix ostate) {
+    RETURN_NULL_IF(NULL == X, NULL);
+    assert(NULL != iW);
+    assert(NULL != b);
+    assert(NULL != sW);
+    assert(NULL != sW2);
+
+    const size_t size = sW2->nc;
+    const size_t nc = X->nc;
+    assert(X->nr == iW->nr);
+    assert(iW->nc == 3 * size);
+    assert(b->nr == 3 * size);
+    assert(sW->nr == size);
+    assert(sW2->nr == size);
+    assert(sW->nc == 2 * size);
+    assert(sW2->nc == size);
+    assert(!residual || X->nr == size);
+    //  Output may only overwrite the input when they have the same shape
+    assert(ostate != X || X->nr == size);
+
+    scrappie_matrix xblock = make_scrappie_matrix(3 * size, GRU_FUSED_BLOCK);
+    scrappie_matrix xF = make_scrappie_matrix(3 * size, 1);
+    scrappie_matrix state = make_scrappie_matrix(size, 1);
+    scrappie_matrix xres = make_scrappie_matrix(size, 1);
+    //  Recurrent products at int8 when the weights have been quantised
+    quantised_weights qsW, qsW2;
+    const bool quantised = SCRAPPIE_PRECISION_INT8 == scrappie_precision_get()
+        && find_quantised_weights(sW, &qsW) && find_quantised_weights(sW2, &qsW2);
+    //  Otherwise by the copy of the weights local to this thread
+    const recurrent_weights rW = find_recurrent_weights(sW);
+    const recurrent_weights rW2 = find_recurrent_weights(sW2);
+    int32_t * xq = quantised ? malloc(((size + 1) / 2) * sizeof(int32_t)) : NULL;
+    if (NULL == xblock || NULL == xF || NULL == state || NULL == xres || (quantised && NULL == xq)) {
+        ostate = NULL;
+        goto clean;
+    }
+    ostate = remake_scrappie_matrix(ostate, size, nc);
+    if (NULL == ostate) {
+        goto clean;
+    }
+    if (NULL != istate) {
+        assert(istate->nr == size);
+        memcpy(state->data.v, istate->data.v, state->nrq * sizeof(__m128));
+    }
+
+    const size_t nblock = (nc + GRU_FUSED_BLOCK - 1) / GRU_FUSED_BLOCK;
+    for (size_t blk = 0; blk < nblock; blk++) {
+        const size_t ib = backward ? (nblock - blk - 1) : blk;
+        const size_t col0 = ib * GRU_FUSED_BLOCK;
+        const size_t ncol = (nc - col0 < GRU_FUSED_BLOCK) ? (nc - col0) : GRU_FUSED_BLOCK;
+
+        /*  Project the block of input before any of its columns are
+         *  written, so the output may overwrite the input.
+         */
+        _Mat xView = *X;
+        xView.nc = ncol;
+        xView.data.v = X->data.v + col0 * X->nrq;
+        _Mat pView = *xblock;
+        pView.nc = ncol;
+        (void)affine_map(&xView, iW, b, &pView);
+
+        _Mat pCol = pView, oCol = *ostate;
+        pCol.nc = oCol.nc = 1;
+        for (size_t j = 0; j < ncol; j++) {
+            const size_t jb = backward ? (ncol - j - 1) : j;
+            const size_t col = col0 + jb;
+            pCol.data.v = xblock->data.v + jb * xblock->nrq;
+            oCol.data.v = ostate->data.v + col * ostate->nrq;
+            //  Read input column for residual before it might be overwritten
+            if (residual) {
+                memcpy(xres->data.v, X->data.v + col * X->nrq, X->nrq * sizeof(__m128));
+            }
+            if (quantised) {
+                gru_step_quantised(&pCol, state, &qsW, &qsW2, xF, xq, &oCol);
+            } else {
+                gru_step_recurrent(&pCol, state, &rW, &rW2, xF, &oCol);
+            }
+            memcpy(state->data.v, oCol.data.v, state->nrq * sizeof(__m128));
+            if (residual) {
+                for (size_t r = 0; r < ostate->nrq; r++) {
+                    oCol.data.v[r] += xres->data.v[r];
+                }
+            }
+        }
+    }
+    if (NULL != fstate) {
+        assert(fstate->nr == size);
+        memcpy(fstate->data.v, state->data.v, state->nrq * sizeof(__m128));
+    }
+
+clean:
+    free(xq);
+    xres = free_scrappie_matrix(xres);
+    state = free_scrappie_matrix(state);
+    xF = free_scrappie_matrix(xF);
+    xblock = free_scrappie_matrix(xblock);
+    return ostate;
+}
+
+/**  Fused input projection and forward GRU
+ *
+ *   Equivalent to gru_forward applied to feedforward_linear(X, iW, b),
+ *   optionally followed by residual_inplace, but the projection is computed
+ *   a block of time steps at a time into a small buffer so the full
+ *   3 * size x T intermediate is never materialised.
+ *
+ *   @param X  Input [isize x T]
+ *   @param iW, b  Input weights and bias of GRU
+ *   @param sW, sW2  Recurrent weights of GRU
+ *   @param residual  Add input to output
+ *   @param ostate  Matrix to write output to.  May be X when isize == size.
+ *
+ *   @returns Output [size x T] or NULL on failure
+ **/
+scrappie_matrix gru_forward_fused(const_scrappie_matrix X, const_scrappie_matrix iW,
+                                  const_scrappie_matrix b, const_scrappie_matrix sW,
+                                  const_scrappie_matrix sW2, bool residual, scrappie_matrix ostate) {
+    scrappie_profile_begin(SCRAPPIE_STAGE_GRU);
+    ostate = gru_fused(X, iW, b, sW, sW2, residual, false, NULL, NULL, ostate);
+    scrappie_profile_end(SCRAPPIE_STAGE_GRU);
+    RETURN_NULL_IF(NULL == ostate, NULL);
+    assert(residual || validate_scrappie_matrix
+           (ostate, -1.0, 1.0, 0.0, true, __FILE__, __LINE__));
+    return ostate;
+}
+
+/**  Fused input projection and forward GRU continuing from a state
+ *
+ *   As gru_forward_fused but the state before the first time step is
+ *   istate, e.g. the final state of a previous call on the preceding input,
+ *   rather than zero.
+ *
+ *   @param istate  Initial state [size x 1], or NULL for zero
+ *   @param fstate  Matrix to write state after the last time step to, before
+ *   any residual is added [size x 1].  May be istate or NULL.
+ **/
+scrappie_matrix gru_forward_fused_from_state(const_scrappie_matrix X, const_scrappie_matrix iW,
+                                             const_scrappie_matrix b, const_scrappie_matrix sW,
+                                             const_scrappie_matrix sW2, bool residual,
+                                             const_scrappie_matrix istate, scrappie_matrix fstate,
+                                             scrappie_matrix ostate) {
+    scrappie_profile_begin(SCRAPPIE_STAGE_GRU);
+    ostate = gru_fused(X, iW, b, sW, sW2, residual, false, istate, fstate, ostate);
+    scrappie_profile_end(SCRAPPIE_STAGE_GRU);
+    RETURN_NULL_IF(NULL == ostate, NULL);
+    assert(residual || validate_scrappie_matrix
+           (ostate, -1.0, 1.0, 0.0, true, __FILE__, __LINE__));
+    return ostate;
+}
+
+/**  Fused input projection and backward GRU
+ *
+ *   As gru_forward_fused but running backwards in time.
+ **/
+scrappie_matrix gru_backward_fused(const_scrappie_matrix X, const_scrappie_matrix iW,
+                                   const_scrappie_matrix b, const_scrappie_matrix sW,
+                                   const_scrappie_matrix sW2, bool residual, scrappie_matrix ostate) {
+    scrappie_profile_begin(SCRAPPIE_STAGE_GRU);
+    ostate = gru_fused(X, iW, b, sW, sW2, residual, true, NULL, NULL, ostate);
+    scrappie_profile_end(SCRAPPIE_STAGE_GRU);
+    RETURN_NULL_IF(NULL == ostate, NULL);
+    assert(residual || validate_scrappie_matrix
+           (ostate, -1.0, 1.0, 0.0, true, __FILE__, __LINE__));
     return ostate;
 }
 
 void gru_step(const_scrappie_matrix x, const_scrappie_matrix istate,
               const_scrappie_matrix sW, const_scrappie_matrix sW2,
               scrappie_matrix xF, scrappie_matrix ostate) {
+    assert(NULL != sW);
+    assert(NULL != sW2);
+    const recurrent_weights rW = dense_recurrent_weights(sW);
+    const recurrent_weights rW2 = dense_recurrent_weights(sW2);
+    gru_step_recurrent(x, istate, &rW, &rW2, xF, ostate);
+}
+
+static void gru_step_recurrent(const_scrappie_matrix x, const_scrappie_matrix istate,
+                               recurrent_weights const * rW, recurrent_weights const * rW2,
+                               scrappie_matrix xF, scrappie_matrix ostate) {
     /* Perform a single GRU step
      * x      is [isize]
      * istate is [size]
@@ -483,16 +923,16 @@ void gru_step(const_scrappie_matrix x, const_scrappie_matrix istate,
      * ostate is [size]
      */
     assert(NULL != x);
-    assert(NULL != sW);
-    assert(NULL != sW2);
+    assert(NULL != rW->W);
+    assert(NULL != rW2->W);
     const size_t size = istate->nr;
     assert(x->nr == 3 * size);
     assert(size % 4 == 0);  // Vectorisation assumes size divisible by 4
     const size_t sizeq = size / 4;
-    assert(size == sW->nr);
-    assert(2 * size == sW->nc);
-    assert(size == sW2->nr);
-    assert(size == sW2->nc);
+    assert(size == rW->W->nr);
+    assert(2 * size == rW->W->nc);
+    assert(size == rW2->W->nr);
+    assert(size == rW2->W->nc);
     assert(3 * size == xF->nr);
     assert(size == ostate->nr);
 
@@ -502,35 +942,246 @@ void gru_step(const_scrappie_matrix x, const_scrappie_matrix istate,
     /*  Add sW * istate to first 2 * size elts of xF
      *  then apply gate function to get r and z
      */
-    cblas_sgemv(CblasColMajor, CblasTrans, sW->nr, sW->nc, 1.0, sW->data.f,
-                sW->stride, istate->data.f, 1, 1.0, xF->data.f, 1);
-    for (size_t i = 0; i < (sizeq +sizeq); i++) {
-        xF->data.v[i] = LOGISTICFV(xF->data.v[i]);
-    }
+    recurrent_map(rW, istate->data.f, xF->data.f);
+    logisticf_array_inplace(xF->data.f, size + size);
 
-    const __m128 *z = xF->data.v;
+    const float *z = xF->data.f;
     __m128 *r = xF->data.v + sizeq;
-    __m128 *hbar = xF->data.v + sizeq + sizeq;
+    float *hbar = xF->data.f + size + size;
     for (size_t i = 0; i < sizeq; i++) {
         r[i] *= istate->data.v[i];
     }
-    cblas_sgemv(CblasColMajor, CblasTrans, sW2->nr, sW2->nc, 1.0, sW2->data.f,
-                sW2->stride, (float *)r, 1, 1.0, (float *)hbar, 1);
-    for (size_t i = 0; i < sizeq; i++) {
-        hbar[i] = TANHFV(hbar[i]);
+    recurrent_map(rW2, (float *)r, hbar);
+    tanhf_array_inplace(hbar, size);
+
+    gru_update_array(z, istate->data.f, hbar, ostate->data.f, size);
+}
+
+
+/**  Zero state of reads in batch that have finished
+ *
+ *   @param state Matrix [size, nbatch] containing state at a single time step
+ *   @param t Time step of state
+ *   @param len Array [nbatch] of lengths of each read in batch
+ **/
+static void mask_batch_state(scrappie_matrix state, size_t t, size_t const * len) {
+    for (size_t b = 0; b < state->nc; b++) {
+        if (t >= len[b]) {
+            memset(state->data.v + b * state->nrq, 0, state->nrq * sizeof(__m128));
+        }
     }
+}
 
-    const __m128 ones = _mm_set1_ps(1.0f);
-    for (size_t i = 0; i < sizeq ; i++) {
-        ostate->data.v[i] = z[i] * istate->data.v[i] + (ones - z[i]) * hbar[i];
+/**  GRU layer, forwards in time, applied to a batch of reads
+ *
+ *   The input is the interleaved batch produced by interleave_scrappie_matrices,
+ *   so time step t of every read is a contiguous block of nbatch columns and
+ *   each step is a matrix-matrix product rather than a matrix-vector one.
+ *   State of a read is set to zero for time steps beyond its length.
+ *
+ *   @param X Interleaved input [3 * size, nbatch * nblock]
+ *   @param sW, sW2 Recurrent weights, as for gru_forward
+ *   @param nbatch Number of reads in batch
+ *   @param len Array [nbatch] of number of blocks in each read
+ *   @param ostate Matrix to write output into or NULL
+ *
+ *   @returns Interleaved output [size, nbatch * nblock]
+ **/
+scrappie_matrix gru_forward_batch(const_scrappie_matrix X, const_scrappie_matrix sW,
+                                  const_scrappie_matrix sW2, size_t nbatch,
+                                  size_t const * len, scrappie_matrix ostate) {
+    RETURN_NULL_IF(NULL == X, NULL);
+    RETURN_NULL_IF(NULL == len, NULL);
+    scrappie_profile_begin(SCRAPPIE_STAGE_GRU);
+    assert(NULL != sW);
+    assert(NULL != sW2);
+    sW = scrappie_local_weights(sW);
+    sW2 = scrappie_local_weights(sW2);
+    assert(nbatch > 0);
+    assert(0 == X->nc % nbatch);
+
+    const size_t nblock = X->nc / nbatch;
+    const size_t size = sW2->nc;
+    assert(X->nr == 3 * size);
+    assert(sW->nr == size);
+    assert(sW2->nr == size);
+    assert(sW->nc == 2 * size);
+    assert(sW2->nc == size);
+
+    ostate = remake_scrappie_matrix(ostate, size, X->nc);
+    RETURN_NULL_IF(NULL == ostate, NULL);
+
+    scrappie_matrix tmp = make_scrappie_matrix(3 * size, nbatch);
+    scrappie_matrix zero = make_scrappie_matrix(size, nbatch);
+    if(NULL == tmp || NULL == zero){
+        //  Memory allocation falled, clean-up and return
+        tmp = free_scrappie_matrix(tmp);
+        zero = free_scrappie_matrix(zero);
+        ostate = free_scrappie_matrix(ostate);
+        return NULL;
+    }
+
+    /* First step state is zero */
+    _Mat xCol, sCol1, sCol2;
+    xCol = *X;
+    sCol1 = *ostate;
+    sCol2 = *ostate;
+    xCol.nc = sCol1.nc = sCol2.nc = nbatch;
+    sCol2.data.v = ostate->data.v;
+    gru_step_batch(&xCol, zero, sW, sW2, tmp, &sCol2);
+    mask_batch_state(&sCol2, 0, len);
+    for (size_t i = 1; i < nblock; i++) {
+        xCol.data.v = X->data.v + i * nbatch * X->nrq;
+        sCol1.data.v = ostate->data.v + (i - 1) * nbatch * ostate->nrq;
+        sCol2.data.v = ostate->data.v + i * nbatch * ostate->nrq;
+        gru_step_batch(&xCol, &sCol1, sW, sW2, tmp, &sCol2);
+        mask_batch_state(&sCol2, i, len);
+    }
+
+    zero = free_scrappie_matrix(zero);
+    tmp = free_scrappie_matrix(tmp);
+
+    assert(validate_scrappie_matrix
+           (ostate, -1.0, 1.0, 0.0, true, __FILE__, __LINE__));
+    scrappie_profile_end(SCRAPPIE_STAGE_GRU);
+    return ostate;
+}
+
+/**  GRU layer, backwards in time, applied to a batch of reads
+ *
+ *   @see gru_forward_batch.  Since the state of a read is held at zero for
+ *   all time steps beyond its length, each read in the batch starts its
+ *   backwards recursion from a zero state exactly as it would unbatched.
+ **/
+scrappie_matrix gru_backward_batch(const_scrappie_matrix X, const_scrappie_matrix sW,
+                                   const_scrappie_matrix sW2, size_t nbatch,
+                                   size_t const * len, scrappie_matrix ostate) {
+    RETURN_NULL_IF(NULL == X, NULL);
+    RETURN_NULL_IF(NULL == len, NULL);
+    scrappie_profile_begin(SCRAPPIE_STAGE_GRU);
+    assert(NULL != sW);
+    assert(NULL != sW2);
+    sW = scrappie_local_weights(sW);
+    sW2 = scrappie_local_weights(sW2);
+    assert(nbatch > 0);
+    assert(0 == X->nc % nbatch);
+
+    const size_t nblock = X->nc / nbatch;
+    const size_t size = sW2->nc;
+    assert(X->nr == 3 * size);
+    assert(sW->nr == size);
+    assert(sW2->nr == size);
+    assert(sW->nc == 2 * size);
+    assert(sW2->nc == size);
+
+    ostate = remake_scrappie_matrix(ostate, size, X->nc);
+    RETURN_NULL_IF(NULL == ostate, NULL);
+
+    scrappie_matrix tmp = make_scrappie_matrix(3 * size, nbatch);
+    scrappie_matrix zero = make_scrappie_matrix(size, nbatch);
+    if(NULL == tmp || NULL == zero){
+        //  Memory allocation falled, clean-up and return
+        tmp = free_scrappie_matrix(tmp);
+        zero = free_scrappie_matrix(zero);
+        ostate = free_scrappie_matrix(ostate);
+        return NULL;
+    }
+
+    /* First step state is zero */
+    _Mat xCol, sCol1, sCol2;
+    xCol = *X;
+    sCol1 = *ostate;
+    sCol2 = *ostate;
+    xCol.nc = sCol1.nc = sCol2.nc = nbatch;
+    xCol.data.v = X->data.v + (nblock - 1) * nbatch * X->nrq;
+    sCol2.data.v = ostate->data.v + (nblock - 1) * nbatch * ostate->nrq;
+    gru_step_batch(&xCol, zero, sW, sW2, tmp, &sCol2);
+    mask_batch_state(&sCol2, nblock - 1, len);
+    for (size_t i = 1; i < nblock; i++) {
+        const size_t index = nblock - i - 1;
+        xCol.data.v = X->data.v + index * nbatch * X->nrq;
+        sCol1.data.v = ostate->data.v + (index + 1) * nbatch * ostate->nrq;
+        sCol2.data.v = ostate->data.v + index * nbatch * ostate->nrq;
+        gru_step_batch(&xCol, &sCol1, sW, sW2, tmp, &sCol2);
+        mask_batch_state(&sCol2, index, len);
+    }
+
+    zero = free_scrappie_matrix(zero);
+    tmp = free_scrappie_matrix(tmp);
+
+    assert(validate_scrappie_matrix
+           (ostate, -1.0, 1.0, 0.0, true, __FILE__, __LINE__));
+    scrappie_profile_end(SCRAPPIE_STAGE_GRU);
+    return ostate;
+}
+
+void gru_step_batch(const_scrappie_matrix x, const_scrappie_matrix istate,
+                    const_scrappie_matrix sW, const_scrappie_matrix sW2,
+                    scrappie_matrix xF, scrappie_matrix ostate) {
+    /* Perform a single GRU step for a batch of nbatch reads
+     * x      is [3 * size, nbatch]
+     * istate is [size, nbatch]
+     * sW     is [size, 2 * size]
+     * sW2    is [size, size]
+     * xF     is [3 * size, nbatch]
+     * ostate is [size, nbatch]
+     */
+    assert(NULL != x);
+    assert(NULL != sW);
+    assert(NULL != sW2);
+    const size_t size = istate->nr;
+    const size_t nbatch = istate->nc;
+    assert(x->nr == 3 * size);
+    assert(size % 4 == 0);  // Vectorisation assumes size divisible by 4
+    const size_t sizeq = size / 4;
+    assert(size == sW->nr);
+    assert(2 * size == sW->nc);
+    assert(size == sW2->nr);
+    assert(size == sW2->nc);
+    assert(3 * size == xF->nr);
+    assert(nbatch == x->nc);
+    assert(nbatch == xF->nc);
+    assert(nbatch == ostate->nc);
+    assert(size == ostate->nr);
+
+    // Copy input matrix = iW x + b to temporary matrix
+    memcpy(xF->data.v, x->data.v, x->nrq * nbatch * sizeof(__m128));
+    /*  Add sW * istate to first 2 * size rows of xF
+     *  then apply gate function to get r and z
+     */
+    cblas_sgemm(CblasColMajor, CblasTrans, CblasNoTrans, sW->nc, nbatch, sW->nr,
+                1.0, sW->data.f, sW->stride, istate->data.f, istate->stride,
+                1.0, xF->data.f, xF->stride);
+    for (size_t b = 0; b < nbatch; b++) {
+        __m128 *xFb = xF->data.v + b * xF->nrq;
+        const __m128 *statein = istate->data.v + b * istate->nrq;
+        logisticf_array_inplace((float *)xFb, size + size);
+        __m128 *r = xFb + sizeq;
+        for (size_t i = 0; i < sizeq; i++) {
+            r[i] *= statein[i];
+        }
+    }
+
+    cblas_sgemm(CblasColMajor, CblasTrans, CblasNoTrans, sW2->nc, nbatch, sW2->nr,
+                1.0, sW2->data.f, sW2->stride, xF->data.f + size, xF->stride,
+                1.0, xF->data.f + size + size, xF->stride);
+
+    for (size_t b = 0; b < nbatch; b++) {
+        const float *z = xF->data.f + b * xF->stride;
+        float *hbar = xF->data.f + b * xF->stride + size + size;
+        tanhf_array_inplace(hbar, size);
+        gru_update_array(z, istate->data.f + b * istate->stride, hbar,
+                         ostate->data.f + b * ostate->stride, size);
     }
 }
 
 scrappie_matrix grumod_forward(const_scrappie_matrix X, const_scrappie_matrix sW,
                                scrappie_matrix ostate) {
     RETURN_NULL_IF(NULL == X, NULL);
+    scrappie_profile_begin(SCRAPPIE_STAGE_GRU);
 
     assert(NULL != sW);
+    const recurrent_weights rW = find_recurrent_weights(sW);
 
     const size_t bsize = X->nc;
     const size_t size = sW->nr;
@@ -556,25 +1207,28 @@ scrappie_matrix grumod_forward(const_scrappie_matrix X, const_scrappie_matrix sW
     xCol.nc = sCol1.nc = sCol2.nc = 1;
     sCol1.data.v = ostate->data.v + ostate->nrq;
     sCol2.data.v = ostate->data.v;
-    grumod_step(&xCol, &sCol1, sW, tmp, &sCol2);
+    grumod_step_recurrent(&xCol, &sCol1, &rW, tmp, &sCol2);
     for (size_t i = 1; i < bsize; i++) {
         xCol.data.v = X->data.v + i * X->nrq;
         sCol1.data.v = ostate->data.v + (i - 1) * ostate->nrq;
         sCol2.data.v = ostate->data.v + i * ostate->nrq;
-        grumod_step(&xCol, &sCol1, sW, tmp, &sCol2);
+        grumod_step_recurrent(&xCol, &sCol1, &rW, tmp, &sCol2);
     }
 
     tmp = free_scrappie_matrix(tmp);
 
     assert(validate_scrappie_matrix
            (ostate, -1.0, 1.0, 0.0, true, __FILE__, __LINE__));
+    scrappie_profile_end(SCRAPPIE_STAGE_GRU);
     return ostate;
 }
 
 scrappie_matrix grumod_backward(const_scrappie_matrix X, const_scrappie_matrix sW,
                                 scrappie_matrix ostate) {
     RETURN_NULL_IF(NULL == X, NULL);
+    scrappie_profile_begin(SCRAPPIE_STAGE_GRU);
     assert(NULL != sW);
+    const recurrent_weights rW = find_recurrent_weights(sW);
 
     const size_t size = sW->nr;
     const size_t bsize = X->nc;
@@ -601,25 +1255,34 @@ scrappie_matrix grumod_backward(const_scrappie_matrix X, const_scrappie_matrix s
     xCol.data.v = X->data.v + (X->nc - 1) * X->nrq;
     sCol1.data.v = ostate->data.v;
     sCol2.data.v = ostate->data.v + (ostate->nc - 1) * ostate->nrq;
-    grumod_step(&xCol, &sCol1, sW, tmp, &sCol2);
+    grumod_step_recurrent(&xCol, &sCol1, &rW, tmp, &sCol2);
     for (size_t i = 1; i < bsize; i++) {
         const size_t index = bsize - i - 1;
         xCol.data.v = X->data.v + index * X->nrq;
         sCol1.data.v = ostate->data.v + (index + 1) * ostate->nrq;
         sCol2.data.v = ostate->data.v + index * ostate->nrq;
-        grumod_step(&xCol, &sCol1, sW, tmp, &sCol2);
+        grumod_step_recurrent(&xCol, &sCol1, &rW, tmp, &sCol2);
     }
 
     tmp = free_scrappie_matrix(tmp);
 
     assert(validate_scrappie_matrix
            (ostate, -1.0, 1.0, 0.0, true, __FILE__, __LINE__));
+    scrappie_profile_end(SCRAPPIE_STAGE_GRU);
     return ostate;
 }
 
 void grumod_step(const_scrappie_matrix x, const_scrappie_matrix istate,
                  const_scrappie_matrix sW, scrappie_matrix xF,
                  scrappie_matrix ostate) {
+    assert(NULL != sW);
+    const recurrent_weights rW = dense_recurrent_weights(sW);
+    grumod_step_recurrent(x, istate, &rW, xF, ostate);
+}
+
+static void grumod_step_recurrent(const_scrappie_matrix x, const_scrappie_matrix istate,
+                                  recurrent_weights const * rW, scrappie_matrix xF,
+                                  scrappie_matrix ostate) {
     /* Perform a single modified GRU step
      * x      is [isize]
      * istate is [size]
@@ -631,13 +1294,13 @@ void grumod_step(const_scrappie_matrix x, const_scrappie_matrix istate,
      * ostate is [size]
      */
     assert(NULL != x);
-    assert(NULL != sW);
+    assert(NULL != rW->W);
     const size_t size = istate->nr;
     assert(x->nr == 3 * size);
     assert(size % 4 == 0);  // Vectorisation assumes size divisible by 4
     const size_t sizeq = size / 4;
-    assert(size == sW->nr);
-    assert(3 * size == sW->nc);
+    assert(size == rW->W->nr);
+    assert(3 * size == rW->W->nc);
     assert(3 * size == xF->nr);
     assert(size == ostate->nr);
 
@@ -648,34 +1311,29 @@ void grumod_step(const_scrappie_matrix x, const_scrappie_matrix istate,
     /*  Add sW * istate to first 3 * size elts of xF
      *  then apply gate function to get r and z
      */
-    cblas_sgemv(CblasColMajor, CblasTrans, sW->nr, sW->nc, 1.0, sW->data.f,
-                sW->stride, istate->data.f, 1, 1.0, xF->data.f, 1);
-    for (size_t i = 0; i < (sizeq + sizeq); i++) {
-        xF->data.v[i] = LOGISTICFV(xF->data.v[i]);
-    }
+    recurrent_map(rW, istate->data.f, xF->data.f);
+    logisticf_array_inplace(xF->data.f, size + size);
 
-    const __m128 *z = xF->data.v;
     const __m128 *r = xF->data.v + sizeq;
     __m128 *hbar = xF->data.v + sizeq + sizeq;
     for (size_t i = 0; i < sizeq; i++) {
         hbar[i] = r[i] * hbar[i] + x->data.v[sizeq + sizeq + i];
     }
-    for (size_t i = 0; i < sizeq; i++) {
-        hbar[i] = TANHFV(hbar[i]);
-    }
+    tanhf_array_inplace((float *)hbar, size);
 
-    const __m128 ones = _mm_set1_ps(1.0f);
-    for (size_t i = 0; i < sizeq ; i++) {
-        ostate->data.v[i] = z[i] * istate->data.v[i] + (ones - z[i]) * hbar[i];
-    }
+    gru_update_array(xF->data.f, istate->data.f, (float *)hbar, ostate->data.f, size);
 }
 
+/*  Columns of Xaffine are stepped by its stride, so it may be a view of some
+ *  rows of a larger projection  */
 scrappie_matrix lstm_forward(const_scrappie_matrix Xaffine,
                              const_scrappie_matrix sW, const_scrappie_matrix p,
                              scrappie_matrix output) {
     RETURN_NULL_IF(NULL == Xaffine, NULL);
+    scrappie_profile_begin(SCRAPPIE_STAGE_LSTM);
     assert(NULL != sW);
     assert(NULL != p);
+    const recurrent_weights rW = find_recurrent_weights(sW);
 
     const size_t size = sW->nr;
     const size_t bsize = Xaffine->nc;
@@ -705,12 +1363,12 @@ scrappie_matrix lstm_forward(const_scrappie_matrix Xaffine,
     xCol.nc = sCol1.nc = sCol2.nc = 1;
     sCol1.data.v = output->data.v + output->nrq;
     sCol2.data.v = output->data.v;
-    lstm_step(&xCol, &sCol1, sW, p, tmp, state, &sCol2);
+    lstm_step_recurrent(&xCol, &sCol1, &rW, p, tmp, state, &sCol2);
     for (size_t i = 1; i < bsize; i++) {
-        xCol.data.v = Xaffine->data.v + i * Xaffine->nrq;
+        xCol.data.f = Xaffine->data.f + i * Xaffine->stride;
         sCol1.data.v = output->data.v + (i - 1) * output->nrq;
         sCol2.data.v = output->data.v + i * output->nrq;
-        lstm_step(&xCol, &sCol1, sW, p, tmp, state, &sCol2);
+        lstm_step_recurrent(&xCol, &sCol1, &rW, p, tmp, state, &sCol2);
     }
 
     state = free_scrappie_matrix(state);
@@ -718,6 +1376,7 @@ scrappie_matrix lstm_forward(const_scrappie_matrix Xaffine,
 
     assert(validate_scrappie_matrix
            (output, -1.0, 1.0, 0.0, true, __FILE__, __LINE__));
+    scrappie_profile_end(SCRAPPIE_STAGE_LSTM);
     return output;
 }
 
@@ -725,8 +1384,10 @@ scrappie_matrix lstm_backward(const_scrappie_matrix Xaffine,
                               const_scrappie_matrix sW, const_scrappie_matrix p,
                               scrappie_matrix output) {
     RETURN_NULL_IF(NULL == Xaffine, NULL);
+    scrappie_profile_begin(SCRAPPIE_STAGE_LSTM);
     assert(NULL != sW);
     assert(NULL != p);
+    const recurrent_weights rW = find_recurrent_weights(sW);
 
     const size_t size = sW->nr;
     const size_t bsize = Xaffine->nc;
@@ -754,16 +1415,16 @@ scrappie_matrix lstm_backward(const_scrappie_matrix Xaffine,
     sCol1 = *output;
     sCol2 = *output;
     xCol.nc = sCol1.nc = sCol2.nc = 1;
-    xCol.data.v = Xaffine->data.v + (bsize - 1) * Xaffine->nrq;
+    xCol.data.f = Xaffine->data.f + (bsize - 1) * Xaffine->stride;
     sCol1.data.v = output->data.v;
     sCol2.data.v = output->data.v + (bsize - 1) * output->nrq;
-    lstm_step(&xCol, &sCol1, sW, p, tmp, state, &sCol2);
+    lstm_step_recurrent(&xCol, &sCol1, &rW, p, tmp, state, &sCol2);
     for (size_t i = 1; i < bsize; i++) {
         const size_t index = bsize - i - 1;
-        xCol.data.v = Xaffine->data.v + index * Xaffine->nrq;
+        xCol.data.f = Xaffine->data.f + index * Xaffine->stride;
         sCol1.data.v = output->data.v + (index + 1) * output->nrq;
         sCol2.data.v = output->data.v + index * output->nrq;
-        lstm_step(&xCol, &sCol1, sW, p, tmp, state, &sCol2);
+        lstm_step_recurrent(&xCol, &sCol1, &rW, p, tmp, state, &sCol2);
     }
 
     state = free_scrappie_matrix(state);
@@ -771,6 +1432,7 @@ scrappie_matrix lstm_backward(const_scrappie_matrix Xaffine,
 
     assert(validate_scrappie_matrix
            (output, -1.0, 1.0, 0.0, true, __FILE__, __LINE__));
+    scrappie_profile_end(SCRAPPIE_STAGE_LSTM);
     return output;
 }
 
@@ -778,6 +1440,15 @@ void lstm_step(const_scrappie_matrix xAffine, const_scrappie_matrix out_prev,
                const_scrappie_matrix sW, const_scrappie_matrix peep,
                scrappie_matrix xF, scrappie_matrix state,
                scrappie_matrix output) {
+    assert(NULL != sW);
+    const recurrent_weights rW = dense_recurrent_weights(sW);
+    lstm_step_recurrent(xAffine, out_prev, &rW, peep, xF, state, output);
+}
+
+static void lstm_step_recurrent(const_scrappie_matrix xAffine, const_scrappie_matrix out_prev,
+                                recurrent_weights const * rW, const_scrappie_matrix peep,
+                                scrappie_matrix xF, scrappie_matrix state,
+                                scrappie_matrix output) {
     /* Perform a single LSTM step
      * xAffine  is [isize] (== iW x + b, where x is the input to the LSTM layer)
      * out_prev is [size]
@@ -789,7 +1460,7 @@ void lstm_step(const_scrappie_matrix xAffine, const_scrappie_matrix out_prev,
      */
     assert(NULL != xAffine);
     assert(NULL != out_prev);
-    assert(NULL != sW);
+    assert(NULL != rW->W);
     assert(NULL != peep);
     assert(NULL != xF);
     assert(NULL != state);
@@ -797,8 +1468,8 @@ void lstm_step(const_scrappie_matrix xAffine, const_scrappie_matrix out_prev,
     const size_t size = state->nr;
     assert(xAffine->nr == 4 * size);
     assert(size == out_prev->nr);
-    assert(size == sW->nr);
-    assert(4 * size == sW->nc);
+    assert(size == rW->W->nr);
+    assert(4 * size == rW->W->nc);
     assert(3 * size == peep->nr);
     assert(4 * size == xF->nr);
     assert(size == output->nr);
@@ -806,31 +1477,93 @@ void lstm_step(const_scrappie_matrix xAffine, const_scrappie_matrix out_prev,
     // Copy input vector = iW x + b to temporary vector
     memcpy(xF->data.v, xAffine->data.v, xAffine->nrq * sizeof(__m128));
     //  + sW' * xprev
-    cblas_sgemv(CblasColMajor, CblasTrans, sW->nr, sW->nc, 1.0, sW->data.f,
-                sW->stride, out_prev->data.f, 1, 1.0, xF->data.f, 1);
+    recurrent_map(rW, out_prev->data.f, xF->data.f);
 
     assert(size % 4 == 0);  // Vectorisation assumes size divisible by 4
-    const size_t sizeq = size / 4;
-    for (size_t i = 0; i < sizeq; i++) {
-        // Forget gate
-        __m128 forget = LOGISTICFV(xF->data.v[2 * sizeq + i]
-                                   + state->data.v[i] * peep->data.v[sizeq + i])
-            * state->data.v[i];
-        // Update gate
-        __m128 update = LOGISTICFV(xF->data.v[sizeq + i]
-                                   + state->data.v[i] * peep->data.v[i])
-            * TANHFV(xF->data.v[i]);
-        state->data.v[i] = _mm_add_ps(forget, update);
-        // Output gate
-        output->data.v[i] = LOGISTICFV(xF->data.v[3 * sizeq + i]
-                                       +
-                                       state->data.v[i] * peep->data.v[2 *
-                                                                       sizeq +
-                                                                       i])
-            * TANHFV(state->data.v[i]);
+    lstm_gates_array(xF->data.f, peep->data.f, state->data.f, output->data.f, size);
+}
+
+
+/**  Log-sum-exp of CRF transitions for one block
+ *
+ *   Terms tmp[st1 * nstate + st2] are summed over st2 for each st1 when
+ *   forwards is true, otherwise over st1 for each st2.  Terms are taken
+ *   relative to the largest term of their sum, so nothing overflows, and
+ *   exponentiated together in a single vectorised pass.
+ *
+ *   @param tmp  Terms, aligned [4 * ceil(nstate * nstate / 4)].  Overwritten.
+ *   @param nstate  Number of states
+ *   @param forwards  Direction of sum
+ *   @param out  Log-sum-exp of each sum [out, nstate]
+ **/
+void crf_logsumexp_block(float * tmp, size_t nstate, bool forwards, float * out){
+    const size_t ntrans = nstate * nstate;
+    for(size_t st=0 ; st < nstate ; st++){
+        out[st] = -HUGE_VALF;
+    }
+    for(size_t i=0 ; i < ntrans ; i++){
+        const size_t st = forwards ? (i / nstate) : (i % nstate);
+        out[st] = fmaxf(out[st], tmp[i]);
+    }
+    for(size_t i=0 ; i < ntrans ; i++){
+        const size_t st = forwards ? (i / nstate) : (i % nstate);
+        tmp[i] -= out[st];
+    }
+
+    __m128 * tmpv = (__m128 *) tmp;
+    for(size_t i=0 ; i < (ntrans + 3) / 4 ; i++){
+        tmpv[i] = expfv(tmpv[i]);
+    }
+
+    for(size_t st=0 ; st < nstate ; st++){
+        float sum = 0.0f;
+        for(size_t k=0 ; k < nstate ; k++){
+            sum += forwards ? tmp[st * nstate + k] : tmp[k * nstate + st];
+        }
+        out[st] += logf(sum);
     }
 }
 
+/**  One step of forwards recursion of CRF in log space
+ *
+ *   curr[st1] = log sum_st2 exp(trans[st1 * nstate + st2] + prev[st2])
+ *
+ *   @param trans  Transition scores for block [nstate * nstate]
+ *   @param nstate  Number of states
+ *   @param prev  Forward scores at end of previous block [nstate]
+ *   @param curr  Forward scores at end of this block [out, nstate]
+ *   @param tmp  Workspace, aligned [4 * ceil(nstate * nstate / 4)]
+ **/
+void crf_forward_step(float const * trans, size_t nstate, float const * prev, float * curr,
+                      float * tmp){
+    for(size_t st1=0 ; st1 < nstate ; st1++){
+        for(size_t st2=0 ; st2 < nstate ; st2++){
+            tmp[st1 * nstate + st2] = trans[st1 * nstate + st2] + prev[st2];
+        }
+    }
+    crf_logsumexp_block(tmp, nstate, true, curr);
+}
+
+/**  One step of backwards recursion of CRF in log space
+ *
+ *   curr[st2] = log sum_st1 exp(trans[st1 * nstate + st2] + prev[st1])
+ *
+ *   @param trans  Transition scores for block [nstate * nstate]
+ *   @param nstate  Number of states
+ *   @param prev  Backward scores at end of this block [nstate]
+ *   @param curr  Backward scores at start of this block [out, nstate]
+ *   @param tmp  Workspace, aligned [4 * ceil(nstate * nstate / 4)]
+ **/
+void crf_backward_step(float const * trans, size_t nstate, float const * prev, float * curr,
+                       float * tmp){
+    for(size_t st1=0 ; st1 < nstate ; st1++){
+        for(size_t st2=0 ; st2 < nstate ; st2++){
+            tmp[st1 * nstate + st2] = trans[st1 * nstate + st2] + prev[st1];
+        }
+    }
+    crf_logsumexp_block(tmp, nstate, false, curr);
+}
+
 
 float crf_partition_function(const_scrappie_matrix C){
     RETURN_NULL_IF(NULL == C, NAN);
@@ -838,33 +1571,41 @@ float crf_partition_function(const_scrappie_matrix C){
     const size_t nstate = roundf(sqrtf((float)C->nr));
     assert(nstate * nstate == C->nr);
     float * mem = calloc(2 * nstate, sizeof(float));
-    RETURN_NULL_IF(NULL==mem, NAN);
+    scrappie_matrix tmp = make_scrappie_matrix(C->nr, 1);
+    if(NULL == mem || NULL == tmp){
+        free(mem);
+        tmp = free_scrappie_matrix(tmp);
+        return NAN;
+    }
 
     float * curr = mem;
     float * prev = mem + nstate;
 
+    //  Scores are shifted each block so the largest is zero, with the shifts
+    //  accumulated separately, so precision is not lost on long reads.
+    double shift = 0.0;
     for(size_t c=0 ; c < C->nc ; c++){
-        const size_t offset = c * C->stride;
         //  Swap
         {
             float * tmp = curr;
             curr = prev;
             prev = tmp;
         }
-        for(size_t st1=0 ; st1 < nstate ; st1++){
-            const size_t offsetS = offset + st1 * nstate;
-            curr[st1] = C->data.f[offsetS + 0] + prev[0];
-            for(size_t st2=1 ; st2 < nstate ; st2++){
-                curr[st1] = logsumexpf(curr[st1],  C->data.f[offsetS + st2] + prev[st2]);
-            }
+        crf_forward_step(C->data.f + c * C->stride, nstate, prev, curr, tmp->data.f);
+        const float maxscore = valmaxf(curr, nstate);
+        for(size_t st=0 ; st < nstate ; st++){
+            curr[st] -= maxscore;
         }
+        shift += maxscore;
     }
 
     float logZ = curr[0];
     for(size_t st=1 ; st < nstate ; st++){
         logZ = logsumexpf(logZ, curr[st]);
     }
+    logZ += shift;
 
+    tmp = free_scrappie_matrix(tmp);
     free(mem);
 
     return logZ;
@@ -873,6 +1614,7 @@ float crf_partition_function(const_scrappie_matrix C){
 
 scrappie_matrix globalnorm(const_scrappie_matrix X, const_scrappie_matrix W,
                            const_scrappie_matrix b, scrappie_matrix C) {
+    scrappie_profile_begin(SCRAPPIE_STAGE_SOFTMAX);
     C = affine_map(X, W, b, C);
     RETURN_NULL_IF(NULL == C, NULL);
 
@@ -884,6 +1626,7 @@ scrappie_matrix globalnorm(const_scrappie_matrix X, const_scrappie_matrix W,
             C->data.f[offset + r] -= logZ;
         }
     }
+    scrappie_profile_end(SCRAPPIE_STAGE_SOFTMAX);
 
     return C;
 }
@@ -3,6 +3,7 @@
 #    define LAYERS_H
 
 #    include "scrappie_matrix.h"
+#    include "sparse_posterior.h"
 
 void tanh_activation_inplace(scrappie_matrix C);
 void exp_activation_inplace(scrappie_matrix C);
@@ -16,9 +17,15 @@ scrappie_matrix window(const_scrappie_matrix input, size_t w, size_t stride);
 scrappie_matrix convolution(const_scrappie_matrix X, const_scrappie_matrix W,
                             const_scrappie_matrix b, size_t stride,
                             scrappie_matrix C);
+scrappie_matrix convolution_activation(const_scrappie_matrix X, const_scrappie_matrix W,
+                                       const_scrappie_matrix b, size_t stride,
+                                       scrappie_activation_ptr activation, scrappie_matrix C);
 scrappie_matrix feedforward_linear(const_scrappie_matrix X,
                                    const_scrappie_matrix W,
                                    const_scrappie_matrix b, scrappie_matrix C);
+scrappie_matrix feedforward_linear_window(const_scrappie_matrix X, size_t w,
+                                          const_scrappie_matrix W,
+                                          const_scrappie_matrix b, scrappie_matrix C);
 scrappie_matrix feedforward_tanh(const_scrappie_matrix X,
                                  const_scrappie_matrix W,
                                  const_scrappie_matrix b, scrappie_matrix C);
@@ -33,6 +40,9 @@ scrappie_matrix softmax(const_scrappie_matrix X, const_scrappie_matrix W,
 scrappie_matrix softmax_with_temperature(scrappie_matrix X, const_scrappie_matrix W,
                                          const_scrappie_matrix b, float tempW, float tempb,
                                          scrappie_matrix C);
+sparse_posterior softmax_topk_with_temperature(scrappie_matrix X, const_scrappie_matrix W,
+                                               const_scrappie_matrix b, float tempW, float tempb,
+                                               float min_prob, size_t k);
 
 scrappie_matrix feedforward2_tanh(const_scrappie_matrix Xf,
                                   const_scrappie_matrix Xb,
@@ -44,9 +54,29 @@ scrappie_matrix gru_forward(const_scrappie_matrix X, const_scrappie_matrix sW,
                             const_scrappie_matrix sW2, scrappie_matrix res);
 scrappie_matrix gru_backward(const_scrappie_matrix X, const_scrappie_matrix sW,
                              const_scrappie_matrix sW2, scrappie_matrix res);
+scrappie_matrix gru_forward_fused(const_scrappie_matrix X, const_scrappie_matrix iW,
+                                  const_scrappie_matrix b, const_scrappie_matrix sW,
+                                  const_scrappie_matrix sW2, bool residual, scrappie_matrix ostate);
+scrappie_matrix gru_forward_fused_from_state(const_scrappie_matrix X, const_scrappie_matrix iW,
+                                             const_scrappie_matrix b, const_scrappie_matrix sW,
+                                             const_scrappie_matrix sW2, bool residual,
+                                             const_scrappie_matrix istate, scrappie_matrix fstate,
+                                             scrappie_matrix ostate);
+scrappie_matrix gru_backward_fused(const_scrappie_matrix X, const_scrappie_matrix iW,
+                                   const_scrappie_matrix b, const_scrappie_matrix sW,
+                                   const_scrappie_matrix sW2, bool residual, scrappie_matrix ostate);
 void gru_step(const_scrappie_matrix x, const_scrappie_matrix istate,
               const_scrappie_matrix sW, const_scrappie_matrix sW2,
               scrappie_matrix xF, scrappie_matrix ostate);
+scrappie_matrix gru_forward_batch(const_scrappie_matrix X, const_scrappie_matrix sW,
+                                  const_scrappie_matrix sW2, size_t nbatch,
+                                  size_t const * len, scrappie_matrix ostate);
+scrappie_matrix gru_backward_batch(const_scrappie_matrix X, const_scrappie_matrix sW,
+                                   const_scrappie_matrix sW2, size_t nbatch,
+                                   size_t const * len, scrappie_matrix ostate);
+void gru_step_batch(const_scrappie_matrix x, const_scrappie_matrix istate,
+                    const_scrappie_matrix sW, const_scrappie_matrix sW2,
+                    scrappie_matrix xF, scrappie_matrix ostate);
 
 scrappie_matrix grumod_forward(const_scrappie_matrix X, const_scrappie_matrix sW,
                                scrappie_matrix res);
@@ -68,5 +98,10 @@ void lstm_step(const_scrappie_matrix x, const_scrappie_matrix out_prev,
 
 scrappie_matrix globalnorm(const_scrappie_matrix X, const_scrappie_matrix W,
                            const_scrappie_matrix b, scrappie_matrix C);
+void crf_logsumexp_block(float * tmp, size_t nstate, bool forwards, float * out);
+void crf_forward_step(float const * trans, size_t nstate, float const * prev, float * curr,
+                      float * tmp);
+void crf_backward_step(float const * trans, size_t nstate, float const * prev, float * curr,
+                       float * tmp);
 float crf_partition_function(const_scrappie_matrix C);
 #endif                          /* LAYERS_H */
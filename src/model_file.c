@@ -0,0 +1,212 @@
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "model_file.h"
+#include "scrappie_stdlib.h"
+
+
+static size_t model_file_align(size_t offset) {
+    return SCRAPPIE_MODEL_FILE_ALIGN * ((offset + SCRAPPIE_MODEL_FILE_ALIGN - 1) / SCRAPPIE_MODEL_FILE_ALIGN);
+}
+
+
+static size_t padded_stride(size_t nr) {
+    return 4 * ((nr + 3) / 4);
+}
+
+
+/**  Load model file
+ *
+ *   The file is mapped read-only and the tensors refer to the mapped data,
+ *   so loading costs no more than reading the header and directory; the
+ *   weights themselves are paged in as they are first used.
+ *
+ *   @param path  Path to model file
+ *
+ *   @returns Model file or NULL on failure
+ **/
+model_file * load_model_file(const char * path) {
+    RETURN_NULL_IF(NULL == path, NULL);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        warnx("Failed to open model file \"%s\"", path);
+        return NULL;
+    }
+    struct stat st;
+    if (0 != fstat(fd, &st) || (size_t)st.st_size < sizeof(model_file_header)) {
+        warnx("Model file \"%s\" is too short", path);
+        close(fd);
+        return NULL;
+    }
+    const size_t nbyte = st.st_size;
+    void * map = mmap(NULL, nbyte, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == map) {
+        warnx("Failed to map model file \"%s\"", path);
+        return NULL;
+    }
+
+    const model_file_header * header = map;
+    const bool valid_header = 0 == memcmp(header->magic, SCRAPPIE_MODEL_FILE_MAGIC, sizeof(header->magic))
+        && SCRAPPIE_MODEL_FILE_VERSION == header->version
+        && header->ntensor > 0
+        && header->directory_offset >= sizeof(model_file_header)
+        && header->directory_offset % SCRAPPIE_MODEL_FILE_ALIGN == 0
+        && header->directory_offset + header->ntensor * sizeof(model_file_entry) <= nbyte;
+    if (!valid_header) {
+        warnx("\"%s\" is not a scrappie model file", path);
+        munmap(map, nbyte);
+        return NULL;
+    }
+
+    const model_file_entry * directory =
+        (const model_file_entry *)((const char *)map + header->directory_offset);
+    for (size_t i = 0; i < header->ntensor; i++) {
+        const model_file_entry * e = directory + i;
+        const uint64_t tensor_nbyte = (uint64_t)e->nc * padded_stride(e->nr) * sizeof(float);
+        const bool valid_entry = '\0' == e->name[SCRAPPIE_TENSOR_NAME_LEN - 1]
+            && e->nr > 0 && e->nc > 0
+            && e->offset % SCRAPPIE_MODEL_FILE_ALIGN == 0
+            && e->offset <= nbyte && tensor_nbyte <= nbyte - e->offset;
+        if (!valid_entry) {
+            warnx("Tensor %zu of model file \"%s\" is corrupt", i, path);
+            munmap(map, nbyte);
+            return NULL;
+        }
+    }
+
+    model_file * mf = calloc(1, sizeof(model_file));
+    _Mat * tensor = calloc(header->ntensor, sizeof(_Mat));
+    if (NULL == mf || NULL == tensor) {
+        free(tensor);
+        free(mf);
+        munmap(map, nbyte);
+        return NULL;
+    }
+    mf->map = map;
+    mf->nbyte = nbyte;
+    memcpy(mf->model, header->model, SCRAPPIE_MODEL_NAME_LEN);
+    mf->ntensor = header->ntensor;
+    mf->directory = directory;
+    mf->tensor = tensor;
+    for (size_t i = 0; i < mf->ntensor; i++) {
+        tensor[i].nr = directory[i].nr;
+        tensor[i].nrq = padded_stride(directory[i].nr) / 4;
+        tensor[i].nc = directory[i].nc;
+        tensor[i].stride = padded_stride(directory[i].nr);
+        //  Mapping is read-only; tensors must only be used through a const_scrappie_matrix
+        tensor[i].data.f = (float *)((char *)map + directory[i].offset);
+    }
+
+    return mf;
+}
+
+
+/**  Find tensor of model file by name
+ *
+ *   @returns Tensor or NULL if the file contains no tensor of that name
+ **/
+const_scrappie_matrix model_file_tensor(const model_file * mf, const char * name) {
+    RETURN_NULL_IF(NULL == mf, NULL);
+    RETURN_NULL_IF(NULL == name, NULL);
+
+    for (size_t i = 0; i < mf->ntensor; i++) {
+        if (0 == strcmp(mf->directory[i].name, name)) {
+            return mf->tensor + i;
+        }
+    }
+    return NULL;
+}
+
+
+/**  Write model file
+ *
+ *   @param path  Path of file to write
+ *   @param model  Name of model
+ *   @param names  Array [ntensor] of names of tensors
+ *   @param tensors  Array [ntensor] of tensors
+ *   @param ntensor  Number of tensors
+ *
+ *   @returns true on success
+ **/
+bool write_model_file(const char * path, const char * model, const char * const * names,
+                      const const_scrappie_matrix * tensors, size_t ntensor) {
+    RETURN_NULL_IF(NULL == path, false);
+    RETURN_NULL_IF(NULL == model, false);
+    RETURN_NULL_IF(NULL == names, false);
+    RETURN_NULL_IF(NULL == tensors, false);
+    RETURN_NULL_IF(0 == ntensor, false);
+    const size_t model_len = strlen(model);
+    RETURN_NULL_IF(model_len >= SCRAPPIE_MODEL_NAME_LEN, false);
+
+    model_file_entry * directory = calloc(ntensor, sizeof(model_file_entry));
+    RETURN_NULL_IF(NULL == directory, false);
+
+    model_file_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SCRAPPIE_MODEL_FILE_MAGIC, sizeof(header.magic));
+    header.version = SCRAPPIE_MODEL_FILE_VERSION;
+    header.ntensor = ntensor;
+    memcpy(header.model, model, model_len);
+    header.directory_offset = model_file_align(sizeof(header));
+
+    size_t offset = model_file_align(header.directory_offset + ntensor * sizeof(model_file_entry));
+    for (size_t i = 0; i < ntensor; i++) {
+        const size_t name_len = strlen(names[i]);
+        if (0 == name_len || name_len >= SCRAPPIE_TENSOR_NAME_LEN || NULL == tensors[i]
+            || tensors[i]->stride != padded_stride(tensors[i]->nr)) {
+            warnx("Tensor %zu cannot be written to model file", i);
+            free(directory);
+            return false;
+        }
+        memcpy(directory[i].name, names[i], name_len);
+        directory[i].nr = tensors[i]->nr;
+        directory[i].nc = tensors[i]->nc;
+        directory[i].offset = offset;
+        offset = model_file_align(offset + tensors[i]->nc * tensors[i]->stride * sizeof(float));
+    }
+
+    FILE * fh = fopen(path, "wb");
+    if (NULL == fh) {
+        warnx("Failed to open \"%s\" to write model", path);
+        free(directory);
+        return false;
+    }
+    const char padding[SCRAPPIE_MODEL_FILE_ALIGN] = { 0 };
+    size_t pos = header.directory_offset;
+    bool ok = 1 == fwrite(&header, sizeof(header), 1, fh)
+        && pos - sizeof(header) == fwrite(padding, 1, pos - sizeof(header), fh)
+        && ntensor == fwrite(directory, sizeof(model_file_entry), ntensor, fh);
+    pos += ntensor * sizeof(model_file_entry);
+    for (size_t i = 0; ok && i < ntensor; i++) {
+        const size_t ndata = tensors[i]->nc * tensors[i]->stride;
+        ok = directory[i].offset - pos == fwrite(padding, 1, directory[i].offset - pos, fh)
+            && ndata == fwrite(tensors[i]->data.f, sizeof(float), ndata, fh);
+        pos = directory[i].offset + ndata * sizeof(float);
+    }
+    ok = (0 == fclose(fh)) && ok;
+    if (!ok) {
+        warnx("Failed to write model file \"%s\"", path);
+        remove(path);
+    }
+    free(directory);
+
+    return ok;
+}
+
+
+model_file * free_model_file(model_file * mf) {
+    if (NULL != mf) {
+        munmap(mf->map, mf->nbyte);
+        free(mf->tensor);
+        free(mf);
+    }
+    return NULL;
+}
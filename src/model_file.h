@@ -0,0 +1,62 @@
+#pragma once
+#ifndef MODEL_FILE_H
+#    define MODEL_FILE_H
+
+/**  Binary files of model weights
+ *
+ *   A model file is a fixed size header, naming the model, followed by a
+ *   directory of named tensors and then the tensors themselves in scrappie's
+ *   padded layout.  Each tensor starts on a SCRAPPIE_MODEL_FILE_ALIGN byte
+ *   boundary so a mapped file can be used as a set of matrices without any
+ *   copying or parsing.  Values are stored in native byte order.
+ **/
+
+#    include <stdbool.h>
+#    include <stddef.h>
+#    include <stdint.h>
+#    include "scrappie_matrix.h"
+
+#    define SCRAPPIE_MODEL_FILE_MAGIC "SCRPMODL"
+#    define SCRAPPIE_MODEL_FILE_VERSION 1
+#    define SCRAPPIE_MODEL_FILE_ALIGN 64
+#    define SCRAPPIE_MODEL_NAME_LEN 32
+#    define SCRAPPIE_TENSOR_NAME_LEN 40
+
+//  Header of model file, 64 bytes
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t ntensor;
+    char model[SCRAPPIE_MODEL_NAME_LEN];
+    //  Bytes from start of file to start of directory
+    uint64_t directory_offset;
+    char reserved[8];
+} model_file_header;
+
+//  Entry of directory, 64 bytes
+typedef struct {
+    char name[SCRAPPIE_TENSOR_NAME_LEN];
+    uint32_t nr;
+    uint32_t nc;
+    //  Bytes from start of file to start of tensor
+    uint64_t offset;
+    char reserved[8];
+} model_file_entry;
+
+typedef struct {
+    void * map;
+    size_t nbyte;
+    char model[SCRAPPIE_MODEL_NAME_LEN + 1];
+    size_t ntensor;
+    model_file_entry const * directory;
+    //  Matrices whose data are within the mapped file
+    _Mat * tensor;
+} model_file;
+
+model_file * load_model_file(const char * path);
+const_scrappie_matrix model_file_tensor(const model_file * mf, const char * name);
+bool write_model_file(const char * path, const char * model, const char * const * names,
+                      const const_scrappie_matrix * tensors, size_t ntensor);
+model_file * free_model_file(model_file * mf);
+
+#endif                          /* MODEL_FILE_H */
@@ -0,0 +1,403 @@
+#if defined(_OPENMP)
+#    include <omp.h>
+#endif
+#include <assert.h>
+#include <err.h>
+#include <string.h>
+
+#include "layers.h"
+#include "network_graph.h"
+#include "nnfeatures.h"
+#include "scrappie_stdlib.h"
+
+
+/**  Evaluate two independent functions concurrently
+ *
+ *   Called from a worker of the read pipeline, the second function is a
+ *   task that an idle thread of the team may take; otherwise the functions
+ *   are run by a team of their own.  Either way, they run serially when no
+ *   other thread is available.
+ *
+ *   @param layer  Function evaluating, e.g., one direction of a layer
+ *   @param first, second  Arguments of each evaluation
+ **/
+void run_concurrently(void (*layer)(void *), void * first, void * second) {
+#if defined(_OPENMP)
+    if (omp_in_parallel()) {
+#pragma omp task
+        layer(second);
+        layer(first);
+#pragma omp taskwait
+        return;
+    }
+#endif
+#pragma omp parallel sections
+    {
+#pragma omp section
+        layer(first);
+#pragma omp section
+        layer(second);
+    }
+}
+
+
+static size_t tensor_ncol(const network_graph * graph, size_t i, size_t n) {
+    const size_t stride = graph->step[i].column_stride;
+    return (n + stride - 1) / stride;
+}
+
+static size_t tensor_bytes(const network_graph * graph, size_t i, size_t n) {
+    return ((graph->step[i].nr + 3) / 4) * sizeof(__m128) * tensor_ncol(graph, i, n);
+}
+
+
+/**  Shape of the tensor of a layer, checking the layer against its inputs
+ *
+ *   @returns true if the layer is valid
+ **/
+static bool plan_layer_shape(network_graph * graph, size_t i) {
+    const graph_layer * layer = graph->layer + i;
+    graph_step * step = graph->step + i;
+    for (size_t k = 0; k < 2; k++) {
+        if (layer->input[k] < -1 || layer->input[k] >= (int)i) {
+            return false;
+        }
+    }
+    const graph_step * in0 = (layer->input[0] >= 0) ? graph->step + layer->input[0] : NULL;
+    const graph_step * in1 = (layer->input[1] >= 0) ? graph->step + layer->input[1] : NULL;
+    const bool source = (NULL == in0 && NULL == in1);
+
+    switch (layer->type) {
+    case GRAPH_LAYER_FEATURES:
+        step->nr = 1;
+        step->column_stride = 1;
+        return source;
+    case GRAPH_LAYER_EMBEDDING:
+        if (!source || NULL == layer->W) {
+            return false;
+        }
+        step->nr = layer->W->nr;
+        step->column_stride = 1;
+        return true;
+    case GRAPH_LAYER_CONVOLUTION:
+        if (NULL == in0 || NULL != in1 || NULL == layer->W || NULL == layer->b
+            || 0 == layer->stride || layer->W->nc != layer->b->nr
+            || 0 != layer->W->nrq % ((in0->nr + 3) / 4)) {
+            return false;
+        }
+        step->nr = layer->W->nc;
+        step->column_stride = in0->column_stride * layer->stride;
+        step->activation = layer->activation;
+        return true;
+    case GRAPH_LAYER_ACTIVATION:
+        if (NULL == in0 || NULL != in1 || NULL == layer->activation) {
+            return false;
+        }
+        step->nr = in0->nr;
+        step->column_stride = in0->column_stride;
+        return true;
+    case GRAPH_LAYER_GRU:
+        if (NULL == in0 || NULL != in1 || NULL == layer->W || NULL == layer->b
+            || NULL == layer->sW || NULL == layer->sW2 || layer->W->nr != in0->nr
+            || layer->W->nc != 3 * layer->sW2->nc || layer->b->nr != layer->W->nc
+            || (layer->residual && in0->nr != layer->sW2->nc)) {
+            return false;
+        }
+        step->nr = layer->sW2->nc;
+        step->column_stride = in0->column_stride;
+        return true;
+    case GRAPH_LAYER_FEEDFORWARD2_TANH:
+        if (NULL == in0 || NULL == in1 || NULL == layer->W || NULL == layer->W2
+            || NULL == layer->b || layer->W->nr != in0->nr || layer->W2->nr != in1->nr
+            || layer->W->nc != layer->W2->nc || layer->b->nr != layer->W->nc
+            || in0->column_stride != in1->column_stride) {
+            return false;
+        }
+        step->nr = layer->W->nc;
+        step->column_stride = in0->column_stride;
+        return true;
+    case GRAPH_LAYER_RESIDUAL:
+        if (NULL == in0 || NULL == in1 || in0->nr != in1->nr
+            || in0->column_stride != in1->column_stride) {
+            return false;
+        }
+        step->nr = in1->nr;
+        step->column_stride = in1->column_stride;
+        return true;
+    default:
+        return false;
+    }
+}
+
+
+/**  Plan the evaluation of a graph
+ *
+ *   Tensors are assigned to buffers in order of layer.  A layer overwrites
+ *   its input when the layer works in place, activations and residuals
+ *   always and GRUs whose input has the shape of their output, and no later
+ *   layer reads the input; otherwise its tensor goes into the largest buffer
+ *   whose tensor has been read for the last time, or a new buffer when
+ *   there is none.  The plan depends only on the layers, so holds for
+ *   inputs of any length.
+ *
+ *   @param graph  Graph, whose plan is filled in [in/out]
+ *
+ *   @returns true on success, false if the graph is invalid
+ **/
+bool plan_network_graph(network_graph * graph) {
+    assert(NULL != graph);
+    graph->planned = false;
+    const size_t nlayer = graph->nlayer;
+    RETURN_NULL_IF(0 == nlayer || nlayer > NETWORK_GRAPH_MAX_LAYER, false);
+    memset(graph->step, 0, sizeof(graph->step));
+
+    for (size_t i = 0; i < nlayer; i++) {
+        if (!plan_layer_shape(graph, i)) {
+            warnx("Layer %zu of network graph is invalid.", i);
+            return false;
+        }
+        //  A tensor that is never read is dead once written
+        graph->step[i].last_use = i;
+        for (size_t k = 0; k < 2; k++) {
+            if (graph->layer[i].input[k] >= 0) {
+                graph->step[graph->layer[i].input[k]].last_use = i;
+            }
+        }
+    }
+    graph->step[nlayer - 1].last_use = nlayer;
+
+    //  Activations whose convolution has no other reader are applied by it
+    for (size_t i = 0; i < nlayer; i++) {
+        const int j = graph->layer[i].input[0];
+        if (GRAPH_LAYER_ACTIVATION == graph->layer[i].type
+            && GRAPH_LAYER_CONVOLUTION == graph->layer[j].type
+            && NULL == graph->step[j].activation && i == graph->step[j].last_use) {
+            graph->step[j].activation = graph->layer[i].activation;
+            graph->step[i].fused = true;
+        }
+    }
+
+    //  Adjacent GRUs, the second not reading the first, run concurrently
+    for (size_t i = 0; i + 1 < nlayer; i++) {
+        if (GRAPH_LAYER_GRU == graph->layer[i].type && GRAPH_LAYER_GRU == graph->layer[i + 1].type
+            && (int)i != graph->layer[i + 1].input[0]) {
+            graph->step[i].concurrent = true;
+            i += 1;
+        }
+    }
+
+    //  Last layer reading the tensor in each buffer and bytes per sample of the largest
+    size_t busy[NETWORK_GRAPH_MAX_LAYER];
+    float density[NETWORK_GRAPH_MAX_LAYER];
+    size_t nbuffer = 0;
+    for (size_t i = 0; i < nlayer; i++) {
+        graph_step * step = graph->step + i;
+        const graph_layer * layer = graph->layer + i;
+        const bool paired = step->concurrent || (i > 0 && graph->step[i - 1].concurrent);
+        //  Layers evaluated together may not write a buffer either reads
+        const size_t first = (i > 0 && graph->step[i - 1].concurrent) ? i - 1 : i;
+
+        int src = -1;
+        if (GRAPH_LAYER_ACTIVATION == layer->type) {
+            src = layer->input[0];
+        } else if (GRAPH_LAYER_RESIDUAL == layer->type) {
+            src = layer->input[1];
+        } else if (GRAPH_LAYER_GRU == layer->type && !paired
+                   && step->nr == graph->step[layer->input[0]].nr
+                   && i == graph->step[layer->input[0]].last_use) {
+            src = layer->input[0];
+        }
+        if (src >= 0 && i != graph->step[src].last_use) {
+            warnx("Layer %zu of network graph overwrites a tensor read by a later layer.", i);
+            return false;
+        }
+
+        const float layer_density = (float)((step->nr + 3) / 4) / step->column_stride;
+        size_t buffer = nbuffer;
+        if (src >= 0) {
+            buffer = graph->step[src].buffer;
+            step->inplace = true;
+        } else {
+            for (size_t b = 0; b < nbuffer; b++) {
+                if (busy[b] < first && (buffer == nbuffer || density[b] > density[buffer])) {
+                    buffer = b;
+                }
+            }
+            if (nbuffer == buffer) {
+                density[buffer] = 0.0f;
+                nbuffer += 1;
+            }
+        }
+        step->buffer = buffer;
+        busy[buffer] = step->last_use;
+        if (layer_density > density[buffer]) {
+            density[buffer] = layer_density;
+        }
+    }
+
+    graph->nbuffer = nbuffer;
+    graph->planned = true;
+    return true;
+}
+
+
+/**  Memory of the buffers of a planned graph
+ *
+ *   @param graph  Planned graph
+ *   @param n  Length of the input, samples of signal or bases of sequence
+ *
+ *   @returns Bytes held by the buffers at the peak of evaluation
+ **/
+size_t network_graph_bytes(const network_graph * graph, size_t n) {
+    assert(NULL != graph);
+    assert(graph->planned);
+    size_t bytes[NETWORK_GRAPH_MAX_LAYER] = {0};
+    for (size_t i = 0; i < graph->nlayer; i++) {
+        const size_t b = graph->step[i].buffer;
+        const size_t nbyte = tensor_bytes(graph, i, n);
+        if (nbyte > bytes[b]) {
+            bytes[b] = nbyte;
+        }
+    }
+    size_t total = 0;
+    for (size_t b = 0; b < graph->nbuffer; b++) {
+        total += bytes[b];
+    }
+    return total;
+}
+
+
+typedef struct {
+    const network_graph * graph;
+    const graph_input * input;
+    scrappie_matrix const * buffer;
+    size_t layer;
+    scrappie_matrix out;
+} graph_task;
+
+static void evaluate_graph_layer(void * arg) {
+    graph_task * task = arg;
+    const network_graph * graph = task->graph;
+    const graph_layer * layer = graph->layer + task->layer;
+    const graph_step * step = graph->step + task->layer;
+    scrappie_matrix C = task->buffer[step->buffer];
+    const_scrappie_matrix X = (layer->input[0] >= 0)
+        ? task->buffer[graph->step[layer->input[0]].buffer] : NULL;
+    const_scrappie_matrix X2 = (layer->input[1] >= 0)
+        ? task->buffer[graph->step[layer->input[1]].buffer] : NULL;
+
+    switch (layer->type) {
+    case GRAPH_LAYER_FEATURES:
+        C = nanonet_features_from_raw_into(task->input->signal, C);
+        break;
+    case GRAPH_LAYER_EMBEDDING:
+        C = embedding(task->input->sequence, task->input->n, layer->W, C);
+        break;
+    case GRAPH_LAYER_CONVOLUTION:
+        C = convolution_activation(X, layer->W, layer->b, layer->stride, step->activation, C);
+        break;
+    case GRAPH_LAYER_ACTIVATION:
+        if (!step->fused) {
+            layer->activation(C->data.f, C->stride * C->nc);
+        }
+        break;
+    case GRAPH_LAYER_GRU:
+        C = layer->backward
+            ? gru_backward_fused(X, layer->W, layer->b, layer->sW, layer->sW2, layer->residual, C)
+            : gru_forward_fused(X, layer->W, layer->b, layer->sW, layer->sW2, layer->residual, C);
+        break;
+    case GRAPH_LAYER_FEEDFORWARD2_TANH:
+        C = feedforward2_tanh(X, X2, layer->W, layer->W2, layer->b, C);
+        break;
+    case GRAPH_LAYER_RESIDUAL:
+        residual_inplace(X, C);
+        break;
+    default:
+        errx(EXIT_FAILURE, "Network graph enum failure -- report bug\n");
+    }
+    task->out = C;
+}
+
+
+/**  Evaluate a planned graph
+ *
+ *   Each buffer is allocated once, large enough for every tensor it holds,
+ *   and reshaped for each; buffers other than that of the output are freed
+ *   at the end.
+ *
+ *   @param graph  Planned graph
+ *   @param input  Input of graph
+ *
+ *   @returns Tensor of the last layer or NULL on failure
+ **/
+scrappie_matrix run_network_graph(const network_graph * graph, const graph_input input) {
+    RETURN_NULL_IF(NULL == graph, NULL);
+    assert(graph->planned);
+    const size_t nlayer = graph->nlayer;
+
+    size_t n = input.n;
+    for (size_t i = 0; i < nlayer; i++) {
+        if (GRAPH_LAYER_FEATURES == graph->layer[i].type) {
+            n = input.signal.end - input.signal.start;
+        }
+    }
+    RETURN_NULL_IF(0 == n, NULL);
+
+    //  Largest tensor held by each buffer, to allocate it for
+    size_t largest[NETWORK_GRAPH_MAX_LAYER] = {0};
+    size_t largest_bytes[NETWORK_GRAPH_MAX_LAYER] = {0};
+    for (size_t i = 0; i < nlayer; i++) {
+        const size_t b = graph->step[i].buffer;
+        const size_t nbyte = tensor_bytes(graph, i, n);
+        if (nbyte > largest_bytes[b]) {
+            largest[b] = i;
+            largest_bytes[b] = nbyte;
+        }
+    }
+
+    scrappie_matrix buffer[NETWORK_GRAPH_MAX_LAYER] = {NULL};
+    bool ok = true;
+    for (size_t i = 0; ok && i < nlayer; i++) {
+        const size_t nconcurrent = graph->step[i].concurrent ? 2 : 1;
+        graph_task task[2];
+        for (size_t k = 0; ok && k < nconcurrent; k++) {
+            const graph_step * step = graph->step + i + k;
+            const size_t b = step->buffer;
+            if (!step->inplace) {
+                if (NULL == buffer[b]) {
+                    buffer[b] = make_scrappie_matrix(graph->step[largest[b]].nr,
+                                                     tensor_ncol(graph, largest[b], n));
+                }
+                buffer[b] = reshape_scrappie_matrix(buffer[b], step->nr, tensor_ncol(graph, i + k, n));
+                ok = (NULL != buffer[b]);
+            }
+            task[k] = (graph_task){graph, &input, buffer, i + k, NULL};
+        }
+        if (!ok) {
+            break;
+        }
+
+        if (2 == nconcurrent) {
+            run_concurrently(evaluate_graph_layer, task, task + 1);
+        } else {
+            evaluate_graph_layer(task);
+        }
+        for (size_t k = 0; k < nconcurrent; k++) {
+            //  A layer failing may have freed its buffer
+            buffer[graph->step[i + k].buffer] = task[k].out;
+            ok &= (NULL != task[k].out);
+        }
+        i += nconcurrent - 1;
+    }
+
+    const size_t out = graph->step[nlayer - 1].buffer;
+    scrappie_matrix res = ok ? buffer[out] : NULL;
+    if (ok) {
+        buffer[out] = NULL;
+    }
+    for (size_t b = 0; b < graph->nbuffer; b++) {
+        buffer[b] = free_scrappie_matrix(buffer[b]);
+    }
+
+    return res;
+}
@@ -0,0 +1,112 @@
+#pragma once
+#ifndef NETWORK_GRAPH_H
+#    define NETWORK_GRAPH_H
+
+/**  Networks described as a list of layers
+ *
+ *   Layer i of a graph writes tensor i from the tensors of earlier layers
+ *   named by its inputs.  Layers without inputs read the input of the
+ *   graph, a raw signal or a sequence, and the tensor of the last layer is
+ *   the output of the graph.
+ *
+ *   Planning a graph decides, from the last layer reading each tensor,
+ *   which tensors share a buffer, so a network holds only as many matrices
+ *   as are live at once; a layer overwrites its input when nothing later
+ *   reads it.  Planning also fuses an activation into the convolution it
+ *   follows and runs adjacent recurrent layers that are independent of each
+ *   other, such as the two directions of a bidirectional layer,
+ *   concurrently.  Each layer is evaluated by the function of layers.h,
+ *   which chooses the kernel for its weights and for the machine, so a
+ *   model described as a graph needs nothing more to have them.
+ **/
+
+#    include <stdbool.h>
+#    include <stddef.h>
+#    include "scrappie_matrix.h"
+#    include "scrappie_structures.h"
+
+#    define NETWORK_GRAPH_MAX_LAYER 24
+
+enum graph_layer_type {
+    //  Features of the raw signal input to the graph
+    GRAPH_LAYER_FEATURES = 0,
+    //  Embedding, by W, of the sequence input to the graph
+    GRAPH_LAYER_EMBEDDING,
+    //  Convolution by W and b with stride, then activation if not NULL
+    GRAPH_LAYER_CONVOLUTION,
+    //  Activation applied in place
+    GRAPH_LAYER_ACTIVATION,
+    //  GRU with input weights W, bias b and recurrent weights sW and sW2
+    GRAPH_LAYER_GRU,
+    //  tanh(W input[0] + W2 input[1] + b)
+    GRAPH_LAYER_FEEDFORWARD2_TANH,
+    //  input[1] + input[0], in place of input[1]
+    GRAPH_LAYER_RESIDUAL,
+    GRAPH_LAYER_INVALID
+};
+
+typedef struct {
+    enum graph_layer_type type;
+    //  Layers whose tensors are input to this one, -1 for none
+    int input[2];
+    const_scrappie_matrix W, W2, b, sW, sW2;
+    size_t stride;
+    scrappie_activation_ptr activation;
+    bool backward, residual;
+} graph_layer;
+
+#    define GRAPH_FEATURES() {.type = GRAPH_LAYER_FEATURES, .input = {-1, -1}}
+#    define GRAPH_EMBEDDING(w) {.type = GRAPH_LAYER_EMBEDDING, .input = {-1, -1}, .W = (w)}
+#    define GRAPH_CONVOLUTION(in, w, bias, str) \
+    {.type = GRAPH_LAYER_CONVOLUTION, .input = {(in), -1}, .W = (w), .b = (bias), .stride = (str)}
+#    define GRAPH_ACTIVATION(in, act) \
+    {.type = GRAPH_LAYER_ACTIVATION, .input = {(in), -1}, .activation = (act)}
+#    define GRAPH_GRU(in, iw, bias, sw, sw2, bwd, res) \
+    {.type = GRAPH_LAYER_GRU, .input = {(in), -1}, .W = (iw), .b = (bias), .sW = (sw), \
+     .sW2 = (sw2), .backward = (bwd), .residual = (res)}
+#    define GRAPH_FEEDFORWARD2_TANH(inf, inb, wf, wb, bias) \
+    {.type = GRAPH_LAYER_FEEDFORWARD2_TANH, .input = {(inf), (inb)}, .W = (wf), .W2 = (wb), \
+     .b = (bias)}
+#    define GRAPH_RESIDUAL(in, fin) {.type = GRAPH_LAYER_RESIDUAL, .input = {(in), (fin)}}
+
+//  Evaluation of a layer, as planned
+typedef struct {
+    //  Buffer holding the tensor of the layer
+    size_t buffer;
+    //  Last layer reading the tensor, nlayer for the output of the graph
+    size_t last_use;
+    //  Rows of tensor and samples of input per column
+    size_t nr, column_stride;
+    //  Tensor overwrites one of the inputs of the layer
+    bool inplace;
+    //  Activation of a convolution, its own or that of an activation layer fused into it
+    scrappie_activation_ptr activation;
+    //  Activation layer applied by the convolution it follows
+    bool fused;
+    //  Evaluated concurrently with the next layer
+    bool concurrent;
+} graph_step;
+
+typedef struct {
+    size_t nlayer;
+    graph_layer layer[NETWORK_GRAPH_MAX_LAYER];
+    //  Filled in by plan_network_graph
+    bool planned;
+    size_t nbuffer;
+    graph_step step[NETWORK_GRAPH_MAX_LAYER];
+} network_graph;
+
+//  Input of a graph, the signal for features or the sequence of length n to embed
+typedef struct {
+    raw_table signal;
+    int const * sequence;
+    size_t n;
+} graph_input;
+
+bool plan_network_graph(network_graph * graph);
+size_t network_graph_bytes(const network_graph * graph, size_t n);
+scrappie_matrix run_network_graph(const network_graph * graph, const graph_input input);
+
+void run_concurrently(void (*layer)(void *), void * first, void * second);
+
+#endif                          /* NETWORK_GRAPH_H */
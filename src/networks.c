@@ -1,4 +1,10 @@
+#if defined(_OPENMP)
+#    include <omp.h>
+#endif
+
 #include "layers.h"
+#include "model_file.h"
+#include "network_graph.h"
 #include "models/nanonet_events.h"
 #include "models/raw_r94.h"
 #include "models/rgrgr_r94.h"
@@ -7,12 +13,17 @@
 #include "models/rnnrf_r94.h"
 #include "networks.h"
 #include "nnfeatures.h"
+#include "packed_reference.h"
+#include "scrappie_seq_helpers.h"
+#include "scrappie_simd.h"
 #include "scrappie_stdlib.h"
 #include "util.h"
 
 #include "models/squiggle_r94.h"
 #include "models/squiggle_r10.h"
 
+static void register_network_weights(void);
+
 enum raw_model_type get_raw_model(const char * modelstr){
     if(0 == strcmp(modelstr, "raw_r94")){
         return SCRAPPIE_MODEL_RAW;
@@ -99,6 +110,125 @@ int get_raw_model_stride(const enum raw_model_type model){
     return -1;
 }
 
+/**  Network of a raw model: its hidden layers, as a planned graph, and its output layer
+ **/
+typedef struct {
+    network_graph hidden;
+    const_scrappie_matrix out_W, out_b;
+    //  Output layer is globally normalised rather than a softmax
+    bool crf;
+} raw_model_network;
+
+/**  Network of a raw model
+ *
+ *   Models whose recurrent layers are unidirectional are built from their
+ *   description by get_recurrent_network.  The raw_r94 model, whose
+ *   recurrent layers are bidirectional, is listed layer by layer.
+ *
+ *   @param model  Raw model
+ *   @param net  Network, whose graph is planned [out]
+ *
+ *   @returns true on success
+ **/
+static bool get_raw_model_network(const enum raw_model_type model, raw_model_network * net) {
+    register_network_weights();
+    recurrent_network rnet;
+    if (SCRAPPIE_MODEL_RAW == model) {
+        *net = (raw_model_network){
+            {9, {GRAPH_FEATURES(),
+                 GRAPH_CONVOLUTION(0, conv_raw_W, conv_raw_b, conv_raw_stride),
+                 GRAPH_ACTIVATION(1, tanhf_array_inplace),
+                 //  First GRU layer, then combined with feed forward layer
+                 GRAPH_GRU(2, gruF1_raw_iW, gruF1_raw_b, gruF1_raw_sW, gruF1_raw_sW2, false, false),
+                 GRAPH_GRU(2, gruB1_raw_iW, gruB1_raw_b, gruB1_raw_sW, gruB1_raw_sW2, true, false),
+                 GRAPH_FEEDFORWARD2_TANH(3, 4, FF1_raw_Wf, FF1_raw_Wb, FF1_raw_b),
+                 //  Second GRU layer, then combined with feed forward layer
+                 GRAPH_GRU(5, gruF2_raw_iW, gruF2_raw_b, gruF2_raw_sW, gruF2_raw_sW2, false, false),
+                 GRAPH_GRU(5, gruB2_raw_iW, gruB2_raw_b, gruB2_raw_sW, gruB2_raw_sW2, true, false),
+                 GRAPH_FEEDFORWARD2_TANH(6, 7, FF2_raw_Wf, FF2_raw_Wb, FF2_raw_b)}},
+            FF3_raw_W, FF3_raw_b, false};
+    } else if (get_recurrent_network(model, &rnet)) {
+        *net = (raw_model_network){.out_W = rnet.out_W, .out_b = rnet.out_b, .crf = rnet.crf};
+        network_graph * graph = &net->hidden;
+        graph->layer[0] = (graph_layer)GRAPH_FEATURES();
+        graph->layer[1] = (graph_layer)GRAPH_CONVOLUTION(0, rnet.conv_W, rnet.conv_b, rnet.stride);
+        graph->layer[2] = (graph_layer)GRAPH_ACTIVATION(1, rnet.activation);
+        graph->nlayer = 3;
+        //  GRU layers, each reading the last
+        for (size_t i = 0; i < rnet.nlayer; i++) {
+            const recurrent_layer * layer = rnet.layer + i;
+            graph->layer[graph->nlayer] = (graph_layer)GRAPH_GRU(
+                (int)graph->nlayer - 1, layer->iW, layer->b, layer->sW, layer->sW2, layer->backward,
+                rnet.residual);
+            graph->nlayer += 1;
+        }
+    } else {
+        return false;
+    }
+
+    return plan_network_graph(&net->hidden);
+}
+
+/**  Number of states of each block of the posterior of a raw model
+ *
+ *   @param model  Raw model
+ *
+ *   @returns Number of states, including stay
+ **/
+size_t get_raw_model_nstate(const enum raw_model_type model){
+    raw_model_network net;
+    if (!get_raw_model_network(model, &net)) {
+        errx(EXIT_FAILURE, "Failed to plan network of raw model %s:%d", __FILE__, __LINE__);
+    }
+    return net.out_W->nc;
+}
+
+/**  Estimate of the peak memory used to basecall a read
+ *
+ *   An upper bound, summing the largest matrices of each stage as if all
+ *   were live at once: the signal, the buffers of the network as planned by
+ *   plan_network_graph, the posterior and the traceback of the decoder, one
+ *   column of states per block.  When the posterior is calculated in chunks,
+ *   the network is only evaluated for the chunks being evaluated, one per
+ *   thread.  A checkpointed traceback holds about twice the square root of
+ *   the number of blocks.
+ *
+ *   @param model  Raw model
+ *   @param nsample  Number of samples of signal
+ *   @param chunk_size  Samples per chunk of posterior, 0 if not chunked
+ *   @param low_memory  Whether traceback of decoder is checkpointed
+ *
+ *   @returns Estimate in bytes
+ **/
+size_t raw_model_memory_estimate(const enum raw_model_type model, size_t nsample, size_t chunk_size,
+                                 bool low_memory){
+    raw_model_network net;
+    if (!get_raw_model_network(model, &net)) {
+        errx(EXIT_FAILURE, "Failed to plan network of raw model %s:%d", __FILE__, __LINE__);
+    }
+    const size_t stride = get_raw_model_stride(model);
+    const size_t nstate = 4 * ((net.out_W->nc + 3) / 4);
+    const size_t nblock = nsample / stride + 1;
+
+    size_t nnetwork = nsample;
+    if(chunk_size > 0 && chunk_size < nsample){
+        size_t nthread = 1;
+#if defined(_OPENMP)
+        nthread = omp_get_max_threads();
+#endif
+        if(nthread * chunk_size < nsample){
+            nnetwork = nthread * chunk_size;
+        }
+    }
+    const size_t ntraceback = low_memory ? (2 * (size_t)ceil(sqrt(nblock)) + 1) : nblock;
+
+    const size_t signal_bytes = nsample * sizeof(float);
+    const size_t network_bytes = network_graph_bytes(&net.hidden, nnetwork);
+    const size_t post_bytes = nstate * nblock * sizeof(float);
+    const size_t traceback_bytes = (nstate + 4) * ntraceback * sizeof(int);
+    return signal_bytes + network_bytes + post_bytes + traceback_bytes;
+}
+
 posterior_function_ptr get_posterior_function(const enum raw_model_type model){
     switch(model){
     case SCRAPPIE_MODEL_RAW:
@@ -120,6 +250,31 @@ posterior_function_ptr get_posterior_function(const enum raw_model_type model){
     return NULL;
 }
 
+/**  Sparse posterior function of transducer model
+ *
+ *   @returns Function or NULL if model is not a transducer
+ **/
+sparse_posterior_function_ptr get_sparse_posterior_function(const enum raw_model_type model){
+    switch(model){
+    case SCRAPPIE_MODEL_RAW:
+        return nanonet_raw_sparse_posterior;
+    case SCRAPPIE_MODEL_RGRGR_R9_4:
+        return nanonet_rgrgr_r94_sparse_posterior;
+    case SCRAPPIE_MODEL_RGRGR_R9_4_1:
+        return nanonet_rgrgr_r941_sparse_posterior;
+    case SCRAPPIE_MODEL_RGRGR_R10:
+        return nanonet_rgrgr_r10_sparse_posterior;
+    case SCRAPPIE_MODEL_RNNRF_R9_4:
+        return NULL;
+    case SCRAPPIE_MODEL_INVALID:
+        errx(EXIT_FAILURE, "Invalid scrappie model %s:%d", __FILE__, __LINE__);
+    default:
+        errx(EXIT_FAILURE, "Scrappie enum failure -- report bug\n");
+    }
+
+    return NULL;
+}
+
 squiggle_function_ptr get_squiggle_function(const enum squiggle_model_type squiggle_model){
     switch(squiggle_model){
     case SCRAPPIE_SQUIGGLE_MODEL_R9_4:
@@ -135,6 +290,257 @@ squiggle_function_ptr get_squiggle_function(const enum squiggle_model_type squig
     return NULL;
 }
 
+
+squiggle_batch_function_ptr get_squiggle_batch_function(const enum squiggle_model_type squiggle_model){
+    switch(squiggle_model){
+    case SCRAPPIE_SQUIGGLE_MODEL_R9_4:
+        return squiggle_r94_batch;
+    case SCRAPPIE_SQUIGGLE_MODEL_R10:
+        return squiggle_r10_batch;
+    case SCRAPPIE_SQUIGGLE_MODEL_INVALID:
+        errx(EXIT_FAILURE, "Invalid scrappie squiggle model %s:%d", __FILE__, __LINE__);
+    default:
+        errx(EXIT_FAILURE, "Scrappie enum failure -- report bug\n");
+    }
+
+    return NULL;
+}
+
+
+/**  Predict squiggle of a sequence of bases
+ *
+ *   @param base_seq  Sequence of bases, as characters
+ *   @param n  Length of sequence
+ *   @param rescale  Whether to transform output into current levels, spreads
+ *   and dwells in samples
+ *   @param squiggle_model  Model to predict with
+ *
+ *   @returns Squiggle [3, n], to be freed by caller, or NULL on failure
+ **/
+scrappie_matrix sequence_to_squiggle(char const * base_seq, size_t n, bool rescale,
+                                     enum squiggle_model_type squiggle_model){
+    RETURN_NULL_IF(NULL == base_seq, NULL);
+
+    int * sequence = encode_bases_to_integers(base_seq, n, 1);
+    RETURN_NULL_IF(NULL == sequence, NULL);
+
+    squiggle_function_ptr squiggle_function = get_squiggle_function(squiggle_model);
+
+    scrappie_matrix squiggle = squiggle_function(sequence, n, rescale);
+    free(sequence);
+
+    return squiggle;
+}
+
+//  Encode sequence i of a set of sequences into integers, NULL if it cannot be predicted
+typedef int * (*squiggle_encode_function_ptr)(void const * src, size_t i);
+
+struct _base_sequences {
+    char const * const * base_seq;
+    size_t const * n;
+};
+
+static int * encode_base_sequence(void const * src, size_t i) {
+    const struct _base_sequences * seqs = src;
+    //  Sequences with bases other than ACGT are not predicted
+    return (NULL != seqs->base_seq[i]) ? encode_bases_to_integers(seqs->base_seq[i], seqs->n[i], 1) : NULL;
+}
+
+static int * encode_packed_sequence(void const * src, size_t i) {
+    return packed_reference_states((const packed_reference *)src, i, 1, NULL);
+}
+
+
+/**  Predict squiggles of many sequences in packed batches
+ *
+ *   Sequences are packed, in order, into batches of about SQUIGGLE_BATCH_BASES
+ *   bases, each predicted as a whole by the batch function of the model, and
+ *   the batches are predicted in parallel.  A sequence longer than a batch is
+ *   predicted alone.  Each sequence is encoded within its batch, so only the
+ *   sequences of the batches being predicted are held encoded.
+ *
+ *   @returns Array [nseq] of squiggles or NULL on failure
+ **/
+static scrappie_matrix * squiggle_batches(squiggle_encode_function_ptr encode, void const * src, size_t const * n,
+                                          size_t nseq, bool rescale, enum squiggle_model_type squiggle_model){
+    squiggle_batch_function_ptr squiggle_function = get_squiggle_batch_function(squiggle_model);
+
+    scrappie_matrix * squiggle = calloc(nseq, sizeof(scrappie_matrix));
+    int ** sequence = calloc(nseq, sizeof(int *));
+    //  First sequence of each batch, and index of the batch to end them
+    size_t * first = calloc(nseq + 1, sizeof(size_t));
+    if (NULL == squiggle || NULL == sequence || NULL == first) {
+        free(first);
+        free(sequence);
+        free(squiggle);
+        return NULL;
+    }
+    size_t nbatch = 0;
+    size_t nbase = 0;
+    for (size_t i = 0; i < nseq; i++) {
+        if (0 == i || nbase + n[i] > SQUIGGLE_BATCH_BASES) {
+            first[nbatch] = i;
+            nbatch += 1;
+            nbase = 0;
+        }
+        nbase += n[i];
+    }
+    first[nbatch] = nseq;
+
+    const int ibatch = nbatch;
+#pragma omp parallel for schedule(dynamic)
+    for (int b = 0; b < ibatch; b++) {
+        const size_t start = first[b];
+        const size_t nb = first[b + 1] - start;
+        for (size_t i = start; i < start + nb; i++) {
+            sequence[i] = (n[i] > 0) ? encode(src, i) : NULL;
+        }
+        scrappie_matrix * res = squiggle_function((int const * const *)(sequence + start), n + start, nb, rescale);
+        for (size_t i = start; i < start + nb; i++) {
+            squiggle[i] = (NULL != res) ? res[i - start] : NULL;
+            free(sequence[i]);
+        }
+        free(res);
+    }
+
+    free(first);
+    free(sequence);
+    return squiggle;
+}
+
+/**  Predict squiggles of many sequences of bases
+ *
+ *   See squiggle_batches
+ *
+ *   @param base_seq  Array [nseq] of sequences of bases, as characters
+ *   @param n  Array [nseq] of lengths of sequences
+ *   @param rescale  Whether to transform output into current levels, spreads
+ *   and dwells in samples
+ *   @param squiggle_model  Model to predict with
+ *
+ *   @returns Array [nseq] of squiggles, each [3, n] and NULL for sequences
+ *   that could not be predicted, or NULL on failure.  Array and squiggles
+ *   to be freed by caller
+ **/
+scrappie_matrix * sequence_to_squiggle_batch(char const * const * base_seq, size_t const * n, size_t nseq,
+                                             bool rescale, enum squiggle_model_type squiggle_model){
+    RETURN_NULL_IF(NULL == base_seq, NULL);
+    RETURN_NULL_IF(NULL == n, NULL);
+    const struct _base_sequences seqs = {base_seq, n};
+    return squiggle_batches(encode_base_sequence, &seqs, n, nseq, rescale, squiggle_model);
+}
+
+/**  Predict squiggles of sequences of a packed reference
+ *
+ *   As sequence_to_squiggle_batch, with the bases of each sequence read
+ *   from its packed words.
+ *
+ *   @param ref  Packed reference
+ *   @param predict  Array [ref->nseq] of whether to predict each sequence, or
+ *   NULL to predict all
+ *   @param rescale  Whether to transform output into current levels, spreads
+ *   and dwells in samples
+ *   @param squiggle_model  Model to predict with
+ *
+ *   @returns Array [ref->nseq] of squiggles, NULL for sequences not predicted,
+ *   or NULL on failure.  Array and squiggles to be freed by caller
+ **/
+scrappie_matrix * packed_reference_to_squiggle_batch(const packed_reference * ref, bool const * predict,
+                                                     bool rescale, enum squiggle_model_type squiggle_model){
+    RETURN_NULL_IF(NULL == ref, NULL);
+    size_t * n = calloc(ref->nseq + 1, sizeof(size_t));
+    RETURN_NULL_IF(NULL == n, NULL);
+    for (size_t i = 0; i < ref->nseq; i++) {
+        //  Sequences of no length are not encoded, so not predicted
+        n[i] = (NULL == predict || predict[i]) ? packed_reference_length(ref, i) : 0;
+    }
+    scrappie_matrix * squiggle = squiggle_batches(encode_packed_sequence, ref, n, ref->nseq, rescale, squiggle_model);
+    free(n);
+    return squiggle;
+}
+
+typedef struct {
+    const_scrappie_matrix X, iW, b, sW, p;
+    bool backward;
+    scrappie_matrix out;
+} lstm_direction;
+
+static void lstm_direction_layer(void * arg) {
+    lstm_direction * d = arg;
+    scrappie_matrix xin = feedforward_linear(d->X, d->iW, d->b, NULL);
+    d->out = d->backward ? lstm_backward(xin, d->sW, d->p, d->out)
+                         : lstm_forward(xin, d->sW, d->p, d->out);
+    xin = free_scrappie_matrix(xin);
+}
+
+/**  Direction of an LSTM layer whose input projection is already made
+ *
+ *   X is the rows of a projection of both directions belonging to this one
+ **/
+static void lstm_projected_direction_layer(void * arg) {
+    lstm_direction * d = arg;
+    d->out = d->backward ? lstm_backward(d->X, d->sW, d->p, d->out)
+                         : lstm_forward(d->X, d->sW, d->p, d->out);
+}
+
+/**  Input weights of both directions of the first LSTM layer of the events model
+ *
+ *   The weights and biases of the two directions side by side, so the input
+ *   projections of both are made by a single product.  Formed, and
+ *   registered for packing, on first use from the weights then current, so
+ *   those of a model file are used; released when the weights are replaced.
+ **/
+static scrappie_matrix lstm1_joint_iW = NULL;
+static scrappie_matrix lstm1_joint_b = NULL;
+
+static void release_joint_input_weights(void) {
+    if (NULL != lstm1_joint_iW) {
+        unregister_packed_weights(lstm1_joint_iW);
+    }
+    lstm1_joint_iW = free_scrappie_matrix(lstm1_joint_iW);
+    lstm1_joint_b = free_scrappie_matrix(lstm1_joint_b);
+}
+
+static bool make_joint_input_weights(void) {
+    bool ok = true;
+#pragma omp critical(register_network_weights)
+    {
+        if (NULL == lstm1_joint_iW) {
+            const size_t nk = lstmF1_iW->nc + lstmB1_iW->nc;
+            assert(lstmF1_iW->nr == lstmB1_iW->nr);
+            //  Biases are joined as rows, so each must fill whole vectors
+            assert(lstmF1_b->nr == 4 * lstmF1_b->nrq);
+            scrappie_matrix iW = make_scrappie_matrix(lstmF1_iW->nr, nk);
+            scrappie_matrix b = make_scrappie_matrix(nk, 1);
+            if (NULL != iW && NULL != b) {
+                memcpy(iW->data.f, lstmF1_iW->data.f, lstmF1_iW->nc * lstmF1_iW->stride * sizeof(float));
+                memcpy(iW->data.f + lstmF1_iW->nc * iW->stride, lstmB1_iW->data.f,
+                       lstmB1_iW->nc * lstmB1_iW->stride * sizeof(float));
+                memcpy(b->data.f, lstmF1_b->data.f, lstmF1_b->nr * sizeof(float));
+                memcpy(b->data.f + lstmF1_b->nr, lstmB1_b->data.f, lstmB1_b->nr * sizeof(float));
+                (void)register_packed_weights(iW);
+                lstm1_joint_iW = iW;
+                lstm1_joint_b = b;
+            } else {
+                iW = free_scrappie_matrix(iW);
+                b = free_scrappie_matrix(b);
+                ok = false;
+            }
+        }
+    }
+    return ok;
+}
+
+/**  Rows of a matrix as a view sharing its memory
+ *
+ *   The columns of the view are as far apart as those of the matrix
+ **/
+static _Mat row_view(const_scrappie_matrix X, size_t r0, size_t nr) {
+    assert(0 == r0 % 4);
+    assert(r0 + nr <= X->nr);
+    return (_Mat){nr, (nr + 3) / 4, X->nc, X->stride, {.f = X->data.f + r0}};
+}
+
 scrappie_matrix nanonet_posterior(const event_table events, float min_prob,
                                   float tempW, float tempb, bool return_log) {
     assert(min_prob >= 0.0f && min_prob <= 1.0f);
@@ -142,37 +548,38 @@ scrappie_matrix nanonet_posterior(const event_table events, float min_prob,
     RETURN_NULL_IF(0 == events.n, NULL);
     RETURN_NULL_IF(NULL == events.event, NULL);
 
+    register_network_weights();
     const int WINLEN = 3;
 
+    RETURN_NULL_IF(!make_joint_input_weights(), NULL);
+
     //  Make features
     scrappie_matrix features = nanonet_features_from_events(events, true);
-    scrappie_matrix feature3 = window(features, WINLEN, 1);
-    features = free_scrappie_matrix(features);
 
-    // Initial transformation of input for LSTM layer
-    scrappie_matrix lstmXf =
-        feedforward_linear(feature3, lstmF1_iW, lstmF1_b, NULL);
-    scrappie_matrix lstmXb =
-        feedforward_linear(feature3, lstmB1_iW, lstmB1_b, NULL);
-    feature3 = free_scrappie_matrix(feature3);
-    scrappie_matrix lstmF = lstm_forward(lstmXf, lstmF1_sW, lstmF1_p, NULL);
-    scrappie_matrix lstmB = lstm_backward(lstmXb, lstmB1_sW, lstmB1_p, NULL);
+    //  First LSTM layer, input projections of both directions made from windows of features at once
+    scrappie_matrix xin = feedforward_linear_window(features, WINLEN, lstm1_joint_iW, lstm1_joint_b, NULL);
+    features = free_scrappie_matrix(features);
+    RETURN_NULL_IF(NULL == xin, NULL);
+    const _Mat xinF = row_view(xin, 0, lstmF1_iW->nc);
+    const _Mat xinB = row_view(xin, lstmF1_iW->nc, lstmB1_iW->nc);
+    lstm_direction lstmF = {&xinF, lstmF1_iW, lstmF1_b, lstmF1_sW, lstmF1_p, false, NULL};
+    lstm_direction lstmB = {&xinB, lstmB1_iW, lstmB1_b, lstmB1_sW, lstmB1_p, true, NULL};
+    run_concurrently(lstm_projected_direction_layer, &lstmF, &lstmB);
+    xin = free_scrappie_matrix(xin);
 
     //  Combine LSTM output
     scrappie_matrix lstmFF =
-        feedforward2_tanh(lstmF, lstmB, FF1_Wf, FF1_Wb, FF1_b, NULL);
+        feedforward2_tanh(lstmF.out, lstmB.out, FF1_Wf, FF1_Wb, FF1_b, NULL);
 
-    lstmXf = feedforward_linear(lstmFF, lstmF2_iW, lstmF2_b, lstmXf);
-    lstmXb = feedforward_linear(lstmFF, lstmB2_iW, lstmB2_b, lstmXb);
-    lstmF = lstm_forward(lstmXf, lstmF2_sW, lstmF2_p, lstmF);
-    lstmXf = free_scrappie_matrix(lstmXf);
-    lstmB = lstm_backward(lstmXb, lstmB2_sW, lstmB2_p, lstmB);
-    lstmXb = free_scrappie_matrix(lstmXb);
+    //  Second LSTM layer
+    lstmF = (lstm_direction){lstmFF, lstmF2_iW, lstmF2_b, lstmF2_sW, lstmF2_p, false, lstmF.out};
+    lstmB = (lstm_direction){lstmFF, lstmB2_iW, lstmB2_b, lstmB2_sW, lstmB2_p, true, lstmB.out};
+    run_concurrently(lstm_direction_layer, &lstmF, &lstmB);
 
     // Combine LSTM output
-    lstmFF = feedforward2_tanh(lstmF, lstmB, FF2_Wf, FF2_Wb, FF2_b, lstmFF);
-    lstmF = free_scrappie_matrix(lstmF);
-    lstmB = free_scrappie_matrix(lstmB);
+    lstmFF = feedforward2_tanh(lstmF.out, lstmB.out, FF2_Wf, FF2_Wb, FF2_b, lstmFF);
+    lstmF.out = free_scrappie_matrix(lstmF.out);
+    lstmB.out = free_scrappie_matrix(lstmB.out);
 
     scrappie_matrix post = softmax_with_temperature(lstmFF, FF3_W, FF3_b, tempW, tempb, NULL);
     lstmFF = free_scrappie_matrix(lstmFF);
@@ -185,26 +592,440 @@ scrappie_matrix nanonet_posterior(const event_table events, float min_prob,
     return post;
 }
 
-scrappie_matrix nanonet_raw_posterior(const raw_table signal, float min_prob,
-                                      float tempW, float tempb, bool return_log) {
+/**  Posterior of a raw model, or transitions of a CRF model, see posterior_function_ptr
+ **/
+static scrappie_matrix raw_model_posterior(const enum raw_model_type model, const raw_table signal,
+                                           float min_prob, float tempW, float tempb, bool return_log) {
     assert(min_prob >= 0.0f && min_prob <= 1.0f);
     assert(tempW > 0.0f && tempb > 0.0f);
     RETURN_NULL_IF(0 == signal.n, NULL);
-    RETURN_NULL_IF(NULL == signal.raw, NULL);
+    RETURN_NULL_IF(NULL == signal.raw && NULL == signal.sample, NULL);
+
+    raw_model_network net;
+    RETURN_NULL_IF(!get_raw_model_network(model, &net), NULL);
+    //  Returning non-log transformed transitions not supported
+    assert(return_log || !net.crf);
+    scrappie_matrix hidden = run_network_graph(&net.hidden, (graph_input){.signal = signal});
+    scrappie_matrix post = net.crf
+        ? globalnorm(hidden, net.out_W, net.out_b, NULL)
+        : softmax_with_temperature(hidden, net.out_W, net.out_b, tempW, tempb, NULL);
+    hidden = free_scrappie_matrix(hidden);
+    RETURN_NULL_IF(NULL == post, NULL);
+
+    if (return_log && !net.crf) {
+        robustlog_activation_inplace(post, min_prob);
+    }
+
+    return post;
+}
+
+/**  Sparse posterior of a raw transducer model, see sparse_posterior_function_ptr
+ **/
+static sparse_posterior raw_model_sparse_posterior(const enum raw_model_type model,
+                                                   const raw_table signal, float min_prob,
+                                                   float tempW, float tempb, size_t k) {
+    assert(min_prob > 0.0f && min_prob <= 1.0f);
+    assert(tempW > 0.0f && tempb > 0.0f);
+    RETURN_NULL_IF(0 == signal.n, NULL);
+    RETURN_NULL_IF(NULL == signal.raw && NULL == signal.sample, NULL);
+
+    raw_model_network net;
+    RETURN_NULL_IF(!get_raw_model_network(model, &net), NULL);
+    RETURN_NULL_IF(net.crf, NULL);
+    scrappie_matrix hidden = run_network_graph(&net.hidden, (graph_input){.signal = signal});
+    sparse_posterior post = softmax_topk_with_temperature(hidden, net.out_W, net.out_b, tempW, tempb,
+                                                          min_prob, k);
+    hidden = free_scrappie_matrix(hidden);
+
+    return post;
+}
+
+scrappie_matrix nanonet_raw_posterior(const raw_table signal, float min_prob,
+                                      float tempW, float tempb, bool return_log) {
+    return raw_model_posterior(SCRAPPIE_MODEL_RAW, signal, min_prob, tempW, tempb, return_log);
+}
+
+sparse_posterior nanonet_raw_sparse_posterior(const raw_table signal, float min_prob,
+                                              float tempW, float tempb, size_t k) {
+    return raw_model_sparse_posterior(SCRAPPIE_MODEL_RAW, signal, min_prob, tempW, tempb, k);
+}
+
+scrappie_matrix nanonet_rgrgr_r94_posterior(const raw_table signal, float min_prob,
+                                            float tempW, float tempb, bool return_log) {
+    return raw_model_posterior(SCRAPPIE_MODEL_RGRGR_R9_4, signal, min_prob, tempW, tempb, return_log);
+}
+
+sparse_posterior nanonet_rgrgr_r94_sparse_posterior(const raw_table signal, float min_prob,
+                                                    float tempW, float tempb, size_t k) {
+    return raw_model_sparse_posterior(SCRAPPIE_MODEL_RGRGR_R9_4, signal, min_prob, tempW, tempb, k);
+}
+
+scrappie_matrix nanonet_rgrgr_r941_posterior(const raw_table signal, float min_prob,
+                                            float tempW, float tempb, bool return_log) {
+    return raw_model_posterior(SCRAPPIE_MODEL_RGRGR_R9_4_1, signal, min_prob, tempW, tempb, return_log);
+}
+
+sparse_posterior nanonet_rgrgr_r941_sparse_posterior(const raw_table signal, float min_prob,
+                                                     float tempW, float tempb, size_t k) {
+    return raw_model_sparse_posterior(SCRAPPIE_MODEL_RGRGR_R9_4_1, signal, min_prob, tempW, tempb, k);
+}
+
+scrappie_matrix nanonet_rgrgr_r10_posterior(const raw_table signal, float min_prob,
+                                            float tempW, float tempb, bool return_log) {
+    return raw_model_posterior(SCRAPPIE_MODEL_RGRGR_R10, signal, min_prob, tempW, tempb, return_log);
+}
+
+sparse_posterior nanonet_rgrgr_r10_sparse_posterior(const raw_table signal, float min_prob,
+                                                    float tempW, float tempb, size_t k) {
+    return raw_model_sparse_posterior(SCRAPPIE_MODEL_RGRGR_R10, signal, min_prob, tempW, tempb, k);
+}
+
+scrappie_matrix nanonet_rnnrf_r94_transitions(const raw_table signal, float min_prob,
+                                              float tempW, float tempb, bool return_log) {
+    return raw_model_posterior(SCRAPPIE_MODEL_RNNRF_R9_4, signal, min_prob, tempW, tempb, return_log);
+}
+
+
+/**  Columns of zeros either side of each sequence packed into a squiggle batch
+ *
+ *   At least half the window of every convolution of the squiggle models, so
+ *   each sequence only ever sees zeros beyond its ends, as when it is
+ *   predicted alone.
+ **/
+#define SQUIGGLE_BATCH_GAP 8
+#define SQUIGGLE_NCONV 6
+
+/**  Weights of a squiggle model: an embedding followed by convolutions, all of
+ *   stride one, the first with tanh activation, the next four also wrapped in
+ *   residual layers, and the last linear
+ **/
+typedef struct {
+    const_scrappie_matrix embed;
+    const_scrappie_matrix W[SQUIGGLE_NCONV];
+    const_scrappie_matrix b[SQUIGGLE_NCONV];
+    size_t winlen[SQUIGGLE_NCONV];
+} squiggle_weights;
+
+
+/**  Zero the columns of a packed batch that lie between sequences
+ **/
+static void zero_squiggle_gaps(scrappie_matrix X, size_t const * start, size_t const * len, size_t nbatch) {
+    const size_t colbytes = X->stride * sizeof(float);
+    size_t col = 0;
+    for (size_t i = 0; i < nbatch; i++) {
+        if (0 == len[i]) {
+            continue;
+        }
+        memset(X->data.f + col * X->stride, 0, (start[i] - col) * colbytes);
+        col = start[i] + len[i];
+    }
+    memset(X->data.f + col * X->stride, 0, (X->nc - col) * colbytes);
+}
+
+
+/**  Predict squiggles of a batch of sequences packed into a single matrix
+ *
+ *   Sequences are laid end to end, separated by SQUIGGLE_BATCH_GAP columns,
+ *   so each layer is one convolution over the whole batch.  The columns
+ *   between sequences are zeroed after every layer, so no sequence sees
+ *   another and each is predicted as it would be alone, up to rounding.
+ *
+ *   @returns Array [nbatch] of squiggles, NULL for sequences that are NULL or
+ *   empty, or NULL on failure
+ **/
+static scrappie_matrix * squiggle_batch(const squiggle_weights * w, int const * const * sequences,
+                                        size_t const * n, size_t nbatch, bool transform_units) {
+    RETURN_NULL_IF(NULL == sequences, NULL);
+    RETURN_NULL_IF(NULL == n, NULL);
+    RETURN_NULL_IF(0 == nbatch, NULL);
+
+    scrappie_matrix * res = calloc(nbatch, sizeof(scrappie_matrix));
+    size_t * start = calloc(nbatch, sizeof(size_t));
+    size_t * len = calloc(nbatch, sizeof(size_t));
+    if (NULL == res || NULL == start || NULL == len) {
+        free(len);
+        free(start);
+        free(res);
+        return NULL;
+    }
+    size_t ncol = SQUIGGLE_BATCH_GAP;
+    for (size_t i = 0; i < nbatch; i++) {
+        len[i] = (NULL != sequences[i]) ? n[i] : 0;
+        start[i] = ncol;
+        ncol += (len[i] > 0) ? len[i] + SQUIGGLE_BATCH_GAP : 0;
+    }
+
+    scrappie_matrix X = NULL;
+    int * packed = (ncol > SQUIGGLE_BATCH_GAP) ? calloc(ncol, sizeof(int)) : NULL;
+    if (NULL != packed) {
+        for (size_t i = 0; i < nbatch; i++) {
+            if (len[i] > 0) {
+                memcpy(packed + start[i], sequences[i], len[i] * sizeof(int));
+            }
+        }
+        X = embedding(packed, ncol, w->embed, NULL);
+        free(packed);
+        if (NULL != X) {
+            zero_squiggle_gaps(X, start, len, nbatch);
+        }
+    }
+
+    for (size_t k = 0; NULL != X && k < SQUIGGLE_NCONV; k++) {
+        assert(w->winlen[k] / 2 <= SQUIGGLE_BATCH_GAP);
+        scrappie_matrix Y = convolution(X, w->W[k], w->b[k], 1, NULL);
+        if (NULL != Y && k < SQUIGGLE_NCONV - 1) {
+            tanh_activation_inplace(Y);
+            zero_squiggle_gaps(Y, start, len, nbatch);
+            if (k > 0) {
+                residual_inplace(X, Y);
+            }
+        }
+        X = free_scrappie_matrix(X);
+        X = Y;
+    }
+
+    for (size_t i = 0; NULL != X && i < nbatch; i++) {
+        if (0 == len[i]) {
+            continue;
+        }
+        res[i] = make_scrappie_matrix(X->nr, len[i]);
+        if (NULL == res[i]) {
+            continue;
+        }
+        memcpy(res[i]->data.f, X->data.f + start[i] * X->stride, len[i] * X->stride * sizeof(float));
+        if (transform_units) {
+            for (size_t c = 0; c < res[i]->nc; c++) {
+                float * col = res[i]->data.f + c * res[i]->stride;
+                //  Convert logsd to sd
+                col[1] = expf(col[1]);
+                //  Convert transformed dwell into expected samples
+                col[2] = expf(-col[2]);
+            }
+        }
+    }
+    const bool ok = (NULL != X) || (ncol == SQUIGGLE_BATCH_GAP);
+    X = free_scrappie_matrix(X);
+    free(len);
+    free(start);
+    if (!ok) {
+        free(res);
+        return NULL;
+    }
+
+    return res;
+}
+
+
+static squiggle_weights get_squiggle_r94_weights(void) {
+    return (squiggle_weights){
+        embed_squiggle_r94_W,
+        {conv1_squiggle_r94_W, conv2_squiggle_r94_W, conv3_squiggle_r94_W,
+         conv4_squiggle_r94_W, conv5_squiggle_r94_W, conv6_squiggle_r94_W},
+        {conv1_squiggle_r94_b, conv2_squiggle_r94_b, conv3_squiggle_r94_b,
+         conv4_squiggle_r94_b, conv5_squiggle_r94_b, conv6_squiggle_r94_b},
+        {_conv1_squiggle_r94_winlen, _conv2_squiggle_r94_winlen, _conv3_squiggle_r94_winlen,
+         _conv4_squiggle_r94_winlen, _conv5_squiggle_r94_winlen, _conv6_squiggle_r94_winlen}
+    };
+}
+
+static squiggle_weights get_squiggle_r10_weights(void) {
+    return (squiggle_weights){
+        embed_squiggle_r10_W,
+        {conv1_squiggle_r10_W, conv2_squiggle_r10_W, conv3_squiggle_r10_W,
+         conv4_squiggle_r10_W, conv5_squiggle_r10_W, conv6_squiggle_r10_W},
+        {conv1_squiggle_r10_b, conv2_squiggle_r10_b, conv3_squiggle_r10_b,
+         conv4_squiggle_r10_b, conv5_squiggle_r10_b, conv6_squiggle_r10_b},
+        {_conv1_squiggle_r10_winlen, _conv2_squiggle_r10_winlen, _conv3_squiggle_r10_winlen,
+         _conv4_squiggle_r10_winlen, _conv5_squiggle_r10_winlen, _conv6_squiggle_r10_winlen}
+    };
+}
+
 
-    scrappie_matrix raw_mat = nanonet_features_from_raw(signal);
-    scrappie_matrix conv = convolution(raw_mat, conv_raw_W, conv_raw_b, conv_raw_stride, NULL);
-    tanh_activation_inplace(conv);
-    raw_mat = free_scrappie_matrix(raw_mat);
+/**  Predict the squiggle of a single sequence
+ *
+ *   The layers of the model, see squiggle_weights, are evaluated as a graph.
+ *
+ *   @returns Matrix of level, log or, when transform_units is set, standard
+ *   deviation, and dwell for each base of sequence, or NULL on failure
+ **/
+static scrappie_matrix squiggle_sequence(const squiggle_weights * w, int const * sequence, size_t n,
+                                         bool transform_units) {
+    RETURN_NULL_IF(NULL == sequence, NULL);
+
+    network_graph graph = {2, {GRAPH_EMBEDDING(w->embed), GRAPH_CONVOLUTION(0, w->W[0], w->b[0], 1)}};
+    graph.layer[graph.nlayer++] = (graph_layer)GRAPH_ACTIVATION(1, tanhf_array_inplace);
+    for (size_t k = 1; k < SQUIGGLE_NCONV - 1; k++) {
+        //  Convolution, wrapped in residual layer
+        const int in = (int)graph.nlayer - 1;
+        graph.layer[graph.nlayer++] = (graph_layer)GRAPH_CONVOLUTION(in, w->W[k], w->b[k], 1);
+        graph.layer[graph.nlayer++] = (graph_layer)GRAPH_ACTIVATION(in + 1, tanhf_array_inplace);
+        graph.layer[graph.nlayer++] = (graph_layer)GRAPH_RESIDUAL(in, in + 2);
+    }
+    graph.layer[graph.nlayer] = (graph_layer)GRAPH_CONVOLUTION(
+        (int)graph.nlayer - 1, w->W[SQUIGGLE_NCONV - 1], w->b[SQUIGGLE_NCONV - 1], 1);
+    graph.nlayer += 1;
+    RETURN_NULL_IF(!plan_network_graph(&graph), NULL);
+
+    scrappie_matrix squiggle = run_network_graph(&graph, (graph_input){.sequence = sequence, .n = n});
+    RETURN_NULL_IF(NULL == squiggle, NULL);
+
+    if(transform_units){
+        for(size_t c=0 ; c < squiggle->nc ; c++){
+            size_t offset = c * squiggle->stride;
+            //  Convert logsd to sd
+            squiggle->data.f[offset + 1] = expf(squiggle->data.f[offset + 1]);
+            //  Convert transformed dwell into expected samples
+            squiggle->data.f[offset + 2] = expf(-squiggle->data.f[offset + 2]);
+        }
+    }
+
+    return squiggle;
+}
+
+
+scrappie_matrix squiggle_r94(int const * sequence, size_t n, bool transform_units){
+    register_network_weights();
+    const squiggle_weights w = get_squiggle_r94_weights();
+    return squiggle_sequence(&w, sequence, n, transform_units);
+}
+
+
+scrappie_matrix squiggle_r10(int const * sequence, size_t n, bool transform_units){
+    register_network_weights();
+    const squiggle_weights w = get_squiggle_r10_weights();
+    return squiggle_sequence(&w, sequence, n, transform_units);
+}
+
+
+scrappie_matrix * squiggle_r94_batch(int const * const * sequences, size_t const * n, size_t nbatch,
+                                     bool transform_units){
+    register_network_weights();
+    const squiggle_weights w = get_squiggle_r94_weights();
+    return squiggle_batch(&w, sequences, n, nbatch, transform_units);
+}
+
+
+scrappie_matrix * squiggle_r10_batch(int const * const * sequences, size_t const * n, size_t nbatch,
+                                     bool transform_units){
+    register_network_weights();
+    const squiggle_weights w = get_squiggle_r10_weights();
+    return squiggle_batch(&w, sequences, n, nbatch, transform_units);
+}
+
+
+/**  Features and first convolution for a batch of reads
+ *
+ *   Convolution is applied to each read separately, since its window spans
+ *   time, and the results interleaved into a single batch matrix.
+ *
+ *   @param signals Array [nbatch] of raw signals
+ *   @param nbatch Number of reads
+ *   @param W, b, stride Parameters of convolution
+ *   @param activation Element-wise activation, fused with convolution
+ *   @param nblock Array [nbatch] to write number of blocks of each read to [out]
+ *
+ *   @returns Interleaved batch matrix or NULL on failure
+ **/
+static scrappie_matrix convolution_batch(const raw_table * signals, size_t nbatch,
+                                         const_scrappie_matrix W, const_scrappie_matrix b,
+                                         size_t stride, scrappie_activation_ptr activation,
+                                         size_t * nblock) {
+    scrappie_matrix * conv = calloc(nbatch, sizeof(scrappie_matrix));
+    RETURN_NULL_IF(NULL == conv, NULL);
+
+    for (size_t i = 0; i < nbatch; i++) {
+        nblock[i] = 0;
+        if (0 == signals[i].n || (NULL == signals[i].raw && NULL == signals[i].sample)) {
+            continue;
+        }
+        scrappie_matrix raw_mat = nanonet_features_from_raw(signals[i]);
+        conv[i] = convolution_activation(raw_mat, W, b, stride, activation, NULL);
+        raw_mat = free_scrappie_matrix(raw_mat);
+        if (NULL != conv[i]) {
+            nblock[i] = conv[i]->nc;
+        }
+    }
+
+    scrappie_matrix batch = interleave_scrappie_matrices((const_scrappie_matrix *)conv, nbatch, NULL);
+    for (size_t i = 0; i < nbatch; i++) {
+        conv[i] = free_scrappie_matrix(conv[i]);
+    }
+    free(conv);
+
+    return batch;
+}
+
+
+/**  Softmax output layer for an interleaved batch, split into reads
+ *
+ *   @returns Array [nbatch] of posterior matrices, one per read
+ **/
+static scrappie_matrix * softmax_batch(scrappie_matrix X, const_scrappie_matrix W,
+                                       const_scrappie_matrix b, float tempW, float tempb,
+                                       float min_prob, bool return_log, size_t nbatch,
+                                       size_t const * nblock) {
+    scrappie_matrix post = softmax_with_temperature(X, W, b, tempW, tempb, NULL);
+    RETURN_NULL_IF(NULL == post, NULL);
+
+    if (return_log) {
+        robustlog_activation_inplace(post, min_prob);
+    }
+
+    scrappie_matrix * res = deinterleave_scrappie_matrix(post, nbatch, nblock);
+    post = free_scrappie_matrix(post);
+
+    return res;
+}
+
+
+posterior_batch_function_ptr get_posterior_batch_function(const enum raw_model_type model){
+    switch(model){
+    case SCRAPPIE_MODEL_RAW:
+        return nanonet_raw_posterior_batch;
+    case SCRAPPIE_MODEL_RGRGR_R9_4:
+        return nanonet_rgrgr_r94_posterior_batch;
+    case SCRAPPIE_MODEL_RGRGR_R9_4_1:
+        return nanonet_rgrgr_r941_posterior_batch;
+    case SCRAPPIE_MODEL_RGRGR_R10:
+        return nanonet_rgrgr_r10_posterior_batch;
+    case SCRAPPIE_MODEL_RNNRF_R9_4:
+        return nanonet_rnnrf_r94_transitions_batch;
+    case SCRAPPIE_MODEL_INVALID:
+        errx(EXIT_FAILURE, "Invalid scrappie model %s:%d", __FILE__, __LINE__);
+    default:
+        errx(EXIT_FAILURE, "Scrappie enum failure -- report bug\n");
+    }
+
+    return NULL;
+}
+
+
+scrappie_matrix * nanonet_raw_posterior_batch(const raw_table * signals, size_t nbatch, float min_prob,
+                                              float tempW, float tempb, bool return_log) {
+    assert(min_prob >= 0.0f && min_prob <= 1.0f);
+    assert(tempW > 0.0f && tempb > 0.0f);
+    RETURN_NULL_IF(NULL == signals, NULL);
+    RETURN_NULL_IF(0 == nbatch, NULL);
+
+    register_network_weights();
+    size_t * nblock = calloc(nbatch, sizeof(size_t));
+    RETURN_NULL_IF(NULL == nblock, NULL);
+
+    scrappie_matrix conv = convolution_batch(signals, nbatch, conv_raw_W, conv_raw_b, conv_raw_stride,
+                                             tanhf_array_inplace, nblock);
+    if (NULL == conv) {
+        free(nblock);
+        return NULL;
+    }
 
     //  First GRU layer
     scrappie_matrix gruF1in = feedforward_linear(conv, gruF1_raw_iW, gruF1_raw_b, NULL);
     scrappie_matrix gruB1in = feedforward_linear(conv, gruB1_raw_iW, gruB1_raw_b, NULL);
     conv = free_scrappie_matrix(conv);
 
-    scrappie_matrix gruF = gru_forward(gruF1in, gruF1_raw_sW, gruF1_raw_sW2, NULL);
+    scrappie_matrix gruF = gru_forward_batch(gruF1in, gruF1_raw_sW, gruF1_raw_sW2, nbatch, nblock, NULL);
     gruF1in = free_scrappie_matrix(gruF1in);
-    scrappie_matrix gruB = gru_backward(gruB1in, gruB1_raw_sW, gruB1_raw_sW2, NULL);
+    scrappie_matrix gruB = gru_backward_batch(gruB1in, gruB1_raw_sW, gruB1_raw_sW2, nbatch, nblock, NULL);
     gruB1in = free_scrappie_matrix(gruB1in);
 
     //  Combine with feed forward layer
@@ -215,336 +1036,705 @@ scrappie_matrix nanonet_raw_posterior(const raw_table signal, float min_prob,
     scrappie_matrix gruF2in = feedforward_linear(gruFF, gruF2_raw_iW, gruF2_raw_b, NULL);
     scrappie_matrix gruB2in = feedforward_linear(gruFF, gruB2_raw_iW, gruB2_raw_b, NULL);
     gruFF = free_scrappie_matrix(gruFF);
-    gruF = gru_forward(gruF2in, gruF2_raw_sW, gruF2_raw_sW2, gruF);
+    gruF = gru_forward_batch(gruF2in, gruF2_raw_sW, gruF2_raw_sW2, nbatch, nblock, gruF);
     gruF2in = free_scrappie_matrix(gruF2in);
-    gruB = gru_backward(gruB2in, gruB2_raw_sW, gruB2_raw_sW2, gruB);
+    gruB = gru_backward_batch(gruB2in, gruB2_raw_sW, gruB2_raw_sW2, nbatch, nblock, gruB);
     gruB2in = free_scrappie_matrix(gruB2in);
 
-
     //  Combine with feed forward layer
     gruFF =
         feedforward2_tanh(gruF, gruB, FF2_raw_Wf, FF2_raw_Wb, FF2_raw_b, gruFF);
     gruF = free_scrappie_matrix(gruF);
     gruB = free_scrappie_matrix(gruB);
 
-    scrappie_matrix post = softmax_with_temperature(gruFF, FF3_raw_W, FF3_raw_b, tempW, tempb, NULL);
+    scrappie_matrix * post = softmax_batch(gruFF, FF3_raw_W, FF3_raw_b, tempW, tempb, min_prob,
+                                           return_log, nbatch, nblock);
     gruFF = free_scrappie_matrix(gruFF);
-    RETURN_NULL_IF(NULL == post, NULL);
-
-    if (return_log) {
-        robustlog_activation_inplace(post, min_prob);
-    }
+    free(nblock);
 
     return post;
 }
 
 
-scrappie_matrix nanonet_rgrgr_r94_posterior(const raw_table signal, float min_prob,
-                                            float tempW, float tempb, bool return_log) {
+scrappie_matrix * nanonet_rgrgr_r94_posterior_batch(const raw_table * signals, size_t nbatch, float min_prob,
+                                                    float tempW, float tempb, bool return_log) {
     assert(min_prob >= 0.0f && min_prob <= 1.0f);
     assert(tempW > 0.0f && tempb > 0.0f);
-    RETURN_NULL_IF(0 == signal.n, NULL);
-    RETURN_NULL_IF(NULL == signal.raw, NULL);
-
-    scrappie_matrix raw_mat = nanonet_features_from_raw(signal);
-    scrappie_matrix conv =
-        convolution(raw_mat, conv_rgrgr_r94_W, conv_rgrgr_r94_b, conv_rgrgr_r94_stride, NULL);
-    elu_activation_inplace(conv);
-    raw_mat = free_scrappie_matrix(raw_mat);
+    RETURN_NULL_IF(NULL == signals, NULL);
+    RETURN_NULL_IF(0 == nbatch, NULL);
+
+    register_network_weights();
+    size_t * nblock = calloc(nbatch, sizeof(size_t));
+    RETURN_NULL_IF(NULL == nblock, NULL);
+
+    scrappie_matrix conv = convolution_batch(signals, nbatch, conv_rgrgr_r94_W, conv_rgrgr_r94_b,
+                                             conv_rgrgr_r94_stride, eluf_array_inplace, nblock);
+    if (NULL == conv) {
+        free(nblock);
+        return NULL;
+    }
     //  First GRU layer
     scrappie_matrix gruB1in = feedforward_linear(conv, gruB1_rgrgr_r94_iW, gruB1_rgrgr_r94_b, NULL);
     conv = free_scrappie_matrix(conv);
-    scrappie_matrix gruB1 = gru_backward(gruB1in, gruB1_rgrgr_r94_sW, gruB1_rgrgr_r94_sW2, NULL);
+    scrappie_matrix gruB1 = gru_backward_batch(gruB1in, gruB1_rgrgr_r94_sW, gruB1_rgrgr_r94_sW2, nbatch, nblock, NULL);
     gruB1in = free_scrappie_matrix(gruB1in);
     //  Second GRU layer
     scrappie_matrix gruF2in = feedforward_linear(gruB1, gruF2_rgrgr_r94_iW, gruF2_rgrgr_r94_b, NULL);
     gruB1 = free_scrappie_matrix(gruB1);
-    scrappie_matrix gruF2 = gru_forward(gruF2in, gruF2_rgrgr_r94_sW, gruF2_rgrgr_r94_sW2, NULL);
+    scrappie_matrix gruF2 = gru_forward_batch(gruF2in, gruF2_rgrgr_r94_sW, gruF2_rgrgr_r94_sW2, nbatch, nblock, NULL);
     gruF2in = free_scrappie_matrix(gruF2in);
     //  Third GRU layer
     scrappie_matrix gruB3in = feedforward_linear(gruF2, gruB3_rgrgr_r94_iW, gruB3_rgrgr_r94_b, NULL);
     gruF2 = free_scrappie_matrix(gruF2);
-    scrappie_matrix gruB3 = gru_backward(gruB3in, gruB3_rgrgr_r94_sW, gruB3_rgrgr_r94_sW2, NULL);
+    scrappie_matrix gruB3 = gru_backward_batch(gruB3in, gruB3_rgrgr_r94_sW, gruB3_rgrgr_r94_sW2, nbatch, nblock, NULL);
     gruB3in = free_scrappie_matrix(gruB3in);
     //  Fourth GRU layer
     scrappie_matrix gruF4in = feedforward_linear(gruB3, gruF4_rgrgr_r94_iW, gruF4_rgrgr_r94_b, NULL);
     gruB3 = free_scrappie_matrix(gruB3);
-    scrappie_matrix gruF4 = gru_forward(gruF4in, gruF4_rgrgr_r94_sW, gruF4_rgrgr_r94_sW2, NULL);
+    scrappie_matrix gruF4 = gru_forward_batch(gruF4in, gruF4_rgrgr_r94_sW, gruF4_rgrgr_r94_sW2, nbatch, nblock, NULL);
     gruF4in = free_scrappie_matrix(gruF4in);
     //  Fifth GRU layer
     scrappie_matrix gruB5in = feedforward_linear(gruF4, gruB5_rgrgr_r94_iW, gruB5_rgrgr_r94_b, NULL);
     gruF4 = free_scrappie_matrix(gruF4);
-    scrappie_matrix gruB5 = gru_backward(gruB5in, gruB5_rgrgr_r94_sW, gruB5_rgrgr_r94_sW2, NULL);
+    scrappie_matrix gruB5 = gru_backward_batch(gruB5in, gruB5_rgrgr_r94_sW, gruB5_rgrgr_r94_sW2, nbatch, nblock, NULL);
     gruB5in = free_scrappie_matrix(gruB5in);
 
-    scrappie_matrix post = softmax_with_temperature(gruB5, FF_rgrgr_r94_W, FF_rgrgr_r94_b, tempW, tempb, NULL);
+    scrappie_matrix * post = softmax_batch(gruB5, FF_rgrgr_r94_W, FF_rgrgr_r94_b, tempW, tempb, min_prob,
+                                           return_log, nbatch, nblock);
     gruB5 = free_scrappie_matrix(gruB5);
-
-    if (return_log) {
-        robustlog_activation_inplace(post, min_prob);
-    }
+    free(nblock);
 
     return post;
 }
 
 
-scrappie_matrix nanonet_rgrgr_r941_posterior(const raw_table signal, float min_prob,
-                                            float tempW, float tempb, bool return_log) {
+scrappie_matrix * nanonet_rgrgr_r941_posterior_batch(const raw_table * signals, size_t nbatch, float min_prob,
+                                                     float tempW, float tempb, bool return_log) {
     assert(min_prob >= 0.0f && min_prob <= 1.0f);
     assert(tempW > 0.0f && tempb > 0.0f);
-    RETURN_NULL_IF(0 == signal.n, NULL);
-    RETURN_NULL_IF(NULL == signal.raw, NULL);
-
-    scrappie_matrix raw_mat = nanonet_features_from_raw(signal);
-    scrappie_matrix conv =
-        convolution(raw_mat, conv_rgrgr_r941_W, conv_rgrgr_r941_b, conv_rgrgr_r941_stride, NULL);
-    elu_activation_inplace(conv);
-    raw_mat = free_scrappie_matrix(raw_mat);
+    RETURN_NULL_IF(NULL == signals, NULL);
+    RETURN_NULL_IF(0 == nbatch, NULL);
+
+    register_network_weights();
+    size_t * nblock = calloc(nbatch, sizeof(size_t));
+    RETURN_NULL_IF(NULL == nblock, NULL);
+
+    scrappie_matrix conv = convolution_batch(signals, nbatch, conv_rgrgr_r941_W, conv_rgrgr_r941_b,
+                                             conv_rgrgr_r941_stride, eluf_array_inplace, nblock);
+    if (NULL == conv) {
+        free(nblock);
+        return NULL;
+    }
     //  First GRU layer
     scrappie_matrix gruB1in = feedforward_linear(conv, gruB1_rgrgr_r941_iW, gruB1_rgrgr_r941_b, NULL);
     conv = free_scrappie_matrix(conv);
-    scrappie_matrix gruB1 = gru_backward(gruB1in, gruB1_rgrgr_r941_sW, gruB1_rgrgr_r941_sW2, NULL);
+    scrappie_matrix gruB1 = gru_backward_batch(gruB1in, gruB1_rgrgr_r941_sW, gruB1_rgrgr_r941_sW2, nbatch, nblock, NULL);
     gruB1in = free_scrappie_matrix(gruB1in);
     //  Second GRU layer
     scrappie_matrix gruF2in = feedforward_linear(gruB1, gruF2_rgrgr_r941_iW, gruF2_rgrgr_r941_b, NULL);
     gruB1 = free_scrappie_matrix(gruB1);
-    scrappie_matrix gruF2 = gru_forward(gruF2in, gruF2_rgrgr_r941_sW, gruF2_rgrgr_r941_sW2, NULL);
+    scrappie_matrix gruF2 = gru_forward_batch(gruF2in, gruF2_rgrgr_r941_sW, gruF2_rgrgr_r941_sW2, nbatch, nblock, NULL);
     gruF2in = free_scrappie_matrix(gruF2in);
     //  Third GRU layer
     scrappie_matrix gruB3in = feedforward_linear(gruF2, gruB3_rgrgr_r941_iW, gruB3_rgrgr_r941_b, NULL);
     gruF2 = free_scrappie_matrix(gruF2);
-    scrappie_matrix gruB3 = gru_backward(gruB3in, gruB3_rgrgr_r941_sW, gruB3_rgrgr_r941_sW2, NULL);
+    scrappie_matrix gruB3 = gru_backward_batch(gruB3in, gruB3_rgrgr_r941_sW, gruB3_rgrgr_r941_sW2, nbatch, nblock, NULL);
     gruB3in = free_scrappie_matrix(gruB3in);
     //  Fourth GRU layer
     scrappie_matrix gruF4in = feedforward_linear(gruB3, gruF4_rgrgr_r941_iW, gruF4_rgrgr_r941_b, NULL);
     gruB3 = free_scrappie_matrix(gruB3);
-    scrappie_matrix gruF4 = gru_forward(gruF4in, gruF4_rgrgr_r941_sW, gruF4_rgrgr_r941_sW2, NULL);
+    scrappie_matrix gruF4 = gru_forward_batch(gruF4in, gruF4_rgrgr_r941_sW, gruF4_rgrgr_r941_sW2, nbatch, nblock, NULL);
     gruF4in = free_scrappie_matrix(gruF4in);
     //  Fifth GRU layer
     scrappie_matrix gruB5in = feedforward_linear(gruF4, gruB5_rgrgr_r941_iW, gruB5_rgrgr_r941_b, NULL);
     gruF4 = free_scrappie_matrix(gruF4);
-    scrappie_matrix gruB5 = gru_backward(gruB5in, gruB5_rgrgr_r941_sW, gruB5_rgrgr_r941_sW2, NULL);
+    scrappie_matrix gruB5 = gru_backward_batch(gruB5in, gruB5_rgrgr_r941_sW, gruB5_rgrgr_r941_sW2, nbatch, nblock, NULL);
     gruB5in = free_scrappie_matrix(gruB5in);
 
-    scrappie_matrix post = softmax_with_temperature(gruB5, FF_rgrgr_r941_W, FF_rgrgr_r941_b, tempW, tempb, NULL);
+    scrappie_matrix * post = softmax_batch(gruB5, FF_rgrgr_r941_W, FF_rgrgr_r941_b, tempW, tempb, min_prob,
+                                           return_log, nbatch, nblock);
     gruB5 = free_scrappie_matrix(gruB5);
-
-    if (return_log) {
-        robustlog_activation_inplace(post, min_prob);
-    }
+    free(nblock);
 
     return post;
 }
 
 
-scrappie_matrix nanonet_rgrgr_r10_posterior(const raw_table signal, float min_prob,
-		                                    float tempW, float tempb, bool return_log) {
+scrappie_matrix * nanonet_rgrgr_r10_posterior_batch(const raw_table * signals, size_t nbatch, float min_prob,
+                                                    float tempW, float tempb, bool return_log) {
     assert(min_prob >= 0.0f && min_prob <= 1.0f);
     assert(tempW > 0.0f && tempb > 0.0f);
-    RETURN_NULL_IF(0 == signal.n, NULL);
-    RETURN_NULL_IF(NULL == signal.raw, NULL);
-
-    scrappie_matrix raw_mat = nanonet_features_from_raw(signal);
-    scrappie_matrix conv =
-        convolution(raw_mat, conv_rgrgr_r10_W, conv_rgrgr_r10_b, conv_rgrgr_r10_stride, NULL);
-    tanh_activation_inplace(conv);
-    raw_mat = free_scrappie_matrix(raw_mat);
+    RETURN_NULL_IF(NULL == signals, NULL);
+    RETURN_NULL_IF(0 == nbatch, NULL);
+
+    register_network_weights();
+    size_t * nblock = calloc(nbatch, sizeof(size_t));
+    RETURN_NULL_IF(NULL == nblock, NULL);
+
+    scrappie_matrix conv = convolution_batch(signals, nbatch, conv_rgrgr_r10_W, conv_rgrgr_r10_b,
+                                             conv_rgrgr_r10_stride, tanhf_array_inplace, nblock);
+    if (NULL == conv) {
+        free(nblock);
+        return NULL;
+    }
     //  First GRU layer
     scrappie_matrix gruB1in = feedforward_linear(conv, gruB1_rgrgr_r10_iW, gruB1_rgrgr_r10_b, NULL);
     conv = free_scrappie_matrix(conv);
-    scrappie_matrix gruB1 = gru_backward(gruB1in, gruB1_rgrgr_r10_sW, gruB1_rgrgr_r10_sW2, NULL);
+    scrappie_matrix gruB1 = gru_backward_batch(gruB1in, gruB1_rgrgr_r10_sW, gruB1_rgrgr_r10_sW2, nbatch, nblock, NULL);
     gruB1in = free_scrappie_matrix(gruB1in);
     //  Second GRU layer
     scrappie_matrix gruF2in = feedforward_linear(gruB1, gruF2_rgrgr_r10_iW, gruF2_rgrgr_r10_b, NULL);
     gruB1 = free_scrappie_matrix(gruB1);
-    scrappie_matrix gruF2 = gru_forward(gruF2in, gruF2_rgrgr_r10_sW, gruF2_rgrgr_r10_sW2, NULL);
+    scrappie_matrix gruF2 = gru_forward_batch(gruF2in, gruF2_rgrgr_r10_sW, gruF2_rgrgr_r10_sW2, nbatch, nblock, NULL);
     gruF2in = free_scrappie_matrix(gruF2in);
     //  Third GRU layer
     scrappie_matrix gruB3in = feedforward_linear(gruF2, gruB3_rgrgr_r10_iW, gruB3_rgrgr_r10_b, NULL);
     gruF2 = free_scrappie_matrix(gruF2);
-    scrappie_matrix gruB3 = gru_backward(gruB3in, gruB3_rgrgr_r10_sW, gruB3_rgrgr_r10_sW2, NULL);
+    scrappie_matrix gruB3 = gru_backward_batch(gruB3in, gruB3_rgrgr_r10_sW, gruB3_rgrgr_r10_sW2, nbatch, nblock, NULL);
     gruB3in = free_scrappie_matrix(gruB3in);
     //  Fourth GRU layer
     scrappie_matrix gruF4in = feedforward_linear(gruB3, gruF4_rgrgr_r10_iW, gruF4_rgrgr_r10_b, NULL);
     gruB3 = free_scrappie_matrix(gruB3);
-    scrappie_matrix gruF4 = gru_forward(gruF4in, gruF4_rgrgr_r10_sW, gruF4_rgrgr_r10_sW2, NULL);
+    scrappie_matrix gruF4 = gru_forward_batch(gruF4in, gruF4_rgrgr_r10_sW, gruF4_rgrgr_r10_sW2, nbatch, nblock, NULL);
     gruF4in = free_scrappie_matrix(gruF4in);
     //  Fifth GRU layer
     scrappie_matrix gruB5in = feedforward_linear(gruF4, gruB5_rgrgr_r10_iW, gruB5_rgrgr_r10_b, NULL);
     gruF4 = free_scrappie_matrix(gruF4);
-    scrappie_matrix gruB5 = gru_backward(gruB5in, gruB5_rgrgr_r10_sW, gruB5_rgrgr_r10_sW2, NULL);
+    scrappie_matrix gruB5 = gru_backward_batch(gruB5in, gruB5_rgrgr_r10_sW, gruB5_rgrgr_r10_sW2, nbatch, nblock, NULL);
     gruB5in = free_scrappie_matrix(gruB5in);
 
-    scrappie_matrix post = softmax_with_temperature(gruB5, FF_rgrgr_r10_W, FF_rgrgr_r10_b, tempW, tempb, NULL);
+    scrappie_matrix * post = softmax_batch(gruB5, FF_rgrgr_r10_W, FF_rgrgr_r10_b, tempW, tempb, min_prob,
+                                           return_log, nbatch, nblock);
     gruB5 = free_scrappie_matrix(gruB5);
-
-    if (return_log) {
-        robustlog_activation_inplace(post, min_prob);
-    }
+    free(nblock);
 
     return post;
 }
 
 
-scrappie_matrix squiggle_r94(int const * sequence, size_t n, bool transform_units){
-    RETURN_NULL_IF(NULL == sequence, NULL);
-
-    scrappie_matrix seq_embedding = embedding(sequence, n, embed_squiggle_r94_W, NULL);
-    scrappie_matrix conv1 = convolution(seq_embedding, conv1_squiggle_r94_W, conv1_squiggle_r94_b,
-                                        conv1_squiggle_r94_stride, NULL);
-    seq_embedding = free_scrappie_matrix(seq_embedding);
-    tanh_activation_inplace(conv1);
-
-    // Convolution 2, wrapped in residual layer
-    scrappie_matrix conv2 = convolution(conv1, conv2_squiggle_r94_W, conv2_squiggle_r94_b,
-                                        conv2_squiggle_r94_stride, NULL);
-    tanh_activation_inplace(conv2);
-    residual_inplace(conv1, conv2);
-    conv1 = free_scrappie_matrix(conv1);
-
-    // Convolution 3, wrapped in residual layer
-    scrappie_matrix conv3 = convolution(conv2, conv3_squiggle_r94_W, conv3_squiggle_r94_b,
-                                        conv3_squiggle_r94_stride, NULL);
-    tanh_activation_inplace(conv3);
-    residual_inplace(conv2, conv3);
-    conv2 = free_scrappie_matrix(conv2);
-
-    // Convolution 4, wrapped in residual layer
-    scrappie_matrix conv4 = convolution(conv3, conv4_squiggle_r94_W, conv4_squiggle_r94_b,
-                                        conv4_squiggle_r94_stride, NULL);
-    tanh_activation_inplace(conv4);
-    residual_inplace(conv3, conv4);
-    conv3 = free_scrappie_matrix(conv3);
-
-    // Convolution 4, wrapped in residual layer
-    scrappie_matrix conv5 = convolution(conv4, conv5_squiggle_r94_W, conv5_squiggle_r94_b,
-                                        conv5_squiggle_r94_stride, NULL);
-    tanh_activation_inplace(conv5);
-    residual_inplace(conv4, conv5);
-    conv4 = free_scrappie_matrix(conv4);
-
-    scrappie_matrix conv6 = convolution(conv5, conv6_squiggle_r94_W, conv6_squiggle_r94_b,
-                                        conv6_squiggle_r94_stride, NULL);
-    conv5 = free_scrappie_matrix(conv5);
-
-    RETURN_NULL_IF(NULL == conv6, NULL);
-
-    if(transform_units){
-        for(size_t c=0 ; c < conv6->nc ; c++){
-            size_t offset = c * conv6->stride;
-            //  Convert logsd to sd
-            conv6->data.f[offset + 1] = expf(conv6->data.f[offset + 1]);
-            //  Convert transformed dwell into expected samples
-            conv6->data.f[offset + 2] = expf(-conv6->data.f[offset + 2]);
-        }
-    }
-
-    return conv6;
-}
-
-
-scrappie_matrix squiggle_r10(int const * sequence, size_t n, bool transform_units){
-    RETURN_NULL_IF(NULL == sequence, NULL);
-
-    scrappie_matrix seq_embedding = embedding(sequence, n, embed_squiggle_r10_W, NULL);
-    scrappie_matrix conv1 = convolution(seq_embedding, conv1_squiggle_r10_W, conv1_squiggle_r10_b,
-                                        conv1_squiggle_r10_stride, NULL);
-    seq_embedding = free_scrappie_matrix(seq_embedding);
-    tanh_activation_inplace(conv1);
-
-    // Convolution 2, wrapped in residual layer
-    scrappie_matrix conv2 = convolution(conv1, conv2_squiggle_r10_W, conv2_squiggle_r10_b,
-                                        conv2_squiggle_r10_stride, NULL);
-    tanh_activation_inplace(conv2);
-    residual_inplace(conv1, conv2);
-    conv1 = free_scrappie_matrix(conv1);
-
-    // Convolution 3, wrapped in residual layer
-    scrappie_matrix conv3 = convolution(conv2, conv3_squiggle_r10_W, conv3_squiggle_r10_b,
-                                        conv3_squiggle_r10_stride, NULL);
-    tanh_activation_inplace(conv3);
-    residual_inplace(conv2, conv3);
-    conv2 = free_scrappie_matrix(conv2);
-
-    // Convolution 4, wrapped in residual layer
-    scrappie_matrix conv4 = convolution(conv3, conv4_squiggle_r10_W, conv4_squiggle_r10_b,
-                                        conv4_squiggle_r10_stride, NULL);
-    tanh_activation_inplace(conv4);
-    residual_inplace(conv3, conv4);
-    conv3 = free_scrappie_matrix(conv3);
-
-    // Convolution 4, wrapped in residual layer
-    scrappie_matrix conv5 = convolution(conv4, conv5_squiggle_r10_W, conv5_squiggle_r10_b,
-                                        conv5_squiggle_r10_stride, NULL);
-    tanh_activation_inplace(conv5);
-    residual_inplace(conv4, conv5);
-    conv4 = free_scrappie_matrix(conv4);
-
-    scrappie_matrix conv6 = convolution(conv5, conv6_squiggle_r10_W, conv6_squiggle_r10_b,
-                                        conv6_squiggle_r10_stride, NULL);
-    conv5 = free_scrappie_matrix(conv5);
-
-    RETURN_NULL_IF(NULL == conv6, NULL);
-
-    if(transform_units){
-        for(size_t c=0 ; c < conv6->nc ; c++){
-            size_t offset = c * conv6->stride;
-            //  Convert logsd to sd
-            conv6->data.f[offset + 1] = expf(conv6->data.f[offset + 1]);
-            //  Convert transformed dwell into expected samples
-            conv6->data.f[offset + 2] = expf(-conv6->data.f[offset + 2]);
-        }
-    }
-
-    return conv6;
-}
-
-scrappie_matrix nanonet_rnnrf_r94_transitions(const raw_table signal, float min_prob,
-                                              float tempW, float tempb,bool return_log) {
+scrappie_matrix * nanonet_rnnrf_r94_transitions_batch(const raw_table * signals, size_t nbatch, float min_prob,
+                                                      float tempW, float tempb, bool return_log) {
     assert(return_log);  // Returning non-log transformed not supported
     assert(min_prob >= 0.0f && min_prob <= 1.0f);
     assert(tempW > 0.0f && tempb > 0.0f);
-    RETURN_NULL_IF(0 == signal.n, NULL);
-    RETURN_NULL_IF(NULL == signal.raw, NULL);
-
-    scrappie_matrix raw_mat = nanonet_features_from_raw(signal);
-    scrappie_matrix conv =
-        convolution(raw_mat, conv_rnnrf_r94_W, conv_rnnrf_r94_b, conv_rnnrf_r94_stride, NULL);
-    elu_activation_inplace(conv);
-    raw_mat = free_scrappie_matrix(raw_mat);
+    RETURN_NULL_IF(NULL == signals, NULL);
+    RETURN_NULL_IF(0 == nbatch, NULL);
+
+    register_network_weights();
+    size_t * nblock = calloc(nbatch, sizeof(size_t));
+    RETURN_NULL_IF(NULL == nblock, NULL);
+
+    scrappie_matrix conv = convolution_batch(signals, nbatch, conv_rnnrf_r94_W, conv_rnnrf_r94_b,
+                                             conv_rnnrf_r94_stride, eluf_array_inplace, nblock);
+    if (NULL == conv) {
+        free(nblock);
+        return NULL;
+    }
     //  First GRU layer
     scrappie_matrix gruB1in = feedforward_linear(conv, gruB1_rnnrf_r94_iW, gruB1_rnnrf_r94_b, NULL);
-    scrappie_matrix gruB1 = gru_backward(gruB1in, gruB1_rnnrf_r94_sW, gruB1_rnnrf_r94_sW2, NULL);
+    scrappie_matrix gruB1 = gru_backward_batch(gruB1in, gruB1_rnnrf_r94_sW, gruB1_rnnrf_r94_sW2, nbatch, nblock, NULL);
     residual_inplace(conv, gruB1);
     conv = free_scrappie_matrix(conv);
     gruB1in = free_scrappie_matrix(gruB1in);
     //  Second GRU layer
     scrappie_matrix gruF2in = feedforward_linear(gruB1, gruF2_rnnrf_r94_iW, gruF2_rnnrf_r94_b, NULL);
-    scrappie_matrix gruF2 = gru_forward(gruF2in, gruF2_rnnrf_r94_sW, gruF2_rnnrf_r94_sW2, NULL);
+    scrappie_matrix gruF2 = gru_forward_batch(gruF2in, gruF2_rnnrf_r94_sW, gruF2_rnnrf_r94_sW2, nbatch, nblock, NULL);
     residual_inplace(gruB1, gruF2);
     gruB1 = free_scrappie_matrix(gruB1);
     gruF2in = free_scrappie_matrix(gruF2in);
     //  Third GRU layer
     scrappie_matrix gruB3in = feedforward_linear(gruF2, gruB3_rnnrf_r94_iW, gruB3_rnnrf_r94_b, NULL);
-    scrappie_matrix gruB3 = gru_backward(gruB3in, gruB3_rnnrf_r94_sW, gruB3_rnnrf_r94_sW2, NULL);
+    scrappie_matrix gruB3 = gru_backward_batch(gruB3in, gruB3_rnnrf_r94_sW, gruB3_rnnrf_r94_sW2, nbatch, nblock, NULL);
     residual_inplace(gruF2, gruB3);
     gruF2 = free_scrappie_matrix(gruF2);
     gruB3in = free_scrappie_matrix(gruB3in);
     //  Fourth GRU layer
     scrappie_matrix gruF4in = feedforward_linear(gruB3, gruF4_rnnrf_r94_iW, gruF4_rnnrf_r94_b, NULL);
-    scrappie_matrix gruF4 = gru_forward(gruF4in, gruF4_rnnrf_r94_sW, gruF4_rnnrf_r94_sW2, NULL);
+    scrappie_matrix gruF4 = gru_forward_batch(gruF4in, gruF4_rnnrf_r94_sW, gruF4_rnnrf_r94_sW2, nbatch, nblock, NULL);
     residual_inplace(gruB3, gruF4);
     gruB3 = free_scrappie_matrix(gruB3);
     gruF4in = free_scrappie_matrix(gruF4in);
     //  Fifth GRU layer
     scrappie_matrix gruB5in = feedforward_linear(gruF4, gruB5_rnnrf_r94_iW, gruB5_rnnrf_r94_b, NULL);
-    scrappie_matrix gruB5 = gru_backward(gruB5in, gruB5_rnnrf_r94_sW, gruB5_rnnrf_r94_sW2, NULL);
+    scrappie_matrix gruB5 = gru_backward_batch(gruB5in, gruB5_rnnrf_r94_sW, gruB5_rnnrf_r94_sW2, nbatch, nblock, NULL);
     residual_inplace(gruF4, gruB5);
     gruF4 = free_scrappie_matrix(gruF4);
     gruB5in = free_scrappie_matrix(gruB5in);
 
-    scrappie_matrix trans = globalnorm(gruB5, FF_rnnrf_r94_W, FF_rnnrf_r94_b, NULL);
+    //  Global normalisation is over the whole of each read so is applied per read
+    scrappie_matrix * trans = deinterleave_scrappie_matrix(gruB5, nbatch, nblock);
     gruB5 = free_scrappie_matrix(gruB5);
+    free(nblock);
+    RETURN_NULL_IF(NULL == trans, NULL);
+
+    for (size_t i = 0; i < nbatch; i++) {
+        if (NULL == trans[i]) {
+            continue;
+        }
+        scrappie_matrix gru = trans[i];
+        trans[i] = globalnorm(gru, FF_rnnrf_r94_W, FF_rnnrf_r94_b, NULL);
+        gru = free_scrappie_matrix(gru);
+    }
 
     return trans;
 }
+
+
+static scrappie_matrix chunk_posterior(posterior_function_ptr calcpost, const raw_table signal,
+                                       size_t offset, size_t chunk_size, float min_prob,
+                                       float tempW, float tempb, bool return_log) {
+    raw_table chunk = signal;
+    chunk.start = signal.start + offset;
+    chunk.end = (chunk.start + chunk_size < signal.end) ? (chunk.start + chunk_size) : signal.end;
+    return calcpost(chunk, min_prob, tempW, tempb, return_log);
+}
+
+/**  Posterior for a long signal, calculated in overlapping chunks
+ *
+ *   The signal is split into chunks of chunk_size samples, each overlapping
+ *   the next by overlap samples, and the chunks run through the network in
+ *   parallel.  Half of the overlap is discarded from each side of the
+ *   junction between neighbouring chunks when stitching the posteriors
+ *   together, so each block is taken from the chunk where it is furthest
+ *   from an edge.  The result has the same number of blocks as calculating
+ *   the posterior of the whole signal at once.
+ *
+ *   For CRF models, global normalisation is per chunk and so differs by a
+ *   constant per block from the unchunked transitions.  The best path is
+ *   not affected.
+ *
+ *   @param model Raw model to use
+ *   @param signal Raw signal
+ *   @param chunk_size Length of chunk in samples.  Rounded up to a multiple
+ *   of the model stride.
+ *   @param overlap Overlap between chunks in samples.  Rounded up to an even
+ *   multiple of the model stride.
+ *   @param min_prob, tempW, tempb, return_log  As for posterior_function_ptr
+ *
+ *   @returns Posterior matrix or NULL on failure
+ **/
+scrappie_matrix chunked_posterior(const enum raw_model_type model, const raw_table signal,
+                                  size_t chunk_size, size_t overlap, float min_prob,
+                                  float tempW, float tempb, bool return_log) {
+    RETURN_NULL_IF(0 == signal.n, NULL);
+    RETURN_NULL_IF(NULL == signal.raw && NULL == signal.sample, NULL);
+    posterior_function_ptr calcpost = get_posterior_function(model);
+    const size_t stride = get_raw_model_stride(model);
+
+    overlap = 2 * stride * iceil(overlap, 2 * stride);
+    chunk_size = stride * iceil(chunk_size, stride);
+    const size_t nsample = signal.end - signal.start;
+    if (0 == chunk_size || nsample <= chunk_size) {
+        return calcpost(signal, min_prob, tempW, tempb, return_log);
+    }
+    if (chunk_size <= overlap) {
+        warnx("Chunk size (%zu) must be greater than overlap (%zu)", chunk_size, overlap);
+        return NULL;
+    }
+
+    const size_t step = chunk_size - overlap;
+    const size_t nchunk = 1 + iceil(nsample - chunk_size, step);
+    const size_t nblock = iceil(nsample, stride);
+    const size_t halfoverlap = overlap / (2 * stride);
+
+    scrappie_matrix * chunkpost = calloc(nchunk, sizeof(scrappie_matrix));
+    RETURN_NULL_IF(NULL == chunkpost, NULL);
+
+#if defined(_OPENMP)
+    if (omp_in_parallel()) {
+        //  Called from a worker of the read pipeline, share chunks with idle threads of the team
+#pragma omp taskloop
+        for (size_t c = 0; c < nchunk; c++) {
+            chunkpost[c] = chunk_posterior(calcpost, signal, c * step, chunk_size, min_prob, tempW, tempb, return_log);
+        }
+    } else
+#endif
+    {
+#pragma omp parallel for schedule(dynamic)
+        for (size_t c = 0; c < nchunk; c++) {
+            chunkpost[c] = chunk_posterior(calcpost, signal, c * step, chunk_size, min_prob, tempW, tempb, return_log);
+        }
+    }
+
+    scrappie_matrix post = NULL;
+    bool ok = true;
+    for (size_t c = 0; c < nchunk; c++) {
+        ok &= (NULL != chunkpost[c]);
+    }
+    if (ok) {
+        post = make_scrappie_matrix(chunkpost[0]->nr, nblock);
+    }
+    if (NULL != post) {
+        for (size_t c = 0; c < nchunk; c++) {
+            //  Blocks [lo, hi) of the final posterior are taken from this chunk
+            const size_t offset = (c * step) / stride;
+            const size_t lo = (0 == c) ? 0 : (offset + halfoverlap);
+            const size_t hi = (nchunk - 1 == c) ? nblock : (offset + step / stride + halfoverlap);
+            assert(hi - offset <= chunkpost[c]->nc);
+            assert(post->stride == chunkpost[c]->stride);
+            memcpy(post->data.f + lo * post->stride,
+                   chunkpost[c]->data.f + (lo - offset) * post->stride,
+                   (hi - lo) * post->stride * sizeof(float));
+        }
+    }
+
+    for (size_t c = 0; c < nchunk; c++) {
+        chunkpost[c] = free_scrappie_matrix(chunkpost[c]);
+    }
+    free(chunkpost);
+
+    return post;
+}
+
+
+#define RECURRENT_LAYER(P, suffix, bwd) \
+    { P ## _ ## suffix ## _iW, P ## _ ## suffix ## _b, P ## _ ## suffix ## _sW, P ## _ ## suffix ## _sW2, bwd }
+
+/**  Layers of a raw model whose recurrent layers are unidirectional
+ *
+ *   Exposes the weights of the rgrgr and rnnrf families so a network can be
+ *   evaluated piecewise, e.g. over a stream of signal.  The raw_r94 model,
+ *   whose recurrent layers are bidirectional, has no such description.
+ *
+ *   @param model  Raw model
+ *   @param net  Description of network [out]
+ *
+ *   @returns true if the model has a description
+ **/
+bool get_recurrent_network(const enum raw_model_type model, recurrent_network * net) {
+    assert(NULL != net);
+    register_network_weights();
+    switch (model) {
+    case SCRAPPIE_MODEL_RGRGR_R9_4:
+        *net = (recurrent_network){
+            conv_rgrgr_r94_W, conv_rgrgr_r94_b, conv_rgrgr_r94_stride, eluf_array_inplace, false, 5,
+            {RECURRENT_LAYER(gruB1, rgrgr_r94, true), RECURRENT_LAYER(gruF2, rgrgr_r94, false),
+             RECURRENT_LAYER(gruB3, rgrgr_r94, true), RECURRENT_LAYER(gruF4, rgrgr_r94, false),
+             RECURRENT_LAYER(gruB5, rgrgr_r94, true)},
+            FF_rgrgr_r94_W, FF_rgrgr_r94_b, false};
+        return true;
+    case SCRAPPIE_MODEL_RGRGR_R9_4_1:
+        *net = (recurrent_network){
+            conv_rgrgr_r941_W, conv_rgrgr_r941_b, conv_rgrgr_r941_stride, eluf_array_inplace, false, 5,
+            {RECURRENT_LAYER(gruB1, rgrgr_r941, true), RECURRENT_LAYER(gruF2, rgrgr_r941, false),
+             RECURRENT_LAYER(gruB3, rgrgr_r941, true), RECURRENT_LAYER(gruF4, rgrgr_r941, false),
+             RECURRENT_LAYER(gruB5, rgrgr_r941, true)},
+            FF_rgrgr_r941_W, FF_rgrgr_r941_b, false};
+        return true;
+    case SCRAPPIE_MODEL_RGRGR_R10:
+        *net = (recurrent_network){
+            conv_rgrgr_r10_W, conv_rgrgr_r10_b, conv_rgrgr_r10_stride, tanhf_array_inplace, false, 5,
+            {RECURRENT_LAYER(gruB1, rgrgr_r10, true), RECURRENT_LAYER(gruF2, rgrgr_r10, false),
+             RECURRENT_LAYER(gruB3, rgrgr_r10, true), RECURRENT_LAYER(gruF4, rgrgr_r10, false),
+             RECURRENT_LAYER(gruB5, rgrgr_r10, true)},
+            FF_rgrgr_r10_W, FF_rgrgr_r10_b, false};
+        return true;
+    case SCRAPPIE_MODEL_RNNRF_R9_4:
+        *net = (recurrent_network){
+            conv_rnnrf_r94_W, conv_rnnrf_r94_b, conv_rnnrf_r94_stride, eluf_array_inplace, true, 5,
+            {RECURRENT_LAYER(gruB1, rnnrf_r94, true), RECURRENT_LAYER(gruF2, rnnrf_r94, false),
+             RECURRENT_LAYER(gruB3, rnnrf_r94, true), RECURRENT_LAYER(gruF4, rnnrf_r94, false),
+             RECURRENT_LAYER(gruB5, rnnrf_r94, true)},
+            FF_rnnrf_r94_W, FF_rnnrf_r94_b, true};
+        return true;
+    case SCRAPPIE_MODEL_RAW:
+        return false;
+    case SCRAPPIE_MODEL_INVALID:
+        errx(EXIT_FAILURE, "Invalid scrappie model %s:%d", __FILE__, __LINE__);
+    default:
+        errx(EXIT_FAILURE, "Scrappie enum failure -- report bug\n");
+    }
+
+    return false;
+}
+
+
+/**  Runtime model weights
+ *
+ *   The weights of every model are compiled in but may be replaced, before
+ *   any basecalling starts, by those of a model file.  Each compiled-in
+ *   matrix is made to refer to the mapped tensor of the same name, so the
+ *   network functions are unchanged and nothing is copied.  A file replaces
+ *   all the weights of one model and each tensor must have the shape of the
+ *   compiled-in matrix it replaces.
+ **/
+typedef struct {
+    const char * name;
+    _Mat * mat;
+} named_weight;
+
+#define NAMED_WEIGHT(X) { #X, &_ ## X }
+
+static named_weight events_weights[] = {
+    NAMED_WEIGHT(lstmF1_iW), NAMED_WEIGHT(lstmF1_sW), NAMED_WEIGHT(lstmF1_b),
+    NAMED_WEIGHT(lstmF1_p), NAMED_WEIGHT(lstmB1_iW), NAMED_WEIGHT(lstmB1_sW),
+    NAMED_WEIGHT(lstmB1_b), NAMED_WEIGHT(lstmB1_p), NAMED_WEIGHT(FF1_Wf), NAMED_WEIGHT(FF1_Wb),
+    NAMED_WEIGHT(FF1_b), NAMED_WEIGHT(lstmF2_iW), NAMED_WEIGHT(lstmF2_sW), NAMED_WEIGHT(lstmF2_b),
+    NAMED_WEIGHT(lstmF2_p), NAMED_WEIGHT(lstmB2_iW), NAMED_WEIGHT(lstmB2_sW),
+    NAMED_WEIGHT(lstmB2_b), NAMED_WEIGHT(lstmB2_p), NAMED_WEIGHT(FF2_Wf), NAMED_WEIGHT(FF2_Wb),
+    NAMED_WEIGHT(FF2_b), NAMED_WEIGHT(FF3_W), NAMED_WEIGHT(FF3_b),
+};
+
+static named_weight raw_r94_weights[] = {
+    NAMED_WEIGHT(conv_raw_W), NAMED_WEIGHT(conv_raw_b), NAMED_WEIGHT(gruF1_raw_iW),
+    NAMED_WEIGHT(gruF1_raw_sW), NAMED_WEIGHT(gruF1_raw_sW2), NAMED_WEIGHT(gruF1_raw_b),
+    NAMED_WEIGHT(gruB1_raw_iW), NAMED_WEIGHT(gruB1_raw_sW), NAMED_WEIGHT(gruB1_raw_sW2),
+    NAMED_WEIGHT(gruB1_raw_b), NAMED_WEIGHT(FF1_raw_Wf), NAMED_WEIGHT(FF1_raw_Wb),
+    NAMED_WEIGHT(FF1_raw_b), NAMED_WEIGHT(gruF2_raw_iW), NAMED_WEIGHT(gruF2_raw_sW),
+    NAMED_WEIGHT(gruF2_raw_sW2), NAMED_WEIGHT(gruF2_raw_b), NAMED_WEIGHT(gruB2_raw_iW),
+    NAMED_WEIGHT(gruB2_raw_sW), NAMED_WEIGHT(gruB2_raw_sW2), NAMED_WEIGHT(gruB2_raw_b),
+    NAMED_WEIGHT(FF2_raw_Wf), NAMED_WEIGHT(FF2_raw_Wb), NAMED_WEIGHT(FF2_raw_b),
+    NAMED_WEIGHT(FF3_raw_W), NAMED_WEIGHT(FF3_raw_b),
+};
+
+static named_weight rgrgr_r94_weights[] = {
+    NAMED_WEIGHT(conv_rgrgr_r94_W), NAMED_WEIGHT(conv_rgrgr_r94_b),
+    NAMED_WEIGHT(gruB1_rgrgr_r94_iW), NAMED_WEIGHT(gruB1_rgrgr_r94_sW),
+    NAMED_WEIGHT(gruB1_rgrgr_r94_sW2), NAMED_WEIGHT(gruB1_rgrgr_r94_b),
+    NAMED_WEIGHT(gruF2_rgrgr_r94_iW), NAMED_WEIGHT(gruF2_rgrgr_r94_sW),
+    NAMED_WEIGHT(gruF2_rgrgr_r94_sW2), NAMED_WEIGHT(gruF2_rgrgr_r94_b),
+    NAMED_WEIGHT(gruB3_rgrgr_r94_iW), NAMED_WEIGHT(gruB3_rgrgr_r94_sW),
+    NAMED_WEIGHT(gruB3_rgrgr_r94_sW2), NAMED_WEIGHT(gruB3_rgrgr_r94_b),
+    NAMED_WEIGHT(gruF4_rgrgr_r94_iW), NAMED_WEIGHT(gruF4_rgrgr_r94_sW),
+    NAMED_WEIGHT(gruF4_rgrgr_r94_sW2), NAMED_WEIGHT(gruF4_rgrgr_r94_b),
+    NAMED_WEIGHT(gruB5_rgrgr_r94_iW), NAMED_WEIGHT(gruB5_rgrgr_r94_sW),
+    NAMED_WEIGHT(gruB5_rgrgr_r94_sW2), NAMED_WEIGHT(gruB5_rgrgr_r94_b),
+    NAMED_WEIGHT(FF_rgrgr_r94_W), NAMED_WEIGHT(FF_rgrgr_r94_b),
+};
+
+static named_weight rgrgr_r941_weights[] = {
+    NAMED_WEIGHT(conv_rgrgr_r941_W), NAMED_WEIGHT(conv_rgrgr_r941_b),
+    NAMED_WEIGHT(gruB1_rgrgr_r941_iW), NAMED_WEIGHT(gruB1_rgrgr_r941_sW),
+    NAMED_WEIGHT(gruB1_rgrgr_r941_sW2), NAMED_WEIGHT(gruB1_rgrgr_r941_b),
+    NAMED_WEIGHT(gruF2_rgrgr_r941_iW), NAMED_WEIGHT(gruF2_rgrgr_r941_sW),
+    NAMED_WEIGHT(gruF2_rgrgr_r941_sW2), NAMED_WEIGHT(gruF2_rgrgr_r941_b),
+    NAMED_WEIGHT(gruB3_rgrgr_r941_iW), NAMED_WEIGHT(gruB3_rgrgr_r941_sW),
+    NAMED_WEIGHT(gruB3_rgrgr_r941_sW2), NAMED_WEIGHT(gruB3_rgrgr_r941_b),
+    NAMED_WEIGHT(gruF4_rgrgr_r941_iW), NAMED_WEIGHT(gruF4_rgrgr_r941_sW),
+    NAMED_WEIGHT(gruF4_rgrgr_r941_sW2), NAMED_WEIGHT(gruF4_rgrgr_r941_b),
+    NAMED_WEIGHT(gruB5_rgrgr_r941_iW), NAMED_WEIGHT(gruB5_rgrgr_r941_sW),
+    NAMED_WEIGHT(gruB5_rgrgr_r941_sW2), NAMED_WEIGHT(gruB5_rgrgr_r941_b),
+    NAMED_WEIGHT(FF_rgrgr_r941_W), NAMED_WEIGHT(FF_rgrgr_r941_b),
+};
+
+static named_weight rgrgr_r10_weights[] = {
+    NAMED_WEIGHT(conv_rgrgr_r10_W), NAMED_WEIGHT(conv_rgrgr_r10_b),
+    NAMED_WEIGHT(gruB1_rgrgr_r10_iW), NAMED_WEIGHT(gruB1_rgrgr_r10_sW),
+    NAMED_WEIGHT(gruB1_rgrgr_r10_sW2), NAMED_WEIGHT(gruB1_rgrgr_r10_b),
+    NAMED_WEIGHT(gruF2_rgrgr_r10_iW), NAMED_WEIGHT(gruF2_rgrgr_r10_sW),
+    NAMED_WEIGHT(gruF2_rgrgr_r10_sW2), NAMED_WEIGHT(gruF2_rgrgr_r10_b),
+    NAMED_WEIGHT(gruB3_rgrgr_r10_iW), NAMED_WEIGHT(gruB3_rgrgr_r10_sW),
+    NAMED_WEIGHT(gruB3_rgrgr_r10_sW2), NAMED_WEIGHT(gruB3_rgrgr_r10_b),
+    NAMED_WEIGHT(gruF4_rgrgr_r10_iW), NAMED_WEIGHT(gruF4_rgrgr_r10_sW),
+    NAMED_WEIGHT(gruF4_rgrgr_r10_sW2), NAMED_WEIGHT(gruF4_rgrgr_r10_b),
+    NAMED_WEIGHT(gruB5_rgrgr_r10_iW), NAMED_WEIGHT(gruB5_rgrgr_r10_sW),
+    NAMED_WEIGHT(gruB5_rgrgr_r10_sW2), NAMED_WEIGHT(gruB5_rgrgr_r10_b),
+    NAMED_WEIGHT(FF_rgrgr_r10_W), NAMED_WEIGHT(FF_rgrgr_r10_b),
+};
+
+static named_weight rnnrf_r94_weights[] = {
+    NAMED_WEIGHT(conv_rnnrf_r94_W), NAMED_WEIGHT(conv_rnnrf_r94_b),
+    NAMED_WEIGHT(gruB1_rnnrf_r94_iW), NAMED_WEIGHT(gruB1_rnnrf_r94_sW),
+    NAMED_WEIGHT(gruB1_rnnrf_r94_sW2), NAMED_WEIGHT(gruB1_rnnrf_r94_b),
+    NAMED_WEIGHT(gruF2_rnnrf_r94_iW), NAMED_WEIGHT(gruF2_rnnrf_r94_sW),
+    NAMED_WEIGHT(gruF2_rnnrf_r94_sW2), NAMED_WEIGHT(gruF2_rnnrf_r94_b),
+    NAMED_WEIGHT(gruB3_rnnrf_r94_iW), NAMED_WEIGHT(gruB3_rnnrf_r94_sW),
+    NAMED_WEIGHT(gruB3_rnnrf_r94_sW2), NAMED_WEIGHT(gruB3_rnnrf_r94_b),
+    NAMED_WEIGHT(gruF4_rnnrf_r94_iW), NAMED_WEIGHT(gruF4_rnnrf_r94_sW),
+    NAMED_WEIGHT(gruF4_rnnrf_r94_sW2), NAMED_WEIGHT(gruF4_rnnrf_r94_b),
+    NAMED_WEIGHT(gruB5_rnnrf_r94_iW), NAMED_WEIGHT(gruB5_rnnrf_r94_sW),
+    NAMED_WEIGHT(gruB5_rnnrf_r94_sW2), NAMED_WEIGHT(gruB5_rnnrf_r94_b),
+    NAMED_WEIGHT(FF_rnnrf_r94_W), NAMED_WEIGHT(FF_rnnrf_r94_b),
+};
+
+static named_weight squiggle_r94_weights[] = {
+    NAMED_WEIGHT(embed_squiggle_r94_W), NAMED_WEIGHT(conv1_squiggle_r94_W),
+    NAMED_WEIGHT(conv1_squiggle_r94_b), NAMED_WEIGHT(conv2_squiggle_r94_W),
+    NAMED_WEIGHT(conv2_squiggle_r94_b), NAMED_WEIGHT(conv3_squiggle_r94_W),
+    NAMED_WEIGHT(conv3_squiggle_r94_b), NAMED_WEIGHT(conv4_squiggle_r94_W),
+    NAMED_WEIGHT(conv4_squiggle_r94_b), NAMED_WEIGHT(conv5_squiggle_r94_W),
+    NAMED_WEIGHT(conv5_squiggle_r94_b), NAMED_WEIGHT(conv6_squiggle_r94_W),
+    NAMED_WEIGHT(conv6_squiggle_r94_b),
+};
+
+static named_weight squiggle_r10_weights[] = {
+    NAMED_WEIGHT(embed_squiggle_r10_W), NAMED_WEIGHT(conv1_squiggle_r10_W),
+    NAMED_WEIGHT(conv1_squiggle_r10_b), NAMED_WEIGHT(conv2_squiggle_r10_W),
+    NAMED_WEIGHT(conv2_squiggle_r10_b), NAMED_WEIGHT(conv3_squiggle_r10_W),
+    NAMED_WEIGHT(conv3_squiggle_r10_b), NAMED_WEIGHT(conv4_squiggle_r10_W),
+    NAMED_WEIGHT(conv4_squiggle_r10_b), NAMED_WEIGHT(conv5_squiggle_r10_W),
+    NAMED_WEIGHT(conv5_squiggle_r10_b), NAMED_WEIGHT(conv6_squiggle_r10_W),
+    NAMED_WEIGHT(conv6_squiggle_r10_b),
+};
+
+static const struct {
+    const char * model;
+    named_weight * weights;
+    size_t nweight;
+} model_weight_tables[] = {
+    {"events", events_weights, sizeof(events_weights) / sizeof(named_weight)},
+    {"raw_r94", raw_r94_weights, sizeof(raw_r94_weights) / sizeof(named_weight)},
+    {"rgrgr_r94", rgrgr_r94_weights, sizeof(rgrgr_r94_weights) / sizeof(named_weight)},
+    {"rgrgr_r941", rgrgr_r941_weights, sizeof(rgrgr_r941_weights) / sizeof(named_weight)},
+    {"rgrgr_r10", rgrgr_r10_weights, sizeof(rgrgr_r10_weights) / sizeof(named_weight)},
+    {"rnnrf_r94", rnnrf_r94_weights, sizeof(rnnrf_r94_weights) / sizeof(named_weight)},
+    {"squiggle_r94", squiggle_r94_weights, sizeof(squiggle_r94_weights) / sizeof(named_weight)},
+    {"squiggle_r10", squiggle_r10_weights, sizeof(squiggle_r10_weights) / sizeof(named_weight)},
+};
+
+/**  Register weights of every model for packing by affine_map
+ *
+ *   Weights are only packed when first used, so registering those of
+ *   models that are never evaluated costs nothing.
+ **/
+static void register_network_weights(void) {
+    static bool registered = false;
+#pragma omp critical(register_network_weights)
+    {
+        if (!registered) {
+            const size_t ntable = sizeof(model_weight_tables) / sizeof(model_weight_tables[0]);
+            for (size_t i = 0; i < ntable; i++) {
+                for (size_t j = 0; j < model_weight_tables[i].nweight; j++) {
+                    (void)register_packed_weights(model_weight_tables[i].weights[j].mat);
+                }
+            }
+            registered = true;
+        }
+    }
+}
+
+
+static model_file * loaded_model_file = NULL;
+static named_weight * replaced_weights = NULL;
+static _Mat * original_weights = NULL;
+static size_t nreplaced_weights = 0;
+
+
+static int find_model_weight_table(const char * model) {
+    const int ntable = sizeof(model_weight_tables) / sizeof(model_weight_tables[0]);
+    for (int i = 0; i < ntable; i++) {
+        if (0 == strcmp(model_weight_tables[i].model, model)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+/**  Replace compiled-in weights by those of a model file
+ *
+ *   Not thread safe: must be called before any network is evaluated.  Any
+ *   weights previously loaded are restored first.
+ *
+ *   @param path  Path to model file
+ *   @param model  Name of model the file must contain, or NULL to accept any
+ *
+ *   @returns true on success.  On failure the compiled-in weights are used
+ **/
+bool load_model_weights(const char * path, const char * model) {
+    RETURN_NULL_IF(NULL == path, false);
+    unload_model_weights();
+    release_joint_input_weights();
+
+    model_file * mf = load_model_file(path);
+    RETURN_NULL_IF(NULL == mf, false);
+    if (NULL != model && 0 != strcmp(mf->model, model)) {
+        warnx("Model file \"%s\" contains model \"%s\" rather than \"%s\"", path, mf->model, model);
+        mf = free_model_file(mf);
+        return false;
+    }
+    const int table = find_model_weight_table(mf->model);
+    if (table < 0) {
+        warnx("Model file \"%s\" contains unknown model \"%s\"", path, mf->model);
+        mf = free_model_file(mf);
+        return false;
+    }
+
+    named_weight * weights = model_weight_tables[table].weights;
+    const size_t nweight = model_weight_tables[table].nweight;
+    bool ok = (mf->ntensor == nweight);
+    for (size_t i = 0; ok && i < nweight; i++) {
+        const_scrappie_matrix tensor = model_file_tensor(mf, weights[i].name);
+        if (NULL == tensor) {
+            warnx("Model file \"%s\" has no tensor \"%s\"", path, weights[i].name);
+            ok = false;
+        } else if (tensor->nr != weights[i].mat->nr || tensor->nc != weights[i].mat->nc) {
+            warnx("Tensor \"%s\" of model file \"%s\" is %zux%zu rather than %zux%zu", weights[i].name,
+                  path, tensor->nr, tensor->nc, weights[i].mat->nr, weights[i].mat->nc);
+            ok = false;
+        }
+    }
+    if (!ok) {
+        warnx("Model file \"%s\" does not match model \"%s\"", path, mf->model);
+        mf = free_model_file(mf);
+        return false;
+    }
+
+    original_weights = calloc(nweight, sizeof(_Mat));
+    if (NULL == original_weights) {
+        mf = free_model_file(mf);
+        return false;
+    }
+    for (size_t i = 0; i < nweight; i++) {
+        original_weights[i] = *weights[i].mat;
+        *weights[i].mat = *model_file_tensor(mf, weights[i].name);
+    }
+    loaded_model_file = mf;
+    replaced_weights = weights;
+    nreplaced_weights = nweight;
+
+    return true;
+}
+
+
+/**  Restore compiled-in weights replaced by load_model_weights
+ **/
+void unload_model_weights(void) {
+    if (NULL == loaded_model_file) {
+        return;
+    }
+    release_joint_input_weights();
+    for (size_t i = 0; i < nreplaced_weights; i++) {
+        *replaced_weights[i].mat = original_weights[i];
+    }
+    free(original_weights);
+    original_weights = NULL;
+    replaced_weights = NULL;
+    nreplaced_weights = 0;
+    loaded_model_file = free_model_file(loaded_model_file);
+}
+
+
+/**  Write the weights currently used by a model to a model file
+ *
+ *   @param path  Path of file to write
+ *   @param model  Name of model, as accepted by load_model_weights
+ *
+ *   @returns true on success
+ **/
+bool write_model_weights(const char * path, const char * model) {
+    RETURN_NULL_IF(NULL == path, false);
+    RETURN_NULL_IF(NULL == model, false);
+
+    const int table = find_model_weight_table(model);
+    if (table < 0) {
+        warnx("Unknown model \"%s\"", model);
+        return false;
+    }
+    named_weight * weights = model_weight_tables[table].weights;
+    const size_t nweight = model_weight_tables[table].nweight;
+    const char ** names = calloc(nweight, sizeof(char *));
+    const_scrappie_matrix * tensors = calloc(nweight, sizeof(const_scrappie_matrix));
+    bool ok = false;
+    if (NULL != names && NULL != tensors) {
+        for (size_t i = 0; i < nweight; i++) {
+            names[i] = weights[i].name;
+            tensors[i] = weights[i].mat;
+        }
+        ok = write_model_file(path, model, names, tensors, nweight);
+    }
+    free(tensors);
+    free(names);
+
+    return ok;
+}
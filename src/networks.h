@@ -2,8 +2,10 @@
 #ifndef NETWORKS_H
 #    define NETWORKS_H
 #    include <stdbool.h>
+#    include "packed_reference.h"
 #    include "scrappie_matrix.h"
 #    include "scrappie_structures.h"
+#    include "sparse_posterior.h"
 
 enum raw_model_type {
     SCRAPPIE_MODEL_RAW=0,
@@ -23,13 +25,33 @@ typedef scrappie_matrix (*posterior_function_ptr)(const raw_table, float, float,
 enum raw_model_type get_raw_model(const char * modelstr);
 const char * raw_model_string(const enum raw_model_type model);
 int get_raw_model_stride(const enum raw_model_type model);
+size_t get_raw_model_nstate(const enum raw_model_type model);
+size_t raw_model_memory_estimate(const enum raw_model_type model, size_t nsample, size_t chunk_size,
+                                 bool low_memory);
 posterior_function_ptr get_posterior_function(const enum raw_model_type model);
 
+//  Top-k sparse posterior of transducer models, NULL for CRF models
+typedef sparse_posterior (*sparse_posterior_function_ptr)(const raw_table, float, float, float, size_t);
+sparse_posterior_function_ptr get_sparse_posterior_function(const enum raw_model_type model);
+
+typedef scrappie_matrix * (*posterior_batch_function_ptr)(const raw_table *, size_t, float, float, float, bool);
+posterior_batch_function_ptr get_posterior_batch_function(const enum raw_model_type model);
+
 typedef scrappie_matrix (*squiggle_function_ptr)(int const * sequence, size_t, bool);
+typedef scrappie_matrix * (*squiggle_batch_function_ptr)(int const * const * sequences, size_t const *, size_t, bool);
 
 enum squiggle_model_type get_squiggle_model(const char * squigmodelstr);
 const char * squiggle_model_string(const enum squiggle_model_type squiggle_model);
 squiggle_function_ptr get_squiggle_function(const enum squiggle_model_type squiggle_model);
+squiggle_batch_function_ptr get_squiggle_batch_function(const enum squiggle_model_type squiggle_model);
+scrappie_matrix sequence_to_squiggle(char const * base_seq, size_t n, bool rescale,
+                                     enum squiggle_model_type squiggle_model);
+//  Bases of sequences packed into each batch predicted by sequence_to_squiggle_batch
+#define SQUIGGLE_BATCH_BASES 4096
+scrappie_matrix * sequence_to_squiggle_batch(char const * const * base_seq, size_t const * n, size_t nseq,
+                                             bool rescale, enum squiggle_model_type squiggle_model);
+scrappie_matrix * packed_reference_to_squiggle_batch(const packed_reference * ref, bool const * predict,
+                                                     bool rescale, enum squiggle_model_type squiggle_model);
 
 //  Events posterior.  Other models via factory function
 scrappie_matrix nanonet_posterior(const event_table events, float min_prob,
@@ -47,8 +69,66 @@ scrappie_matrix nanonet_rgrgr_r10_posterior(const raw_table signal, float min_pr
 scrappie_matrix nanonet_rnnrf_r94_transitions(const raw_table signal, float min_prob,
 		                              float tempW, float tempb, bool return_log);
 
+//  Raw sparse posterior, keeping the k most probable states of each block
+sparse_posterior nanonet_raw_sparse_posterior(const raw_table signal, float min_prob,
+                                              float tempW, float tempb, size_t k);
+sparse_posterior nanonet_rgrgr_r94_sparse_posterior(const raw_table signal, float min_prob,
+                                                    float tempW, float tempb, size_t k);
+sparse_posterior nanonet_rgrgr_r941_sparse_posterior(const raw_table signal, float min_prob,
+                                                     float tempW, float tempb, size_t k);
+sparse_posterior nanonet_rgrgr_r10_sparse_posterior(const raw_table signal, float min_prob,
+                                                    float tempW, float tempb, size_t k);
+
+//  Raw posteriors for a batch of reads.  Returns array of posteriors, one per read
+scrappie_matrix * nanonet_raw_posterior_batch(const raw_table * signals, size_t nbatch, float min_prob,
+                                              float tempW, float tempb, bool return_log);
+scrappie_matrix * nanonet_rgrgr_r94_posterior_batch(const raw_table * signals, size_t nbatch, float min_prob,
+                                                    float tempW, float tempb, bool return_log);
+scrappie_matrix * nanonet_rgrgr_r941_posterior_batch(const raw_table * signals, size_t nbatch, float min_prob,
+                                                     float tempW, float tempb, bool return_log);
+scrappie_matrix * nanonet_rgrgr_r10_posterior_batch(const raw_table * signals, size_t nbatch, float min_prob,
+                                                    float tempW, float tempb, bool return_log);
+scrappie_matrix * nanonet_rnnrf_r94_transitions_batch(const raw_table * signals, size_t nbatch, float min_prob,
+                                                      float tempW, float tempb, bool return_log);
+
+//  Raw posterior calculated in parallel over overlapping chunks of signal
+scrappie_matrix chunked_posterior(const enum raw_model_type model, const raw_table signal,
+                                  size_t chunk_size, size_t overlap, float min_prob,
+                                  float tempW, float tempb, bool return_log);
+
+//  Layers of raw models made of a convolution then a stack of unidirectional GRUs
+#    define RECURRENT_NETWORK_MAX_LAYER 5
+typedef struct {
+    const_scrappie_matrix iW, b, sW, sW2;
+    bool backward;
+} recurrent_layer;
+
+typedef struct {
+    const_scrappie_matrix conv_W, conv_b;
+    size_t stride;
+    scrappie_activation_ptr activation;
+    //  Whether each GRU layer adds its input to its output
+    bool residual;
+    size_t nlayer;
+    recurrent_layer layer[RECURRENT_NETWORK_MAX_LAYER];
+    //  Output layer, a softmax or, for CRF models, globally normalised
+    const_scrappie_matrix out_W, out_b;
+    bool crf;
+} recurrent_network;
+
+bool get_recurrent_network(const enum raw_model_type model, recurrent_network * net);
+
+//  Replace compiled-in weights by those of a model file, before any network is used
+bool load_model_weights(const char * path, const char * model);
+void unload_model_weights(void);
+bool write_model_weights(const char * path, const char * model);
+
 //  Squiggle functions
 scrappie_matrix squiggle_r94(int const * sequence, size_t n, bool transform_units);
 scrappie_matrix squiggle_r10(int const * sequence, size_t n, bool transform_units);
+scrappie_matrix * squiggle_r94_batch(int const * const * sequences, size_t const * n, size_t nbatch,
+                                     bool transform_units);
+scrappie_matrix * squiggle_r10_batch(int const * const * sequences, size_t const * n, size_t nbatch,
+                                     bool transform_units);
 
 #endif    /* NETWORKS_H */
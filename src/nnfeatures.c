@@ -99,35 +99,75 @@ scrappie_matrix nanonet_features_from_events(const event_table et,
 }
 
 
+/**  Features of raw signal, written straight into the padded input of the first layer
+ *
+ *  Only the range of the signal from start to end is used, and the signal is
+ *  not modified: the scaling of native or scaled signals, see raw_table, is
+ *  applied as each sample is written.  The matrix is allocated from the
+ *  workspace of the calling thread when it is enabled.
+ *
+ *  @param signal View of signal
+ *
+ *  @returns Matrix with one feature per sample, or NULL on failure
+ **/
 scrappie_matrix nanonet_features_from_raw(const raw_table signal) {
+    return nanonet_features_from_raw_into(signal, NULL);
+}
+
+/**  Features of raw signal, as nanonet_features_from_raw, written to C
+ *
+ *  @param signal View of signal
+ *  @param C Matrix to write features to, remade to one row per sample if
+ *  not already that shape, or NULL to allocate a new one.
+ *
+ *  @returns Matrix with one feature per sample, or NULL on failure
+ **/
+scrappie_matrix nanonet_features_from_raw_into(const raw_table signal, scrappie_matrix C) {
     RETURN_NULL_IF(0 == signal.n, NULL);
-    RETURN_NULL_IF(NULL == signal.raw, NULL);
+    RETURN_NULL_IF(NULL == signal.raw && NULL == signal.sample, NULL);
     const size_t nsample = signal.end - signal.start;
-    scrappie_matrix sigmat = make_scrappie_matrix(1, nsample);
+    scrappie_matrix sigmat = remake_scrappie_matrix(C, 1, nsample);
     RETURN_NULL_IF(NULL == sigmat, NULL);
 
+    // Written as a vector per sample, zeroing the padding required for the matrix
     const size_t offset = signal.start;
-    for (size_t i = 0 ; i < nsample ; i++) {
-        // Copy with stride 4 because of required padding for matrix
-        sigmat->data.f[i * 4] = signal.raw[i + offset];
+    if (NULL == signal.raw) {
+        //  Native signal is scaled, and so normalised, as it is copied
+        for (size_t i = 0 ; i < nsample ; i++) {
+            sigmat->data.v[i] = _mm_set_ss((signal.sample[i + offset] + signal.offset) * signal.unit);
+        }
+    } else if (signal.scaled) {
+        for (size_t i = 0 ; i < nsample ; i++) {
+            sigmat->data.v[i] = _mm_set_ss((signal.raw[i + offset] + signal.offset) * signal.unit);
+        }
+    } else {
+        for (size_t i = 0 ; i < nsample ; i++) {
+            sigmat->data.v[i] = _mm_set_ss(signal.raw[i + offset]);
+        }
     }
     return sigmat;
 }
 
 
 scrappie_matrix deltasample_features_from_raw(const raw_table signal, float shift, float scale, float sdthresh){
-    RETURN_NULL_IF(0 == signal.n, NULL);
-    RETURN_NULL_IF(NULL == signal.raw, NULL);
-    const size_t nsample = signal.end - signal.start;
+    scrappie_matrix sigmat = nanonet_features_from_raw(signal);
+    RETURN_NULL_IF(NULL == sigmat, NULL);
+    const size_t nsample = sigmat->nc;
 
-    const float sig_mad = madf(signal.raw + signal.start, nsample, NULL);
+    //  MAD of the signal, as scaled, gathered from the features
+    float * sig = malloc(nsample * sizeof(float));
+    if (NULL == sig) {
+        return free_scrappie_matrix(sigmat);
+    }
+    for (size_t i = 0 ; i < nsample ; i++) {
+        sig[i] = sigmat->data.f[i * 4];
+    }
+    const float sig_mad = madf(sig, nsample, NULL);
+    free(sig);
 
-    scrappie_matrix sigmat = mat_from_array(signal.raw + signal.start, 1, nsample);
-    RETURN_NULL_IF(NULL == sigmat, NULL);
-    
     difference_matrix_inplace(sigmat, 0.0f);
     shift_scale_matrix_inplace(sigmat, shift, scale);
     filter_matrix_inplace(sigmat, 0.0f, sdthresh * sig_mad);
 
     return sigmat;
-}
\ No newline at end of file
+}
@@ -0,0 +1,383 @@
+#include <assert.h>
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "packed_reference.h"
+#include "scrappie_stdlib.h"
+
+//  Longest path of temporary file written
+#define PACKED_REFERENCE_PATH_LEN 4096
+#define PACKED_REFERENCE_ALIGN 64
+
+static const char packed_base_char[4] = { 'A', 'C', 'G', 'T' };
+
+
+static size_t align_up(size_t n) {
+    return PACKED_REFERENCE_ALIGN * ((n + PACKED_REFERENCE_ALIGN - 1) / PACKED_REFERENCE_ALIGN);
+}
+
+static size_t nword_of_length(size_t n) {
+    return (n + PACKED_REFERENCE_BASES_PER_WORD - 1) / PACKED_REFERENCE_BASES_PER_WORD;
+}
+
+/**  Two bit code of base, either case
+ *
+ *   @returns code or -1 if base is not one of ACGT
+ **/
+static int base_code(char base) {
+    switch (base) {
+    case 'A':
+    case 'a':
+        return 0;
+    case 'C':
+    case 'c':
+        return 1;
+    case 'G':
+    case 'g':
+        return 2;
+    case 'T':
+    case 't':
+        return 3;
+    default:
+        return -1;
+    }
+}
+
+
+/**  Set pointers of reference into its data
+ *
+ *   Offsets, lengths and names are checked to lie within the data
+ *
+ *   @returns true if reference is valid
+ **/
+static bool attach_packed_reference(packed_reference * ref) {
+    RETURN_NULL_IF(ref->nbyte < sizeof(packed_reference_header), false);
+    const packed_reference_header * header = ref->data;
+    if (0 != memcmp(header->magic, PACKED_REFERENCE_MAGIC, sizeof(header->magic))
+        || PACKED_REFERENCE_VERSION != header->version || header->nbyte != ref->nbyte
+        || header->record_offset != sizeof(packed_reference_header)
+        || header->nseq > (ref->nbyte - header->record_offset) / sizeof(packed_reference_record)
+        || header->name_offset < header->record_offset + header->nseq * sizeof(packed_reference_record)
+        || header->word_offset < header->name_offset || header->word_offset > ref->nbyte
+        || 0 != header->word_offset % sizeof(uint64_t)) {
+        return false;
+    }
+    const char * base = ref->data;
+    ref->nseq = header->nseq;
+    ref->record = (const packed_reference_record *)(base + header->record_offset);
+    ref->names = base + header->name_offset;
+    ref->words = (const uint64_t *)(base + header->word_offset);
+
+    const size_t nname = header->word_offset - header->name_offset;
+    const size_t nword = (ref->nbyte - header->word_offset) / sizeof(uint64_t);
+    for (size_t i = 0; i < ref->nseq; i++) {
+        const packed_reference_record * rec = ref->record + i;
+        if (rec->name >= nname || NULL == memchr(ref->names + rec->name, '\0', nname - rec->name)
+            || rec->word > nword || nword_of_length(rec->n) > nword - rec->word) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**  Pack sequences two bits to a base
+ *
+ *   @param seqs  Array [nseq] of sequences, with names
+ *   @param nseq  Number of sequences
+ *
+ *   @returns Packed reference, held in memory, or NULL if a sequence contains
+ *   a base other than ACGT or on failure
+ **/
+packed_reference * pack_sequences(scrappie_seq_t const * seqs, size_t nseq) {
+    RETURN_NULL_IF(NULL == seqs, NULL);
+
+    size_t nname = 0;
+    size_t nword = 0;
+    for (size_t i = 0; i < nseq; i++) {
+        nname += ((NULL != seqs[i].name) ? strlen(seqs[i].name) : 0) + 1;
+        nword += nword_of_length(seqs[i].n);
+    }
+    const size_t name_offset = sizeof(packed_reference_header) + nseq * sizeof(packed_reference_record);
+    const size_t word_offset = align_up(name_offset + nname);
+    const size_t nbyte = word_offset + nword * sizeof(uint64_t);
+
+    packed_reference * ref = calloc(1, sizeof(packed_reference));
+    char * data = calloc(nbyte, 1);
+    if (NULL == ref || NULL == data) {
+        free(data);
+        free(ref);
+        return NULL;
+    }
+
+    packed_reference_header * header = (packed_reference_header *)data;
+    memcpy(header->magic, PACKED_REFERENCE_MAGIC, sizeof(header->magic));
+    header->version = PACKED_REFERENCE_VERSION;
+    header->nseq = nseq;
+    header->nbyte = nbyte;
+    header->record_offset = sizeof(packed_reference_header);
+    header->name_offset = name_offset;
+    header->word_offset = word_offset;
+
+    packed_reference_record * record = (packed_reference_record *)(data + header->record_offset);
+    char * names = data + name_offset;
+    uint64_t * words = (uint64_t *)(data + word_offset);
+    size_t iname = 0;
+    size_t iword = 0;
+    for (size_t i = 0; i < nseq; i++) {
+        record[i].n = seqs[i].n;
+        record[i].word = iword;
+        record[i].name = iname;
+        if (NULL != seqs[i].name) {
+            const size_t len = strlen(seqs[i].name);
+            memcpy(names + iname, seqs[i].name, len);
+            iname += len;
+        }
+        iname += 1;
+
+        for (size_t pos = 0; pos < seqs[i].n; pos++) {
+            const int code = base_code(seqs[i].seq[pos]);
+            if (code < 0) {
+                warnx("Reference \"%s\" has base %c at %zu, only ACGT can be packed",
+                      (NULL != seqs[i].name) ? seqs[i].name : "", seqs[i].seq[pos], pos);
+                free(data);
+                free(ref);
+                return NULL;
+            }
+            words[iword + pos / PACKED_REFERENCE_BASES_PER_WORD] |=
+                (uint64_t)code << (2 * (pos % PACKED_REFERENCE_BASES_PER_WORD));
+        }
+        iword += nword_of_length(seqs[i].n);
+    }
+
+    ref->data = data;
+    ref->nbyte = nbyte;
+    ref->mapped = false;
+    if (!attach_packed_reference(ref)) {
+        return free_packed_reference(ref);
+    }
+    return ref;
+}
+
+
+/**  Whether file starts as a packed reference
+ **/
+bool is_packed_reference_file(const char * filename) {
+    RETURN_NULL_IF(NULL == filename, false);
+    FILE * fh = fopen(filename, "rb");
+    RETURN_NULL_IF(NULL == fh, false);
+    char magic[8];
+    const bool is_packed = 1 == fread(magic, sizeof(magic), 1, fh)
+        && 0 == memcmp(magic, PACKED_REFERENCE_MAGIC, sizeof(magic));
+    fclose(fh);
+    return is_packed;
+}
+
+
+/**  Open references from a packed reference file or a fasta file
+ *
+ *   A file written by write_packed_reference is mapped read-only and used
+ *   in place; any other file is read as fasta and packed in memory.
+ *
+ *   @param filename  File to open
+ *
+ *   @returns Packed reference or NULL on failure
+ **/
+packed_reference * open_packed_reference(const char * filename) {
+    RETURN_NULL_IF(NULL == filename, NULL);
+
+    if (!is_packed_reference_file(filename)) {
+        size_t nseq = 0;
+        scrappie_seq_t * seqs = read_sequences_from_fasta(filename, &nseq);
+        RETURN_NULL_IF(NULL == seqs, NULL);
+        packed_reference * ref = pack_sequences(seqs, nseq);
+        seqs = free_sequences(seqs, nseq);
+        return ref;
+    }
+
+    int fd = open(filename, O_RDONLY);
+    RETURN_NULL_IF(fd < 0, NULL);
+    struct stat st;
+    if (0 != fstat(fd, &st) || (size_t)st.st_size < sizeof(packed_reference_header)) {
+        close(fd);
+        return NULL;
+    }
+    const size_t nbyte = st.st_size;
+    void * map = mmap(NULL, nbyte, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (MAP_FAILED == map) {
+        warnx("Failed to map packed reference \"%s\"", filename);
+        return NULL;
+    }
+
+    packed_reference * ref = calloc(1, sizeof(packed_reference));
+    if (NULL == ref) {
+        munmap(map, nbyte);
+        return NULL;
+    }
+    ref->data = map;
+    ref->nbyte = nbyte;
+    ref->mapped = true;
+    if (!attach_packed_reference(ref)) {
+        warnx("Packed reference \"%s\" is corrupt", filename);
+        return free_packed_reference(ref);
+    }
+    return ref;
+}
+
+
+/**  Write packed reference to file
+ *
+ *   The file is written under a temporary name and renamed into place so
+ *   readers never see a partial file.
+ *
+ *   @returns true on success
+ **/
+bool write_packed_reference(const char * filename, const packed_reference * ref) {
+    RETURN_NULL_IF(NULL == filename, false);
+    RETURN_NULL_IF(NULL == ref, false);
+
+    char tmppath[PACKED_REFERENCE_PATH_LEN];
+    const int ret = snprintf(tmppath, PACKED_REFERENCE_PATH_LEN, "%s.%ld.tmp", filename, (long)getpid());
+    RETURN_NULL_IF(ret <= 0 || ret >= PACKED_REFERENCE_PATH_LEN, false);
+
+    FILE * fh = fopen(tmppath, "wb");
+    if (NULL == fh) {
+        warnx("Failed to open \"%s\" to write packed reference", tmppath);
+        return false;
+    }
+    bool ok = ref->nbyte == fwrite(ref->data, 1, ref->nbyte, fh);
+    ok = (0 == fclose(fh)) && ok;
+    if (ok) {
+        ok = (0 == rename(tmppath, filename));
+    }
+    if (!ok) {
+        warnx("Failed to write packed reference \"%s\"", filename);
+        remove(tmppath);
+    }
+
+    return ok;
+}
+
+
+packed_reference * free_packed_reference(packed_reference * ref) {
+    if (NULL != ref) {
+        if (ref->mapped) {
+            munmap(ref->data, ref->nbyte);
+        } else {
+            free(ref->data);
+        }
+        free(ref);
+    }
+    return NULL;
+}
+
+
+size_t packed_reference_length(const packed_reference * ref, size_t i) {
+    assert(NULL != ref && i < ref->nseq);
+    return ref->record[i].n;
+}
+
+size_t packed_reference_max_length(const packed_reference * ref) {
+    RETURN_NULL_IF(NULL == ref, 0);
+    size_t maxlen = 0;
+    for (size_t i = 0; i < ref->nseq; i++) {
+        maxlen = (ref->record[i].n > maxlen) ? ref->record[i].n : maxlen;
+    }
+    return maxlen;
+}
+
+const char * packed_reference_name(const packed_reference * ref, size_t i) {
+    assert(NULL != ref && i < ref->nseq);
+    return ref->names + ref->record[i].name;
+}
+
+
+/**  Code of base of a sequence, A=0, C=1, G=2, T=3
+ **/
+int packed_reference_base(const packed_reference * ref, size_t i, size_t pos) {
+    assert(NULL != ref && i < ref->nseq);
+    assert(pos < ref->record[i].n);
+    const uint64_t word = ref->words[ref->record[i].word + pos / PACKED_REFERENCE_BASES_PER_WORD];
+    return (word >> (2 * (pos % PACKED_REFERENCE_BASES_PER_WORD))) & 3;
+}
+
+
+/**  Unpack bases of a sequence as characters
+ *
+ *   @param ref  Packed reference
+ *   @param i  Index of sequence
+ *   @param bases  Buffer [n + 1] for bases or NULL to allocate one
+ *
+ *   @returns Null terminated bases, in buffer if given, or NULL on failure
+ **/
+char * packed_reference_bases(const packed_reference * ref, size_t i, char * bases) {
+    RETURN_NULL_IF(NULL == ref, NULL);
+    RETURN_NULL_IF(i >= ref->nseq, NULL);
+    const size_t n = ref->record[i].n;
+    if (NULL == bases) {
+        bases = malloc(n + 1);
+        RETURN_NULL_IF(NULL == bases, NULL);
+    }
+
+    const uint64_t * words = ref->words + ref->record[i].word;
+    for (size_t pos = 0; pos < n; pos += PACKED_REFERENCE_BASES_PER_WORD) {
+        uint64_t word = words[pos / PACKED_REFERENCE_BASES_PER_WORD];
+        const size_t nb = (n - pos < PACKED_REFERENCE_BASES_PER_WORD) ? (n - pos) : PACKED_REFERENCE_BASES_PER_WORD;
+        for (size_t j = 0; j < nb; j++, word >>= 2) {
+            bases[pos + j] = packed_base_char[word & 3];
+        }
+    }
+    bases[n] = '\0';
+
+    return bases;
+}
+
+
+/**  States of a sequence encoding k-mers of bases
+ *
+ *   States are identical to those of encode_bases_to_integers, formed by
+ *   shifting each base into a rolling code as the packed words are read.
+ *
+ *   @param ref  Packed reference
+ *   @param i  Index of sequence
+ *   @param state_len  Length of k-mer of each state, at most 15
+ *   @param states  Buffer [n - state_len + 1] for states or NULL to allocate one
+ *
+ *   @returns States, in buffer if given, or NULL if sequence is shorter than
+ *   a state or on failure
+ **/
+int * packed_reference_states(const packed_reference * ref, size_t i, size_t state_len, int * states) {
+    RETURN_NULL_IF(NULL == ref, NULL);
+    RETURN_NULL_IF(i >= ref->nseq, NULL);
+    assert(state_len > 0 && state_len <= 15);
+    const size_t n = ref->record[i].n;
+    RETURN_NULL_IF(n < state_len, NULL);
+    if (NULL == states) {
+        states = malloc((n - state_len + 1) * sizeof(int));
+        RETURN_NULL_IF(NULL == states, NULL);
+    }
+
+    const uint64_t * words = ref->words + ref->record[i].word;
+    const unsigned int mask = (1U << (2 * state_len)) - 1;
+    unsigned int code = 0;
+    for (size_t pos = 0; pos < n; pos += PACKED_REFERENCE_BASES_PER_WORD) {
+        uint64_t word = words[pos / PACKED_REFERENCE_BASES_PER_WORD];
+        const size_t nb = (n - pos < PACKED_REFERENCE_BASES_PER_WORD) ? (n - pos) : PACKED_REFERENCE_BASES_PER_WORD;
+        for (size_t j = 0; j < nb; j++, word >>= 2) {
+            code = ((code << 2) | (word & 3)) & mask;
+            const size_t end = pos + j + 1;
+            if (end >= state_len) {
+                states[end - state_len] = code;
+            }
+        }
+    }
+
+    return states;
+}
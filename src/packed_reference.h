@@ -0,0 +1,74 @@
+#pragma once
+#ifndef PACKED_REFERENCE_H
+#    define PACKED_REFERENCE_H
+
+/**  References packed two bits to a base
+ *
+ *   A set of reference sequences is stored as a fixed size header, a record
+ *   for each sequence, their names and their bases packed into 64-bit words,
+ *   32 bases to a word with the first base in the lowest bits (A=0, C=1, G=2,
+ *   T=3).  Each sequence starts on a new word.  The same layout is used in
+ *   memory and on disk, so a file written by write_packed_reference is mapped
+ *   read-only and used without copying; the pages are shared by every process
+ *   mapping the file.  Values are stored in native byte order.
+ *
+ *   Bases other than ACGT cannot be packed.  States encoding k-mers of
+ *   bases, as encode_bases_to_integers, and the bases themselves are formed
+ *   from the packed words when needed.
+ **/
+
+#    include <stdbool.h>
+#    include <stddef.h>
+#    include <stdint.h>
+#    include "scrappie_seq_helpers.h"
+
+#    define PACKED_REFERENCE_MAGIC "SCRP2BIT"
+#    define PACKED_REFERENCE_VERSION 1
+#    define PACKED_REFERENCE_BASES_PER_WORD 32
+
+//  Header of packed reference, 64 bytes
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved0;
+    uint64_t nseq;
+    //  Bytes of whole reference, and from its start to records, names and words
+    uint64_t nbyte;
+    uint64_t record_offset;
+    uint64_t name_offset;
+    uint64_t word_offset;
+    char reserved[8];
+} packed_reference_header;
+
+typedef struct {
+    //  Number of bases, first word of bases, and offset of name within names
+    uint64_t n;
+    uint64_t word;
+    uint64_t name;
+} packed_reference_record;
+
+typedef struct {
+    void * data;
+    size_t nbyte;
+    //  Whether data are a mapped file rather than allocated
+    bool mapped;
+    size_t nseq;
+    const packed_reference_record * record;
+    const char * names;
+    const uint64_t * words;
+} packed_reference;
+
+packed_reference * pack_sequences(scrappie_seq_t const * seqs, size_t nseq);
+packed_reference * open_packed_reference(const char * filename);
+bool is_packed_reference_file(const char * filename);
+bool write_packed_reference(const char * filename, const packed_reference * ref);
+packed_reference * free_packed_reference(packed_reference * ref);
+
+size_t packed_reference_length(const packed_reference * ref, size_t i);
+size_t packed_reference_max_length(const packed_reference * ref);
+const char * packed_reference_name(const packed_reference * ref, size_t i);
+int packed_reference_base(const packed_reference * ref, size_t i, size_t pos);
+char * packed_reference_bases(const packed_reference * ref, size_t i, char * bases);
+int * packed_reference_states(const packed_reference * ref, size_t i, size_t state_len, int * states);
+
+#endif                          /* PACKED_REFERENCE_H */
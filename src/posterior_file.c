@@ -0,0 +1,174 @@
+#include <err.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "posterior_file.h"
+#include "scrappie_stdlib.h"
+
+
+/**  Copy string into fixed length field, truncating and padding with nul
+ **/
+static void copy_field(char * field, size_t len, const char * str) {
+    memset(field, 0, len);
+    if (NULL != str) {
+        const size_t slen = strlen(str);
+        memcpy(field, str, (slen < len - 1) ? slen : len - 1);
+    }
+}
+
+
+/**  Append posterior matrix to file as a single record
+ *
+ *   The file should only contain posterior records, so that each record
+ *   starts aligned.
+ *
+ *   @param fh  File handle to write to
+ *   @param post  Posterior matrix, one column per block
+ *   @param model  Name of model used to calculate posterior
+ *   @param read_id  Identifier of read
+ *
+ *   @returns true on success
+ **/
+bool write_posterior_record(FILE * fh, const_scrappie_matrix post, const char * model,
+                            const char * read_id) {
+    RETURN_NULL_IF(NULL == fh, false);
+    RETURN_NULL_IF(NULL == post, false);
+
+    const size_t header_size = sizeof(posterior_record_header);
+    const size_t data_size = post->nr * post->nc * sizeof(float);
+    const size_t record_size = POSTERIOR_FILE_ALIGN
+        * ((header_size + data_size + POSTERIOR_FILE_ALIGN - 1) / POSTERIOR_FILE_ALIGN);
+
+    posterior_record_header header;
+    memset(&header, 0, header_size);
+    memcpy(header.magic, POSTERIOR_FILE_MAGIC, sizeof(header.magic));
+    header.version = POSTERIOR_FILE_VERSION;
+    header.nstate = post->nr;
+    header.nblk = post->nc;
+    header.record_size = record_size;
+    copy_field(header.model, POSTERIOR_MODEL_LEN, model);
+    copy_field(header.read_id, POSTERIOR_READ_ID_LEN, read_id);
+
+    if (1 != fwrite(&header, header_size, 1, fh)) {
+        return false;
+    }
+    for (size_t blk = 0; blk < post->nc; blk++) {
+        if (post->nr != fwrite(post->data.f + blk * post->stride, sizeof(float), post->nr, fh)) {
+            return false;
+        }
+    }
+    const char padding[POSTERIOR_FILE_ALIGN] = { 0 };
+    const size_t npad = record_size - header_size - data_size;
+    return npad == fwrite(padding, 1, npad, fh);
+}
+
+
+/**  Check record header found at offset in file of given size
+ **/
+static bool valid_record(const posterior_record_header * record, size_t offset, size_t nbyte) {
+    if (nbyte - offset < sizeof(posterior_record_header)) {
+        return false;
+    }
+    if (0 != memcmp(record->magic, POSTERIOR_FILE_MAGIC, sizeof(record->magic))
+        || POSTERIOR_FILE_VERSION != record->version) {
+        return false;
+    }
+    const uint64_t min_size = sizeof(posterior_record_header)
+        + record->nblk * record->nstate * sizeof(float);
+    return record->record_size >= min_size
+        && 0 == record->record_size % POSTERIOR_FILE_ALIGN
+        && record->record_size <= nbyte - offset;
+}
+
+
+/**  Map posterior file into memory
+ *
+ *   The file is mapped read-only and not copied, so records are available
+ *   immediately however large the file.
+ *
+ *   @param filename  Path to posterior file
+ *
+ *   @returns Mapped file, with index of records, or NULL if the file could
+ *   not be mapped or is not a valid posterior file.
+ **/
+posterior_file * open_posterior_file(const char * filename) {
+    RETURN_NULL_IF(NULL == filename, NULL);
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        warnx("Failed to open posterior file \"%s\"", filename);
+        return NULL;
+    }
+    struct stat st;
+    if (0 != fstat(fd, &st) || 0 == st.st_size) {
+        warnx("Posterior file \"%s\" is empty or unreadable", filename);
+        close(fd);
+        return NULL;
+    }
+    const size_t nbyte = st.st_size;
+    void * map = mmap(NULL, nbyte, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == map) {
+        warnx("Failed to map posterior file \"%s\"", filename);
+        return NULL;
+    }
+
+    //  Count and validate records before building index
+    size_t nrecord = 0;
+    for (size_t offset = 0; offset < nbyte; nrecord++) {
+        const posterior_record_header * record = (const void *)((const char *)map + offset);
+        if (!valid_record(record, offset, nbyte)) {
+            warnx("Invalid posterior record at byte %zu of \"%s\"", offset, filename);
+            munmap(map, nbyte);
+            return NULL;
+        }
+        offset += record->record_size;
+    }
+
+    posterior_file * pf = calloc(1, sizeof(posterior_file));
+    const posterior_record_header ** index = calloc(nrecord, sizeof(*index));
+    if (NULL == pf || NULL == index) {
+        free(index);
+        free(pf);
+        munmap(map, nbyte);
+        return NULL;
+    }
+    for (size_t i = 0, offset = 0; i < nrecord; i++) {
+        index[i] = (const void *)((const char *)map + offset);
+        offset += index[i]->record_size;
+    }
+    *pf = (posterior_file){map, nbyte, nrecord, index};
+    return pf;
+}
+
+
+posterior_file * free_posterior_file(posterior_file * pf) {
+    if (NULL != pf) {
+        munmap(pf->map, pf->nbyte);
+        free(pf->record);
+        free(pf);
+    }
+    return NULL;
+}
+
+
+/**  Posterior of record, nblk contiguous blocks of nstate values
+ *
+ *   Data are aligned to POSTERIOR_FILE_ALIGN bytes
+ **/
+const float * posterior_record_data(const posterior_record_header * record) {
+    RETURN_NULL_IF(NULL == record, NULL);
+    return (const float *)(record + 1);
+}
+
+
+/**  Copy posterior of record into a new matrix
+ **/
+scrappie_matrix posterior_record_to_matrix(const posterior_record_header * record) {
+    RETURN_NULL_IF(NULL == record, NULL);
+    return mat_from_array(posterior_record_data(record), record->nstate, record->nblk);
+}
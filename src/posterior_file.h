@@ -0,0 +1,56 @@
+#pragma once
+#ifndef POSTERIOR_FILE_H
+#    define POSTERIOR_FILE_H
+
+/**  Binary container for posterior matrices
+ *
+ *   A file is a sequence of records, one per read, each starting on a
+ *   multiple of POSTERIOR_FILE_ALIGN bytes.  A record is a fixed size header
+ *   followed by nblk blocks of nstate floats, each block stored contiguously
+ *   without padding.  For CRF models the nstate = 25 values of a block are the
+ *   transition matrix in scrappie's order, destination state major.  Values
+ *   are stored in native byte order.
+ *
+ *   The format is also read by shubham/viterbi_nanopore.cpp so this header
+ *   must remain valid C++.
+ **/
+
+#    include <stdbool.h>
+#    include <stdint.h>
+#    include <stdio.h>
+#    include "scrappie_matrix.h"
+
+#    define POSTERIOR_FILE_MAGIC "SCRPPOST"
+#    define POSTERIOR_FILE_VERSION 1
+#    define POSTERIOR_FILE_ALIGN 64
+#    define POSTERIOR_MODEL_LEN 32
+#    define POSTERIOR_READ_ID_LEN 128
+
+//  Header of each record, 256 bytes so the data that follows it is aligned
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t nstate;
+    uint64_t nblk;
+    //  Bytes from start of this record to start of the next
+    uint64_t record_size;
+    char model[POSTERIOR_MODEL_LEN];
+    char read_id[POSTERIOR_READ_ID_LEN];
+    char reserved[64];
+} posterior_record_header;
+
+typedef struct {
+    void * map;
+    size_t nbyte;
+    size_t nrecord;
+    const posterior_record_header ** record;
+} posterior_file;
+
+bool write_posterior_record(FILE * fh, const_scrappie_matrix post, const char * model,
+                            const char * read_id);
+posterior_file * open_posterior_file(const char * filename);
+posterior_file * free_posterior_file(posterior_file * pf);
+const float * posterior_record_data(const posterior_record_header * record);
+scrappie_matrix posterior_record_to_matrix(const posterior_record_header * record);
+
+#endif                          /* POSTERIOR_FILE_H */
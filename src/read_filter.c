@@ -0,0 +1,154 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "event_detection.h"
+#include "read_filter.h"
+#include "scrappie_stdlib.h"
+#include "util.h"
+
+//  Samples converted to pA and events found at a time when counting events
+#define READ_FILTER_BLOCK 4096
+#define READ_FILTER_MAX_EVENT 1024
+
+static const char * read_filter_reason_strings[READ_FILTER_NREASON] = {
+    "pass", "short", "long", "low_mad", "high_mad", "few_events", "many_events"
+};
+
+const char * read_filter_reason_string(enum read_filter_reason reason){
+    return (reason < READ_FILTER_NREASON) ? read_filter_reason_strings[reason] : "invalid";
+}
+
+bool read_filter_enabled(const read_filter_param * param){
+    RETURN_NULL_IF(NULL == param, false);
+    return param->min_length > 0 || param->max_length > 0
+        || param->min_mad > 0.0f || param->max_mad > 0.0f
+        || param->min_event_rate > 0.0f || param->max_event_rate > 0.0f;
+}
+
+
+/**  MAD of signal in pA
+ **/
+static float read_filter_mad(const raw_table rt){
+    const size_t nsample = rt.end - rt.start;
+    float med = NAN;
+    float mad = NAN;
+    if(NULL != rt.raw){
+        medmadf(rt.raw + rt.start, nsample, NULL, &med, &mad);
+    } else {
+        medmad_int16(rt.sample + rt.start, nsample, &med, &mad);
+        mad *= fabsf(rt.unit);
+    }
+    return mad;
+}
+
+
+/**  Events found per sample of signal
+ *
+ *   Events are counted as the detector finds them, in a buffer of fixed
+ *   size, and native signal converted to pA a block at a time, so no copy
+ *   of the read or its events is made.
+ **/
+static float read_filter_event_rate(const raw_table rt){
+    const size_t nsample = rt.end - rt.start;
+    RETURN_NULL_IF(0 == nsample, NAN);
+    event_detector * ed = make_event_detector(event_detection_defaults);
+    RETURN_NULL_IF(NULL == ed, NAN);
+    event_t * events = malloc(READ_FILTER_MAX_EVENT * sizeof(event_t));
+    if(NULL == events){
+        ed = free_event_detector(ed);
+        return NAN;
+    }
+
+    float block[READ_FILTER_BLOCK];
+    size_t nevent_total = 0;
+    for(size_t offset=0 ; offset < nsample ; ){
+        const size_t nblock = (nsample - offset < READ_FILTER_BLOCK) ? (nsample - offset) : READ_FILTER_BLOCK;
+        const float * x = block;
+        if(NULL != rt.raw){
+            x = rt.raw + rt.start + offset;
+        } else {
+            for(size_t i=0 ; i < nblock ; i++){
+                block[i] = (rt.sample[rt.start + offset + i] + rt.offset) * rt.unit;
+            }
+        }
+        for(size_t pushed=0 ; pushed < nblock ; ){
+            size_t nevent = 0;
+            pushed += event_detector_push(ed, x + pushed, nblock - pushed, events, READ_FILTER_MAX_EVENT, &nevent);
+            nevent_total += nevent;
+        }
+        offset += nblock;
+    }
+    //  Remaining samples of the detector are those within its windows
+    const size_t capacity = event_detector_finish_capacity(ed);
+    if(capacity > READ_FILTER_MAX_EVENT){
+        event_t * new_events = realloc(events, capacity * sizeof(event_t));
+        if(NULL == new_events){
+            free(events);
+            ed = free_event_detector(ed);
+            return NAN;
+        }
+        events = new_events;
+    }
+    nevent_total += event_detector_finish(ed, events, (capacity > READ_FILTER_MAX_EVENT) ? capacity : READ_FILTER_MAX_EVENT);
+
+    free(events);
+    ed = free_event_detector(ed);
+    return (float)nevent_total / (float)nsample;
+}
+
+
+/**  Test read against filter
+ *
+ *   @param rt  Trimmed signal of read, in pA or native with conversion to pA
+ *   @param param  Bounds of filter
+ *   @param stats  Statistics calculated [out], or NULL
+ *
+ *   @returns READ_FILTER_PASS or the first bound the read fails
+ **/
+enum read_filter_reason filter_read(const raw_table rt, const read_filter_param * param,
+                                    read_filter_stats * stats){
+    read_filter_stats st = {rt.end - rt.start, NAN, NAN};
+    enum read_filter_reason reason = READ_FILTER_PASS;
+    if(NULL == param || (NULL == rt.raw && NULL == rt.sample)){
+        goto done;
+    }
+
+    if(param->min_length > 0 && st.nsample < param->min_length){
+        reason = READ_FILTER_SHORT;
+        goto done;
+    }
+    if(param->max_length > 0 && st.nsample > param->max_length){
+        reason = READ_FILTER_LONG;
+        goto done;
+    }
+
+    if(param->min_mad > 0.0f || param->max_mad > 0.0f){
+        st.mad = read_filter_mad(rt);
+        if(param->min_mad > 0.0f && !(st.mad >= param->min_mad)){
+            reason = READ_FILTER_LOW_MAD;
+            goto done;
+        }
+        if(param->max_mad > 0.0f && st.mad > param->max_mad){
+            reason = READ_FILTER_HIGH_MAD;
+            goto done;
+        }
+    }
+
+    if(param->min_event_rate > 0.0f || param->max_event_rate > 0.0f){
+        st.event_rate = read_filter_event_rate(rt);
+        if(param->min_event_rate > 0.0f && !(st.event_rate >= param->min_event_rate)){
+            reason = READ_FILTER_FEW_EVENTS;
+            goto done;
+        }
+        if(param->max_event_rate > 0.0f && st.event_rate > param->max_event_rate){
+            reason = READ_FILTER_MANY_EVENTS;
+            goto done;
+        }
+    }
+
+done:
+    if(NULL != stats){
+        *stats = st;
+    }
+    return reason;
+}
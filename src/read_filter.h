@@ -0,0 +1,60 @@
+#pragma once
+#ifndef READ_FILTER_H
+#    define READ_FILTER_H
+
+/**  Early rejection of reads from cheap statistics of their signal
+ *
+ *   A read is tested after trimming, before it is normalised or any layer
+ *   of the network is evaluated, against bounds on the number of samples
+ *   left, the MAD of the signal in pA and the rate of events found per
+ *   sample.  Blocked pores give few events, noise many, and adapter-only
+ *   reads are short.  Statistics are only calculated when a bound needs
+ *   them, the length first, and a bound of zero is no bound.
+ **/
+
+#    include <stdbool.h>
+#    include <stddef.h>
+#    include "scrappie_structures.h"
+
+typedef struct {
+    size_t min_length;
+    size_t max_length;
+    float min_mad;
+    float max_mad;
+    float min_event_rate;
+    float max_event_rate;
+} read_filter_param;
+
+static read_filter_param const read_filter_defaults = {
+    .min_length = 0,
+    .max_length = 0,
+    .min_mad = 0.0f,
+    .max_mad = 0.0f,
+    .min_event_rate = 0.0f,
+    .max_event_rate = 0.0f
+};
+
+enum read_filter_reason {
+    READ_FILTER_PASS,
+    READ_FILTER_SHORT,
+    READ_FILTER_LONG,
+    READ_FILTER_LOW_MAD,
+    READ_FILTER_HIGH_MAD,
+    READ_FILTER_FEW_EVENTS,
+    READ_FILTER_MANY_EVENTS,
+    READ_FILTER_NREASON
+};
+
+//  Statistics of read, NAN for those not calculated
+typedef struct {
+    size_t nsample;
+    float mad;
+    float event_rate;
+} read_filter_stats;
+
+bool read_filter_enabled(const read_filter_param * param);
+enum read_filter_reason filter_read(const raw_table rt, const read_filter_param * param,
+                                    read_filter_stats * stats);
+const char * read_filter_reason_string(enum read_filter_reason reason);
+
+#endif                          /* READ_FILTER_H */
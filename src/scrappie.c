@@ -46,6 +46,21 @@ int main(int argc, char *argv[]) {
     case SCRAPPIE_MODE_EVENT_TABLE:
         ret = main_event_table(argc - 1, argv + 1);
         break;
+    case SCRAPPIE_MODE_CONVDECODE:
+        ret = main_convdecode(argc - 1, argv + 1);
+        break;
+    case SCRAPPIE_MODE_SIMULATE:
+        ret = main_simulate(argc - 1, argv + 1);
+        break;
+    case SCRAPPIE_MODE_SERVE:
+        ret = main_serve(argc - 1, argv + 1);
+        break;
+    case SCRAPPIE_MODE_REDECODE:
+        ret = main_redecode(argc - 1, argv + 1);
+        break;
+    case SCRAPPIE_MODE_PACK:
+        ret = main_pack(argc - 1, argv + 1);
+        break;
     default:
         ret = EXIT_FAILURE;
         warnx("Unrecognised subcommand %s\n", argv[1]);
@@ -0,0 +1,945 @@
+// Needed for syscall
+#define _DEFAULT_SOURCE
+
+#include <err.h>
+#include <glob.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__linux__)
+#    include <linux/perf_event.h>
+#    include <sys/ioctl.h>
+#    include <sys/syscall.h>
+#    include <unistd.h>
+#endif
+
+#include "decode.h"
+#include "event_detection.h"
+#include "fast5_interface.h"
+#include "layers.h"
+#include "networks.h"
+#include "scrappie_common.h"
+#include "scrappie_matrix.h"
+#include "scrappie_profile.h"
+#include "scrappie_simd.h"
+#include "scrappie_stdlib.h"
+#include "version.h"
+
+// Doesn't play nice with other headers, include last
+#include <argp.h>
+
+#if !defined(SCRAPPIE_VERSION)
+#    define SCRAPPIE_VERSION "unknown"
+#endif
+#if !defined(SCRAPPIE_GIT_COMMIT)
+#    define SCRAPPIE_GIT_COMMIT "unknown"
+#endif
+const char *argp_program_version = "scrappie_bench " SCRAPPIE_VERSION;
+const char *argp_program_bug_address = "<tim.massingham@nanoporetech.com>";
+
+static char doc[] = "Scrappie benchmarks -- time kernels and basecalling of reads";
+static char args_doc[] = "[fast5 ...]";
+static struct argp_option options[] = {
+    {"filter", 'f', "string", 0, "Only run benchmarks whose name contains string"},
+    {"format", 1, "format", 0, "Format of results: tsv (default) or json"},
+    {"min-time", 't', "seconds", 0, "Minimum time to spend timing each benchmark"},
+    {"repeats", 'r', "n", 0, "Minimum number of timed calls of each benchmark"},
+    {"output", 'o', "filename", 0, "Write results to file rather than stdout"},
+    {"models", 2, "list", 0, "Comma separated list of models to basecall with (raw models or \"events\")"},
+    {"basecall", 3, 0, 0, "Time basecalling of reads (default)"},
+    {"no-basecall", 4, 0, OPTION_ALIAS, "Only time kernels"},
+    {"kernels", 5, 0, 0, "Time kernels (default)"},
+    {"no-kernels", 6, 0, OPTION_ALIAS, "Only time basecalling of reads"},
+    {"math", 7, "tier", 0, "Accuracy of activation functions: accurate (default), fast or fastest"},
+    {"simd", 8, "level", 0, "Vector instructions to use: sse, avx2 or avx512 (default is best supported)"},
+    {"counters", 9, 0, 0, "Count cycles, instructions, cache misses and branch misses of each benchmark"},
+    {"no-counters", 10, 0, OPTION_ALIAS, "Only time benchmarks (default)"},
+    {0}
+};
+
+enum bench_format { BENCH_TSV = 0, BENCH_JSON };
+
+struct arguments {
+    char * filter;
+    enum bench_format format;
+    double min_time;
+    int repeats;
+    FILE * output;
+    char * models;
+    bool basecall;
+    bool kernels;
+    enum scrappie_math math;
+    const char * simd;
+    bool counters;
+    char ** files;
+    int nfile;
+};
+
+static struct arguments args = {
+    .filter = NULL,
+    .format = BENCH_TSV,
+    .min_time = 0.5,
+    .repeats = 3,
+    .output = NULL,
+    .models = "rgrgr_r94,rnnrf_r94,raw_r94,events",
+    .basecall = true,
+    .kernels = true,
+    .math = SCRAPPIE_MATH_ACCURATE,
+    .simd = NULL,
+    .counters = false,
+    .files = NULL,
+    .nfile = 0
+};
+
+static error_t parse_arg(int key, char * arg, struct argp_state * state){
+    switch(key){
+    case 'f':
+        args.filter = arg;
+        break;
+    case 1:
+        if(0 == strcmp(arg, "tsv")){
+            args.format = BENCH_TSV;
+        } else if(0 == strcmp(arg, "json")){
+            args.format = BENCH_JSON;
+        } else {
+            errx(EXIT_FAILURE, "Unrecognised format \"%s\", should be tsv or json", arg);
+        }
+        break;
+    case 't':
+        args.min_time = atof(arg);
+        if(!(args.min_time >= 0.0)){
+            errx(EXIT_FAILURE, "--min-time should be non-negative, got %s", arg);
+        }
+        break;
+    case 'r':
+        args.repeats = atoi(arg);
+        if(args.repeats < 1){
+            errx(EXIT_FAILURE, "--repeats should be positive, got %s", arg);
+        }
+        break;
+    case 'o':
+        args.output = fopen(arg, "w");
+        if(NULL == args.output){
+            errx(EXIT_FAILURE, "Failed to open \"%s\" for output.", arg);
+        }
+        break;
+    case 2:
+        args.models = arg;
+        break;
+    case 3:
+        args.basecall = true;
+        break;
+    case 4:
+        args.basecall = false;
+        break;
+    case 5:
+        args.kernels = true;
+        break;
+    case 6:
+        args.kernels = false;
+        break;
+    case 7:
+        args.math = scrappie_math_from_string(arg);
+        if(SCRAPPIE_MATH_INVALID == args.math){
+            errx(EXIT_FAILURE, "Unrecognised accuracy of activations \"%s\"", arg);
+        }
+        break;
+    case 8:
+        args.simd = arg;
+        break;
+    case 9:
+        args.counters = true;
+        break;
+    case 10:
+        args.counters = false;
+        break;
+    case ARGP_KEY_ARG:
+        args.files = &state->argv[state->next - 1];
+        args.nfile = state->argc - state->next + 1;
+        state->next = state->argc;
+        break;
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+static struct argp argp = {options, parse_arg, args_doc, doc};
+
+
+/**  Hardware counters of benchmarks
+ *
+ *   Counted with perf_event_open, for user space only so no privilege is
+ *   needed beyond perf_event_paranoid of 2 or less.  The counters form a
+ *   group so are scheduled together, and are scaled for the time they were
+ *   running should the kernel multiplex them.
+ **/
+enum bench_counter {
+    BENCH_CYCLES = 0,
+    BENCH_INSTRUCTIONS,
+    BENCH_CACHE_MISSES,
+    BENCH_BRANCH_MISSES,
+    BENCH_NCOUNTER
+};
+
+static const char * counter_names[BENCH_NCOUNTER] = {
+    "cycles", "instructions", "cache_misses", "branch_misses"
+};
+
+static int counter_fd[BENCH_NCOUNTER] = {-1, -1, -1, -1};
+
+static void close_counters(void){
+    for(size_t i=0 ; i < BENCH_NCOUNTER ; i++){
+        if(counter_fd[i] >= 0){
+            close(counter_fd[i]);
+            counter_fd[i] = -1;
+        }
+    }
+}
+
+static bool open_counters(void){
+#if defined(__linux__)
+    const uint64_t config[BENCH_NCOUNTER] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+    };
+    for(size_t i=0 ; i < BENCH_NCOUNTER ; i++){
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = config[i];
+        attr.disabled = (0 == i);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        counter_fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, (0 == i) ? -1 : counter_fd[0], 0);
+        if(counter_fd[i] < 0){
+            warn("Failed to open hardware counter of %s, is perf_event_paranoid above 2?",
+                  counter_names[i]);
+            close_counters();
+            return false;
+        }
+    }
+    return true;
+#else
+    warnx("Hardware counters are only supported on Linux");
+    return false;
+#endif
+}
+
+static void start_counters(void){
+#if defined(__linux__)
+    if(counter_fd[0] >= 0){
+        ioctl(counter_fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(counter_fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+}
+
+/**  Stop counting and read counters
+ *
+ *   @param count  Array of BENCH_NCOUNTER to write counts to
+ *
+ *   @returns true if counts were read
+ **/
+static bool stop_counters(double * count){
+#if defined(__linux__)
+    if(counter_fd[0] < 0){
+        return false;
+    }
+    ioctl(counter_fd[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+    //  Number of counters, time enabled and time running, then the counts
+    uint64_t buf[3 + BENCH_NCOUNTER];
+    const ssize_t nread = read(counter_fd[0], buf, sizeof(buf));
+    if(nread != (ssize_t)sizeof(buf) || BENCH_NCOUNTER != buf[0] || 0 == buf[2]){
+        return false;
+    }
+    const double scale = (double)buf[1] / (double)buf[2];
+    for(size_t i=0 ; i < BENCH_NCOUNTER ; i++){
+        count[i] = scale * buf[3 + i];
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+typedef void (*bench_function)(void * state);
+
+static int cmp_double(const void * a, const void * b){
+    const double da = *(const double *)a;
+    const double db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+static bool bench_selected(const char * name){
+    return NULL == args.filter || NULL != strstr(name, args.filter);
+}
+
+/**  Time a benchmark and write its results
+ *
+ *   The benchmark is called once to warm up, then repeatedly until both the
+ *   minimum time and the minimum number of calls have been reached.  When
+ *   hardware counters are open, their mean over the timed calls is written.
+ *
+ *   @param name  Name of benchmark
+ *   @param size  Description of size of problem
+ *   @param fun  Function to time
+ *   @param state  State passed to function
+ *   @param work  Amount of work done by each call, in units
+ *   @param unit  Unit of work
+ **/
+static void run_benchmark(const char * name, const char * size, bench_function fun, void * state,
+                          double work, const char * unit){
+    const size_t max_repeats = 1000000;
+    size_t capacity = 64;
+    double * seconds = calloc(capacity, sizeof(double));
+    if(NULL == seconds){
+        warnx("Failed to allocate memory to time %s", name);
+        return;
+    }
+
+    fun(state);
+    size_t nrep = 0;
+    double total = 0.0;
+    start_counters();
+    while((total < args.min_time || nrep < (size_t)args.repeats) && nrep < max_repeats){
+        const double start = scrappie_profile_now();
+        fun(state);
+        const double elapsed = scrappie_profile_now() - start;
+        if(nrep == capacity){
+            double * tmp = realloc(seconds, 2 * capacity * sizeof(double));
+            if(NULL == tmp){
+                break;
+            }
+            seconds = tmp;
+            capacity *= 2;
+        }
+        seconds[nrep++] = elapsed;
+        total += elapsed;
+    }
+    double count[BENCH_NCOUNTER];
+    const bool counted = stop_counters(count);
+
+    qsort(seconds, nrep, sizeof(double), cmp_double);
+    const double best = seconds[0];
+    const double median = (nrep % 2) ? seconds[nrep / 2] : 0.5 * (seconds[nrep / 2 - 1] + seconds[nrep / 2]);
+    const double rate = (best > 0.0) ? work / best : 0.0;
+    free(seconds);
+
+    if(BENCH_TSV == args.format){
+        fprintf(args.output, "%s\t%s\t%zu\t%e\t%e\t%e\t%s", name, size, nrep, best, median, rate, unit);
+        for(size_t i=0 ; i < BENCH_NCOUNTER ; i++){
+            if(counted){
+                fprintf(args.output, "\t%.0f", count[i] / nrep);
+            } else {
+                fputs("\tNA", args.output);
+            }
+        }
+        fprintf(args.output, "\t%s\n", SCRAPPIE_GIT_COMMIT);
+    } else {
+        fprintf(args.output, "{ \"benchmark\" : \"%s\", \"size\" : \"%s\", \"repeats\" : %zu, \"best_seconds\" : %e, "
+                "\"median_seconds\" : %e, \"rate\" : %e, \"unit\" : \"%s\", \"commit\" : \"%s\"",
+                name, size, nrep, best, median, rate, unit, SCRAPPIE_GIT_COMMIT);
+        for(size_t i=0 ; counted && i < BENCH_NCOUNTER ; i++){
+            fprintf(args.output, ", \"%s\" : %.0f", counter_names[i], count[i] / nrep);
+        }
+        fputs(" }\n", args.output);
+    }
+    fflush(args.output);
+}
+
+
+/**  Fill matrix with uniform random values
+ *
+ *   Padding is left as zero so the matrix validates.
+ **/
+static scrappie_matrix random_matrix(size_t nr, size_t nc, float lower, float upper){
+    scrappie_matrix mat = make_scrappie_matrix(nr, nc);
+    RETURN_NULL_IF(NULL == mat, NULL);
+    for(size_t c=0 ; c < nc ; c++){
+        for(size_t r=0 ; r < nr ; r++){
+            mat->data.f[c * mat->stride + r] = lower + (upper - lower) * (float)rand() / (float)RAND_MAX;
+        }
+    }
+    return mat;
+}
+
+/**  Random matrix whose columns are normalised log probabilities
+ **/
+static scrappie_matrix random_log_probabilities(size_t nr, size_t nc){
+    scrappie_matrix mat = random_matrix(nr, nc, 1e-3f, 1.0f);
+    RETURN_NULL_IF(NULL == mat, NULL);
+    for(size_t c=0 ; c < nc ; c++){
+        float * col = mat->data.f + c * mat->stride;
+        float sum = 0.0f;
+        for(size_t r=0 ; r < nr ; r++){
+            sum += col[r];
+        }
+        for(size_t r=0 ; r < nr ; r++){
+            col[r] = logf(col[r] / sum);
+        }
+    }
+    return mat;
+}
+
+/**  Random signal that steps between levels, like that of a read
+ **/
+static raw_table random_signal(size_t n){
+    float * raw = calloc(n, sizeof(float));
+    RETURN_NULL_IF(NULL == raw, (raw_table){0});
+    float level = 0.0f;
+    for(size_t i=0 ; i < n ; i++){
+        if(0 == rand() % 10){
+            level = 2.0f * (float)rand() / (float)RAND_MAX - 1.0f;
+        }
+        raw[i] = level + 0.2f * ((float)rand() / (float)RAND_MAX - 0.5f);
+    }
+    return (raw_table){NULL, n, 0, n, raw, NULL, 0.0f, 1.0f};
+}
+
+
+struct affine_state {
+    scrappie_matrix X, W, b, C;
+};
+
+static void bench_affine_map(void * state){
+    struct affine_state * s = state;
+    s->C = affine_map(s->X, s->W, s->b, s->C);
+}
+
+static void time_affine_map(void){
+    //  Input size, output size and number of columns
+    const size_t sizes[][3] = {{96, 288, 2000}, {256, 1024, 2000}, {1025, 64, 2000}};
+    for(size_t i=0 ; i < sizeof(sizes) / sizeof(sizes[0]) ; i++){
+        struct affine_state s = {
+            random_matrix(sizes[i][0], sizes[i][2], -1.0f, 1.0f),
+            random_matrix(sizes[i][0], sizes[i][1], -0.1f, 0.1f),
+            random_matrix(sizes[i][1], 1, -0.1f, 0.1f), NULL};
+        if(NULL != s.X && NULL != s.W && NULL != s.b){
+            char size[64];
+            snprintf(size, sizeof(size), "%zux%zu,ncol=%zu", sizes[i][0], sizes[i][1], sizes[i][2]);
+            run_benchmark("affine_map", size, bench_affine_map, &s,
+                          2.0 * sizes[i][0] * sizes[i][1] * sizes[i][2], "flop");
+        }
+        s.X = free_scrappie_matrix(s.X);
+        s.W = free_scrappie_matrix(s.W);
+        s.b = free_scrappie_matrix(s.b);
+        s.C = free_scrappie_matrix(s.C);
+    }
+}
+
+
+#define BENCH_NSTEP 1000
+
+struct recurrent_state {
+    scrappie_matrix x, sW, sW2, peep, xF, istate, ostate, output;
+};
+
+static void bench_gru_step(void * state){
+    struct recurrent_state * s = state;
+    for(size_t i=0 ; i < BENCH_NSTEP ; i++){
+        gru_step(s->x, s->istate, s->sW, s->sW2, s->xF, s->ostate);
+        scrappie_matrix tmp = s->istate;
+        s->istate = s->ostate;
+        s->ostate = tmp;
+    }
+}
+
+static void bench_lstm_step(void * state){
+    struct recurrent_state * s = state;
+    for(size_t i=0 ; i < BENCH_NSTEP ; i++){
+        lstm_step(s->x, s->istate, s->sW, s->peep, s->xF, s->ostate, s->output);
+        scrappie_matrix tmp = s->istate;
+        s->istate = s->output;
+        s->output = tmp;
+    }
+}
+
+static void free_recurrent_state(struct recurrent_state * s){
+    s->x = free_scrappie_matrix(s->x);
+    s->sW = free_scrappie_matrix(s->sW);
+    s->sW2 = free_scrappie_matrix(s->sW2);
+    s->peep = free_scrappie_matrix(s->peep);
+    s->xF = free_scrappie_matrix(s->xF);
+    s->istate = free_scrappie_matrix(s->istate);
+    s->ostate = free_scrappie_matrix(s->ostate);
+    s->output = free_scrappie_matrix(s->output);
+}
+
+static void time_recurrent_steps(void){
+    const size_t sizes[] = {96, 256};
+    char size[64];
+    for(size_t i=0 ; i < sizeof(sizes) / sizeof(sizes[0]) ; i++){
+        const size_t n = sizes[i];
+        snprintf(size, sizeof(size), "size=%zu,nstep=%d", n, BENCH_NSTEP);
+        if(bench_selected("gru_step")){
+            struct recurrent_state s = {
+                random_matrix(3 * n, 1, -1.0f, 1.0f), random_matrix(n, 2 * n, -0.1f, 0.1f),
+                random_matrix(n, n, -0.1f, 0.1f), NULL, make_scrappie_matrix(3 * n, 1),
+                random_matrix(n, 1, -1.0f, 1.0f), make_scrappie_matrix(n, 1), NULL};
+            if(NULL != s.x && NULL != s.sW && NULL != s.sW2 && NULL != s.xF && NULL != s.istate && NULL != s.ostate){
+                run_benchmark("gru_step", size, bench_gru_step, &s, BENCH_NSTEP, "step");
+            }
+            free_recurrent_state(&s);
+        }
+        if(bench_selected("lstm_step")){
+            struct recurrent_state s = {
+                random_matrix(4 * n, 1, -1.0f, 1.0f), random_matrix(n, 4 * n, -0.1f, 0.1f),
+                NULL, random_matrix(3 * n, 1, -0.1f, 0.1f), make_scrappie_matrix(4 * n, 1),
+                random_matrix(n, 1, -1.0f, 1.0f), make_scrappie_matrix(n, 1), make_scrappie_matrix(n, 1)};
+            if(NULL != s.x && NULL != s.sW && NULL != s.peep && NULL != s.xF && NULL != s.istate
+               && NULL != s.ostate && NULL != s.output){
+                run_benchmark("lstm_step", size, bench_lstm_step, &s, BENCH_NSTEP, "step");
+            }
+            free_recurrent_state(&s);
+        }
+    }
+}
+
+
+/**  Zero blocks of weights at random, as left by block pruning
+ **/
+static void prune_blocks(scrappie_matrix W, float sparsity){
+    const size_t bs = SCRAPPIE_SPARSE_BLOCK;
+    for(size_t o=0 ; o < W->nc ; o += bs){
+        for(size_t k=0 ; k < W->nr ; k += bs){
+            if((float)rand() / (float)RAND_MAX >= sparsity){
+                continue;
+            }
+            for(size_t oo=o ; oo < o + bs && oo < W->nc ; oo++){
+                for(size_t kk=k ; kk < k + bs && kk < W->nr ; kk++){
+                    W->data.f[oo * W->stride + kk] = 0.0f;
+                }
+            }
+        }
+    }
+}
+
+struct sparse_gru_state {
+    scrappie_matrix X, sW, sW2, ostate;
+};
+
+static void bench_gru_sparse(void * state){
+    struct sparse_gru_state * s = state;
+    s->ostate = gru_forward(s->X, s->sW, s->sW2, s->ostate);
+}
+
+/**  GRU layer with recurrent weights pruned to blocks of zeros
+ *
+ *   The weights are registered, as those of a model, so blocks of zeros are
+ *   skipped once enough of them are zero.  Sparsity 0 is the dense layer.
+ **/
+static void time_sparse_recurrent(void){
+    const size_t sizes[] = {96, 256};
+    const float sparsities[] = {0.0f, 0.5f, 0.75f};
+    char size[64];
+    for(size_t i=0 ; i < sizeof(sizes) / sizeof(sizes[0]) ; i++){
+        const size_t n = sizes[i];
+        for(size_t j=0 ; j < sizeof(sparsities) / sizeof(sparsities[0]) ; j++){
+            struct sparse_gru_state s = {
+                random_matrix(3 * n, BENCH_NSTEP, -1.0f, 1.0f), random_matrix(n, 2 * n, -0.1f, 0.1f),
+                random_matrix(n, n, -0.1f, 0.1f), NULL};
+            if(NULL != s.X && NULL != s.sW && NULL != s.sW2
+               && register_packed_weights(s.sW) && register_packed_weights(s.sW2)){
+                prune_blocks(s.sW, sparsities[j]);
+                prune_blocks(s.sW2, sparsities[j]);
+                snprintf(size, sizeof(size), "size=%zu,nstep=%d,sparsity=%.2f", n, BENCH_NSTEP, sparsities[j]);
+                run_benchmark("gru_sparse", size, bench_gru_sparse, &s, BENCH_NSTEP, "step");
+            }
+            unregister_packed_weights(s.sW);
+            unregister_packed_weights(s.sW2);
+            s.X = free_scrappie_matrix(s.X);
+            s.sW = free_scrappie_matrix(s.sW);
+            s.sW2 = free_scrappie_matrix(s.sW2);
+            s.ostate = free_scrappie_matrix(s.ostate);
+        }
+    }
+}
+
+
+struct convolution_state {
+    scrappie_matrix X, W, b, C;
+    size_t stride;
+};
+
+static void bench_convolution(void * state){
+    struct convolution_state * s = state;
+    s->C = convolution(s->X, s->W, s->b, s->stride, s->C);
+}
+
+static void time_convolution(void){
+    //  Input channels, window length, filters, stride and number of columns
+    const size_t sizes[][5] = {{1, 11, 96, 2, 8000}, {1, 11, 256, 5, 8000}, {96, 3, 96, 1, 4000}};
+    for(size_t i=0 ; i < sizeof(sizes) / sizeof(sizes[0]) ; i++){
+        const size_t nin = sizes[i][0];
+        const size_t winlen = sizes[i][1];
+        const size_t nfilter = sizes[i][2];
+        struct convolution_state s = {random_matrix(nin, sizes[i][4], -1.0f, 1.0f), NULL,
+                                      random_matrix(nfilter, 1, -0.1f, 0.1f), NULL, sizes[i][3]};
+        //  Filters span the padded rows of each column of the window
+        if(NULL != s.X){
+            s.W = random_matrix(winlen * s.X->stride, nfilter, -0.1f, 0.1f);
+        }
+        if(NULL != s.X && NULL != s.W && NULL != s.b){
+            char size[64];
+            snprintf(size, sizeof(size), "nin=%zu,winlen=%zu,nfilter=%zu,stride=%zu,ncol=%zu",
+                     nin, winlen, nfilter, sizes[i][3], sizes[i][4]);
+            const double ncol_out = (double)((sizes[i][4] + sizes[i][3] - 1) / sizes[i][3]);
+            run_benchmark("convolution", size, bench_convolution, &s,
+                          2.0 * nin * winlen * nfilter * ncol_out, "flop");
+        }
+        s.X = free_scrappie_matrix(s.X);
+        s.W = free_scrappie_matrix(s.W);
+        s.b = free_scrappie_matrix(s.b);
+        s.C = free_scrappie_matrix(s.C);
+    }
+}
+
+
+struct activation_state {
+    void (*fun)(float *, size_t);
+    scrappie_matrix x;
+    scrappie_matrix orig;
+};
+
+static void bench_activation(void * state){
+    struct activation_state * s = state;
+    //  Copy so repeated calls see the same input
+    memcpy(s->x->data.f, s->orig->data.f, s->orig->nr * sizeof(float));
+    s->fun(s->x->data.f, s->x->nr);
+}
+
+static void time_activations(void){
+    const struct {
+        const char * name;
+        void (*fun)(float *, size_t);
+        float lower, upper;
+    } activations[] = {
+        {"tanhf_array_inplace", tanhf_array_inplace, -5.0f, 5.0f},
+        {"expf_array_inplace", expf_array_inplace, -20.0f, 5.0f},
+        {"logf_array_inplace", logf_array_inplace, 1e-5f, 10.0f},
+        {"logisticf_array_inplace", logisticf_array_inplace, -5.0f, 5.0f},
+        {"eluf_array_inplace", eluf_array_inplace, -5.0f, 5.0f}
+    };
+    const size_t sizes[] = {4096, 262144};
+    for(size_t a=0 ; a < sizeof(activations) / sizeof(activations[0]) ; a++){
+        if(!bench_selected(activations[a].name)){
+            continue;
+        }
+        for(size_t i=0 ; i < sizeof(sizes) / sizeof(sizes[0]) ; i++){
+            const size_t n = sizes[i];
+            //  Single column so the array is aligned and its length a multiple of four
+            struct activation_state s = {activations[a].fun, make_scrappie_matrix(n, 1),
+                                         random_matrix(n, 1, activations[a].lower, activations[a].upper)};
+            if(NULL != s.x && NULL != s.orig){
+                char size[64];
+                snprintf(size, sizeof(size), "n=%zu", n);
+                run_benchmark(activations[a].name, size, bench_activation, &s, n, "element");
+            }
+            s.x = free_scrappie_matrix(s.x);
+            s.orig = free_scrappie_matrix(s.orig);
+        }
+    }
+}
+
+
+struct decode_state {
+    scrappie_matrix post;
+    int * path;
+};
+
+static void bench_decode_crf(void * state){
+    struct decode_state * s = state;
+    (void)decode_crf(s->post, s->path);
+}
+
+static void bench_posterior_crf(void * state){
+    struct decode_state * s = state;
+    scrappie_matrix post = posterior_crf(s->post);
+    post = free_scrappie_matrix(post);
+}
+
+static void bench_decode_transducer(void * state){
+    struct decode_state * s = state;
+    (void)decode_transducer(s->post, 0.0f, 0.0f, 2.0f, s->path, false);
+}
+
+static void time_decoding(void){
+    const size_t nblock[] = {1000, 10000};
+    char size[64];
+    for(size_t i=0 ; i < sizeof(nblock) / sizeof(nblock[0]) ; i++){
+        if(bench_selected("decode_crf") || bench_selected("posterior_crf")){
+            //  Transitions between five states, as rnnrf_r94
+            struct decode_state s = {random_log_probabilities(25, nblock[i]), calloc(nblock[i] + 1, sizeof(int))};
+            snprintf(size, sizeof(size), "nstate=5,nblock=%zu", nblock[i]);
+            if(NULL != s.post && NULL != s.path){
+                if(bench_selected("decode_crf")){
+                    run_benchmark("decode_crf", size, bench_decode_crf, &s, nblock[i], "block");
+                }
+                if(bench_selected("posterior_crf")){
+                    run_benchmark("posterior_crf", size, bench_posterior_crf, &s, nblock[i], "block");
+                }
+            }
+            s.post = free_scrappie_matrix(s.post);
+            free(s.path);
+        }
+        if(bench_selected("decode_transducer")){
+            //  Stay and 1024 histories, as the 5-mer transducer models
+            struct decode_state s = {random_log_probabilities(1025, nblock[i]), calloc(nblock[i] + 1, sizeof(int))};
+            snprintf(size, sizeof(size), "nstate=1025,nblock=%zu", nblock[i]);
+            if(NULL != s.post && NULL != s.path){
+                run_benchmark("decode_transducer", size, bench_decode_transducer, &s, nblock[i], "block");
+            }
+            s.post = free_scrappie_matrix(s.post);
+            free(s.path);
+        }
+    }
+}
+
+
+struct squiggle_state {
+    raw_table signal;
+    scrappie_matrix params;
+    int32_t * path;
+};
+
+static void bench_squiggle_match_viterbi(void * state){
+    struct squiggle_state * s = state;
+    //  Defaults of scrappie mappy
+    (void)squiggle_match_viterbi(s->signal, 1.0f, s->params, 0.0f, 2.0f, 5000.0f, 5.0f, s->path);
+}
+
+static void time_squiggle_match(void){
+    if(!bench_selected("squiggle_match_viterbi")){
+        return;
+    }
+    //  Length of signal and of sequence
+    const size_t sizes[][2] = {{2000, 200}, {10000, 1000}};
+    for(size_t i=0 ; i < sizeof(sizes) / sizeof(sizes[0]) ; i++){
+        int * seq = calloc(sizes[i][1], sizeof(int));
+        struct squiggle_state s = {random_signal(sizes[i][0]), NULL, calloc(sizes[i][0], sizeof(int32_t))};
+        if(NULL != seq){
+            for(size_t j=0 ; j < sizes[i][1] ; j++){
+                seq[j] = rand() % 4;
+            }
+            s.params = squiggle_r94(seq, sizes[i][1], true);
+        }
+        if(NULL != s.signal.raw && NULL != s.params && NULL != s.path){
+            char size[64];
+            snprintf(size, sizeof(size), "nsample=%zu,npos=%zu", sizes[i][0], sizes[i][1]);
+            run_benchmark("squiggle_match_viterbi", size, bench_squiggle_match_viterbi, &s,
+                          (double)sizes[i][0] * sizes[i][1], "cell");
+        }
+        free(seq);
+        free(s.signal.raw);
+        s.params = free_scrappie_matrix(s.params);
+        free(s.path);
+    }
+}
+
+
+static void bench_detect_events(void * state){
+    const raw_table * signal = state;
+    event_table et = detect_events(*signal, event_detection_defaults);
+    free(et.event);
+}
+
+static void time_event_detection(void){
+    if(!bench_selected("detect_events")){
+        return;
+    }
+    const size_t sizes[] = {10000, 100000};
+    for(size_t i=0 ; i < sizeof(sizes) / sizeof(sizes[0]) ; i++){
+        raw_table signal = random_signal(sizes[i]);
+        if(NULL != signal.raw){
+            char size[64];
+            snprintf(size, sizeof(size), "nsample=%zu", sizes[i]);
+            run_benchmark("detect_events", size, bench_detect_events, &signal, sizes[i], "sample");
+        }
+        free(signal.raw);
+    }
+}
+
+
+struct basecall_state {
+    raw_table * reads;
+    size_t nread;
+    enum raw_model_type model;
+    size_t nsample;
+    size_t nbase;
+};
+
+/**  Basecall read as scrappie raw or scrappie events would with default options
+ *
+ *   @returns Length of basecall
+ **/
+static size_t basecall_read(raw_table rt, enum raw_model_type model){
+    //  Signal is trimmed and normalised as a view, so is left as loaded for repeated calls
+    raw_table view = trim_raw_view(rt, 200, 10, 100, 0.0f);
+    if(view.start >= view.end){
+        return 0;
+    }
+
+    size_t nbase = 0;
+
+    scrappie_matrix post = NULL;
+    event_table et = {0};
+    if(SCRAPPIE_MODEL_INVALID == model){
+        et = detect_events(view, event_detection_defaults);
+        post = (NULL != et.event) ? nanonet_posterior(et, 1e-5f, 1.0f, 1.0f, true) : NULL;
+    } else {
+        view = medmad_normalise_raw(view);
+        post = get_posterior_function(model)(view, 1e-5f, 1.0f, 1.0f, true);
+    }
+    if(NULL != post){
+        const size_t nblock = post->nc;
+        int * path = calloc(nblock + 1, sizeof(int));
+        int * pos = calloc(nblock + 1, sizeof(int));
+        char * basecall = NULL;
+        if(NULL != path && NULL != pos){
+            if(SCRAPPIE_MODEL_RNNRF_R9_4 == model){
+                (void)decode_crf(post, path);
+                basecall = crfpath_to_basecall(path, nblock, pos);
+            } else {
+                (void)decode_transducer(post, 0.0f, 0.0f, 2.0f, path, false);
+                basecall = overlapper(path, nblock + 1, post->nr - 1, pos);
+            }
+        }
+        nbase = (NULL != basecall) ? strlen(basecall) : 0;
+        free(basecall);
+        free(pos);
+        free(path);
+        post = free_scrappie_matrix(post);
+    }
+    free(et.event);
+    return nbase;
+}
+
+static void bench_basecall(void * state){
+    struct basecall_state * s = state;
+    s->nsample = 0;
+    s->nbase = 0;
+    for(size_t i=0 ; i < s->nread ; i++){
+        s->nbase += basecall_read(s->reads[i], s->model);
+        s->nsample += s->reads[i].n;
+    }
+}
+
+static void time_basecalling(void){
+    glob_t globbuf = {0};
+    char ** files = args.files;
+    size_t nfile = args.nfile;
+    if(0 == nfile){
+        if(0 == glob("reads/*.fast5", 0, NULL, &globbuf)){
+            files = globbuf.gl_pathv;
+            nfile = globbuf.gl_pathc;
+        }
+    }
+    if(0 == nfile){
+        warnx("No reads to basecall, give fast5 files or run from directory containing reads/");
+        globfree(&globbuf);
+        return;
+    }
+
+    raw_table * reads = calloc(nfile, sizeof(raw_table));
+    size_t nread = 0;
+    size_t nsample = 0;
+    for(size_t i=0 ; NULL != reads && i < nfile ; i++){
+        raw_table rt = read_raw(files[i], true);
+        if(NULL == rt.raw){
+            warnx("Failed to read raw signal from \"%s\"", files[i]);
+            continue;
+        }
+        free(rt.uuid);
+        rt.uuid = NULL;
+        nsample += rt.n;
+        reads[nread++] = rt;
+    }
+    globfree(&globbuf);
+
+    char * models = calloc(strlen(args.models) + 1, sizeof(char));
+    if(NULL != models){
+        strcpy(models, args.models);
+    }
+    for(char * model = strtok(models, ","); NULL != models && NULL != model && nread > 0 ; model = strtok(NULL, ",")){
+        char name[64];
+        snprintf(name, sizeof(name), "basecall_%s", model);
+        if(!bench_selected(name)){
+            continue;
+        }
+        const bool events = (0 == strcmp(model, "events"));
+        const enum raw_model_type model_type = events ? SCRAPPIE_MODEL_INVALID : get_raw_model(model);
+        if(!events && SCRAPPIE_MODEL_INVALID == model_type){
+            warnx("Unrecognised model \"%s\"", model);
+            continue;
+        }
+        struct basecall_state s = {reads, nread, model_type, 0, 0};
+        bench_basecall(&s);
+        char size[64];
+        snprintf(size, sizeof(size), "nread=%zu,nsample=%zu,nbase=%zu", nread, nsample, s.nbase);
+        run_benchmark(name, size, bench_basecall, &s, nsample, "sample");
+    }
+    free(models);
+
+    for(size_t i=0 ; i < nread ; i++){
+        free(reads[i].raw);
+    }
+    free(reads);
+}
+
+
+int main(int argc, char * argv[]){
+    argp_parse(&argp, argc, argv, 0, 0, NULL);
+    if(NULL == args.output){
+        args.output = stdout;
+    }
+    scrappie_math_set(args.math);
+    if(NULL != args.simd){
+        const enum scrappie_simd level = scrappie_simd_from_string(args.simd);
+        if(SCRAPPIE_SIMD_INVALID == level){
+            errx(EXIT_FAILURE, "Unrecognised vector instructions \"%s\"", args.simd);
+        }
+        scrappie_simd_set(level);
+    }
+    if(args.counters && !open_counters()){
+        errx(EXIT_FAILURE, "Hardware counters not available");
+    }
+    srand(1);
+
+    if(BENCH_TSV == args.format){
+        fputs("benchmark\tsize\trepeats\tbest_seconds\tmedian_seconds\trate\tunit", args.output);
+        for(size_t i=0 ; i < BENCH_NCOUNTER ; i++){
+            fprintf(args.output, "\t%s", counter_names[i]);
+        }
+        fputs("\tcommit\n", args.output);
+    }
+    if(args.kernels){
+        if(bench_selected("affine_map")){
+            time_affine_map();
+        }
+        time_recurrent_steps();
+        if(bench_selected("gru_sparse")){
+            time_sparse_recurrent();
+        }
+        if(bench_selected("convolution")){
+            time_convolution();
+        }
+        time_activations();
+        time_decoding();
+        time_squiggle_match();
+        time_event_detection();
+    }
+    if(args.basecall){
+        time_basecalling();
+    }
+
+    close_counters();
+    if(stdout != args.output){
+        fclose(args.output);
+    }
+    return EXIT_SUCCESS;
+}
@@ -2,20 +2,49 @@
 #include "scrappie_stdlib.h"
 #include "util.h"
 
-raw_table trim_and_segment_raw(raw_table rt, size_t trim_start, size_t trim_end, size_t varseg_chunk, float varseg_thresh) {
-    RETURN_NULL_IF(NULL == rt.raw, (raw_table){0});
+/**  Trim a read, as a view of its signal
+ *
+ *  Only the start and end of the read are moved; the signal is neither
+ *  copied nor modified and its memory remains owned by the caller.
+ *
+ *  @param rt Structure containing raw signal
+ *
+ *  @return Structure with the trimmed range of the signal, empty (start equal to end)
+ *  if all of the signal is trimmed or on failure
+ **/
+raw_table trim_raw_view(raw_table rt, size_t trim_start, size_t trim_end, size_t varseg_chunk, float varseg_thresh) {
+    raw_table empty = rt;
+    empty.end = empty.start;
+    RETURN_NULL_IF(NULL == rt.raw && NULL == rt.sample, empty);
+    if (rt.end - rt.start < varseg_chunk) {
+        //  Too short to segment, so all would be trimmed
+        return empty;
+    }
 
     rt = trim_raw_by_mad(rt, varseg_chunk, varseg_thresh);
-    RETURN_NULL_IF(NULL == rt.raw, (raw_table){0});
+    RETURN_NULL_IF(rt.start >= rt.end, empty);
 
     rt.start = (rt.n - rt.start) > trim_start ? rt.start + trim_start : rt.n;
     rt.end = (rt.end > trim_end) ? rt.end - trim_end : 0;
 
+    return (rt.start < rt.end) ? rt : empty;
+}
+
+/**  Trim a read, taking ownership of its signal
+ *
+ *  As trim_raw_view but the signal is freed when all of it is trimmed.
+ *
+ *  @return Structure with the trimmed range of the signal, or with NULL
+ *  signal if all of the signal is trimmed
+ **/
+raw_table trim_and_segment_raw(raw_table rt, size_t trim_start, size_t trim_end, size_t varseg_chunk, float varseg_thresh) {
+    RETURN_NULL_IF(NULL == rt.raw && NULL == rt.sample, (raw_table){0});
+    rt = trim_raw_view(rt, trim_start, trim_end, varseg_chunk, varseg_thresh);
     if (rt.start >= rt.end) {
         free(rt.raw);
+        free(rt.sample);
         return (raw_table){0};
     }
-
     return rt;
 }
 
@@ -30,11 +59,16 @@ raw_table trim_and_segment_raw(raw_table rt, size_t trim_start, size_t trim_end,
  *  the end of the trimming: the threshhold is chosen so it is unlikely to be
  *  exceeded in the leader but commonly exceeded in the main read.
  *
+ *  Chunks of native signals are scaled to pA as they are copied into the
+ *  workspace, exactly as when the read is loaded as floats, so ties between
+ *  the MADs of chunks are broken the same way.
+ *
  *  @param rt Structure containing raw signal
  *  @param chunk_size Size of non-overlapping chunks
  *  @param perc  The quantile to be calculated to use for threshholding
  *
- *  @return A range structure containing new start and end for read
+ *  @return A range structure containing new start and end for read, empty
+ *  (start equal to end) on failure.  The signal is not modified.
  **/
 raw_table trim_raw_by_mad(raw_table rt, size_t chunk_size, float perc) {
     assert(chunk_size > 1);
@@ -45,11 +79,32 @@ raw_table trim_raw_by_mad(raw_table rt, size_t chunk_size, float perc) {
     // Truncation of end to be consistent with Sloika
     rt.end = nchunk * chunk_size;
 
-    float *madarr = malloc(nchunk * sizeof(float));
-    RETURN_NULL_IF(NULL == madarr, (raw_table){0});
+    raw_table empty = rt;
+    empty.end = empty.start;
+    float *madarr = calloc(nchunk, sizeof(float));
+    RETURN_NULL_IF(NULL == madarr, empty);
+    // Workspace for MAD, shared between chunks, followed by space for native chunks
+    const bool native = (NULL == rt.raw);
+    float *scratch = malloc((native ? 2 : 1) * chunk_size * sizeof(float));
+    if (NULL == scratch) {
+        free(madarr);
+        return empty;
+    }
     for (size_t i = 0; i < nchunk; i++) {
-        madarr[i] = madf(rt.raw + rt.start + i * chunk_size, chunk_size, NULL);
+        float med, mad;
+        const size_t offset = rt.start + i * chunk_size;
+        const float *chunk = rt.raw + offset;
+        if (native) {
+            float *native_chunk = scratch + chunk_size;
+            for (size_t j = 0; j < chunk_size; j++) {
+                native_chunk[j] = (rt.sample[offset + j] + rt.offset) * rt.unit;
+            }
+            chunk = native_chunk;
+        }
+        medmadf(chunk, chunk_size, scratch, &med, &mad);
+        madarr[i] = mad;
     }
+    free(scratch);
     quantilef(madarr, nchunk, &perc, 1);
 
     const float thresh = perc;
@@ -71,3 +126,31 @@ raw_table trim_raw_by_mad(raw_table rt, size_t chunk_size, float perc) {
 
     return rt;
 }
+
+/**  Normalise trimmed signal of read by its median and MAD
+ *
+ *  The signal is not touched: its median and MAD are folded into the scaling
+ *  of the read, so the normalised signal is only formed as features are
+ *  created.  Float signals are marked as scaled; the median and MAD of a
+ *  native signal are found from its ADC values.
+ *
+ *  @param rt Structure containing trimmed signal
+ *
+ *  @return Structure containing normalised signal
+ **/
+raw_table medmad_normalise_raw(raw_table rt) {
+    const size_t nsample = rt.end - rt.start;
+    float med, mad;
+    if (NULL != rt.raw) {
+        medmadf(rt.raw + rt.start, nsample, NULL, &med, &mad);
+        rt.scaled = true;
+    } else if (NULL != rt.sample) {
+        medmad_int16(rt.sample + rt.start, nsample, &med, &mad);
+    } else {
+        return rt;
+    }
+    rt.offset = -med;
+    //  As medmad_normalise_array, a single sample normalises to zero
+    rt.unit = (1 == nsample) ? 0.0f : 1.0f / mad;
+    return rt;
+}
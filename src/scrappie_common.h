@@ -4,7 +4,9 @@
 
 #include "scrappie_structures.h"
 
+raw_table trim_raw_view(raw_table rt, size_t trim_start, size_t trim_end, size_t varseg_chunk, float varseg_thresh);
 raw_table trim_and_segment_raw(raw_table rt, size_t trim_start, size_t trim_end, size_t varseg_chunk, float varseg_thresh);
 raw_table trim_raw_by_mad(raw_table rt, size_t chunk_size, float proportion);
+raw_table medmad_normalise_raw(raw_table rt);
 
 #endif /* SCRAPPIE_COMMON_H */
@@ -0,0 +1,371 @@
+#include <libgen.h>
+#include <math.h>
+
+#if defined(_OPENMP)
+#    include <omp.h>
+#endif
+#include <stdio.h>
+#include <sys/types.h>
+
+#include "conv_decode.h"
+#include "fast5_interface.h"
+#include "networks.h"
+#include "scrappie_common.h"
+#include "scrappie_licence.h"
+#include "scrappie_pipeline.h"
+#include "scrappie_stdlib.h"
+#include "util.h"
+
+// Doesn't play nice with other headers, include last
+#include <argp.h>
+
+struct _conv_decode_info {
+    float score;
+    raw_table rt;
+    size_t nblock;
+    //  Decoded message as string of '0' and '1'
+    char *msg;
+};
+
+extern const char *argp_program_version;
+extern const char *argp_program_bug_address;
+static char doc[] = "Scrappie convdecode -- decode convolutionally coded messages from raw signal";
+static char args_doc[] = "fast5 [fast5 ...]";
+static struct argp_option options[] = {
+    {"msg-len", 1, "nbits", 0, "Length of message encoded in each read (required)"},
+    {"band", 2, "npos", 0, "Positions either side of expected position to search (0 is full trellis)"},
+    {"mem", 4, "m", 0, "Memory of convolutional code"},
+    {"gen", 6, "G0,G1", 0, "Generator polynomials of code in octal (default for memory if not given)"},
+    {"init", 9, "bits", 0, "Initial state of code in binary"},
+    {"bcjr", 16, 0, 0, "Decode by iterating soft decoding of CRF and code rather than searching their joint trellis"},
+    {"no-bcjr", 17, 0, OPTION_ALIAS, "Decode by search of joint trellis of CRF and code"},
+    {"iterations", 18, "niter", 0, "Iterations between CRF and code when decoding with --bcjr"},
+    {"sync", 12, "bits", 0, "Sync marker bits, or \"none\""},
+    {"period", 13, "nbits", 0, "Period of sync markers"},
+    {"limit", 'l', "nreads", 0, "Maximum number of reads to decode (0 is unlimited)"},
+    {"min_prob", 'm', "probability", 0, "Minimum bound on probability of match"},
+    {"output", 'o', "filename", 0, "Write to file rather than stdout"},
+    {"prefix", 'p', "string", 0, "Prefix to append to name of each read"},
+    {"temperature1", 7, "factor", 0, "Temperature for softmax weights"},
+    {"temperature2", 8, "factor", 0, "Temperature for softmax bias"},
+    {"trim", 't', "start:end", 0, "Number of samples to trim, as start:end"},
+    {"licence", 10, 0, 0, "Print licensing information"},
+    {"license", 11, 0, OPTION_ALIAS, "Print licensing information"},
+    {"segmentation", 3, "chunk:percentile", 0, "Chunk size and percentile for variance based segmentation"},
+    {"uuid", 14, 0, 0, "Output UUID"},
+    {"no-uuid", 15, 0, OPTION_ALIAS, "Output read file"},
+    {"prefetch", 19, "nreads", 0, "Number of reads to load ahead of decoding on a separate thread (0 is off)"},
+#if defined(_OPENMP)
+    {"threads", '#', "nparallel", 0, "Number of reads to decode in parallel"},
+#endif
+    {0}
+};
+
+struct arguments {
+    int msg_len;
+    int band;
+    bool bcjr;
+    int niter;
+    int mem;
+    bool gen_given;
+    uint32_t gen[2];
+    uint32_t initial_state;
+    char * sync_marker;
+    int sync_period;
+    int limit;
+    float min_prob;
+    FILE * output;
+    char * prefix;
+    float temperature1;
+    float temperature2;
+    int trim_start;
+    int trim_end;
+    int varseg_chunk;
+    float varseg_thresh;
+    char ** files;
+    bool uuid;
+    int prefetch;
+};
+
+//  Default code is that of shubham/viterbi_nanopore.cpp
+static struct arguments args = {
+    .msg_len = 0,
+    .band = 0,
+    .bcjr = false,
+    .niter = 3,
+    .mem = 8,
+    .gen_given = false,
+    .gen = {0, 0},
+    .initial_state = 0,
+    .sync_marker = "110",
+    .sync_period = 9,
+    .limit = 0,
+    .min_prob = 1e-5f,
+    .output = NULL,
+    .prefix = "",
+    .temperature1 = 1.0f,
+    .temperature2 = 1.0f,
+    .trim_start = 200,
+    .trim_end = 10,
+    .varseg_chunk = 100,
+    .varseg_thresh = 0.0f,
+    .files = NULL,
+    .uuid = false,
+    .prefetch = 0
+};
+
+static error_t parse_arg(int key, char * arg, struct  argp_state * state){
+    int ret = 0;
+    char * next_tok = NULL;
+
+    switch(key){
+    case 1:
+        args.msg_len = atoi(arg);
+        assert(args.msg_len > 0);
+        break;
+    case 2:
+        args.band = atoi(arg);
+        assert(args.band >= 0);
+        break;
+    case 4:
+        args.mem = atoi(arg);
+        break;
+    case 16:
+        args.bcjr = true;
+        break;
+    case 17:
+        args.bcjr = false;
+        break;
+    case 18:
+        args.niter = atoi(arg);
+        assert(args.niter > 0);
+        break;
+    case 6:
+        args.gen[0] = strtoul(strtok(arg, ","), NULL, 8);
+        next_tok = strtok(NULL, ",");
+        if(NULL == next_tok){
+            errx(EXIT_FAILURE, "--gen should be of form G0,G1");
+        }
+        args.gen[1] = strtoul(next_tok, NULL, 8);
+        args.gen_given = true;
+        break;
+    case 9:
+        args.initial_state = strtoul(arg, NULL, 2);
+        break;
+    case 12:
+        args.sync_marker = (0 == strcmp(arg, "none")) ? NULL : arg;
+        break;
+    case 13:
+        args.sync_period = atoi(arg);
+        assert(args.sync_period > 0);
+        break;
+    case 'l':
+        args.limit = atoi(arg);
+        assert(args.limit > 0);
+        break;
+    case 'm':
+        args.min_prob = atof(arg);
+        assert(isfinite(args.min_prob) && args.min_prob >= 0.0);
+        break;
+    case 'o':
+        args.output = fopen(arg, "w");
+        if(NULL == args.output){
+            errx(EXIT_FAILURE, "Failed to open \"%s\" for output.", arg);
+        }
+        break;
+    case 'p':
+        args.prefix = arg;
+        break;
+    case 't':
+        args.trim_start = atoi(strtok(arg, ":"));
+        next_tok = strtok(NULL, ":");
+        if(NULL != next_tok){
+            args.trim_end = atoi(next_tok);
+        } else {
+            args.trim_end = args.trim_start;
+        }
+        assert(args.trim_start >= 0);
+        assert(args.trim_end >= 0);
+        break;
+    case 3:
+        args.varseg_chunk = atoi(strtok(arg, ":"));
+        next_tok = strtok(NULL, ":");
+        if(NULL == next_tok){
+            errx(EXIT_FAILURE, "--segmentation should be of form chunk:percentile");
+        }
+        args.varseg_thresh = atof(next_tok) / 100.0;
+        assert(args.varseg_chunk >= 0);
+        assert(args.varseg_thresh > 0.0 && args.varseg_thresh < 1.0);
+        break;
+    case 7:
+        args.temperature1 = atof(arg);
+        assert(isfinite(args.temperature1) && args.temperature1 > 0.0f);
+        break;
+    case 8:
+        args.temperature2 = atof(arg);
+        assert(isfinite(args.temperature2) && args.temperature2 > 0.0f);
+        break;
+    case 10:
+    case 11:
+        ret = fputs(scrappie_licence_text, stdout);
+        exit((EOF != ret) ? EXIT_SUCCESS : EXIT_FAILURE);
+        break;
+    case 14:
+        args.uuid = true;
+        break;
+    case 15:
+        args.uuid = false;
+        break;
+    case 19:
+        args.prefetch = atoi(arg);
+        assert(args.prefetch >= 0);
+        break;
+    #if defined(_OPENMP)
+    case '#':
+        {
+            int nthread = atoi(arg);
+            const int maxthread = omp_get_max_threads();
+            if(nthread < 1){nthread = 1;}
+            if(nthread > maxthread){nthread = maxthread;}
+            omp_set_num_threads(nthread);
+        }
+        break;
+    #endif
+
+    case ARGP_KEY_NO_ARGS:
+        argp_usage (state);
+        break;
+
+    case ARGP_KEY_ARG:
+        args.files = &state->argv[state->next - 1];
+        state->next = state->argc;
+        break;
+
+    case ARGP_KEY_END:
+        if(args.msg_len <= 0){
+            argp_error(state, "--msg-len must be given");
+        }
+        break;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+
+static struct argp argp = {options, parse_arg, args_doc, doc};
+
+static conv_code * code = NULL;
+
+/**  Calculate CRF transitions of read and decode message from them
+ *
+ *   The transition matrix is passed directly to the decoder and freed once
+ *   the message has been decoded.
+ **/
+static struct _conv_decode_info calculate_conv_decode(raw_table rt){
+    RETURN_NULL_IF(NULL == rt.raw, (struct _conv_decode_info){0});
+    posterior_function_ptr calcpost = get_posterior_function(SCRAPPIE_MODEL_RNNRF_R9_4);
+
+    rt = trim_and_segment_raw(rt, args.trim_start, args.trim_end, args.varseg_chunk, args.varseg_thresh);
+    RETURN_NULL_IF(NULL == rt.raw, (struct _conv_decode_info){0});
+
+    medmad_normalise_array(rt.raw + rt.start, rt.end - rt.start);
+    scrappie_matrix trans = calcpost(rt, args.min_prob, args.temperature1, args.temperature2, true);
+    bool * msg = calloc(args.msg_len, sizeof(bool));
+    char * msgstr = calloc(args.msg_len + 1, sizeof(char));
+    if (NULL == trans || NULL == msg || NULL == msgstr) {
+        free(msgstr);
+        free(msg);
+        trans = free_scrappie_matrix(trans);
+        free(rt.raw);
+        free(rt.uuid);
+        return (struct _conv_decode_info){0};
+    }
+    const size_t nblock = trans->nc;
+
+    float score = args.bcjr ? decode_post_conv_bcjr(trans, code, args.msg_len, args.band, args.niter, msg)
+                            : decode_post_conv(trans, code, args.msg_len, args.band, msg);
+    trans = free_scrappie_matrix(trans);
+    if (isnan(score)) {
+        free(msgstr);
+        free(msg);
+        free(rt.raw);
+        free(rt.uuid);
+        return (struct _conv_decode_info){0};
+    }
+    for (int i = 0; i < args.msg_len; i++) {
+        msgstr[i] = msg[i] ? '1' : '0';
+    }
+    free(msg);
+
+    return (struct _conv_decode_info) {score, rt, nblock, msgstr};
+}
+
+static int fprintf_conv_fasta(FILE * fp, const char * uuid, const char *readname, bool uuid_primary,
+                              const char * prefix, const struct _conv_decode_info res) {
+    return fprintf(fp,
+                   ">%s%s  { \"filename\" : \"%s\", \"uuid\" : \"%s\", \"normalised_score\" : %f,  \"nblock\" : %zu,  \"msg_len\" : %d, \"nsample\" : %zu, \"trim\" : [ %zu, %zu ] }\n%s\n",
+                   prefix, uuid_primary ? uuid : readname, readname, uuid, -res.score / res.nblock, res.nblock,
+                   args.msg_len, res.rt.n, res.rt.start, res.rt.end, res.msg);
+}
+
+/** Decode a single read for the read pipeline
+ *
+ *  @returns Pointer to decoding information, to be freed by
+ *  output_conv_decode, or NULL on failure
+ **/
+static void * process_conv_decode(char * filename, raw_table rt){
+    struct _conv_decode_info res = calculate_conv_decode(rt);
+    if(NULL == res.msg){
+        warnx("No message decoded for %s", filename);
+        return NULL;
+    }
+    struct _conv_decode_info * pres = malloc(sizeof(*pres));
+    if(NULL == pres){
+        warnx("Failed to allocate memory for decoding of %s", filename);
+        free(res.rt.raw);
+        free(res.rt.uuid);
+        free(res.msg);
+        return NULL;
+    }
+    *pres = res;
+    return pres;
+}
+
+static void output_conv_decode(char * filename, void * result){
+    struct _conv_decode_info * res = result;
+    fprintf_conv_fasta(args.output, res->rt.uuid, basename(filename), args.uuid, args.prefix, *res);
+    free(res->rt.raw);
+    free(res->rt.uuid);
+    free(res->msg);
+    free(res);
+}
+
+int main_convdecode(int argc, char * argv[]){
+    argp_parse(&argp, argc, argv, 0, 0, NULL);
+    if(NULL == args.output){
+        args.output = stdout;
+    }
+
+    code = make_conv_code(args.mem, args.gen_given ? args.gen : NULL, args.initial_state,
+                          args.sync_marker, args.sync_period);
+    if(NULL == code){
+        errx(EXIT_FAILURE, "Invalid convolutional code");
+    }
+
+    //  Reads are decoded in parallel and results written in input order,
+    //  as for scrappie raw
+    read_pipeline_param pipeline = read_pipeline_defaults;
+    pipeline.limit = args.limit > 0 ? args.limit : 0;
+    pipeline.nprefetch = args.prefetch;
+    (void)run_read_pipeline(args.files, pipeline, process_conv_decode, output_conv_decode);
+
+    code = free_conv_code(code);
+
+    if(stdout != args.output){
+        fclose(args.output);
+    }
+
+    return EXIT_SUCCESS;
+}
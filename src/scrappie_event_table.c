@@ -9,6 +9,7 @@
 #include <strings.h>
 #include <sys/types.h>
 
+#include "column_file.h"
 #include "decode.h"
 #include "event_detection.h"
 #include "fast5_interface.h"
@@ -33,6 +34,7 @@ extern const char *argp_program_bug_address;
 static char doc[] = "Scrappie basecaller -- basecall via events";
 static char args_doc[] = "fast5 [fast5 ...]";
 static struct argp_option options[] = {
+    {"format", 'f', "format", 0, "Format of event tables: tsv (default) or columns, the binary column file"},
     {"output", 'o', "filename", 0, "Write to file rather than stdout"},
     {"trim", 't', "start:end", 0, "Number of events to trim, as start:end"},
     {"licence", 10, 0, 0, "Print licensing information"},
@@ -43,7 +45,10 @@ static struct argp_option options[] = {
 };
 
 
+enum format { FORMAT_TSV, FORMAT_COLUMNS };
+
 struct arguments {
+    enum format outformat;
     FILE * output;
     int trim_start;
     int trim_end;
@@ -53,6 +58,7 @@ struct arguments {
 };
 
 static struct arguments args = {
+    .outformat = FORMAT_TSV,
     .output = NULL,
     .trim_start = 200,
     .trim_end = 10,
@@ -65,8 +71,17 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state) {
     int ret = 0;
     char *next_tok = NULL;
     switch (key) {
+    case 'f':
+        if (0 == strcasecmp(arg, "tsv")) {
+            args.outformat = FORMAT_TSV;
+        } else if (0 == strcasecmp(arg, "columns")) {
+            args.outformat = FORMAT_COLUMNS;
+        } else {
+            errx(EXIT_FAILURE, "Unrecognised format");
+        }
+        break;
     case 'o':
-        args.output = fopen(arg, "w");
+        args.output = fopen(arg, "wb");
         if(NULL == args.output){
             errx(EXIT_FAILURE, "Failed to open \"%s\" for output.", arg);
         }
@@ -148,6 +163,15 @@ int main_event_table(int argc, char *argv[]) {
             warnx("No events returned for %s", args.files[fn]);
             continue;
         }
+        if(FORMAT_COLUMNS == args.outformat){
+            output_buffer buf = {NULL, 0, 0};
+            if(!column_batch_append_events(&buf, args.files[fn], et, false) || !write_output_buffer(args.output, &buf)){
+                warnx("Failed to write events of %s", args.files[fn]);
+            }
+            output_buffer_release(&buf);
+            free(et.event);
+            continue;
+        }
         fprintf(args.output, "# %s\n", args.files[fn]);
         fprintf(args.output, "#event\tstart\tmean\tstdv\tdwell\n");
         for(size_t i=0 ; i < et.n ; i++){
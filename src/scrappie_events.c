@@ -1,6 +1,4 @@
-#include <dirent.h>
 #include <fcntl.h>
-#include <glob.h>
 #include <libgen.h>
 #include <math.h>
 #if defined(_OPENMP)
@@ -12,12 +10,16 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "column_file.h"
 #include "decode.h"
 #include "event_detection.h"
 #include "fast5_interface.h"
 #include "networks.h"
 #include "scrappie_common.h"
 #include "scrappie_licence.h"
+#include "scrappie_pipeline.h"
+#include "scrappie_profile.h"
+#include "scrappie_simd.h"
 #include "scrappie_stdlib.h"
 #include "util.h"
 
@@ -30,6 +32,12 @@ struct _bs {
     size_t nev;
     char *bases;
     event_table et;
+    encoded_events dump;
+    //  Samples of trimmed signal and seconds taken to call read
+    size_t nsample;
+    double seconds;
+    //  Batch of annotated events, formatted by the worker that called the read
+    output_buffer columns;
 };
 
 static const struct _bs _bs_null = {
@@ -76,6 +84,23 @@ static struct argp_option options[] = {
      "Chunk size and percentile for variance based segmentation"},
     {"uuid", 15, 0, 0, "Output UUID"},
     {"no-uuid", 16, 0, OPTION_ALIAS, "Output read file"},
+    {"low-memory", 17, 0, 0, "Checkpoint Viterbi traceback to reduce memory use"},
+    {"no-low-memory", 18, 0, OPTION_ALIAS, "Store full Viterbi traceback"},
+    {"prefetch", 19, "nreads", 0,
+     "Number of reads to load ahead of basecalling on a separate thread (0 is off)"},
+    {"beam", 20, "score", 0,
+     "Prune transducer states scoring more than this below the best (0 is off)"},
+    {"max-states", 21, "nstate", 0,
+     "Maximum transducer states kept per event when pruning (0 is unlimited)"},
+    {"fixed-point", 22, 0, 0, "Decode using 16-bit fixed-point scores"},
+    {"no-fixed-point", 23, 0, OPTION_ALIAS, "Decode using floating point scores"},
+    {"model-file", 24, "filename", 0,
+     "Read weights of model from binary model file rather than using those compiled in"},
+    {"math", 25, "tier", 0, "Accuracy of activation functions: accurate (default), fast or fastest"},
+    {"profile", 26, "filename", 0, "Write time spent on each stage of basecalling each read to file"},
+    {"profile-format", 27, "format", 0, "Format of profile: tsv (default) or json"},
+    {"profile-interval", 28, "seconds", 0, "Seconds between reports of throughput to stderr when profiling (0 is only at end)"},
+    {"columns", 29, "filename", 0, "Write annotated events and summary of each read to binary column file"},
     {0}
 };
 
@@ -102,6 +127,17 @@ struct arguments {
     int compression_level;
     int compression_chunk_size;
     bool uuid;
+    bool low_memory;
+    int prefetch;
+    float beam;
+    int max_states;
+    bool fixed_point;
+    char *model_file;
+    enum scrappie_math math;
+    char *profile;
+    enum scrappie_profile_format profile_format;
+    float profile_interval;
+    char *columns;
     char **files;
 };
 
@@ -126,6 +162,17 @@ static struct arguments args = {
     .compression_level = 1,
     .compression_chunk_size = 200,
     .uuid = false,
+    .low_memory = false,
+    .prefetch = 0,
+    .beam = 0.0f,
+    .max_states = 0,
+    .fixed_point = false,
+    .model_file = NULL,
+    .math = SCRAPPIE_MATH_ACCURATE,
+    .profile = NULL,
+    .profile_format = SCRAPPIE_PROFILE_TSV,
+    .profile_interval = 10.0f,
+    .columns = NULL,
     .files = NULL
 };
 
@@ -235,6 +282,55 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state) {
     case 16:
         args.uuid = false;
         break;
+    case 17:
+        args.low_memory = true;
+        break;
+    case 18:
+        args.low_memory = false;
+        break;
+    case 19:
+        args.prefetch = atoi(arg);
+        assert(args.prefetch >= 0);
+        break;
+    case 20:
+        args.beam = atof(arg);
+        assert(args.beam >= 0.0f);
+        break;
+    case 21:
+        args.max_states = atoi(arg);
+        assert(args.max_states >= 0);
+        break;
+    case 22:
+        args.fixed_point = true;
+        break;
+    case 23:
+        args.fixed_point = false;
+        break;
+    case 24:
+        args.model_file = arg;
+        break;
+    case 25:
+        args.math = scrappie_math_from_string(arg);
+        if (SCRAPPIE_MATH_INVALID == args.math) {
+            errx(EXIT_FAILURE, "Invalid accuracy tier \"%s\"", arg);
+        }
+        break;
+    case 26:
+        args.profile = arg;
+        break;
+    case 27:
+        args.profile_format = scrappie_profile_format_from_string(arg);
+        if (SCRAPPIE_PROFILE_INVALID == args.profile_format) {
+            errx(EXIT_FAILURE, "Invalid profile format \"%s\"", arg);
+        }
+        break;
+    case 28:
+        args.profile_interval = atof(arg);
+        assert(args.profile_interval >= 0.0f);
+        break;
+    case 29:
+        args.columns = arg;
+        break;
 #if defined(_OPENMP)
     case '#':
         {
@@ -268,21 +364,25 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state) {
 
 static struct argp argp = { options, parse_arg, args_doc, doc };
 
-static struct _bs calculate_post(char *filename) {
-    RETURN_NULL_IF(NULL == filename, (struct _bs){0};);
-    raw_table rt = read_raw(filename, true);
+static struct _bs calculate_post(raw_table rt) {
     RETURN_NULL_IF(NULL == rt.raw, (struct _bs){0};);
+    scrappie_profile_begin(SCRAPPIE_STAGE_TRIM);
     rt = trim_and_segment_raw(rt, args.trim_start, args.trim_end, args.varseg_chunk, args.varseg_thresh);
+    scrappie_profile_end(SCRAPPIE_STAGE_TRIM);
     RETURN_NULL_IF(NULL == rt.raw, (struct _bs){0};);
 
+    scrappie_profile_begin(SCRAPPIE_STAGE_EVENTS);
     event_table et = detect_events(rt, event_detection_defaults);
+    scrappie_profile_end(SCRAPPIE_STAGE_EVENTS);
     if (NULL == et.event) {
         free(rt.raw);
         free(rt.uuid);
         return _bs_null;
     }
 
+    scrappie_profile_begin(SCRAPPIE_STAGE_NETWORK);
     scrappie_matrix post = nanonet_posterior(et, args.min_prob, args.temperature1, args.temperature2, true);
+    scrappie_profile_end(SCRAPPIE_STAGE_NETWORK);
     if (NULL == post) {
         free(et.event);
         free(rt.raw);
@@ -293,11 +393,24 @@ static struct _bs calculate_post(char *filename) {
     const size_t nstate = post->nr;
 
     int *history_state = calloc(nev + 1, sizeof(int));
-    float score =
-        decode_transducer(post, args.stay_pen, args.skip_pen, args.local_pen, history_state, args.use_slip);
+    float score = NAN;
+    scrappie_profile_begin(SCRAPPIE_STAGE_DECODE);
+    if (args.beam > 0.0f || args.max_states > 0) {
+        //  Pruned traceback is sparse so is used in place of checkpointing
+        const float beam = (args.beam > 0.0f) ? args.beam : INFINITY;
+        score = decode_transducer_pruned(post, args.stay_pen, args.skip_pen, args.local_pen, beam,
+                                         args.max_states, history_state, args.use_slip);
+    } else if (args.fixed_point) {
+        score = decode_transducer_fixed(post, args.stay_pen, args.skip_pen, args.local_pen, history_state, args.use_slip);
+    } else {
+        score = args.low_memory
+            ? decode_transducer_checkpointed(post, args.stay_pen, args.skip_pen, args.local_pen, history_state, args.use_slip)
+            : decode_transducer(post, args.stay_pen, args.skip_pen, args.local_pen, history_state, args.use_slip);
+    }
     post = free_scrappie_matrix(post);
     int *pos = calloc(nev + 1, sizeof(int));
     char *basecall = overlapper(history_state, nev, nstate - 1, pos);
+    scrappie_profile_end(SCRAPPIE_STAGE_DECODE);
     const size_t basecall_len = strlen(basecall);
 
 
@@ -311,9 +424,11 @@ static struct _bs calculate_post(char *filename) {
         }
 
         if (args.dwell_correction) {
+            scrappie_profile_begin(SCRAPPIE_STAGE_HOMOPOLYMER);
             char *newbasecall =
                 homopolymer_dwell_correction(et, history_state, nstate,
                                              basecall_len);
+            scrappie_profile_end(SCRAPPIE_STAGE_HOMOPOLYMER);
             if (NULL != newbasecall) {
                 free(basecall);
                 basecall = newbasecall;
@@ -324,9 +439,11 @@ static struct _bs calculate_post(char *filename) {
     free(pos);
     free(history_state);
     free(rt.raw);
+    const size_t nbase = strlen(basecall);
+    scrappie_profile_count(rt.n, nbase);
 
     return (struct _bs) {
-    rt.uuid, score, nev, basecall, et};
+    rt.uuid, score, nev, basecall, et, .nsample = rt.n};
 }
 
 
@@ -343,16 +460,96 @@ static int fprintf_sam(FILE * fp, const char * uuid, const char *readname, bool
                    uuid_primary ? uuid : readname, res.bases);
 }
 
+static hid_t hdf5out = -1;
+static FILE * columns_fh = NULL;
+static read_summary_table summary = {0};
+
+/** Basecall a single read for the read pipeline
+ *
+ *  @returns Pointer to basecall information, to be freed by output_events_read,
+ *  or NULL on failure
+ **/
+static void *process_events_read(char *filename, raw_table rt) {
+    const double start = scrappie_profile_now();
+    struct _bs res = calculate_post(rt);
+    res.seconds = scrappie_profile_now() - start;
+    if (NULL == res.bases) {
+        warnx("No basecall returned for %s", filename);
+        return NULL;
+    }
+    struct _bs *pres = malloc(sizeof(*pres));
+    if (NULL == pres) {
+        warnx("Failed to allocate memory for basecall of %s", filename);
+        free(res.et.event);
+        free(res.bases);
+        free(res.uuid);
+        return NULL;
+    }
+    if (hdf5out >= 0) {
+        //  Compress on worker thread so output only has to store the chunks
+        res.dump = encode_annotated_events(res.et, args.compression_chunk_size,
+                                           args.compression_level);
+    }
+    if (NULL != columns_fh && !column_batch_append_events(&res.columns, basename(filename), res.et, true)) {
+        warnx("Failed to format events of %s", filename);
+    }
+    *pres = res;
+    return pres;
+}
+
+static void output_events_read(char *filename, void *result) {
+    struct _bs *res = result;
+    switch (args.outformat) {
+    case FORMAT_FASTA:
+        fprintf_fasta(args.output, res->uuid, basename(filename),
+                      args.uuid, args.prefix, *res);
+        break;
+    case FORMAT_SAM:
+        fprintf_sam(args.output, res->uuid, basename(filename),
+                    args.uuid, args.prefix, *res);
+        break;
+    default:
+        errx(EXIT_FAILURE, "Unrecognised output format");
+    }
+
+    if (hdf5out >= 0) {
+        if (res->dump.nchunk > 0) {
+            write_encoded_events(hdf5out, basename(filename), res->dump);
+        } else {
+            write_annotated_events(hdf5out, basename(filename), res->et,
+                                   args.compression_chunk_size,
+                                   args.compression_level);
+        }
+    }
+    if (NULL != columns_fh) {
+        const float score = -res->score / res->nev;
+        if (!write_output_buffer(columns_fh, &res->columns)
+            || !read_summary_add(&summary, columns_fh, basename(filename), res->uuid, res->nsample,
+                                 res->nev, strlen(res->bases), score, res->seconds)) {
+            warnx("Failed to write columns of %s", filename);
+        }
+    }
+    output_buffer_release(&res->columns);
+    free_encoded_events(&res->dump);
+    free(res->et.event);
+    free(res->bases);
+    free(res->uuid);
+    free(res);
+}
+
 int main_events(int argc, char *argv[]) {
-#if defined(_OPENMP)
-    omp_set_nested(1);
-#endif
     argp_parse(&argp, argc, argv, 0, 0, NULL);
+    if(args.fixed_point && (args.beam > 0.0f || args.max_states > 0)){
+        errx(EXIT_FAILURE, "--fixed-point cannot be combined with --beam or --max-states");
+    }
+    if(NULL != args.model_file && !load_model_weights(args.model_file, "events")){
+        errx(EXIT_FAILURE, "Failed to load model file \"%s\"", args.model_file);
+    }
+    scrappie_math_set(args.math);
     if(NULL == args.output){
         args.output = stdout;
     }
 
-    hid_t hdf5out = -1;
     if (NULL != args.dump) {
         int fd = open(args.dump, O_CREAT | O_WRONLY | O_EXCL, S_IRUSR | S_IWUSR);
         if(fd < 0){
@@ -368,92 +565,42 @@ int main_events(int argc, char *argv[]) {
         }
     }
 
-    size_t nfile = 0;
-    for (; args.files[nfile]; nfile++) ;
-
-    size_t reads_started = 0;
-    const size_t reads_limit = args.limit;
-#pragma omp parallel for schedule(dynamic)
-    for (size_t fn = 0; fn < nfile; fn++) {
-        if (reads_limit > 0 && reads_started >= reads_limit) {
-            continue;
+    if (NULL != args.columns) {
+        columns_fh = fopen(args.columns, "wb");
+        if (NULL == columns_fh) {
+            errx(EXIT_FAILURE, "Failed to open \"%s\" for output.", args.columns);
         }
-        //  Iterate through all files and directories on command line.
-        //  Nested parallelism for OpenMP is enabled so worker threads are used for all open
-        // directories but this less than optimal since many directories may be open at once.
-        glob_t globbuf;
-        {
-            // Find all files matching commandline argument using system glob
-            const size_t rootlen = strlen(args.files[fn]);
-            char *globpath = calloc(rootlen + 9, sizeof(char));
-            memcpy(globpath, args.files[fn], rootlen * sizeof(char));
-            {
-                DIR *dirp = opendir(args.files[fn]);
-                if (NULL != dirp) {
-                    // If filename is a directory, add wildcard to find all fast5 files within it
-                    memcpy(globpath + rootlen, "/*.fast5", 8 * sizeof(char));
-                    closedir(dirp);
-                }
-            }
-            int globret = glob(globpath, GLOB_NOSORT, NULL, &globbuf);
-            free(globpath);
-            if (0 != globret) {
-                if(GLOB_NOMATCH == globret){
-                    warnx("File or directory \"%s\" does not exist or no fast5 files found.", args.files[fn]);
-                }
-                globfree(&globbuf);
-                continue;
-            }
-        }
-#pragma omp parallel for schedule(dynamic)
-        for (size_t fn2 = 0; fn2 < globbuf.gl_pathc; fn2++) {
-            if (reads_limit > 0 && reads_started >= reads_limit) {
-                continue;
-            }
-#pragma omp atomic
-            reads_started += 1;
-
-            char *filename = globbuf.gl_pathv[fn2];
-            struct _bs res = calculate_post(filename);
-            if (NULL == res.bases) {
-                warnx("No basecall returned for %s", filename);
-                continue;
-            }
-#pragma omp critical(sequence_output)
-            {
-                switch (args.outformat) {
-                case FORMAT_FASTA:
-                    fprintf_fasta(args.output, res.uuid, basename(filename),
-                                  args.uuid, args.prefix, res);
-                    break;
-                case FORMAT_SAM:
-                    fprintf_sam(args.output, res.uuid, basename(filename),
-                                args.uuid, args.prefix, res);
-                    break;
-                default:
-                    errx(EXIT_FAILURE, "Unrecognised output format");
-                }
-
-                if (hdf5out >= 0) {
-                    write_annotated_events(hdf5out, basename(filename), res.et,
-                                           args.compression_chunk_size,
-                                           args.compression_level);
-                }
-            }
-            free(res.et.event);
-            free(res.bases);
-            free(res.uuid);
-        }
-        globfree(&globbuf);
     }
 
+    if (NULL != args.profile && !scrappie_profile_open(args.profile, args.profile_format, args.profile_interval)) {
+        errx(EXIT_FAILURE, "Failed to open \"%s\" for profile.", args.profile);
+    }
+
+    //  Iterate through all files and directories on command line.  Idle threads take
+    //  the next read so work is shared evenly, and results are written in input order.
+    read_pipeline_param pipeline = read_pipeline_defaults;
+    pipeline.limit = args.limit > 0 ? args.limit : 0;
+    pipeline.nprefetch = args.prefetch;
+    (void)run_read_pipeline(args.files, pipeline, process_events_read, output_events_read);
+    scrappie_profile_close();
+
     if (hdf5out >= 0) {
         H5Fclose(hdf5out);
+        hdf5out = -1;
+    }
+    if (NULL != columns_fh) {
+        if (!read_summary_flush(&summary, columns_fh)) {
+            warnx("Failed to write summaries of reads");
+        }
+        read_summary_release(&summary);
+        fclose(columns_fh);
+        columns_fh = NULL;
     }
 
     if(stdout != args.output){
         fclose(args.output);
     }
+    unload_model_weights();
 
     return EXIT_SUCCESS;
 }
@@ -77,6 +77,26 @@ int main_help(int argc, char *argv[]) {
         help_options[0] = argv[1];
         ret = main_event_table(2, help_options);
         break;
+    case SCRAPPIE_MODE_CONVDECODE:
+        help_options[0] = argv[1];
+        ret = main_convdecode(2, help_options);
+        break;
+    case SCRAPPIE_MODE_SIMULATE:
+        help_options[0] = argv[1];
+        ret = main_simulate(2, help_options);
+        break;
+    case SCRAPPIE_MODE_SERVE:
+        help_options[0] = argv[1];
+        ret = main_serve(2, help_options);
+        break;
+    case SCRAPPIE_MODE_REDECODE:
+        help_options[0] = argv[1];
+        ret = main_redecode(2, help_options);
+        break;
+    case SCRAPPIE_MODE_PACK:
+        help_options[0] = argv[1];
+        ret = main_pack(2, help_options);
+        break;
     default:
         ret = EXIT_FAILURE;
         warnx("Unrecognised subcommand %s\n", argv[1]);
@@ -1,4 +1,7 @@
 #include <math.h>
+#if defined(_OPENMP)
+#    include <omp.h>
+#endif
 #include <stdio.h>
 #include <strings.h>
 #include <sys/types.h>
@@ -6,10 +9,13 @@
 #include "decode.h"
 #include "fast5_interface.h"
 #include "networks.h"
+#include "packed_reference.h"
 #include "scrappie_common.h"
 #include "scrappie_licence.h"
+#include "scrappie_pipeline.h"
 #include "scrappie_seq_helpers.h"
 #include "scrappie_stdlib.h"
+#include "squiggle_cache.h"
 #include "util.h"
 
 
@@ -20,7 +26,7 @@
 extern const char *argp_program_version;
 extern const char *argp_program_bug_address;
 static char doc[] = "Scrappie squiggler";
-static char args_doc[] = "fasta fast5";
+static char args_doc[] = "fasta fast5 [fast5 ...]";
 static struct argp_option options[] = {
     {"model", '1', "name", 0, "Squiggle model to use: \"squiggle_r94\", \"squiggle_r10\""},
     {"backprob", 'b', "probability", 0, "Probability of backwards movement"},
@@ -34,6 +40,14 @@ static struct argp_option options[] = {
     {"trim", 't', "start:end", 0, "Number of samples to trim, as start:end"},
     {"licence", 10, 0, 0, "Print licensing information"},
     {"license", 11, 0, OPTION_ALIAS, "Print licensing information"},
+    {"best", 12, 0, 0, "Only report the best scoring reference for each read"},
+    {"all", 13, 0, OPTION_ALIAS, "Report mapping to every reference"},
+    {"prefetch", 14, "nreads", 0, "Number of reads to load ahead of mapping on a separate thread (0 is off)"},
+    {"squiggle-cache", 15, "directory", 0, "Directory in which to cache predicted squiggles"},
+    {"band", 16, "width", 0, "Width of band of squiggle positions the mapping may occupy (0 is unbanded)"},
+#if defined(_OPENMP)
+    {"threads", '#', "nparallel", 0, "Number of reads to map in parallel"},
+#endif
     {0}
 };
 
@@ -51,9 +65,13 @@ struct arguments {
     int trim_end;
     int varseg_chunk;
     float varseg_thresh;
+    bool best;
+    int prefetch;
+    char * squiggle_cache;
+    int band;
 
     char * fasta_file;
-    char * fast5_file;
+    char ** files;
 };
 
 static struct arguments args = {
@@ -69,9 +87,13 @@ static struct arguments args = {
     .trim_end = 10,
     .varseg_chunk = 100,
     .varseg_thresh = 0.0f,
+    .best = false,
+    .prefetch = 0,
+    .squiggle_cache = NULL,
+    .band = 0,
 
     .fasta_file = NULL,
-    .fast5_file = NULL
+    .files = NULL
 };
 
 static error_t parse_arg(int key, char *arg, struct argp_state *state) {
@@ -141,6 +163,36 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state) {
         ret = fputs(scrappie_licence_text, stdout);
         exit((EOF != ret) ? EXIT_SUCCESS : EXIT_FAILURE);
         break;
+    case 12:
+        args.best = true;
+        break;
+    case 13:
+        args.best = false;
+        break;
+    case 14:
+        args.prefetch = atoi(arg);
+        assert(args.prefetch >= 0);
+        break;
+    case 15:
+        args.squiggle_cache = arg;
+        break;
+    case 16:
+        args.band = atoi(arg);
+        if(args.band < 0){
+            errx(EXIT_FAILURE, "Band width must be non-negative, got %d", args.band);
+        }
+        break;
+    #if defined(_OPENMP)
+    case '#':
+        {
+            int nthread = atoi(arg);
+            const int maxthread = omp_get_max_threads();
+            if(nthread < 1){nthread = 1;}
+            if(nthread > maxthread){nthread = maxthread;}
+            omp_set_num_threads(nthread);
+        }
+        break;
+    #endif
 
     case ARGP_KEY_NO_ARGS:
         argp_usage(state);
@@ -151,7 +203,7 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state) {
         if(NULL == state->argv[state->next]){
             errx(EXIT_FAILURE, "fast5 file is a required argument");
         }
-        args.fast5_file = state->argv[state->next];
+        args.files = &state->argv[state->next];
         state->next = state->argc;
         break;
 
@@ -164,21 +216,124 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state) {
 static struct argp argp = { options, parse_arg, args_doc, doc };
 
 
-static scrappie_matrix sequence_to_squiggle(char const * base_seq, size_t n, bool rescale, enum squiggle_model_type squiggle_model){
-    RETURN_NULL_IF(NULL == base_seq, NULL);
+//  References and their predicted squiggles, calculated once for all reads.  Each
+//  squiggle is either predicted or mapped from the cache and is owned by one of
+//  predicted or cached.
+static packed_reference * refs = NULL;
+static const_scrappie_matrix * squiggles = NULL;
+static scrappie_matrix * predicted = NULL;
+static cached_squiggle ** cached = NULL;
+static size_t nref = 0;
+
+
+struct _mappy_result {
+    raw_table rt;
+    //  Number of mappings reported, either one per reference or just the best
+    size_t nmap;
+    //  Index of reference, score and path for each mapping [nmap] and [nmap * rt.n]
+    size_t * ref;
+    float * score;
+    int * path;
+};
+
+static struct _mappy_result * free_mappy_result(struct _mappy_result * res){
+    if(NULL != res){
+        free(res->path);
+        free(res->score);
+        free(res->ref);
+        free(res->rt.raw);
+        free(res);
+    }
+    return NULL;
+}
 
-    int * sequence = encode_bases_to_integers(base_seq, n, 1);
-    RETURN_NULL_IF(NULL == sequence, NULL);
 
-    squiggle_function_ptr squiggle_function = get_squiggle_function(squiggle_model);
+/**  Map the signal of a single read to the squiggle of every reference
+ *
+ *   @returns Pointer to mappings, to be freed by output_mappy_read, or NULL on failure
+ **/
+static void * process_mappy_read(char * filename, raw_table rt){
+    if(NULL == rt.raw){
+        warnx("Failed to open \"%s\" for input.", filename);
+        free(rt.uuid);
+        return NULL;
+    }
+    char * uuid = rt.uuid;
+    rt = trim_and_segment_raw(rt, args.trim_start, args.trim_end, args.varseg_chunk, args.varseg_thresh);
+    free(uuid);
+    if(NULL == rt.raw){
+        warnx("Failed to trim signal of \"%s\".", filename);
+        return NULL;
+    }
+    rt.uuid = NULL;
+    medmad_normalise_array(rt.raw + rt.start, rt.end - rt.start);
 
-    scrappie_matrix squiggle = squiggle_function(sequence, n, rescale);
-    free(sequence);
+    const size_t nmap = args.best ? 1 : nref;
+    struct _mappy_result * res = calloc(1, sizeof(*res));
+    int * path = calloc(rt.n, sizeof(int32_t));
+    if(NULL != res){
+        res->rt = rt;
+        res->ref = calloc(nmap, sizeof(size_t));
+        res->score = calloc(nmap, sizeof(float));
+        res->path = calloc(nmap * rt.n, sizeof(int));
+    }
+    if(NULL == res || NULL == res->ref || NULL == res->score || NULL == res->path || NULL == path){
+        warnx("Failed to allocate memory for mapping of \"%s\".", filename);
+        free(path);
+        if(NULL == res){
+            free(rt.raw);
+        }
+        return free_mappy_result(res);
+    }
 
-    return squiggle;
+    for(size_t r=0 ; r < nref ; r++){
+        const float score = squiggle_match_viterbi_banded(rt, args.rate, squiggles[r], args.backprob,
+                                                          args.localpen, args.skippen, args.minscore,
+                                                          args.band, path);
+        //  Scores are log-likelihoods, so best is largest
+        const size_t m = args.best ? 0 : res->nmap;
+        if(args.best && res->nmap > 0 && !(score > res->score[0])){
+            continue;
+        }
+        res->ref[m] = r;
+        res->score[m] = score;
+        memcpy(res->path + m * rt.n, path, rt.n * sizeof(int));
+        if(m == res->nmap){
+            res->nmap += 1;
+        }
+    }
+    free(path);
+
+    return res;
 }
 
 
+static void output_mappy_read(char * filename, void * result){
+    struct _mappy_result * res = result;
+    const raw_table rt = res->rt;
+    for(size_t m=0 ; m < res->nmap ; m++){
+        const size_t r = res->ref[m];
+        const_scrappie_matrix squiggle = squiggles[r];
+        int const * path = res->path + m * rt.n;
+        fprintf(args.output, "# %s%s to %s  (score = %f)\n", args.prefix, filename, packed_reference_name(refs, r),
+                res->score[m]);
+        fprintf(args.output, "idx\tsignal\tpos\tbase\tcurrent\tsd\tdwell\n");
+        for(size_t i=0 ; i < rt.n ; i++){
+            const int32_t pos = path[i];
+            if(pos >= 0){
+                const size_t offset = pos * squiggle->stride;
+                fprintf(args.output, "%zu\t%3.6f\t%d\t%c\t%3.6f\t%3.6f\t%3.6f\n", i, rt.raw[i], pos, "ACGT"[packed_reference_base(refs, r, pos)],
+                        squiggle->data.f[offset + 0],
+                        expf(squiggle->data.f[offset + 1]),
+                        expf(-squiggle->data.f[offset + 2]));
+            } else {
+                fprintf(args.output, "%zu\t%3.6f\t%d\tN\tnan\tnan\tnan\n", i, (i >= rt.start && i < rt.end) ? rt.raw[i] : NAN, pos);
+            }
+        }
+    }
+    res = free_mappy_result(res);
+}
+
 
 int main_mappy(int argc, char *argv[]) {
     argp_parse(&argp, argc, argv, 0, 0, NULL);
@@ -187,53 +342,93 @@ int main_mappy(int argc, char *argv[]) {
     }
 
 
-    //  Open sequence file
-    scrappie_seq_t seq = read_sequence_from_fasta(args.fasta_file);
-    if(NULL == seq.seq){
+    //  Open packed reference, or pack sequences of fasta file, and predict squiggle of every reference once
+    refs = open_packed_reference(args.fasta_file);
+    if(NULL == refs){
         warnx("Failed to open \"%s\" for input.\n", args.fasta_file);
         return EXIT_FAILURE;
     }
-
-    //  Read raw signal and normalise
-    raw_table rt = read_raw(args.fast5_file, true);
-    rt = trim_and_segment_raw(rt, args.trim_start, args.trim_end, args.varseg_chunk, args.varseg_thresh);
-    if(NULL == rt.raw){
-        warnx("Failed to open \"%s\" for input and trim signal.\n", args.fasta_file);
+    nref = refs->nseq;
+    squiggles = calloc(nref, sizeof(const_scrappie_matrix));
+    predicted = calloc(nref, sizeof(scrappie_matrix));
+    cached = calloc(nref, sizeof(cached_squiggle *));
+    bool * uncached = calloc(nref, sizeof(bool));
+    if(NULL == squiggles || NULL == predicted || NULL == cached || NULL == uncached){
+        warnx("Memory allocation failure");
+        free(uncached);
+        free(cached);
+        free(predicted);
+        free(squiggles);
+        refs = free_packed_reference(refs);
         return EXIT_FAILURE;
     }
-    medmad_normalise_array(rt.raw + rt.start, rt.end - rt.start);
-
-
-
-    scrappie_matrix squiggle = sequence_to_squiggle(seq.seq, seq.n, false, args.model_type);
-    if(NULL != squiggle){
-        int * path = calloc(rt.n, sizeof(int32_t));
-        if(NULL != path){
-            float score = squiggle_match_viterbi(rt, args.rate, squiggle, args.backprob,
-                                                 args.localpen, args.skippen, args.minscore,
-                                                 path);
-            fprintf(args.output, "# %s to %s  (score = %f)\n", args.fast5_file, args.fasta_file, score);
-            fprintf(args.output, "idx\tsignal\tpos\tbase\tcurrent\tsd\tdwell\n");
-            for(size_t i=0 ; i < rt.n ; i++){
-                const int32_t pos = path[i];
-                if(pos >= 0){
-                    const size_t offset = pos * squiggle->stride;
-                    fprintf(args.output, "%zu\t%3.6f\t%d\t%c\t%3.6f\t%3.6f\t%3.6f\n", i, rt.raw[i], pos, seq.seq[pos],
-                            squiggle->data.f[offset + 0],
-                            expf(squiggle->data.f[offset + 1]),
-                            expf(-squiggle->data.f[offset + 2]));
-                } else {
-                    fprintf(args.output, "%zu\t%3.6f\t%d\tN\tnan\tnan\tnan\n", i, (i >= rt.start && i < rt.end) ? rt.raw[i] : NAN, pos);
-                }
+    const char * model_name = squiggle_model_string(args.model_type);
+    //  The cache is keyed by bases, so these are only unpacked when it is used
+    char * bases = NULL;
+    if(NULL != args.squiggle_cache){
+        bases = calloc(packed_reference_max_length(refs) + 1, sizeof(char));
+        if(NULL == bases){
+            errx(EXIT_FAILURE, "Memory allocation failure");
+        }
+    }
+    for(size_t r=0 ; r < nref ; r++){
+        if(NULL != args.squiggle_cache){
+            (void)packed_reference_bases(refs, r, bases);
+            cached[r] = load_cached_squiggle(args.squiggle_cache, model_name, bases,
+                                             packed_reference_length(refs, r), false);
+            if(NULL != cached[r]){
+                squiggles[r] = &cached[r]->squiggle;
+                continue;
             }
-            free(path);
         }
-        squiggle = free_scrappie_matrix(squiggle);
+        uncached[r] = true;
     }
+    //  References not in the cache are predicted together, in packed batches
+    scrappie_matrix * batch = packed_reference_to_squiggle_batch(refs, uncached, false, args.model_type);
+    if(NULL == batch){
+        errx(EXIT_FAILURE, "Failed to predict squiggles of references");
+    }
+    for(size_t r=0 ; r < nref ; r++){
+        if(NULL != cached[r]){
+            continue;
+        }
+        predicted[r] = batch[r];
+        if(NULL == predicted[r]){
+            errx(EXIT_FAILURE, "Failed to predict squiggle for reference \"%s\"", packed_reference_name(refs, r));
+        }
+        if(NULL != args.squiggle_cache){
+            (void)packed_reference_bases(refs, r, bases);
+            (void)write_cached_squiggle(args.squiggle_cache, model_name, bases, packed_reference_length(refs, r),
+                                        false, predicted[r]);
+        }
+        squiggles[r] = predicted[r];
+    }
+    free(batch);
+    free(bases);
+    free(uncached);
+
+    //  Reads are shared between threads and mappings written in input order
+    read_pipeline_param pipeline = read_pipeline_defaults;
+    pipeline.nprefetch = args.prefetch;
+    (void)run_read_pipeline(args.files, pipeline, process_mappy_read, output_mappy_read);
 
 
-    free(seq.seq);
-    free(seq.name);
+    for(size_t r=0 ; r < nref ; r++){
+        predicted[r] = free_scrappie_matrix(predicted[r]);
+        cached[r] = free_cached_squiggle(cached[r]);
+    }
+    free(cached);
+    cached = NULL;
+    free(predicted);
+    predicted = NULL;
+    free(squiggles);
+    squiggles = NULL;
+    refs = free_packed_reference(refs);
+    nref = 0;
+
+    if(stdout != args.output){
+        fclose(args.output);
+    }
 
     return EXIT_SUCCESS;
 }
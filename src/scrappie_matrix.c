@@ -1,3 +1,5 @@
+// Needed for MAP_ANONYMOUS, MAP_HUGETLB and madvise
+#define _DEFAULT_SOURCE
 #ifdef __APPLE__
 #    include <Accelerate/Accelerate.h>
 #else
@@ -5,9 +7,285 @@
 #endif
 #include <float.h>
 #include <math.h>
+#include <string.h>
+#include <sys/mman.h>
 #include "scrappie_matrix.h"
+#include "scrappie_numa.h"
+#include "scrappie_simd.h"
 #include "scrappie_stdlib.h"
 
+/**  Huge pages for the memory of large matrices
+ *
+ *   The posteriors, tracebacks and states of long reads span many pages, so
+ *   their memory may be backed by 2 MB pages rather than ordinary 4 kB pages
+ *   to reduce misses of the TLB.  Memory of matrices of at least the
+ *   threshold size is rounded up to a whole number of huge pages and either
+ *   aligned to a huge page and advised as a candidate for transparent huge
+ *   pages, or mapped from the pool of explicit huge pages reserved by the
+ *   system administrator (vm.nr_hugepages).  When the pool is exhausted,
+ *   explicit allocations fall back to transparent huge pages.
+ *
+ *   The policy applies to the whole process and should be chosen before any
+ *   threads allocate matrices.  Memory is released correctly whatever the
+ *   policy at the time it was allocated.
+ **/
+#define SCRAPPIE_HUGEPAGE ((size_t)2 << 20)
+static enum scrappie_hugepage_policy hugepage_policy = SCRAPPIE_HUGEPAGE_OFF;
+static size_t hugepage_threshold = SCRAPPIE_HUGEPAGE_THRESHOLD;
+static int hugepage_explicit_failures = 0;
+
+
+/**  Set the huge page policy for the memory of matrices
+ *
+ *   @param policy  Backing of large matrices
+ *   @param threshold  Size in bytes of the smallest matrix backed by huge pages
+ *
+ *   @returns Previous policy
+ **/
+enum scrappie_hugepage_policy scrappie_hugepage_set_policy(enum scrappie_hugepage_policy policy,
+                                                           size_t threshold) {
+    const enum scrappie_hugepage_policy previous = hugepage_policy;
+    hugepage_policy = policy;
+    hugepage_threshold = threshold;
+    return previous;
+}
+
+
+/**  Parse name of huge page policy, as given on the command line
+ *
+ *   @returns Policy, or SCRAPPIE_HUGEPAGE_INVALID if name is not recognised
+ **/
+enum scrappie_hugepage_policy scrappie_hugepage_from_string(const char * name) {
+    RETURN_NULL_IF(NULL == name, SCRAPPIE_HUGEPAGE_INVALID);
+    if (0 == strcmp(name, "off")) {
+        return SCRAPPIE_HUGEPAGE_OFF;
+    }
+    if (0 == strcmp(name, "transparent")) {
+        return SCRAPPIE_HUGEPAGE_TRANSPARENT;
+    }
+    if (0 == strcmp(name, "explicit")) {
+        return SCRAPPIE_HUGEPAGE_EXPLICIT;
+    }
+    return SCRAPPIE_HUGEPAGE_INVALID;
+}
+
+
+/**  Header preceding the memory of each matrix
+ *
+ *   Sixteen bytes, so the memory that follows remains aligned for SSE.
+ **/
+typedef struct {
+    //  Bytes usable following header
+    size_t capacity;
+    //  Bytes mapped, including header, if explicit huge pages were mapped; otherwise 0
+    size_t nmapped;
+} block_header;
+#define BLOCK_HEADER_BYTES 16
+
+
+/**  Allocate memory for matrix, backed by huge pages as policy dictates
+ *
+ *   @param nbytes Size of memory required
+ *
+ *   @returns Pointer to memory, aligned to 16 bytes, or NULL on failure
+ **/
+static void * block_alloc(size_t nbytes) {
+    assert(sizeof(block_header) <= BLOCK_HEADER_BYTES);
+    void * ptr = NULL;
+    size_t nalloc = nbytes + BLOCK_HEADER_BYTES;
+    size_t nmapped = 0;
+    if (SCRAPPIE_HUGEPAGE_OFF != hugepage_policy && nbytes >= hugepage_threshold) {
+        nalloc = SCRAPPIE_HUGEPAGE * ((nalloc + SCRAPPIE_HUGEPAGE - 1) / SCRAPPIE_HUGEPAGE);
+#ifdef MAP_HUGETLB
+        if (SCRAPPIE_HUGEPAGE_EXPLICIT == hugepage_policy) {
+            ptr = mmap(NULL, nalloc, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (MAP_FAILED == ptr) {
+                ptr = NULL;
+                int nfailure;
+#pragma omp atomic capture
+                nfailure = hugepage_explicit_failures++;
+                if (0 == nfailure) {
+                    warnx("Failed to map explicit huge pages, using transparent huge pages instead.");
+                }
+            } else {
+                nmapped = nalloc;
+            }
+        }
+#endif
+        if (NULL == ptr) {
+            if (0 != scrappie_memalign(&ptr, SCRAPPIE_HUGEPAGE, nalloc)) {
+                return NULL;
+            }
+#ifdef MADV_HUGEPAGE
+            (void)madvise(ptr, nalloc, MADV_HUGEPAGE);
+#endif
+        }
+    } else if (0 != scrappie_memalign(&ptr, 16, nalloc)) {
+        return NULL;
+    }
+
+    block_header * header = ptr;
+    header->capacity = nalloc - BLOCK_HEADER_BYTES;
+    header->nmapped = nmapped;
+    return (char *)ptr + BLOCK_HEADER_BYTES;
+}
+
+
+static block_header * block_header_of(void * ptr) {
+    return (block_header *)((char *)ptr - BLOCK_HEADER_BYTES);
+}
+
+
+static void block_free(void * ptr) {
+    if (NULL == ptr) {
+        return;
+    }
+    block_header * header = block_header_of(ptr);
+    if (header->nmapped > 0) {
+        munmap(header, header->nmapped);
+    } else {
+        free(header);
+    }
+}
+
+
+/**  Per-thread workspace for matrix memory
+ *
+ *   When enabled, the memory of freed matrices is retained by the thread
+ *   that freed it and handed back out by subsequent allocations rather than
+ *   being returned to the system.  The layers of a network allocate and free
+ *   buffers of the same few shapes, for every read, so most allocations are
+ *   satisfied from the workspace without a call to the allocator or fresh
+ *   pages being faulted in.  Memory backed by huge pages is retained like
+ *   any other, so its pages are reused across reads.
+ **/
+#define SCRAPPIE_WORKSPACE_NBUF 16
+#define SCRAPPIE_WORKSPACE_MAXBYTES ((size_t)1 << 28)
+typedef struct {
+    bool enabled;
+    size_t nbuf;
+    size_t size[SCRAPPIE_WORKSPACE_NBUF];
+    void * buf[SCRAPPIE_WORKSPACE_NBUF];
+} scrappie_workspace;
+
+static __thread scrappie_workspace workspace = { 0 };
+
+
+/**  Enable or disable workspace for the calling thread
+ *
+ *   Disabling the workspace releases any memory held by it.
+ *
+ *   @param enable Whether to enable the workspace
+ *
+ *   @returns Previous state of workspace
+ **/
+bool scrappie_workspace_enable(bool enable) {
+    const bool previous = workspace.enabled;
+    workspace.enabled = enable;
+    if (!enable) {
+        scrappie_workspace_release();
+    }
+    return previous;
+}
+
+
+/**  Release all memory held by workspace of calling thread
+ *
+ *   Matrices still in use are unaffected.
+ **/
+void scrappie_workspace_release(void) {
+    for (size_t i = 0; i < workspace.nbuf; i++) {
+        block_free(workspace.buf[i]);
+        workspace.buf[i] = NULL;
+        workspace.size[i] = 0;
+    }
+    workspace.nbuf = 0;
+}
+
+
+/**  Number of bytes currently held by workspace of calling thread
+ **/
+size_t scrappie_workspace_size(void) {
+    size_t nbytes = 0;
+    for (size_t i = 0; i < workspace.nbuf; i++) {
+        nbytes += workspace.size[i];
+    }
+    return nbytes;
+}
+
+
+/**  Allocate aligned memory, from workspace if possible
+ *
+ *   The smallest retained buffer large enough is used.
+ *
+ *   @param nbytes Size of memory required
+ *
+ *   @returns Pointer to memory, aligned to 16 bytes, or NULL on failure
+ **/
+static void * workspace_alloc(size_t nbytes) {
+    if (workspace.enabled) {
+        size_t best = workspace.nbuf;
+        for (size_t i = 0; i < workspace.nbuf; i++) {
+            if (workspace.size[i] >= nbytes
+                && (best == workspace.nbuf || workspace.size[i] < workspace.size[best])) {
+                best = i;
+            }
+        }
+        if (best < workspace.nbuf) {
+            void * ptr = workspace.buf[best];
+            workspace.nbuf -= 1;
+            workspace.buf[best] = workspace.buf[workspace.nbuf];
+            workspace.size[best] = workspace.size[workspace.nbuf];
+            return ptr;
+        }
+    }
+
+    return block_alloc(nbytes);
+}
+
+
+/**  Free memory, retaining it in the workspace if enabled
+ *
+ *   The whole of the memory allocated is retained, which may be more than
+ *   the matrix freed used.  When the workspace is full, the smallest buffer
+ *   is released in preference to larger ones.  Memory that would take the
+ *   workspace over SCRAPPIE_WORKSPACE_MAXBYTES is released immediately.
+ *
+ *   @param ptr Memory allocated by workspace_alloc
+ **/
+static void workspace_free(void * ptr) {
+    if (NULL == ptr) {
+        return;
+    }
+    const size_t nbytes = block_header_of(ptr)->capacity;
+    if (!workspace.enabled || scrappie_workspace_size() + nbytes > SCRAPPIE_WORKSPACE_MAXBYTES) {
+        block_free(ptr);
+        return;
+    }
+
+    if (workspace.nbuf < SCRAPPIE_WORKSPACE_NBUF) {
+        workspace.buf[workspace.nbuf] = ptr;
+        workspace.size[workspace.nbuf] = nbytes;
+        workspace.nbuf += 1;
+        return;
+    }
+
+    size_t smallest = 0;
+    for (size_t i = 1; i < workspace.nbuf; i++) {
+        if (workspace.size[i] < workspace.size[smallest]) {
+            smallest = i;
+        }
+    }
+    if (workspace.size[smallest] < nbytes) {
+        block_free(workspace.buf[smallest]);
+        workspace.buf[smallest] = ptr;
+        workspace.size[smallest] = nbytes;
+    } else {
+        block_free(ptr);
+    }
+}
+
+
 scrappie_matrix make_scrappie_matrix(size_t nr, size_t nc) {
     assert(nr > 0);
     assert(nc > 0);
@@ -32,7 +310,8 @@ scrappie_matrix make_scrappie_matrix(size_t nr, size_t nc) {
         }
     }
 
-    if (0 != scrappie_memalign((void **)&mat->data.v, 16, nrq * nc * sizeof(__m128))) {
+    mat->data.v = workspace_alloc(nrq * nc * sizeof(__m128));
+    if (NULL == mat->data.v) {
         warnx("Error allocating memory in %s.\n", __func__);
         free(mat);
         return NULL;
@@ -42,7 +321,7 @@ scrappie_matrix make_scrappie_matrix(size_t nr, size_t nc) {
 }
 
 scrappie_matrix remake_scrappie_matrix(scrappie_matrix M, size_t nr, size_t nc) {
-    // Could be made more efficient when there is sufficent memory already allocated
+    // When the workspace is enabled, memory freed here is reused by the new matrix
     if ((NULL == M) || (M->nr != nr) || (M->nc != nc)) {
         M = free_scrappie_matrix(M);
         M = make_scrappie_matrix(nr, nc);
@@ -50,6 +329,31 @@ scrappie_matrix remake_scrappie_matrix(scrappie_matrix M, size_t nr, size_t nc)
     return M;
 }
 
+/**  Matrix of a new shape, in the memory of M when it is large enough
+ *
+ *   Unlike remake_scrappie_matrix, the memory of M is kept whenever it
+ *   holds the new shape, whatever shape M had, so one buffer may hold
+ *   matrices of different shapes in turn.  M must have been made by
+ *   make_scrappie_matrix, not be a view of another matrix.
+ *
+ *   @returns Matrix, zeroed as a new one would be, or NULL on failure
+ **/
+scrappie_matrix reshape_scrappie_matrix(scrappie_matrix M, size_t nr, size_t nc) {
+    assert(nr > 0);
+    assert(nc > 0);
+    const size_t nrq = (nr + 3) / 4;
+    if (NULL == M || block_header_of(M->data.v)->capacity < nrq * nc * sizeof(__m128)) {
+        M = free_scrappie_matrix(M);
+        return make_scrappie_matrix(nr, nc);
+    }
+    M->nr = nr;
+    M->nrq = nrq;
+    M->nc = nc;
+    M->stride = 4 * nrq;
+    memset(M->data.v, 0, nrq * nc * sizeof(__m128));
+    return M;
+}
+
 scrappie_matrix copy_scrappie_matrix(const_scrappie_matrix M){
     RETURN_NULL_IF(NULL == M, NULL);
     scrappie_matrix C = make_scrappie_matrix(M->nr, M->nc);
@@ -96,6 +400,102 @@ float * array_from_scrappie_matrix(const_scrappie_matrix mat){
 }
 
 
+/**  Interleave several matrices into a single batch matrix
+ *
+ *   Column t of matrix b is placed into column t * nmat + b of the result
+ *   so each column of the input matrices (time step) forms a contiguous block
+ *   of nmat columns.  Matrices shorter than the longest are padded with zeros.
+ *   NULL matrices are treated as having no columns.
+ *
+ *   @param mats Array [nmat] of matrices, all with same number of rows
+ *   @param nmat Number of matrices
+ *   @param C Matrix to write into or NULL
+ *
+ *   @returns batch matrix [nr, maxnc * nmat]
+ **/
+scrappie_matrix interleave_scrappie_matrices(const_scrappie_matrix const * mats, size_t nmat,
+                                             scrappie_matrix C) {
+    RETURN_NULL_IF(NULL == mats, NULL);
+    RETURN_NULL_IF(0 == nmat, NULL);
+
+    size_t nr = 0;
+    size_t maxnc = 0;
+    for (size_t b = 0; b < nmat; b++) {
+        if (NULL == mats[b]) {
+            continue;
+        }
+        assert(0 == nr || nr == mats[b]->nr);
+        nr = mats[b]->nr;
+        if (mats[b]->nc > maxnc) {
+            maxnc = mats[b]->nc;
+        }
+    }
+    RETURN_NULL_IF(0 == maxnc, NULL);
+
+    C = remake_scrappie_matrix(C, nr, maxnc * nmat);
+    RETURN_NULL_IF(NULL == C, NULL);
+    zero_scrappie_matrix(C);
+
+    const size_t nrq = C->nrq;
+    for (size_t b = 0; b < nmat; b++) {
+        if (NULL == mats[b]) {
+            continue;
+        }
+        for (size_t c = 0; c < mats[b]->nc; c++) {
+            memcpy(C->data.v + (c * nmat + b) * nrq, mats[b]->data.v + c * nrq,
+                   nrq * sizeof(__m128));
+        }
+    }
+
+    return C;
+}
+
+
+/**  Split a batch matrix into its constituent matrices
+ *
+ *   Inverse of interleave_scrappie_matrices.  Padding columns are discarded.
+ *
+ *   @param X Batch matrix
+ *   @param nmat Number of matrices in batch
+ *   @param ncol Array [nmat] containing number of columns of each matrix
+ *
+ *   @returns Array [nmat] of matrices.  Elements with no columns are NULL.
+ *   Returns NULL on failure.
+ **/
+scrappie_matrix * deinterleave_scrappie_matrix(const_scrappie_matrix X, size_t nmat,
+                                               size_t const * ncol) {
+    RETURN_NULL_IF(NULL == X, NULL);
+    RETURN_NULL_IF(NULL == ncol, NULL);
+    RETURN_NULL_IF(0 == nmat, NULL);
+    assert(0 == X->nc % nmat);
+
+    scrappie_matrix * mats = calloc(nmat, sizeof(scrappie_matrix));
+    RETURN_NULL_IF(NULL == mats, NULL);
+
+    const size_t nrq = X->nrq;
+    for (size_t b = 0; b < nmat; b++) {
+        if (0 == ncol[b]) {
+            continue;
+        }
+        assert(ncol[b] * nmat <= X->nc);
+        mats[b] = make_scrappie_matrix(X->nr, ncol[b]);
+        if (NULL == mats[b]) {
+            for (size_t i = 0; i < b; i++) {
+                mats[i] = free_scrappie_matrix(mats[i]);
+            }
+            free(mats);
+            return NULL;
+        }
+        for (size_t c = 0; c < ncol[b]; c++) {
+            memcpy(mats[b]->data.v + c * nrq, X->data.v + (c * nmat + b) * nrq,
+                   nrq * sizeof(__m128));
+        }
+    }
+
+    return mats;
+}
+
+
 void fprint_scrappie_matrix(FILE * fh, const char *header,
                             const_scrappie_matrix mat, size_t nr, size_t nc,
                             bool include_padding) {
@@ -129,7 +529,7 @@ void fprint_scrappie_matrix(FILE * fh, const char *header,
 
 scrappie_matrix free_scrappie_matrix(scrappie_matrix mat) {
     if (NULL != mat) {
-        free(mat->data.v);
+        workspace_free(mat->data.v);
         free(mat);
     }
     return NULL;
@@ -279,7 +679,8 @@ scrappie_imatrix make_scrappie_imatrix(size_t nr, size_t nc) {
     mat->nc = nc;
     mat->stride = nrq * 4;
 
-    if (0 != scrappie_memalign((void **)&mat->data.v, 16, nrq * nc * sizeof(__m128i))) {
+    mat->data.v = workspace_alloc(nrq * nc * sizeof(__m128i));
+    if (NULL == mat->data.v) {
         warnx("Error allocating memory in %s.\n", __func__);
         free(mat);
         return NULL;
@@ -307,7 +708,7 @@ scrappie_imatrix copy_scrappie_imatrix(const_scrappie_imatrix M){
 
 scrappie_imatrix free_scrappie_imatrix(scrappie_imatrix mat) {
     if (NULL != mat) {
-        free(mat->data.v);
+        workspace_free(mat->data.v);
         free(mat);
     }
     return NULL;
@@ -320,6 +721,571 @@ void zero_scrappie_imatrix(scrappie_imatrix M) {
     memset(M->data.f, 0, M->stride * M->nc * sizeof(int));
 }
 
+/**  Weights packed for the affine map kernel
+ *
+ *   Weights registered with register_packed_weights are repacked, the first
+ *   time they are used by affine_map, into the panel layout of panel_affine
+ *   and the packed copy used for every subsequent map.  Only matrices whose
+ *   values do not change, such as the weights of a model, should be
+ *   registered.  Other weights are mapped using BLAS.  A registered matrix
+ *   whose data are replaced, for example by load_model_weights, is repacked
+ *   when next used; this must not happen while any thread is evaluating a
+ *   network.
+ *
+ *   At SCRAPPIE_PRECISION_INT8, registered weights are instead quantised to
+ *   int8 with a scale for each output, the largest weight of each output
+ *   mapping to 127, and each column of the input is quantised likewise as
+ *   it is mapped.  No calibration is needed since every scale follows from
+ *   the values being quantised.
+ *
+ *   Weights read a column at a time by recurrent layers may instead be held
+ *   as their blocks that are not all zero, when pruning has left enough of
+ *   them zero, so the zero blocks are neither read nor multiplied.  Whether
+ *   they have is found the first time the sparse copy is asked for.
+ *
+ *   When workers are placed on more than one NUMA node, each node has its own
+ *   copies, made by the first thread on that node to need them so that their
+ *   memory is local to it.
+ **/
+typedef struct {
+    float * blocks;
+    uint32_t * block_input;
+    uint32_t * row_start;
+    size_t nrow_block;
+} sparse_copy;
+
+typedef struct {
+    float * panels;
+    //  Copy quantised to int8, made when first used at that precision
+    int8_t * qpanels;
+    float * qscale;
+    //  Unpacked copy, see scrappie_local_weights
+    scrappie_matrix local;
+    //  Copy of blocks not all zero, NULL when the weights are too dense once checked
+    sparse_copy * sparse;
+    bool sparse_checked;
+} packed_copy;
+
+typedef struct {
+    const_scrappie_matrix W;
+    //  Shape and data that were packed
+    size_t nr, nc;
+    float const * data;
+    size_t npanel;
+    packed_copy copy[SCRAPPIE_NUMA_MAX_NODE];
+} packed_weights;
+
+//  Packed weights as seen by the calling thread
+typedef struct {
+    size_t nr, npanel;
+    float const * panels;
+    int8_t const * qpanels;
+    float const * qscale;
+} packed_view;
+
+static packed_weights * packed_registry = NULL;
+static size_t npacked_registry = 0;
+static size_t packed_registry_capacity = 0;
+
+
+static sparse_copy * free_sparse_copy(sparse_copy * sc) {
+    if (NULL != sc) {
+        free(sc->blocks);
+        free(sc->block_input);
+        free(sc->row_start);
+        free(sc);
+    }
+    return NULL;
+}
+
+
+static void free_packed_copies(packed_weights * entry) {
+    for (size_t i = 0; i < SCRAPPIE_NUMA_MAX_NODE; i++) {
+        entry->copy[i].sparse = free_sparse_copy(entry->copy[i].sparse);
+        free(entry->copy[i].panels);
+        free(entry->copy[i].qpanels);
+        free(entry->copy[i].qscale);
+        if (NULL != entry->copy[i].local) {
+            free(entry->copy[i].local->data.f);
+            free(entry->copy[i].local);
+        }
+        entry->copy[i] = (packed_copy){ 0 };
+    }
+}
+
+
+static float * pack_panels(const_scrappie_matrix W, size_t npanel) {
+    const size_t nfloat = npanel * SCRAPPIE_PANEL_WIDTH * W->nr;
+    float * panels = NULL;
+    RETURN_NULL_IF(0 != scrappie_memalign((void **)&panels, 64, nfloat * sizeof(float)), NULL);
+    memset(panels, 0, nfloat * sizeof(float));
+    for (size_t o = 0; o < W->nc; o++) {
+        const size_t p = o / SCRAPPIE_PANEL_WIDTH;
+        float * panel = panels + p * SCRAPPIE_PANEL_WIDTH * W->nr + o % SCRAPPIE_PANEL_WIDTH;
+        for (size_t k = 0; k < W->nr; k++) {
+            panel[k * SCRAPPIE_PANEL_WIDTH] = W->data.f[o * W->stride + k];
+        }
+    }
+    return panels;
+}
+
+
+/**  Quantise weights into panels of pairs of inputs for panel_affine_int8
+ *
+ *   @param qscale  Scale of each output [out], allocated
+ *
+ *   @returns Panels or NULL on failure
+ **/
+static int8_t * quantise_panels(const_scrappie_matrix W, size_t npanel, float ** qscale) {
+    const size_t nkpair = (W->nr + 1) / 2;
+    const size_t nbyte = npanel * SCRAPPIE_PANEL_WIDTH * 2 * nkpair;
+    int8_t * panels = NULL;
+    RETURN_NULL_IF(0 != scrappie_memalign((void **)&panels, 64, nbyte), NULL);
+    *qscale = calloc(npanel * SCRAPPIE_PANEL_WIDTH, sizeof(float));
+    if (NULL == *qscale) {
+        free(panels);
+        return NULL;
+    }
+    memset(panels, 0, nbyte);
+    for (size_t o = 0; o < W->nc; o++) {
+        float const * w = W->data.f + o * W->stride;
+        float amax = 0.0f;
+        for (size_t k = 0; k < W->nr; k++) {
+            amax = fmaxf(amax, fabsf(w[k]));
+        }
+        const float recip = (amax > 0.0f) ? 127.0f / amax : 0.0f;
+        (*qscale)[o] = amax / 127.0f;
+        const size_t p = o / SCRAPPIE_PANEL_WIDTH;
+        int8_t * panel = panels + p * SCRAPPIE_PANEL_WIDTH * 2 * nkpair + 2 * (o % SCRAPPIE_PANEL_WIDTH);
+        for (size_t k = 0; k < W->nr; k++) {
+            panel[(k / 2) * 2 * SCRAPPIE_PANEL_WIDTH + k % 2] = (int8_t)lrintf(w[k] * recip);
+        }
+    }
+    return panels;
+}
+
+
+/**  Copy of the blocks of weights that are not all zero, for block_sparse_affine
+ *
+ *   Inputs beyond the last of W are taken to have weight zero.
+ *
+ *   @returns Copy, or NULL if more than SCRAPPIE_SPARSE_MAX_DENSITY of the
+ *   blocks are not all zero, W has outputs that do not fill a block, or on
+ *   failure
+ **/
+static sparse_copy * make_sparse_copy(const_scrappie_matrix W) {
+    const size_t bs = SCRAPPIE_SPARSE_BLOCK;
+    RETURN_NULL_IF(0 != W->nc % bs, NULL);
+    const size_t nrow_block = W->nc / bs;
+    const size_t nkb = (W->nr + bs - 1) / bs;
+
+    size_t nblock = 0;
+    for (size_t ob = 0; ob < nrow_block; ob++) {
+        for (size_t kb = 0; kb < nkb; kb++) {
+            bool zero = true;
+            for (size_t o = ob * bs; zero && o < (ob + 1) * bs; o++) {
+                for (size_t k = kb * bs; zero && k < (kb + 1) * bs && k < W->nr; k++) {
+                    zero = (0.0f == W->data.f[o * W->stride + k]);
+                }
+            }
+            nblock += !zero;
+        }
+    }
+    if (nblock > SCRAPPIE_SPARSE_MAX_DENSITY * nrow_block * nkb) {
+        return NULL;
+    }
+
+    sparse_copy * sc = calloc(1, sizeof(sparse_copy));
+    RETURN_NULL_IF(NULL == sc, NULL);
+    sc->nrow_block = nrow_block;
+    sc->block_input = malloc((nblock + 1) * sizeof(uint32_t));
+    sc->row_start = malloc((nrow_block + 1) * sizeof(uint32_t));
+    if (0 != scrappie_memalign((void **)&sc->blocks, 64, (nblock + 1) * bs * bs * sizeof(float))) {
+        sc->blocks = NULL;
+    }
+    if (NULL == sc->blocks || NULL == sc->block_input || NULL == sc->row_start) {
+        return free_sparse_copy(sc);
+    }
+
+    size_t b = 0;
+    for (size_t ob = 0; ob < nrow_block; ob++) {
+        sc->row_start[ob] = b;
+        for (size_t kb = 0; kb < nkb; kb++) {
+            float * block = sc->blocks + b * bs * bs;
+            bool zero = true;
+            for (size_t j = 0; j < bs; j++) {
+                const size_t k = kb * bs + j;
+                for (size_t o = 0; o < bs; o++) {
+                    block[j * bs + o] = (k < W->nr) ? W->data.f[(ob * bs + o) * W->stride + k] : 0.0f;
+                    zero &= (0.0f == block[j * bs + o]);
+                }
+            }
+            if (!zero) {
+                sc->block_input[b] = kb;
+                b += 1;
+            }
+        }
+    }
+    sc->row_start[nrow_block] = b;
+    return sc;
+}
+
+
+static enum scrappie_precision precision = SCRAPPIE_PRECISION_FP32;
+
+/**  Arithmetic used to map by registered weights
+ *
+ *   Should be set before any worker threads are started.
+ *
+ *   @returns Precision now in use
+ **/
+enum scrappie_precision scrappie_precision_set(enum scrappie_precision p) {
+    assert(p == SCRAPPIE_PRECISION_FP32 || p == SCRAPPIE_PRECISION_INT8);
+    precision = p;
+    return precision;
+}
+
+enum scrappie_precision scrappie_precision_get(void) {
+    return precision;
+}
+
+
+/**  Register matrix as weights to be packed for affine_map
+ *
+ *   Thread safe.  Registering a matrix more than once has no effect.
+ *
+ *   @returns true on success
+ **/
+bool register_packed_weights(const_scrappie_matrix W) {
+    RETURN_NULL_IF(NULL == W, false);
+    bool ok = true;
+#pragma omp critical(scrappie_packed_weights)
+    {
+        bool found = false;
+        for (size_t i = 0; i < npacked_registry; i++) {
+            found |= (packed_registry[i].W == W);
+        }
+        if (!found && npacked_registry == packed_registry_capacity) {
+            const size_t capacity = (0 == packed_registry_capacity) ? 64 : 2 * packed_registry_capacity;
+            packed_weights * registry = realloc(packed_registry, capacity * sizeof(packed_weights));
+            if (NULL == registry) {
+                ok = false;
+            } else {
+                packed_registry = registry;
+                packed_registry_capacity = capacity;
+            }
+        }
+        if (!found && ok) {
+            packed_registry[npacked_registry] = (packed_weights){.W = W};
+            npacked_registry += 1;
+        }
+    }
+    return ok;
+}
+
+
+/**  Remove matrix from registry of packed weights, freeing its packed copy
+ **/
+void unregister_packed_weights(const_scrappie_matrix W) {
+#pragma omp critical(scrappie_packed_weights)
+    {
+        for (size_t i = 0; i < npacked_registry; i++) {
+            if (packed_registry[i].W == W) {
+                free_packed_copies(packed_registry + i);
+                npacked_registry -= 1;
+                packed_registry[i] = packed_registry[npacked_registry];
+                break;
+            }
+        }
+    }
+}
+
+
+/**  Entry of registry for weights, repacked if their data have been replaced
+ *
+ *   Must be called from within critical section scrappie_packed_weights
+ *
+ *   @returns Entry or NULL if the weights are not registered
+ **/
+static packed_weights * find_registry_entry(const_scrappie_matrix W) {
+    for (size_t i = 0; i < npacked_registry; i++) {
+        packed_weights * entry = packed_registry + i;
+        if (entry->W != W) {
+            continue;
+        }
+        if (entry->data != W->data.f || entry->nr != W->nr || entry->nc != W->nc) {
+            free_packed_copies(entry);
+            entry->npanel = (W->nc + SCRAPPIE_PANEL_WIDTH - 1) / SCRAPPIE_PANEL_WIDTH;
+            entry->data = W->data.f;
+            entry->nr = W->nr;
+            entry->nc = W->nc;
+        }
+        return entry;
+    }
+    return NULL;
+}
+
+
+//  Copy of weights used by the calling thread
+static size_t packed_copy_index(void) {
+    return (scrappie_numa_nreplica() > 1) ? scrappie_numa_node() : 0;
+}
+
+
+/**  Packed copy of registered weights, packing them if necessary
+ *
+ *   @param quantised  Whether int8 copy is wanted, rather than float
+ *   @param pw  Copy for node of calling thread [out]
+ *
+ *   @returns true if the weights are registered and packed successfully
+ **/
+static bool find_packed_weights(const_scrappie_matrix W, bool quantised, packed_view * pw) {
+    const size_t node = packed_copy_index();
+    bool found = false;
+#pragma omp critical(scrappie_packed_weights)
+    {
+        packed_weights * entry = find_registry_entry(W);
+        if (NULL != entry) {
+            packed_copy * copy = entry->copy + node;
+            if (!quantised && NULL == copy->panels) {
+                copy->panels = pack_panels(W, entry->npanel);
+            }
+            if (quantised && NULL == copy->qpanels) {
+                copy->qpanels = quantise_panels(W, entry->npanel, &copy->qscale);
+            }
+            *pw = (packed_view){entry->nr, entry->npanel, copy->panels, copy->qpanels, copy->qscale};
+            found = quantised ? (NULL != copy->qpanels) : (NULL != copy->panels);
+        }
+    }
+    return found;
+}
+
+
+/**  Copy of registered weights local to the NUMA node of the calling thread
+ *
+ *   For weights read directly, rather than through a packed copy, such as
+ *   those of the recurrent step of a layer.
+ *
+ *   @returns Copy of W for the node of calling thread, or W itself when
+ *   weights are not copied for each node, W is not registered or it could
+ *   not be copied
+ **/
+const_scrappie_matrix scrappie_local_weights(const_scrappie_matrix W) {
+    RETURN_NULL_IF(NULL == W, NULL);
+    if (scrappie_numa_nreplica() <= 1) {
+        return W;
+    }
+    const size_t node = packed_copy_index();
+    const_scrappie_matrix local = W;
+#pragma omp critical(scrappie_packed_weights)
+    {
+        packed_weights * entry = find_registry_entry(W);
+        if (NULL != entry && NULL == entry->copy[node].local) {
+            //  Allocated outside of the workspace since the copy outlives the thread's use of it
+            scrappie_matrix mat = malloc(sizeof(*mat));
+            float * data = NULL;
+            const size_t nbyte = W->stride * W->nc * sizeof(float);
+            if (NULL != mat && 0 == scrappie_memalign((void **)&data, 16, nbyte)) {
+                memcpy(data, W->data.f, nbyte);
+                *mat = *W;
+                mat->data.f = data;
+                entry->copy[node].local = mat;
+            } else {
+                free(mat);
+            }
+        }
+        if (NULL != entry && NULL != entry->copy[node].local) {
+            local = entry->copy[node].local;
+        }
+    }
+    return local;
+}
+
+
+/**  Quantised copy of registered weights
+ *
+ *   @param qw  Quantised weights [out]
+ *
+ *   @returns true if the weights are registered and quantised successfully
+ **/
+bool find_quantised_weights(const_scrappie_matrix W, quantised_weights * qw) {
+    RETURN_NULL_IF(NULL == W, false);
+    packed_view pw;
+    RETURN_NULL_IF(!find_packed_weights(W, true, &pw), false);
+    *qw = (quantised_weights){pw.qpanels, pw.qscale, pw.npanel, pw.nr};
+    return true;
+}
+
+
+/**  Copy of registered weights skipping their blocks that are all zero
+ *
+ *   @param sw  Sparse weights [out]
+ *
+ *   @returns true if the weights are registered and sparse enough for the
+ *   copy to be worth using
+ **/
+bool find_sparse_weights(const_scrappie_matrix W, sparse_weights * sw) {
+    RETURN_NULL_IF(NULL == W, false);
+    const size_t node = packed_copy_index();
+    bool found = false;
+#pragma omp critical(scrappie_packed_weights)
+    {
+        packed_weights * entry = find_registry_entry(W);
+        if (NULL != entry) {
+            packed_copy * copy = entry->copy + node;
+            if (!copy->sparse_checked) {
+                copy->sparse = make_sparse_copy(W);
+                copy->sparse_checked = true;
+            }
+            if (NULL != copy->sparse) {
+                const sparse_copy * sc = copy->sparse;
+                *sw = (sparse_weights){sc->blocks, sc->block_input, sc->row_start, sc->nrow_block};
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+
+/**  Accumulate map of a vector by sparse weights
+ *
+ *   y += W^t x
+ *
+ *   @param sw  Weights found by find_sparse_weights
+ *   @param x  Input, padded to a multiple of four values
+ *   @param y  Output [4 * sw->nrow_block]
+ **/
+void sparse_affine_vector(sparse_weights const * sw, float const * x, float * y) {
+    block_sparse_affine(sw->blocks, sw->block_input, sw->row_start, sw->nrow_block, x, y);
+}
+
+
+/**  Accumulate map of a vector by quantised weights
+ *
+ *   y += W^t x, where x is quantised to int8 as it is read
+ *
+ *   @param qw  Weights quantised by find_quantised_weights
+ *   @param x  Input [qw->nk]
+ *   @param xq  Workspace [(qw->nk + 1) / 2]
+ *   @param y  Output, a multiple of four values [n]
+ *   @param n  Number of outputs
+ **/
+void quantised_affine_vector(quantised_weights const * qw, float const * x, int32_t * xq,
+                             float * y, size_t n) {
+    float xscale;
+    quantise_columns_int8(x, qw->nk, 0, 1, xq, 0, &xscale);
+    panel_affine_int8(qw->panels, qw->scale, qw->npanel, qw->nk, xq, 0, &xscale, y, n, y, n, 1);
+}
+
+
+/**  Affine map by packed weights with bias and activation applied in blocks
+ *
+ *   Columns are mapped PACKED_COLUMN_BLOCK at a time so the second input and
+ *   the activation are applied while the block of output is still in cache.
+ **/
+#define PACKED_COLUMN_BLOCK 64
+static bool packed_affine_map(const_scrappie_matrix X1, const_scrappie_matrix W1,
+                              const_scrappie_matrix X2, const_scrappie_matrix W2,
+                              const_scrappie_matrix b, scrappie_activation_ptr activation,
+                              scrappie_matrix C) {
+    const bool quantised = (SCRAPPIE_PRECISION_INT8 == precision);
+    packed_view pw1, pw2;
+    if (!find_packed_weights(W1, quantised, &pw1) || (NULL != W2 && !find_packed_weights(W2, quantised, &pw2))) {
+        return false;
+    }
+
+    //  Bias padded to a whole number of panels
+    float * bias = calloc(pw1.npanel * SCRAPPIE_PANEL_WIDTH, sizeof(float));
+    RETURN_NULL_IF(NULL == bias, false);
+    memcpy(bias, b->data.f, b->nr * sizeof(float));
+
+    //  Quantised block of columns of either input
+    const size_t ldxq = quantised ? (((NULL != W2 && W2->nr > W1->nr) ? W2->nr : W1->nr) + 1) / 2 : 0;
+    int32_t * xq = quantised ? malloc(ldxq * PACKED_COLUMN_BLOCK * sizeof(int32_t)) : NULL;
+    float xscale[PACKED_COLUMN_BLOCK];
+    if (quantised && NULL == xq) {
+        free(bias);
+        return false;
+    }
+
+    for (size_t c = 0; c < C->nc; c += PACKED_COLUMN_BLOCK) {
+        const size_t ncol = (c + PACKED_COLUMN_BLOCK < C->nc) ? PACKED_COLUMN_BLOCK : (C->nc - c);
+        float * Cc = C->data.f + c * C->stride;
+        if (quantised) {
+            quantise_columns_int8(X1->data.f + c * X1->stride, W1->nr, X1->stride, ncol, xq, ldxq, xscale);
+            panel_affine_int8(pw1.qpanels, pw1.qscale, pw1.npanel, W1->nr, xq, ldxq, xscale,
+                              bias, 0, Cc, C->stride, ncol);
+        } else {
+            panel_affine(pw1.panels, pw1.npanel, W1->nr, X1->data.f + c * X1->stride, X1->stride,
+                         bias, 0, Cc, C->stride, ncol);
+        }
+        if (NULL != W2 && quantised) {
+            quantise_columns_int8(X2->data.f + c * X2->stride, W2->nr, X2->stride, ncol, xq, ldxq, xscale);
+            panel_affine_int8(pw2.qpanels, pw2.qscale, pw2.npanel, W2->nr, xq, ldxq, xscale,
+                              Cc, C->stride, Cc, C->stride, ncol);
+        } else if (NULL != W2) {
+            panel_affine(pw2.panels, pw2.npanel, W2->nr, X2->data.f + c * X2->stride, X2->stride,
+                         Cc, C->stride, Cc, C->stride, ncol);
+        }
+        if (NULL != activation) {
+            activation(Cc, ncol * C->stride);
+        }
+    }
+    free(xq);
+    free(bias);
+    return true;
+}
+
+
+/**  Affine transform followed by an activation
+ *
+ *   C = activation(W^t X + b)
+ *
+ *   Registered weights are mapped by the packed kernel with the bias and
+ *   activation fused into it; others are mapped by BLAS.
+ *
+ *   @param X  Input [nr, nc]
+ *   @param W  Weights [nr, nk]
+ *   @param b  Bias [nk]
+ *   @param activation  Function applied in place to output, or NULL for none
+ *   @param C  Output [nk, nc] or NULL.  If NULL then C is allocated.
+ *
+ *   @returns Output
+ **/
+scrappie_matrix affine_map_activation(const_scrappie_matrix X, const_scrappie_matrix W,
+                                      const_scrappie_matrix b, scrappie_activation_ptr activation,
+                                      scrappie_matrix C) {
+    RETURN_NULL_IF(NULL == X, NULL);
+
+    assert(NULL != W);
+    assert(NULL != b);
+    assert(W->nr == X->nr);
+
+    C = remake_scrappie_matrix(C, W->nc, X->nc);
+    RETURN_NULL_IF(NULL == C, NULL);
+
+    if (packed_affine_map(X, W, NULL, NULL, b, activation, C)) {
+        return C;
+    }
+
+    /* Copy bias */
+    for (size_t c = 0; c < C->nc; c++) {
+        memcpy(C->data.v + c * C->nrq, b->data.v, C->nrq * sizeof(__m128));
+    }
+
+    /* Affine transform */
+    cblas_sgemm(CblasColMajor, CblasTrans, CblasNoTrans, W->nc, X->nc, W->nr,
+                1.0, W->data.f, W->stride, X->data.f, X->stride, 1.0,
+                C->data.f, C->stride);
+
+    if (NULL != activation) {
+        activation(C->data.f, C->nc * C->stride);
+    }
+
+    return C;
+}
+
 scrappie_matrix affine_map(const_scrappie_matrix X, const_scrappie_matrix W,
                            const_scrappie_matrix b, scrappie_matrix C) {
     /*  Affine transform C = W^t X + b
@@ -328,31 +1294,112 @@ scrappie_matrix affine_map(const_scrappie_matrix X, const_scrappie_matrix W,
      *  b is [nk]
      *  C is [nk, nc] or NULL.  If NULL then C is allocated.
      */
+    return affine_map_activation(X, W, b, NULL, C);
+}
+
+/**  Affine transform of a window of the input
+ *
+ *   C = W^t window(X, w, 1) + b, without forming the window.  Each column
+ *   of the window stacks the w columns of X around it, zero beyond the end
+ *   of X.  As window, a column whose window would start before X has a
+ *   window of zeros and so is the bias alone.  When the rows of X are unpadded, the windows of columns away from
+ *   the ends are overlapping spans of X itself, so registered weights map
+ *   them directly as a view whose columns are X->stride apart; only the
+ *   columns at the ends are formed.  Otherwise the map is accumulated from
+ *   one product for each offset in the window, of the rows of W for that
+ *   offset with the shifted columns of X.
+ *
+ *   @param X  Input [nr, nc]
+ *   @param w  Length of window
+ *   @param W  Weights [w * nr, nk]
+ *   @param b  Bias [nk]
+ *   @param C  Output [nk, nc] or NULL.  If NULL then C is allocated.
+ *
+ *   @returns Output
+ **/
+scrappie_matrix affine_map_window(const_scrappie_matrix X, size_t w, const_scrappie_matrix W,
+                                  const_scrappie_matrix b, scrappie_matrix C) {
     RETURN_NULL_IF(NULL == X, NULL);
 
+    assert(w > 0);
     assert(NULL != W);
     assert(NULL != b);
-    assert(W->nr == X->nr);
+    assert(W->nr == w * X->nr);
 
     C = remake_scrappie_matrix(C, W->nc, X->nc);
     RETURN_NULL_IF(NULL == C, NULL);
 
+    //  Window of column c spans columns c - before to c + w - 1 - before, as window
+    const size_t before = (w + 1) / 2 - 1;
+    const size_t after = w - 1 - before;
+
+    if (X->nr == X->stride && X->nc > before + after) {
+        const size_t nr = w * X->nr;
+        const _Mat Xw = {nr, (nr + 3) / 4, X->nc - before - after, X->stride, {.f = X->data.f}};
+        _Mat Cw = *C;
+        Cw.nc = Xw.nc;
+        Cw.data.f = C->data.f + before * C->stride;
+        if (packed_affine_map(&Xw, W, NULL, NULL, b, NULL, &Cw)) {
+            //  Columns at the ends, whose windows run off the input
+            scrappie_matrix Xe = make_scrappie_matrix(nr, 1);
+            RETURN_NULL_IF(NULL == Xe, free_scrappie_matrix(C));
+            bool ok = true;
+            for (size_t c = 0; c < C->nc && ok; c++) {
+                if (c == before) {
+                    //  Skip interior
+                    c = C->nc - after - 1;
+                    continue;
+                }
+                memset(Xe->data.f, 0, Xe->stride * sizeof(float));
+                for (size_t k = 0; k < w && c >= before; k++) {
+                    const size_t col = c + k - before;
+                    if (col < X->nc) {
+                        memcpy(Xe->data.f + k * X->nr, X->data.f + col * X->stride, X->nr * sizeof(float));
+                    }
+                }
+                Cw.nc = 1;
+                Cw.data.f = C->data.f + c * C->stride;
+                ok = packed_affine_map(Xe, W, NULL, NULL, b, NULL, &Cw);
+            }
+            Xe = free_scrappie_matrix(Xe);
+            if (ok) {
+                return C;
+            }
+        }
+    }
+
     /* Copy bias */
     for (size_t c = 0; c < C->nc; c++) {
         memcpy(C->data.v + c * C->nrq, b->data.v, C->nrq * sizeof(__m128));
     }
 
-    /* Affine transform */
-    cblas_sgemm(CblasColMajor, CblasTrans, CblasNoTrans, W->nc, X->nc, W->nr,
-                1.0, W->data.f, W->stride, X->data.f, X->stride, 1.0,
-                C->data.f, C->stride);
+    /* Affine transform -- one product for each offset */
+    for (size_t k = 0; k < w; k++) {
+        //  Output columns whose input at this offset is within X
+        const size_t c0 = before;
+        const size_t c1 = (k > before) ? X->nc - ((k - before < X->nc) ? k - before : X->nc) : X->nc;
+        if (c1 <= c0) {
+            continue;
+        }
+        cblas_sgemm(CblasColMajor, CblasTrans, CblasNoTrans, W->nc, c1 - c0, X->nr,
+                    1.0, W->data.f + k * X->nr, W->stride,
+                    X->data.f + (c0 + k - before) * X->stride, X->stride, 1.0,
+                    C->data.f + c0 * C->stride, C->stride);
+    }
 
     return C;
 }
 
-scrappie_matrix affine_map2(const_scrappie_matrix Xf, const_scrappie_matrix Xb,
-                            const_scrappie_matrix Wf, const_scrappie_matrix Wb,
-                            const_scrappie_matrix b, scrappie_matrix C) {
+/**  Affine transform of two inputs followed by an activation
+ *
+ *   C = activation(Wf^t Xf + Wb^t Xb + b)
+ *
+ *   @returns Output
+ **/
+scrappie_matrix affine_map2_activation(const_scrappie_matrix Xf, const_scrappie_matrix Xb,
+                                       const_scrappie_matrix Wf, const_scrappie_matrix Wb,
+                                       const_scrappie_matrix b, scrappie_activation_ptr activation,
+                                       scrappie_matrix C) {
     RETURN_NULL_IF(NULL == Xf, NULL);
     RETURN_NULL_IF(NULL == Xb, NULL);
 
@@ -366,6 +1413,10 @@ scrappie_matrix affine_map2(const_scrappie_matrix Xf, const_scrappie_matrix Xb,
     C = remake_scrappie_matrix(C, Wf->nc, Xf->nc);
     RETURN_NULL_IF(NULL == C, NULL);
 
+    if (packed_affine_map(Xf, Wf, Xb, Wb, b, activation, C)) {
+        return C;
+    }
+
     /* Copy bias */
     for (size_t c = 0; c < C->nc; c++) {
         memcpy(C->data.v + c * C->nrq, b->data.v, C->nrq * sizeof(__m128));
@@ -379,31 +1430,26 @@ scrappie_matrix affine_map2(const_scrappie_matrix Xf, const_scrappie_matrix Xb,
     cblas_sgemm(CblasColMajor, CblasTrans, CblasNoTrans, Wb->nc, Xb->nc, Wb->nr,
                 1.0, Wb->data.f, Wb->stride, Xb->data.f, Xb->stride, 1.0,
                 C->data.f, C->stride);
+
+    if (NULL != activation) {
+        activation(C->data.f, C->nc * C->stride);
+    }
+
     return C;
 }
 
+scrappie_matrix affine_map2(const_scrappie_matrix Xf, const_scrappie_matrix Xb,
+                            const_scrappie_matrix Wf, const_scrappie_matrix Wb,
+                            const_scrappie_matrix b, scrappie_matrix C) {
+    return affine_map2_activation(Xf, Xb, Wf, Wb, b, NULL, C);
+}
+
 void row_normalise_inplace(scrappie_matrix C) {
     if (NULL == C) {
         // Input NULL due to earlier failure.  Propagate
         return;
     }
-    const size_t i = C->stride - C->nr;
-    const __m128 mask = _mm_cmpgt_ps(_mm_set_ps(i >= 1, i >= 2, i >= 3, 0), _mm_set1_ps(0.0f));
-    for (size_t col = 0; col < C->nc; col++) {
-        const size_t offset = col * C->nrq;
-        __m128 sum = C->data.v[offset];
-        for (size_t row = 1; row < C->nrq; row++) {
-            sum += C->data.v[offset + row];
-        }
-        sum -= _mm_and_ps(C->data.v[offset + C->nrq - 1], mask);
-        const __m128 psum = _mm_hadd_ps(sum, sum);
-        const __m128 tsum = _mm_hadd_ps(psum, psum);
-
-        const __m128 tsum_recip = _mm_set1_ps(1.0f) / tsum;
-        for (size_t row = 0; row < C->nrq; row++) {
-            C->data.v[offset + row] *= tsum_recip;
-        }
-    }
+    normalise_columns_inplace(C->data.f, C->nr, C->stride, C->nc);
 }
 
 float max_scrappie_matrix(const_scrappie_matrix x) {
@@ -28,13 +28,35 @@ typedef _iMat *scrappie_imatrix;
 typedef _Mat const *const_scrappie_matrix;
 typedef _iMat const *const_scrappie_imatrix;
 
+//  Backing of the memory of large matrices, see scrappie_matrix.c
+enum scrappie_hugepage_policy {
+    SCRAPPIE_HUGEPAGE_OFF = 0,
+    SCRAPPIE_HUGEPAGE_TRANSPARENT,
+    SCRAPPIE_HUGEPAGE_EXPLICIT,
+    SCRAPPIE_HUGEPAGE_INVALID
+};
+//  Smallest matrix, in bytes, backed by huge pages unless another threshold is set
+#    define SCRAPPIE_HUGEPAGE_THRESHOLD ((size_t)4 << 20)
+enum scrappie_hugepage_policy scrappie_hugepage_set_policy(enum scrappie_hugepage_policy policy,
+                                                           size_t threshold);
+enum scrappie_hugepage_policy scrappie_hugepage_from_string(const char * name);
+
+bool scrappie_workspace_enable(bool enable);
+void scrappie_workspace_release(void);
+size_t scrappie_workspace_size(void);
+
 scrappie_matrix make_scrappie_matrix(size_t nr, size_t nc);
 scrappie_matrix remake_scrappie_matrix(scrappie_matrix M, size_t nr, size_t nc);
+scrappie_matrix reshape_scrappie_matrix(scrappie_matrix M, size_t nr, size_t nc);
 scrappie_matrix copy_scrappie_matrix(const_scrappie_matrix mat);
 scrappie_matrix free_scrappie_matrix(scrappie_matrix mat);
 void zero_scrappie_matrix(scrappie_matrix M);
 scrappie_matrix mat_from_array(const float *x, size_t nr, size_t nc);
 float * array_from_scrappie_matrix(const_scrappie_matrix mat);
+scrappie_matrix interleave_scrappie_matrices(const_scrappie_matrix const * mats, size_t nmat,
+                                             scrappie_matrix C);
+scrappie_matrix * deinterleave_scrappie_matrix(const_scrappie_matrix X, size_t nmat,
+                                               size_t const * ncol);
 void fprint_scrappie_matrix(FILE * fh, const char *header,
                             const_scrappie_matrix mat, size_t nr, size_t nc,
                             bool include_padding);
@@ -51,11 +73,53 @@ scrappie_imatrix copy_scrappie_imatrix(const_scrappie_imatrix mat);
 scrappie_imatrix free_scrappie_imatrix(scrappie_imatrix mat);
 void zero_scrappie_imatrix(scrappie_imatrix M);
 
+//  Activation applied in place to an array whose length is a multiple of four
+typedef void (*scrappie_activation_ptr)(float * x, size_t n);
+
 scrappie_matrix affine_map(const_scrappie_matrix X, const_scrappie_matrix W,
                            const_scrappie_matrix b, scrappie_matrix C);
+scrappie_matrix affine_map_window(const_scrappie_matrix X, size_t w, const_scrappie_matrix W,
+                                  const_scrappie_matrix b, scrappie_matrix C);
 scrappie_matrix affine_map2(const_scrappie_matrix Xf, const_scrappie_matrix Xb,
                             const_scrappie_matrix Wf, const_scrappie_matrix Wb,
                             const_scrappie_matrix b, scrappie_matrix C);
+scrappie_matrix affine_map_activation(const_scrappie_matrix X, const_scrappie_matrix W,
+                                      const_scrappie_matrix b, scrappie_activation_ptr activation,
+                                      scrappie_matrix C);
+scrappie_matrix affine_map2_activation(const_scrappie_matrix Xf, const_scrappie_matrix Xb,
+                                       const_scrappie_matrix Wf, const_scrappie_matrix Wb,
+                                       const_scrappie_matrix b, scrappie_activation_ptr activation,
+                                       scrappie_matrix C);
+//  Weights mapped by affine_map using a packed copy, see scrappie_matrix.c
+bool register_packed_weights(const_scrappie_matrix W);
+void unregister_packed_weights(const_scrappie_matrix W);
+const_scrappie_matrix scrappie_local_weights(const_scrappie_matrix W);
+enum scrappie_precision {
+    SCRAPPIE_PRECISION_FP32 = 0,
+    SCRAPPIE_PRECISION_INT8
+};
+enum scrappie_precision scrappie_precision_set(enum scrappie_precision p);
+enum scrappie_precision scrappie_precision_get(void);
+//  Registered weights quantised to int8 in the panel layout of panel_affine_int8
+typedef struct {
+    int8_t const * panels;
+    float const * scale;
+    size_t npanel;
+    size_t nk;
+} quantised_weights;
+bool find_quantised_weights(const_scrappie_matrix W, quantised_weights * qw);
+void quantised_affine_vector(quantised_weights const * qw, float const * x, int32_t * xq,
+                             float * y, size_t n);
+//  Registered weights held as their blocks that are not all zero, see block_sparse_affine
+#    define SCRAPPIE_SPARSE_MAX_DENSITY 0.75
+typedef struct {
+    float const * blocks;
+    uint32_t const * block_input;
+    uint32_t const * row_start;
+    size_t nrow_block;
+} sparse_weights;
+bool find_sparse_weights(const_scrappie_matrix W, sparse_weights * sw);
+void sparse_affine_vector(sparse_weights const * sw, float const * x, float * y);
 void row_normalise_inplace(scrappie_matrix C);
 
 float min_scrappie_matrix(const_scrappie_matrix mat);
@@ -0,0 +1,224 @@
+// Needed for sched_setaffinity and CPU_SET
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__linux__)
+#    include <sched.h>
+#endif
+
+#include "scrappie_numa.h"
+#include "scrappie_stdlib.h"
+
+#define NUMA_NODE_PATH "/sys/devices/system/node/node%zu/cpulist"
+#define NUMA_MAX_CPU 4096
+
+/**  CPUs available to the process on each node
+ *
+ *   CPUs of node i are cpu[first[i]] to cpu[first[i + 1] - 1]
+ **/
+static struct {
+    bool discovered;
+    size_t nnode;
+    size_t first[SCRAPPIE_NUMA_MAX_NODE + 1];
+    int cpu[NUMA_MAX_CPU];
+} topology = { 0 };
+
+static bool numa_enabled = false;
+
+//  Node of calling thread, as an index into topology
+static __thread size_t thread_node = 0;
+static __thread bool thread_bound = false;
+
+#if defined(__linux__)
+//  CPUs the process was allowed to run on when topology was discovered
+static cpu_set_t process_cpus;
+#endif
+
+
+/**  Parse list of CPUs in the format of the cpulist of each node in sysfs
+ *
+ *   @param list  Comma separated CPUs or ranges of CPUs, e.g. "0-3,8,10-11"
+ *   @param cpu  CPUs in list [out, max]
+ *   @param max  Maximum number of CPUs to return
+ *
+ *   @returns Number of CPUs written to cpu, 0 if the list is malformed
+ **/
+size_t scrappie_numa_parse_cpulist(const char * list, int * cpu, size_t max) {
+    RETURN_NULL_IF(NULL == list, 0);
+    RETURN_NULL_IF(NULL == cpu, 0);
+
+    size_t n = 0;
+    const char * p = list;
+    while ('\0' != *p && !isspace((unsigned char)*p)) {
+        char * end = NULL;
+        const long from = strtol(p, &end, 10);
+        RETURN_NULL_IF(end == p || from < 0, 0);
+        long to = from;
+        if ('-' == *end) {
+            p = end + 1;
+            to = strtol(p, &end, 10);
+            RETURN_NULL_IF(end == p || to < from, 0);
+        }
+        for (long c = from; c <= to && n < max; c++) {
+            cpu[n++] = (int)c;
+        }
+        p = end;
+        if (',' == *p) {
+            p += 1;
+        } else {
+            RETURN_NULL_IF('\0' != *p && !isspace((unsigned char)*p), 0);
+        }
+    }
+    return n;
+}
+
+
+#if defined(__linux__)
+static size_t read_node_cpus(size_t node, int * cpu, size_t max) {
+    char path[sizeof(NUMA_NODE_PATH) + 32];
+    sprintf(path, NUMA_NODE_PATH, node);
+    FILE * fh = fopen(path, "r");
+    if (NULL == fh) {
+        return 0;
+    }
+    char line[8192];
+    size_t n = 0;
+    if (NULL != fgets(line, sizeof(line), fh)) {
+        n = scrappie_numa_parse_cpulist(line, cpu, max);
+    }
+    fclose(fh);
+    return n;
+}
+#endif
+
+
+/**  Find CPUs of each node that the process may run on
+ *
+ *   Nodes without any such CPU are ignored.
+ **/
+static void discover_topology(void) {
+    topology.nnode = 0;
+    topology.first[0] = 0;
+#if defined(__linux__)
+    CPU_ZERO(&process_cpus);
+    if (0 != sched_getaffinity(0, sizeof(process_cpus), &process_cpus)) {
+        warnx("Failed to find CPUs available to process");
+        return;
+    }
+    size_t ncpu = 0;
+    for (size_t node = 0; node < 1024 && topology.nnode < SCRAPPIE_NUMA_MAX_NODE; node++) {
+        const size_t n = read_node_cpus(node, topology.cpu + ncpu, NUMA_MAX_CPU - ncpu);
+        //  CPUs of node that the process is allowed to use
+        size_t navail = 0;
+        for (size_t i = 0; i < n; i++) {
+            const int c = topology.cpu[ncpu + i];
+            if (c < CPU_SETSIZE && CPU_ISSET(c, &process_cpus)) {
+                topology.cpu[ncpu + navail++] = c;
+            }
+        }
+        if (navail > 0) {
+            ncpu += navail;
+            topology.nnode += 1;
+            topology.first[topology.nnode] = ncpu;
+        }
+    }
+#endif
+}
+
+
+/**  Enable or disable placement of workers on NUMA nodes
+ *
+ *   Not thread safe: must be called before any worker is bound.
+ *
+ *   @returns Number of nodes over which workers will be placed, 0 if
+ *   placement is disabled or unavailable
+ **/
+size_t scrappie_numa_enable(bool enable) {
+    if (enable && !topology.discovered) {
+        discover_topology();
+        topology.discovered = true;
+    }
+    numa_enabled = enable && topology.nnode > 0;
+    return numa_enabled ? topology.nnode : 0;
+}
+
+
+bool scrappie_numa_enabled(void) {
+    return numa_enabled;
+}
+
+
+/**  Number of copies of the weights of a model kept, one for each node
+ *
+ *   Weights are only copied when workers are placed on more than one node.
+ **/
+size_t scrappie_numa_nreplica(void) {
+    return (numa_enabled && topology.nnode > 1) ? topology.nnode : 1;
+}
+
+
+/**  Pin calling thread to a CPU of a node
+ *
+ *   Workers are divided into contiguous groups, one for each node, whose
+ *   sizes differ by at most one.  Within a group, workers take the CPUs of
+ *   the node in turn.
+ *
+ *   @param worker  Index of calling thread among workers
+ *   @param nworker  Number of workers
+ *
+ *   @returns true if the thread was pinned
+ **/
+bool scrappie_numa_bind(size_t worker, size_t nworker) {
+    RETURN_NULL_IF(!numa_enabled, false);
+    RETURN_NULL_IF(worker >= nworker, false);
+#if defined(__linux__)
+    const size_t nnode = topology.nnode;
+    const size_t node = worker * nnode / nworker;
+    //  First worker whose group is node
+    const size_t first_worker = (node * nworker + nnode - 1) / nnode;
+    const size_t ncpu = topology.first[node + 1] - topology.first[node];
+    const int cpu = topology.cpu[topology.first[node] + (worker - first_worker) % ncpu];
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (0 != sched_setaffinity(0, sizeof(set), &set)) {
+        warnx("Failed to pin worker %zu to CPU %d", worker, cpu);
+        return false;
+    }
+    thread_node = node;
+    thread_bound = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+
+/**  Allow calling thread to run on any CPU available to the process again
+ **/
+void scrappie_numa_unbind(void) {
+    if (!thread_bound) {
+        return;
+    }
+#if defined(__linux__)
+    (void)sched_setaffinity(0, sizeof(process_cpus), &process_cpus);
+#endif
+    thread_node = 0;
+    thread_bound = false;
+}
+
+
+/**  Node of calling thread, 0 if it is not bound
+ *
+ *   @returns Index of node, less than scrappie_numa_nreplica() when weights
+ *   are copied for each node
+ **/
+size_t scrappie_numa_node(void) {
+    return thread_node;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#ifndef SCRAPPIE_NUMA_H
+#    define SCRAPPIE_NUMA_H
+
+#    include <stdbool.h>
+#    include <stddef.h>
+
+/**  Placement of worker threads on NUMA nodes
+ *
+ *   When enabled, each worker is pinned to a CPU of one node, workers being
+ *   divided evenly between the nodes available to the process, and the
+ *   weights of a model are copied once for each node by the first worker on
+ *   that node to use them, see scrappie_local_weights.  Memory allocated by
+ *   a worker is placed on its node by the first-touch policy of the kernel.
+ *
+ *   Nodes are found from /sys/devices/system/node so placement is only
+ *   available on Linux; elsewhere, or if the nodes cannot be found, all CPUs
+ *   are treated as a single node.
+ **/
+
+#    define SCRAPPIE_NUMA_MAX_NODE 16
+
+size_t scrappie_numa_enable(bool enable);
+bool scrappie_numa_enabled(void);
+size_t scrappie_numa_nreplica(void);
+bool scrappie_numa_bind(size_t worker, size_t nworker);
+void scrappie_numa_unbind(void);
+size_t scrappie_numa_node(void);
+size_t scrappie_numa_parse_cpulist(const char * list, int * cpu, size_t max);
+
+#endif                          /* SCRAPPIE_NUMA_H */
@@ -0,0 +1,199 @@
+#include <assert.h>
+#include <err.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "scrappie_output.h"
+#include "scrappie_stdlib.h"
+
+/**  Output formatted in memory and optionally compressed as BGZF
+ *
+ *   Each worker formats the records of its read into a buffer of its own,
+ *   and compresses them, while other workers are still basecalling, so the
+ *   only work left for the ordered output is a single write of the buffer.
+ *
+ *   BGZF is the blocked gzip of samtools: a series of gzip members, each
+ *   holding at most 64KiB of data and recording its own compressed size,
+ *   ended by an empty member.  The output of a read is compressed into
+ *   blocks of its own so reads are compressed independently and in
+ *   parallel; the file may be read by bgzip, samtools or any gzip reader.
+ **/
+
+//  Header (with BC extra field) and footer of a BGZF block
+#define BGZF_HEADER_LENGTH 18
+#define BGZF_FOOTER_LENGTH 8
+#define BGZF_MAX_BLOCK 0x10000
+
+static const uint8_t bgzf_eof[BGZF_EOF_LENGTH] = {
+    0x1f, 0x8b, 0x08, 0x04, 0x00, 0x00, 0x00, 0x00, 0x00, 0xff, 0x06, 0x00, 0x42, 0x43,
+    0x02, 0x00, 0x1b, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+
+static bool reserve_output_buffer(output_buffer * buf, size_t n) {
+    if (buf->n + n <= buf->capacity) {
+        return true;
+    }
+    size_t capacity = (0 == buf->capacity) ? 4096 : buf->capacity;
+    while (capacity < buf->n + n) {
+        capacity *= 2;
+    }
+    char * data = realloc(buf->data, capacity);
+    RETURN_NULL_IF(NULL == data, false);
+    buf->data = data;
+    buf->capacity = capacity;
+    return true;
+}
+
+
+/**  Append formatted text to buffer
+ *
+ *   @returns true on success.  On failure the buffer is unchanged
+ **/
+bool output_buffer_printf(output_buffer * buf, const char * format, ...) {
+    RETURN_NULL_IF(NULL == buf, false);
+    RETURN_NULL_IF(NULL == format, false);
+
+    va_list ap;
+    va_start(ap, format);
+    const int len = vsnprintf(NULL, 0, format, ap);
+    va_end(ap);
+    RETURN_NULL_IF(len < 0, false);
+    //  Room for terminating nul written by vsnprintf
+    RETURN_NULL_IF(!reserve_output_buffer(buf, len + 1), false);
+
+    va_start(ap, format);
+    (void)vsnprintf(buf->data + buf->n, len + 1, format, ap);
+    va_end(ap);
+    buf->n += len;
+    return true;
+}
+
+
+/**  Append bytes to buffer, which are copied unless data is NULL, when n zeros are appended
+ *
+ *   @returns true on success.  On failure the buffer is unchanged
+ **/
+bool output_buffer_append(output_buffer * buf, const void * data, size_t n) {
+    RETURN_NULL_IF(NULL == buf, false);
+    RETURN_NULL_IF(!reserve_output_buffer(buf, n), false);
+    if (NULL != data) {
+        memcpy(buf->data + buf->n, data, n);
+    } else {
+        memset(buf->data + buf->n, 0, n);
+    }
+    buf->n += n;
+    return true;
+}
+
+
+static void put_le16(uint8_t * p, uint32_t x) {
+    p[0] = x & 0xff;
+    p[1] = (x >> 8) & 0xff;
+}
+
+static void put_le32(uint8_t * p, uint32_t x) {
+    put_le16(p, x & 0xffff);
+    put_le16(p + 2, x >> 16);
+}
+
+
+/**  Compress data into a single BGZF block
+ *
+ *   @param in  Data to compress [n], n at most BGZF_BLOCK_INPUT
+ *   @param out  Block [out, BGZF_MAX_BLOCK]
+ *
+ *   @returns Length of block, 0 on failure
+ **/
+static size_t compress_bgzf_block(const char * in, size_t n, int level, uint8_t * out) {
+    assert(n <= BGZF_BLOCK_INPUT);
+    z_stream zs = {0};
+    //  Raw deflate: header and footer are written here
+    RETURN_NULL_IF(Z_OK != deflateInit2(&zs, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY), 0);
+    zs.next_in = (Bytef *) in;
+    zs.avail_in = n;
+    zs.next_out = out + BGZF_HEADER_LENGTH;
+    zs.avail_out = BGZF_MAX_BLOCK - BGZF_HEADER_LENGTH - BGZF_FOOTER_LENGTH;
+    //  Even stored uncompressed, BGZF_BLOCK_INPUT of data leaves room to spare
+    const int status = deflate(&zs, Z_FINISH);
+    const size_t ncompressed = zs.total_out;
+    deflateEnd(&zs);
+    RETURN_NULL_IF(Z_STREAM_END != status, 0);
+
+    const size_t block_length = BGZF_HEADER_LENGTH + ncompressed + BGZF_FOOTER_LENGTH;
+    memcpy(out, bgzf_eof, BGZF_HEADER_LENGTH);
+    put_le16(out + 16, block_length - 1);
+    uint8_t * footer = out + BGZF_HEADER_LENGTH + ncompressed;
+    put_le32(footer, crc32(crc32(0L, Z_NULL, 0), (const Bytef *) in, n));
+    put_le32(footer + 4, n);
+    return block_length;
+}
+
+
+/**  Replace contents of buffer by it compressed as BGZF blocks
+ *
+ *   No end of file marker is written, see write_bgzf_eof.
+ *
+ *   @param level  Compression level of zlib, -1 being its default
+ *
+ *   @returns true on success.  On failure the buffer is unchanged
+ **/
+bool output_buffer_bgzf(output_buffer * buf, int level) {
+    RETURN_NULL_IF(NULL == buf, false);
+    if (0 == buf->n) {
+        return true;
+    }
+
+    const size_t nblock = (buf->n + BGZF_BLOCK_INPUT - 1) / BGZF_BLOCK_INPUT;
+    output_buffer out = {NULL, 0, 0};
+    RETURN_NULL_IF(!reserve_output_buffer(&out, nblock * BGZF_MAX_BLOCK), false);
+    for (size_t i = 0; i < buf->n; i += BGZF_BLOCK_INPUT) {
+        const size_t n = (buf->n - i < BGZF_BLOCK_INPUT) ? (buf->n - i) : BGZF_BLOCK_INPUT;
+        const size_t nout = compress_bgzf_block(buf->data + i, n, level, (uint8_t *) out.data + out.n);
+        if (0 == nout) {
+            warnx("Failed to compress output");
+            output_buffer_release(&out);
+            return false;
+        }
+        out.n += nout;
+    }
+
+    output_buffer_release(buf);
+    *buf = out;
+    return true;
+}
+
+
+/**  Free memory of buffer, leaving it empty
+ **/
+void output_buffer_release(output_buffer * buf) {
+    if (NULL == buf) {
+        return;
+    }
+    free(buf->data);
+    *buf = (output_buffer){NULL, 0, 0};
+}
+
+
+/**  Write buffer to file
+ *
+ *   @returns true if all of the buffer was written
+ **/
+bool write_output_buffer(FILE * fh, const output_buffer * buf) {
+    RETURN_NULL_IF(NULL == fh, false);
+    RETURN_NULL_IF(NULL == buf, false);
+    return buf->n == fwrite(buf->data, 1, buf->n, fh);
+}
+
+
+/**  Write empty block marking end of BGZF file
+ *
+ *   @returns true on success
+ **/
+bool write_bgzf_eof(FILE * fh) {
+    RETURN_NULL_IF(NULL == fh, false);
+    return BGZF_EOF_LENGTH == fwrite(bgzf_eof, 1, BGZF_EOF_LENGTH, fh);
+}
@@ -0,0 +1,28 @@
+#pragma once
+#ifndef SCRAPPIE_OUTPUT_H
+#    define SCRAPPIE_OUTPUT_H
+
+#    include <stdbool.h>
+#    include <stddef.h>
+#    include <stdio.h>
+
+/**  Records formatted by a worker, ready to be written in a single call
+ **/
+typedef struct {
+    char * data;
+    size_t n;
+    size_t capacity;
+} output_buffer;
+
+//  Most uncompressed data in a BGZF block, as used by samtools
+#    define BGZF_BLOCK_INPUT 0xff00
+#    define BGZF_EOF_LENGTH 28
+
+bool output_buffer_printf(output_buffer * buf, const char * format, ...);
+bool output_buffer_append(output_buffer * buf, const void * data, size_t n);
+bool output_buffer_bgzf(output_buffer * buf, int level);
+void output_buffer_release(output_buffer * buf);
+bool write_output_buffer(FILE * fh, const output_buffer * buf);
+bool write_bgzf_eof(FILE * fh);
+
+#endif                          /* SCRAPPIE_OUTPUT_H */
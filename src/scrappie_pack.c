@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "packed_reference.h"
+#include "scrappie_licence.h"
+#include "scrappie_seq_helpers.h"
+#include "scrappie_stdlib.h"
+
+// Doesn't play nice with other headers, include last
+#include <argp.h>
+
+
+extern const char *argp_program_version;
+extern const char *argp_program_bug_address;
+static char doc[] = "Scrappie pack -- pack references two bits to a base for mapping\v"
+    "The sequences of every fasta file, in order, are written to a single file that \"scrappie mappy\" "
+    "and \"scrappie seqmappy\" accept in place of a fasta file and map into memory without reading "
+    "or encoding it.  Only the bases ACGT, of either case, can be packed.";
+static char args_doc[] = "fasta [fasta ...]";
+static struct argp_option options[] = {
+    {"output", 'o', "filename", 0, "Write packed reference to file (required)"},
+    {"licence", 10, 0, 0, "Print licensing information"},
+    {"license", 11, 0, OPTION_ALIAS, "Print licensing information"},
+    {0}
+};
+
+
+struct arguments {
+    char * output;
+    char ** files;
+    int nfile;
+};
+
+static struct arguments args = {
+    .output = NULL,
+    .files = NULL,
+    .nfile = 0
+};
+
+static error_t parse_arg(int key, char *arg, struct argp_state *state) {
+    int ret = 0;
+
+    switch (key) {
+    case 'o':
+        args.output = arg;
+        break;
+    case 10:
+    case 11:
+        ret = fputs(scrappie_licence_text, stdout);
+        exit((EOF != ret) ? EXIT_SUCCESS : EXIT_FAILURE);
+        break;
+
+    case ARGP_KEY_NO_ARGS:
+        argp_usage(state);
+        break;
+
+    case ARGP_KEY_ARG:
+        args.files = &state->argv[state->next - 1];
+        args.nfile = state->argc - state->next + 1;
+        state->next = state->argc;
+        break;
+
+    case ARGP_KEY_END:
+        if(NULL == args.output){
+            argp_error(state, "--output is required");
+        }
+        break;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+static struct argp argp = { options, parse_arg, args_doc, doc };
+
+
+int main_pack(int argc, char * argv[]) {
+    argp_parse(&argp, argc, argv, 0, 0, NULL);
+
+    //  Sequences of all files, in order
+    size_t nseq = 0;
+    scrappie_seq_t * seqs = NULL;
+    for(int f=0 ; f < args.nfile ; f++){
+        size_t nfseq = 0;
+        scrappie_seq_t * fseqs = read_sequences_from_fasta(args.files[f], &nfseq);
+        if(NULL == fseqs){
+            errx(EXIT_FAILURE, "Failed to read sequences from \"%s\"", args.files[f]);
+        }
+        scrappie_seq_t * newseqs = realloc(seqs, (nseq + nfseq) * sizeof(scrappie_seq_t));
+        if(NULL == newseqs){
+            errx(EXIT_FAILURE, "Memory allocation failure");
+        }
+        seqs = newseqs;
+        memcpy(seqs + nseq, fseqs, nfseq * sizeof(scrappie_seq_t));
+        nseq += nfseq;
+        //  Sequences now owned by seqs
+        free(fseqs);
+    }
+
+    packed_reference * ref = pack_sequences(seqs, nseq);
+    seqs = free_sequences(seqs, nseq);
+    if(NULL == ref){
+        errx(EXIT_FAILURE, "Failed to pack sequences");
+    }
+    const bool ok = write_packed_reference(args.output, ref);
+    ref = free_packed_reference(ref);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
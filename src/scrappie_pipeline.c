@@ -0,0 +1,1202 @@
+#include <assert.h>
+#include <dirent.h>
+#include <err.h>
+#include <glob.h>
+#if defined(_OPENMP)
+#    include <omp.h>
+#endif
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fast5_interface.h"
+#include "scrappie_matrix.h"
+#include "scrappie_numa.h"
+#include "scrappie_pipeline.h"
+#include "scrappie_profile.h"
+#include "scrappie_stdlib.h"
+
+//  Number of results that may be waiting for output, per worker thread
+#define PIPELINE_SLOTS_PER_THREAD 4
+//  Weight of each read in moving average of time taken by a stage
+#define PIPELINE_STAGE_SMOOTHING 0.1
+
+
+/**  Read whose length has been found ahead of loading it
+ **/
+typedef struct {
+    //  Index of file containing read
+    size_t file;
+    //  Entry of read in file, if the file could be opened
+    hsize_t entry;
+    bool opened;
+    size_t nsample;
+    //  Position of read in the order it was found
+    size_t order;
+} scheduled_read;
+
+/**  Sorted set of names of reads, as recorded in a manifest
+ **/
+typedef struct {
+    char ** name;
+    size_t n;
+} read_name_set;
+
+/**  Producer of reads from files and directories given on commandline
+ *
+ *   Each path is expanded using the system glob only when the previous
+ *   one has been exhausted, so directories are opened one at a time.
+ *   Each fast5 file is kept open until all the reads it contains have
+ *   been loaded.
+ *
+ *   Alternatively, the reads may be produced from a schedule found in
+ *   advance, in which case each fast5 file is kept open only while
+ *   consecutive reads come from it.
+ *
+ *   When sharded, paths are expanded in sorted order and only every
+ *   nshard'th file is opened.  Reads named in the set of those already
+ *   done are skipped without being loaded.
+ **/
+typedef struct {
+    char ** paths;
+    glob_t globbuf;
+    size_t next;
+    bool open;
+    fast5_reader * reader;
+    const char * filename;
+    //  Keep signal as native ADC values
+    bool native;
+    //  Reads in the order they are to be produced, or NULL
+    scheduled_read * schedule;
+    size_t nschedule;
+    size_t nscheduled;
+    //  Files containing scheduled reads and that from which reader is open
+    char ** files;
+    size_t nfile;
+    size_t reader_file;
+    //  Shard of files to produce and number of files found so far
+    size_t shard;
+    size_t nshard;
+    size_t nfile_found;
+    //  Reads already done, or NULL
+    const read_name_set * done;
+} read_producer;
+
+typedef struct {
+    char * readname;
+    void * result;
+    bool done;
+    scrappie_profile_record profile;
+} pipeline_slot;
+
+typedef struct {
+    char * readname;
+    raw_table rt;
+    size_t ticket;
+    double load_seconds;
+} loaded_read;
+
+/**  Read between the two stages of processing
+ **/
+typedef struct {
+    char * readname;
+    void * state;
+    size_t ticket;
+    //  Memory charged for read and profile of first stage
+    size_t cost;
+    scrappie_profile_record profile;
+} staged_read;
+
+typedef struct {
+    read_producer producer;
+    size_t limit;
+    size_t nstarted;
+    size_t nwritten;
+    //  Reorder buffer for results awaiting output
+    pipeline_slot * slot;
+    size_t nslot;
+    //  Queue of reads loaded ahead by the reader thread
+    loaded_read * queue;
+    size_t nqueue;
+    size_t qhead;
+    size_t qcount;
+    bool qfinished;
+    //  Manifest to which reads are added once output, or NULL
+    FILE * manifest;
+    //  Memory admitted against budget: estimates of reads being processed
+    //  and workspace retained by workers between reads
+    size_t max_memory;
+    read_memory_ptr memory;
+    size_t memory_used;
+    size_t nrunning;
+    //  Whether all reads have been taken
+    bool exhausted;
+    //  Queue of reads awaiting second stage, when split, ordered as they left the first
+    read_finish_ptr finish;
+    staged_read * staged;
+    size_t shead;
+    size_t scount;
+    //  Workers running second stage and share of workers for it, fixed or tuned
+    //  from the average time of each stage
+    size_t nfinishing;
+    size_t finish_target;
+    bool tuned;
+    double stage_seconds[2];
+    size_t nstage_timed[2];
+} read_pipeline;
+
+
+/**  Expand path into list of fast5 files
+ *
+ *   @param path  File, directory or glob pattern
+ *   @param sorted  Whether to sort files by name
+ *   @param globbuf  Buffer for results [out]
+ *
+ *   @returns true if any files were found
+ **/
+static bool glob_fast5(char const * path, bool sorted, glob_t * globbuf) {
+    // Find all files matching commandline argument using system glob
+    const size_t rootlen = strlen(path);
+    char * globpath = calloc(rootlen + 9, sizeof(char));
+    RETURN_NULL_IF(NULL == globpath, false);
+    memcpy(globpath, path, rootlen * sizeof(char));
+    {
+        DIR * dirp = opendir(path);
+        if (NULL != dirp) {
+            // If filename is a directory, add wildcard to find all fast5 files within it
+            memcpy(globpath + rootlen, "/*.fast5", 8 * sizeof(char));
+            closedir(dirp);
+        }
+    }
+    int globret = glob(globpath, sorted ? 0 : GLOB_NOSORT, NULL, globbuf);
+    free(globpath);
+    if (0 != globret) {
+        if (GLOB_NOMATCH == globret) {
+            warnx("File or directory \"%s\" does not exist or no fast5 files found.", path);
+        }
+        globfree(globbuf);
+        return false;
+    }
+    return true;
+}
+
+
+/**  Copy of string, or of two strings joined by a colon
+ **/
+static char * join_name(const char * str1, const char * str2) {
+    const size_t len1 = strlen(str1);
+    const size_t len2 = (NULL != str2) ? strlen(str2) : 0;
+    char * name = calloc(len1 + len2 + 2, sizeof(char));
+    RETURN_NULL_IF(NULL == name, NULL);
+    memcpy(name, str1, len1);
+    if (NULL != str2) {
+        name[len1] = ':';
+        memcpy(name + len1 + 1, str2, len2);
+    }
+    return name;
+}
+
+
+/**  Name by which a read is known in a manifest
+ *
+ *   The directory containing a file is not part of the name so that a run may
+ *   be resumed with its reads mounted elsewhere.
+ **/
+static const char * read_key(const char * readname) {
+    const char * slash = strrchr(readname, '/');
+    return (NULL != slash) ? slash + 1 : readname;
+}
+
+
+static int compare_names(const void * a, const void * b) {
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+
+static bool read_name_set_contains(const read_name_set * set, const char * name) {
+    if (NULL == set || 0 == set->n) {
+        return false;
+    }
+    return NULL != bsearch(&name, set->name, set->n, sizeof(char *), compare_names);
+}
+
+
+static void free_read_name_set(read_name_set * set) {
+    for (size_t i = 0; i < set->n; i++) {
+        free(set->name[i]);
+    }
+    free(set->name);
+    *set = (read_name_set){NULL, 0};
+}
+
+
+/**  Read names of reads done from manifest, one per line
+ *
+ *   A manifest that does not exist lists no reads.
+ *
+ *   @param filename  Path to manifest
+ *   @param set  Names read [out]
+ *
+ *   @returns true on success
+ **/
+static bool read_manifest(const char * filename, read_name_set * set) {
+    *set = (read_name_set){NULL, 0};
+    FILE * fh = fopen(filename, "r");
+    if (NULL == fh) {
+        return true;
+    }
+    size_t capacity = 0;
+    size_t buflen = 256;
+    char * buf = malloc(buflen);
+    bool ok = (NULL != buf);
+    while (ok && NULL != fgets(buf, buflen, fh)) {
+        size_t len = strlen(buf);
+        //  Extend buffer until it holds the whole line
+        while (ok && len + 1 == buflen && '\n' != buf[len - 1]) {
+            char * newbuf = realloc(buf, 2 * buflen);
+            ok = (NULL != newbuf);
+            if (ok) {
+                buf = newbuf;
+                buflen *= 2;
+                if (NULL == fgets(buf + len, buflen - len, fh)) {
+                    break;
+                }
+                len += strlen(buf + len);
+            }
+        }
+        if (len > 0 && '\n' == buf[len - 1]) {
+            buf[--len] = '\0';
+        }
+        if (!ok || 0 == len) {
+            continue;
+        }
+        if (set->n == capacity) {
+            capacity = (capacity > 0) ? 2 * capacity : 1024;
+            char ** name = realloc(set->name, capacity * sizeof(char *));
+            ok = (NULL != name);
+            if (!ok) {
+                break;
+            }
+            set->name = name;
+        }
+        set->name[set->n] = join_name(buf, NULL);
+        ok = (NULL != set->name[set->n]);
+        set->n += ok;
+    }
+    free(buf);
+    fclose(fh);
+    if (!ok) {
+        warnx("Failed to read manifest \"%s\"", filename);
+        free_read_name_set(set);
+        return false;
+    }
+    qsort(set->name, set->n, sizeof(char *), compare_names);
+    return true;
+}
+
+
+/**  Whether the next file found belongs to the shard of the producer
+ **/
+static bool next_file_in_shard(read_producer * producer) {
+    const size_t file = producer->nfile_found;
+    producer->nfile_found += 1;
+    return (producer->nshard < 2) || (producer->shard == file % producer->nshard);
+}
+
+
+/**  Whether the next read of the open reader of a producer has already been done
+ *
+ *   If the read has been done, the reader moves past it; otherwise the reader is
+ *   left where it was.
+ *
+ *   @returns true if the read has been done or there are no more reads
+ **/
+static bool next_reader_read_done(read_producer * producer) {
+    if (NULL == producer->done || 0 == producer->done->n) {
+        return false;
+    }
+    hsize_t entry;
+    char * group = NULL;
+    if (!fast5_reader_next_entry(producer->reader, &entry, &group, NULL)) {
+        return true;
+    }
+    char * readname = join_name(producer->filename, group);
+    free(group);
+    const bool done = (NULL != readname) && read_name_set_contains(producer->done, read_key(readname));
+    free(readname);
+    if (!done) {
+        fast5_reader_seek(producer->reader, entry);
+    }
+    return done;
+}
+
+
+/**  Load next read from the open reader of a producer
+ *
+ *   @returns Name of read, to be freed by caller, or NULL if no read was found
+ *   or its name could not be allocated
+ **/
+static char * next_reader_read(read_producer * producer, raw_table * rt) {
+    char * group = NULL;
+    *rt = producer->native ? fast5_reader_next_native(producer->reader, &group)
+                           : fast5_reader_next(producer->reader, true, &group);
+    const bool multi = producer->reader->multi;
+    if (!multi || NULL != group) {
+        char * readname = join_name(producer->filename, group);
+        free(group);
+        if (NULL != readname) {
+            return readname;
+        }
+        warnx("Failed to allocate memory for read name");
+        free(rt->raw);
+        free(rt->sample);
+        free(rt->uuid);
+        *rt = (raw_table){ NULL, 0, 0, 0, NULL };
+    }
+    return NULL;
+}
+
+
+/**  Load next read from the schedule of a producer
+ *
+ *   Not thread safe.
+ *
+ *   @returns As next_read
+ **/
+static char * next_scheduled_read(read_producer * producer, raw_table * rt) {
+    *rt = (raw_table){ NULL, 0, 0, 0, NULL };
+    while (producer->nscheduled < producer->nschedule) {
+        const scheduled_read sr = producer->schedule[producer->nscheduled];
+        producer->nscheduled += 1;
+        producer->filename = producer->files[sr.file];
+        if (!sr.opened) {
+            //  Failure was reported when schedule was made
+            return join_name(producer->filename, NULL);
+        }
+        if (NULL != producer->reader && producer->reader_file != sr.file) {
+            producer->reader = free_fast5_reader(producer->reader);
+        }
+        if (NULL == producer->reader) {
+            producer->reader = open_fast5_reader(producer->filename);
+            producer->reader_file = sr.file;
+            if (NULL == producer->reader) {
+                return join_name(producer->filename, NULL);
+            }
+        }
+        fast5_reader_seek(producer->reader, sr.entry);
+        char * readname = next_reader_read(producer, rt);
+        if (NULL != readname) {
+            return readname;
+        }
+    }
+    return NULL;
+}
+
+
+/**  Load next read from producer
+ *
+ *   Not thread safe.
+ *
+ *   @param producer  Producer of reads
+ *   @param rt  Raw signal of read, whose raw and sample elements are NULL if
+ *   loading failed [out]
+ *
+ *   @returns Name of read, to be freed by caller, or NULL when all reads have been
+ *   produced.  The name is the path to the file, followed by a colon and the name
+ *   of the read for files containing multiple reads.
+ **/
+static char * next_read(read_producer * producer, raw_table * rt) {
+    if (NULL != producer->schedule) {
+        return next_scheduled_read(producer, rt);
+    }
+    *rt = (raw_table){ NULL, 0, 0, 0, NULL };
+    while (true) {
+        if (NULL != producer->reader) {
+            if (!fast5_reader_finished(producer->reader)) {
+                if (next_reader_read_done(producer)) {
+                    continue;
+                }
+                char * readname = next_reader_read(producer, rt);
+                if (NULL != readname) {
+                    return readname;
+                }
+                continue;
+            }
+            producer->reader = free_fast5_reader(producer->reader);
+        }
+        if (producer->open) {
+            if (producer->next < producer->globbuf.gl_pathc) {
+                producer->filename = producer->globbuf.gl_pathv[producer->next];
+                producer->next += 1;
+                if (!next_file_in_shard(producer)) {
+                    continue;
+                }
+                producer->reader = open_fast5_reader(producer->filename);
+                if (NULL == producer->reader) {
+                    //  Report failure against the file
+                    return join_name(producer->filename, NULL);
+                }
+                continue;
+            }
+            globfree(&producer->globbuf);
+            producer->open = false;
+        }
+        if (NULL == *producer->paths) {
+            return NULL;
+        }
+        producer->open = glob_fast5(*producer->paths, producer->nshard > 0, &producer->globbuf);
+        producer->next = 0;
+        producer->paths += 1;
+    }
+}
+
+
+static int scheduled_read_longest_first(const void * a, const void * b) {
+    const scheduled_read * ra = a;
+    const scheduled_read * rb = b;
+    if (ra->nsample != rb->nsample) {
+        return (ra->nsample > rb->nsample) ? -1 : 1;
+    }
+    return (ra->order > rb->order) - (ra->order < rb->order);
+}
+
+
+static bool append_scheduled_read(read_producer * producer, size_t * capacity, scheduled_read sr) {
+    if (producer->nschedule == *capacity) {
+        const size_t new_capacity = (*capacity > 0) ? 2 * *capacity : 1024;
+        scheduled_read * schedule = realloc(producer->schedule, new_capacity * sizeof(scheduled_read));
+        RETURN_NULL_IF(NULL == schedule, false);
+        producer->schedule = schedule;
+        *capacity = new_capacity;
+    }
+    sr.order = producer->nschedule;
+    producer->schedule[producer->nschedule] = sr;
+    producer->nschedule += 1;
+    return true;
+}
+
+
+static bool append_schedule_file(read_producer * producer, size_t * capacity, const char * filename) {
+    if (producer->nfile == *capacity) {
+        const size_t new_capacity = (*capacity > 0) ? 2 * *capacity : 256;
+        char ** files = realloc(producer->files, new_capacity * sizeof(char *));
+        RETURN_NULL_IF(NULL == files, false);
+        producer->files = files;
+        *capacity = new_capacity;
+    }
+    producer->files[producer->nfile] = join_name(filename, NULL);
+    RETURN_NULL_IF(NULL == producer->files[producer->nfile], false);
+    producer->nfile += 1;
+    return true;
+}
+
+
+static void free_schedule(read_producer * producer) {
+    for (size_t i = 0; i < producer->nfile; i++) {
+        free(producer->files[i]);
+    }
+    free(producer->files);
+    free(producer->schedule);
+    producer->files = NULL;
+    producer->nfile = 0;
+    producer->schedule = NULL;
+    producer->nschedule = 0;
+}
+
+
+/**  Find every read and schedule them longest first
+ *
+ *   Only the length of each read is found, from the extent of its signal,
+ *   so scheduling is cheap compared to loading.  Reads of equal length keep
+ *   the order in which they were found.
+ *
+ *   @param producer  Producer whose paths are yet to be expanded
+ *   @param limit  Maximum number of reads to schedule, in the order they are
+ *   found (0 is unlimited)
+ *
+ *   @returns true on success.  On failure, the producer has no schedule.
+ **/
+static bool schedule_longest_first(read_producer * producer, size_t limit) {
+    size_t file_capacity = 0;
+    size_t schedule_capacity = 0;
+    bool ok = true;
+    for (char ** path = producer->paths; ok && NULL != *path; path++) {
+        glob_t globbuf;
+        if (!glob_fast5(*path, producer->nshard > 0, &globbuf)) {
+            continue;
+        }
+        for (size_t i = 0; ok && i < globbuf.gl_pathc; i++) {
+            if (limit > 0 && producer->nschedule >= limit) {
+                break;
+            }
+            if (!next_file_in_shard(producer)) {
+                continue;
+            }
+            const size_t file = producer->nfile;
+            ok = append_schedule_file(producer, &file_capacity, globbuf.gl_pathv[i]);
+            if (!ok) {
+                break;
+            }
+            fast5_reader * reader = open_fast5_reader(globbuf.gl_pathv[i]);
+            if (NULL == reader) {
+                ok = append_scheduled_read(producer, &schedule_capacity,
+                                           (scheduled_read){.file = file, .opened = false});
+                continue;
+            }
+            hsize_t entry;
+            size_t nsample;
+            char * group = NULL;
+            char ** pgroup = (NULL != producer->done && producer->done->n > 0) ? &group : NULL;
+            while (ok && (0 == limit || producer->nschedule < limit)
+                   && fast5_reader_next_entry(reader, &entry, pgroup, &nsample)) {
+                if (NULL != pgroup) {
+                    //  Reads already done are not scheduled
+                    char * readname = join_name(globbuf.gl_pathv[i], group);
+                    free(group);
+                    group = NULL;
+                    const bool done = (NULL != readname)
+                        && read_name_set_contains(producer->done, read_key(readname));
+                    free(readname);
+                    if (done) {
+                        continue;
+                    }
+                }
+                ok = append_scheduled_read(producer, &schedule_capacity,
+                                           (scheduled_read){.file = file, .entry = entry, .opened = true,
+                                                            .nsample = nsample});
+            }
+            free(group);
+            reader = free_fast5_reader(reader);
+        }
+        globfree(&globbuf);
+    }
+    if (!ok) {
+        warnx("Failed to allocate memory for schedule of reads");
+        free_schedule(producer);
+        return false;
+    }
+    if (NULL == producer->schedule) {
+        //  No reads found, so schedule is empty rather than absent
+        producer->schedule = calloc(1, sizeof(scheduled_read));
+        RETURN_NULL_IF(NULL == producer->schedule, false);
+    }
+    qsort(producer->schedule, producer->nschedule, sizeof(scheduled_read), scheduled_read_longest_first);
+    return true;
+}
+
+
+/**  Load next read, with its position in output order
+ *
+ *   Must be called within the read_pipeline_input critical section.
+ *
+ *   @returns true if a read was loaded, false when there are no more reads or
+ *   the limit has been reached.
+ **/
+static bool load_next_read(read_pipeline * p, loaded_read * lr) {
+    if (0 != p->limit && p->nstarted >= p->limit) {
+        return false;
+    }
+    const double start = scrappie_profile_enabled() ? scrappie_profile_now() : 0.0;
+    lr->readname = next_read(&p->producer, &lr->rt);
+    lr->load_seconds = scrappie_profile_enabled() ? scrappie_profile_now() - start : 0.0;
+    lr->ticket = p->nstarted;
+    const bool loaded = (NULL != lr->readname);
+    p->nstarted += loaded;
+    return loaded;
+}
+
+
+/**  Take and load next read, with its position in output order
+ *
+ *   The HDF5 library serialises calls from different threads so nothing is
+ *   lost by loading within the critical section.
+ *
+ *   @returns true if a read was taken, false when there are no more reads or
+ *   the limit has been reached.
+ **/
+static bool take_read(read_pipeline * p, loaded_read * lr) {
+    bool taken = false;
+#pragma omp critical(read_pipeline_input)
+    taken = load_next_read(p, lr);
+    return taken;
+}
+
+
+/**  Take and load next read, if its result would fit into reorder buffer
+ *
+ *   Never waits for the buffer, so that a worker may turn to the second stage
+ *   of processing instead.  Once there are no more reads, the pipeline is
+ *   marked as exhausted.
+ *
+ *   @returns true if a read was taken
+ **/
+static bool take_read_if_slot(read_pipeline * p, loaded_read * lr) {
+    bool taken = false;
+#pragma omp critical(read_pipeline_input)
+    {
+        size_t nwritten;
+#pragma omp atomic read
+        nwritten = p->nwritten;
+        if (p->nstarted - nwritten < p->nslot) {
+            taken = load_next_read(p, lr);
+            if (!taken) {
+#pragma omp atomic write
+                p->exhausted = true;
+            }
+        }
+    }
+    return taken;
+}
+
+
+static bool pipeline_exhausted(read_pipeline * p) {
+    bool exhausted;
+#pragma omp atomic read
+    exhausted = p->exhausted;
+    return exhausted;
+}
+
+
+/**  Wait until result for read would fit into reorder buffer
+ **/
+static void wait_for_slot(read_pipeline * p, size_t ticket) {
+    while (true) {
+        size_t nwritten;
+#pragma omp atomic read
+        nwritten = p->nwritten;
+        if (ticket - nwritten < p->nslot) {
+            return;
+        }
+        sched_yield();
+    }
+}
+
+
+/**  Load reads ahead of the workers
+ *
+ *   Run by a single thread that does no basecalling, so that waiting for
+ *   storage overlaps with computation.  At most nqueue loaded reads are
+ *   held waiting for a worker.
+ **/
+static void prefetch_reads(read_pipeline * p) {
+    loaded_read lr;
+    while (take_read(p, &lr)) {
+        wait_for_slot(p, lr.ticket);
+
+        bool queued = false;
+        while (!queued) {
+#pragma omp critical(read_pipeline_queue)
+            {
+                if (p->qcount < p->nqueue) {
+                    p->queue[(p->qhead + p->qcount) % p->nqueue] = lr;
+                    p->qcount += 1;
+                    queued = true;
+                }
+            }
+            if (!queued) {
+                sched_yield();
+            }
+        }
+    }
+#pragma omp critical(read_pipeline_queue)
+    p->qfinished = true;
+}
+
+
+/**  Take next read loaded by the reader thread, if one is ready
+ *
+ *   Once all reads have been taken, the pipeline is marked as exhausted.
+ *
+ *   @returns true if a read was taken
+ **/
+static bool poll_prefetched_read(read_pipeline * p, loaded_read * lr) {
+    bool taken = false;
+#pragma omp critical(read_pipeline_queue)
+    {
+        if (p->qcount > 0) {
+            *lr = p->queue[p->qhead];
+            p->qhead = (p->qhead + 1) % p->nqueue;
+            p->qcount -= 1;
+            taken = true;
+        } else if (p->qfinished) {
+#pragma omp atomic write
+            p->exhausted = true;
+        }
+    }
+    return taken;
+}
+
+
+/**  Take next read loaded by the reader thread, waiting if none are ready
+ *
+ *   @returns true if a read was taken, false when all reads have been taken
+ **/
+static bool take_prefetched_read(read_pipeline * p, loaded_read * lr) {
+    while (!poll_prefetched_read(p, lr)) {
+        if (pipeline_exhausted(p)) {
+            return false;
+        }
+        sched_yield();
+    }
+    return true;
+}
+
+
+/**  Move signal of read into memory first touched by the calling thread
+ *
+ *   Used when workers are placed on NUMA nodes, since a read loaded by the
+ *   reader thread is otherwise on the node of the reader.  The signal is left
+ *   where it is if it cannot be copied.
+ **/
+static void localise_signal(raw_table * rt) {
+    if (NULL != rt->raw) {
+        float * raw = malloc(rt->n * sizeof(float));
+        if (NULL != raw) {
+            memcpy(raw, rt->raw, rt->n * sizeof(float));
+            free(rt->raw);
+            rt->raw = raw;
+        }
+    } else if (NULL != rt->sample) {
+        int16_t * sample = malloc(rt->n * sizeof(int16_t));
+        if (NULL != sample) {
+            memcpy(sample, rt->sample, rt->n * sizeof(int16_t));
+            free(rt->sample);
+            rt->sample = sample;
+        }
+    }
+}
+
+
+/**  Charge memory for read if it fits into budget
+ *
+ *   @returns true if charged
+ **/
+static bool try_admit_read(read_pipeline * p, size_t cost) {
+    bool admitted = false;
+#pragma omp critical(read_pipeline_memory)
+    {
+        if (0 == p->nrunning || p->memory_used + cost <= p->max_memory) {
+            p->memory_used += cost;
+            p->nrunning += 1;
+            admitted = true;
+        }
+    }
+    return admitted;
+}
+
+
+/**  Wait until memory for read fits into budget, then charge it
+ *
+ *   A read is always admitted when no other read is being processed, so a
+ *   read whose estimate exceeds the whole budget is processed alone rather
+ *   than never.
+ *
+ *   @returns Memory charged for read, to be returned by release_read
+ **/
+static size_t admit_read(read_pipeline * p, const raw_table rt) {
+    if (0 == p->max_memory || NULL == p->memory) {
+        return 0;
+    }
+    const size_t cost = p->memory(rt);
+    while (!try_admit_read(p, cost)) {
+        sched_yield();
+    }
+    return cost;
+}
+
+
+/**  Return memory of read to budget
+ *
+ *   The workspace the worker retains for the next read is charged in its
+ *   place, replacing that charged after its previous read.
+ *
+ *   @param cost  Memory charged by admit_read
+ *   @param held [in/out]  Workspace charged for worker
+ **/
+static void release_read(read_pipeline * p, size_t cost, size_t * held) {
+    if (0 == p->max_memory || NULL == p->memory) {
+        return;
+    }
+    const size_t workspace = scrappie_workspace_size();
+#pragma omp critical(read_pipeline_memory)
+    {
+        p->memory_used = p->memory_used - cost - *held + workspace;
+        p->nrunning -= 1;
+    }
+    *held = workspace;
+}
+
+
+/**  Store result and write all results that are next in order
+ **/
+static void complete_read(read_pipeline * p, size_t ticket, char * readname, void * result,
+                          scrappie_profile_record profile, read_output_ptr output) {
+#pragma omp critical(read_pipeline_output)
+    {
+        p->slot[ticket % p->nslot] = (pipeline_slot){readname, result, true, profile};
+        for (pipeline_slot * s = p->slot + p->nwritten % p->nslot; s->done; s = p->slot + p->nwritten % p->nslot) {
+            const double start = scrappie_profile_enabled() ? scrappie_profile_now() : 0.0;
+            if (NULL != s->result) {
+                output(s->readname, s->result);
+                if (NULL != p->manifest) {
+                    //  Read is only recorded once all its output has been flushed
+                    (void)fflush(NULL);
+                    fprintf(p->manifest, "%s\n", read_key(s->readname));
+                    (void)fflush(p->manifest);
+                }
+            }
+            if (scrappie_profile_enabled()) {
+                scrappie_profile_write_read(s->readname, s->profile, scrappie_profile_now() - start);
+            }
+            free(s->readname);
+            *s = (pipeline_slot){NULL, NULL, false};
+#pragma omp atomic update
+            p->nwritten += 1;
+        }
+    }
+}
+
+
+/**  Profile of a read whose stages were run separately
+ **/
+static scrappie_profile_record join_profiles(scrappie_profile_record first, const scrappie_profile_record second) {
+    for (size_t i = 0; i < SCRAPPIE_NSTAGE; i++) {
+        first.seconds[i] += second.seconds[i];
+    }
+    first.nsample += second.nsample;
+    first.nbase += second.nbase;
+    return first;
+}
+
+
+/**  Record time taken by a stage on a read and retune share of workers for second stage
+ *
+ *   The stages keep pace with each other when each has a share of the workers in
+ *   proportion to the time it takes on a read, averaged over recent reads.  Each
+ *   stage keeps at least one worker, if there is more than one.
+ *
+ *   Must be called within the read_pipeline_stages critical section.
+ **/
+static void time_stage(read_pipeline * p, size_t stage, double seconds, size_t nworker) {
+    p->stage_seconds[stage] = (0 == p->nstage_timed[stage])
+        ? seconds
+        : p->stage_seconds[stage] + PIPELINE_STAGE_SMOOTHING * (seconds - p->stage_seconds[stage]);
+    p->nstage_timed[stage] += 1;
+
+    const double total = p->stage_seconds[0] + p->stage_seconds[1];
+    if (!p->tuned || 0 == p->nstage_timed[0] || 0 == p->nstage_timed[1] || total <= 0.0) {
+        return;
+    }
+    const size_t most = (nworker > 1) ? nworker - 1 : 1;
+    size_t target = (size_t)(nworker * p->stage_seconds[1] / total + 0.5);
+    target = (target < 1) ? 1 : target;
+    p->finish_target = (target > most) ? most : target;
+}
+
+
+/**  Run second stage on the read that has waited for it longest, if any
+ *
+ *   @param any  Whether to run the stage even when its share of workers is busy
+ *   @param nworker  Number of workers
+ *   @param held [in/out]  Workspace charged for worker
+ *
+ *   @returns true if a read was finished
+ **/
+static bool finish_staged_read(read_pipeline * p, bool any, size_t nworker, size_t * held,
+                               read_output_ptr output) {
+    staged_read sr;
+    bool taken = false;
+#pragma omp critical(read_pipeline_stages)
+    {
+        if (p->scount > 0 && (any || p->nfinishing < p->finish_target)) {
+            sr = p->staged[p->shead];
+            p->shead = (p->shead + 1) % p->nslot;
+            p->scount -= 1;
+            p->nfinishing += 1;
+            taken = true;
+        }
+    }
+    if (!taken) {
+        return false;
+    }
+
+    (void)scrappie_profile_take();
+    const double start = scrappie_profile_now();
+    void * result = p->finish(sr.readname, sr.state);
+    const double seconds = scrappie_profile_now() - start;
+    release_read(p, sr.cost, held);
+#pragma omp critical(read_pipeline_stages)
+    {
+        p->nfinishing -= 1;
+        time_stage(p, 1, seconds, nworker);
+    }
+    complete_read(p, sr.ticket, sr.readname, result, join_profiles(sr.profile, scrappie_profile_take()), output);
+    return true;
+}
+
+
+/**  Run first stage on read and queue it for the second
+ *
+ *   While waiting for memory for the read to fit into the budget, the worker
+ *   finishes reads waiting for the second stage, since it is they that return
+ *   memory.  A read that fails in the first stage is output, as failed, at once.
+ **/
+static void start_staged_read(read_pipeline * p, loaded_read lr, size_t nworker, size_t * held,
+                              read_process_ptr process, read_output_ptr output) {
+    size_t cost = 0;
+    if (0 != p->max_memory && NULL != p->memory) {
+        cost = p->memory(lr.rt);
+        while (!try_admit_read(p, cost)) {
+            if (!finish_staged_read(p, true, nworker, held, output)) {
+                sched_yield();
+            }
+        }
+    }
+
+    (void)scrappie_profile_take();
+    scrappie_profile_add(SCRAPPIE_STAGE_IO, lr.load_seconds);
+    const double start = scrappie_profile_now();
+    void * state = process(lr.readname, lr.rt);
+    const double seconds = scrappie_profile_now() - start;
+    const scrappie_profile_record profile = scrappie_profile_take();
+#pragma omp critical(read_pipeline_stages)
+    time_stage(p, 0, seconds, nworker);
+
+    if (NULL == state) {
+        release_read(p, cost, held);
+        complete_read(p, lr.ticket, lr.readname, NULL, profile, output);
+        return;
+    }
+    //  Every read started has a slot in the reorder buffer, so the queue never overflows
+#pragma omp critical(read_pipeline_stages)
+    {
+        assert(p->scount < p->nslot);
+        p->staged[(p->shead + p->scount) % p->nslot] = (staged_read){lr.readname, state, lr.ticket, cost, profile};
+        p->scount += 1;
+    }
+}
+
+
+/**  Work on either stage of processing until all reads are output
+ *
+ *   A worker finishes a waiting read while fewer than the share of workers for
+ *   the second stage are doing so, and otherwise starts a new read.  When no
+ *   read can be started, because there are none left or the reorder buffer is
+ *   full, any waiting read is finished regardless of share so no worker is idle
+ *   while there is work.
+ **/
+static void run_staged_worker(read_pipeline * p, bool threaded_reader, bool numa, size_t nworker,
+                              read_process_ptr process, read_output_ptr output) {
+    size_t held = 0;
+    while (true) {
+        if (finish_staged_read(p, false, nworker, &held, output)) {
+            continue;
+        }
+        loaded_read lr;
+        const bool taken = threaded_reader ? poll_prefetched_read(p, &lr) : take_read_if_slot(p, &lr);
+        if (taken) {
+            if (threaded_reader && numa) {
+                localise_signal(&lr.rt);
+            }
+            start_staged_read(p, lr, nworker, &held, process, output);
+            continue;
+        }
+        if (finish_staged_read(p, true, nworker, &held, output)) {
+            continue;
+        }
+        //  Reads still in their first stage are finished by the workers that started them
+        if (pipeline_exhausted(p)) {
+            break;
+        }
+        sched_yield();
+    }
+}
+
+
+/**  Process reads in parallel and output results in order
+ *
+ *   Reads are taken one at a time by worker threads from a producer that expands
+ *   the files and directories given.  Each idle worker takes the next read, so load
+ *   is balanced however the reads are spread between directories.  Files containing
+ *   multiple reads are opened once and their reads loaded in turn.  Results go into a
+ *   bounded reorder buffer and are written by whichever thread completes the next
+ *   read in order, so output is in the same order as the input.  A worker whose
+ *   read would overflow the buffer waits until earlier reads have been written.
+ *
+ *   When prefetching, an additional thread loads reads ahead of the workers so that
+ *   storage latency is hidden behind basecalling.
+ *
+ *   When profiling, the time to load and output each read is recorded along with
+ *   the stages timed by the processing function, and the profile of each read is
+ *   written as it is output.
+ *
+ *   When scheduling longest first, the length of every read is found before any
+ *   are processed and reads are taken in order of decreasing length, so that no
+ *   long read is started when the other workers are about to run out of work.
+ *   Results are then written in the same order.
+ *
+ *   When given a memory budget, a worker only starts on its read once the
+ *   estimated memory of the read, together with that of the reads being
+ *   processed and of the workspace retained by each worker, fits within the
+ *   budget.  A read too large for the budget is processed once no other
+ *   read is.
+ *
+ *   When placing workers on NUMA nodes, each worker is pinned to a CPU of its
+ *   node for the duration of the pipeline and reads loaded by the reader thread
+ *   are copied into memory local to the worker that takes them.
+ *
+ *   When given a second stage, processing of each read is split in two, e.g. the
+ *   network and decoding of basecalling, and reads pass between the stages through
+ *   a queue.  The workers are divided between the stages, either as given or in
+ *   proportion to the time each stage takes on a read, measured as the pipeline
+ *   runs, so that neither stage starves the other as reads change.  A worker
+ *   moves between stages from one read to the next, helping the other stage
+ *   whenever its own has no work.
+ *
+ *   Files may be divided into shards, assigned in sorted order, so that separate
+ *   runs process disjoint sets of reads.  Each read output is recorded in the
+ *   manifest, if given, after its output has been flushed, and reads already
+ *   recorded are skipped so that an interrupted run may be resumed.
+ *
+ *   @param paths  NULL terminated array of files, directories or glob patterns
+ *   @param param  Limit on reads, prefetching, type of signal, schedule, shard,
+ *   manifest, memory budget, placement of workers and second stage
+ *   @param process  Function to process each read
+ *   @param output  Function to output and free each successful result
+ *
+ *   @returns Number of reads processed
+ **/
+size_t run_read_pipeline(char ** paths, const read_pipeline_param param,
+                         read_process_ptr process, read_output_ptr output) {
+    RETURN_NULL_IF(NULL == paths, 0);
+    RETURN_NULL_IF(NULL == process, 0);
+    RETURN_NULL_IF(NULL == output, 0);
+
+    int nthread = 1;
+    bool prefetching = false;
+#if defined(_OPENMP)
+    nthread = omp_get_max_threads();
+    prefetching = (param.nprefetch > 0);
+#endif
+    const size_t nslot = PIPELINE_SLOTS_PER_THREAD * nthread;
+    read_pipeline p = {
+        .producer = {.paths = paths, .next = 0, .open = false, .reader = NULL, .filename = NULL,
+                     .native = param.native},
+        .limit = param.limit,
+        .slot = calloc(nslot, sizeof(pipeline_slot)),
+        .nslot = nslot,
+        .queue = prefetching ? calloc(param.nprefetch, sizeof(loaded_read)) : NULL,
+        .nqueue = param.nprefetch,
+        .max_memory = param.max_memory,
+        .memory = param.memory,
+        .finish = param.finish,
+        .staged = (NULL != param.finish) ? calloc(nslot, sizeof(staged_read)) : NULL,
+        .tuned = (0 == param.nfinish),
+        .finish_target = (param.nfinish > 0) ? param.nfinish : (nthread + 1) / 2};
+    if (NULL == p.slot || (prefetching && NULL == p.queue) || (NULL != p.finish && NULL == p.staged)) {
+        free(p.staged);
+        free(p.queue);
+        free(p.slot);
+        return 0;
+    }
+    assert(0 == param.nshard || param.shard < param.nshard);
+    p.producer.shard = param.shard;
+    p.producer.nshard = param.nshard;
+    read_name_set done = {NULL, 0};
+    if (NULL != param.manifest) {
+        p.manifest = read_manifest(param.manifest, &done) ? fopen(param.manifest, "a") : NULL;
+        if (NULL == p.manifest) {
+            warnx("Failed to open manifest \"%s\"", param.manifest);
+            free_read_name_set(&done);
+            free(p.staged);
+            free(p.queue);
+            free(p.slot);
+            return 0;
+        }
+        p.producer.done = &done;
+    }
+    if (param.longest_first && !schedule_longest_first(&p.producer, param.limit)) {
+        if (NULL != p.manifest) {
+            fclose(p.manifest);
+        }
+        free_read_name_set(&done);
+        free(p.staged);
+        free(p.queue);
+        free(p.slot);
+        return 0;
+    }
+
+    const bool numa = param.numa && scrappie_numa_enable(true) > 0;
+
+#pragma omp parallel num_threads(nthread + prefetching)
+    {
+        bool threaded_reader = false;
+        size_t worker = 0;
+        size_t nworker = 1;
+#if defined(_OPENMP)
+        //  Team may be smaller than requested, in which case workers load their own reads
+        threaded_reader = prefetching && omp_get_num_threads() > 1;
+        worker = omp_get_thread_num() - threaded_reader;
+        nworker = omp_get_num_threads() - threaded_reader;
+        if (threaded_reader && 0 == omp_get_thread_num()) {
+            prefetch_reads(&p);
+        } else
+#endif
+        {
+            if (numa) {
+                (void)scrappie_numa_bind(worker, nworker);
+            }
+            //  Recycle matrix memory between layers and reads on this thread
+            (void)scrappie_workspace_enable(true);
+            size_t held = 0;
+            while (NULL == p.finish) {
+                loaded_read lr;
+                if (threaded_reader) {
+                    if (!take_prefetched_read(&p, &lr)) {
+                        break;
+                    }
+                    if (numa) {
+                        localise_signal(&lr.rt);
+                    }
+                } else {
+                    if (!take_read(&p, &lr)) {
+                        break;
+                    }
+                    wait_for_slot(&p, lr.ticket);
+                }
+
+                //  Time spent on work shared from other reads is not charged to this one
+                (void)scrappie_profile_take();
+                scrappie_profile_add(SCRAPPIE_STAGE_IO, lr.load_seconds);
+                const size_t cost = admit_read(&p, lr.rt);
+                void * result = process(lr.readname, lr.rt);
+                release_read(&p, cost, &held);
+                complete_read(&p, lr.ticket, lr.readname, result, scrappie_profile_take(), output);
+            }
+            if (NULL != p.finish) {
+                run_staged_worker(&p, threaded_reader, numa, nworker, process, output);
+            }
+            scrappie_numa_unbind();
+        }
+    }
+    if (numa) {
+        (void)scrappie_numa_enable(false);
+    }
+
+    //  Limit may have been reached part way through a file
+    p.producer.reader = free_fast5_reader(p.producer.reader);
+    if (p.producer.open) {
+        globfree(&p.producer.globbuf);
+    }
+    free_schedule(&p.producer);
+    if (NULL != p.manifest) {
+        fclose(p.manifest);
+    }
+    free_read_name_set(&done);
+    free(p.staged);
+    free(p.queue);
+    free(p.slot);
+    return p.nstarted;
+}
@@ -0,0 +1,92 @@
+#pragma once
+#ifndef SCRAPPIE_PIPELINE_H
+#    define SCRAPPIE_PIPELINE_H
+
+#    include <stdbool.h>
+#    include <stddef.h>
+#    include "scrappie_structures.h"
+
+/**  Process a single read.  Called concurrently from worker threads.
+ *
+ *   @param readname  Path to file containing read, followed by a colon and the
+ *   name of the read for files containing multiple reads
+ *   @param rt  Raw signal of read, owned by the processing function.  The signal
+ *   is either in the raw element or, if the pipeline was run on native values, the
+ *   sample element; both are NULL if the read could not be loaded.
+ *
+ *   @returns Result to be passed to output function, or NULL on failure
+ **/
+typedef void * (*read_process_ptr)(char * readname, raw_table rt);
+
+/**  Finish processing a read, as the second of two stages.  Called concurrently
+ *   from worker threads, not necessarily that which ran the first stage.
+ *
+ *   @param readname  Name of read, as passed to the processing function
+ *   @param state  Non-NULL result of processing function, owned by this function
+ *
+ *   @returns Result to be passed to output function, or NULL on failure
+ **/
+typedef void * (*read_finish_ptr)(char * readname, void * state);
+
+/**  Output and free the result of processing a read.
+ *
+ *   Called for one read at a time, in the order the reads were found.
+ *
+ *   @param readname  Name of read, as passed to the processing function
+ *   @param result  Non-NULL result returned by the processing function
+ **/
+typedef void (*read_output_ptr)(char * readname, void * result);
+
+/**  Estimate memory needed to process a read
+ *
+ *   @param rt  Raw signal of read, as passed to the processing function
+ *
+ *   @returns Bytes
+ **/
+typedef size_t (*read_memory_ptr)(const raw_table rt);
+
+typedef struct {
+    //  Maximum number of reads to process (0 is unlimited)
+    size_t limit;
+    //  Maximum number of reads to load ahead on a separate thread (0 is off)
+    size_t nprefetch;
+    //  Pass signal as native ADC values in the sample element rather than in pA
+    bool native;
+    //  Find the length of every read before starting and process the longest first
+    bool longest_first;
+    //  Only process files whose position, in sorted order, is shard modulo nshard
+    //  (nshard of 0 is all files, unsorted)
+    size_t shard;
+    size_t nshard;
+    //  File listing reads already output, to which each read is added once output, or NULL
+    const char * manifest;
+    //  Pin workers to CPUs of each NUMA node in turn, with a copy of the weights for each node
+    bool numa;
+    //  Budget in bytes for reads being processed at once, with estimate of each (0 is unlimited)
+    size_t max_memory;
+    read_memory_ptr memory;
+    //  Second stage of processing, run by its own share of the workers, or NULL for one stage
+    read_finish_ptr finish;
+    //  Workers running second stage (0 is tuned from the time taken by each stage)
+    size_t nfinish;
+} read_pipeline_param;
+
+static read_pipeline_param const read_pipeline_defaults = {
+    .limit = 0,
+    .nprefetch = 0,
+    .native = false,
+    .longest_first = false,
+    .shard = 0,
+    .nshard = 0,
+    .manifest = NULL,
+    .numa = false,
+    .max_memory = 0,
+    .memory = NULL,
+    .finish = NULL,
+    .nfinish = 0
+};
+
+size_t run_read_pipeline(char ** paths, const read_pipeline_param param,
+                         read_process_ptr process, read_output_ptr output);
+
+#endif                          /* SCRAPPIE_PIPELINE_H */
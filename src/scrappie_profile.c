@@ -0,0 +1,297 @@
+// Needed for clock_gettime
+#define _POSIX_C_SOURCE 199309L
+
+#include <err.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "scrappie_profile.h"
+#include "scrappie_stdlib.h"
+
+#define PROFILE_MAX_DEPTH 16
+
+static const char * stage_names[SCRAPPIE_NSTAGE] = {
+    "io", "trim", "events", "network", "convolution", "gru", "lstm",
+    "feedforward", "softmax", "decode", "homopolymer", "output"
+};
+
+static bool profile_enabled = false;
+static FILE * profile_fh = NULL;
+static enum scrappie_profile_format profile_format = SCRAPPIE_PROFILE_TSV;
+static double profile_interval = 0.0;
+static double profile_start = 0.0;
+static double profile_last_report = 0.0;
+
+//  Totals over all reads, updated atomically by the threads doing the work
+static double total_seconds[SCRAPPIE_NSTAGE];
+static size_t total_nsample = 0;
+static size_t total_nbase = 0;
+static size_t total_nread = 0;
+
+typedef struct {
+    enum scrappie_stage stage;
+    double start;
+    //  Time spent in stages begun within this one
+    double child;
+    //  Layer called from another layer, counted as part of the caller
+    bool merged;
+} profile_frame;
+
+typedef struct {
+    scrappie_profile_record record;
+    size_t depth;
+    profile_frame frame[PROFILE_MAX_DEPTH];
+} profile_state;
+
+static __thread profile_state thread_profile = { { { 0 } } };
+
+
+static bool is_layer_stage(enum scrappie_stage stage) {
+    return stage >= SCRAPPIE_STAGE_CONVOLUTION && stage <= SCRAPPIE_STAGE_SOFTMAX;
+}
+
+
+/**  Open profile of basecalling
+ *
+ *   Once open, the time spent on each stage of basecalling is recorded.
+ *   Each read is written to the side stream as it is output, and a summary
+ *   of throughput over all reads so far is printed to stderr periodically
+ *   and when the profile is closed.  Not thread safe.
+ *
+ *   @param path  File to write profile of each read to, or NULL for none
+ *   @param format  Format of profile of each read
+ *   @param interval  Seconds between reports to stderr (0 is only at close)
+ *
+ *   @returns true on success
+ **/
+bool scrappie_profile_open(const char * path, enum scrappie_profile_format format, double interval) {
+    RETURN_NULL_IF(format >= SCRAPPIE_PROFILE_INVALID, false);
+    scrappie_profile_close();
+
+    if (NULL != path) {
+        profile_fh = fopen(path, "w");
+        if (NULL == profile_fh) {
+            warnx("Failed to open \"%s\" to write profile", path);
+            return false;
+        }
+        if (SCRAPPIE_PROFILE_TSV == format) {
+            fputs("read\tnsample\tnbase\tseconds\tsamples_per_second\tbases_per_second", profile_fh);
+            for (size_t i = 0; i < SCRAPPIE_NSTAGE; i++) {
+                fprintf(profile_fh, "\t%s", stage_names[i]);
+            }
+            fputc('\n', profile_fh);
+        }
+    }
+    memset(total_seconds, 0, sizeof(total_seconds));
+    total_nsample = 0;
+    total_nbase = 0;
+    total_nread = 0;
+    profile_format = format;
+    profile_interval = interval;
+    profile_start = profile_last_report = scrappie_profile_now();
+    profile_enabled = true;
+    return true;
+}
+
+
+/**  Print summary of throughput over all reads so far
+ **/
+static void profile_report(FILE * fh, double now) {
+    const double elapsed = now - profile_start;
+    double total = 0.0;
+    for (size_t i = 0; i < SCRAPPIE_NSTAGE; i++) {
+        total += total_seconds[i];
+    }
+    fprintf(fh, "Profile: %zu reads in %.1fs, %.0f samples/s, %.0f bases/s;", total_nread, elapsed,
+            (elapsed > 0.0) ? total_nsample / elapsed : 0.0, (elapsed > 0.0) ? total_nbase / elapsed : 0.0);
+    for (size_t i = 0; i < SCRAPPIE_NSTAGE; i++) {
+        if (total_seconds[i] > 0.0) {
+            fprintf(fh, " %s %.1f%%", stage_names[i], 100.0 * total_seconds[i] / total);
+        }
+    }
+    fputc('\n', fh);
+}
+
+
+/**  Close profile, printing a final summary to stderr
+ **/
+void scrappie_profile_close(void) {
+    if (!profile_enabled) {
+        return;
+    }
+    profile_report(stderr, scrappie_profile_now());
+    if (NULL != profile_fh) {
+        fclose(profile_fh);
+        profile_fh = NULL;
+    }
+    profile_enabled = false;
+}
+
+
+bool scrappie_profile_enabled(void) {
+    return profile_enabled;
+}
+
+
+const char * scrappie_stage_string(enum scrappie_stage stage) {
+    return (stage < SCRAPPIE_NSTAGE) ? stage_names[stage] : "invalid";
+}
+
+
+enum scrappie_profile_format scrappie_profile_format_from_string(const char * str) {
+    RETURN_NULL_IF(NULL == str, SCRAPPIE_PROFILE_INVALID);
+    if (0 == strcmp(str, "tsv")) {
+        return SCRAPPIE_PROFILE_TSV;
+    }
+    if (0 == strcmp(str, "json")) {
+        return SCRAPPIE_PROFILE_JSON;
+    }
+    return SCRAPPIE_PROFILE_INVALID;
+}
+
+
+/**  Monotonic time in seconds
+ **/
+double scrappie_profile_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+
+static void profile_charge(enum scrappie_stage stage, double seconds) {
+    thread_profile.record.seconds[stage] += seconds;
+#pragma omp atomic update
+    total_seconds[stage] += seconds;
+}
+
+
+/**  Begin timing a stage on the calling thread
+ *
+ *   Does nothing when profiling is not enabled.  Stages begun on a thread
+ *   are charged to the read it is working on.
+ **/
+void scrappie_profile_begin(enum scrappie_stage stage) {
+    if (!profile_enabled || thread_profile.depth >= PROFILE_MAX_DEPTH) {
+        return;
+    }
+    const size_t depth = thread_profile.depth;
+    const bool merged = depth > 0 && is_layer_stage(stage)
+        && is_layer_stage(thread_profile.frame[depth - 1].stage);
+    thread_profile.frame[depth] = (profile_frame){stage, scrappie_profile_now(), 0.0, merged};
+    thread_profile.depth += 1;
+}
+
+
+/**  End timing of stage on the calling thread
+ *
+ *   Stages left unfinished within this one, e.g. by returning early on
+ *   failure, are discarded.
+ **/
+void scrappie_profile_end(enum scrappie_stage stage) {
+    if (!profile_enabled) {
+        return;
+    }
+    const double now = scrappie_profile_now();
+    while (thread_profile.depth > 0) {
+        thread_profile.depth -= 1;
+        const profile_frame * f = thread_profile.frame + thread_profile.depth;
+        if (f->stage != stage) {
+            continue;
+        }
+        if (f->merged) {
+            return;
+        }
+        const double elapsed = now - f->start;
+        profile_charge(stage, elapsed - f->child);
+        if (thread_profile.depth > 0) {
+            thread_profile.frame[thread_profile.depth - 1].child += elapsed;
+        }
+        return;
+    }
+}
+
+
+/**  Charge time measured elsewhere to the read of the calling thread
+ **/
+void scrappie_profile_add(enum scrappie_stage stage, double seconds) {
+    if (profile_enabled && stage < SCRAPPIE_NSTAGE) {
+        profile_charge(stage, seconds);
+    }
+}
+
+
+/**  Count samples and bases of the read of the calling thread
+ **/
+void scrappie_profile_count(size_t nsample, size_t nbase) {
+    if (!profile_enabled) {
+        return;
+    }
+    thread_profile.record.nsample += nsample;
+    thread_profile.record.nbase += nbase;
+#pragma omp atomic update
+    total_nsample += nsample;
+#pragma omp atomic update
+    total_nbase += nbase;
+}
+
+
+/**  Take profile of the read of the calling thread, starting a new read
+ **/
+scrappie_profile_record scrappie_profile_take(void) {
+    const scrappie_profile_record record = thread_profile.record;
+    thread_profile.record = (scrappie_profile_record){ { 0 } };
+    thread_profile.depth = 0;
+    return record;
+}
+
+
+/**  Write profile of read and report throughput if due
+ *
+ *   Must be called for one read at a time, as reads are output.
+ *
+ *   @param readname  Name of read
+ *   @param record  Profile of read
+ *   @param output_seconds  Time spent writing the read
+ **/
+void scrappie_profile_write_read(const char * readname, scrappie_profile_record record, double output_seconds) {
+    if (!profile_enabled) {
+        return;
+    }
+    record.seconds[SCRAPPIE_STAGE_OUTPUT] += output_seconds;
+#pragma omp atomic update
+    total_seconds[SCRAPPIE_STAGE_OUTPUT] += output_seconds;
+    total_nread += 1;
+
+    if (NULL != profile_fh) {
+        double seconds = 0.0;
+        for (size_t i = 0; i < SCRAPPIE_NSTAGE; i++) {
+            seconds += record.seconds[i];
+        }
+        const double sample_rate = (seconds > 0.0) ? record.nsample / seconds : 0.0;
+        const double base_rate = (seconds > 0.0) ? record.nbase / seconds : 0.0;
+        if (SCRAPPIE_PROFILE_TSV == profile_format) {
+            fprintf(profile_fh, "%s\t%zu\t%zu\t%f\t%.0f\t%.0f", readname, record.nsample, record.nbase,
+                    seconds, sample_rate, base_rate);
+            for (size_t i = 0; i < SCRAPPIE_NSTAGE; i++) {
+                fprintf(profile_fh, "\t%f", record.seconds[i]);
+            }
+            fputc('\n', profile_fh);
+        } else {
+            fprintf(profile_fh, "{ \"read\" : \"%s\", \"nsample\" : %zu, \"nbase\" : %zu, \"seconds\" : %f, "
+                    "\"samples_per_second\" : %.0f, \"bases_per_second\" : %.0f, \"stages\" : {",
+                    readname, record.nsample, record.nbase, seconds, sample_rate, base_rate);
+            for (size_t i = 0; i < SCRAPPIE_NSTAGE; i++) {
+                fprintf(profile_fh, "%s \"%s\" : %f", (i > 0) ? "," : "", stage_names[i], record.seconds[i]);
+            }
+            fputs(" } }\n", profile_fh);
+        }
+    }
+
+    const double now = scrappie_profile_now();
+    if (profile_interval > 0.0 && now - profile_last_report >= profile_interval) {
+        profile_report(stderr, now);
+        profile_last_report = now;
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+#ifndef SCRAPPIE_PROFILE_H
+#    define SCRAPPIE_PROFILE_H
+
+#    include <stdbool.h>
+#    include <stddef.h>
+
+/**  Stages of basecalling that are timed when profiling
+ *
+ *   Time is exclusive: a stage begun within another is not also counted in
+ *   the outer stage, except that a layer calling another layer counts as a
+ *   single layer.  The network stage is time spent evaluating the network
+ *   outside of any of the layer stages, e.g. creating features.
+ **/
+enum scrappie_stage {
+    SCRAPPIE_STAGE_IO = 0,
+    SCRAPPIE_STAGE_TRIM,
+    SCRAPPIE_STAGE_EVENTS,
+    SCRAPPIE_STAGE_NETWORK,
+    SCRAPPIE_STAGE_CONVOLUTION,
+    SCRAPPIE_STAGE_GRU,
+    SCRAPPIE_STAGE_LSTM,
+    SCRAPPIE_STAGE_FEEDFORWARD,
+    SCRAPPIE_STAGE_SOFTMAX,
+    SCRAPPIE_STAGE_DECODE,
+    SCRAPPIE_STAGE_HOMOPOLYMER,
+    SCRAPPIE_STAGE_OUTPUT,
+    SCRAPPIE_NSTAGE
+};
+
+enum scrappie_profile_format {
+    SCRAPPIE_PROFILE_TSV = 0,
+    SCRAPPIE_PROFILE_JSON,
+    SCRAPPIE_PROFILE_INVALID
+};
+
+//  Time spent on each stage of a single read
+typedef struct {
+    double seconds[SCRAPPIE_NSTAGE];
+    size_t nsample;
+    size_t nbase;
+} scrappie_profile_record;
+
+bool scrappie_profile_open(const char * path, enum scrappie_profile_format format, double interval);
+void scrappie_profile_close(void);
+bool scrappie_profile_enabled(void);
+const char * scrappie_stage_string(enum scrappie_stage stage);
+enum scrappie_profile_format scrappie_profile_format_from_string(const char * str);
+
+double scrappie_profile_now(void);
+void scrappie_profile_begin(enum scrappie_stage stage);
+void scrappie_profile_end(enum scrappie_stage stage);
+void scrappie_profile_add(enum scrappie_stage stage, double seconds);
+void scrappie_profile_count(size_t nsample, size_t nbase);
+scrappie_profile_record scrappie_profile_take(void);
+void scrappie_profile_write_read(const char * readname, scrappie_profile_record record, double output_seconds);
+
+#endif                          /* SCRAPPIE_PROFILE_H */
@@ -1,5 +1,4 @@
-#include <dirent.h>
-#include <glob.h>
+#include <ctype.h>
 #include <libgen.h>
 #include <math.h>
 
@@ -13,8 +12,15 @@
 #include "decode.h"
 #include "fast5_interface.h"
 #include "networks.h"
+#include "column_file.h"
+#include "posterior_file.h"
+#include "read_filter.h"
 #include "scrappie_common.h"
 #include "scrappie_licence.h"
+#include "scrappie_output.h"
+#include "scrappie_pipeline.h"
+#include "scrappie_profile.h"
+#include "scrappie_simd.h"
 #include "scrappie_stdlib.h"
 #include "util.h"
 #include "homopolymer.h"
@@ -28,17 +34,49 @@ struct _raw_basecall_info {
 
     char *basecall;
     size_t basecall_length;
+    //  Phred qualities of basecall, only calculated for FASTQ output
+    char *quality;
 
     int *pos;
     size_t nblock;
+
+    //  Posterior, only kept when writing posteriors
+    scrappie_matrix post;
+
+    //  Record of read, formatted and compressed by the worker that called it
+    output_buffer record;
+
+    //  Reason read was rejected before the network, and its statistics
+    enum read_filter_reason filtered;
+    read_filter_stats filter_stats;
+
+    //  Seconds taken to call read, over all stages
+    double seconds;
+};
+
+//  Read whose posterior has been calculated, awaiting decoding
+struct _raw_network_info {
+    raw_table rt;
+    scrappie_matrix post;
+    //  Whether traceback is to be checkpointed
+    bool low_memory;
+    //  Whether read needs no decoding, having been rejected, failed or
+    //  called from its sparse posterior, in which case its result is res
+    bool decoded;
+    struct _raw_basecall_info res;
+    //  Seconds taken to calculate posterior
+    double seconds;
 };
 
+//  Bytes of output buffered before being written
+#define RAW_OUTPUT_BUFFER (1 << 20)
+
 extern const char *argp_program_version;
 extern const char *argp_program_bug_address;
 static char doc[] = "Scrappie basecaller -- basecall from raw signal";
 static char args_doc[] = "fast5 [fast5 ...]";
 static struct argp_option options[] = {
-    {"format", 'f', "format", 0, "Format to output reads (FASTA or SAM)"},
+    {"format", 'f', "format", 0, "Format to output reads (FASTA, FASTQ or SAM).  FASTQ is only available for CRF"},
     {"limit", 'l', "nreads", 0, "Maximum number of reads to call (0 is unlimited)"},
     {"min_prob", 'm', "probability", 0, "Minimum bound on probability of match"},
     {"output", 'o', "filename", 0, "Write to file rather than stdout"},
@@ -62,13 +100,50 @@ static struct argp_option options[] = {
     {"homopolymer", 'H',"homopolymer", 0, "Homopolymer run calc. to use: choose from \"nochange\" or \"mean\" (default). Not implemented for CRF."},
     {"uuid", 14, 0, 0, "Output UUID"},
     {"no-uuid", 15, 0, OPTION_ALIAS, "Output read file"},
+    {"chunk", 16, "size:overlap", 0, "Calculate posterior in overlapping chunks of signal (size 0 is off)"},
+    {"low-memory", 17, 0, 0, "Checkpoint Viterbi traceback to reduce memory use"},
+    {"no-low-memory", 18, 0, OPTION_ALIAS, "Store full Viterbi traceback"},
+    {"prefetch", 19, "nreads", 0, "Number of reads to load ahead of basecalling on a separate thread (0 is off)"},
+    {"posterior", 20, "filename", 0, "Write posterior matrices to binary posterior file"},
+    {"beam", 21, "score", 0, "Prune transducer states scoring more than this below the best (0 is off)"},
+    {"max-states", 22, "nstate", 0, "Maximum transducer states kept per block when pruning (0 is unlimited)"},
+    {"topk", 23, "k", 0, "Keep only the k most probable transducer states of each block of the posterior (0 is off)"},
+    {"fixed-point", 24, 0, 0, "Decode transducer using 16-bit fixed-point scores"},
+    {"no-fixed-point", 25, 0, OPTION_ALIAS, "Decode transducer using floating point scores"},
+    {"model-file", 26, "filename", 0, "Read weights of model from binary model file rather than using those compiled in"},
+    {"int8", 27, 0, 0, "Evaluate network with weights and activations quantised to 8-bit integers"},
+    {"no-int8", 28, 0, OPTION_ALIAS, "Evaluate network in single precision floating point"},
+    {"math", 29, "tier", 0, "Accuracy of activation functions: accurate (default), fast or fastest"},
+    //  Keys 32 to 126 are printable, so would also be short options
+    {"profile", 256, "filename", 0, "Write time spent on each stage of basecalling each read to file"},
+    {"profile-format", 257, "format", 0, "Format of profile: tsv (default) or json"},
+    {"profile-interval", 258, "seconds", 0, "Seconds between reports of throughput to stderr when profiling (0 is only at end)"},
+    {"longest-first", 259, 0, 0, "Find length of all reads first and call longest first, writing them in that order"},
+    {"no-longest-first", 260, 0, OPTION_ALIAS, "Call reads in the order they are found"},
+    {"shard", 261, "i/N", 0, "Call only the i'th of N shards of files, taken in sorted order (i counts from 0)"},
+    {"manifest", 262, "filename", 0, "Skip reads listed in manifest, adding each read to it once written; output is appended to"},
+    {"bgzf", 265, 0, 0, "Compress output with BGZF, as bgzip and samtools"},
+    {"no-bgzf", 266, 0, OPTION_ALIAS, "Write output uncompressed"},
+    {"bgzf-level", 267, "level", 0, "Compression level for BGZF output (0: off, 1: quickest, 9: best)"},
+    {"max-memory", 268, "size", 0, "Budget for memory of reads being called at once, in bytes or with suffix K, M or G.  Reads too large for it are called in chunks (0 is unlimited)"},
+    {"filter-length", 269, "min:max", 0, "Reject reads with fewer or more samples than this after trimming (0 is unbounded)"},
+    {"filter-mad", 270, "min:max", 0, "Reject reads whose MAD of signal in pA is outside this range (0 is unbounded)"},
+    {"filter-event-rate", 271, "min:max", 0, "Reject reads whose events per sample are outside this range (0 is unbounded)"},
+    {"filter-report", 272, "filename", 0, "Write reads rejected by filters, with their statistics, to file as TSV"},
+    {"huge-pages", 273, "policy", 0, "Back matrices of 4 MB or more with huge pages: off (default), transparent or explicit"},
+    {"split-stages", 274, 0, 0, "Run network and decoding as separate stages, each with its own share of threads"},
+    {"no-split-stages", 275, 0, OPTION_ALIAS, "Run network and decoding of each read on one thread"},
+    {"decode-threads", 276, "nthread", 0, "Threads decoding when stages are split (0 is tuned from the time taken by each stage)"},
+    {"columns", 277, "filename", 0, "Write summary of each read to binary column file"},
+    {"numa", 263, 0, 0, "Pin threads to CPUs of each NUMA node in turn, with a copy of the model weights for each node"},
+    {"no-numa", 264, 0, OPTION_ALIAS, "Let threads run on any CPU"},
 #if defined(_OPENMP)
     {"threads", '#', "nparallel", 0, "Number of reads to call in parallel"},
 #endif
     {0}
 };
 
-enum format { FORMAT_FASTA, FORMAT_SAM };
+enum format { FORMAT_FASTA, FORMAT_FASTQ, FORMAT_SAM };
 
 struct arguments {
     enum format outformat;
@@ -93,6 +168,36 @@ struct arguments {
     char ** files;
     enum homopolymer_calculation homopolymer;
     bool uuid;
+    int chunk_size;
+    int chunk_overlap;
+    bool low_memory;
+    int prefetch;
+    char * posterior;
+    float beam;
+    int max_states;
+    int topk;
+    bool fixed_point;
+    char * model_file;
+    bool int8;
+    enum scrappie_math math;
+    char * profile;
+    enum scrappie_profile_format profile_format;
+    float profile_interval;
+    bool longest_first;
+    char * output_name;
+    int shard;
+    int nshard;
+    char * manifest;
+    bool numa;
+    bool bgzf;
+    int bgzf_level;
+    size_t max_memory;
+    read_filter_param filter;
+    char * filter_report;
+    char * columns;
+    enum scrappie_hugepage_policy huge_pages;
+    bool split_stages;
+    int decode_threads;
 };
 
 static struct arguments args = {
@@ -117,9 +222,87 @@ static struct arguments args = {
     .model_type = SCRAPPIE_MODEL_RGRGR_R9_4,
     .files = NULL,
     .homopolymer = HOMOPOLYMER_MEAN,
-    .uuid = false
+    .uuid = false,
+    .chunk_size = 0,
+    .chunk_overlap = 2000,
+    .low_memory = false,
+    .prefetch = 0,
+    .posterior = NULL,
+    .beam = 0.0f,
+    .max_states = 0,
+    .topk = 0,
+    .fixed_point = false,
+    .model_file = NULL,
+    .int8 = false,
+    .math = SCRAPPIE_MATH_ACCURATE,
+    .profile = NULL,
+    .profile_format = SCRAPPIE_PROFILE_TSV,
+    .profile_interval = 10.0f,
+    .longest_first = false,
+    .output_name = NULL,
+    .shard = 0,
+    .nshard = 0,
+    .manifest = NULL,
+    .numa = false,
+    .bgzf = false,
+    .bgzf_level = 6,
+    .max_memory = 0,
+    .filter = {0},
+    .filter_report = NULL,
+    .columns = NULL,
+    .huge_pages = SCRAPPIE_HUGEPAGE_OFF,
+    .split_stages = false,
+    .decode_threads = 0
 };
 
+//  Chunk size of posterior of reads too large for memory budget, unless --chunk given
+#define RAW_BUDGET_CHUNK 100000
+
+/**  Size of memory, in bytes, with an optional suffix of K, M or G
+ **/
+static size_t parse_memory_size(const char * arg){
+    char * end = NULL;
+    double size = strtod(arg, &end);
+    if(end == arg || size < 0.0){
+        errx(EXIT_FAILURE, "--max-memory should be a non-negative size, optionally suffixed by K, M or G");
+    }
+    switch(toupper(*end)){
+    case 'G':
+        size *= 1024.0;
+        //  fall through
+    case 'M':
+        size *= 1024.0;
+        //  fall through
+    case 'K':
+        size *= 1024.0;
+        end += 1;
+        break;
+    default:
+        break;
+    }
+    if('\0' != *end){
+        errx(EXIT_FAILURE, "--max-memory should be a non-negative size, optionally suffixed by K, M or G");
+    }
+    return (size_t)size;
+}
+
+/**  Bounds of a filter, as min:max with max optional
+ **/
+static void parse_filter_bounds(const char * name, char * arg, float * lo, float * hi){
+    char * end = NULL;
+    *lo = strtof(arg, &end);
+    *hi = 0.0f;
+    if(':' == *end){
+        char * hend = NULL;
+        *hi = strtof(end + 1, &hend);
+        end = (hend == end + 1) ? end : hend;
+    }
+    if('\0' != *end || !isfinite(*lo) || !isfinite(*hi) || *lo < 0.0f || *hi < 0.0f
+       || (*hi > 0.0f && *hi < *lo)){
+        errx(EXIT_FAILURE, "--%s should be of form min:max, with 0 <= min <= max", name);
+    }
+}
+
 static error_t parse_arg(int key, char * arg, struct  argp_state * state){
     int ret = 0;
     char * next_tok = NULL;
@@ -128,6 +311,8 @@ static error_t parse_arg(int key, char * arg, struct  argp_state * state){
     case 'f':
         if(0 == strcasecmp("FASTA", arg)){
             args.outformat = FORMAT_FASTA;
+        } else if(0 == strcasecmp("FASTQ", arg)){
+            args.outformat = FORMAT_FASTQ;
         } else if(0 == strcasecmp("SAM", arg)){
             args.outformat = FORMAT_SAM;
         } else {
@@ -143,10 +328,7 @@ static error_t parse_arg(int key, char * arg, struct  argp_state * state){
         assert(isfinite(args.min_prob) && args.min_prob >= 0.0);
         break;
     case 'o':
-        args.output = fopen(arg, "w");
-        if(NULL == args.output){
-            errx(EXIT_FAILURE, "Failed to open \"%s\" for output.", arg);
-        }
+        args.output_name = arg;
         break;
     case 'p':
         args.prefix = arg;
@@ -232,6 +414,159 @@ static error_t parse_arg(int key, char * arg, struct  argp_state * state){
     case 15:
         args.uuid = false;
         break;
+    case 16:
+        args.chunk_size = atoi(strtok(arg, ":"));
+        next_tok = strtok(NULL, ":");
+        if(NULL != next_tok){
+            args.chunk_overlap = atoi(next_tok);
+        }
+        assert(args.chunk_size >= 0);
+        assert(args.chunk_overlap >= 0);
+        if(args.chunk_size > 0 && args.chunk_size <= args.chunk_overlap){
+            errx(EXIT_FAILURE, "--chunk size must be greater than overlap");
+        }
+        break;
+    case 17:
+        args.low_memory = true;
+        break;
+    case 18:
+        args.low_memory = false;
+        break;
+    case 19:
+        args.prefetch = atoi(arg);
+        assert(args.prefetch >= 0);
+        break;
+    case 20:
+        args.posterior = arg;
+        break;
+    case 21:
+        args.beam = atof(arg);
+        assert(args.beam >= 0.0f);
+        break;
+    case 22:
+        args.max_states = atoi(arg);
+        assert(args.max_states >= 0);
+        break;
+    case 23:
+        args.topk = atoi(arg);
+        assert(args.topk >= 0);
+        break;
+    case 24:
+        args.fixed_point = true;
+        break;
+    case 25:
+        args.fixed_point = false;
+        break;
+    case 26:
+        args.model_file = arg;
+        break;
+    case 27:
+        args.int8 = true;
+        break;
+    case 28:
+        args.int8 = false;
+        break;
+    case 29:
+        args.math = scrappie_math_from_string(arg);
+        if(SCRAPPIE_MATH_INVALID == args.math){
+            errx(EXIT_FAILURE, "Invalid accuracy tier \"%s\"", arg);
+        }
+        break;
+    case 256:
+        args.profile = arg;
+        break;
+    case 257:
+        args.profile_format = scrappie_profile_format_from_string(arg);
+        if(SCRAPPIE_PROFILE_INVALID == args.profile_format){
+            errx(EXIT_FAILURE, "Invalid profile format \"%s\"", arg);
+        }
+        break;
+    case 258:
+        args.profile_interval = atof(arg);
+        assert(args.profile_interval >= 0.0f);
+        break;
+    case 259:
+        args.longest_first = true;
+        break;
+    case 260:
+        args.longest_first = false;
+        break;
+    case 261:
+        {
+            char * end = NULL;
+            args.shard = strtol(arg, &end, 10);
+            if(end == arg || '/' != *end){
+                errx(EXIT_FAILURE, "--shard should be of form i/N");
+            }
+            char * nend = NULL;
+            args.nshard = strtol(end + 1, &nend, 10);
+            if(nend == end + 1 || '\0' != *nend || args.nshard < 1 || args.shard < 0 || args.shard >= args.nshard){
+                errx(EXIT_FAILURE, "--shard i/N requires 0 <= i < N");
+            }
+        }
+        break;
+    case 262:
+        args.manifest = arg;
+        break;
+    case 263:
+        args.numa = true;
+        break;
+    case 264:
+        args.numa = false;
+        break;
+    case 265:
+        args.bgzf = true;
+        break;
+    case 266:
+        args.bgzf = false;
+        break;
+    case 267:
+        args.bgzf_level = atoi(arg);
+        if(args.bgzf_level < 0 || args.bgzf_level > 9){
+            errx(EXIT_FAILURE, "--bgzf-level should be between 0 and 9");
+        }
+        break;
+    case 268:
+        args.max_memory = parse_memory_size(arg);
+        break;
+    case 269:
+        {
+            float lo, hi;
+            parse_filter_bounds("filter-length", arg, &lo, &hi);
+            args.filter.min_length = lo;
+            args.filter.max_length = hi;
+        }
+        break;
+    case 270:
+        parse_filter_bounds("filter-mad", arg, &args.filter.min_mad, &args.filter.max_mad);
+        break;
+    case 271:
+        parse_filter_bounds("filter-event-rate", arg, &args.filter.min_event_rate, &args.filter.max_event_rate);
+        break;
+    case 272:
+        args.filter_report = arg;
+        break;
+    case 273:
+        args.huge_pages = scrappie_hugepage_from_string(arg);
+        if(SCRAPPIE_HUGEPAGE_INVALID == args.huge_pages){
+            errx(EXIT_FAILURE, "Invalid huge page policy \"%s\"", arg);
+        }
+        break;
+    case 274:
+        args.split_stages = true;
+        break;
+    case 275:
+        args.split_stages = false;
+        break;
+    case 276:
+        args.decode_threads = atoi(arg);
+        if(args.decode_threads < 0){
+            errx(EXIT_FAILURE, "--decode-threads should be non-negative");
+        }
+        break;
+    case 277:
+        args.columns = arg;
+        break;
     #if defined(_OPENMP)
     case '#':
         {
@@ -262,84 +597,458 @@ static error_t parse_arg(int key, char * arg, struct  argp_state * state){
 
 static struct argp argp = {options, parse_arg, args_doc, doc};
 
-static struct _raw_basecall_info calculate_post(char * filename, enum raw_model_type model){
-    RETURN_NULL_IF(NULL == filename, (struct _raw_basecall_info){0});
-    RETURN_NULL_IF(SCRAPPIE_MODEL_INVALID == model, (struct _raw_basecall_info){0});
-    posterior_function_ptr calcpost = get_posterior_function(model);
+/**  Basecall from sparse posterior of transducer model
+ *
+ *   The read has already been trimmed and normalised.  Only the top-k
+ *   states of each block are calculated and kept so the dense posterior is
+ *   never held in memory; the posterior of the result is NULL.
+ **/
+static struct _raw_basecall_info calculate_sparse_post(raw_table rt, enum raw_model_type model){
+    sparse_posterior_function_ptr calcpost = get_sparse_posterior_function(model);
+    scrappie_profile_begin(SCRAPPIE_STAGE_NETWORK);
+    sparse_posterior post = calcpost(rt, args.min_prob, args.temperature1, args.temperature2, args.topk);
+    scrappie_profile_end(SCRAPPIE_STAGE_NETWORK);
+    if (NULL == post) {
+        free(rt.raw);
+        free(rt.sample);
+        free(rt.uuid);
+        return (struct _raw_basecall_info){0};
+    }
+    const int nblock = post->nblock;
+    const int nstate = post->nstate;
+    int * path = calloc(nblock + 1, sizeof(int));
+    int * pos = calloc(nblock + 1, sizeof(int));
 
-    raw_table rt = read_raw(filename, true);
-    RETURN_NULL_IF(NULL == rt.raw, (struct _raw_basecall_info){0});
+    scrappie_profile_begin(SCRAPPIE_STAGE_DECODE);
+    float score = decode_transducer_sparse(post, args.stay_pen, args.skip_pen, args.local_pen, path, args.use_slip);
+    scrappie_profile_end(SCRAPPIE_STAGE_DECODE);
+    scrappie_profile_begin(SCRAPPIE_STAGE_HOMOPOLYMER);
+    int runcount = homopolymer_path_sparse(post, path, args.homopolymer);
+    scrappie_profile_end(SCRAPPIE_STAGE_HOMOPOLYMER);
+    post = free_sparse_posterior(post);
+    if(runcount < 0){
+        free(pos);
+        free(path);
+        free(rt.raw);
+        free(rt.sample);
+        free(rt.uuid);
+        return (struct _raw_basecall_info){0};
+    }
+    scrappie_profile_begin(SCRAPPIE_STAGE_DECODE);
+    char * basecall = overlapper(path, nblock + 1, nstate - 1, pos);
+    scrappie_profile_end(SCRAPPIE_STAGE_DECODE);
+    free(path);
+    const size_t basecall_len = strlen(basecall);
+    scrappie_profile_count(rt.n, basecall_len);
 
+    return (struct _raw_basecall_info) {
+    score, rt, basecall, basecall_len, NULL, pos, nblock, NULL};
+}
+
+static int budget_chunk_size(void){
+    return (args.chunk_size > 0) ? args.chunk_size : RAW_BUDGET_CHUNK;
+}
+
+/**  Whether read, called as asked, is estimated to need more than the memory budget
+ **/
+static bool raw_read_oversized(size_t nsample){
+    return args.max_memory > 0
+        && raw_model_memory_estimate(args.model_type, nsample, args.chunk_size, args.low_memory) > args.max_memory;
+}
+
+/**  Estimate of memory to call read, as the read pipeline admits reads against budget
+ **/
+static size_t raw_read_memory(const raw_table rt){
+    return raw_read_oversized(rt.n)
+        ? raw_model_memory_estimate(args.model_type, rt.n, budget_chunk_size(), true)
+        : raw_model_memory_estimate(args.model_type, rt.n, args.chunk_size, args.low_memory);
+}
+
+/**  Trim, filter and normalise read then calculate its posterior
+ *
+ *   The first half of calculate_post, run apart from decoding when the stages
+ *   of the read pipeline are split.
+ **/
+static struct _raw_network_info calculate_network(raw_table rt, enum raw_model_type model){
+    const struct _raw_network_info failed = {.decoded = true};
+    RETURN_NULL_IF(NULL == rt.raw && NULL == rt.sample, failed);
+    if(SCRAPPIE_MODEL_INVALID == model){
+        free(rt.raw);
+        free(rt.sample);
+        free(rt.uuid);
+        return failed;
+    }
+    posterior_function_ptr calcpost = get_posterior_function(model);
+
+    scrappie_profile_begin(SCRAPPIE_STAGE_TRIM);
     rt = trim_and_segment_raw(rt, args.trim_start, args.trim_end, args.varseg_chunk, args.varseg_thresh);
-    RETURN_NULL_IF(NULL == rt.raw, (struct _raw_basecall_info){0});
+    RETURN_NULL_IF(NULL == rt.raw && NULL == rt.sample, failed);
 
-    medmad_normalise_array(rt.raw + rt.start, rt.end - rt.start);
-    scrappie_matrix post = calcpost(rt, args.min_prob, args.temperature1, args.temperature2, true);
+    //  Junk reads are rejected on the signal in pA, before any layer of the network
+    read_filter_stats filter_stats;
+    const enum read_filter_reason filtered = filter_read(rt, &args.filter, &filter_stats);
+    if(READ_FILTER_PASS != filtered){
+        scrappie_profile_end(SCRAPPIE_STAGE_TRIM);
+        free(rt.raw);
+        free(rt.sample);
+        return (struct _raw_network_info){
+            .decoded = true,
+            .res = {.rt = {.uuid = rt.uuid}, .filtered = filtered, .filter_stats = filter_stats}};
+    }
+
+    rt = medmad_normalise_raw(rt);
+    scrappie_profile_end(SCRAPPIE_STAGE_TRIM);
+    if(args.topk > 0){
+        //  Sparse posterior is decoded as it is calculated
+        return (struct _raw_network_info){.decoded = true, .res = calculate_sparse_post(rt, model)};
+    }
+    //  Reads too large for the memory budget are called in chunks, with checkpointed traceback
+    const bool oversized = raw_read_oversized(rt.n);
+    const int chunk_size = oversized ? budget_chunk_size() : args.chunk_size;
+    const bool low_memory = args.low_memory || oversized;
+    scrappie_profile_begin(SCRAPPIE_STAGE_NETWORK);
+    scrappie_matrix post = (chunk_size > 0)
+        ? chunked_posterior(model, rt, chunk_size, args.chunk_overlap, args.min_prob,
+                            args.temperature1, args.temperature2, true)
+        : calcpost(rt, args.min_prob, args.temperature1, args.temperature2, true);
+    scrappie_profile_end(SCRAPPIE_STAGE_NETWORK);
 
     if (NULL == post) {
         free(rt.raw);
+        free(rt.sample);
         free(rt.uuid);
-        return (struct _raw_basecall_info){0};
+        return failed;
     }
+    return (struct _raw_network_info){.rt = rt, .post = post, .low_memory = low_memory};
+}
+
+/**  Decode posterior of read into basecall
+ *
+ *   The second half of calculate_post.
+ **/
+static struct _raw_basecall_info decode_post(struct _raw_network_info net, enum raw_model_type model){
+    if(net.decoded){
+        return net.res;
+    }
+    raw_table rt = net.rt;
+    scrappie_matrix post = net.post;
+    const bool low_memory = net.low_memory;
     const int nblock = post->nc;
     int * path = calloc(nblock + 1, sizeof(int));
     int * pos = calloc(nblock + 1, sizeof(int));
 
     float score = NAN;
     char * basecall = NULL;
+    char * quality = NULL;
+    scrappie_profile_begin(SCRAPPIE_STAGE_DECODE);
     if(SCRAPPIE_MODEL_RNNRF_R9_4 != model){
-        const int nstate = post->nr;
-        score = decode_transducer(post, args.stay_pen, args.skip_pen, args.local_pen, path, args.use_slip);
-        int runcount = homopolymer_path(post, path, args.homopolymer);
-        if(runcount < 0){
+        if(args.beam > 0.0f || args.max_states > 0){
+            //  Pruned traceback is sparse so is used in place of checkpointing
+            const float beam = (args.beam > 0.0f) ? args.beam : INFINITY;
+            score = decode_transducer_pruned(post, args.stay_pen, args.skip_pen, args.local_pen, beam,
+                                             args.max_states, path, args.use_slip);
+            basecall = homopolymer_overlapper(post, path, args.homopolymer, pos);
+        } else if(args.fixed_point){
+            score = decode_transducer_fixed(post, args.stay_pen, args.skip_pen, args.local_pen, path, args.use_slip);
+            basecall = homopolymer_overlapper(post, path, args.homopolymer, pos);
+        } else if(low_memory){
+            score = decode_transducer_checkpointed(post, args.stay_pen, args.skip_pen, args.local_pen, path, args.use_slip);
+            basecall = homopolymer_overlapper(post, path, args.homopolymer, pos);
+        } else {
+            //  Homopolymers corrected and basecall assembled during the traceback
+            basecall = decode_transducer_basecall(post, args.stay_pen, args.skip_pen, args.local_pen,
+                                                  args.use_slip, args.homopolymer, path, pos, &score);
+        }
+        if(NULL == basecall){
             // On error, clean up and return
+            scrappie_profile_end(SCRAPPIE_STAGE_DECODE);
             free(pos);
             free(path);
             post = free_scrappie_matrix(post);
             free(rt.raw);
+            free(rt.sample);
             free(rt.uuid);
             return (struct _raw_basecall_info){0};
         }
-        basecall = overlapper(path, nblock + 1, nstate - 1, pos);
+    } else if(FORMAT_FASTQ == args.outformat){
+        //  Posterior of path found alongside it, so traceback is never checkpointed
+        float * perr = calloc(nblock + 1, sizeof(float));
+        if(NULL != perr){
+            score = decode_crf_quality(post, path, perr);
+            basecall = crfpath_to_basecall(path, nblock, pos);
+            quality = crfpath_to_quality(path, perr, nblock);
+        }
+        free(perr);
     } else{
-        score = decode_crf(post, path);
+        score = low_memory ? decode_crf_checkpointed(post, path) : decode_crf(post, path);
         basecall = crfpath_to_basecall(path, nblock, pos);
     }
+    scrappie_profile_end(SCRAPPIE_STAGE_DECODE);
 
     free(path);
-    post = free_scrappie_matrix(post);
+    if(NULL == args.posterior){
+        post = free_scrappie_matrix(post);
+    }
     const size_t basecall_len = strlen(basecall);
+    scrappie_profile_count(rt.n, basecall_len);
 
     return (struct _raw_basecall_info) {
-    score, rt, basecall, basecall_len, pos, nblock};
+    score, rt, basecall, basecall_len, quality, pos, nblock, post};
 }
 
-static int fprintf_fasta(FILE * fp, const char * uuid, const char *readname, bool uuid_primary, const char * prefix,
-                         const struct _raw_basecall_info res) {
-    return fprintf(fp,
-                   ">%s%s  { \"filename\" : \"%s\", \"uuid\" : \"%s\", \"normalised_score\" : %f,  \"nblock\" : %zu,  \"sequence_length\" : %zu,  \"blocks_per_base\" : %f, \"nsample\" : %zu, \"trim\" : [ %zu, %zu ] }\n%s\n",
-                   prefix, uuid_primary ? uuid : readname, readname, uuid, -res.score / res.nblock, res.nblock,
+static struct _raw_basecall_info calculate_post(raw_table rt, enum raw_model_type model){
+    return decode_post(calculate_network(rt, model), model);
+}
+
+//  Name and description line of a FASTA or FASTQ record, starting with marker
+static bool format_description(output_buffer * buf, char marker, const char * uuid, const char *readname, bool uuid_primary,
+                               const char * prefix, const struct _raw_basecall_info res) {
+    return output_buffer_printf(buf,
+                   "%c%s%s  { \"filename\" : \"%s\", \"uuid\" : \"%s\", \"normalised_score\" : %f,  \"nblock\" : %zu,  \"sequence_length\" : %zu,  \"blocks_per_base\" : %f, \"nsample\" : %zu, \"trim\" : [ %zu, %zu ] }\n",
+                   marker, prefix, uuid_primary ? uuid : readname, readname, uuid, -res.score / res.nblock, res.nblock,
                    res.basecall_length,
                    (float)res.nblock / (float)res.basecall_length,
-                   res.rt.n, res.rt.start, res.rt.end, res.basecall);
+                   res.rt.n, res.rt.start, res.rt.end);
+}
+
+static bool format_fasta(output_buffer * buf, const char * uuid, const char *readname, bool uuid_primary, const char * prefix,
+                         const struct _raw_basecall_info res) {
+    return format_description(buf, '>', uuid, readname, uuid_primary, prefix, res)
+        && output_buffer_printf(buf, "%s\n", res.basecall);
+}
+
+static bool format_fastq(output_buffer * buf, const char * uuid, const char *readname, bool uuid_primary, const char * prefix,
+                         const struct _raw_basecall_info res) {
+    RETURN_NULL_IF(NULL == res.quality, false);
+    return format_description(buf, '@', uuid, readname, uuid_primary, prefix, res)
+        && output_buffer_printf(buf, "%s\n+\n%s\n", res.basecall, res.quality);
 }
 
-static int fprintf_sam(FILE * fp,  const char * uuid, const char *readname, bool uuid_primary, const char * prefix,
+static bool format_sam(output_buffer * buf,  const char * uuid, const char *readname, bool uuid_primary, const char * prefix,
                        const struct _raw_basecall_info res) {
-    return fprintf(fp, "%s%s\t4\t*\t0\t0\t*\t*\t0\t0\t%s\t*\n", prefix,
+    return output_buffer_printf(buf, "%s%s\t4\t*\t0\t0\t*\t*\t0\t0\t%s\t*\n", prefix,
                    uuid_primary ? uuid : readname, res.basecall);
 }
 
+/** Basecall a single read for the read pipeline
+ *
+ *  The record of the read is formatted, and compressed if writing BGZF, here
+ *  rather than when output so that it is done in parallel.
+ *
+ *  @returns Pointer to basecall information, to be freed by output_raw_read,
+ *  or NULL on failure
+ **/
+static FILE * filter_report_fh = NULL;
+static size_t nfiltered[READ_FILTER_NREASON] = {0};
+
+/**  Record read rejected by filters
+ **/
+static void report_filtered_read(const char * filename, const struct _raw_basecall_info res){
+#pragma omp atomic
+    nfiltered[res.filtered] += 1;
+    if(NULL == filter_report_fh){
+        return;
+    }
+#pragma omp critical(raw_filter_report)
+    {
+        fprintf(filter_report_fh, "%s\t%s\t%s\t%zu\t%f\t%f\n", basename((char *)filename),
+                (NULL != res.rt.uuid) ? res.rt.uuid : "", read_filter_reason_string(res.filtered),
+                res.filter_stats.nsample, res.filter_stats.mad, res.filter_stats.event_rate);
+    }
+}
+
+/**  Format basecall of read for output
+ *
+ *  @returns As process_raw_read
+ **/
+static void * format_raw_read(char * filename, struct _raw_basecall_info res){
+    if(READ_FILTER_PASS != res.filtered){
+        report_filtered_read(filename, res);
+        free(res.rt.uuid);
+        return NULL;
+    }
+    if(NULL == res.basecall){
+        warnx("No basecall returned for %s", filename);
+        return NULL;
+    }
+    struct _raw_basecall_info * pres = malloc(sizeof(*pres));
+    if(NULL == pres){
+        warnx("Failed to allocate memory for basecall of %s", filename);
+        free(res.rt.raw);
+        free(res.rt.sample);
+        free(res.rt.uuid);
+        free(res.basecall);
+        free(res.quality);
+        free(res.pos);
+        res.post = free_scrappie_matrix(res.post);
+        return NULL;
+    }
+    *pres = res;
+
+    scrappie_profile_begin(SCRAPPIE_STAGE_OUTPUT);
+    //  Name of read is its file name, without the directory
+    char * readname = basename(filename);
+    bool formatted = false;
+    switch(args.outformat){
+    case FORMAT_FASTA:
+        formatted = format_fasta(&pres->record, res.rt.uuid, readname, args.uuid, args.prefix, res);
+        break;
+    case FORMAT_FASTQ:
+        formatted = format_fastq(&pres->record, res.rt.uuid, readname, args.uuid, args.prefix, res);
+        break;
+    case FORMAT_SAM:
+        formatted = format_sam(&pres->record, res.rt.uuid, readname, args.uuid, args.prefix, res);
+        break;
+    default:
+        errx(EXIT_FAILURE, "Unrecognised output format");
+    }
+    if(formatted && args.bgzf){
+        formatted = output_buffer_bgzf(&pres->record, args.bgzf_level);
+    }
+    scrappie_profile_end(SCRAPPIE_STAGE_OUTPUT);
+    if(!formatted){
+        warnx("Failed to format basecall of %s", filename);
+        output_buffer_release(&pres->record);
+    }
+    return pres;
+}
+
+static void * process_raw_read(char * filename, raw_table rt){
+    const double start = scrappie_profile_now();
+    struct _raw_basecall_info res = calculate_post(rt, args.model_type);
+    res.seconds = scrappie_profile_now() - start;
+    return format_raw_read(filename, res);
+}
+
+/** Calculate posterior of a single read, as first stage of the read pipeline
+ *
+ *  @returns Pointer to posterior of read, to be freed by decode_raw_read, or
+ *  NULL on failure
+ **/
+static void * process_raw_network(char * filename, raw_table rt){
+    const double start = scrappie_profile_now();
+    struct _raw_network_info net = calculate_network(rt, args.model_type);
+    net.seconds = scrappie_profile_now() - start;
+    struct _raw_network_info * pnet = malloc(sizeof(*pnet));
+    if(NULL == pnet){
+        warnx("Failed to allocate memory for posterior of %s", filename);
+        //  Read either awaits decoding or has its result
+        free(net.rt.raw);
+        free(net.rt.sample);
+        free(net.rt.uuid);
+        net.post = free_scrappie_matrix(net.post);
+        free(net.res.rt.raw);
+        free(net.res.rt.sample);
+        free(net.res.rt.uuid);
+        free(net.res.basecall);
+        free(net.res.quality);
+        free(net.res.pos);
+        net.res.post = free_scrappie_matrix(net.res.post);
+        return NULL;
+    }
+    *pnet = net;
+    return pnet;
+}
+
+/** Decode and format a single read, as second stage of the read pipeline
+ *
+ *  @returns As process_raw_read
+ **/
+static void * decode_raw_read(char * filename, void * state){
+    struct _raw_network_info net = *(struct _raw_network_info *)state;
+    free(state);
+    const double start = scrappie_profile_now();
+    struct _raw_basecall_info res = decode_post(net, args.model_type);
+    res.seconds = net.seconds + scrappie_profile_now() - start;
+    return format_raw_read(filename, res);
+}
+
+static hid_t hdf5out = -1;
+static FILE * posterior_fh = NULL;
+static FILE * columns_fh = NULL;
+static read_summary_table summary = {0};
+
+static void output_raw_read(char * filename, void * result){
+    struct _raw_basecall_info * res = result;
+    if(!write_output_buffer(args.output, &res->record)){
+        warnx("Failed to write basecall of %s", filename);
+    }
+
+    if(hdf5out >= 0){
+        write_annotated_raw(hdf5out, basename(filename), res->rt,
+            args.compression_chunk_size, args.compression_level);
+    }
+    if(NULL != posterior_fh){
+        const char * read_id = (NULL != res->rt.uuid) ? res->rt.uuid : basename(filename);
+        if(!write_posterior_record(posterior_fh, res->post, raw_model_string(args.model_type), read_id)){
+            warnx("Failed to write posterior of %s", filename);
+        }
+    }
+    if(NULL != columns_fh && !read_summary_add(&summary, columns_fh, basename(filename), res->rt.uuid, res->rt.n,
+                                               res->nblock, res->basecall_length, -res->score / res->nblock,
+                                               res->seconds)){
+        warnx("Failed to write summary of %s", filename);
+    }
+    res->post = free_scrappie_matrix(res->post);
+    free(res->rt.raw);
+    free(res->rt.sample);
+    free(res->rt.uuid);
+    free(res->basecall);
+    free(res->quality);
+    free(res->pos);
+    output_buffer_release(&res->record);
+    free(res);
+}
+
 int main_raw(int argc, char * argv[]){
-    #if defined(_OPENMP)
-        omp_set_nested(1);
-    #endif
     argp_parse(&argp, argc, argv, 0, 0, NULL);
+    if(args.topk > 0){
+        if(SCRAPPIE_MODEL_RNNRF_R9_4 == args.model_type){
+            errx(EXIT_FAILURE, "--topk is only available for transducer models");
+        }
+        const size_t nstate = get_raw_model_nstate(args.model_type);
+        if((size_t)args.topk >= nstate){
+            errx(EXIT_FAILURE, "--topk must be less than the %zu states of the posterior", nstate);
+        }
+        if(NULL != args.posterior || args.chunk_size > 0 || args.beam > 0.0f || args.max_states > 0){
+            errx(EXIT_FAILURE, "--topk cannot be combined with --posterior, --chunk, --beam or --max-states");
+        }
+    }
+    if(FORMAT_FASTQ == args.outformat && SCRAPPIE_MODEL_RNNRF_R9_4 != args.model_type){
+        errx(EXIT_FAILURE, "FASTQ output is only available for CRF model rnnrf_r94");
+    }
+    if(args.max_memory > 0 && budget_chunk_size() <= args.chunk_overlap){
+        errx(EXIT_FAILURE, "Overlap of chunks for --max-memory must be less than %d", budget_chunk_size());
+    }
+    if(args.fixed_point){
+        if(SCRAPPIE_MODEL_RNNRF_R9_4 == args.model_type){
+            errx(EXIT_FAILURE, "--fixed-point is only available for transducer models");
+        }
+        if(args.topk > 0 || args.beam > 0.0f || args.max_states > 0){
+            errx(EXIT_FAILURE, "--fixed-point cannot be combined with --topk, --beam or --max-states");
+        }
+    }
+    if(NULL != args.model_file && !load_model_weights(args.model_file, raw_model_string(args.model_type))){
+        errx(EXIT_FAILURE, "Failed to load model file \"%s\"", args.model_file);
+    }
+    if(args.int8){
+        scrappie_precision_set(SCRAPPIE_PRECISION_INT8);
+    }
+    scrappie_math_set(args.math);
+    (void)scrappie_hugepage_set_policy(args.huge_pages, SCRAPPIE_HUGEPAGE_THRESHOLD);
+    if(NULL != args.output_name){
+        //  Resumed runs add to the output of the runs before
+        args.output = fopen(args.output_name, (NULL != args.manifest) ? "a" : "w");
+        if(NULL == args.output){
+            errx(EXIT_FAILURE, "Failed to open \"%s\" for output.", args.output_name);
+        }
+    }
     if(NULL == args.output){
         args.output = stdout;
     }
+    //  Records are written whole so a large buffer means few, large writes
+    (void)setvbuf(args.output, NULL, _IOFBF, RAW_OUTPUT_BUFFER);
 
-    hid_t hdf5out = -1;
     if(NULL != args.dump){
         hdf5out = H5Fopen(args.dump, H5F_ACC_RDWR, H5P_DEFAULT);
         if(hdf5out < 0){
@@ -347,91 +1056,98 @@ int main_raw(int argc, char * argv[]){
         }
     }
 
-    int nfile = 0;
-    for( ; args.files[nfile] ; nfile++);
+    if(NULL != args.posterior){
+        posterior_fh = fopen(args.posterior, (NULL != args.manifest) ? "ab" : "wb");
+        if(NULL == posterior_fh){
+            errx(EXIT_FAILURE, "Failed to open \"%s\" for output.", args.posterior);
+        }
+    }
 
-    int reads_started = 0;
-    const int reads_limit = args.limit;
-    #pragma omp parallel for schedule(dynamic)
-    for(int fn=0 ; fn < nfile ; fn++){
-        if(reads_limit > 0 && reads_started >= reads_limit){
-            continue;
+    if(NULL != args.columns){
+        columns_fh = fopen(args.columns, (NULL != args.manifest) ? "ab" : "wb");
+        if(NULL == columns_fh){
+            errx(EXIT_FAILURE, "Failed to open \"%s\" for output.", args.columns);
         }
-        //  Iterate through all files and directories on command line.
-        //  Nested parallelism for OpenMP is enabled so worker threads are used for all open
-        // directories but this less than optimal since many directories may be open at once.
-        glob_t globbuf;
-        {
-            // Find all files matching commandline argument using system glob
-            const size_t rootlen = strlen(args.files[fn]);
-            char * globpath = calloc(rootlen + 9, sizeof(char));
-            memcpy(globpath, args.files[fn], rootlen * sizeof(char));
-            {
-                DIR * dirp = opendir(args.files[fn]);
-                if(NULL != dirp){
-                    // If filename is a directory, add wildcard to find all fast5 files within it
-                    memcpy(globpath + rootlen, "/*.fast5", 8 * sizeof(char));
-                    closedir(dirp);
-                }
-            }
-            int globret = glob(globpath, GLOB_NOSORT, NULL, &globbuf);
-            free(globpath);
-            if(0 != globret){
-                if(GLOB_NOMATCH == globret){
-                    warnx("File or directory \"%s\" does not exist or no fast5 files found.", args.files[fn]);
-                }
-                globfree(&globbuf);
-                continue;
-            }
+    }
+    if(NULL != args.filter_report){
+        filter_report_fh = fopen(args.filter_report, (NULL != args.manifest) ? "a" : "w");
+        if(NULL == filter_report_fh){
+            errx(EXIT_FAILURE, "Failed to open \"%s\" for filter report.", args.filter_report);
         }
-        #pragma omp parallel for schedule(dynamic)
-        for(size_t fn2=0 ; fn2 < globbuf.gl_pathc ; fn2++){
-            if(reads_limit > 0 && reads_started >= reads_limit){
-                continue;
-            }
-            #pragma omp atomic
-            reads_started += 1;
-
-            char * filename = globbuf.gl_pathv[fn2];
-            struct _raw_basecall_info res = calculate_post(filename, args.model_type);
-            if(NULL == res.basecall){
-                warnx("No basecall returned for %s", filename);
-                continue;
-            }
-
-            #pragma omp critical(sequence_output)
-            {
-                switch(args.outformat){
-                case FORMAT_FASTA:
-                    fprintf_fasta(args.output, res.rt.uuid, basename(filename), args.uuid, args.prefix, res);
-                    break;
-                case FORMAT_SAM:
-                    fprintf_sam(args.output, res.rt.uuid, basename(filename), args.uuid, args.prefix, res);
-                    break;
-                default:
-                    errx(EXIT_FAILURE, "Unrecognised output format");
-                }
-
-                if(hdf5out >= 0){
-                    write_annotated_raw(hdf5out, basename(filename), res.rt,
-                        args.compression_chunk_size, args.compression_level);
-                }
-            }
-            free(res.rt.raw);
-            free(res.rt.uuid);
-            free(res.basecall);
-            free(res.pos);
+        if(0 == ftell(filter_report_fh)){
+            fputs("read\tuuid\treason\tnsample\tmad\tevent_rate\n", filter_report_fh);
         }
-        globfree(&globbuf);
     }
 
+    if(NULL != args.profile && !scrappie_profile_open(args.profile, args.profile_format, args.profile_interval)){
+        errx(EXIT_FAILURE, "Failed to open \"%s\" for profile.", args.profile);
+    }
+
+    //  Iterate through all files and directories on command line.  Idle threads take
+    //  the next read so work is shared evenly, and results are written in input order,
+    //  or longest first if so scheduled.
+    read_pipeline_param pipeline = read_pipeline_defaults;
+    pipeline.limit = args.limit > 0 ? args.limit : 0;
+    pipeline.nprefetch = args.prefetch;
+    pipeline.native = true;
+    pipeline.longest_first = args.longest_first;
+    pipeline.shard = args.shard;
+    pipeline.nshard = args.nshard;
+    pipeline.manifest = args.manifest;
+    pipeline.numa = args.numa;
+    pipeline.max_memory = args.max_memory;
+    pipeline.memory = raw_read_memory;
+    if(args.split_stages){
+        pipeline.finish = decode_raw_read;
+        pipeline.nfinish = args.decode_threads;
+    }
+    (void)run_read_pipeline(args.files, pipeline, args.split_stages ? process_raw_network : process_raw_read,
+                            output_raw_read);
+    scrappie_profile_close();
+
     if(hdf5out >= 0){
         H5Fclose(hdf5out);
+        hdf5out = -1;
+    }
+
+    if(NULL != posterior_fh){
+        fclose(posterior_fh);
+        posterior_fh = NULL;
+    }
+    if(NULL != columns_fh){
+        if(!read_summary_flush(&summary, columns_fh)){
+            warnx("Failed to write summaries of reads");
+        }
+        read_summary_release(&summary);
+        fclose(columns_fh);
+        columns_fh = NULL;
+    }
+
+    if(NULL != filter_report_fh){
+        fclose(filter_report_fh);
+        filter_report_fh = NULL;
+    }
+    if(read_filter_enabled(&args.filter)){
+        size_t ntotal = 0;
+        for(int i=READ_FILTER_PASS + 1 ; i < READ_FILTER_NREASON ; i++){
+            ntotal += nfiltered[i];
+        }
+        fprintf(stderr, "Rejected %zu reads before basecalling", ntotal);
+        for(int i=READ_FILTER_PASS + 1 ; i < READ_FILTER_NREASON ; i++){
+            if(nfiltered[i] > 0){
+                fprintf(stderr, ", %s %zu", read_filter_reason_string(i), nfiltered[i]);
+            }
+        }
+        fputc('\n', stderr);
     }
 
+    if(args.bgzf && !write_bgzf_eof(args.output)){
+        warnx("Failed to write end of BGZF output");
+    }
     if(stdout != args.output){
         fclose(args.output);
     }
+    unload_model_weights();
 
     return EXIT_SUCCESS;
 }
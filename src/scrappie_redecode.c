@@ -0,0 +1,426 @@
+#include <math.h>
+#if defined(_OPENMP)
+#    include <omp.h>
+#endif
+#include <stdio.h>
+#include <strings.h>
+
+#include "decode.h"
+#include "homopolymer.h"
+#include "networks.h"
+#include "posterior_file.h"
+#include "scrappie_licence.h"
+#include "scrappie_matrix.h"
+#include "scrappie_output.h"
+#include "scrappie_stdlib.h"
+
+// Doesn't play nice with other headers, include last
+#include <argp.h>
+
+//  Most values in each list of penalties or homopolymer calculations
+#define REDECODE_MAX_VALUES 32
+//  Records decoded together, per thread, before their results are written
+#define REDECODE_RECORDS_PER_THREAD 4
+
+
+extern const char *argp_program_version;
+extern const char *argp_program_bug_address;
+static char doc[] = "Scrappie redecode -- basecall again from stored posteriors\v"
+    "Posteriors written by \"scrappie raw --posterior\" are decoded with every combination of the "
+    "penalties and homopolymer calculations given, each a comma separated list, without "
+    "evaluating the network again.  Parameters are ignored for CRF models, which are decoded once.";
+static char args_doc[] = "posterior [posterior ...]";
+static struct argp_option options[] = {
+    {"format", 'f', "format", 0, "Format to output reads (FASTA or SAM)"},
+    {"limit", 'l', "nreads", 0, "Maximum number of reads to call (0 is unlimited)"},
+    {"output", 'o', "filename", 0, "Write to file rather than stdout"},
+    {"prefix", 'p', "string", 0, "Prefix to append to name of each read"},
+    {"skip", 's', "penalties", 0, "Penalties for skipping a base"},
+    {"stay", 'y', "penalties", 0, "Penalties for staying"},
+    {"local", 6, "penalties", 0, "Penalties for local basecalling"},
+    {"homopolymer", 'H', "calculations", 0, "Homopolymer run calcs. to use: \"nochange\" or \"mean\" (default)"},
+    {"slip", 1, 0, 0, "Use slipping"},
+    {"no-slip", 2, 0, OPTION_ALIAS, "Disable slipping"},
+    {"both-slip", 3, 0, 0, "Decode both with and without slipping"},
+    {"low-memory", 17, 0, 0, "Checkpoint Viterbi traceback to reduce memory use"},
+    {"no-low-memory", 18, 0, OPTION_ALIAS, "Store full Viterbi traceback"},
+    {"licence", 10, 0, 0, "Print licensing information"},
+    {"license", 11, 0, OPTION_ALIAS, "Print licensing information"},
+#if defined(_OPENMP)
+    {"threads", '#', "nparallel", 0, "Number of reads to decode in parallel"},
+#endif
+    {0}
+};
+
+enum format { FORMAT_FASTA, FORMAT_SAM };
+
+typedef struct {
+    size_t n;
+    float value[REDECODE_MAX_VALUES];
+} penalty_list;
+
+struct arguments {
+    int limit;
+    FILE * output;
+    enum format outformat;
+    char * prefix;
+    penalty_list skip_pen;
+    penalty_list stay_pen;
+    penalty_list local_pen;
+    size_t nhomopolymer;
+    enum homopolymer_calculation homopolymer[REDECODE_MAX_VALUES];
+    bool slip;
+    bool both_slip;
+    bool low_memory;
+    char ** files;
+};
+
+static struct arguments args = {
+    .limit = 0,
+    .output = NULL,
+    .outformat = FORMAT_FASTA,
+    .prefix = "",
+    .skip_pen = {1, {0.0f}},
+    .stay_pen = {1, {0.0f}},
+    .local_pen = {1, {2.0f}},
+    .nhomopolymer = 1,
+    .homopolymer = {HOMOPOLYMER_MEAN},
+    .slip = false,
+    .both_slip = false,
+    .low_memory = false,
+    .files = NULL
+};
+
+
+/**  Parse comma separated list of penalties
+ *
+ *   Exits on failure
+ **/
+static penalty_list parse_penalty_list(char * arg, const char * option) {
+    penalty_list list = {0};
+    for (char * tok = strtok(arg, ","); NULL != tok; tok = strtok(NULL, ",")) {
+        char * end = NULL;
+        const float pen = strtof(tok, &end);
+        if (end == tok || '\0' != *end || !isfinite(pen)) {
+            errx(EXIT_FAILURE, "Invalid penalty \"%s\" for --%s", tok, option);
+        }
+        if (REDECODE_MAX_VALUES == list.n) {
+            errx(EXIT_FAILURE, "At most %d penalties may be given for --%s", REDECODE_MAX_VALUES, option);
+        }
+        list.value[list.n++] = pen;
+    }
+    if (0 == list.n) {
+        errx(EXIT_FAILURE, "No penalties given for --%s", option);
+    }
+    return list;
+}
+
+
+static error_t parse_arg(int key, char *arg, struct argp_state *state) {
+    int ret = 0;
+
+    switch (key) {
+    case 'f':
+        if (0 == strcasecmp("fasta", arg)) {
+            args.outformat = FORMAT_FASTA;
+        } else if (0 == strcasecmp("sam", arg)) {
+            args.outformat = FORMAT_SAM;
+        } else {
+            errx(EXIT_FAILURE, "Unrecognised format");
+        }
+        break;
+    case 'l':
+        args.limit = atoi(arg);
+        assert(args.limit > 0);
+        break;
+    case 'o':
+        args.output = fopen(arg, "w");
+        if (NULL == args.output) {
+            errx(EXIT_FAILURE, "Failed to open \"%s\" for output.", arg);
+        }
+        break;
+    case 'p':
+        args.prefix = arg;
+        break;
+    case 's':
+        args.skip_pen = parse_penalty_list(arg, "skip");
+        break;
+    case 'y':
+        args.stay_pen = parse_penalty_list(arg, "stay");
+        break;
+    case 6:
+        args.local_pen = parse_penalty_list(arg, "local");
+        break;
+    case 'H':
+        args.nhomopolymer = 0;
+        for (char * tok = strtok(arg, ","); NULL != tok; tok = strtok(NULL, ",")) {
+            const enum homopolymer_calculation calc = get_homopolymer_calculation(tok);
+            if (HOMOPOLYMER_INVALID == calc) {
+                errx(EXIT_FAILURE, "Invalid homopolymer calculation \"%s\"", tok);
+            }
+            if (REDECODE_MAX_VALUES == args.nhomopolymer) {
+                errx(EXIT_FAILURE, "At most %d homopolymer calculations may be given", REDECODE_MAX_VALUES);
+            }
+            args.homopolymer[args.nhomopolymer++] = calc;
+        }
+        if (0 == args.nhomopolymer) {
+            errx(EXIT_FAILURE, "No homopolymer calculation given");
+        }
+        break;
+    case 1:
+        args.slip = true;
+        args.both_slip = false;
+        break;
+    case 2:
+        args.slip = false;
+        args.both_slip = false;
+        break;
+    case 3:
+        args.both_slip = true;
+        break;
+    case 17:
+        args.low_memory = true;
+        break;
+    case 18:
+        args.low_memory = false;
+        break;
+    case 10:
+    case 11:
+        ret = fputs(scrappie_licence_text, stdout);
+        exit((EOF != ret) ? EXIT_SUCCESS : EXIT_FAILURE);
+        break;
+    #if defined(_OPENMP)
+    case '#':
+        {
+            int nthread = atoi(arg);
+            const int maxthread = omp_get_max_threads();
+            if(nthread < 1){nthread = 1;}
+            if(nthread > maxthread){nthread = maxthread;}
+            omp_set_num_threads(nthread);
+        }
+        break;
+    #endif
+    case ARGP_KEY_NO_ARGS:
+        argp_usage(state);
+        break;
+    case ARGP_KEY_ARG:
+        args.files = &state->argv[state->next - 1];
+        state->next = state->argc;
+        break;
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+
+static struct argp argp = {options, parse_arg, args_doc, doc};
+
+
+/**  Parameters of the decoders that do not affect the posterior
+ **/
+typedef struct {
+    float stay_pen;
+    float skip_pen;
+    float local_pen;
+    bool slip;
+    enum homopolymer_calculation homopolymer;
+} decode_param;
+
+
+/**  Every combination of the values given on the command line
+ *
+ *   @param nset  Number of combinations [out]
+ *
+ *   @returns Array of combinations, varying the homopolymer calculation
+ *   fastest and the stay penalty slowest
+ **/
+static decode_param * make_decode_params(size_t * nset) {
+    const size_t nslip = args.both_slip ? 2 : 1;
+    *nset = args.stay_pen.n * args.skip_pen.n * args.local_pen.n * nslip * args.nhomopolymer;
+    decode_param * param = calloc(*nset, sizeof(decode_param));
+    RETURN_NULL_IF(NULL == param, NULL);
+
+    size_t i = 0;
+    for (size_t st = 0; st < args.stay_pen.n; st++) {
+        for (size_t sk = 0; sk < args.skip_pen.n; sk++) {
+            for (size_t lo = 0; lo < args.local_pen.n; lo++) {
+                for (size_t sl = 0; sl < nslip; sl++) {
+                    for (size_t ho = 0; ho < args.nhomopolymer; ho++, i++) {
+                        param[i] = (decode_param){args.stay_pen.value[st], args.skip_pen.value[sk],
+                                                  args.local_pen.value[lo],
+                                                  args.both_slip ? (1 == sl) : args.slip,
+                                                  args.homopolymer[ho]};
+                    }
+                }
+            }
+        }
+    }
+    return param;
+}
+
+
+static const char * homopolymer_string(enum homopolymer_calculation calc) {
+    return (HOMOPOLYMER_NOCHANGE == calc) ? "nochange" : "mean";
+}
+
+
+/**  Decode posterior of a read with one set of parameters and format its record
+ *
+ *   @param set  Index of parameter set, included in name of read when there is
+ *   more than one set
+ *   @param record  Formatted record [out]
+ *
+ *   @returns true on success
+ **/
+static bool redecode_read(const_scrappie_matrix post, const posterior_record_header * header,
+                          const decode_param param, size_t set, size_t nset, output_buffer * record) {
+    const size_t nblock = post->nc;
+    int * path = calloc(nblock + 1, sizeof(int));
+    int * pos = calloc(nblock + 1, sizeof(int));
+    if (NULL == path || NULL == pos) {
+        free(pos);
+        free(path);
+        return false;
+    }
+
+    const bool crf = (SCRAPPIE_MODEL_RNNRF_R9_4 == get_raw_model(header->model));
+    float score = NAN;
+    char * basecall = NULL;
+    if (crf) {
+        score = args.low_memory ? decode_crf_checkpointed(post, path) : decode_crf(post, path);
+        basecall = crfpath_to_basecall(path, nblock, pos);
+    } else {
+        if (args.low_memory) {
+            score = decode_transducer_checkpointed(post, param.stay_pen, param.skip_pen, param.local_pen, path, param.slip);
+            basecall = homopolymer_overlapper(post, path, param.homopolymer, pos);
+        } else {
+            basecall = decode_transducer_basecall(post, param.stay_pen, param.skip_pen, param.local_pen, param.slip,
+                                                  param.homopolymer, path, pos, &score);
+        }
+    }
+    free(pos);
+    free(path);
+    RETURN_NULL_IF(NULL == basecall, false);
+
+    //  Read id of record is NUL terminated within its field
+    char read_id[POSTERIOR_READ_ID_LEN + 32];
+    if (nset > 1) {
+        sprintf(read_id, "%.*s_set%zu", POSTERIOR_READ_ID_LEN, header->read_id, set);
+    } else {
+        sprintf(read_id, "%.*s", POSTERIOR_READ_ID_LEN, header->read_id);
+    }
+    const size_t basecall_length = strlen(basecall);
+    bool ok = false;
+    if (FORMAT_SAM == args.outformat) {
+        ok = output_buffer_printf(record, "%s%s\t4\t*\t0\t0\t*\t*\t0\t0\t%s\t*\n", args.prefix, read_id,
+                                  basecall);
+    } else {
+        ok = output_buffer_printf(record,
+                                  ">%s%s  { \"read_id\" : \"%.*s\", \"parameter_set\" : %zu, \"stay_pen\" : %f, \"skip_pen\" : %f, \"local_pen\" : %f, \"slip\" : %s, \"homopolymer\" : \"%s\", \"normalised_score\" : %f,  \"nblock\" : %zu,  \"sequence_length\" : %zu,  \"blocks_per_base\" : %f }\n%s\n",
+                                  args.prefix, read_id, POSTERIOR_READ_ID_LEN, header->read_id, set,
+                                  param.stay_pen, param.skip_pen, param.local_pen,
+                                  param.slip ? "true" : "false", homopolymer_string(param.homopolymer),
+                                  -score / nblock, nblock, basecall_length,
+                                  (float)nblock / (float)basecall_length, basecall);
+    }
+    free(basecall);
+    return ok;
+}
+
+
+/**  Decode records of posterior file with every parameter set
+ *
+ *   Records are taken REDECODE_RECORDS_PER_THREAD per thread at a time, each
+ *   copied once into a matrix shared by all of its parameter sets, and every
+ *   (record, parameter set) pair is decoded in parallel.  Output is in the
+ *   order of the records, then of the parameter sets.
+ *
+ *   @param nlimit  Maximum number of records to decode
+ *
+ *   @returns Number of records decoded
+ **/
+static size_t redecode_file(const posterior_file * pf, const decode_param * param, size_t nset,
+                            size_t nlimit) {
+    int nthread = 1;
+#if defined(_OPENMP)
+    nthread = omp_get_max_threads();
+#endif
+    const size_t nrecord = (pf->nrecord < nlimit) ? pf->nrecord : nlimit;
+    const size_t nchunk = REDECODE_RECORDS_PER_THREAD * nthread;
+    scrappie_matrix * post = calloc(nchunk, sizeof(scrappie_matrix));
+    output_buffer * record = calloc(nchunk * nset, sizeof(output_buffer));
+    if (NULL == post || NULL == record) {
+        free(record);
+        free(post);
+        warnx("Failed to allocate memory to decode posteriors");
+        return 0;
+    }
+
+    for (size_t r0 = 0; r0 < nrecord; r0 += nchunk) {
+        const size_t nr = (nrecord - r0 < nchunk) ? (nrecord - r0) : nchunk;
+#pragma omp parallel for schedule(dynamic)
+        for (size_t r = 0; r < nr; r++) {
+            post[r] = posterior_record_to_matrix(pf->record[r0 + r]);
+        }
+#pragma omp parallel for schedule(dynamic)
+        for (size_t task = 0; task < nr * nset; task++) {
+            const size_t r = task / nset;
+            const size_t set = task % nset;
+            const posterior_record_header * header = pf->record[r0 + r];
+            const bool crf = (SCRAPPIE_MODEL_RNNRF_R9_4 == get_raw_model(header->model));
+            //  Parameters do not affect decoding of CRF so it is only decoded once
+            if (NULL == post[r] || (crf && set > 0)) {
+                continue;
+            }
+            if (!redecode_read(post[r], header, param[set], set, crf ? 1 : nset, record + task)) {
+                warnx("Failed to decode posterior of %.*s", POSTERIOR_READ_ID_LEN, header->read_id);
+                output_buffer_release(record + task);
+            }
+        }
+        for (size_t task = 0; task < nr * nset; task++) {
+            if (!write_output_buffer(args.output, record + task)) {
+                warnx("Failed to write basecall");
+            }
+            output_buffer_release(record + task);
+        }
+        for (size_t r = 0; r < nr; r++) {
+            post[r] = free_scrappie_matrix(post[r]);
+        }
+    }
+
+    free(record);
+    free(post);
+    return nrecord;
+}
+
+
+int main_redecode(int argc, char *argv[]) {
+    argp_parse(&argp, argc, argv, 0, 0, NULL);
+    if (NULL == args.output) {
+        args.output = stdout;
+    }
+
+    size_t nset = 0;
+    decode_param * param = make_decode_params(&nset);
+    if (NULL == param) {
+        errx(EXIT_FAILURE, "Failed to allocate memory for parameter sets");
+    }
+
+    size_t nremaining = (args.limit > 0) ? (size_t)args.limit : SIZE_MAX;
+    for (char ** file = args.files; NULL != *file && nremaining > 0; file++) {
+        posterior_file * pf = open_posterior_file(*file);
+        if (NULL == pf) {
+            warnx("Skipping \"%s\"", *file);
+            continue;
+        }
+        nremaining -= redecode_file(pf, param, nset, nremaining);
+        pf = free_posterior_file(pf);
+    }
+
+    free(param);
+    if (stdout != args.output) {
+        fclose(args.output);
+    }
+    return EXIT_SUCCESS;
+}
@@ -84,7 +84,7 @@ scrappie_seq_t read_sequence_from_fasta(char const * filename){
     kseq_t * kseqer = kseq_init(fileno(fh));
     if(kseq_read(kseqer) >= 0){
         char * name = calloc(kseqer->name.l + 1, sizeof(char));
-        char * base_seq = calloc(kseqer->seq.l, sizeof(char));
+        char * base_seq = calloc(kseqer->seq.l + 1, sizeof(char));
         if(NULL == base_seq || NULL == name){
             free(base_seq);
             free(name);
@@ -102,6 +102,76 @@ scrappie_seq_t read_sequence_from_fasta(char const * filename){
 }
 
 
+/**  Read all sequences from a fasta file
+ *
+ *   @param filename  Fasta file to read
+ *   @param nseq      Number of sequences read [out]
+ *
+ *   @returns Array of sequences, in order of file, or NULL on failure or if
+ *   file contains no sequences
+ **/
+scrappie_seq_t * read_sequences_from_fasta(char const * filename, size_t * nseq){
+    RETURN_NULL_IF(NULL == nseq, NULL);
+    *nseq = 0;
+
+    FILE * fh = fopen(filename, "r");
+    RETURN_NULL_IF(NULL == fh, NULL);
+
+    size_t nalloc = 16;
+    scrappie_seq_t * seqs = calloc(nalloc, sizeof(scrappie_seq_t));
+    kseq_t * kseqer = kseq_init(fileno(fh));
+    bool ok = (NULL != seqs);
+    while(ok && kseq_read(kseqer) >= 0){
+        if(*nseq == nalloc){
+            scrappie_seq_t * newseqs = realloc(seqs, 2 * nalloc * sizeof(scrappie_seq_t));
+            if(NULL == newseqs){
+                ok = false;
+                break;
+            }
+            seqs = newseqs;
+            nalloc *= 2;
+        }
+        char * name = calloc(kseqer->name.l + 1, sizeof(char));
+        char * base_seq = calloc(kseqer->seq.l + 1, sizeof(char));
+        if(NULL == base_seq || NULL == name){
+            free(base_seq);
+            free(name);
+            ok = false;
+            break;
+        }
+        seqs[*nseq].seq = strncpy(base_seq, kseqer->seq.s, kseqer->seq.l);
+        seqs[*nseq].name = strncpy(name, kseqer->name.s, kseqer->name.l);
+        seqs[*nseq].n = kseqer->seq.l;
+        *nseq += 1;
+    }
+
+    kseq_destroy(kseqer);
+    fclose(fh);
+
+    if(!ok || 0 == *nseq){
+        seqs = free_sequences(seqs, *nseq);
+        *nseq = 0;
+    }
+
+    return seqs;
+}
+
+
+/**  Free array of sequences
+ *
+ *   @returns NULL
+ **/
+scrappie_seq_t * free_sequences(scrappie_seq_t * seqs, size_t nseq){
+    if(NULL != seqs){
+        for(size_t i=0 ; i < nseq ; i++){
+            free(seqs[i].seq);
+            free(seqs[i].name);
+        }
+        free(seqs);
+    }
+    return NULL;
+}
+
 /**  Calculate an int that represents b repeated nrep times in base 4
  *
  *   (for example, repeatblock(1,1) = 1
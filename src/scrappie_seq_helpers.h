@@ -15,6 +15,8 @@ typedef struct {
 int base_to_int(char c, bool allow_lower);
 int * encode_bases_to_integers(char const * seq, size_t n, size_t state_len);
 scrappie_seq_t read_sequence_from_fasta(char const * filename);
+scrappie_seq_t * read_sequences_from_fasta(char const * filename, size_t * nseq);
+scrappie_seq_t * free_sequences(scrappie_seq_t * seqs, size_t nseq);
 int repeatblock(int b, int nrep);
 int kmerlength_fromnblocks(int n);
 
@@ -1,14 +1,20 @@
 #include <math.h>
+#if defined(_OPENMP)
+#    include <omp.h>
+#endif
 #include <stdio.h>
 //#include <string.h>
 #include <strings.h>
 #include <sys/types.h>
 
+#include "banding.h"
 #include "decode.h"
 #include "fast5_interface.h"
 #include "networks.h"
+#include "packed_reference.h"
 #include "scrappie_common.h"
 #include "scrappie_licence.h"
+#include "scrappie_pipeline.h"
 #include "scrappie_seq_helpers.h"
 #include "scrappie_stdlib.h"
 #include "util.h"
@@ -21,7 +27,7 @@
 extern const char *argp_program_version;
 extern const char *argp_program_bug_address;
 static char doc[] = "Scrappie seqmappy (local-global)";
-static char args_doc[] = "fasta fast5";
+static char args_doc[] = "fasta fast5 [fast5 ...]";
 static struct argp_option options[] = {
     {"localpen", 'l', "float", 0, "Penalty for local matching"},
     {"min_prob", 'm', "probability", 0, "Minimum bound on probability of match"},
@@ -35,6 +41,15 @@ static struct argp_option options[] = {
     {"temperature2", 8, "factor", 0, "Temperature for softmax bias"},
     {"licence", 10, 0, 0, "Print licensing information"},
     {"license", 11, 0, OPTION_ALIAS, "Print licensing information"},
+    {"fixed-point", 12, 0, 0, "Map using 16-bit fixed-point scores"},
+    {"no-fixed-point", 13, 0, OPTION_ALIAS, "Map using floating point scores"},
+    {"band", 14, "margin", 0, "Map within band seeded from basecall, widened by margin (0 for full mapping)"},
+    {"best", 15, 0, 0, "Only report the best scoring reference for each read"},
+    {"all", 16, 0, OPTION_ALIAS, "Report mapping to every reference"},
+    {"prefetch", 17, "nreads", 0, "Number of reads to load ahead of mapping on a separate thread (0 is off)"},
+#if defined(_OPENMP)
+    {"threads", '#', "nparallel", 0, "Number of reads to map in parallel"},
+#endif
     {0}
 };
 
@@ -52,9 +67,13 @@ struct arguments {
     int trim_end;
     int varseg_chunk;
     float varseg_thresh;
+    bool fixed_point;
+    int band_margin;
+    bool best;
+    int prefetch;
 
     char * fasta_file;
-    char * fast5_file;
+    char ** files;
 };
 
 static struct arguments args = {
@@ -70,9 +89,13 @@ static struct arguments args = {
     .trim_end = 10,
     .varseg_chunk = 100,
     .varseg_thresh = 0.0f,
+    .fixed_point = false,
+    .band_margin = 0,
+    .best = false,
+    .prefetch = 0,
 
     .fasta_file = NULL,
-    .fast5_file = NULL
+    .files = NULL
 };
 
 static error_t parse_arg(int key, char *arg, struct argp_state *state) {
@@ -137,6 +160,37 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state) {
         ret = fputs(scrappie_licence_text, stdout);
         exit((EOF != ret) ? EXIT_SUCCESS : EXIT_FAILURE);
         break;
+    case 12:
+        args.fixed_point = true;
+        break;
+    case 13:
+        args.fixed_point = false;
+        break;
+    case 14:
+        args.band_margin = atoi(arg);
+        assert(args.band_margin >= 0);
+        break;
+    case 15:
+        args.best = true;
+        break;
+    case 16:
+        args.best = false;
+        break;
+    case 17:
+        args.prefetch = atoi(arg);
+        assert(args.prefetch >= 0);
+        break;
+    #if defined(_OPENMP)
+    case '#':
+        {
+            int nthread = atoi(arg);
+            const int maxthread = omp_get_max_threads();
+            if(nthread < 1){nthread = 1;}
+            if(nthread > maxthread){nthread = maxthread;}
+            omp_set_num_threads(nthread);
+        }
+        break;
+    #endif
 
     case ARGP_KEY_NO_ARGS:
         argp_usage(state);
@@ -147,7 +201,7 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state) {
         if(NULL == state->argv[state->next]){
             errx(EXIT_FAILURE, "fast5 file is a required argument");
         }
-        args.fast5_file = state->argv[state->next];
+        args.files = &state->argv[state->next];
         state->next = state->argc;
         break;
 
@@ -161,66 +215,179 @@ static struct argp argp = { options, parse_arg, args_doc, doc };
 
 
 
-int main_seqmappy(int argc, char *argv[]) {
-    argp_parse(&argp, argc, argv, 0, 0, NULL);
-    if(NULL == args.output){
-        args.output = stdout;
-    }
 
 
-    //  Open sequence file
-    scrappie_seq_t seq = read_sequence_from_fasta(args.fasta_file);
-    if(NULL == seq.seq){
-        warnx("Failed to open \"%s\" for input.\n", args.fasta_file);
-        return EXIT_FAILURE;
-    }
+//  References, packed two bits to a base.  The states of each reference, in
+//  the same history states as the posterior, are formed as it is mapped.
+static const size_t state_len = 5;
+static packed_reference * refs = NULL;
+static size_t nref = 0;
+static size_t ref_maxlen = 0;
 
-    const size_t state_len = 5;
-    const size_t nstate = seq.n - state_len + 1;
-    int * states = encode_bases_to_integers(seq.seq, seq.n, state_len);
-    if(NULL == states){
-        warnx("Memory allocation failure");
-        return EXIT_FAILURE;
+
+struct _seqmappy_result {
+    size_t nblock;
+    //  Number of mappings reported, either one per reference or just the best
+    size_t nmap;
+    //  Index of reference, score and path for each mapping [nmap] and [nmap * nblock]
+    size_t * ref;
+    float * score;
+    int * path;
+};
+
+static struct _seqmappy_result * free_seqmappy_result(struct _seqmappy_result * res){
+    if(NULL != res){
+        free(res->path);
+        free(res->score);
+        free(res->ref);
+        free(res);
     }
+    return NULL;
+}
+
 
-    //  Read raw signal and normalise
-    raw_table rt = read_raw(args.fast5_file, true);
+/**  Map a single read to every reference
+ *
+ *   The posterior is calculated once and shared by all the mappings
+ *
+ *   @returns Pointer to mappings, to be freed by output_seqmappy_read, or NULL on failure
+ **/
+static void * process_seqmappy_read(char * filename, raw_table rt){
+    if(NULL == rt.raw){
+        warnx("Failed to open \"%s\" for input.", filename);
+        free(rt.uuid);
+        return NULL;
+    }
+    char * uuid = rt.uuid;
     rt = trim_and_segment_raw(rt, args.trim_start, args.trim_end, args.varseg_chunk, args.varseg_thresh);
+    free(uuid);
     if(NULL == rt.raw){
-        warnx("Failed to open \"%s\" for input and trim signal.\n", args.fasta_file);
-        free(states);
-        return EXIT_FAILURE;
+        warnx("Failed to trim signal of \"%s\".", filename);
+        return NULL;
     }
     medmad_normalise_array(rt.raw + rt.start, rt.end - rt.start);
 
-
     scrappie_matrix logpost = nanonet_rgrgr_r94_posterior(rt, args.min_prob, args.temperature1, args.temperature2, true);
+    free(rt.raw);
     if(NULL == logpost){
-        warnx("Failed to calculate posterior for \"%s\" ", args.fasta_file);
-        free(states);
-        return EXIT_FAILURE;
+        warnx("Failed to calculate posterior for \"%s\".", filename);
+        return NULL;
     }
 
     const size_t nblock = logpost->nc;
+    const size_t nmap = args.best ? 1 : nref;
+    struct _seqmappy_result * res = calloc(1, sizeof(*res));
     int * path = calloc(nblock, sizeof(int));
-    if(NULL != path){
-        float score = map_to_sequence_viterbi(logpost, args.stay_pen, args.skip_pen, args.local_pen, states, nstate, path);
+    int * states = calloc(ref_maxlen, sizeof(int));
+    //  Bases are only needed to seed bands
+    char * bases = (args.band_margin > 0) ? calloc(ref_maxlen + 1, sizeof(char)) : NULL;
+    if(NULL != res){
+        res->nblock = nblock;
+        res->ref = calloc(nmap, sizeof(size_t));
+        res->score = calloc(nmap, sizeof(float));
+        res->path = calloc(nmap * nblock, sizeof(int));
+    }
+    if(NULL == res || NULL == res->ref || NULL == res->score || NULL == res->path || NULL == path
+       || NULL == states || (args.band_margin > 0 && NULL == bases)){
+        warnx("Failed to allocate memory for mapping of \"%s\".", filename);
+        free(bases);
+        free(states);
+        free(path);
+        logpost = free_scrappie_matrix(logpost);
+        return free_seqmappy_result(res);
+    }
 
-        fprintf(args.output, "# %s to %s -- score %f over %zu blocks (%f per block)\n", args.fast5_file, args.fasta_file, -score, nblock, -score / nblock);
+    for(size_t r=0 ; r < nref ; r++){
+        const size_t nstate = packed_reference_length(refs, r) - state_len + 1;
+        (void)packed_reference_states(refs, r, state_len, states);
+        float score = NAN;
+        if(args.band_margin > 0){
+            (void)packed_reference_bases(refs, r, bases);
+            score = map_to_sequence_viterbi_seeded(logpost, args.stay_pen, args.skip_pen, args.local_pen, bases,
+                                                   states, nstate, args.band_margin, path);
+        } else if(args.fixed_point){
+            score = map_to_sequence_viterbi_fixed(logpost, args.stay_pen, args.skip_pen, args.local_pen, states,
+                                                  nstate, path);
+        } else {
+            score = map_to_sequence_viterbi(logpost, args.stay_pen, args.skip_pen, args.local_pen, states,
+                                            nstate, path);
+        }
+
+        //  Scores are log-likelihoods, so best is largest
+        const size_t m = args.best ? 0 : res->nmap;
+        if(args.best && res->nmap > 0 && !(score > res->score[0])){
+            continue;
+        }
+        res->ref[m] = r;
+        res->score[m] = score;
+        memcpy(res->path + m * nblock, path, nblock * sizeof(int));
+        if(m == res->nmap){
+            res->nmap += 1;
+        }
+    }
+
+    free(bases);
+    free(states);
+    free(path);
+    logpost = free_scrappie_matrix(logpost);
+
+    return res;
+}
+
+
+static void output_seqmappy_read(char * filename, void * result){
+    struct _seqmappy_result * res = result;
+    const size_t nblock = res->nblock;
+    for(size_t m=0 ; m < res->nmap ; m++){
+        const float score = res->score[m];
+        int const * path = res->path + m * nblock;
+        fprintf(args.output, "# %s%s to %s -- score %f over %zu blocks (%f per block)\n", args.prefix, filename,
+                packed_reference_name(refs, res->ref[m]), -score, nblock, -score / nblock);
         fprintf(args.output, "block\tpos\n");
         for(size_t i=0 ; i < nblock ; i++){
-            const int32_t pos = path[i];
-            fprintf(args.output, "%zu\t%d\n", i, pos);
+            fprintf(args.output, "%zu\t%d\n", i, path[i]);
         }
+    }
+    res = free_seqmappy_result(res);
+}
 
-        free(path);
+
+int main_seqmappy(int argc, char *argv[]) {
+    argp_parse(&argp, argc, argv, 0, 0, NULL);
+    if(args.fixed_point && args.band_margin > 0){
+        errx(EXIT_FAILURE, "--fixed-point and --band are incompatible");
+    }
+    if(NULL == args.output){
+        args.output = stdout;
     }
 
 
-    free(states);
-    logpost = free_scrappie_matrix(logpost);
-    free(seq.seq);
-    free(seq.name);
+    //  Open packed reference, or pack sequences of fasta file
+    refs = open_packed_reference(args.fasta_file);
+    if(NULL == refs){
+        warnx("Failed to open \"%s\" for input.\n", args.fasta_file);
+        return EXIT_FAILURE;
+    }
+    nref = refs->nseq;
+    ref_maxlen = packed_reference_max_length(refs);
+    for(size_t r=0 ; r < nref ; r++){
+        if(packed_reference_length(refs, r) < state_len){
+            errx(EXIT_FAILURE, "Reference \"%s\" is shorter than a state", packed_reference_name(refs, r));
+        }
+    }
+
+    //  Reads are shared between threads and mappings written in input order
+    read_pipeline_param pipeline = read_pipeline_defaults;
+    pipeline.nprefetch = args.prefetch;
+    (void)run_read_pipeline(args.files, pipeline, process_seqmappy_read, output_seqmappy_read);
+
+
+    refs = free_packed_reference(refs);
+    nref = 0;
+
+    if(stdout != args.output){
+        fclose(args.output);
+    }
 
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,973 @@
+// Needed for getaddrinfo and sigaction
+#define _POSIX_C_SOURCE 200112L
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <math.h>
+#include <netdb.h>
+#if defined(_OPENMP)
+#    include <omp.h>
+#endif
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "decode.h"
+#include "fast5_interface.h"
+#include "homopolymer.h"
+#include "model_file.h"
+#include "networks.h"
+#include "scrappie_common.h"
+#include "scrappie_licence.h"
+#include "scrappie_matrix.h"
+#include "scrappie_stdlib.h"
+#include "util.h"
+
+// Doesn't play nice with other headers, include last
+#include <argp.h>
+
+//  Longest line accepted from a client
+#define SERVE_MAX_LINE (1 << 28)
+//  Longest wait, in milliseconds, for activity when no reads are waiting
+#define SERVE_IDLE_MS 1000
+
+
+extern const char *argp_program_version;
+extern const char *argp_program_bug_address;
+static char doc[] = "Scrappie server -- basecall raw signal sent over a socket\v"
+    "Each line sent by a client is a request, either \"fast5 <path>\" to call every read "
+    "of a fast5 file or \"signal <name> <pA> <pA> ...\" to call a read given as samples in pA.  "
+    "The answer to each request, in the order they were sent, is a line \"ok <nread>\" followed "
+    "by the FASTA or SAM record of each read called, or a line \"error <message>\".  Reads from all "
+    "clients are basecalled together in batches.";
+static char args_doc[] = "";
+static struct argp_option options[] = {
+    {"socket", 'S', "path", 0, "Listen on Unix domain socket at path"},
+    {"port", 'P', "port", 0, "Listen on TCP port rather than a Unix domain socket"},
+    {"host", 1, "address", 0, "Address on which to listen for TCP connections"},
+    {"batch-size", 'b', "nreads", 0, "Maximum number of reads in each batch evaluated by a thread"},
+    {"max-latency", 2, "ms", 0, "Longest time a read waits for its batch to fill before being called"},
+    {"format", 'f', "format", 0, "Format to output reads (FASTA or SAM)"},
+    {"model", 5, "name", 0, "Raw model to use: \"raw_r94\", \"rgrgr_r94\", \"rgrgr_r941\", \"rgrgr_r10\", \"rnnrf_r94\""},
+    {"model-file", 3, "filename", 0, "Read weights of model from binary model file rather than using those compiled in"},
+    {"min_prob", 'm', "probability", 0, "Minimum bound on probability of match"},
+    {"skip", 's', "penalty", 0, "Penalty for skipping a base"},
+    {"stay", 'y', "penalty", 0, "Penalty for staying"},
+    {"local", 4, "penalty", 0, "Penalty for local basecalling"},
+    {"trim", 't', "start:end", 0, "Number of samples to trim, as start:end"},
+    {"segmentation", 6, "chunk:percentile", 0, "Chunk size and percentile for variance based segmentation"},
+    {"homopolymer", 'H', "homopolymer", 0,
+     "Homopolymer run calc. to use: choose from \"nochange\" or \"mean\" (default). Not implemented for CRF."},
+    {"uuid", 7, 0, 0, "Output UUID"},
+    {"no-uuid", 8, 0, OPTION_ALIAS, "Output read file"},
+    {"licence", 10, 0, 0, "Print licensing information"},
+    {"license", 11, 0, OPTION_ALIAS, "Print licensing information"},
+#if defined(_OPENMP)
+    {"threads", '#', "nparallel", 0, "Number of batches to call in parallel"},
+#endif
+    {0}
+};
+
+enum format { FORMAT_FASTA, FORMAT_SAM };
+
+struct arguments {
+    char * socket;
+    char * port;
+    char * host;
+    int batch_size;
+    float max_latency;
+    enum format outformat;
+    enum raw_model_type model_type;
+    char * model_file;
+    float min_prob;
+    float skip_pen;
+    float stay_pen;
+    float local_pen;
+    int trim_start;
+    int trim_end;
+    int varseg_chunk;
+    float varseg_thresh;
+    enum homopolymer_calculation homopolymer;
+    bool uuid;
+};
+
+static struct arguments args = {
+    .socket = NULL,
+    .port = NULL,
+    .host = "127.0.0.1",
+    .batch_size = 8,
+    .max_latency = 50.0f,
+    .outformat = FORMAT_FASTA,
+    .model_type = SCRAPPIE_MODEL_RGRGR_R9_4,
+    .model_file = NULL,
+    .min_prob = 1e-5f,
+    .skip_pen = 0.0f,
+    .stay_pen = 0.0f,
+    .local_pen = 2.0f,
+    .trim_start = 200,
+    .trim_end = 10,
+    .varseg_chunk = 100,
+    .varseg_thresh = 0.0f,
+    .homopolymer = HOMOPOLYMER_MEAN,
+    .uuid = false
+};
+
+
+static error_t parse_arg(int key, char *arg, struct argp_state *state) {
+    int ret = 0;
+    char * next_tok = NULL;
+
+    switch (key) {
+    case 'S':
+        args.socket = arg;
+        break;
+    case 'P':
+        args.port = arg;
+        break;
+    case 1:
+        args.host = arg;
+        break;
+    case 'b':
+        args.batch_size = atoi(arg);
+        if(args.batch_size < 1){
+            errx(EXIT_FAILURE, "--batch-size must be at least 1");
+        }
+        break;
+    case 2:
+        args.max_latency = atof(arg);
+        assert(args.max_latency >= 0.0f);
+        break;
+    case 'f':
+        if (0 == strcasecmp("fasta", arg)) {
+            args.outformat = FORMAT_FASTA;
+        } else if (0 == strcasecmp("sam", arg)) {
+            args.outformat = FORMAT_SAM;
+        } else {
+            errx(EXIT_FAILURE, "Unrecognised format");
+        }
+        break;
+    case 5:
+        args.model_type = get_raw_model(arg);
+        if(SCRAPPIE_MODEL_INVALID == args.model_type){
+            errx(EXIT_FAILURE, "Invalid raw model name \"%s\"", arg);
+        }
+        break;
+    case 3:
+        args.model_file = arg;
+        break;
+    case 'm':
+        args.min_prob = atof(arg);
+        break;
+    case 's':
+        args.skip_pen = atof(arg);
+        break;
+    case 'y':
+        args.stay_pen = atof(arg);
+        break;
+    case 4:
+        args.local_pen = atof(arg);
+        break;
+    case 't':
+        args.trim_start = atoi(strtok(arg, ":"));
+        next_tok = strtok(NULL, ":");
+        if(NULL != next_tok){
+            args.trim_end = atoi(next_tok);
+        } else {
+            args.trim_end = args.trim_start;
+        }
+        assert(args.trim_start >= 0);
+        assert(args.trim_end >= 0);
+        break;
+    case 6:
+        args.varseg_chunk = atoi(strtok(arg, ":"));
+        next_tok = strtok(NULL, ":");
+        if(NULL == next_tok){
+            errx(EXIT_FAILURE, "--segmentation should be of form chunk:percentile");
+        }
+        args.varseg_thresh = atof(next_tok) / 100.0;
+        assert(args.varseg_chunk >= 0);
+        assert(args.varseg_thresh > 0.0 && args.varseg_thresh < 1.0);
+        break;
+    case 'H':
+        args.homopolymer = get_homopolymer_calculation(arg);
+        if(HOMOPOLYMER_INVALID == args.homopolymer){
+            errx(EXIT_FAILURE, "Invalid homopolymer calculation \"%s\"", arg);
+        }
+        break;
+    case 7:
+        args.uuid = true;
+        break;
+    case 8:
+        args.uuid = false;
+        break;
+    case 10:
+    case 11:
+        ret = fputs(scrappie_licence_text, stdout);
+        exit((EOF != ret) ? EXIT_SUCCESS : EXIT_FAILURE);
+        break;
+    #if defined(_OPENMP)
+    case '#':
+        {
+            int nthread = atoi(arg);
+            const int maxthread = omp_get_max_threads();
+            if(nthread < 1){nthread = 1;}
+            if(nthread > maxthread){nthread = maxthread;}
+            omp_set_num_threads(nthread);
+        }
+        break;
+    #endif
+    case ARGP_KEY_ARG:
+        argp_usage(state);
+        break;
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+
+static struct argp argp = {options, parse_arg, args_doc, doc};
+
+
+/**  Growable buffer of bytes
+ **/
+typedef struct {
+    char * data;
+    size_t n;
+    size_t capacity;
+} serve_buffer;
+
+static bool buffer_reserve(serve_buffer * buf, size_t n) {
+    if (buf->n + n > buf->capacity) {
+        size_t capacity = (buf->capacity > 0) ? buf->capacity : 4096;
+        while (capacity < buf->n + n) {
+            capacity *= 2;
+        }
+        char * data = realloc(buf->data, capacity);
+        RETURN_NULL_IF(NULL == data, false);
+        buf->data = data;
+        buf->capacity = capacity;
+    }
+    return true;
+}
+
+static bool buffer_append(serve_buffer * buf, const char * data, size_t n) {
+    RETURN_NULL_IF(!buffer_reserve(buf, n), false);
+    if (n > 0) {
+        memcpy(buf->data + buf->n, data, n);
+    }
+    buf->n += n;
+    return true;
+}
+
+static bool buffer_printf(serve_buffer * buf, const char * fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    const int len = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    RETURN_NULL_IF(len < 0, false);
+    //  Room for the null written after the string
+    RETURN_NULL_IF(!buffer_reserve(buf, len + 1), false);
+    va_start(ap, fmt);
+    (void)vsnprintf(buf->data + buf->n, len + 1, fmt, ap);
+    va_end(ap);
+    buf->n += len;
+    return true;
+}
+
+static void buffer_consume(serve_buffer * buf, size_t n) {
+    assert(n <= buf->n);
+    memmove(buf->data, buf->data + n, buf->n - n);
+    buf->n -= n;
+}
+
+
+typedef struct {
+    int fd;
+    //  Unique identifier, since slots are reused once a client disconnects
+    uint64_t id;
+    serve_buffer in;
+    serve_buffer out;
+    //  Client will send no more requests, though may still be waiting for answers
+    bool eof;
+    //  Client has gone, or sent a request that could not be handled
+    bool closed;
+} serve_client;
+
+/**  Request of a client, answered once all of its reads have been called
+ **/
+typedef struct {
+    uint64_t client;
+    size_t nread;
+    size_t ndone;
+    //  Records of reads called successfully
+    serve_buffer records;
+    size_t nrecord;
+    char * error;
+} serve_request;
+
+typedef struct {
+    serve_request * request;
+    char * name;
+    raw_table rt;
+    double arrival;
+} serve_read;
+
+typedef struct {
+    serve_client * client;
+    size_t nclient;
+    uint64_t next_id;
+    //  Requests in the order they were made, by any client
+    serve_request ** request;
+    size_t nrequest;
+    size_t request_capacity;
+    //  Reads waiting to be called, oldest first
+    serve_read * read;
+    size_t nread;
+    size_t read_capacity;
+} serve_state;
+
+
+static volatile sig_atomic_t serve_stop = 0;
+
+static void handle_stop(int sig) {
+    (void)sig;
+    serve_stop = 1;
+}
+
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return 1e3 * ts.tv_sec + 1e-6 * ts.tv_nsec;
+}
+
+
+static void free_request(serve_request * request) {
+    if (NULL != request) {
+        free(request->records.data);
+        free(request->error);
+        free(request);
+    }
+}
+
+
+static serve_request * new_request(serve_state * state, uint64_t client) {
+    if (state->nrequest == state->request_capacity) {
+        const size_t capacity = (state->request_capacity > 0) ? 2 * state->request_capacity : 64;
+        serve_request ** request = realloc(state->request, capacity * sizeof(serve_request *));
+        RETURN_NULL_IF(NULL == request, NULL);
+        state->request = request;
+        state->request_capacity = capacity;
+    }
+    serve_request * request = calloc(1, sizeof(serve_request));
+    RETURN_NULL_IF(NULL == request, NULL);
+    request->client = client;
+    state->request[state->nrequest] = request;
+    state->nrequest += 1;
+    return request;
+}
+
+
+static bool queue_read(serve_state * state, serve_request * request, char * name, raw_table rt) {
+    if (state->nread == state->read_capacity) {
+        const size_t capacity = (state->read_capacity > 0) ? 2 * state->read_capacity : 64;
+        serve_read * reads = realloc(state->read, capacity * sizeof(serve_read));
+        RETURN_NULL_IF(NULL == reads, false);
+        state->read = reads;
+        state->read_capacity = capacity;
+    }
+    state->read[state->nread] = (serve_read){request, name, rt, now_ms()};
+    state->nread += 1;
+    request->nread += 1;
+    return true;
+}
+
+
+static void fail_request(serve_request * request, const char * message) {
+    if (NULL == request->error) {
+        request->error = calloc(strlen(message) + 1, sizeof(char));
+        if (NULL != request->error) {
+            memcpy(request->error, message, strlen(message));
+        }
+    }
+}
+
+
+/**  Queue every read of a fast5 file for calling
+ **/
+static void request_fast5(serve_state * state, serve_request * request, const char * path) {
+    fast5_reader * reader = open_fast5_reader(path);
+    if (NULL == reader) {
+        fail_request(request, "failed to open fast5 file");
+        return;
+    }
+    char * path_copy = calloc(strlen(path) + 1, sizeof(char));
+    if (NULL == path_copy) {
+        reader = free_fast5_reader(reader);
+        fail_request(request, "out of memory");
+        return;
+    }
+    memcpy(path_copy, path, strlen(path));
+    const char * filename = basename(path_copy);
+    while (!fast5_reader_finished(reader)) {
+        char * group = NULL;
+        raw_table rt = fast5_reader_next(reader, true, &group);
+        if (reader->multi && NULL == group) {
+            break;
+        }
+        const size_t len = strlen(filename) + strlen(group) + 2;
+        char * name = calloc(len, sizeof(char));
+        if (NULL != name) {
+            (void)snprintf(name, len, (NULL != group) ? "%s:%s" : "%s", filename, group);
+        }
+        free(group);
+        if (NULL == name || !queue_read(state, request, name, rt)) {
+            free(name);
+            free(rt.raw);
+            free(rt.uuid);
+            fail_request(request, "out of memory");
+            break;
+        }
+    }
+    free(path_copy);
+    reader = free_fast5_reader(reader);
+}
+
+
+/**  Queue read given as name and samples in pA
+ **/
+static void request_signal(serve_state * state, serve_request * request, char * line) {
+    char * save = NULL;
+    const char * read_name = strtok_r(line, " \t", &save);
+    if (NULL == read_name) {
+        fail_request(request, "signal request has no name");
+        return;
+    }
+    size_t capacity = 4096;
+    size_t n = 0;
+    float * signal = malloc(capacity * sizeof(float));
+    char * name = calloc(strlen(read_name) + 1, sizeof(char));
+    if (NULL == signal || NULL == name) {
+        free(signal);
+        free(name);
+        fail_request(request, "out of memory");
+        return;
+    }
+    memcpy(name, read_name, strlen(read_name));
+    for (char * tok = strtok_r(NULL, " \t", &save); NULL != tok; tok = strtok_r(NULL, " \t", &save)) {
+        char * end = NULL;
+        const float x = strtof(tok, &end);
+        if (end == tok || '\0' != *end || !isfinite(x)) {
+            free(signal);
+            free(name);
+            fail_request(request, "signal is not a list of numbers");
+            return;
+        }
+        if (n == capacity) {
+            capacity *= 2;
+            float * newsignal = realloc(signal, capacity * sizeof(float));
+            if (NULL == newsignal) {
+                free(signal);
+                free(name);
+                fail_request(request, "out of memory");
+                return;
+            }
+            signal = newsignal;
+        }
+        signal[n++] = x;
+    }
+    char * uuid = calloc(strlen(name) + 1, sizeof(char));
+    if (NULL != uuid) {
+        memcpy(uuid, name, strlen(name));
+    }
+    raw_table rt = {uuid, n, 0, n, signal};
+    if (!queue_read(state, request, name, rt)) {
+        free(signal);
+        free(uuid);
+        free(name);
+        fail_request(request, "out of memory");
+    }
+}
+
+
+/**  Handle a line sent by a client
+ **/
+static void handle_line(serve_state * state, serve_client * client, char * line) {
+    const size_t len = strlen(line);
+    if (len > 0 && '\r' == line[len - 1]) {
+        line[len - 1] = '\0';
+    }
+    if ('\0' == line[0]) {
+        return;
+    }
+    serve_request * request = new_request(state, client->id);
+    if (NULL == request) {
+        warnx("Failed to allocate memory for request");
+        client->closed = true;
+        return;
+    }
+    if (0 == strncmp(line, "fast5 ", 6)) {
+        request_fast5(state, request, line + 6);
+    } else if (0 == strncmp(line, "signal ", 7)) {
+        request_signal(state, request, line + 7);
+    } else {
+        fail_request(request, "unrecognised request");
+    }
+}
+
+
+static serve_client * find_client(serve_state * state, uint64_t id) {
+    for (size_t i = 0; i < state->nclient; i++) {
+        if (state->client[i].id == id) {
+            return state->client + i;
+        }
+    }
+    return NULL;
+}
+
+
+/**  Move answers of completed requests to their clients
+ *
+ *   A client is answered in the order of its requests, so a completed request
+ *   waits for any earlier request of the same client.
+ **/
+static void answer_requests(serve_state * state) {
+    size_t nkept = 0;
+    for (size_t r = 0; r < state->nrequest; r++) {
+        serve_request * request = state->request[r];
+        serve_client * client = find_client(state, request->client);
+        bool blocked = false;
+        for (size_t k = 0; k < nkept; k++) {
+            blocked |= (state->request[k]->client == request->client);
+        }
+        const bool complete = (request->ndone == request->nread);
+        if (NULL != client && (blocked || !complete)) {
+            state->request[nkept++] = request;
+            continue;
+        }
+        if (NULL != client) {
+            const bool ok = (NULL != request->error)
+                ? buffer_printf(&client->out, "error %s\n", request->error)
+                : (buffer_printf(&client->out, "ok %zu\n", request->nrecord)
+                   && buffer_append(&client->out, request->records.data, request->records.n));
+            if (!ok) {
+                warnx("Failed to allocate memory for answer to client");
+                client->closed = true;
+            }
+        } else if (!complete) {
+            //  Client has gone but reads are still waiting
+            state->request[nkept++] = request;
+            continue;
+        }
+        free_request(request);
+    }
+    state->nrequest = nkept;
+}
+
+
+/**  Decode posterior of a read and append its record to output
+ *
+ *   @returns true on success
+ **/
+static bool format_call(serve_buffer * out, const char * name, raw_table rt, scrappie_matrix post) {
+    const enum raw_model_type model = args.model_type;
+    const size_t nblock = post->nc;
+    int * path = calloc(nblock + 1, sizeof(int));
+    int * pos = calloc(nblock + 1, sizeof(int));
+    char * basecall = NULL;
+    float score = NAN;
+    if (NULL != path && NULL != pos) {
+        if (SCRAPPIE_MODEL_RNNRF_R9_4 != model) {
+            basecall = decode_transducer_basecall(post, args.stay_pen, args.skip_pen, args.local_pen, false,
+                                                  args.homopolymer, path, pos, &score);
+        } else {
+            score = decode_crf(post, path);
+            basecall = crfpath_to_basecall(path, nblock, pos);
+        }
+    }
+    free(pos);
+    free(path);
+    RETURN_NULL_IF(NULL == basecall, false);
+
+    const char * uuid = (NULL != rt.uuid) ? rt.uuid : "";
+    const char * id = args.uuid ? uuid : name;
+    const size_t basecall_len = strlen(basecall);
+    bool ok = false;
+    switch (args.outformat) {
+    case FORMAT_FASTA:
+        ok = buffer_printf(out,
+                           ">%s  { \"filename\" : \"%s\", \"uuid\" : \"%s\", \"normalised_score\" : %f,  \"nblock\" : %zu,  \"sequence_length\" : %zu,  \"blocks_per_base\" : %f, \"nsample\" : %zu, \"trim\" : [ %zu, %zu ] }\n%s\n",
+                           id, name, uuid, -score / nblock, nblock, basecall_len,
+                           (float)nblock / (float)basecall_len, rt.n, rt.start, rt.end, basecall);
+        break;
+    case FORMAT_SAM:
+        ok = buffer_printf(out, "%s\t4\t*\t0\t0\t*\t*\t0\t0\t%s\t*\n", id, basecall);
+        break;
+    default:
+        errx(EXIT_FAILURE, "Unrecognised output format");
+    }
+    free(basecall);
+    return ok;
+}
+
+
+/**  Call a batch of reads, the oldest waiting
+ *
+ *   The reads are divided between the threads, each of which evaluates the
+ *   network for its share together using the batched posterior function.
+ *
+ *   @param nread  Number of reads to call
+ **/
+static void call_batch(serve_state * state, size_t nread) {
+    assert(nread <= state->nread);
+    serve_read * batch = state->read;
+    serve_buffer * records = calloc(nread, sizeof(serve_buffer));
+    bool * called = calloc(nread, sizeof(bool));
+    if (NULL == records || NULL == called) {
+        errx(EXIT_FAILURE, "Failed to allocate memory for batch of %zu reads", nread);
+    }
+
+    const size_t batch_size = args.batch_size;
+    const size_t nsub = (nread + batch_size - 1) / batch_size;
+    posterior_batch_function_ptr calcpost = get_posterior_batch_function(args.model_type);
+#pragma omp parallel for schedule(dynamic)
+    for (size_t sub = 0; sub < nsub; sub++) {
+        const size_t start = sub * batch_size;
+        const size_t end = (start + batch_size < nread) ? (start + batch_size) : nread;
+        //  Reads that fail to trim are dropped from the batch evaluated
+        size_t * index = calloc(end - start, sizeof(size_t));
+        raw_table * sub_rts = calloc(end - start, sizeof(raw_table));
+        size_t nvalid = 0;
+        for (size_t i = start; NULL != index && NULL != sub_rts && i < end; i++) {
+            if (NULL == batch[i].rt.raw) {
+                continue;
+            }
+            char * uuid = batch[i].rt.uuid;
+            raw_table rt = trim_and_segment_raw(batch[i].rt, args.trim_start, args.trim_end,
+                                                args.varseg_chunk, args.varseg_thresh);
+            if (NULL == rt.raw) {
+                //  Signal has been freed but not the uuid
+                batch[i].rt = (raw_table){uuid, 0, 0, 0, NULL};
+                continue;
+            }
+            batch[i].rt = medmad_normalise_raw(rt);
+            index[nvalid] = i;
+            sub_rts[nvalid] = batch[i].rt;
+            nvalid += 1;
+        }
+        scrappie_matrix * post = (nvalid > 0) ? calcpost(sub_rts, nvalid, args.min_prob, 1.0f, 1.0f, true) : NULL;
+        for (size_t j = 0; NULL != post && j < nvalid; j++) {
+            const size_t i = index[j];
+            called[i] = (NULL != post[j]) && format_call(records + i, batch[i].name, batch[i].rt, post[j]);
+            post[j] = free_scrappie_matrix(post[j]);
+        }
+        free(post);
+        free(sub_rts);
+        free(index);
+    }
+
+    for (size_t i = 0; i < nread; i++) {
+        serve_request * request = batch[i].request;
+        if (called[i]) {
+            if (buffer_append(&request->records, records[i].data, records[i].n)) {
+                request->nrecord += 1;
+            } else {
+                fail_request(request, "out of memory");
+            }
+        } else {
+            //  Read is left out of the answer, as by scrappie raw
+            warnx("No basecall returned for %s", batch[i].name);
+        }
+        request->ndone += 1;
+        free(records[i].data);
+        free(batch[i].name);
+        free(batch[i].rt.raw);
+        free(batch[i].rt.uuid);
+    }
+    memmove(state->read, state->read + nread, (state->nread - nread) * sizeof(serve_read));
+    state->nread -= nread;
+
+    free(called);
+    free(records);
+}
+
+
+/**  Open socket listening on Unix domain socket or TCP port
+ *
+ *   @returns File descriptor of socket, or -1 on failure
+ **/
+static int open_listener(void) {
+    int fd = -1;
+    if (NULL != args.port) {
+        struct addrinfo hints;
+        memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        struct addrinfo * res = NULL;
+        const int ret = getaddrinfo(args.host, args.port, &hints, &res);
+        if (0 != ret) {
+            warnx("Failed to find address %s:%s -- %s", args.host, args.port, gai_strerror(ret));
+            return -1;
+        }
+        for (struct addrinfo * ai = res; NULL != ai && fd < 0; ai = ai->ai_next) {
+            fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (fd < 0) {
+                continue;
+            }
+            const int one = 1;
+            (void)setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if (0 != bind(fd, ai->ai_addr, ai->ai_addrlen)) {
+                close(fd);
+                fd = -1;
+            }
+        }
+        freeaddrinfo(res);
+        if (fd < 0) {
+            warn("Failed to bind to %s:%s", args.host, args.port);
+            return -1;
+        }
+    } else {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(args.socket) >= sizeof(addr.sun_path)) {
+            warnx("Path of socket \"%s\" is too long", args.socket);
+            return -1;
+        }
+        memcpy(addr.sun_path, args.socket, strlen(args.socket));
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        RETURN_NULL_IF(fd < 0, -1);
+        if (0 != bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+            warn("Failed to bind to socket \"%s\"", args.socket);
+            close(fd);
+            return -1;
+        }
+    }
+    if (0 != listen(fd, 64) || fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+        warn("Failed to listen on socket");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+static void accept_clients(serve_state * state, int listener) {
+    while (true) {
+        const int fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            return;
+        }
+        serve_client * client = realloc(state->client, (state->nclient + 1) * sizeof(serve_client));
+        if (NULL == client || fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+            warnx("Failed to accept client");
+            state->client = (NULL != client) ? client : state->client;
+            close(fd);
+            continue;
+        }
+        state->client = client;
+        state->client[state->nclient] = (serve_client){.fd = fd, .id = state->next_id};
+        state->next_id += 1;
+        state->nclient += 1;
+    }
+}
+
+
+/**  Read from client and handle every complete line
+ **/
+static void read_client(serve_state * state, serve_client * client) {
+    char chunk[65536];
+    while (true) {
+        const ssize_t nbyte = read(client->fd, chunk, sizeof(chunk));
+        if (nbyte > 0) {
+            if (client->in.n + nbyte > SERVE_MAX_LINE || !buffer_append(&client->in, chunk, nbyte)) {
+                warnx("Request from client too long");
+                client->closed = true;
+                return;
+            }
+            continue;
+        }
+        if (0 == nbyte) {
+            //  A last request need not end with a newline
+            if (!client->eof && client->in.n > 0 && !buffer_append(&client->in, "\n", 1)) {
+                client->closed = true;
+            }
+            client->eof = true;
+        } else if (EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno) {
+            client->closed = true;
+        }
+        break;
+    }
+    size_t start = 0;
+    for (size_t i = 0; i < client->in.n; i++) {
+        if ('\n' == client->in.data[i]) {
+            client->in.data[i] = '\0';
+            handle_line(state, client, client->in.data + start);
+            start = i + 1;
+        }
+    }
+    buffer_consume(&client->in, start);
+}
+
+
+static void write_client(serve_client * client) {
+    while (client->out.n > 0) {
+        const ssize_t nbyte = write(client->fd, client->out.data, client->out.n);
+        if (nbyte < 0) {
+            if (EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno) {
+                //  Client has gone, so there is no one to answer
+                client->out.n = 0;
+                client->closed = true;
+            }
+            return;
+        }
+        buffer_consume(&client->out, nbyte);
+    }
+}
+
+
+/**  Whether any request of a client is still to be answered
+ **/
+static bool client_waiting(const serve_state * state, uint64_t id) {
+    for (size_t r = 0; r < state->nrequest; r++) {
+        if (state->request[r]->client == id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/**  Remove clients that have closed and have nothing left to be sent
+ **/
+static void remove_clients(serve_state * state) {
+    size_t nkept = 0;
+    for (size_t c = 0; c < state->nclient; c++) {
+        serve_client * client = state->client + c;
+        const bool finished = client->eof && 0 == client->out.n && !client_waiting(state, client->id);
+        if (client->closed || finished) {
+            close(client->fd);
+            free(client->in.data);
+            free(client->out.data);
+            continue;
+        }
+        state->client[nkept++] = *client;
+    }
+    state->nclient = nkept;
+}
+
+
+int main_serve(int argc, char *argv[]) {
+    argp_parse(&argp, argc, argv, 0, 0, NULL);
+    if ((NULL == args.socket) == (NULL == args.port)) {
+        errx(EXIT_FAILURE, "Give one of --socket or --port to listen on");
+    }
+    if (NULL != args.model_file && !load_model_weights(args.model_file, raw_model_string(args.model_type))) {
+        errx(EXIT_FAILURE, "Failed to load model file \"%s\"", args.model_file);
+    }
+
+    const int listener = open_listener();
+    if (listener < 0) {
+        errx(EXIT_FAILURE, "Failed to open socket to listen on");
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = handle_stop;
+    sigemptyset(&action.sa_mask);
+    (void)sigaction(SIGINT, &action, NULL);
+    (void)sigaction(SIGTERM, &action, NULL);
+    //  A client closing early must not stop the server
+    action.sa_handler = SIG_IGN;
+    (void)sigaction(SIGPIPE, &action, NULL);
+
+    int nthread = 1;
+#if defined(_OPENMP)
+    nthread = omp_get_max_threads();
+#endif
+    //  Enough reads to give every thread a full batch
+    const size_t max_reads = (size_t)args.batch_size * nthread;
+
+    serve_state state = {0};
+    struct pollfd * fds = NULL;
+    while (!serve_stop) {
+        struct pollfd * newfds = realloc(fds, (state.nclient + 1) * sizeof(struct pollfd));
+        if (NULL == newfds) {
+            warnx("Failed to allocate memory for clients");
+            break;
+        }
+        fds = newfds;
+        fds[0] = (struct pollfd){listener, POLLIN, 0};
+        for (size_t c = 0; c < state.nclient; c++) {
+            const serve_client * client = state.client + c;
+            const short events = (client->eof ? 0 : POLLIN) | ((client->out.n > 0) ? POLLOUT : 0);
+            //  Clients waiting for reads to be called are not polled
+            fds[c + 1] = (struct pollfd){(0 != events) ? client->fd : -1, events, 0};
+        }
+        int timeout = SERVE_IDLE_MS;
+        if (state.nread >= max_reads) {
+            timeout = 0;
+        } else if (state.nread > 0) {
+            const double wait = state.read[0].arrival + args.max_latency - now_ms();
+            timeout = (wait > 0.0) ? (int)ceil(wait) : 0;
+        }
+        if (poll(fds, state.nclient + 1, timeout) < 0 && EINTR != errno) {
+            warn("Failed to wait for clients");
+            break;
+        }
+
+        //  Clients are handled before any are accepted, so fds still matches
+        for (size_t c = 0; c < state.nclient; c++) {
+            if (!state.client[c].eof && (fds[c + 1].revents & (POLLIN | POLLHUP | POLLERR))) {
+                read_client(&state, state.client + c);
+            }
+        }
+        if (fds[0].revents & POLLIN) {
+            accept_clients(&state, listener);
+        }
+
+        while (state.nread > 0
+               && (state.nread >= max_reads || now_ms() - state.read[0].arrival >= args.max_latency)) {
+            call_batch(&state, (state.nread < max_reads) ? state.nread : max_reads);
+        }
+        answer_requests(&state);
+        for (size_t c = 0; c < state.nclient; c++) {
+            write_client(state.client + c);
+        }
+        remove_clients(&state);
+    }
+
+    //  Reads still waiting are abandoned
+    for (size_t i = 0; i < state.nread; i++) {
+        free(state.read[i].name);
+        free(state.read[i].rt.raw);
+        free(state.read[i].rt.uuid);
+    }
+    free(state.read);
+    for (size_t r = 0; r < state.nrequest; r++) {
+        free_request(state.request[r]);
+    }
+    free(state.request);
+    for (size_t c = 0; c < state.nclient; c++) {
+        close(state.client[c].fd);
+        free(state.client[c].in.data);
+        free(state.client[c].out.data);
+    }
+    free(state.client);
+    free(fds);
+    close(listener);
+    if (NULL != args.socket) {
+        (void)unlink(args.socket);
+    }
+    unload_model_weights();
+
+    return EXIT_SUCCESS;
+}
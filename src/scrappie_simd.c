@@ -0,0 +1,1505 @@
+#include <assert.h>
+#include <err.h>
+#include <immintrin.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include "scrappie_simd.h"
+#include "util.h"
+
+#if defined(FAST_LOG) || defined(FAST_EXP) || defined(FAST_TANH) || defined(FAST_LOGISTIC) || defined(FAST_ELU)
+//  Wider kernels only implement the accurate functions
+#    define SCRAPPIE_SIMD_SSE_ONLY 1
+#endif
+
+//  Level in use.  Detected on first use, may be lowered by scrappie_simd_set
+static int simd_level = -1;
+//  Accuracy tier of elementwise kernels
+static enum scrappie_math math_tier = SCRAPPIE_MATH_ACCURATE;
+
+
+/**  Widest vector unit supported by this CPU
+ *
+ *   @returns Widest supported level
+ **/
+enum scrappie_simd scrappie_simd_supported(void) {
+#if defined(SCRAPPIE_SIMD_SSE_ONLY) || !defined(__GNUC__) || !defined(__x86_64__)
+    return SCRAPPIE_SIMD_SSE;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return SCRAPPIE_SIMD_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return SCRAPPIE_SIMD_AVX2;
+    }
+    return SCRAPPIE_SIMD_SSE;
+#endif
+}
+
+
+/**  Level of vectorisation currently used by elementwise kernels
+ *
+ *   @returns Level in use
+ **/
+enum scrappie_simd scrappie_simd_get(void) {
+    if (simd_level < 0) {
+        //  Benign race: every thread detects the same value
+        simd_level = scrappie_simd_supported();
+    }
+    return simd_level;
+}
+
+
+/**  Set level of vectorisation used by elementwise kernels
+ *
+ *   Should be called before any worker threads are started.
+ *
+ *   @param level  Requested level.  Clipped to what is supported.
+ *
+ *   @returns Level now in use
+ **/
+enum scrappie_simd scrappie_simd_set(enum scrappie_simd level) {
+    const enum scrappie_simd supported = scrappie_simd_supported();
+    if (level >= SCRAPPIE_SIMD_INVALID || level > supported) {
+        level = supported;
+    }
+    simd_level = level;
+    return level;
+}
+
+
+const char * scrappie_simd_string(enum scrappie_simd level) {
+    switch (level) {
+    case SCRAPPIE_SIMD_SSE:
+        return "sse";
+    case SCRAPPIE_SIMD_AVX2:
+        return "avx2";
+    case SCRAPPIE_SIMD_AVX512:
+        return "avx512";
+    case SCRAPPIE_SIMD_INVALID:
+        errx(EXIT_FAILURE, "Invalid vectorisation level\n");
+    default:
+        errx(EXIT_FAILURE, "Vectorisation level %d not recognised\n", level);
+    }
+}
+
+
+enum scrappie_simd scrappie_simd_from_string(const char * str) {
+    if (0 == strcmp(str, "sse")) {
+        return SCRAPPIE_SIMD_SSE;
+    }
+    if (0 == strcmp(str, "avx2")) {
+        return SCRAPPIE_SIMD_AVX2;
+    }
+    if (0 == strcmp(str, "avx512")) {
+        return SCRAPPIE_SIMD_AVX512;
+    }
+    return SCRAPPIE_SIMD_INVALID;
+}
+
+
+/**  Accuracy tier currently used by elementwise kernels
+ *
+ *   @returns Tier in use
+ **/
+enum scrappie_math scrappie_math_get(void) {
+    return math_tier;
+}
+
+
+/**  Set accuracy tier used by elementwise kernels
+ *
+ *   Should be called before any worker threads are started.
+ *
+ *   @param tier  Requested tier.  Invalid tiers leave the current one in use.
+ *
+ *   @returns Tier now in use
+ **/
+enum scrappie_math scrappie_math_set(enum scrappie_math tier) {
+    if (tier < SCRAPPIE_MATH_INVALID) {
+        math_tier = tier;
+    }
+    return math_tier;
+}
+
+
+const char * scrappie_math_string(enum scrappie_math tier) {
+    switch (tier) {
+    case SCRAPPIE_MATH_ACCURATE:
+        return "accurate";
+    case SCRAPPIE_MATH_FAST:
+        return "fast";
+    case SCRAPPIE_MATH_FASTEST:
+        return "fastest";
+    case SCRAPPIE_MATH_INVALID:
+        errx(EXIT_FAILURE, "Invalid accuracy tier\n");
+    default:
+        errx(EXIT_FAILURE, "Accuracy tier %d not recognised\n", tier);
+    }
+}
+
+
+enum scrappie_math scrappie_math_from_string(const char * str) {
+    if (0 == strcmp(str, "accurate")) {
+        return SCRAPPIE_MATH_ACCURATE;
+    }
+    if (0 == strcmp(str, "fast")) {
+        return SCRAPPIE_MATH_FAST;
+    }
+    if (0 == strcmp(str, "fastest")) {
+        return SCRAPPIE_MATH_FASTEST;
+    }
+    return SCRAPPIE_MATH_INVALID;
+}
+
+
+
+/**
+ *   SSE kernels.  Scalar tails of the wider kernels also use these.
+ **/
+static void tanhf_array_sse(float * x, size_t n) {
+    for (size_t i = 0; i < n; i += 4) {
+        _mm_storeu_ps(x + i, TANHFV(_mm_loadu_ps(x + i)));
+    }
+}
+
+static void expf_array_sse(float * x, size_t n) {
+    for (size_t i = 0; i < n; i += 4) {
+        _mm_storeu_ps(x + i, EXPFV(_mm_loadu_ps(x + i)));
+    }
+}
+
+static void logf_array_sse(float * x, size_t n) {
+    for (size_t i = 0; i < n; i += 4) {
+        _mm_storeu_ps(x + i, LOGFV(_mm_loadu_ps(x + i)));
+    }
+}
+
+static void logisticf_array_sse(float * x, size_t n) {
+    for (size_t i = 0; i < n; i += 4) {
+        _mm_storeu_ps(x + i, LOGISTICFV(_mm_loadu_ps(x + i)));
+    }
+}
+
+static void eluf_array_sse(float * x, size_t n) {
+    for (size_t i = 0; i < n; i += 4) {
+        _mm_storeu_ps(x + i, ELUFV(_mm_loadu_ps(x + i)));
+    }
+}
+
+static void gru_update_array_sse(float const * z, float const * istate, float const * hbar,
+                                 float * ostate, size_t n) {
+    const __m128 ones = _mm_set1_ps(1.0f);
+    for (size_t i = 0; i < n; i += 4) {
+        const __m128 zv = _mm_loadu_ps(z + i);
+        _mm_storeu_ps(ostate + i, zv * _mm_loadu_ps(istate + i)
+                                  + (ones - zv) * _mm_loadu_ps(hbar + i));
+    }
+}
+
+static void lstm_gates_array_sse(float const * xF, float const * peep, float * state,
+                                 float * output, size_t size) {
+    for (size_t i = 0; i < size; i += 4) {
+        const __m128 st = _mm_loadu_ps(state + i);
+        // Forget gate
+        const __m128 forget = LOGISTICFV(_mm_loadu_ps(xF + 2 * size + i)
+                                         + st * _mm_loadu_ps(peep + size + i)) * st;
+        // Update gate
+        const __m128 update = LOGISTICFV(_mm_loadu_ps(xF + size + i)
+                                         + st * _mm_loadu_ps(peep + i))
+                            * TANHFV(_mm_loadu_ps(xF + i));
+        const __m128 newst = _mm_add_ps(forget, update);
+        _mm_storeu_ps(state + i, newst);
+        // Output gate
+        _mm_storeu_ps(output + i, LOGISTICFV(_mm_loadu_ps(xF + 3 * size + i)
+                                             + newst * _mm_loadu_ps(peep + 2 * size + i))
+                                  * TANHFV(newst));
+    }
+}
+
+static void normalise_columns_sse(float * x, size_t nr, size_t stride, size_t nc) {
+    const size_t i = stride - nr;
+    const size_t nrq = stride / 4;
+    const __m128 mask = _mm_cmpgt_ps(_mm_set_ps(i >= 1, i >= 2, i >= 3, 0), _mm_set1_ps(0.0f));
+    for (size_t col = 0; col < nc; col++) {
+        __m128 * xv = (__m128 *)(x + col * stride);
+        __m128 sum = xv[0];
+        for (size_t row = 1; row < nrq; row++) {
+            sum += xv[row];
+        }
+        sum -= _mm_and_ps(xv[nrq - 1], mask);
+        const __m128 psum = _mm_hadd_ps(sum, sum);
+        const __m128 tsum = _mm_hadd_ps(psum, psum);
+
+        const __m128 tsum_recip = _mm_set1_ps(1.0f) / tsum;
+        for (size_t row = 0; row < nrq; row++) {
+            xv[row] *= tsum_recip;
+        }
+    }
+}
+
+/**
+ *   Cheaper tiers of the elementwise kernels, see enum scrappie_math.  Each
+ *   width defines exp, log and a reciprocal for a tier, from which the
+ *   activations and the kernels using them are generated.
+ **/
+static inline __m128 exp_fast_sse(__m128 x) {
+    x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-87.0f)), _mm_set1_ps(88.0f));
+    //  exp(x) = 2^n exp(r) with |r| <= log(2) / 2
+    const __m128i n = _mm_cvtps_epi32(x * _mm_set1_ps(1.44269504088896341f));
+    const __m128 r = x - _mm_cvtepi32_ps(n) * _mm_set1_ps(0.693147180559945309f);
+    __m128 y = _mm_set1_ps(1.0f / 24.0f);
+    y = y * r + _mm_set1_ps(1.0f / 6.0f);
+    y = y * r + _mm_set1_ps(0.5f);
+    y = y * r + _mm_setone_ps();
+    y = y * r + _mm_setone_ps();
+    return y * _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(0x7f)), 23));
+}
+
+static inline __m128 log_fast_sse(__m128 x) {
+    return logfv(x);
+}
+
+//  One Newton step doubles the twelve bits of the estimate
+static inline __m128 recip_fast_sse(__m128 x) {
+    const __m128 r = _mm_rcp_ps(x);
+    return r * (_mm_set1_ps(2.0f) - x * r);
+}
+
+static inline __m128 exp_fastest_sse(__m128 x) {
+    return fast_expfv(x);
+}
+
+static inline __m128 log_fastest_sse(__m128 x) {
+    return fast_logfv(x);
+}
+
+static inline __m128 recip_fastest_sse(__m128 x) {
+    return _mm_rcp_ps(x);
+}
+
+//  Step of LSTM gates for elements i to i + width of vector
+#define LSTM_GATES_STEP(VEC, LOAD, STORE, LOGISTIC, TANH) \
+    { \
+        const VEC st = LOAD(state + i); \
+        const VEC forget = LOGISTIC(LOAD(xF + 2 * size + i) + st * LOAD(peep + size + i)) * st; \
+        const VEC update = LOGISTIC(LOAD(xF + size + i) + st * LOAD(peep + i)) * TANH(LOAD(xF + i)); \
+        const VEC newst = forget + update; \
+        STORE(state + i, newst); \
+        STORE(output + i, LOGISTIC(LOAD(xF + 3 * size + i) + newst * LOAD(peep + 2 * size + i)) \
+                          * TANH(newst)); \
+    }
+
+#define DEFINE_ARRAY_KERNEL_SSE(NAME, F) \
+static void NAME ## _sse(float * x, size_t n) { \
+    for (size_t i = 0; i < n; i += 4) { \
+        _mm_storeu_ps(x + i, F(_mm_loadu_ps(x + i))); \
+    } \
+}
+
+#define DEFINE_MATH_TIER_SSE(T) \
+static inline __m128 logistic_ ## T ## _sse(__m128 x) { \
+    return recip_ ## T ## _sse(_mm_setone_ps() + exp_ ## T ## _sse(-x)); \
+} \
+static inline __m128 tanh_ ## T ## _sse(__m128 x) { \
+    const __m128 y = logistic_ ## T ## _sse(x + x); \
+    return y + y - _mm_setone_ps(); \
+} \
+static inline __m128 elu_ ## T ## _sse(__m128 x) { \
+    if (0 == _mm_movemask_ps(x)) { \
+        return x; \
+    } \
+    const __m128 mask = _mm_cmpge_ps(x, _mm_setzero_ps()); \
+    const __m128 y = exp_ ## T ## _sse(x) - _mm_setone_ps(); \
+    return _mm_or_ps(_mm_and_ps(mask, x), _mm_andnot_ps(mask, y)); \
+} \
+DEFINE_ARRAY_KERNEL_SSE(tanhf_array_ ## T, tanh_ ## T ## _sse) \
+DEFINE_ARRAY_KERNEL_SSE(expf_array_ ## T, exp_ ## T ## _sse) \
+DEFINE_ARRAY_KERNEL_SSE(logf_array_ ## T, log_ ## T ## _sse) \
+DEFINE_ARRAY_KERNEL_SSE(logisticf_array_ ## T, logistic_ ## T ## _sse) \
+DEFINE_ARRAY_KERNEL_SSE(eluf_array_ ## T, elu_ ## T ## _sse) \
+static void lstm_gates_array_ ## T ## _sse(float const * xF, float const * peep, float * state, \
+                                          float * output, size_t size) { \
+    for (size_t i = 0; i < size; i += 4) { \
+        LSTM_GATES_STEP(__m128, _mm_loadu_ps, _mm_storeu_ps, logistic_ ## T ## _sse, tanh_ ## T ## _sse) \
+    } \
+}
+
+DEFINE_MATH_TIER_SSE(fast)
+DEFINE_MATH_TIER_SSE(fastest)
+
+/*  Rows of the initial values of each column that can be read  */
+static inline size_t panel_init_len(size_t npanel, size_t ldinit, size_t ldc) {
+    return (0 == ldinit) ? npanel * SCRAPPIE_PANEL_WIDTH : ldc;
+}
+
+static void panel_affine_sse(float const * panels, size_t npanel, size_t nk, float const * x,
+                             size_t ldx, float const * init, size_t ldinit, float * c, size_t ldc,
+                             size_t ncol) {
+    const size_t init_len = panel_init_len(npanel, ldinit, ldc);
+    for (size_t j = 0; j < ncol; j += 2) {
+        const size_t nj = (j + 1 < ncol) ? 2 : 1;
+        float const * x0 = x + j * ldx;
+        float const * x1 = x0 + (nj - 1) * ldx;
+        for (size_t p = 0; p < npanel; p++) {
+            const size_t r0 = p * SCRAPPIE_PANEL_WIDTH;
+            const size_t nvinit = (init_len - r0 < SCRAPPIE_PANEL_WIDTH) ? (init_len - r0) / 4 : 4;
+            const size_t nvout = (ldc - r0 < SCRAPPIE_PANEL_WIDTH) ? (ldc - r0) / 4 : 4;
+            __m128 acc0[4], acc1[4];
+            for (size_t v = 0; v < 4; v++) {
+                acc0[v] = (v < nvinit) ? _mm_loadu_ps(init + j * ldinit + r0 + 4 * v) : _mm_setzero_ps();
+                acc1[v] = (v < nvinit) ? _mm_loadu_ps(init + (j + nj - 1) * ldinit + r0 + 4 * v)
+                                       : _mm_setzero_ps();
+            }
+            float const * pk = panels + r0 * nk;
+            for (size_t k = 0; k < nk; k++, pk += SCRAPPIE_PANEL_WIDTH) {
+                const __m128 xk0 = _mm_set1_ps(x0[k]);
+                const __m128 xk1 = _mm_set1_ps(x1[k]);
+                for (size_t v = 0; v < 4; v++) {
+                    const __m128 w = _mm_load_ps(pk + 4 * v);
+                    acc0[v] += w * xk0;
+                    acc1[v] += w * xk1;
+                }
+            }
+            for (size_t v = 0; v < nvout; v++) {
+                _mm_storeu_ps(c + j * ldc + r0 + 4 * v, acc0[v]);
+                if (nj > 1) {
+                    _mm_storeu_ps(c + (j + 1) * ldc + r0 + 4 * v, acc1[v]);
+                }
+            }
+        }
+    }
+}
+
+
+
+static void panel_affine_int8_sse(int8_t const * panels, float const * wscale, size_t npanel,
+                                  size_t nk, int32_t const * xq, size_t ldxq, float const * xscale,
+                                  float const * init, size_t ldinit, float * c, size_t ldc,
+                                  size_t ncol) {
+    const size_t init_len = panel_init_len(npanel, ldinit, ldc);
+    const size_t nkpair = (nk + 1) / 2;
+    for (size_t j = 0; j < ncol; j++) {
+        int16_t const * xj = (int16_t const *)(xq + j * ldxq);
+        for (size_t p = 0; p < npanel; p++) {
+            const size_t r0 = p * SCRAPPIE_PANEL_WIDTH;
+            int8_t const * pk = panels + 2 * r0 * nkpair;
+            for (size_t o = 0; o < SCRAPPIE_PANEL_WIDTH && r0 + o < ldc; o++) {
+                int32_t acc = 0;
+                for (size_t q = 0; q < nkpair; q++) {
+                    acc += pk[2 * (q * SCRAPPIE_PANEL_WIDTH + o)] * xj[2 * q]
+                         + pk[2 * (q * SCRAPPIE_PANEL_WIDTH + o) + 1] * xj[2 * q + 1];
+                }
+                const float c0 = (r0 + o < init_len) ? init[j * ldinit + r0 + o] : 0.0f;
+                c[j * ldc + r0 + o] = c0 + acc * wscale[r0 + o] * xscale[j];
+            }
+        }
+    }
+}
+
+
+static void block_sparse_affine_sse(float const * blocks, uint32_t const * block_input,
+                                    uint32_t const * row_start, size_t nrow_block,
+                                    float const * x, float * y) {
+    for (size_t ob = 0; ob < nrow_block; ob++) {
+        __m128 acc = _mm_loadu_ps(y + 4 * ob);
+        for (uint32_t b = row_start[ob]; b < row_start[ob + 1]; b++) {
+            float const * w = blocks + 16 * b;
+            float const * xb = x + 4 * block_input[b];
+            acc += _mm_load_ps(w) * _mm_set1_ps(xb[0]) + _mm_load_ps(w + 4) * _mm_set1_ps(xb[1])
+                 + _mm_load_ps(w + 8) * _mm_set1_ps(xb[2]) + _mm_load_ps(w + 12) * _mm_set1_ps(xb[3]);
+        }
+        _mm_storeu_ps(y + 4 * ob, acc);
+    }
+}
+
+
+#ifndef SCRAPPIE_SIMD_SSE_ONLY
+/**
+ *   AVX2 kernels.  Exp and log are the eight wide transcriptions of the Cephes
+ *   based routines in sse_mathfun.h
+ **/
+#    define AVX2_TARGET __attribute__((target("avx2,fma")))
+
+static inline AVX2_TARGET __m256 exp_avx2(__m256 x) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+    x = _mm256_min_ps(x, _mm256_set1_ps(88.3762626647949f));
+    x = _mm256_max_ps(x, _mm256_set1_ps(-88.3762626647949f));
+
+    /* express exp(x) as exp(g + n*log(2)) */
+    __m256 fx = x * _mm256_set1_ps(1.44269504088896341f) + _mm256_set1_ps(0.5f);
+    fx = _mm256_floor_ps(fx);
+    x = x - fx * _mm256_set1_ps(0.693359375f) - fx * _mm256_set1_ps(-2.12194440e-4f);
+
+    const __m256 z = x * x;
+    __m256 y = _mm256_set1_ps(1.9875691500E-4f);
+    y = y * x + _mm256_set1_ps(1.3981999507E-3f);
+    y = y * x + _mm256_set1_ps(8.3334519073E-3f);
+    y = y * x + _mm256_set1_ps(4.1665795894E-2f);
+    y = y * x + _mm256_set1_ps(1.6666665459E-1f);
+    y = y * x + _mm256_set1_ps(5.0000001201E-1f);
+    y = y * z + x + one;
+
+    /* build 2^n */
+    __m256i emm0 = _mm256_cvttps_epi32(fx);
+    emm0 = _mm256_add_epi32(emm0, _mm256_set1_epi32(0x7f));
+    emm0 = _mm256_slli_epi32(emm0, 23);
+    return y * _mm256_castsi256_ps(emm0);
+}
+
+static inline AVX2_TARGET __m256 log_avx2(__m256 x) {
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 invalid_mask = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LE_OQ);
+
+    /* cut off denormalized stuff */
+    x = _mm256_max_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(0x00800000)));
+    __m256i emm0 = _mm256_srli_epi32(_mm256_castps_si256(x), 23);
+
+    /* keep only the fractional part */
+    x = _mm256_and_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(~0x7f800000)));
+    x = _mm256_or_ps(x, _mm256_set1_ps(0.5f));
+
+    emm0 = _mm256_sub_epi32(emm0, _mm256_set1_epi32(0x7f));
+    __m256 e = _mm256_cvtepi32_ps(emm0) + one;
+
+    const __m256 mask = _mm256_cmp_ps(x, _mm256_set1_ps(0.707106781186547524f), _CMP_LT_OQ);
+    const __m256 tmp = _mm256_and_ps(x, mask);
+    x = x - one;
+    e = e - _mm256_and_ps(one, mask);
+    x = x + tmp;
+
+    const __m256 z = x * x;
+    __m256 y = _mm256_set1_ps(7.0376836292E-2f);
+    y = y * x + _mm256_set1_ps(-1.1514610310E-1f);
+    y = y * x + _mm256_set1_ps(1.1676998740E-1f);
+    y = y * x + _mm256_set1_ps(-1.2420140846E-1f);
+    y = y * x + _mm256_set1_ps(1.4249322787E-1f);
+    y = y * x + _mm256_set1_ps(-1.6668057665E-1f);
+    y = y * x + _mm256_set1_ps(2.0000714765E-1f);
+    y = y * x + _mm256_set1_ps(-2.4999993993E-1f);
+    y = y * x + _mm256_set1_ps(3.3333331174E-1f);
+    y = y * x * z;
+
+    y = y + e * _mm256_set1_ps(-2.12194440e-4f);
+    y = y - z * _mm256_set1_ps(0.5f);
+    x = x + y + e * _mm256_set1_ps(0.693359375f);
+    // negative arg will be NAN
+    return _mm256_or_ps(x, invalid_mask);
+}
+
+static inline AVX2_TARGET __m256 logistic_avx2(__m256 x) {
+    const __m256 ones = _mm256_set1_ps(1.0f);
+    return ones / (ones + exp_avx2(-x));
+}
+
+static inline AVX2_TARGET __m256 tanh_avx2(__m256 x) {
+    const __m256 y = logistic_avx2(x + x);
+    return y + y - _mm256_set1_ps(1.0f);
+}
+
+static inline AVX2_TARGET __m256 elu_avx2(__m256 x) {
+    if (0 == _mm256_movemask_ps(x)) {
+        // All positive, early return.
+        return x;
+    }
+    const __m256 mask = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GE_OQ);
+    return _mm256_blendv_ps(exp_avx2(x) - _mm256_set1_ps(1.0f), x, mask);
+}
+
+static AVX2_TARGET void tanhf_array_avx2(float * x, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(x + i, tanh_avx2(_mm256_loadu_ps(x + i)));
+    }
+    tanhf_array_sse(x + i, n - i);
+}
+
+static AVX2_TARGET void expf_array_avx2(float * x, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(x + i, exp_avx2(_mm256_loadu_ps(x + i)));
+    }
+    expf_array_sse(x + i, n - i);
+}
+
+static AVX2_TARGET void logf_array_avx2(float * x, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(x + i, log_avx2(_mm256_loadu_ps(x + i)));
+    }
+    logf_array_sse(x + i, n - i);
+}
+
+static AVX2_TARGET void logisticf_array_avx2(float * x, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(x + i, logistic_avx2(_mm256_loadu_ps(x + i)));
+    }
+    logisticf_array_sse(x + i, n - i);
+}
+
+static AVX2_TARGET void eluf_array_avx2(float * x, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(x + i, elu_avx2(_mm256_loadu_ps(x + i)));
+    }
+    eluf_array_sse(x + i, n - i);
+}
+
+static AVX2_TARGET void gru_update_array_avx2(float const * z, float const * istate,
+                                              float const * hbar, float * ostate, size_t n) {
+    const __m256 ones = _mm256_set1_ps(1.0f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m256 zv = _mm256_loadu_ps(z + i);
+        _mm256_storeu_ps(ostate + i, zv * _mm256_loadu_ps(istate + i)
+                                     + (ones - zv) * _mm256_loadu_ps(hbar + i));
+    }
+    gru_update_array_sse(z + i, istate + i, hbar + i, ostate + i, n - i);
+}
+
+static AVX2_TARGET void lstm_gates_array_avx2(float const * xF, float const * peep,
+                                              float * state, float * output, size_t size) {
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        const __m256 st = _mm256_loadu_ps(state + i);
+        const __m256 forget = logistic_avx2(_mm256_loadu_ps(xF + 2 * size + i)
+                                            + st * _mm256_loadu_ps(peep + size + i)) * st;
+        const __m256 update = logistic_avx2(_mm256_loadu_ps(xF + size + i)
+                                            + st * _mm256_loadu_ps(peep + i))
+                            * tanh_avx2(_mm256_loadu_ps(xF + i));
+        const __m256 newst = forget + update;
+        _mm256_storeu_ps(state + i, newst);
+        _mm256_storeu_ps(output + i, logistic_avx2(_mm256_loadu_ps(xF + 3 * size + i)
+                                                   + newst * _mm256_loadu_ps(peep + 2 * size + i))
+                                     * tanh_avx2(newst));
+    }
+    for (; i < size; i += 4) {
+        //  Tail.  Gates are strided by size so cannot defer to SSE kernel
+        const __m128 st = _mm_loadu_ps(state + i);
+        const __m128 forget = logisticfv(_mm_loadu_ps(xF + 2 * size + i)
+                                         + st * _mm_loadu_ps(peep + size + i)) * st;
+        const __m128 update = logisticfv(_mm_loadu_ps(xF + size + i)
+                                         + st * _mm_loadu_ps(peep + i))
+                            * tanhfv(_mm_loadu_ps(xF + i));
+        const __m128 newst = forget + update;
+        _mm_storeu_ps(state + i, newst);
+        _mm_storeu_ps(output + i, logisticfv(_mm_loadu_ps(xF + 3 * size + i)
+                                             + newst * _mm_loadu_ps(peep + 2 * size + i))
+                                  * tanhfv(newst));
+    }
+}
+
+static AVX2_TARGET void normalise_columns_avx2(float * x, size_t nr, size_t stride, size_t nc) {
+    for (size_t col = 0; col < nc; col++) {
+        float * xc = x + col * stride;
+        __m256 sumv = _mm256_setzero_ps();
+        size_t r = 0;
+        for (; r + 8 <= nr; r += 8) {
+            sumv += _mm256_loadu_ps(xc + r);
+        }
+        const __m128 s4 = _mm256_castps256_ps128(sumv) + _mm256_extractf128_ps(sumv, 1);
+        float sum = s4[0] + s4[1] + s4[2] + s4[3];
+        for (; r < nr; r++) {
+            sum += xc[r];
+        }
+
+        const __m256 recip = _mm256_set1_ps(1.0f / sum);
+        r = 0;
+        for (; r + 8 <= stride; r += 8) {
+            _mm256_storeu_ps(xc + r, _mm256_loadu_ps(xc + r) * recip);
+        }
+        for (; r < stride; r++) {
+            xc[r] /= sum;
+        }
+    }
+}
+
+static inline AVX2_TARGET __m256 exp_fast_avx2(__m256 x) {
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.0f)), _mm256_set1_ps(88.0f));
+    const __m256i n = _mm256_cvtps_epi32(x * _mm256_set1_ps(1.44269504088896341f));
+    const __m256 r = x - _mm256_cvtepi32_ps(n) * _mm256_set1_ps(0.693147180559945309f);
+    __m256 y = _mm256_set1_ps(1.0f / 24.0f);
+    y = y * r + _mm256_set1_ps(1.0f / 6.0f);
+    y = y * r + _mm256_set1_ps(0.5f);
+    y = y * r + _mm256_set1_ps(1.0f);
+    y = y * r + _mm256_set1_ps(1.0f);
+    return y * _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_add_epi32(n, _mm256_set1_epi32(0x7f)), 23));
+}
+
+static inline AVX2_TARGET __m256 log_fast_avx2(__m256 x) {
+    return log_avx2(x);
+}
+
+static inline AVX2_TARGET __m256 recip_fast_avx2(__m256 x) {
+    const __m256 r = _mm256_rcp_ps(x);
+    return r * (_mm256_set1_ps(2.0f) - x * r);
+}
+
+static inline AVX2_TARGET __m256 exp_fastest_avx2(__m256 x) {
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-_BOUND)), _mm256_set1_ps(_BOUND));
+    return _mm256_castsi256_ps(_mm256_cvtps_epi32(_mm256_set1_ps(_A) * x + _mm256_set1_ps(_B)));
+}
+
+static inline AVX2_TARGET __m256 log_fastest_avx2(__m256 x) {
+    return _mm256_set1_ps(_Alogfv) * (_mm256_cvtepi32_ps(_mm256_castps_si256(x)) - _mm256_set1_ps(_Blogfv));
+}
+
+static inline AVX2_TARGET __m256 recip_fastest_avx2(__m256 x) {
+    return _mm256_rcp_ps(x);
+}
+
+#    define DEFINE_ARRAY_KERNEL_WIDE(NAME, W, NARROW, TARGET, STEP, LOAD, STORE, F) \
+static TARGET void NAME ## _ ## W(float * x, size_t n) { \
+    size_t i = 0; \
+    for (; i + STEP <= n; i += STEP) { \
+        STORE(x + i, F(LOAD(x + i))); \
+    } \
+    NAME ## _ ## NARROW(x + i, n - i); \
+}
+
+#    define DEFINE_MATH_TIER_AVX2(T) \
+static inline AVX2_TARGET __m256 logistic_ ## T ## _avx2(__m256 x) { \
+    return recip_ ## T ## _avx2(_mm256_set1_ps(1.0f) + exp_ ## T ## _avx2(-x)); \
+} \
+static inline AVX2_TARGET __m256 tanh_ ## T ## _avx2(__m256 x) { \
+    const __m256 y = logistic_ ## T ## _avx2(x + x); \
+    return y + y - _mm256_set1_ps(1.0f); \
+} \
+static inline AVX2_TARGET __m256 elu_ ## T ## _avx2(__m256 x) { \
+    if (0 == _mm256_movemask_ps(x)) { \
+        return x; \
+    } \
+    const __m256 mask = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_GE_OQ); \
+    return _mm256_blendv_ps(exp_ ## T ## _avx2(x) - _mm256_set1_ps(1.0f), x, mask); \
+} \
+DEFINE_ARRAY_KERNEL_WIDE(tanhf_array_ ## T, avx2, sse, AVX2_TARGET, 8, _mm256_loadu_ps, \
+                         _mm256_storeu_ps, tanh_ ## T ## _avx2) \
+DEFINE_ARRAY_KERNEL_WIDE(expf_array_ ## T, avx2, sse, AVX2_TARGET, 8, _mm256_loadu_ps, \
+                         _mm256_storeu_ps, exp_ ## T ## _avx2) \
+DEFINE_ARRAY_KERNEL_WIDE(logf_array_ ## T, avx2, sse, AVX2_TARGET, 8, _mm256_loadu_ps, \
+                         _mm256_storeu_ps, log_ ## T ## _avx2) \
+DEFINE_ARRAY_KERNEL_WIDE(logisticf_array_ ## T, avx2, sse, AVX2_TARGET, 8, _mm256_loadu_ps, \
+                         _mm256_storeu_ps, logistic_ ## T ## _avx2) \
+DEFINE_ARRAY_KERNEL_WIDE(eluf_array_ ## T, avx2, sse, AVX2_TARGET, 8, _mm256_loadu_ps, \
+                         _mm256_storeu_ps, elu_ ## T ## _avx2) \
+static AVX2_TARGET void lstm_gates_array_ ## T ## _avx2(float const * xF, float const * peep, \
+                                                       float * state, float * output, size_t size) { \
+    size_t i = 0; \
+    for (; i + 8 <= size; i += 8) { \
+        LSTM_GATES_STEP(__m256, _mm256_loadu_ps, _mm256_storeu_ps, logistic_ ## T ## _avx2, \
+                        tanh_ ## T ## _avx2) \
+    } \
+    for (; i < size; i += 4) { \
+        LSTM_GATES_STEP(__m128, _mm_loadu_ps, _mm_storeu_ps, logistic_ ## T ## _sse, tanh_ ## T ## _sse) \
+    } \
+}
+
+DEFINE_MATH_TIER_AVX2(fast)
+DEFINE_MATH_TIER_AVX2(fastest)
+
+//  Mask of first n lanes, n may be negative or more than eight
+static inline AVX2_TARGET __m256i lane_mask_avx2(ptrdiff_t n) {
+    return _mm256_cmpgt_epi32(_mm256_set1_epi32((int)n), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+}
+
+//  Four columns at a time against each panel of sixteen outputs
+static AVX2_TARGET void panel_affine_avx2(float const * panels, size_t npanel, size_t nk,
+                                          float const * x, size_t ldx, float const * init,
+                                          size_t ldinit, float * c, size_t ldc, size_t ncol) {
+    const size_t init_len = panel_init_len(npanel, ldinit, ldc);
+    for (size_t j = 0; j < ncol; j += 4) {
+        const size_t nj = (j + 4 <= ncol) ? 4 : ncol - j;
+        //  Missing columns repeat the last one and are not stored
+        float const * xj[4];
+        float const * initj[4];
+        for (size_t jj = 0; jj < 4; jj++) {
+            const size_t col = j + ((jj < nj) ? jj : nj - 1);
+            xj[jj] = x + col * ldx;
+            initj[jj] = init + col * ldinit;
+        }
+        for (size_t p = 0; p < npanel; p++) {
+            const size_t r0 = p * SCRAPPIE_PANEL_WIDTH;
+            __m256 acc[4][2];
+            if (r0 + SCRAPPIE_PANEL_WIDTH <= init_len) {
+                for (size_t jj = 0; jj < 4; jj++) {
+                    acc[jj][0] = _mm256_loadu_ps(initj[jj] + r0);
+                    acc[jj][1] = _mm256_loadu_ps(initj[jj] + r0 + 8);
+                }
+            } else {
+                const __m256i m0 = lane_mask_avx2((ptrdiff_t)init_len - (ptrdiff_t)r0);
+                const __m256i m1 = lane_mask_avx2((ptrdiff_t)init_len - (ptrdiff_t)r0 - 8);
+                for (size_t jj = 0; jj < 4; jj++) {
+                    acc[jj][0] = _mm256_maskload_ps(initj[jj] + r0, m0);
+                    acc[jj][1] = _mm256_maskload_ps(initj[jj] + r0 + 8, m1);
+                }
+            }
+            float const * pk = panels + r0 * nk;
+            for (size_t k = 0; k < nk; k++, pk += SCRAPPIE_PANEL_WIDTH) {
+                const __m256 w0 = _mm256_load_ps(pk);
+                const __m256 w1 = _mm256_load_ps(pk + 8);
+                for (size_t jj = 0; jj < 4; jj++) {
+                    const __m256 xk = _mm256_broadcast_ss(xj[jj] + k);
+                    acc[jj][0] = _mm256_fmadd_ps(w0, xk, acc[jj][0]);
+                    acc[jj][1] = _mm256_fmadd_ps(w1, xk, acc[jj][1]);
+                }
+            }
+            if (r0 + SCRAPPIE_PANEL_WIDTH <= ldc) {
+                for (size_t jj = 0; jj < nj; jj++) {
+                    _mm256_storeu_ps(c + (j + jj) * ldc + r0, acc[jj][0]);
+                    _mm256_storeu_ps(c + (j + jj) * ldc + r0 + 8, acc[jj][1]);
+                }
+            } else {
+                const __m256i m0 = lane_mask_avx2((ptrdiff_t)ldc - (ptrdiff_t)r0);
+                const __m256i m1 = lane_mask_avx2((ptrdiff_t)ldc - (ptrdiff_t)r0 - 8);
+                for (size_t jj = 0; jj < nj; jj++) {
+                    _mm256_maskstore_ps(c + (j + jj) * ldc + r0, m0, acc[jj][0]);
+                    _mm256_maskstore_ps(c + (j + jj) * ldc + r0 + 8, m1, acc[jj][1]);
+                }
+            }
+        }
+    }
+}
+
+
+
+//  Four columns at a time against each panel of sixteen int8 outputs
+static AVX2_TARGET void panel_affine_int8_avx2(int8_t const * panels, float const * wscale,
+                                               size_t npanel, size_t nk, int32_t const * xq,
+                                               size_t ldxq, float const * xscale,
+                                               float const * init, size_t ldinit, float * c,
+                                               size_t ldc, size_t ncol) {
+    const size_t init_len = panel_init_len(npanel, ldinit, ldc);
+    const size_t nkpair = (nk + 1) / 2;
+    for (size_t j = 0; j < ncol; j += 4) {
+        const size_t nj = (j + 4 <= ncol) ? 4 : ncol - j;
+        //  Missing columns repeat the last one and are not stored
+        int32_t const * xj[4];
+        float const * initj[4];
+        float xsj[4];
+        for (size_t jj = 0; jj < 4; jj++) {
+            const size_t col = j + ((jj < nj) ? jj : nj - 1);
+            xj[jj] = xq + col * ldxq;
+            initj[jj] = init + col * ldinit;
+            xsj[jj] = xscale[col];
+        }
+        for (size_t p = 0; p < npanel; p++) {
+            const size_t r0 = p * SCRAPPIE_PANEL_WIDTH;
+            __m256i acc[4][2];
+            for (size_t jj = 0; jj < 4; jj++) {
+                acc[jj][0] = acc[jj][1] = _mm256_setzero_si256();
+            }
+            int8_t const * pk = panels + 2 * r0 * nkpair;
+            for (size_t q = 0; q < nkpair; q++, pk += 2 * SCRAPPIE_PANEL_WIDTH) {
+                const __m256i wq = _mm256_load_si256((__m256i const *)pk);
+                const __m256i w0 = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(wq));
+                const __m256i w1 = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(wq, 1));
+                for (size_t jj = 0; jj < 4; jj++) {
+                    const __m256i xk = _mm256_set1_epi32(xj[jj][q]);
+                    acc[jj][0] = _mm256_add_epi32(acc[jj][0], _mm256_madd_epi16(w0, xk));
+                    acc[jj][1] = _mm256_add_epi32(acc[jj][1], _mm256_madd_epi16(w1, xk));
+                }
+            }
+            const __m256i mi0 = lane_mask_avx2((ptrdiff_t)init_len - (ptrdiff_t)r0);
+            const __m256i mi1 = lane_mask_avx2((ptrdiff_t)init_len - (ptrdiff_t)r0 - 8);
+            const __m256i mo0 = lane_mask_avx2((ptrdiff_t)ldc - (ptrdiff_t)r0);
+            const __m256i mo1 = lane_mask_avx2((ptrdiff_t)ldc - (ptrdiff_t)r0 - 8);
+            const __m256 ws0 = _mm256_maskload_ps(wscale + r0, mo0);
+            const __m256 ws1 = _mm256_maskload_ps(wscale + r0 + 8, mo1);
+            for (size_t jj = 0; jj < nj; jj++) {
+                const __m256 xs = _mm256_set1_ps(xsj[jj]);
+                const __m256 c0 = _mm256_fmadd_ps(_mm256_cvtepi32_ps(acc[jj][0]), ws0 * xs,
+                                                  _mm256_maskload_ps(initj[jj] + r0, mi0));
+                const __m256 c1 = _mm256_fmadd_ps(_mm256_cvtepi32_ps(acc[jj][1]), ws1 * xs,
+                                                  _mm256_maskload_ps(initj[jj] + r0 + 8, mi1));
+                _mm256_maskstore_ps(c + (j + jj) * ldc + r0, mo0, c0);
+                _mm256_maskstore_ps(c + (j + jj) * ldc + r0 + 8, mo1, c1);
+            }
+        }
+    }
+}
+
+
+//  Each block as two halves of a pair of inputs, summed once the row is done
+static AVX2_TARGET void block_sparse_affine_avx2(float const * blocks, uint32_t const * block_input,
+                                                 uint32_t const * row_start, size_t nrow_block,
+                                                 float const * x, float * y) {
+    const __m256i lo = _mm256_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1);
+    const __m256i hi = _mm256_setr_epi32(2, 2, 2, 2, 3, 3, 3, 3);
+    for (size_t ob = 0; ob < nrow_block; ob++) {
+        __m256 acc0 = _mm256_setzero_ps();
+        __m256 acc1 = _mm256_setzero_ps();
+        for (uint32_t b = row_start[ob]; b < row_start[ob + 1]; b++) {
+            float const * w = blocks + 16 * b;
+            const __m256 xb = _mm256_broadcast_ps((__m128 const *)(x + 4 * block_input[b]));
+            acc0 = _mm256_fmadd_ps(_mm256_load_ps(w), _mm256_permutevar8x32_ps(xb, lo), acc0);
+            acc1 = _mm256_fmadd_ps(_mm256_load_ps(w + 8), _mm256_permutevar8x32_ps(xb, hi), acc1);
+        }
+        const __m256 acc = acc0 + acc1;
+        _mm_storeu_ps(y + 4 * ob, _mm_loadu_ps(y + 4 * ob) + _mm256_castps256_ps128(acc)
+                                  + _mm256_extractf128_ps(acc, 1));
+    }
+}
+
+
+/**
+ *   AVX-512 kernels.  Transcriptions of AVX2 kernels using mask registers.
+ **/
+#    define AVX512_TARGET __attribute__((target("avx512f")))
+
+static inline AVX512_TARGET __m512 exp_avx512(__m512 x) {
+    const __m512 one = _mm512_set1_ps(1.0f);
+    x = _mm512_min_ps(x, _mm512_set1_ps(88.3762626647949f));
+    x = _mm512_max_ps(x, _mm512_set1_ps(-88.3762626647949f));
+
+    __m512 fx = x * _mm512_set1_ps(1.44269504088896341f) + _mm512_set1_ps(0.5f);
+    fx = _mm512_roundscale_ps(fx, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+    x = x - fx * _mm512_set1_ps(0.693359375f) - fx * _mm512_set1_ps(-2.12194440e-4f);
+
+    const __m512 z = x * x;
+    __m512 y = _mm512_set1_ps(1.9875691500E-4f);
+    y = y * x + _mm512_set1_ps(1.3981999507E-3f);
+    y = y * x + _mm512_set1_ps(8.3334519073E-3f);
+    y = y * x + _mm512_set1_ps(4.1665795894E-2f);
+    y = y * x + _mm512_set1_ps(1.6666665459E-1f);
+    y = y * x + _mm512_set1_ps(5.0000001201E-1f);
+    y = y * z + x + one;
+
+    __m512i emm0 = _mm512_cvttps_epi32(fx);
+    emm0 = _mm512_add_epi32(emm0, _mm512_set1_epi32(0x7f));
+    emm0 = _mm512_slli_epi32(emm0, 23);
+    return y * _mm512_castsi512_ps(emm0);
+}
+
+static inline AVX512_TARGET __m512 log_avx512(__m512 x) {
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __mmask16 invalid_mask = _mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_LE_OQ);
+
+    x = _mm512_max_ps(x, _mm512_castsi512_ps(_mm512_set1_epi32(0x00800000)));
+    __m512i xi = _mm512_castps_si512(x);
+    __m512i emm0 = _mm512_srli_epi32(xi, 23);
+
+    xi = _mm512_and_si512(xi, _mm512_set1_epi32(~0x7f800000));
+    xi = _mm512_or_si512(xi, _mm512_castps_si512(_mm512_set1_ps(0.5f)));
+    x = _mm512_castsi512_ps(xi);
+
+    emm0 = _mm512_sub_epi32(emm0, _mm512_set1_epi32(0x7f));
+    __m512 e = _mm512_cvtepi32_ps(emm0) + one;
+
+    const __mmask16 mask = _mm512_cmp_ps_mask(x, _mm512_set1_ps(0.707106781186547524f), _CMP_LT_OQ);
+    const __m512 tmp = _mm512_maskz_mov_ps(mask, x);
+    x = x - one;
+    e = _mm512_mask_sub_ps(e, mask, e, one);
+    x = x + tmp;
+
+    const __m512 z = x * x;
+    __m512 y = _mm512_set1_ps(7.0376836292E-2f);
+    y = y * x + _mm512_set1_ps(-1.1514610310E-1f);
+    y = y * x + _mm512_set1_ps(1.1676998740E-1f);
+    y = y * x + _mm512_set1_ps(-1.2420140846E-1f);
+    y = y * x + _mm512_set1_ps(1.4249322787E-1f);
+    y = y * x + _mm512_set1_ps(-1.6668057665E-1f);
+    y = y * x + _mm512_set1_ps(2.0000714765E-1f);
+    y = y * x + _mm512_set1_ps(-2.4999993993E-1f);
+    y = y * x + _mm512_set1_ps(3.3333331174E-1f);
+    y = y * x * z;
+
+    y = y + e * _mm512_set1_ps(-2.12194440e-4f);
+    y = y - z * _mm512_set1_ps(0.5f);
+    x = x + y + e * _mm512_set1_ps(0.693359375f);
+    // negative arg will be NAN
+    return _mm512_mask_mov_ps(x, invalid_mask, _mm512_set1_ps(NAN));
+}
+
+static inline AVX512_TARGET __m512 logistic_avx512(__m512 x) {
+    const __m512 ones = _mm512_set1_ps(1.0f);
+    return ones / (ones + exp_avx512(-x));
+}
+
+static inline AVX512_TARGET __m512 tanh_avx512(__m512 x) {
+    const __m512 y = logistic_avx512(x + x);
+    return y + y - _mm512_set1_ps(1.0f);
+}
+
+static inline AVX512_TARGET __m512 elu_avx512(__m512 x) {
+    const __mmask16 neg = _mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_LT_OQ);
+    if (0 == neg) {
+        // All positive, early return.
+        return x;
+    }
+    return _mm512_mask_mov_ps(x, neg, exp_avx512(x) - _mm512_set1_ps(1.0f));
+}
+
+static AVX512_TARGET void tanhf_array_avx512(float * x, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(x + i, tanh_avx512(_mm512_loadu_ps(x + i)));
+    }
+    tanhf_array_avx2(x + i, n - i);
+}
+
+static AVX512_TARGET void expf_array_avx512(float * x, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(x + i, exp_avx512(_mm512_loadu_ps(x + i)));
+    }
+    expf_array_avx2(x + i, n - i);
+}
+
+static AVX512_TARGET void logf_array_avx512(float * x, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(x + i, log_avx512(_mm512_loadu_ps(x + i)));
+    }
+    logf_array_avx2(x + i, n - i);
+}
+
+static AVX512_TARGET void logisticf_array_avx512(float * x, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(x + i, logistic_avx512(_mm512_loadu_ps(x + i)));
+    }
+    logisticf_array_avx2(x + i, n - i);
+}
+
+static AVX512_TARGET void eluf_array_avx512(float * x, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(x + i, elu_avx512(_mm512_loadu_ps(x + i)));
+    }
+    eluf_array_avx2(x + i, n - i);
+}
+
+static AVX512_TARGET void gru_update_array_avx512(float const * z, float const * istate,
+                                                  float const * hbar, float * ostate, size_t n) {
+    const __m512 ones = _mm512_set1_ps(1.0f);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m512 zv = _mm512_loadu_ps(z + i);
+        _mm512_storeu_ps(ostate + i, zv * _mm512_loadu_ps(istate + i)
+                                     + (ones - zv) * _mm512_loadu_ps(hbar + i));
+    }
+    gru_update_array_avx2(z + i, istate + i, hbar + i, ostate + i, n - i);
+}
+
+static AVX512_TARGET void lstm_gates_array_avx512(float const * xF, float const * peep,
+                                                  float * state, float * output, size_t size) {
+    size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        const __m512 st = _mm512_loadu_ps(state + i);
+        const __m512 forget = logistic_avx512(_mm512_loadu_ps(xF + 2 * size + i)
+                                              + st * _mm512_loadu_ps(peep + size + i)) * st;
+        const __m512 update = logistic_avx512(_mm512_loadu_ps(xF + size + i)
+                                              + st * _mm512_loadu_ps(peep + i))
+                            * tanh_avx512(_mm512_loadu_ps(xF + i));
+        const __m512 newst = forget + update;
+        _mm512_storeu_ps(state + i, newst);
+        _mm512_storeu_ps(output + i, logistic_avx512(_mm512_loadu_ps(xF + 3 * size + i)
+                                                     + newst * _mm512_loadu_ps(peep + 2 * size + i))
+                                     * tanh_avx512(newst));
+    }
+    for (; i < size; i += 4) {
+        const __m128 st = _mm_loadu_ps(state + i);
+        const __m128 forget = logisticfv(_mm_loadu_ps(xF + 2 * size + i)
+                                         + st * _mm_loadu_ps(peep + size + i)) * st;
+        const __m128 update = logisticfv(_mm_loadu_ps(xF + size + i)
+                                         + st * _mm_loadu_ps(peep + i))
+                            * tanhfv(_mm_loadu_ps(xF + i));
+        const __m128 newst = forget + update;
+        _mm_storeu_ps(state + i, newst);
+        _mm_storeu_ps(output + i, logisticfv(_mm_loadu_ps(xF + 3 * size + i)
+                                             + newst * _mm_loadu_ps(peep + 2 * size + i))
+                                  * tanhfv(newst));
+    }
+}
+
+static AVX512_TARGET void normalise_columns_avx512(float * x, size_t nr, size_t stride, size_t nc) {
+    for (size_t col = 0; col < nc; col++) {
+        float * xc = x + col * stride;
+        __m512 sumv = _mm512_setzero_ps();
+        size_t r = 0;
+        for (; r + 16 <= nr; r += 16) {
+            sumv += _mm512_loadu_ps(xc + r);
+        }
+        if (r < nr) {
+            const __mmask16 rem = (__mmask16)((1U << (nr - r)) - 1);
+            sumv += _mm512_maskz_loadu_ps(rem, xc + r);
+        }
+        const float sum = _mm512_reduce_add_ps(sumv);
+
+        const __m512 recip = _mm512_set1_ps(1.0f / sum);
+        r = 0;
+        for (; r + 16 <= stride; r += 16) {
+            _mm512_storeu_ps(xc + r, _mm512_loadu_ps(xc + r) * recip);
+        }
+        if (r < stride) {
+            const __mmask16 rem = (__mmask16)((1U << (stride - r)) - 1);
+            _mm512_mask_storeu_ps(xc + r, rem, _mm512_maskz_loadu_ps(rem, xc + r) * recip);
+        }
+    }
+}
+
+static inline AVX512_TARGET __m512 exp_fast_avx512(__m512 x) {
+    x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(-87.0f)), _mm512_set1_ps(88.0f));
+    const __m512i n = _mm512_cvtps_epi32(x * _mm512_set1_ps(1.44269504088896341f));
+    const __m512 r = x - _mm512_cvtepi32_ps(n) * _mm512_set1_ps(0.693147180559945309f);
+    __m512 y = _mm512_set1_ps(1.0f / 24.0f);
+    y = y * r + _mm512_set1_ps(1.0f / 6.0f);
+    y = y * r + _mm512_set1_ps(0.5f);
+    y = y * r + _mm512_set1_ps(1.0f);
+    y = y * r + _mm512_set1_ps(1.0f);
+    return y * _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_add_epi32(n, _mm512_set1_epi32(0x7f)), 23));
+}
+
+static inline AVX512_TARGET __m512 log_fast_avx512(__m512 x) {
+    return log_avx512(x);
+}
+
+//  Estimate has fourteen bits
+static inline AVX512_TARGET __m512 recip_fast_avx512(__m512 x) {
+    const __m512 r = _mm512_rcp14_ps(x);
+    return r * (_mm512_set1_ps(2.0f) - x * r);
+}
+
+static inline AVX512_TARGET __m512 exp_fastest_avx512(__m512 x) {
+    x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(-_BOUND)), _mm512_set1_ps(_BOUND));
+    return _mm512_castsi512_ps(_mm512_cvtps_epi32(_mm512_set1_ps(_A) * x + _mm512_set1_ps(_B)));
+}
+
+static inline AVX512_TARGET __m512 log_fastest_avx512(__m512 x) {
+    return _mm512_set1_ps(_Alogfv) * (_mm512_cvtepi32_ps(_mm512_castps_si512(x)) - _mm512_set1_ps(_Blogfv));
+}
+
+static inline AVX512_TARGET __m512 recip_fastest_avx512(__m512 x) {
+    return _mm512_rcp14_ps(x);
+}
+
+#    define DEFINE_MATH_TIER_AVX512(T) \
+static inline AVX512_TARGET __m512 logistic_ ## T ## _avx512(__m512 x) { \
+    return recip_ ## T ## _avx512(_mm512_set1_ps(1.0f) + exp_ ## T ## _avx512(-x)); \
+} \
+static inline AVX512_TARGET __m512 tanh_ ## T ## _avx512(__m512 x) { \
+    const __m512 y = logistic_ ## T ## _avx512(x + x); \
+    return y + y - _mm512_set1_ps(1.0f); \
+} \
+static inline AVX512_TARGET __m512 elu_ ## T ## _avx512(__m512 x) { \
+    const __mmask16 neg = _mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_LT_OQ); \
+    if (0 == neg) { \
+        return x; \
+    } \
+    return _mm512_mask_mov_ps(x, neg, exp_ ## T ## _avx512(x) - _mm512_set1_ps(1.0f)); \
+} \
+DEFINE_ARRAY_KERNEL_WIDE(tanhf_array_ ## T, avx512, avx2, AVX512_TARGET, 16, _mm512_loadu_ps, \
+                         _mm512_storeu_ps, tanh_ ## T ## _avx512) \
+DEFINE_ARRAY_KERNEL_WIDE(expf_array_ ## T, avx512, avx2, AVX512_TARGET, 16, _mm512_loadu_ps, \
+                         _mm512_storeu_ps, exp_ ## T ## _avx512) \
+DEFINE_ARRAY_KERNEL_WIDE(logf_array_ ## T, avx512, avx2, AVX512_TARGET, 16, _mm512_loadu_ps, \
+                         _mm512_storeu_ps, log_ ## T ## _avx512) \
+DEFINE_ARRAY_KERNEL_WIDE(logisticf_array_ ## T, avx512, avx2, AVX512_TARGET, 16, _mm512_loadu_ps, \
+                         _mm512_storeu_ps, logistic_ ## T ## _avx512) \
+DEFINE_ARRAY_KERNEL_WIDE(eluf_array_ ## T, avx512, avx2, AVX512_TARGET, 16, _mm512_loadu_ps, \
+                         _mm512_storeu_ps, elu_ ## T ## _avx512) \
+static AVX512_TARGET void lstm_gates_array_ ## T ## _avx512(float const * xF, float const * peep, \
+                                                           float * state, float * output, size_t size) { \
+    size_t i = 0; \
+    for (; i + 16 <= size; i += 16) { \
+        LSTM_GATES_STEP(__m512, _mm512_loadu_ps, _mm512_storeu_ps, logistic_ ## T ## _avx512, \
+                        tanh_ ## T ## _avx512) \
+    } \
+    for (; i < size; i += 4) { \
+        LSTM_GATES_STEP(__m128, _mm_loadu_ps, _mm_storeu_ps, logistic_ ## T ## _sse, tanh_ ## T ## _sse) \
+    } \
+}
+
+DEFINE_MATH_TIER_AVX512(fast)
+DEFINE_MATH_TIER_AVX512(fastest)
+
+//  Eight columns at a time against each panel of sixteen outputs
+static AVX512_TARGET void panel_affine_avx512(float const * panels, size_t npanel, size_t nk,
+                                              float const * x, size_t ldx, float const * init,
+                                              size_t ldinit, float * c, size_t ldc, size_t ncol) {
+    const size_t init_len = panel_init_len(npanel, ldinit, ldc);
+    for (size_t j = 0; j < ncol; j += 8) {
+        const size_t nj = (j + 8 <= ncol) ? 8 : ncol - j;
+        //  Missing columns repeat the last one and are not stored
+        float const * xj[8];
+        float const * initj[8];
+        for (size_t jj = 0; jj < 8; jj++) {
+            const size_t col = j + ((jj < nj) ? jj : nj - 1);
+            xj[jj] = x + col * ldx;
+            initj[jj] = init + col * ldinit;
+        }
+        for (size_t p = 0; p < npanel; p++) {
+            const size_t r0 = p * SCRAPPIE_PANEL_WIDTH;
+            const __mmask16 minit = (r0 + SCRAPPIE_PANEL_WIDTH <= init_len)
+                ? 0xffff : (__mmask16)((1U << (init_len - r0)) - 1);
+            const __mmask16 mout = (r0 + SCRAPPIE_PANEL_WIDTH <= ldc)
+                ? 0xffff : (__mmask16)((1U << (ldc - r0)) - 1);
+            __m512 acc[8];
+            for (size_t jj = 0; jj < 8; jj++) {
+                acc[jj] = _mm512_maskz_loadu_ps(minit, initj[jj] + r0);
+            }
+            float const * pk = panels + r0 * nk;
+            for (size_t k = 0; k < nk; k++, pk += SCRAPPIE_PANEL_WIDTH) {
+                const __m512 w = _mm512_load_ps(pk);
+                for (size_t jj = 0; jj < 8; jj++) {
+                    acc[jj] = _mm512_fmadd_ps(w, _mm512_set1_ps(xj[jj][k]), acc[jj]);
+                }
+            }
+            for (size_t jj = 0; jj < nj; jj++) {
+                _mm512_mask_storeu_ps(c + (j + jj) * ldc + r0, mout, acc[jj]);
+            }
+        }
+    }
+}
+
+/*  Eight columns at a time against each panel of sixteen int8 outputs.  The
+ *  dot product of pairs of int16 is a single instruction with VNNI.  */
+#    define DEFINE_PANEL_AFFINE_INT8_AVX512(NAME, TARGET, DPWSSD) \
+static TARGET void NAME(int8_t const * panels, float const * wscale, size_t npanel, size_t nk, \
+                        int32_t const * xq, size_t ldxq, float const * xscale, \
+                        float const * init, size_t ldinit, float * c, size_t ldc, size_t ncol) { \
+    const size_t init_len = panel_init_len(npanel, ldinit, ldc); \
+    const size_t nkpair = (nk + 1) / 2; \
+    for (size_t j = 0; j < ncol; j += 8) { \
+        const size_t nj = (j + 8 <= ncol) ? 8 : ncol - j; \
+        int32_t const * xj[8]; \
+        float const * initj[8]; \
+        float xsj[8]; \
+        for (size_t jj = 0; jj < 8; jj++) { \
+            const size_t col = j + ((jj < nj) ? jj : nj - 1); \
+            xj[jj] = xq + col * ldxq; \
+            initj[jj] = init + col * ldinit; \
+            xsj[jj] = xscale[col]; \
+        } \
+        for (size_t p = 0; p < npanel; p++) { \
+            const size_t r0 = p * SCRAPPIE_PANEL_WIDTH; \
+            const __mmask16 minit = (r0 + SCRAPPIE_PANEL_WIDTH <= init_len) \
+                ? 0xffff : (__mmask16)((1U << (init_len - r0)) - 1); \
+            const __mmask16 mout = (r0 + SCRAPPIE_PANEL_WIDTH <= ldc) \
+                ? 0xffff : (__mmask16)((1U << (ldc - r0)) - 1); \
+            __m512i acc[8]; \
+            for (size_t jj = 0; jj < 8; jj++) { \
+                acc[jj] = _mm512_setzero_si512(); \
+            } \
+            int8_t const * pk = panels + 2 * r0 * nkpair; \
+            for (size_t q = 0; q < nkpair; q++, pk += 2 * SCRAPPIE_PANEL_WIDTH) { \
+                const __m512i w = _mm512_cvtepi8_epi16(_mm256_load_si256((__m256i const *)pk)); \
+                for (size_t jj = 0; jj < 8; jj++) { \
+                    acc[jj] = DPWSSD(acc[jj], w, _mm512_set1_epi32(xj[jj][q])); \
+                } \
+            } \
+            const __m512 ws = _mm512_maskz_loadu_ps(mout, wscale + r0); \
+            for (size_t jj = 0; jj < nj; jj++) { \
+                const __m512 cj = _mm512_fmadd_ps(_mm512_cvtepi32_ps(acc[jj]), \
+                                                  ws * _mm512_set1_ps(xsj[jj]), \
+                                                  _mm512_maskz_loadu_ps(minit, initj[jj] + r0)); \
+                _mm512_mask_storeu_ps(c + (j + jj) * ldc + r0, mout, cj); \
+            } \
+        } \
+    } \
+}
+
+#    define AVX512BW_TARGET __attribute__((target("avx512f,avx512bw")))
+#    define AVX512VNNI_TARGET __attribute__((target("avx512f,avx512bw,avx512vnni")))
+#    define DPWSSD_AVX512BW(ACC, A, B) _mm512_add_epi32(ACC, _mm512_madd_epi16(A, B))
+DEFINE_PANEL_AFFINE_INT8_AVX512(panel_affine_int8_avx512, AVX512BW_TARGET, DPWSSD_AVX512BW)
+DEFINE_PANEL_AFFINE_INT8_AVX512(panel_affine_int8_avx512vnni, AVX512VNNI_TARGET, _mm512_dpwssd_epi32)
+
+//  Each block whole, its four quarters summed once the row is done
+static AVX512_TARGET void block_sparse_affine_avx512(float const * blocks, uint32_t const * block_input,
+                                                     uint32_t const * row_start, size_t nrow_block,
+                                                     float const * x, float * y) {
+    const __m512i spread = _mm512_setr_epi32(0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3);
+    for (size_t ob = 0; ob < nrow_block; ob++) {
+        __m512 acc = _mm512_setzero_ps();
+        for (uint32_t b = row_start[ob]; b < row_start[ob + 1]; b++) {
+            const __m512 xb = _mm512_castps128_ps512(_mm_loadu_ps(x + 4 * block_input[b]));
+            acc = _mm512_fmadd_ps(_mm512_load_ps(blocks + 16 * b), _mm512_permutexvar_ps(spread, xb), acc);
+        }
+        const __m128 sum = (_mm512_extractf32x4_ps(acc, 0) + _mm512_extractf32x4_ps(acc, 1))
+                         + (_mm512_extractf32x4_ps(acc, 2) + _mm512_extractf32x4_ps(acc, 3));
+        _mm_storeu_ps(y + 4 * ob, _mm_loadu_ps(y + 4 * ob) + sum);
+    }
+}
+#endif                          /* SCRAPPIE_SIMD_SSE_ONLY */
+
+
+
+/**
+ *   Dispatching kernels
+ **/
+#ifdef SCRAPPIE_SIMD_SSE_ONLY
+#    define SIMD_DISPATCH(FUNC, ...) FUNC ## _sse(__VA_ARGS__)
+#else
+#    define SIMD_DISPATCH(FUNC, ...) \
+    switch (scrappie_simd_get()) { \
+    case SCRAPPIE_SIMD_AVX512: \
+        FUNC ## _avx512(__VA_ARGS__); \
+        break; \
+    case SCRAPPIE_SIMD_AVX2: \
+        FUNC ## _avx2(__VA_ARGS__); \
+        break; \
+    default: \
+        FUNC ## _sse(__VA_ARGS__); \
+    }
+#endif
+
+//  Kernel of the accuracy tier in use, at the widest supported level
+#define MATH_DISPATCH(FUNC, ...) \
+    switch (scrappie_math_get()) { \
+    case SCRAPPIE_MATH_FASTEST: \
+        SIMD_DISPATCH(FUNC ## _fastest, __VA_ARGS__); \
+        break; \
+    case SCRAPPIE_MATH_FAST: \
+        SIMD_DISPATCH(FUNC ## _fast, __VA_ARGS__); \
+        break; \
+    default: \
+        SIMD_DISPATCH(FUNC, __VA_ARGS__); \
+    }
+
+
+/**  Apply tanh to array element-wise
+ *
+ *   @param x  Array to transform, length a multiple of four
+ *   @param n  Length of array
+ **/
+void tanhf_array_inplace(float * x, size_t n) {
+    assert(n % 4 == 0);
+    MATH_DISPATCH(tanhf_array, x, n);
+}
+
+/**  Apply exp to array element-wise
+ *
+ *   @param x  Array to transform, length a multiple of four
+ *   @param n  Length of array
+ **/
+void expf_array_inplace(float * x, size_t n) {
+    assert(n % 4 == 0);
+    MATH_DISPATCH(expf_array, x, n);
+}
+
+/**  Apply log to array element-wise
+ *
+ *   @param x  Array to transform, length a multiple of four
+ *   @param n  Length of array
+ **/
+void logf_array_inplace(float * x, size_t n) {
+    assert(n % 4 == 0);
+    MATH_DISPATCH(logf_array, x, n);
+}
+
+/**  Apply logistic function to array element-wise
+ *
+ *   @param x  Array to transform, length a multiple of four
+ *   @param n  Length of array
+ **/
+void logisticf_array_inplace(float * x, size_t n) {
+    assert(n % 4 == 0);
+    MATH_DISPATCH(logisticf_array, x, n);
+}
+
+/**  Apply ELU to array element-wise
+ *
+ *   @param x  Array to transform, length a multiple of four
+ *   @param n  Length of array
+ **/
+void eluf_array_inplace(float * x, size_t n) {
+    assert(n % 4 == 0);
+    MATH_DISPATCH(eluf_array, x, n);
+}
+
+/**  Final update of GRU state
+ *
+ *   ostate = z * istate + (1 - z) * hbar
+ *
+ *   @param z       Update gate
+ *   @param istate  Previous state
+ *   @param hbar    Candidate state
+ *   @param ostate  Output state [out]
+ *   @param n       Size of state, a multiple of four
+ **/
+void gru_update_array(float const * z, float const * istate, float const * hbar,
+                      float * ostate, size_t n) {
+    assert(n % 4 == 0);
+    SIMD_DISPATCH(gru_update_array, z, istate, hbar, ostate, n);
+}
+
+/**  Gate calculations for LSTM with peepholes
+ *
+ *   @param xF      Input and recurrent contributions [4 * size], blocks are
+ *                  cell input, update, forget and output.
+ *   @param peep    Peephole weights [3 * size]
+ *   @param state   Cell state, updated in place [size]
+ *   @param output  Output [out, size]
+ *   @param size    Size of layer, a multiple of four
+ **/
+void lstm_gates_array(float const * xF, float const * peep, float * state,
+                      float * output, size_t size) {
+    assert(size % 4 == 0);
+    MATH_DISPATCH(lstm_gates_array, xF, peep, state, output, size);
+}
+
+/**  Normalise columns of array to sum to one
+ *
+ *   @param x       Column-major array of nc columns
+ *   @param nr      Number of rows to sum over
+ *   @param stride  Distance between columns, a multiple of four.  Padding
+ *                  between nr and stride is scaled but not summed.
+ *   @param nc      Number of columns
+ **/
+void normalise_columns_inplace(float * x, size_t nr, size_t stride, size_t nc) {
+    assert(stride % 4 == 0);
+    assert(nr <= stride && stride - nr < 4);
+    SIMD_DISPATCH(normalise_columns, x, nr, stride, nc);
+}
+
+/**  Affine map of columns by weights packed into panels
+ *
+ *   c[:, j] = init[:, j] + P^t x[:, j] for each column j, where P is held as
+ *   npanel panels of SCRAPPIE_PANEL_WIDTH outputs.  Each panel is nk rows of
+ *   SCRAPPIE_PANEL_WIDTH contiguous weights, one row per input, aligned to
+ *   64 bytes.
+ *
+ *   @param panels  Packed weights [npanel * nk * SCRAPPIE_PANEL_WIDTH]
+ *   @param npanel  Number of panels
+ *   @param nk      Number of inputs
+ *   @param x       Column-major input, ncol columns of at least nk values
+ *   @param ldx     Distance between columns of input
+ *   @param init    Initial value of each column of output
+ *   @param ldinit  Distance between columns of init.  If zero, the same
+ *                  npanel * SCRAPPIE_PANEL_WIDTH values, typically a bias,
+ *                  are used for every column.  Otherwise ldc, and init may
+ *                  be c so the map accumulates into c.
+ *   @param c       Column-major output [out]
+ *   @param ldc     Distance between columns of output, a multiple of four.
+ *                  Outputs beyond ldc are not written.
+ *   @param ncol    Number of columns
+ **/
+void panel_affine(float const * panels, size_t npanel, size_t nk, float const * x, size_t ldx,
+                  float const * init, size_t ldinit, float * c, size_t ldc, size_t ncol) {
+    assert(ldc % 4 == 0);
+    assert(0 == ldinit || ldc == ldinit);
+    assert(ldc <= npanel * SCRAPPIE_PANEL_WIDTH);
+    SIMD_DISPATCH(panel_affine, panels, npanel, nk, x, ldx, init, ldinit, c, ldc, ncol);
+}
+
+
+/**  Quantise columns of input to int8 for panel_affine_int8
+ *
+ *   Each column is scaled so its largest absolute value is 127 and rounded.
+ *   Quantised values are stored as int16, so consecutive pairs form the
+ *   int32 inputs of panel_affine_int8, and a column of odd length is padded
+ *   with a zero.  A zero column has scale zero.
+ *
+ *   @param x  Column-major input, ncol columns of nr values
+ *   @param nr  Number of rows of input
+ *   @param ldx  Distance between columns of input
+ *   @param ncol  Number of columns
+ *   @param xq  Quantised pairs [out], ncol columns of (nr + 1) / 2 values
+ *   @param ldxq  Distance between columns of xq
+ *   @param xscale  Scale of each column [out], x ~ xscale * quantised
+ **/
+void quantise_columns_int8(float const * x, size_t nr, size_t ldx, size_t ncol,
+                           int32_t * xq, size_t ldxq, float * xscale) {
+    const size_t nr4 = nr & ~(size_t)3;
+    const __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    for (size_t j = 0; j < ncol; j++) {
+        float const * xj = x + j * ldx;
+        int16_t * qj = (int16_t *)(xq + j * ldxq);
+        __m128 vmax = _mm_setzero_ps();
+        for (size_t k = 0; k < nr4; k += 4) {
+            vmax = _mm_max_ps(vmax, _mm_and_ps(_mm_loadu_ps(xj + k), absmask));
+        }
+        vmax = _mm_max_ps(vmax, _mm_shuffle_ps(vmax, vmax, _MM_SHUFFLE(1, 0, 3, 2)));
+        vmax = _mm_max_ps(vmax, _mm_shuffle_ps(vmax, vmax, _MM_SHUFFLE(2, 3, 0, 1)));
+        float amax = _mm_cvtss_f32(vmax);
+        for (size_t k = nr4; k < nr; k++) {
+            amax = fmaxf(amax, fabsf(xj[k]));
+        }
+
+        const float recip = (amax > 0.0f) ? 127.0f / amax : 0.0f;
+        xscale[j] = amax / 127.0f;
+        //  Conversion rounds to nearest
+        const __m128 vrecip = _mm_set1_ps(recip);
+        for (size_t k = 0; k < nr4; k += 4) {
+            const __m128i q = _mm_cvtps_epi32(_mm_loadu_ps(xj + k) * vrecip);
+            _mm_storel_epi64((__m128i *)(qj + k), _mm_packs_epi32(q, q));
+        }
+        for (size_t k = nr4; k < nr; k++) {
+            qj[k] = (int16_t)_mm_cvtss_si32(_mm_set_ss(xj[k] * recip));
+        }
+        if (nr % 2 == 1) {
+            qj[nr] = 0;
+        }
+    }
+}
+
+/**  Affine map of quantised columns by int8 weights packed into panels
+ *
+ *   c[:, j] = init[:, j] + xscale[j] * diag(wscale) P^t xq[:, j], integer
+ *   products being accumulated exactly in int32.  Each panel holds
+ *   (nk + 1) / 2 consecutive blocks of 2 * SCRAPPIE_PANEL_WIDTH weights, a
+ *   block being the weights of a pair of inputs interleaved output by
+ *   output.  Otherwise as panel_affine.
+ *
+ *   @param panels  Packed weights [npanel * ((nk + 1) / 2) * 2 * SCRAPPIE_PANEL_WIDTH]
+ *   @param wscale  Scale of weights of each output [npanel * SCRAPPIE_PANEL_WIDTH]
+ *   @param xq, ldxq, xscale  Input quantised by quantise_columns_int8
+ **/
+void panel_affine_int8(int8_t const * panels, float const * wscale, size_t npanel, size_t nk,
+                       int32_t const * xq, size_t ldxq, float const * xscale,
+                       float const * init, size_t ldinit, float * c, size_t ldc, size_t ncol) {
+    assert(ldc % 4 == 0);
+    assert(0 == ldinit || ldc == ldinit);
+    assert(ldc <= npanel * SCRAPPIE_PANEL_WIDTH);
+#ifdef SCRAPPIE_SIMD_SSE_ONLY
+    panel_affine_int8_sse(panels, wscale, npanel, nk, xq, ldxq, xscale, init, ldinit, c, ldc, ncol);
+#else
+    switch (scrappie_simd_get()) {
+    case SCRAPPIE_SIMD_AVX512:
+        //  Integer instructions need AVX-512BW, which some early AVX-512 CPUs lack
+        if (__builtin_cpu_supports("avx512vnni")) {
+            panel_affine_int8_avx512vnni(panels, wscale, npanel, nk, xq, ldxq, xscale, init, ldinit,
+                                         c, ldc, ncol);
+            break;
+        }
+        if (__builtin_cpu_supports("avx512bw")) {
+            panel_affine_int8_avx512(panels, wscale, npanel, nk, xq, ldxq, xscale, init, ldinit,
+                                     c, ldc, ncol);
+            break;
+        }
+        //  Fall through
+    case SCRAPPIE_SIMD_AVX2:
+        panel_affine_int8_avx2(panels, wscale, npanel, nk, xq, ldxq, xscale, init, ldinit, c, ldc, ncol);
+        break;
+    default:
+        panel_affine_int8_sse(panels, wscale, npanel, nk, xq, ldxq, xscale, init, ldinit, c, ldc, ncol);
+    }
+#endif
+}
+
+
+/**  Accumulate map of a vector by block-sparse weights
+ *
+ *   y += W^t x, where W is held as its blocks of SCRAPPIE_SPARSE_BLOCK
+ *   inputs by SCRAPPIE_SPARSE_BLOCK outputs that are not all zero.  The
+ *   blocks of each group of SCRAPPIE_SPARSE_BLOCK outputs are consecutive,
+ *   each block being the weights of its first input, output by output,
+ *   then those of its second input and so on.  Blocks are aligned to 64
+ *   bytes.
+ *
+ *   @param blocks  Weights [16 * nblock]
+ *   @param block_input  Index of the first input of each block, divided by
+ *   SCRAPPIE_SPARSE_BLOCK [nblock]
+ *   @param row_start  Index of first block of each group of outputs, and of
+ *   the block after the last [nrow_block + 1]
+ *   @param nrow_block  Number of groups of outputs
+ *   @param x  Input, padded to a whole number of blocks
+ *   @param y  Output [SCRAPPIE_SPARSE_BLOCK * nrow_block], accumulated into
+ **/
+void block_sparse_affine(float const * blocks, uint32_t const * block_input, uint32_t const * row_start,
+                         size_t nrow_block, float const * x, float * y) {
+    SIMD_DISPATCH(block_sparse_affine, blocks, block_input, row_start, nrow_block, x, y);
+}
@@ -0,0 +1,78 @@
+#pragma once
+#ifndef SCRAPPIE_SIMD_H
+#    define SCRAPPIE_SIMD_H
+
+#    include <stdbool.h>
+#    include <stddef.h>
+#    include <stdint.h>
+
+/**  Width of vector unit used by elementwise kernels
+ *
+ *   The SSE path is always available and is the only path used when
+ *   compiled with any of the FAST_* approximations.  Wider paths are
+ *   selected at runtime according to what the CPU supports.
+ **/
+enum scrappie_simd {
+    SCRAPPIE_SIMD_SSE = 0,
+    SCRAPPIE_SIMD_AVX2,
+    SCRAPPIE_SIMD_AVX512,
+    SCRAPPIE_SIMD_INVALID
+};
+
+enum scrappie_simd scrappie_simd_supported(void);
+enum scrappie_simd scrappie_simd_get(void);
+enum scrappie_simd scrappie_simd_set(enum scrappie_simd level);
+const char * scrappie_simd_string(enum scrappie_simd level);
+enum scrappie_simd scrappie_simd_from_string(const char * str);
+
+/**  Accuracy of exp, log and the activations built on them
+ *
+ *   Accurate uses the Cephes based polynomials.  Fast uses a degree four
+ *   polynomial for exp, relative error below 1e-4, and a refined estimate of
+ *   the reciprocal.  Fastest uses Schraudolph's bit manipulation for exp and
+ *   log, relative error of a few percent, and the raw reciprocal estimate.
+ *   Compiling with a FAST_* approximation changes what the accurate tier
+ *   computes on the SSE path.
+ **/
+enum scrappie_math {
+    SCRAPPIE_MATH_ACCURATE = 0,
+    SCRAPPIE_MATH_FAST,
+    SCRAPPIE_MATH_FASTEST,
+    SCRAPPIE_MATH_INVALID
+};
+
+enum scrappie_math scrappie_math_get(void);
+enum scrappie_math scrappie_math_set(enum scrappie_math tier);
+const char * scrappie_math_string(enum scrappie_math tier);
+enum scrappie_math scrappie_math_from_string(const char * str);
+
+/*  Elementwise kernels.  Arrays must hold a multiple of four floats, which
+ *  is always true for the memory of a scrappie_matrix (stride * nc).  */
+void tanhf_array_inplace(float * x, size_t n);
+void expf_array_inplace(float * x, size_t n);
+void logf_array_inplace(float * x, size_t n);
+void logisticf_array_inplace(float * x, size_t n);
+void eluf_array_inplace(float * x, size_t n);
+void gru_update_array(float const * z, float const * istate, float const * hbar,
+                      float * ostate, size_t n);
+void lstm_gates_array(float const * xF, float const * peep, float * state,
+                      float * output, size_t size);
+void normalise_columns_inplace(float * x, size_t nr, size_t stride, size_t nc);
+
+/*  Affine map by weights packed into panels of SCRAPPIE_PANEL_WIDTH outputs  */
+#    define SCRAPPIE_PANEL_WIDTH 16
+void panel_affine(float const * panels, size_t npanel, size_t nk, float const * x, size_t ldx,
+                  float const * init, size_t ldinit, float * c, size_t ldc, size_t ncol);
+/*  As panel_affine but with weights and inputs quantised to int8  */
+void quantise_columns_int8(float const * x, size_t nr, size_t ldx, size_t ncol,
+                           int32_t * xq, size_t ldxq, float * xscale);
+void panel_affine_int8(int8_t const * panels, float const * wscale, size_t npanel, size_t nk,
+                       int32_t const * xq, size_t ldxq, float const * xscale,
+                       float const * init, size_t ldinit, float * c, size_t ldc, size_t ncol);
+
+/*  Map of a vector by weights of which only the blocks that are not all zero are held  */
+#    define SCRAPPIE_SPARSE_BLOCK 4
+void block_sparse_affine(float const * blocks, uint32_t const * block_input, uint32_t const * row_start,
+                         size_t nrow_block, float const * x, float * y);
+
+#endif                          /* SCRAPPIE_SIMD_H */
@@ -0,0 +1,408 @@
+#include <math.h>
+#if defined(_OPENMP)
+#    include <omp.h>
+#endif
+#include <stdio.h>
+#include <strings.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "fast5_interface.h"
+#include "kseq.h"
+#include "networks.h"
+#include "posterior_file.h"
+#include "scrappie_common.h"
+#include "scrappie_licence.h"
+#include "scrappie_stdlib.h"
+#include "simulate.h"
+
+KSEQ_INIT(int, read)
+
+// Doesn't play nice with other headers, include last
+#include <argp.h>
+
+//  Number of sequences read before simulating them in parallel
+#define SIMULATE_BLOCK 256
+
+enum simulate_format {
+    SIMULATE_FORMAT_TSV = 0,
+    SIMULATE_FORMAT_FAST5,
+    SIMULATE_FORMAT_SIGNAL,
+    SIMULATE_FORMAT_INVALID
+};
+
+
+extern const char *argp_program_version;
+extern const char *argp_program_bug_address;
+static char doc[] = "Scrappie simulator -- raw signal from predicted squiggle";
+static char args_doc[] = "fasta [fasta ...]";
+static struct argp_option options[] = {
+    {"model", 'm', "name", 0, "Squiggle model to use: \"squiggle_r94\", \"squiggle_r10\""},
+    {"limit", 'l', "nreads", 0,
+     "Maximum number of reads to simulate (0 is unlimited)"},
+    {"output", 'o', "filename", 0, "Write to file rather than stdout"},
+    {"prefix", 'p', "string", 0, "Prefix to append to name of each read"},
+    {"format", 'f', "format", 0,
+     "Format of output: \"tsv\", \"fast5\" (multi-read, requires --output) or \"signal\" (binary posterior format)"},
+    {"model-file", 3, "filename", 0,
+     "Read weights of model from binary model file rather than using those compiled in"},
+    {"dwell", 4, "distribution", 0,
+     "Distribution of dwell: \"fixed\", \"poisson\", \"gamma\" or \"gamma:shape\""},
+    {"rate", 5, "factor", 0, "Speed of translocation relative to model"},
+    {"min-dwell", 6, "nsample", 0, "Minimum number of samples for each position"},
+    {"noise", 7, "distribution", 0, "Distribution of noise: \"laplace\", \"gaussian\" or \"none\""},
+    {"noise-scale", 8, "factor", 0, "Multiplier of spread predicted by model"},
+    {"shift", 9, "pA", 0, "Shift of signal in pA"},
+    {"scale", 12, "pA", 0, "Scale of signal in pA"},
+    {"seed", 13, "integer", 0, "Seed for random number generator"},
+    {"licence", 10, 0, 0, "Print licensing information"},
+    {"license", 11, 0, OPTION_ALIAS, "Print licensing information"},
+#if defined(_OPENMP)
+    {"threads", '#', "nparallel", 0, "Number of sequences to simulate in parallel"},
+#endif
+    {0}
+};
+
+
+struct arguments {
+    enum squiggle_model_type model_type;
+    int limit;
+    char * output;
+    char * prefix;
+    enum simulate_format format;
+    char * model_file;
+    simulate_param param;
+    uint64_t seed;
+    char ** files;
+};
+
+static struct arguments args = {
+    .model_type = SCRAPPIE_SQUIGGLE_MODEL_R9_4,
+    .limit = 0,
+    .output = NULL,
+    .prefix = "",
+    .format = SIMULATE_FORMAT_TSV,
+    .model_file = NULL,
+    .seed = 1,
+    .files = NULL
+};
+
+//  Scaling of simulated signal to ADC values for fast5 output
+static const fast5_raw_scaling simulate_scaling = {
+    .digitisation = 8192.0f,
+    .offset = 0.0f,
+    .range = 1400.0f,
+    .sample_rate = 4000.0f
+};
+
+
+static enum simulate_format get_simulate_format(const char * formatstr) {
+    if (0 == strcmp(formatstr, "tsv")) {
+        return SIMULATE_FORMAT_TSV;
+    }
+    if (0 == strcmp(formatstr, "fast5")) {
+        return SIMULATE_FORMAT_FAST5;
+    }
+    if (0 == strcmp(formatstr, "signal")) {
+        return SIMULATE_FORMAT_SIGNAL;
+    }
+    return SIMULATE_FORMAT_INVALID;
+}
+
+
+static error_t parse_arg(int key, char *arg, struct argp_state *state) {
+    int ret = 0;
+
+    switch (key) {
+    case 'm':
+        args.model_type = get_squiggle_model(arg);
+        if(SCRAPPIE_SQUIGGLE_MODEL_INVALID == args.model_type){
+            errx(EXIT_FAILURE, "Invalid squiggle model name \"%s\"", arg);
+        }
+        break;
+    case 'l':
+        args.limit = atoi(arg);
+        assert(args.limit > 0);
+        break;
+    case 'o':
+        args.output = arg;
+        break;
+    case 'p':
+        args.prefix = arg;
+        break;
+    case 'f':
+        args.format = get_simulate_format(arg);
+        if(SIMULATE_FORMAT_INVALID == args.format){
+            errx(EXIT_FAILURE, "Invalid output format \"%s\"", arg);
+        }
+        break;
+    case 3:
+        args.model_file = arg;
+        break;
+    case 4:
+        args.param.dwell = simulate_dwell_from_string(arg, &args.param.dwell_shape);
+        if(SIMULATE_DWELL_INVALID == args.param.dwell){
+            errx(EXIT_FAILURE, "Invalid dwell distribution \"%s\"", arg);
+        }
+        break;
+    case 5:
+        args.param.rate = atof(arg);
+        assert(args.param.rate > 0.0f);
+        break;
+    case 6:
+        args.param.min_dwell = atoi(arg);
+        break;
+    case 7:
+        args.param.noise = simulate_noise_from_string(arg);
+        if(SIMULATE_NOISE_INVALID == args.param.noise){
+            errx(EXIT_FAILURE, "Invalid noise distribution \"%s\"", arg);
+        }
+        break;
+    case 8:
+        args.param.noise_scale = atof(arg);
+        assert(args.param.noise_scale >= 0.0f);
+        break;
+    case 9:
+        args.param.shift = atof(arg);
+        break;
+    case 12:
+        args.param.scale = atof(arg);
+        break;
+    case 13:
+        args.seed = strtoull(arg, NULL, 10);
+        break;
+    case 10:
+    case 11:
+        ret = fputs(scrappie_licence_text, stdout);
+        exit((EOF != ret) ? EXIT_SUCCESS : EXIT_FAILURE);
+        break;
+    #if defined(_OPENMP)
+    case '#':
+        {
+            int nthread = atoi(arg);
+            const int maxthread = omp_get_max_threads();
+            if(nthread < 1){nthread = 1;}
+            if(nthread > maxthread){nthread = maxthread;}
+            omp_set_num_threads(nthread);
+        }
+        break;
+    #endif
+
+    case ARGP_KEY_NO_ARGS:
+        argp_usage(state);
+        break;
+
+    case ARGP_KEY_ARG:
+        args.files = &state->argv[state->next - 1];
+        state->next = state->argc;
+        break;
+
+    default:
+        return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+static struct argp argp = { options, parse_arg, args_doc, doc };
+
+
+/**  Sequences read and simulated together
+ **/
+typedef struct {
+    size_t n;
+    char * name[SIMULATE_BLOCK];
+    char * seq[SIMULATE_BLOCK];
+    size_t seqlen[SIMULATE_BLOCK];
+    float * signal[SIMULATE_BLOCK];
+    size_t nsample[SIMULATE_BLOCK];
+} simulate_block;
+
+
+static char * copy_string(const char * prefix, const char * str, size_t n) {
+    const size_t nprefix = strlen(prefix);
+    char * copy = calloc(nprefix + n + 1, sizeof(char));
+    RETURN_NULL_IF(NULL == copy, NULL);
+    memcpy(copy, prefix, nprefix);
+    memcpy(copy + nprefix, str, n);
+    return copy;
+}
+
+
+static void clear_block(simulate_block * block) {
+    for (size_t i = 0; i < block->n; i++) {
+        free(block->name[i]);
+        free(block->seq[i]);
+        free(block->signal[i]);
+    }
+    block->n = 0;
+}
+
+
+static void simulate_block_signal(simulate_block * block, uint64_t first_seed) {
+    const int nseq = block->n;
+    //  Squiggles of the block are predicted in packed batches, themselves in parallel
+    scrappie_matrix * squiggle = sequence_to_squiggle_batch((char const * const *)block->seq, block->seqlen,
+                                                            block->n, true, args.model_type);
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < nseq; i++) {
+        block->signal[i] = NULL;
+        block->nsample[i] = 0;
+        if (NULL == squiggle || NULL == squiggle[i]) {
+            continue;
+        }
+        block->signal[i] = simulate_signal(squiggle[i], args.param, first_seed + i, &block->nsample[i]);
+        squiggle[i] = free_scrappie_matrix(squiggle[i]);
+    }
+    free(squiggle);
+}
+
+
+static bool write_tsv(FILE * fh, const char * name, const float * signal, size_t n) {
+    fprintf(fh, "#%s\n", name);
+    for (size_t i = 0; i < n; i++) {
+        fprintf(fh, "%3.6f\n", signal[i]);
+    }
+    return !ferror(fh);
+}
+
+
+static bool write_fast5(hid_t hdf5file, const char * name, const float * signal, size_t n) {
+    int16_t * sample = calloc((n > 0) ? n : 1, sizeof(int16_t));
+    RETURN_NULL_IF(NULL == sample, false);
+    const float raw_unit = simulate_scaling.range / simulate_scaling.digitisation;
+    for (size_t i = 0; i < n; i++) {
+        const float adc = roundf(signal[i] / raw_unit - simulate_scaling.offset);
+        sample[i] = (adc > INT16_MAX) ? INT16_MAX : ((adc < INT16_MIN) ? INT16_MIN : (int16_t)adc);
+    }
+    const bool status = write_raw_read(hdf5file, name, sample, n, simulate_scaling, 100000, 1);
+    free(sample);
+    return status;
+}
+
+
+static bool write_signal(FILE * fh, const char * name, const float * signal, size_t n) {
+    scrappie_matrix sigmat = make_scrappie_matrix(1, n);
+    RETURN_NULL_IF(NULL == sigmat, false);
+    for (size_t i = 0; i < n; i++) {
+        sigmat->data.f[i * sigmat->stride] = signal[i];
+    }
+    const bool status = write_posterior_record(fh, sigmat, squiggle_model_string(args.model_type), name);
+    sigmat = free_scrappie_matrix(sigmat);
+    return status;
+}
+
+
+int main_simulate(int argc, char *argv[]) {
+    args.param = simulate_defaults;
+    argp_parse(&argp, argc, argv, 0, 0, NULL);
+    if(NULL != args.model_file
+       && !load_model_weights(args.model_file, squiggle_model_string(args.model_type))){
+        errx(EXIT_FAILURE, "Failed to load model file \"%s\"", args.model_file);
+    }
+
+    FILE * output = stdout;
+    hid_t hdf5out = -1;
+    if (SIMULATE_FORMAT_FAST5 == args.format) {
+        if (NULL == args.output) {
+            errx(EXIT_FAILURE, "Output to fast5 requires a file name (--output)");
+        }
+        hdf5out = H5Fcreate(args.output, H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+        if (hdf5out < 0) {
+            errx(EXIT_FAILURE, "Failed to open \"%s\" for output.", args.output);
+        }
+    } else if (NULL != args.output) {
+        output = fopen(args.output, (SIMULATE_FORMAT_SIGNAL == args.format) ? "wb" : "w");
+        if (NULL == output) {
+            errx(EXIT_FAILURE, "Failed to open \"%s\" for output.", args.output);
+        }
+    }
+
+    simulate_block * block = calloc(1, sizeof(simulate_block));
+    if (NULL == block) {
+        errx(EXIT_FAILURE, "Failed to allocate memory for sequences");
+    }
+
+    int nfile = 0;
+    for (; args.files[nfile]; nfile++) ;
+
+    int reads_started = 0;
+    const int reads_limit = args.limit;
+    int nfailed = 0;
+
+    for (int fn = 0; fn < nfile; fn++) {
+        if (reads_limit > 0 && reads_started >= reads_limit) {
+            break;
+        }
+        FILE * fh = fopen(args.files[fn], "r");
+        if(NULL == fh){
+            warnx("Failed to open \"%s\" for input.\n", args.files[fn]);
+            continue;
+        }
+
+        kseq_t * seq = kseq_init(fileno(fh));
+        bool finished = false;
+        while (!finished) {
+            //  Read block of sequences, simulate in parallel and write in input order
+            const uint64_t first_seed = args.seed + reads_started;
+            while (block->n < SIMULATE_BLOCK) {
+                if ((reads_limit > 0 && reads_started >= reads_limit) || kseq_read(seq) < 0) {
+                    finished = true;
+                    break;
+                }
+                const size_t i = block->n;
+                block->name[i] = copy_string(args.prefix, seq->name.s, seq->name.l);
+                block->seq[i] = copy_string("", seq->seq.s, seq->seq.l);
+                block->seqlen[i] = seq->seq.l;
+                block->signal[i] = NULL;
+                block->n += 1;
+                reads_started += 1;
+                if (NULL == block->name[i] || NULL == block->seq[i]) {
+                    errx(EXIT_FAILURE, "Failed to allocate memory for sequences");
+                }
+            }
+
+            simulate_block_signal(block, first_seed);
+
+            for (size_t i = 0; i < block->n; i++) {
+                if (NULL == block->signal[i]) {
+                    warnx("Failed to simulate signal for %s", block->name[i]);
+                    nfailed += 1;
+                    continue;
+                }
+                bool status = false;
+                switch (args.format) {
+                case SIMULATE_FORMAT_TSV:
+                    status = write_tsv(output, block->name[i], block->signal[i], block->nsample[i]);
+                    break;
+                case SIMULATE_FORMAT_FAST5:
+                    status = write_fast5(hdf5out, block->name[i], block->signal[i], block->nsample[i]);
+                    break;
+                case SIMULATE_FORMAT_SIGNAL:
+                    status = write_signal(output, block->name[i], block->signal[i], block->nsample[i]);
+                    break;
+                default:
+                    errx(EXIT_FAILURE, "Invalid output format -- report bug");
+                }
+                if (!status) {
+                    warnx("Failed to write signal for %s", block->name[i]);
+                    nfailed += 1;
+                }
+            }
+            clear_block(block);
+        }
+
+        kseq_destroy(seq);
+        fclose(fh);
+    }
+    free(block);
+
+    if (hdf5out >= 0) {
+        H5Fclose(hdf5out);
+    }
+    if (stdout != output) {
+        fclose(output);
+    }
+    unload_model_weights();
+
+    return (0 == nfailed) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,5 +1,9 @@
 #include <math.h>
+#if defined(_OPENMP)
+#    include <omp.h>
+#endif
 #include <stdio.h>
+#include <string.h>
 #include <strings.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -13,6 +17,10 @@
 
 KSEQ_INIT(int, read)
 
+//  Maximum number of sequences, and of bases in them, predicted together
+#define SQUIGGLE_BLOCK 4096
+#define SQUIGGLE_BLOCK_BASES (64 * SQUIGGLE_BATCH_BASES)
+
 // Doesn't play nice with other headers, include last
 #include <argp.h>
 
@@ -29,6 +37,11 @@ static struct argp_option options[] = {
     {"prefix", 'p', "string", 0, "Prefix to append to name of each read"},
     {"rescale", 1, 0, 0, "Rescale network output"},
     {"no-rescale", 2, 0, OPTION_ALIAS, "Don't rescale network output"},
+    {"model-file", 3, "filename", 0,
+     "Read weights of model from binary model file rather than using those compiled in"},
+#if defined(_OPENMP)
+    {"threads", '#', "nparallel", 0, "Number of batches of sequences to predict in parallel"},
+#endif
     {"licence", 10, 0, 0, "Print licensing information"},
     {"license", 11, 0, OPTION_ALIAS, "Print licensing information"},
     {0}
@@ -41,6 +54,7 @@ struct arguments {
     FILE * output;
     char * prefix;
     bool rescale;
+    char *model_file;
     char **files;
 };
 
@@ -50,6 +64,7 @@ static struct arguments args = {
     .output = NULL,
     .prefix = "",
     .rescale = true,
+    .model_file = NULL,
     .files = NULL
 };
 
@@ -82,6 +97,20 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state) {
     case 2:
         args.rescale = false;
         break;
+    case 3:
+        args.model_file = arg;
+        break;
+    #if defined(_OPENMP)
+    case '#':
+        {
+            int nthread = atoi(arg);
+            const int maxthread = omp_get_max_threads();
+            if(nthread < 1){nthread = 1;}
+            if(nthread > maxthread){nthread = maxthread;}
+            omp_set_num_threads(nthread);
+        }
+        break;
+    #endif
     case 10:
     case 11:
         ret = fputs(scrappie_licence_text, stdout);
@@ -106,23 +135,61 @@ static error_t parse_arg(int key, char *arg, struct argp_state *state) {
 static struct argp argp = { options, parse_arg, args_doc, doc };
 
 
-static scrappie_matrix sequence_to_squiggle(char const * base_seq, size_t n, bool rescale, enum squiggle_model_type squiggle_model){
-    RETURN_NULL_IF(NULL == base_seq, NULL);
+/**  Sequences read and predicted together
+ **/
+typedef struct {
+    size_t n;
+    size_t nbase;
+    char * name[SQUIGGLE_BLOCK];
+    char * seq[SQUIGGLE_BLOCK];
+    size_t seqlen[SQUIGGLE_BLOCK];
+} squiggle_block;
 
-    int * sequence = encode_bases_to_integers(base_seq, n, 1);
-    RETURN_NULL_IF(NULL == sequence, NULL);
 
-    squiggle_function_ptr squiggle_function = get_squiggle_function(squiggle_model);
+static char * copy_string(const char * str, size_t n) {
+    char * copy = calloc(n + 1, sizeof(char));
+    RETURN_NULL_IF(NULL == copy, NULL);
+    memcpy(copy, str, n);
+    return copy;
+}
 
-    scrappie_matrix squiggle = squiggle_function(sequence, n, rescale);
-    free(sequence);
 
-    return squiggle;
+/**  Predict squiggles of a block of sequences, writing them in order
+ **/
+static void predict_block(squiggle_block * block) {
+    if (0 == block->n) {
+        return;
+    }
+    scrappie_matrix * squiggle = sequence_to_squiggle_batch((char const * const *)block->seq, block->seqlen,
+                                                            block->n, args.rescale, args.model_type);
+    for (size_t r = 0; r < block->n; r++) {
+        if (NULL != squiggle && NULL != squiggle[r]) {
+            fprintf(args.output, "#%s\n", block->name[r]);
+            fprintf(args.output, "pos\tbase\tcurrent\tsd\tdwell\n");
+            for(size_t i=0 ; i < squiggle[r]->nc ; i++){
+                const size_t offset = i * squiggle[r]->stride;
+                fprintf(args.output, "%zu\t%c\t%3.6f\t%3.6f\t%3.6f\n", i, block->seq[r][i],
+                        squiggle[r]->data.f[offset + 0],
+                        squiggle[r]->data.f[offset + 1],
+                        squiggle[r]->data.f[offset + 2]);
+            }
+            squiggle[r] = free_scrappie_matrix(squiggle[r]);
+        }
+        free(block->name[r]);
+        free(block->seq[r]);
+    }
+    free(squiggle);
+    block->n = 0;
+    block->nbase = 0;
 }
 
 
 int main_squiggle(int argc, char *argv[]) {
     argp_parse(&argp, argc, argv, 0, 0, NULL);
+    if(NULL != args.model_file
+       && !load_model_weights(args.model_file, squiggle_model_string(args.model_type))){
+        errx(EXIT_FAILURE, "Failed to load model file \"%s\"", args.model_file);
+    }
     if(NULL == args.output){
         args.output = stdout;
     }
@@ -133,6 +200,11 @@ int main_squiggle(int argc, char *argv[]) {
 
     int reads_started = 0;
     const int reads_limit = args.limit;
+    //  Sequences read are predicted in blocks, packed into batches predicted in parallel
+    squiggle_block * block = calloc(1, sizeof(squiggle_block));
+    if(NULL == block){
+        errx(EXIT_FAILURE, "Failed to allocate memory for sequences");
+    }
 
     for (int fn = 0; fn < nfile; fn++) {
         if (reads_limit > 0 && reads_started >= reads_limit) {
@@ -152,24 +224,29 @@ int main_squiggle(int argc, char *argv[]) {
             }
             reads_started += 1;
 
-            scrappie_matrix squiggle = sequence_to_squiggle(seq->seq.s, seq->seq.l, args.rescale, args.model_type);
-            if(NULL != squiggle){
-                fprintf(args.output, "#%s\n", seq->name.s);
-                fprintf(args.output, "pos\tbase\tcurrent\tsd\tdwell\n");
-                for(size_t i=0 ; i < squiggle->nc ; i++){
-                    const size_t offset = i * squiggle->stride;
-                    fprintf(args.output, "%zu\t%c\t%3.6f\t%3.6f\t%3.6f\n", i, seq->seq.s[i],
-                            squiggle->data.f[offset + 0],
-                            squiggle->data.f[offset + 1],
-                            squiggle->data.f[offset + 2]);
-                }
-                squiggle = free_scrappie_matrix(squiggle);
+            const size_t r = block->n;
+            block->name[r] = copy_string(seq->name.s, seq->name.l);
+            block->seq[r] = copy_string(seq->seq.s, seq->seq.l);
+            if(NULL == block->name[r] || NULL == block->seq[r]){
+                free(block->name[r]);
+                free(block->seq[r]);
+                warnx("Failed to allocate memory for sequence \"%s\"", seq->name.s);
+                continue;
+            }
+            block->seqlen[r] = seq->seq.l;
+            block->n += 1;
+            block->nbase += seq->seq.l;
+            if(SQUIGGLE_BLOCK == block->n || block->nbase >= SQUIGGLE_BLOCK_BASES){
+                predict_block(block);
             }
         }
 
         kseq_destroy(seq);
         fclose(fh);
     }
+    predict_block(block);
+    free(block);
+    unload_model_weights();
 
     return EXIT_SUCCESS;
 }
@@ -38,5 +38,5 @@
 
 
 //  strlen on NULL is undefined.  Define it.
-#    define strlen(A) (NULL != A) ? strlen(A) : 0
+#    define strlen(A) ((NULL != (A)) ? strlen(A) : 0)
 #endif /* SCRAPPIE_STDLIB */
@@ -3,6 +3,7 @@
 #    define SCRAPPIE_STRUCTURES_H
 
 #    include <inttypes.h>
+#    include <stdbool.h>
 #    include <stddef.h>
 
 typedef struct {
@@ -27,6 +28,14 @@ typedef struct {
     size_t start;
     size_t end;
     float *raw;
+    //  Native ADC values, used in place of raw when raw is NULL.  Sample i
+    //  of the signal is (sample[i] + offset) * unit
+    int16_t *sample;
+    float offset;
+    float unit;
+    //  Whether offset and unit also apply to raw, so sample i of the signal
+    //  is (raw[i] + offset) * unit.  Set by medmad_normalise_raw
+    bool scaled;
 } raw_table;
 
 #endif                          /* SCRAPPIE_DATA_H */
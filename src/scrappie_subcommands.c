@@ -31,6 +31,21 @@ enum scrappie_mode get_scrappie_mode(const char *modestr) {
     if (0 == strcmp(modestr, "event_table")){
         return SCRAPPIE_MODE_EVENT_TABLE;
     }
+    if (0 == strcmp(modestr, "convdecode")){
+        return SCRAPPIE_MODE_CONVDECODE;
+    }
+    if (0 == strcmp(modestr, "simulate")){
+        return SCRAPPIE_MODE_SIMULATE;
+    }
+    if (0 == strcmp(modestr, "serve")){
+        return SCRAPPIE_MODE_SERVE;
+    }
+    if (0 == strcmp(modestr, "redecode")){
+        return SCRAPPIE_MODE_REDECODE;
+    }
+    if (0 == strcmp(modestr, "pack")){
+        return SCRAPPIE_MODE_PACK;
+    }
 
     return SCRAPPIE_MODE_INVALID;
 }
@@ -55,6 +70,16 @@ const char *scrappie_mode_string(const enum scrappie_mode mode) {
         return "seqmappy";
     case SCRAPPIE_MODE_EVENT_TABLE:
         return "event_table";
+    case SCRAPPIE_MODE_CONVDECODE:
+        return "convdecode";
+    case SCRAPPIE_MODE_SIMULATE:
+        return "simulate";
+    case SCRAPPIE_MODE_SERVE:
+        return "serve";
+    case SCRAPPIE_MODE_REDECODE:
+        return "redecode";
+    case SCRAPPIE_MODE_PACK:
+        return "pack";
     case SCRAPPIE_MODE_INVALID:
         errx(EXIT_FAILURE, "Invalid scrappie mode\n");
     default:
@@ -84,6 +109,16 @@ const char *scrappie_mode_description(const enum scrappie_mode mode) {
         return "Map signal to sequence via basecall posteriors";
     case SCRAPPIE_MODE_EVENT_TABLE:
         return "Output table of events for read";
+    case SCRAPPIE_MODE_CONVDECODE:
+        return "Decode convolutionally coded message from raw signal";
+    case SCRAPPIE_MODE_SIMULATE:
+        return "Simulate raw signal for sequence";
+    case SCRAPPIE_MODE_SERVE:
+        return "Basecall raw signal sent by clients over a socket";
+    case SCRAPPIE_MODE_REDECODE:
+        return "Decode stored posteriors again with many sets of decoding parameters";
+    case SCRAPPIE_MODE_PACK:
+        return "Pack references two bits to a base for mapping";
     case SCRAPPIE_MODE_INVALID:
         errx(EXIT_FAILURE, "Invalid scrappie mode\n");
     default:
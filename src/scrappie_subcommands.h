@@ -16,6 +16,11 @@ enum scrappie_mode {SCRAPPIE_MODE_EVENTS = 0,
                     SCRAPPIE_MODE_MAPPY,
                     SCRAPPIE_MODE_SEQMAPPY,
                     SCRAPPIE_MODE_EVENT_TABLE,
+                    SCRAPPIE_MODE_CONVDECODE,
+                    SCRAPPIE_MODE_SIMULATE,
+                    SCRAPPIE_MODE_SERVE,
+                    SCRAPPIE_MODE_REDECODE,
+                    SCRAPPIE_MODE_PACK,
                     SCRAPPIE_MODE_INVALID };
 static const enum scrappie_mode scrappie_ncommand = SCRAPPIE_MODE_INVALID;
 
@@ -25,14 +30,19 @@ const char *scrappie_mode_description(const enum scrappie_mode mode);
 int fprint_scrappie_commands(FILE * fp, bool header);
 
 // Main routines for subcommands
+int main_convdecode(int argc, char *argv[]);
 int main_events(int argc, char *argv[]);
 int main_event_table(int argc, char *argv[]);
 int main_help(int argc, char *argv[]);
 int main_help_short(void);
 int main_licence(int argc, char *argv[]);
 int main_mappy(int argc, char * argv[]);
+int main_pack(int argc, char * argv[]);
 int main_raw(int argc, char *argv[]);
+int main_redecode(int argc, char * argv[]);
 int main_seqmappy(int argc, char * argv[]);
+int main_serve(int argc, char * argv[]);
+int main_simulate(int argc, char * argv[]);
 int main_squiggle(int argc, char * argv[]);
 int main_version(int argc, char *argv[]);
 
@@ -0,0 +1,207 @@
+#include <assert.h>
+#include <math.h>
+#include <string.h>
+
+#include "scrappie_stdlib.h"
+#include "simulate.h"
+
+//  Not defined by math.h in strict C99
+static const double simulate_pi = 3.14159265358979323846;
+static const double simulate_sqrt2 = 1.41421356237309504880;
+
+/**  Next value of splitmix64 generator
+ **/
+static uint64_t rng_next(uint64_t * state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+//  Uniform on the open interval (0, 1)
+static double rng_uniform(uint64_t * state) {
+    return ((rng_next(state) >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+static double rng_normal(uint64_t * state) {
+    const double u1 = rng_uniform(state);
+    const double u2 = rng_uniform(state);
+    return sqrt(-2.0 * log(u1)) * cos(2.0 * simulate_pi * u2);
+}
+
+//  Laplace with unit scale, by inverting its distribution function
+static double rng_laplace(uint64_t * state) {
+    const double u = rng_uniform(state) - 0.5;
+    return (u < 0.0) ? log1p(2.0 * u) : -log1p(-2.0 * u);
+}
+
+static double rng_poisson(uint64_t * state, double mean) {
+    if (mean > 30.0) {
+        //  Normal approximation is good and takes constant time
+        const double x = round(mean + sqrt(mean) * rng_normal(state));
+        return (x > 0.0) ? x : 0.0;
+    }
+    const double limit = exp(-mean);
+    double k = 0.0;
+    double p = rng_uniform(state);
+    while (p > limit) {
+        k += 1.0;
+        p *= rng_uniform(state);
+    }
+    return k;
+}
+
+//  Gamma with unit scale by Marsaglia and Tsang's method
+static double rng_gamma(uint64_t * state, double shape) {
+    if (shape < 1.0) {
+        return rng_gamma(state, shape + 1.0) * pow(rng_uniform(state), 1.0 / shape);
+    }
+    const double d = shape - 1.0 / 3.0;
+    const double c = 1.0 / sqrt(9.0 * d);
+    while (true) {
+        double x, v;
+        do {
+            x = rng_normal(state);
+            v = 1.0 + c * x;
+        } while (v <= 0.0);
+        v = v * v * v;
+        const double u = rng_uniform(state);
+        if (log(u) < 0.5 * x * x + d - d * v + d * log(v)) {
+            return d * v;
+        }
+    }
+}
+
+
+/**  Dwell distribution from its description
+ *
+ *   @param str  "fixed", "poisson", "gamma" or "gamma:shape"
+ *   @param shape  Shape of gamma distribution, set if given in str [out]
+ *
+ *   @returns Distribution or SIMULATE_DWELL_INVALID
+ **/
+enum simulate_dwell simulate_dwell_from_string(const char * str, float * shape) {
+    RETURN_NULL_IF(NULL == str, SIMULATE_DWELL_INVALID);
+    if (0 == strcmp(str, "fixed")) {
+        return SIMULATE_DWELL_FIXED;
+    }
+    if (0 == strcmp(str, "poisson")) {
+        return SIMULATE_DWELL_POISSON;
+    }
+    if (0 == strcmp(str, "gamma")) {
+        return SIMULATE_DWELL_GAMMA;
+    }
+    if (0 == strncmp(str, "gamma:", 6)) {
+        char * end = NULL;
+        const float k = strtof(str + 6, &end);
+        if (end == str + 6 || '\0' != *end || !(k > 0.0f)) {
+            return SIMULATE_DWELL_INVALID;
+        }
+        if (NULL != shape) {
+            *shape = k;
+        }
+        return SIMULATE_DWELL_GAMMA;
+    }
+    return SIMULATE_DWELL_INVALID;
+}
+
+
+enum simulate_noise simulate_noise_from_string(const char * str) {
+    RETURN_NULL_IF(NULL == str, SIMULATE_NOISE_INVALID);
+    if (0 == strcmp(str, "laplace")) {
+        return SIMULATE_NOISE_LAPLACE;
+    }
+    if (0 == strcmp(str, "gaussian")) {
+        return SIMULATE_NOISE_GAUSSIAN;
+    }
+    if (0 == strcmp(str, "none")) {
+        return SIMULATE_NOISE_NONE;
+    }
+    return SIMULATE_NOISE_INVALID;
+}
+
+
+static size_t draw_dwell(uint64_t * state, float expected, const simulate_param param) {
+    double dwell = expected;
+    switch (param.dwell) {
+    case SIMULATE_DWELL_FIXED:
+        dwell = round(expected);
+        break;
+    case SIMULATE_DWELL_POISSON:
+        dwell = rng_poisson(state, expected);
+        break;
+    case SIMULATE_DWELL_GAMMA:
+        dwell = round(rng_gamma(state, param.dwell_shape) * expected / param.dwell_shape);
+        break;
+    default:
+        errx(EXIT_FAILURE, "Invalid dwell distribution -- report bug");
+    }
+    return (dwell > param.min_dwell) ? (size_t)dwell : param.min_dwell;
+}
+
+
+/**  Simulate raw signal from a squiggle
+ *
+ *   Gaussian noise has the same variance as Laplace noise with the spread
+ *   of the position as its scale.
+ *
+ *   @param squiggle  Squiggle with transformed units, [3, npos]
+ *   @param param  Parameters of simulation
+ *   @param seed  Seed of random number generator
+ *   @param nsample  Number of samples simulated [out]
+ *
+ *   @returns Simulated signal in pA, to be freed by caller, or NULL on failure
+ **/
+float * simulate_signal(const_scrappie_matrix squiggle, const simulate_param param, uint64_t seed,
+                        size_t * nsample) {
+    RETURN_NULL_IF(NULL == squiggle, NULL);
+    RETURN_NULL_IF(NULL == nsample, NULL);
+    assert(squiggle->nr >= 3);
+    assert(param.rate > 0.0f);
+    assert(param.dwell_shape > 0.0f);
+    *nsample = 0;
+
+    const size_t npos = squiggle->nc;
+    const size_t ldp = squiggle->stride;
+    //  Mixed once so that consecutive seeds give unrelated streams
+    uint64_t state = seed;
+    state = rng_next(&state);
+
+    size_t * dwell = calloc(npos, sizeof(size_t));
+    RETURN_NULL_IF(NULL == dwell, NULL);
+    size_t n = 0;
+    for (size_t pos = 0; pos < npos; pos++) {
+        dwell[pos] = draw_dwell(&state, squiggle->data.f[pos * ldp + 2] / param.rate, param);
+        n += dwell[pos];
+    }
+
+    float * signal = calloc((n > 0) ? n : 1, sizeof(float));
+    if (NULL == signal) {
+        free(dwell);
+        return NULL;
+    }
+    const float gaussian_sd = (float)simulate_sqrt2;
+    for (size_t pos = 0, i = 0; pos < npos; pos++) {
+        const float level = param.shift + param.scale * squiggle->data.f[pos * ldp + 0];
+        const float spread = param.scale * param.noise_scale * squiggle->data.f[pos * ldp + 1];
+        for (size_t j = 0; j < dwell[pos]; j++, i++) {
+            switch (param.noise) {
+            case SIMULATE_NOISE_LAPLACE:
+                signal[i] = level + spread * (float)rng_laplace(&state);
+                break;
+            case SIMULATE_NOISE_GAUSSIAN:
+                signal[i] = level + spread * gaussian_sd * (float)rng_normal(&state);
+                break;
+            case SIMULATE_NOISE_NONE:
+                signal[i] = level;
+                break;
+            default:
+                errx(EXIT_FAILURE, "Invalid noise distribution -- report bug");
+            }
+        }
+    }
+    free(dwell);
+
+    *nsample = n;
+    return signal;
+}
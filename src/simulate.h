@@ -0,0 +1,68 @@
+#pragma once
+#ifndef SIMULATE_H
+#    define SIMULATE_H
+
+/**  Simulation of raw signal from a predicted squiggle
+ *
+ *   Each position of a squiggle, as predicted by squiggle_r94 or
+ *   squiggle_r10 with transformed units, is a current level, a spread and an
+ *   expected dwell in samples.  The signal of a position is a number of
+ *   samples drawn from the dwell distribution, each the level plus noise
+ *   whose scale is the spread.  Levels are in normalised units and mapped to
+ *   pA by an affine transform.
+ *
+ *   Random numbers come from a generator seeded per sequence so simulations
+ *   are reproducible whatever the number of threads.
+ **/
+
+#    include <stdbool.h>
+#    include <stddef.h>
+#    include <stdint.h>
+#    include "scrappie_matrix.h"
+
+enum simulate_dwell {
+    SIMULATE_DWELL_FIXED = 0,
+    SIMULATE_DWELL_POISSON,
+    SIMULATE_DWELL_GAMMA,
+    SIMULATE_DWELL_INVALID
+};
+
+enum simulate_noise {
+    SIMULATE_NOISE_LAPLACE = 0,
+    SIMULATE_NOISE_GAUSSIAN,
+    SIMULATE_NOISE_NONE,
+    SIMULATE_NOISE_INVALID
+};
+
+typedef struct {
+    enum simulate_dwell dwell;
+    //  Shape of gamma distributed dwells, larger is less variable
+    float dwell_shape;
+    //  Speed of translocation relative to the model, dividing each dwell
+    float rate;
+    size_t min_dwell;
+    enum simulate_noise noise;
+    //  Multiplier of the spread of each position
+    float noise_scale;
+    //  Signal in pA is shift + scale * level
+    float shift;
+    float scale;
+} simulate_param;
+
+static simulate_param const simulate_defaults = {
+    .dwell = SIMULATE_DWELL_FIXED,
+    .dwell_shape = 2.0f,
+    .rate = 1.0f,
+    .min_dwell = 1,
+    .noise = SIMULATE_NOISE_LAPLACE,
+    .noise_scale = 1.0f,
+    .shift = 90.0f,
+    .scale = 15.0f
+};
+
+enum simulate_dwell simulate_dwell_from_string(const char * str, float * shape);
+enum simulate_noise simulate_noise_from_string(const char * str);
+float * simulate_signal(const_scrappie_matrix squiggle, const simulate_param param, uint64_t seed,
+                        size_t * nsample);
+
+#endif                          /* SIMULATE_H */
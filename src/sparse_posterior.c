@@ -0,0 +1,176 @@
+#include <assert.h>
+#include <err.h>
+#include <stdlib.h>
+
+#include "scrappie_stdlib.h"
+#include "sparse_posterior.h"
+
+
+/**  Make sparse posterior
+ *
+ *   @param nstate  Number of states, including stay
+ *   @param nblock  Number of blocks
+ *   @param k  Number of history states kept per block, less than nstate
+ *   @param floor  Log posterior of states not kept
+ *
+ *   @returns Sparse posterior with every block empty or NULL on failure
+ **/
+sparse_posterior make_sparse_posterior(size_t nstate, size_t nblock, size_t k, float floor) {
+    assert(nstate > 1);
+    RETURN_NULL_IF(0 == k || k >= nstate, NULL);
+    sparse_posterior sp = calloc(1, sizeof(*sp));
+    RETURN_NULL_IF(NULL == sp, NULL);
+    sp->nstate = nstate;
+    sp->nblock = nblock;
+    sp->k = k;
+    sp->floor = floor;
+    sp->state = calloc(nblock * k + 1, sizeof(int));
+    sp->logpost = calloc(nblock * k + 1, sizeof(float));
+    sp->stay = calloc(nblock + 1, sizeof(float));
+    if (NULL == sp->state || NULL == sp->logpost || NULL == sp->stay) {
+        warnx("Failed to allocate memory for sparse posterior");
+        return free_sparse_posterior(sp);
+    }
+    return sp;
+}
+
+
+sparse_posterior free_sparse_posterior(sparse_posterior sp) {
+    if (NULL != sp) {
+        free(sp->stay);
+        free(sp->logpost);
+        free(sp->state);
+        free(sp);
+    }
+    return NULL;
+}
+
+
+/**  Set block of sparse posterior from a dense column
+ *
+ *   Keeps the k history states with greatest log posterior, ties to the
+ *   lower state, sorted most probable first.
+ *
+ *   @param sp  Sparse posterior to update
+ *   @param blk  Block to set
+ *   @param logpost  Dense log posterior of block [nstate]
+ **/
+void sparse_posterior_set_block(sparse_posterior sp, size_t blk, float const * logpost) {
+    RETURN_NULL_IF(NULL == sp, );
+    RETURN_NULL_IF(NULL == logpost, );
+    assert(blk < sp->nblock);
+
+    const size_t k = sp->k;
+    const size_t nhistory = sp->nstate - 1;
+    int * state = sp->state + blk * k;
+    float * val = sp->logpost + blk * k;
+    //  Insertion into sorted list, states are visited in increasing order so
+    //  a state only displaces those strictly less probable
+    for (size_t i = 0; i < k; i++) {
+        state[i] = i;
+        val[i] = logpost[i];
+    }
+    for (size_t i = 1; i < k; i++) {
+        for (size_t j = i; j > 0 && val[j] > val[j - 1]; j--) {
+            const float tmpv = val[j];
+            val[j] = val[j - 1];
+            val[j - 1] = tmpv;
+            const int tmps = state[j];
+            state[j] = state[j - 1];
+            state[j - 1] = tmps;
+        }
+    }
+    for (size_t st = k; st < nhistory; st++) {
+        if (logpost[st] <= val[k - 1]) {
+            continue;
+        }
+        size_t j = k - 1;
+        for (; j > 0 && logpost[st] > val[j - 1]; j--) {
+            val[j] = val[j - 1];
+            state[j] = state[j - 1];
+        }
+        val[j] = logpost[st];
+        state[j] = st;
+    }
+    sp->stay[blk] = logpost[nhistory];
+}
+
+
+/**  Sparse posterior from dense log posterior
+ *
+ *   @param logpost  Log posterior, one column per block
+ *   @param k  Number of history states to keep per block
+ *   @param floor  Log posterior of states not kept
+ *
+ *   @returns Sparse posterior or NULL on failure
+ **/
+sparse_posterior sparse_posterior_from_matrix(const_scrappie_matrix logpost, size_t k, float floor) {
+    RETURN_NULL_IF(NULL == logpost, NULL);
+    sparse_posterior sp = make_sparse_posterior(logpost->nr, logpost->nc, k, floor);
+    RETURN_NULL_IF(NULL == sp, NULL);
+    for (size_t blk = 0; blk < logpost->nc; blk++) {
+        sparse_posterior_set_block(sp, blk, logpost->data.f + blk * logpost->stride);
+    }
+    return sp;
+}
+
+
+/**  Dense log posterior for a range of blocks of a sparse posterior
+ *
+ *   @param sp  Sparse posterior
+ *   @param blk_start  First block to expand
+ *   @param nblk  Number of blocks to expand
+ *   @param C  Matrix to reuse or NULL
+ *
+ *   @returns Matrix [nstate, nblk] of log posteriors or NULL on failure
+ **/
+scrappie_matrix sparse_posterior_to_matrix(const_sparse_posterior sp, size_t blk_start, size_t nblk,
+                                           scrappie_matrix C) {
+    RETURN_NULL_IF(NULL == sp, NULL);
+    assert(blk_start + nblk <= sp->nblock);
+    C = remake_scrappie_matrix(C, sp->nstate, nblk);
+    RETURN_NULL_IF(NULL == C, NULL);
+
+    const size_t k = sp->k;
+    const size_t nhistory = sp->nstate - 1;
+    for (size_t c = 0; c < nblk; c++) {
+        const size_t blk = blk_start + c;
+        float * col = C->data.f + c * C->stride;
+        for (size_t st = 0; st < nhistory; st++) {
+            col[st] = sp->floor;
+        }
+        for (size_t i = 0; i < k; i++) {
+            col[sp->state[blk * k + i]] = sp->logpost[blk * k + i];
+        }
+        col[nhistory] = sp->stay[blk];
+    }
+    return C;
+}
+
+
+/**  Log posterior of a state at a block
+ **/
+float sparse_posterior_value(const_sparse_posterior sp, size_t blk, size_t state) {
+    assert(NULL != sp);
+    assert(blk < sp->nblock);
+    assert(state < sp->nstate);
+    if (sp->nstate - 1 == state) {
+        return sp->stay[blk];
+    }
+    const size_t k = sp->k;
+    for (size_t i = 0; i < k; i++) {
+        if (sp->state[blk * k + i] == (int)state) {
+            return sp->logpost[blk * k + i];
+        }
+    }
+    return sp->floor;
+}
+
+
+/**  Bytes of memory used by sparse posterior
+ **/
+size_t sparse_posterior_size(const_sparse_posterior sp) {
+    RETURN_NULL_IF(NULL == sp, 0);
+    return sizeof(*sp) + sp->nblock * sp->k * (sizeof(int) + sizeof(float))
+        + sp->nblock * sizeof(float);
+}
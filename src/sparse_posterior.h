@@ -0,0 +1,43 @@
+#pragma once
+#ifndef SPARSE_POSTERIOR_H
+#    define SPARSE_POSTERIOR_H
+
+/**  Sparse posterior for transducer models
+ *
+ *   Most of the posterior mass of each block sits in a handful of the 1025
+ *   states of a transducer model.  Rather than the dense log-posterior, only
+ *   the k most probable history states of each block are kept, along with the
+ *   stay (the last state) which is always needed by the decoders.  All other
+ *   states are taken to have log-posterior floor, the log of the minimum
+ *   probability used by robustlog_activation_inplace.
+ **/
+
+#    include <stdbool.h>
+#    include <stddef.h>
+#    include "scrappie_matrix.h"
+
+typedef struct {
+    size_t nstate, nblock, k;
+    //  Log posterior of states not kept
+    float floor;
+    //  Kept history states of each block, most probable first, and their log
+    //  posteriors.  Both [nblock * k], block major.
+    int * state;
+    float * logpost;
+    //  Log posterior of stay for each block [nblock]
+    float * stay;
+} _SparsePost;
+
+typedef _SparsePost *sparse_posterior;
+typedef _SparsePost const *const_sparse_posterior;
+
+sparse_posterior make_sparse_posterior(size_t nstate, size_t nblock, size_t k, float floor);
+sparse_posterior free_sparse_posterior(sparse_posterior sp);
+void sparse_posterior_set_block(sparse_posterior sp, size_t blk, float const * logpost);
+sparse_posterior sparse_posterior_from_matrix(const_scrappie_matrix logpost, size_t k, float floor);
+scrappie_matrix sparse_posterior_to_matrix(const_sparse_posterior sp, size_t blk_start, size_t nblk,
+                                           scrappie_matrix C);
+float sparse_posterior_value(const_sparse_posterior sp, size_t blk, size_t state);
+size_t sparse_posterior_size(const_sparse_posterior sp);
+
+#endif                          /* SPARSE_POSTERIOR_H */
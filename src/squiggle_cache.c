@@ -0,0 +1,201 @@
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "scrappie_stdlib.h"
+#include "squiggle_cache.h"
+
+//  Longest path of cache file, including directory
+#define SQUIGGLE_CACHE_PATH_LEN 4096
+
+
+/**  FNV-1a hash of model, units flag and sequence
+ *
+ *   @returns 64-bit hash
+ **/
+uint64_t squiggle_cache_hash(const char * model, char const * seq, size_t n, bool transform_units) {
+    const uint64_t prime = 1099511628211ULL;
+    uint64_t hash = 14695981039346656037ULL;
+    if (NULL != model) {
+        for (char const * c = model; '\0' != *c; c++) {
+            hash = (hash ^ (uint8_t)*c) * prime;
+        }
+    }
+    //  Separate model from sequence
+    hash = (hash ^ (transform_units ? 1 : 2)) * prime;
+    for (size_t i = 0; i < n; i++) {
+        hash = (hash ^ (uint8_t)seq[i]) * prime;
+    }
+    return hash;
+}
+
+
+/**  Path of cache file within directory
+ *
+ *   @returns true if path fitted into buffer
+ **/
+static bool cache_path(char * path, size_t len, const char * dir, const char * model, uint64_t hash) {
+    const int ret = snprintf(path, len, "%s/%s-%016llx.squiggle", dir, model, (unsigned long long)hash);
+    return ret > 0 && (size_t)ret < len;
+}
+
+
+static size_t cache_data_offset(size_t seqlen) {
+    const size_t end = sizeof(squiggle_cache_header) + seqlen;
+    return SQUIGGLE_CACHE_ALIGN * ((end + SQUIGGLE_CACHE_ALIGN - 1) / SQUIGGLE_CACHE_ALIGN);
+}
+
+
+/**  Load squiggle from cache
+ *
+ *   The cache file is mapped read-only and the matrix refers to the mapped
+ *   data, so nothing is copied.  The cached squiggle must have been
+ *   predicted by the same model, with the same units, for exactly the same
+ *   sequence.
+ *
+ *   @param dir  Cache directory
+ *   @param model  Name of squiggle model
+ *   @param seq  Sequence of bases
+ *   @param n  Length of sequence
+ *   @param transform_units  Whether squiggle parameters were transformed
+ *
+ *   @returns Cached squiggle or NULL if not in cache
+ **/
+cached_squiggle * load_cached_squiggle(const char * dir, const char * model, char const * seq, size_t n,
+                                       bool transform_units) {
+    RETURN_NULL_IF(NULL == dir, NULL);
+    RETURN_NULL_IF(NULL == model, NULL);
+    RETURN_NULL_IF(NULL == seq, NULL);
+
+    const uint64_t hash = squiggle_cache_hash(model, seq, n, transform_units);
+    char path[SQUIGGLE_CACHE_PATH_LEN];
+    RETURN_NULL_IF(!cache_path(path, SQUIGGLE_CACHE_PATH_LEN, dir, model, hash), NULL);
+
+    //  Absence from cache is not an error
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (0 != fstat(fd, &st) || (size_t)st.st_size < sizeof(squiggle_cache_header)) {
+        close(fd);
+        return NULL;
+    }
+    const size_t nbyte = st.st_size;
+    void * map = mmap(NULL, nbyte, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == map) {
+        warnx("Failed to map cached squiggle \"%s\"", path);
+        return NULL;
+    }
+
+    const squiggle_cache_header * header = map;
+    const bool valid = 0 == memcmp(header->magic, SQUIGGLE_CACHE_MAGIC, sizeof(header->magic))
+        && SQUIGGLE_CACHE_VERSION == header->version
+        && header->transform_units == transform_units
+        && header->hash == hash
+        && header->seqlen == n
+        && 0 == strncmp(header->model, model, SQUIGGLE_CACHE_MODEL_LEN)
+        && header->data_offset == cache_data_offset(n)
+        && header->nr > 0 && header->nc > 0
+        && header->stride == 4 * ((header->nr + 3) / 4)
+        && header->data_offset + header->nc * header->stride * sizeof(float) <= nbyte
+        && 0 == memcmp((const char *)map + sizeof(squiggle_cache_header), seq, n);
+    if (!valid) {
+        warnx("Cached squiggle \"%s\" does not match sequence, ignoring", path);
+        munmap(map, nbyte);
+        return NULL;
+    }
+
+    cached_squiggle * cs = calloc(1, sizeof(cached_squiggle));
+    if (NULL == cs) {
+        munmap(map, nbyte);
+        return NULL;
+    }
+    cs->map = map;
+    cs->nbyte = nbyte;
+    cs->squiggle.nr = header->nr;
+    cs->squiggle.nrq = header->stride / 4;
+    cs->squiggle.nc = header->nc;
+    cs->squiggle.stride = header->stride;
+    //  Mapping is read-only; matrix must only be used through a const_scrappie_matrix
+    cs->squiggle.data.f = (float *)((char *)map + header->data_offset);
+
+    return cs;
+}
+
+
+/**  Write squiggle to cache
+ *
+ *   The file is written under a temporary name and renamed into place so
+ *   readers never see a partial file.
+ *
+ *   @returns true on success
+ **/
+bool write_cached_squiggle(const char * dir, const char * model, char const * seq, size_t n,
+                           bool transform_units, const_scrappie_matrix squiggle) {
+    RETURN_NULL_IF(NULL == dir, false);
+    RETURN_NULL_IF(NULL == model, false);
+    RETURN_NULL_IF(NULL == seq, false);
+    RETURN_NULL_IF(NULL == squiggle, false);
+
+    const uint64_t hash = squiggle_cache_hash(model, seq, n, transform_units);
+    char path[SQUIGGLE_CACHE_PATH_LEN];
+    char tmppath[SQUIGGLE_CACHE_PATH_LEN];
+    RETURN_NULL_IF(!cache_path(path, SQUIGGLE_CACHE_PATH_LEN, dir, model, hash), false);
+    const int ret = snprintf(tmppath, SQUIGGLE_CACHE_PATH_LEN, "%s.%ld.tmp", path, (long)getpid());
+    RETURN_NULL_IF(ret <= 0 || ret >= SQUIGGLE_CACHE_PATH_LEN, false);
+
+    squiggle_cache_header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SQUIGGLE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = SQUIGGLE_CACHE_VERSION;
+    header.transform_units = transform_units;
+    header.nr = squiggle->nr;
+    header.nc = squiggle->nc;
+    header.stride = squiggle->stride;
+    header.seqlen = n;
+    header.hash = hash;
+    header.data_offset = cache_data_offset(n);
+    {
+        const size_t mlen = strlen(model);
+        memcpy(header.model, model, (mlen < SQUIGGLE_CACHE_MODEL_LEN - 1) ? mlen : SQUIGGLE_CACHE_MODEL_LEN - 1);
+    }
+
+    FILE * fh = fopen(tmppath, "wb");
+    if (NULL == fh) {
+        warnx("Failed to open \"%s\" to cache squiggle", tmppath);
+        return false;
+    }
+    const char padding[SQUIGGLE_CACHE_ALIGN] = { 0 };
+    const size_t npad = header.data_offset - sizeof(header) - n;
+    const size_t ndata = squiggle->nc * squiggle->stride;
+    bool ok = 1 == fwrite(&header, sizeof(header), 1, fh)
+        && n == fwrite(seq, sizeof(char), n, fh)
+        && npad == fwrite(padding, 1, npad, fh)
+        && ndata == fwrite(squiggle->data.f, sizeof(float), ndata, fh);
+    ok = (0 == fclose(fh)) && ok;
+    if (ok) {
+        ok = (0 == rename(tmppath, path));
+    }
+    if (!ok) {
+        warnx("Failed to write cached squiggle \"%s\"", path);
+        remove(tmppath);
+    }
+
+    return ok;
+}
+
+
+cached_squiggle * free_cached_squiggle(cached_squiggle * cs) {
+    if (NULL != cs) {
+        munmap(cs->map, cs->nbyte);
+        free(cs);
+    }
+    return NULL;
+}
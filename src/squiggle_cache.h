@@ -0,0 +1,55 @@
+#pragma once
+#ifndef SQUIGGLE_CACHE_H
+#    define SQUIGGLE_CACHE_H
+
+/**  On-disk cache of predicted squiggles
+ *
+ *   Each predicted squiggle is stored in its own file within a cache
+ *   directory, named from the model and a hash of the sequence.  A file is a
+ *   fixed size header, the sequence itself (to guard against collisions of
+ *   the hash) and the squiggle matrix in scrappie's padded layout, so a
+ *   mapped file can be used as a matrix without copying.  Values are stored
+ *   in native byte order.
+ **/
+
+#    include <stdbool.h>
+#    include <stddef.h>
+#    include <stdint.h>
+#    include "scrappie_matrix.h"
+
+#    define SQUIGGLE_CACHE_MAGIC "SCRPSQGL"
+#    define SQUIGGLE_CACHE_VERSION 1
+#    define SQUIGGLE_CACHE_ALIGN 64
+#    define SQUIGGLE_CACHE_MODEL_LEN 32
+
+//  Header of cache file, 256 bytes
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t transform_units;
+    uint64_t nr;
+    uint64_t nc;
+    uint64_t stride;
+    uint64_t seqlen;
+    uint64_t hash;
+    //  Bytes from start of file to start of matrix
+    uint64_t data_offset;
+    char model[SQUIGGLE_CACHE_MODEL_LEN];
+    char reserved[160];
+} squiggle_cache_header;
+
+typedef struct {
+    void * map;
+    size_t nbyte;
+    //  Matrix whose data are within the mapped file
+    _Mat squiggle;
+} cached_squiggle;
+
+uint64_t squiggle_cache_hash(const char * model, char const * seq, size_t n, bool transform_units);
+cached_squiggle * load_cached_squiggle(const char * dir, const char * model, char const * seq, size_t n,
+                                       bool transform_units);
+bool write_cached_squiggle(const char * dir, const char * model, char const * seq, size_t n,
+                           bool transform_units, const_scrappie_matrix squiggle);
+cached_squiggle * free_cached_squiggle(cached_squiggle * cs);
+
+#endif                          /* SQUIGGLE_CACHE_H */
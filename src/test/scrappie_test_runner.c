@@ -5,26 +5,48 @@
 int register_scrappie_util(void);
 int register_test_map_to_sequence(void);
 int register_test_skeleton(void);
+int register_test_batch(void);
+int register_test_column_file(void);
+int register_test_context(void);
+int register_test_conv_decode(void);
 int register_test_convolution(void);
 int register_test_decoding(void);
 int register_test_elu(void);
 int register_test_eventdetection(void);
 int register_test_matrix(void);
+int register_test_model_file(void);
+int register_test_network_graph(void);
+int register_test_numa(void);
+int register_test_output(void);
+int register_test_posterior_file(void);
 int register_test_signal(void);
+int register_test_simd(void);
 int register_test_squiggle(void);
+int register_test_stream(void);
 int register_test_util(void);
 
 int (*test_suites[]) (void) = {
     register_test_skeleton,
     register_scrappie_util,
+    register_test_batch,
+    register_test_column_file,
+    register_test_context,
+    register_test_conv_decode,
     register_test_convolution,
     register_test_decoding,
     register_test_elu,
     register_test_eventdetection,
     register_test_map_to_sequence,
     register_test_matrix,
+    register_test_model_file,
+    register_test_network_graph,
+    register_test_numa,
+    register_test_output,
+    register_test_posterior_file,
     register_test_signal,
+    register_test_simd,
     register_test_squiggle,
+    register_test_stream,
     register_test_util,
     NULL // Last element of array should be NULL
 };
@@ -2,6 +2,7 @@
 #include <CUnit/Basic.h>
 #include <stdbool.h>
 
+#include <banding.h>
 #include <decode.h>
 #include <layers.h>
 #include <util.h>
@@ -210,7 +211,7 @@ void test_full_band_viterbi_map_to_sequence(void){
     }
 
     float score_vit = map_to_sequence_viterbi(logpost, 0.0f, 0.0f, BIG_VAL, mapping_target, mapping_target_len, NULL);
-    float score_vitB = map_to_sequence_viterbi_banded(logpost, 0.0f, 0.0f, BIG_VAL, mapping_target, mapping_target_len, poslow, poshigh);
+    float score_vitB = map_to_sequence_viterbi_banded(logpost, 0.0f, 0.0f, BIG_VAL, mapping_target, mapping_target_len, poslow, poshigh, NULL);
     printf("vit = %f vitB = %f\n", score_vit, score_vitB);
     CU_ASSERT_DOUBLE_EQUAL(score_vit, score_vitB, 1e-3);
 
@@ -266,7 +267,7 @@ void test_relaxed_band_helper(float local_pen, int32_t band){
     }
 
     float score_vit = map_to_sequence_viterbi(logpost, 0.0f, 0.0f, local_pen, mapping_target, mapping_target_len, NULL);
-    float score_vitB = map_to_sequence_viterbi_banded(logpost, 0.0f, 0.0f, local_pen, mapping_target, mapping_target_len, poslow, poshigh);
+    float score_vitB = map_to_sequence_viterbi_banded(logpost, 0.0f, 0.0f, local_pen, mapping_target, mapping_target_len, poslow, poshigh, NULL);
     printf("vit = %f vitB = %f\n", score_vit, score_vitB);
     CU_ASSERT_DOUBLE_EQUAL(score_vit, score_vitB, 1e-3);
 
@@ -336,6 +337,168 @@ void test_tight_band_forward_map_to_sequence(void){
     logpost = free_scrappie_matrix(logpost);
 }
 
+void test_fixed_viterbi_helper(float local_pen){
+    scrappie_matrix logpost = read_scrappie_matrix(posteriorfile);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(logpost);
+    log_activation_inplace(logpost);
+
+    const size_t nblock = logpost->nc;
+    int * path = calloc(nblock, sizeof(int));
+    int * path_fixed = calloc(nblock, sizeof(int));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(path);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(path_fixed);
+
+    float score_vit = map_to_sequence_viterbi(logpost, 0.0f, 0.0f, local_pen, mapping_target, mapping_target_len, path);
+    float score_fixed = map_to_sequence_viterbi_fixed(logpost, 0.0f, 0.0f, local_pen, mapping_target, mapping_target_len, path_fixed);
+    printf("vit = %f fixed = %f\n", score_vit, score_fixed);
+    CU_ASSERT_EQUAL(score_vit, score_fixed);
+    CU_ASSERT_TRUE(equality_arrayi(path, path_fixed, nblock));
+
+    free(path_fixed);
+    free(path);
+    logpost = free_scrappie_matrix(logpost);
+}
+
+void test_fixed_viterbi_map_to_sequence(void){
+    test_fixed_viterbi_helper(BIG_VAL);
+}
+
+void test_fixed_viterbi_with_local_map_to_sequence(void){
+    test_fixed_viterbi_helper(test_local_pen);
+}
+
+void test_banded_path_helper(float local_pen){
+    scrappie_matrix logpost = read_scrappie_matrix(posteriorfile);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(logpost);
+    log_activation_inplace(logpost);
+
+    const size_t nblock = logpost->nc;
+    const size_t band = 5;
+    size_t * poslow = calloc(nblock, sizeof(size_t));
+    size_t * poshigh = calloc(nblock, sizeof(size_t));
+    int * path = calloc(nblock, sizeof(int));
+    int * path_banded = calloc(nblock, sizeof(int));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(poslow);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(poshigh);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(path);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(path_banded);
+    for(size_t i=0 ; i < nblock ; i++){
+        poslow[i] = (tightlow[i] > band) ? (tightlow[i] - band) : 0;
+        poshigh[i] = imin(tightlow[i] + band, mapping_target_len);
+    }
+
+    float score_vit = map_to_sequence_viterbi(logpost, 0.0f, 0.0f, local_pen, mapping_target, mapping_target_len, path);
+    float score_vitB = map_to_sequence_viterbi_banded(logpost, 0.0f, 0.0f, local_pen, mapping_target, mapping_target_len,
+                                                      poslow, poshigh, path_banded);
+    printf("vit = %f vitB = %f\n", score_vit, score_vitB);
+    CU_ASSERT_EQUAL(score_vit, score_vitB);
+    CU_ASSERT_TRUE(equality_arrayi(path, path_banded, nblock));
+
+    free(path_banded);
+    free(path);
+    free(poshigh);
+    free(poslow);
+    logpost = free_scrappie_matrix(logpost);
+}
+
+void test_banded_path_viterbi_map_to_sequence(void){
+    test_banded_path_helper(BIG_VAL);
+}
+
+void test_banded_path_with_local_viterbi_map_to_sequence(void){
+    test_banded_path_helper(test_local_pen);
+}
+
+void test_band_from_seed_map_to_sequence(void){
+    scrappie_matrix logpost = read_scrappie_matrix(posteriorfile);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(logpost);
+    log_activation_inplace(logpost);
+
+    const size_t nblock = logpost->nc;
+    int * seedpos = calloc(nblock, sizeof(int));
+    size_t * poslow = calloc(nblock, sizeof(size_t));
+    size_t * poshigh = calloc(nblock, sizeof(size_t));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(seedpos);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(poslow);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(poshigh);
+    //  Seed is offset from the true path, as from an imperfect basecall
+    for(size_t i=0 ; i < nblock ; i++){
+        seedpos[i] = (int)tightlow[i] + 2;
+    }
+
+    CU_ASSERT_TRUE(band_from_seed_positions(seedpos, nblock, mapping_target_len, 5, poslow, poshigh));
+    CU_ASSERT_EQUAL(poslow[0], 0);
+    CU_ASSERT_EQUAL(poshigh[nblock - 1], mapping_target_len);
+
+    float score_vit = map_to_sequence_viterbi(logpost, 0.0f, 0.0f, BIG_VAL, mapping_target, mapping_target_len, NULL);
+    float score_vitB = map_to_sequence_viterbi_banded(logpost, 0.0f, 0.0f, BIG_VAL, mapping_target, mapping_target_len,
+                                                      poslow, poshigh, NULL);
+    printf("vit = %f vitB = %f\n", score_vit, score_vitB);
+    CU_ASSERT_DOUBLE_EQUAL(score_vit, score_vitB, 1e-3);
+
+    //  Wild seeds are tidied into a sane band
+    for(size_t i=0 ; i < nblock ; i++){
+        seedpos[i] = (i % 2) ? -100 : 1000;
+    }
+    CU_ASSERT_TRUE(band_from_seed_positions(seedpos, nblock, mapping_target_len, 5, poslow, poshigh));
+
+    free(poshigh);
+    free(poslow);
+    free(seedpos);
+    logpost = free_scrappie_matrix(logpost);
+}
+
+void test_seed_positions_from_basecall(void){
+    const char bases[] = "ACGT";
+    const size_t nbase = 2000;
+    const size_t nblock = 4000;
+    //  Basecall is bases 100 to 1900 with 20 bases deleted from 1000
+    const size_t call_start = 100;
+    const size_t del_start = 1000;
+    const size_t del_len = 20;
+    const size_t ncall = 1800 - del_len;
+
+    char * seq = calloc(nbase + 1, sizeof(char));
+    char * basecall = calloc(ncall + 1, sizeof(char));
+    int * callpos = calloc(nblock, sizeof(int));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(seq);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(basecall);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(callpos);
+    uint32_t state = 1;
+    for(size_t i=0 ; i < nbase ; i++){
+        state = 1664525 * state + 1013904223;
+        seq[i] = bases[state >> 30];
+    }
+    for(size_t i=0, j=call_start ; i < ncall ; i++, j++){
+        if(del_start == j){
+            j += del_len;
+        }
+        basecall[i] = seq[j];
+    }
+    for(size_t blk=0 ; blk < nblock ; blk++){
+        callpos[blk] = (blk * ncall) / nblock;
+    }
+
+    int * seedpos = seed_positions_from_basecall(basecall, callpos, nblock, seq, nbase, 12);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(seedpos);
+    for(size_t blk=0 ; blk < nblock ; blk++){
+        const int p = callpos[blk];
+        const int expected = call_start + p + ((call_start + p >= del_start) ? del_len : 0);
+        CU_ASSERT_TRUE(abs(seedpos[blk] - expected) <= (int)del_len);
+    }
+    CU_ASSERT_EQUAL(seedpos[0], call_start);
+    CU_ASSERT_EQUAL(seedpos[nblock - 1], call_start + callpos[nblock - 1] + del_len);
+
+    //  No anchors in an unrelated sequence
+    int * noseed = seed_positions_from_basecall(basecall, callpos, nblock, "ACGTACGTACGTACGTACGT", 20, 12);
+    CU_ASSERT_PTR_NULL(noseed);
+
+    free(seedpos);
+    free(callpos);
+    free(basecall);
+    free(seq);
+}
+
 
 static test_with_description tests[] = {
     {"Test assumptions about bounds -- not null", test_bounds_not_null_map_to_sequence},
@@ -357,6 +520,12 @@ static test_with_description tests[] = {
     {"Test mapping -- Viterbi with relaxed band3 equals Viterbi, local pen", test_relaxed_band3_with_local_viterbi_map_to_sequence},
     {"Test mapping -- Viterbi with relaxed band4 equals Viterbi, local pen", test_relaxed_band4_with_local_viterbi_map_to_sequence},
     {"Test mapping -- Viterbi with relaxed band5 equals Viterbi, local pen", test_relaxed_band5_with_local_viterbi_map_to_sequence},
+    {"Test mapping -- fixed-point Viterbi equals Viterbi", test_fixed_viterbi_map_to_sequence},
+    {"Test mapping -- fixed-point Viterbi equals Viterbi, local pen", test_fixed_viterbi_with_local_map_to_sequence},
+    {"Test mapping -- banded Viterbi path equals Viterbi path", test_banded_path_viterbi_map_to_sequence},
+    {"Test mapping -- banded Viterbi path equals Viterbi path, local pen", test_banded_path_with_local_viterbi_map_to_sequence},
+    {"Test mapping -- band from seed positions", test_band_from_seed_map_to_sequence},
+    {"Test mapping -- seed positions from basecall", test_seed_positions_from_basecall},
     {0}};
 
 /**   Register tests with CUnit
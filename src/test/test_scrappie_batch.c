@@ -0,0 +1,218 @@
+#include <CUnit/Basic.h>
+#include <err.h>
+#include <math.h>
+#include <stdbool.h>
+
+#include "layers.h"
+#include "networks.h"
+#include "scrappie_structures.h"
+#include "scrappie_util.h"
+#include "test_common.h"
+#include "util.h"
+
+static const char normsignalfile[] = "normalised_signal.crp";
+
+#define NBATCH 3
+//  Reads of differing lengths, taken from different parts of the signal
+static const size_t batch_start[NBATCH] = {0, 7000, 20000};
+static const size_t batch_len[NBATCH] = {6000, 10001, 2999};
+
+static scrappie_matrix normsignal = NULL;
+static float * normsig_arr = NULL;
+
+
+/**  Initialise test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int init_test_batch(void) {
+    normsignal = read_scrappie_matrix(normsignalfile);
+    if(NULL == normsignal){
+        return 1;
+    }
+    normsig_arr = array_from_scrappie_matrix(normsignal);
+    if(NULL == normsig_arr){
+        return 1;
+    }
+
+    return 0;
+}
+
+/**  Clean up after test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int clean_test_batch(void) {
+    free(normsig_arr);
+    normsignal = free_scrappie_matrix(normsignal);
+    return 0;
+}
+
+
+void test_batch_equivalent_helper(enum raw_model_type model){
+    const float min_prob = 1e-5;
+    raw_table rt[NBATCH];
+    for(size_t i=0 ; i < NBATCH ; i++){
+        CU_ASSERT_FATAL(batch_start[i] + batch_len[i] <= normsignal->nc);
+        rt[i] = (raw_table){NULL, batch_len[i], 0, batch_len[i], normsig_arr + batch_start[i]};
+    }
+
+    posterior_function_ptr calcpost = get_posterior_function(model);
+    posterior_batch_function_ptr calcpost_batch = get_posterior_batch_function(model);
+
+    scrappie_matrix * post_batch = calcpost_batch(rt, NBATCH, min_prob, 1.0f, 1.0f, true);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(post_batch);
+
+    for(size_t i=0 ; i < NBATCH ; i++){
+        scrappie_matrix post = calcpost(rt[i], min_prob, 1.0f, 1.0f, true);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(post);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(post_batch[i]);
+        CU_ASSERT_EQUAL(post->nr, post_batch[i]->nr);
+        CU_ASSERT_EQUAL(post->nc, post_batch[i]->nc);
+        CU_ASSERT_TRUE(equality_scrappie_matrix(post, post_batch[i], 1e-3));
+
+        post = free_scrappie_matrix(post);
+        post_batch[i] = free_scrappie_matrix(post_batch[i]);
+    }
+    free(post_batch);
+}
+
+
+void test_batch_rgrgr_r94_equivalent(void) {
+    test_batch_equivalent_helper(SCRAPPIE_MODEL_RGRGR_R9_4);
+}
+
+void test_batch_raw_r94_equivalent(void) {
+    test_batch_equivalent_helper(SCRAPPIE_MODEL_RAW);
+}
+
+void test_batch_rnnrf_r94_equivalent(void) {
+    test_batch_equivalent_helper(SCRAPPIE_MODEL_RNNRF_R9_4);
+}
+
+void test_batch_empty_read(void) {
+    raw_table rt[2] = {
+        {NULL, 0, 0, 0, NULL},
+        {NULL, batch_len[0], 0, batch_len[0], normsig_arr}
+    };
+
+    posterior_batch_function_ptr calcpost_batch = get_posterior_batch_function(SCRAPPIE_MODEL_RGRGR_R9_4);
+    scrappie_matrix * post_batch = calcpost_batch(rt, 2, 1e-5, 1.0f, 1.0f, true);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(post_batch);
+    CU_ASSERT_PTR_NULL(post_batch[0]);
+    CU_ASSERT_PTR_NOT_NULL(post_batch[1]);
+
+    post_batch[1] = free_scrappie_matrix(post_batch[1]);
+    free(post_batch);
+}
+
+
+void test_gru_fused_equivalent(void) {
+    //  Length spans several blocks of the fused layer, the last partially filled
+    const size_t size = 16;
+    const size_t nc = 150;
+    scrappie_matrix X = random_scrappie_matrix(size, nc, -1.0, 1.0);
+    scrappie_matrix iW = random_scrappie_matrix(size, 3 * size, -1.0, 1.0);
+    scrappie_matrix b = random_scrappie_matrix(3 * size, 1, -1.0, 1.0);
+    scrappie_matrix sW = random_scrappie_matrix(size, 2 * size, -1.0, 1.0);
+    scrappie_matrix sW2 = random_scrappie_matrix(size, size, -1.0, 1.0);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(X);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(iW);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(b);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(sW);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(sW2);
+
+    scrappie_matrix xin = feedforward_linear(X, iW, b, NULL);
+    for(int backward=0 ; backward < 2 ; backward++){
+        scrappie_matrix expected = backward ? gru_backward(xin, sW, sW2, NULL)
+                                            : gru_forward(xin, sW, sW2, NULL);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(expected);
+        scrappie_matrix fused = backward ? gru_backward_fused(X, iW, b, sW, sW2, false, NULL)
+                                         : gru_forward_fused(X, iW, b, sW, sW2, false, NULL);
+        CU_ASSERT(equality_scrappie_matrix(expected, fused, 1e-5));
+
+        //  Residual output written over a copy of the input
+        residual_inplace(X, expected);
+        fused = free_scrappie_matrix(fused);
+        fused = copy_scrappie_matrix(X);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(fused);
+        fused = backward ? gru_backward_fused(fused, iW, b, sW, sW2, true, fused)
+                         : gru_forward_fused(fused, iW, b, sW, sW2, true, fused);
+        CU_ASSERT(equality_scrappie_matrix(expected, fused, 1e-5));
+
+        fused = free_scrappie_matrix(fused);
+        expected = free_scrappie_matrix(expected);
+    }
+
+    xin = free_scrappie_matrix(xin);
+    sW2 = free_scrappie_matrix(sW2);
+    sW = free_scrappie_matrix(sW);
+    b = free_scrappie_matrix(b);
+    iW = free_scrappie_matrix(iW);
+    X = free_scrappie_matrix(X);
+}
+
+
+void test_chunked_helper(enum raw_model_type model, size_t chunk_size, size_t overlap,
+                         float tol){
+    const float min_prob = 1e-5;
+    const size_t nsample = 20001;
+    CU_ASSERT_FATAL(nsample <= normsignal->nc);
+    raw_table rt = {NULL, nsample, 0, nsample, normsig_arr};
+
+    posterior_function_ptr calcpost = get_posterior_function(model);
+    scrappie_matrix post = calcpost(rt, min_prob, 1.0f, 1.0f, true);
+    scrappie_matrix post_chunked = chunked_posterior(model, rt, chunk_size, overlap, min_prob, 1.0f, 1.0f, true);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(post);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(post_chunked);
+    CU_ASSERT_EQUAL(post->nr, post_chunked->nr);
+    CU_ASSERT_EQUAL(post->nc, post_chunked->nc);
+
+    /*  Mean absolute difference between probabilities.  Recurrent state carries
+     *  information over long distances so chunking is not exact, but blocks that
+     *  are misaligned when stitching would differ by about one or more.  */
+    double diff = 0.0;
+    for(size_t c=0 ; c < post->nc ; c++){
+        for(size_t r=0 ; r < post->nr ; r++){
+            const size_t i = c * post->stride + r;
+            diff += fabs(exp(post->data.f[i]) - exp(post_chunked->data.f[i]));
+        }
+    }
+    diff /= post->nc;
+    CU_ASSERT(diff < tol);
+
+    post = free_scrappie_matrix(post);
+    post_chunked = free_scrappie_matrix(post_chunked);
+}
+
+void test_chunked_single_chunk(void) {
+    //  Chunk larger than signal is the unchunked posterior
+    test_chunked_helper(SCRAPPIE_MODEL_RGRGR_R9_4, 1000000, 1000, 1e-6f);
+}
+
+void test_chunked_rgrgr_r94(void) {
+    test_chunked_helper(SCRAPPIE_MODEL_RGRGR_R9_4, 5000, 1500, 0.25f);
+}
+
+void test_chunked_raw_r94(void) {
+    test_chunked_helper(SCRAPPIE_MODEL_RAW, 5003, 1499, 0.25f);
+}
+
+static test_with_description tests[] = {
+    {"Batched rgrgr_r94 posterior same as unbatched", test_batch_rgrgr_r94_equivalent},
+    {"Batched raw_r94 posterior same as unbatched", test_batch_raw_r94_equivalent},
+    {"Batched rnnrf_r94 transitions same as unbatched", test_batch_rnnrf_r94_equivalent},
+    {"Empty read in batch", test_batch_empty_read},
+    {"Fused GRU layer same as projection then GRU", test_gru_fused_equivalent},
+    {"Chunked posterior with one chunk", test_chunked_single_chunk},
+    {"Chunked rgrgr_r94 posterior close to unchunked", test_chunked_rgrgr_r94},
+    {"Chunked raw_r94 posterior close to unchunked", test_chunked_raw_r94},
+    {0}};
+
+/**   Register tests with CUnit
+ *
+ *    @returns 0 on success, non-zero on failure
+ **/
+int register_test_batch(void) {
+    return scrappie_register_test_suite("Test batched posterior calculation", init_test_batch, clean_test_batch, tests);
+}
@@ -0,0 +1,171 @@
+// Needed for mkstemp and fdopen
+#define BANANA 1
+#define _DEFAULT_SOURCE
+#define _POSIX_SOURCE 1
+
+#include <CUnit/Basic.h>
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "column_file.h"
+#include "test_common.h"
+
+static char column_tmpfile_name[] = "scrappie_column_file_XXXXXX";
+
+#define NEVENT 37
+static event_t events[NEVENT];
+static const char * summary_read[3] = {"read_one.fast5", "read_two.fast5", "read_three.fast5"};
+
+/**  Initialise column file test
+ *
+ *   Writes a table of events and a table of summaries of three reads, two
+ *   without a known uuid, to a temporary column file
+ *
+ *  @returns 0 on success, non-zero on failure
+ **/
+int init_test_scrappie_column_file(void) {
+    for (size_t i = 0; i < NEVENT; i++) {
+        events[i] = (event_t){5 * i, 5.0f, 100.0f + i, 1.0f + 0.5f * i, i / 2, i % 7};
+    }
+    const event_table et = {NEVENT, 0, NEVENT, events};
+
+    (void)umask(022);
+    int outfileno = mkstemp(column_tmpfile_name);
+    FILE * outfile = (-1 != outfileno) ? fdopen(outfileno, "wb") : NULL;
+    if (NULL == outfile) {
+        warnx("Failed to open temporary file to write to.\n");
+        return -1;
+    }
+    output_buffer buf = {NULL, 0, 0};
+    read_summary_table summary = {0};
+    bool ok = column_batch_append_events(&buf, "read_one.fast5", et, true)
+        && write_output_buffer(outfile, &buf);
+    for (size_t i = 0; ok && i < 3; i++) {
+        ok = read_summary_add(&summary, outfile, summary_read[i], (1 == i) ? "c99357df" : NULL,
+                              1000 * (i + 1), 100 * (i + 1), 50 * (i + 1), 0.25f * i, 1.5f);
+    }
+    ok = ok && read_summary_flush(&summary, outfile);
+    read_summary_release(&summary);
+    output_buffer_release(&buf);
+    ok &= (0 == fclose(outfile));
+    return ok ? 0 : -1;
+}
+
+/**  Clean up after column file test
+ *
+ *  @returns 0 on success, non-zero on failure
+ **/
+int clean_test_scrappie_column_file(void) {
+    return remove(column_tmpfile_name);
+}
+
+void test_roundtrip_events_column_file(void) {
+    column_file * cf = open_column_file(column_tmpfile_name);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(cf);
+    CU_ASSERT_EQUAL_FATAL(cf->nbatch, 2);
+
+    const column_batch_header * batch = cf->batch[0];
+    CU_ASSERT(0 == strcmp(batch->table, "events"));
+    CU_ASSERT(0 == strcmp(batch->label, "read_one.fast5"));
+    CU_ASSERT_EQUAL_FATAL(batch->nrow, NEVENT);
+    CU_ASSERT_EQUAL(batch->ncolumn, 6);
+
+    const column_descriptor * start = column_batch_find(batch, "start");
+    const column_descriptor * mean = column_batch_find(batch, "mean");
+    const column_descriptor * state = column_batch_find(batch, "state");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(start);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(mean);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(state);
+    CU_ASSERT_PTR_NULL(column_batch_find(batch, "nonexistent"));
+    CU_ASSERT_EQUAL(start->type, COLUMN_TYPE_UINT64);
+    CU_ASSERT_EQUAL(mean->type, COLUMN_TYPE_FLOAT32);
+    CU_ASSERT_EQUAL(state->type, COLUMN_TYPE_INT32);
+
+    const uint64_t * start_values = column_batch_values(batch, start);
+    const float * mean_values = column_batch_values(batch, mean);
+    const int32_t * state_values = column_batch_values(batch, state);
+    CU_ASSERT_EQUAL((uintptr_t)start_values % COLUMN_FILE_ALIGN, 0);
+    CU_ASSERT_EQUAL((uintptr_t)mean_values % COLUMN_FILE_ALIGN, 0);
+    for (size_t i = 0; i < NEVENT; i++) {
+        CU_ASSERT_EQUAL(start_values[i], events[i].start);
+        CU_ASSERT_EQUAL(mean_values[i], events[i].mean);
+        CU_ASSERT_EQUAL(state_values[i], events[i].state);
+    }
+
+    cf = free_column_file(cf);
+}
+
+void test_roundtrip_summary_column_file(void) {
+    column_file * cf = open_column_file(column_tmpfile_name);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(cf);
+    CU_ASSERT_EQUAL_FATAL(cf->nbatch, 2);
+
+    const column_batch_header * batch = cf->batch[1];
+    CU_ASSERT(0 == strcmp(batch->table, "summary"));
+    CU_ASSERT_EQUAL_FATAL(batch->nrow, 3);
+    const column_descriptor * read = column_batch_find(batch, "read");
+    const column_descriptor * uuid = column_batch_find(batch, "uuid");
+    const column_descriptor * nbase = column_batch_find(batch, "sequence_length");
+    const column_descriptor * score = column_batch_find(batch, "normalised_score");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(read);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(uuid);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(nbase);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(score);
+    CU_ASSERT_PTR_NULL(column_batch_string(batch, nbase, 0, NULL));
+
+    const uint64_t * nbase_values = column_batch_values(batch, nbase);
+    const float * score_values = column_batch_values(batch, score);
+    for (size_t i = 0; i < 3; i++) {
+        size_t len = 0;
+        const char * str = column_batch_string(batch, read, i, &len);
+        CU_ASSERT_EQUAL(len, strlen(summary_read[i]));
+        CU_ASSERT(0 == strncmp(str, summary_read[i], len));
+        (void)column_batch_string(batch, uuid, i, &len);
+        CU_ASSERT_EQUAL(len, (1 == i) ? 8 : 0);
+        CU_ASSERT_EQUAL(nbase_values[i], 50 * (i + 1));
+        CU_ASSERT_EQUAL(score_values[i], 0.25f * i);
+    }
+    CU_ASSERT_PTR_NULL(column_batch_string(batch, read, 3, NULL));
+
+    cf = free_column_file(cf);
+}
+
+void test_truncated_column_file(void) {
+    static char truncated_name[] = "scrappie_column_trunc_XXXXXX";
+    int fd = mkstemp(truncated_name);
+    FILE * fh = (-1 != fd) ? fdopen(fd, "wb") : NULL;
+    CU_ASSERT_PTR_NOT_NULL_FATAL(fh);
+    output_buffer buf = {NULL, 0, 0};
+    const event_table et = {NEVENT, 0, NEVENT, events};
+    CU_ASSERT(column_batch_append_events(&buf, "read_one.fast5", et, false));
+    CU_ASSERT(write_output_buffer(fh, &buf));
+    output_buffer_release(&buf);
+    fclose(fh);
+    //  Lose last part of data
+    CU_ASSERT_EQUAL(truncate(truncated_name, sizeof(column_batch_header) + 100), 0);
+
+    CU_ASSERT_PTR_NULL(open_column_file(truncated_name));
+    remove(truncated_name);
+}
+
+static test_with_description tests[] = {
+    {"Column file round trip of events", test_roundtrip_events_column_file},
+    {"Column file round trip of read summaries", test_roundtrip_summary_column_file},
+    {"Truncated column file rejected", test_truncated_column_file},
+    {0}
+};
+
+/**   Register tests with CUnit
+ *
+ *    @returns 0 on success, non-zero on failure
+ **/
+int register_test_column_file(void) {
+    return scrappie_register_test_suite("Binary column files", init_test_scrappie_column_file,
+                                        clean_test_scrappie_column_file, tests);
+}
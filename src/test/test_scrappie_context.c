@@ -0,0 +1,157 @@
+#include <CUnit/Basic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "basecall_context.h"
+#include "scrappie_util.h"
+#include "test_common.h"
+
+static const char normsignalfile[] = "normalised_signal.crp";
+static const size_t read_len[] = {3000, 4500, 5000, 6000};
+#define NREAD (sizeof(read_len) / sizeof(read_len[0]))
+#define NCALL 8
+
+static scrappie_matrix normsignal = NULL;
+static float * normsig_arr = NULL;
+
+
+/**  Initialise test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int init_test_context(void) {
+    normsignal = read_scrappie_matrix(normsignalfile);
+    if (NULL == normsignal) {
+        return 1;
+    }
+    normsig_arr = array_from_scrappie_matrix(normsignal);
+    if (NULL == normsig_arr) {
+        return 1;
+    }
+    for (size_t i = 0; i < NREAD; i++) {
+        if (read_len[i] > normsignal->nc) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**  Clean up after test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int clean_test_context(void) {
+    free(normsig_arr);
+    normsignal = free_scrappie_matrix(normsignal);
+    return 0;
+}
+
+
+static void assert_same_result(const basecall_result * res, const basecall_result * expected) {
+    CU_ASSERT_PTR_NOT_NULL_FATAL(res->basecall);
+    CU_ASSERT(0 == strcmp(res->basecall, expected->basecall));
+    CU_ASSERT_DOUBLE_EQUAL(res->score, expected->score, 1e-3);
+    CU_ASSERT_EQUAL(res->nblock, expected->nblock);
+    CU_ASSERT_EQUAL(res->start, expected->start);
+    CU_ASSERT_EQUAL(res->end, expected->end);
+}
+
+
+void test_context_invalid(void) {
+    CU_ASSERT_PTR_NULL(make_basecall_context("not_a_model", NULL));
+    basecall_context_param param = basecall_context_defaults;
+    param.quality = true;
+    CU_ASSERT_PTR_NULL(make_basecall_context("rgrgr_r94", &param));
+    param = basecall_context_defaults;
+    param.nthread = 0;
+    CU_ASSERT_PTR_NULL(make_basecall_context("rgrgr_r94", &param));
+}
+
+/**  Calls made at once from many threads on one context agree with a lone call
+ **/
+void test_context_threads(void) {
+    basecall_context * context = make_basecall_context("rgrgr_r94", NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(context);
+    basecall_result expected;
+    CU_ASSERT_TRUE_FATAL(basecall_context_call(context, normsig_arr, read_len[0], &expected));
+    CU_ASSERT(strlen(expected.basecall) > 0);
+    CU_ASSERT(expected.end <= read_len[0]);
+
+    basecall_result res[NCALL];
+#pragma omp parallel for
+    for (size_t i = 0; i < NCALL; i++) {
+        (void)basecall_context_call(context, normsig_arr, read_len[0], res + i);
+    }
+    for (size_t i = 0; i < NCALL; i++) {
+        assert_same_result(res + i, &expected);
+        basecall_result_release(res + i);
+    }
+    CU_ASSERT_PTR_NULL(res[0].basecall);
+
+    basecall_result_release(&expected);
+    context = free_basecall_context(context);
+}
+
+/**  Each read of a batch, including a read missing from it, is called as alone
+ **/
+void test_context_batch_helper(const char * model, bool quality) {
+    basecall_context_param param = basecall_context_defaults;
+    param.quality = quality;
+    param.nthread = 2;
+    param.batch_size = 3;
+    basecall_context * context = make_basecall_context(model, &param);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(context);
+
+    const float * signal[NREAD + 1];
+    size_t n[NREAD + 1];
+    for (size_t i = 0; i < NREAD; i++) {
+        signal[i] = normsig_arr;
+        n[i] = read_len[i];
+    }
+    signal[NREAD] = NULL;
+    n[NREAD] = 0;
+
+    basecall_result res[NREAD + 1];
+    CU_ASSERT_EQUAL(NREAD, basecall_context_call_batch(context, signal, n, NREAD + 1, res));
+    CU_ASSERT_PTR_NULL(res[NREAD].basecall);
+    for (size_t i = 0; i < NREAD; i++) {
+        basecall_result expected;
+        CU_ASSERT_TRUE_FATAL(basecall_context_call(context, signal[i], n[i], &expected));
+        assert_same_result(res + i, &expected);
+        if (quality) {
+            CU_ASSERT_PTR_NOT_NULL_FATAL(res[i].quality);
+            CU_ASSERT_EQUAL(strlen(res[i].quality), strlen(res[i].basecall));
+        } else {
+            CU_ASSERT_PTR_NULL(res[i].quality);
+        }
+        basecall_result_release(&expected);
+        basecall_result_release(res + i);
+    }
+
+    context = free_basecall_context(context);
+}
+
+void test_context_batch_rgrgr_r94(void) {
+    test_context_batch_helper("rgrgr_r94", false);
+}
+
+void test_context_batch_rnnrf_r94(void) {
+    test_context_batch_helper("rnnrf_r94", true);
+}
+
+
+static test_with_description tests[] = {
+    {"Context not made for invalid parameters", test_context_invalid},
+    {"Calls from many threads on one context agree", test_context_threads},
+    {"Batch call agrees with single calls rgrgr_r94", test_context_batch_rgrgr_r94},
+    {"Batch call agrees with single calls rnnrf_r94, with qualities", test_context_batch_rnnrf_r94},
+    {0}};
+
+/**   Register tests with CUnit
+ *
+ *    @returns 0 on success, non-zero on failure
+ **/
+int register_test_context(void) {
+    return scrappie_register_test_suite("Reentrant basecalling context", init_test_context, clean_test_context, tests);
+}
@@ -0,0 +1,182 @@
+#include <CUnit/Basic.h>
+#include <err.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "conv_decode.h"
+#include "scrappie_util.h"
+#include "test_common.h"
+
+#define MSG_LEN 60
+
+
+/**  Initialise test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int init_test_conv_decode(void) {
+    srand(0x5eed);
+    return 0;
+}
+
+/**  Clean up after test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int clean_test_conv_decode(void) {
+    return 0;
+}
+
+/**  Random message satisfying sync markers of code
+ **/
+static void random_message(const conv_code * code, bool * msg, size_t msg_len) {
+    for (size_t i = 0; i < msg_len; i++) {
+        msg[i] = rand() & 1;
+        if (!conv_sync_allows(code, i, msg[i])) {
+            msg[i] = !msg[i];
+        }
+    }
+}
+
+/**  CRF transitions favouring the path emitting bases, with blanks between
+ *
+ *   Each base is followed by between zero and two blanks.  The favoured
+ *   transition of each block has score 0 and all others -4.
+ **/
+static scrappie_matrix synthetic_crf_transitions(const int * bases, size_t nbase) {
+    int * path = calloc(3 * nbase + 1, sizeof(int));
+    if (NULL == path) {
+        return NULL;
+    }
+    size_t npath = 0;
+    path[npath++] = 4;
+    for (size_t i = 0; i < nbase; i++) {
+        path[npath++] = bases[i];
+        const int nblank = rand() % 3;
+        for (int j = 0; j < nblank; j++) {
+            path[npath++] = 4;
+        }
+    }
+
+    scrappie_matrix trans = make_scrappie_matrix(25, npath - 1);
+    if (NULL != trans) {
+        for (size_t t = 1; t < npath; t++) {
+            float * tcol = trans->data.f + (t - 1) * trans->stride;
+            for (size_t i = 0; i < 25; i++) {
+                tcol[i] = -4.0f;
+            }
+            tcol[path[t] * 5 + path[t - 1]] = 0.0f;
+        }
+    }
+    free(path);
+    return trans;
+}
+
+//  Iterations of decode_post_conv_bcjr
+#define NITER 3
+
+static void test_conv_decode_helper(int mem, uint32_t initial_state, const char * sync_marker,
+                                    size_t sync_period, size_t band, bool bcjr) {
+    conv_code * code = make_conv_code(mem, NULL, initial_state, sync_marker, sync_period);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(code);
+
+    bool msg[MSG_LEN], decoded[MSG_LEN];
+    random_message(code, msg, MSG_LEN);
+    int * bases = conv_encode_bases(code, msg, MSG_LEN);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(bases);
+    scrappie_matrix trans = synthetic_crf_transitions(bases, MSG_LEN + mem);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(trans);
+
+    if (bcjr) {
+        //  Log probability of message
+        float score = decode_post_conv_bcjr(trans, code, MSG_LEN, band, NITER, decoded);
+        CU_ASSERT(isfinite(score));
+        CU_ASSERT(score <= 0.0f);
+    } else {
+        float score = decode_post_conv(trans, code, MSG_LEN, band, decoded);
+        CU_ASSERT(isfinite(score));
+        //  Favoured path has score zero
+        CU_ASSERT_DOUBLE_EQUAL(score, 0.0, 1e-5);
+    }
+    for (size_t i = 0; i < MSG_LEN; i++) {
+        CU_ASSERT_EQUAL(msg[i], decoded[i]);
+    }
+
+    trans = free_scrappie_matrix(trans);
+    free(bases);
+    code = free_conv_code(code);
+}
+
+void test_conv_decode_mem6(void) {
+    test_conv_decode_helper(6, 0, NULL, 0, 0, false);
+}
+
+void test_conv_decode_mem8_sync(void) {
+    test_conv_decode_helper(8, 0, "110", 9, 0, false);
+}
+
+void test_conv_decode_mem11_initial_state(void) {
+    test_conv_decode_helper(11, 0x4b1, "10", 7, 0, false);
+}
+
+void test_conv_decode_banded(void) {
+    test_conv_decode_helper(8, 0, "110", 9, 20, false);
+}
+
+void test_conv_decode_bcjr_mem6(void) {
+    test_conv_decode_helper(6, 0, NULL, 0, 0, true);
+}
+
+void test_conv_decode_bcjr_mem11_initial_state(void) {
+    test_conv_decode_helper(11, 0x4b1, "10", 7, 0, true);
+}
+
+void test_conv_decode_bcjr_banded(void) {
+    test_conv_decode_helper(8, 0, "110", 9, 20, true);
+}
+
+void test_conv_decode_too_short(void) {
+    conv_code * code = make_conv_code(8, NULL, 0, NULL, 0);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(code);
+    scrappie_matrix trans = random_scrappie_matrix(25, MSG_LEN, -1.0, 0.0);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(trans);
+
+    bool decoded[MSG_LEN];
+    CU_ASSERT(isnan(decode_post_conv(trans, code, MSG_LEN, 0, decoded)));
+    CU_ASSERT(isnan(decode_post_conv_bcjr(trans, code, MSG_LEN, 0, NITER, decoded)));
+
+    trans = free_scrappie_matrix(trans);
+    code = free_conv_code(code);
+}
+
+void test_conv_code_invalid(void) {
+    const uint32_t wide_gen[2] = {01777, 0133};
+    CU_ASSERT_PTR_NULL(make_conv_code(7, NULL, 0, NULL, 0));
+    CU_ASSERT_PTR_NULL(make_conv_code(6, wide_gen, 0, NULL, 0));
+    CU_ASSERT_PTR_NULL(make_conv_code(6, NULL, 0x40, NULL, 0));
+    CU_ASSERT_PTR_NULL(make_conv_code(6, NULL, 0, "1101", 3));
+    CU_ASSERT_PTR_NULL(make_conv_code(6, NULL, 0, "1x", 9));
+}
+
+static test_with_description tests[] = {
+    {"Decode memory 6 code", test_conv_decode_mem6},
+    {"Decode memory 8 code with sync markers", test_conv_decode_mem8_sync},
+    {"Decode memory 11 code from non-zero initial state", test_conv_decode_mem11_initial_state},
+    {"Decode within band", test_conv_decode_banded},
+    {"Iterative BCJR decoding of memory 6 code", test_conv_decode_bcjr_mem6},
+    {"Iterative BCJR decoding of memory 11 code from non-zero initial state", test_conv_decode_bcjr_mem11_initial_state},
+    {"Iterative BCJR decoding within band", test_conv_decode_bcjr_banded},
+    {"Decode fails when too few blocks", test_conv_decode_too_short},
+    {"Invalid codes rejected", test_conv_code_invalid},
+    {0}
+};
+
+/**   Register tests with CUnit
+ *
+ *    @returns 0 on success, non-zero on failure
+ **/
+int register_test_conv_decode(void) {
+    return scrappie_register_test_suite("Decoding convolutional codes", init_test_conv_decode,
+                                        clean_test_conv_decode, tests);
+}
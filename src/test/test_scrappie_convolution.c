@@ -1,9 +1,13 @@
 #define BANANA 1
 #include <CUnit/CUnit.h>
+#include <math.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <layers.h>
+#include <scrappie_simd.h>
+#include "scrappie_util.h"
 #include "test_common.h"
 
 static float test_conv_tol = 1e-5;
@@ -407,6 +411,55 @@ void test_scrappie_convolution_f1s1(void) {
                                     filter_base);
 }
 
+/*  Naive convolution of single channel input, with zero padding  */
+static float naive_convolution(const_scrappie_matrix X, const_scrappie_matrix W,
+                               const_scrappie_matrix b, size_t stride, size_t f, size_t col) {
+    const size_t winlen = W->nrq;
+    const int padL = (winlen - 1) / 2;
+    float y = b->data.f[f];
+    for (size_t w = 0; w < winlen; w++) {
+        const int i = (int)(col * stride + w) - padL;
+        if (i >= 0 && i < (int)X->nc) {
+            y += W->data.f[f * W->stride + w * 4] * X->data.f[i * X->stride];
+        }
+    }
+    return y;
+}
+
+void test_direct_convolution_single_channel(void) {
+    const size_t winlen[3] = {19, 11, 4};
+    const size_t stride[3] = {5, 1, 3};
+    scrappie_matrix X = random_scrappie_matrix(1, 203, -1.0, 1.0);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(X);
+
+    for (size_t t = 0; t < 3; t++) {
+        //  Filters of raw models only have the first of every four rows
+        scrappie_matrix W = random_scrappie_matrix(4 * winlen[t] - 3, 21, -1.0, 1.0);
+        scrappie_matrix b = random_scrappie_matrix(21, 1, -1.0, 1.0);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(W);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(b);
+
+        scrappie_matrix C = convolution(X, W, b, stride[t], NULL);
+        scrappie_matrix Ct = convolution_activation(X, W, b, stride[t], tanhf_array_inplace, NULL);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(C);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(Ct);
+        CU_ASSERT_EQUAL(C->nc, (X->nc + stride[t] - 1) / stride[t]);
+        for (size_t col = 0; col < C->nc; col++) {
+            for (size_t f = 0; f < C->nr; f++) {
+                const float expected = naive_convolution(X, W, b, stride[t], f, col);
+                CU_ASSERT_DOUBLE_EQUAL(C->data.f[col * C->stride + f], expected, test_conv_tol);
+                CU_ASSERT_DOUBLE_EQUAL(Ct->data.f[col * C->stride + f], tanhf(expected), test_conv_tol);
+            }
+        }
+
+        Ct = free_scrappie_matrix(Ct);
+        C = free_scrappie_matrix(C);
+        b = free_scrappie_matrix(b);
+        W = free_scrappie_matrix(W);
+    }
+    X = free_scrappie_matrix(X);
+}
+
 
 static const test_with_description tests[] = {
     {"Simple stride 1", test_stride1_convolution},
@@ -428,6 +481,7 @@ static const test_with_description tests[] = {
     {"Simple convolution, unit filter length 5", test_convolution_ones_f5},
     {"Simple convolution, antisymmetric filter length 3", test_convolution_antisymmetric_f3},
     {"Scrappie convolution, antisymmetric filter length 3", test_scrappie_convolution_f1s1},
+    {"Direct convolution of single channel input", test_direct_convolution_single_channel},
     {0}};
 
 /**   Register tests with CUnit
@@ -1,6 +1,8 @@
 #include <CUnit/Basic.h>
 #include <err.h>
+#include <math.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "decode.h"
 #include "layers.h"
@@ -97,11 +99,638 @@ void test_decode_equivalent_to_sloika(void) {
     post = free_scrappie_matrix(post);
 }
 
+void test_decode_checkpointed_helper(bool allow_slip){
+    const float min_prob = 1e-5;
+    scrappie_matrix post = read_scrappie_matrix(posteriorfile);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(post);
+
+    robustlog_activation_inplace(post, min_prob);
+    const size_t nblock = post->nc;
+
+    int * path_full = calloc(nblock + 1, sizeof(int));
+    int * path_checkpointed = calloc(nblock + 1, sizeof(int));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(path_full);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(path_checkpointed);
+    float score_full = decode_transducer(post, 0.0f, 0.0f, 2.0f, path_full, allow_slip);
+    float score_checkpointed = decode_transducer_checkpointed(post, 0.0f, 0.0f, 2.0f, path_checkpointed, allow_slip);
+
+    CU_ASSERT_EQUAL(score_full, score_checkpointed);
+    CU_ASSERT_TRUE(equality_arrayi(path_full, path_checkpointed, nblock + 1));
+
+    free(path_checkpointed);
+    free(path_full);
+    post = free_scrappie_matrix(post);
+}
+
+void test_decode_checkpointed_equivalent(void) {
+    test_decode_checkpointed_helper(false);
+}
+
+void test_decode_checkpointed_with_slip_equivalent(void) {
+    test_decode_checkpointed_helper(true);
+}
+
+void test_decode_pruned_helper(bool allow_slip, float beam, size_t max_states){
+    const float min_prob = 1e-5;
+    scrappie_matrix post = read_scrappie_matrix(posteriorfile);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(post);
+
+    robustlog_activation_inplace(post, min_prob);
+    const size_t nblock = post->nc;
+
+    int * path_full = calloc(nblock + 1, sizeof(int));
+    int * path_pruned = calloc(nblock + 1, sizeof(int));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(path_full);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(path_pruned);
+    float score_full = decode_transducer(post, 0.0f, 0.0f, 2.0f, path_full, allow_slip);
+    float score_pruned = decode_transducer_pruned(post, 0.0f, 0.0f, 2.0f, beam, max_states,
+                                                  path_pruned, allow_slip);
+
+    CU_ASSERT_EQUAL(score_full, score_pruned);
+    CU_ASSERT_TRUE(equality_arrayi(path_full, path_pruned, nblock + 1));
+
+    free(path_pruned);
+    free(path_full);
+    post = free_scrappie_matrix(post);
+}
+
+void test_decode_pruned_unlimited_equivalent(void) {
+    test_decode_pruned_helper(false, INFINITY, 0);
+}
+
+void test_decode_pruned_unlimited_with_slip_equivalent(void) {
+    test_decode_pruned_helper(true, INFINITY, 0);
+}
+
+void test_decode_pruned_beam_equivalent(void) {
+    test_decode_pruned_helper(false, 20.0f, 64);
+}
+
+void test_decode_sparse_helper(bool allow_slip, size_t k){
+    const float min_prob = 1e-5;
+    scrappie_matrix post = read_scrappie_matrix(posteriorfile);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(post);
+
+    robustlog_activation_inplace(post, min_prob);
+    const size_t nblock = post->nc;
+    sparse_posterior sparse = sparse_posterior_from_matrix(post, k, logf(min_prob));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(sparse);
+    //  Decoding the sparse posterior should be the same as decoding its dense expansion
+    scrappie_matrix dense = sparse_posterior_to_matrix(sparse, 0, nblock, NULL);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(dense);
+    if(k + 1 >= post->nr){
+        CU_ASSERT_TRUE(equality_scrappie_matrix(post, dense, 0.0));
+    }
+
+    int * path_full = calloc(nblock + 1, sizeof(int));
+    int * path_sparse = calloc(nblock + 1, sizeof(int));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(path_full);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(path_sparse);
+    float score_full = decode_transducer(dense, 0.0f, 0.0f, 2.0f, path_full, allow_slip);
+    float score_sparse = decode_transducer_sparse(sparse, 0.0f, 0.0f, 2.0f, path_sparse, allow_slip);
+
+    CU_ASSERT_EQUAL(score_full, score_sparse);
+    CU_ASSERT_TRUE(equality_arrayi(path_full, path_sparse, nblock + 1));
+
+    free(path_sparse);
+    free(path_full);
+    dense = free_scrappie_matrix(dense);
+    sparse = free_sparse_posterior(sparse);
+    post = free_scrappie_matrix(post);
+}
+
+void test_decode_sparse_all_states_equivalent(void) {
+    test_decode_sparse_helper(false, 1024);
+}
+
+void test_decode_sparse_all_states_with_slip_equivalent(void) {
+    test_decode_sparse_helper(true, 1024);
+}
+
+void test_decode_sparse_topk_equivalent(void) {
+    test_decode_sparse_helper(false, 16);
+}
+
+void test_sparse_posterior_oversize_k(void) {
+    sparse_posterior sp = make_sparse_posterior(1025, 10, 1024, -10.0f);
+    CU_ASSERT_PTR_NOT_NULL(sp);
+    sp = free_sparse_posterior(sp);
+    CU_ASSERT_PTR_NULL(make_sparse_posterior(1025, 10, 1025, -10.0f));
+    CU_ASSERT_PTR_NULL(make_sparse_posterior(1025, 10, 2000, -10.0f));
+    CU_ASSERT_PTR_NULL(make_sparse_posterior(1025, 10, 0, -10.0f));
+}
+
+void test_decode_fixed_helper(bool allow_slip){
+    const float min_prob = 1e-5;
+    scrappie_matrix post = read_scrappie_matrix(posteriorfile);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(post);
+
+    robustlog_activation_inplace(post, min_prob);
+    const size_t nblock = post->nc;
+
+    int * path_full = calloc(nblock + 1, sizeof(int));
+    int * path_fixed = calloc(nblock + 1, sizeof(int));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(path_full);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(path_fixed);
+    float score_full = decode_transducer(post, 0.0f, 0.0f, 2.0f, path_full, allow_slip);
+    float score_fixed = decode_transducer_fixed(post, 0.0f, 0.0f, 2.0f, path_fixed, allow_slip);
+
+    CU_ASSERT_EQUAL(score_full, score_fixed);
+    CU_ASSERT_TRUE(equality_arrayi(path_full, path_fixed, nblock + 1));
+
+    free(path_fixed);
+    free(path_full);
+    post = free_scrappie_matrix(post);
+}
+
+void test_decode_fixed_equivalent(void) {
+    test_decode_fixed_helper(false);
+}
+
+void test_decode_fixed_with_slip_equivalent(void) {
+    test_decode_fixed_helper(true);
+}
+
+/**  Fused traceback gives the basecall of separate homopolymer and overlapper passes
+ **/
+void test_decode_transducer_basecall_helper(enum homopolymer_calculation homopolymer, bool allow_slip){
+    const float min_prob = 1e-5;
+    scrappie_matrix post = read_scrappie_matrix(posteriorfile);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(post);
+
+    robustlog_activation_inplace(post, min_prob);
+    const size_t nblock = post->nc;
+
+    int * path_ref = calloc(nblock + 1, sizeof(int));
+    int * pos_ref = calloc(nblock + 1, sizeof(int));
+    int * path = calloc(nblock + 1, sizeof(int));
+    int * pos = calloc(nblock + 1, sizeof(int));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(path_ref);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pos_ref);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(path);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pos);
+    const float score_ref = decode_transducer(post, 0.0f, 0.0f, 2.0f, path_ref, allow_slip);
+    CU_ASSERT_EQUAL_FATAL(homopolymer_path(post, path_ref, homopolymer), 0);
+    char * basecall_ref = overlapper(path_ref, nblock + 1, post->nr - 1, pos_ref);
+
+    float score = NAN;
+    char * basecall = decode_transducer_basecall(post, 0.0f, 0.0f, 2.0f, allow_slip, homopolymer,
+                                                 path, pos, &score);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(basecall_ref);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(basecall);
+    CU_ASSERT_EQUAL(score_ref, score);
+    CU_ASSERT(0 == strcmp(basecall_ref, basecall));
+    CU_ASSERT_TRUE(equality_arrayi(path_ref, path, nblock + 1));
+    CU_ASSERT_TRUE(equality_arrayi(pos_ref, pos, nblock + 1));
+
+    free(basecall);
+    free(basecall_ref);
+    free(pos);
+    free(path);
+    free(pos_ref);
+    free(path_ref);
+    post = free_scrappie_matrix(post);
+}
+
+void test_decode_transducer_basecall_equivalent(void) {
+    test_decode_transducer_basecall_helper(HOMOPOLYMER_MEAN, false);
+}
+
+void test_decode_transducer_basecall_with_slip_equivalent(void) {
+    test_decode_transducer_basecall_helper(HOMOPOLYMER_MEAN, true);
+}
+
+void test_decode_transducer_basecall_nochange_equivalent(void) {
+    test_decode_transducer_basecall_helper(HOMOPOLYMER_NOCHANGE, false);
+}
+
+/**  Walk over random paths rich in homopolymers same as separate passes
+ *
+ *   Kmers are drawn from those ending in runs of a base, so every form of
+ *   homopolymer run found by homopolymer_path occurs.
+ **/
+void test_homopolymer_overlapper_equivalent(void) {
+    const size_t nblock = 2000;
+    const int nkmer = 1024;
+    srand(1);
+    scrappie_matrix post = make_scrappie_matrix(nkmer + 1, nblock);
+    int * path_ref = calloc(nblock + 1, sizeof(int));
+    int * pos_ref = calloc(nblock + 1, sizeof(int));
+    int * path = calloc(nblock + 1, sizeof(int));
+    int * pos = calloc(nblock + 1, sizeof(int));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(post);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(path_ref);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pos_ref);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(path);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pos);
+    for(size_t trial=0 ; trial < 20 ; trial++){
+        for(size_t c=0 ; c < nblock ; c++){
+            for(size_t r=0 ; r < post->nr ; r++){
+                post->data.f[c * post->stride + r] = -5.0f * (float)rand() / RAND_MAX;
+            }
+        }
+        for(size_t blk=0 ; blk <= nblock ; blk++){
+            const int b = rand() % 4;
+            const int nrep = 2 + rand() % 4;
+            int kmer = rand() % nkmer;
+            for(int i=0 ; i < nrep ; i++){
+                kmer = ((kmer << 2) | b) & (nkmer - 1);
+            }
+            path_ref[blk] = (rand() % 3 == 0) ? -1 : kmer;
+            path[blk] = path_ref[blk];
+            pos_ref[blk] = 0;
+        }
+
+        CU_ASSERT_EQUAL_FATAL(homopolymer_path(post, path_ref, HOMOPOLYMER_MEAN), 0);
+        char * basecall_ref = overlapper(path_ref, nblock + 1, nkmer, pos_ref);
+        char * basecall = homopolymer_overlapper(post, path, HOMOPOLYMER_MEAN, pos);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(basecall_ref);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(basecall);
+        CU_ASSERT(0 == strcmp(basecall_ref, basecall));
+        CU_ASSERT_TRUE(equality_arrayi(path_ref, path, nblock + 1));
+        CU_ASSERT_TRUE(equality_arrayi(pos_ref, pos, nblock + 1));
+        free(basecall);
+        free(basecall_ref);
+    }
+
+    free(pos);
+    free(path);
+    free(pos_ref);
+    free(path_ref);
+    post = free_scrappie_matrix(post);
+}
+
+void test_decode_crf_checkpointed_equivalent(void) {
+    //  Include lengths that are not a square and shorter than a segment
+    const size_t nblocks[] = {1, 2, 17, 1000};
+    srand(1);
+    for(size_t i=0 ; i < sizeof(nblocks) / sizeof(nblocks[0]) ; i++){
+        const size_t nblock = nblocks[i];
+        scrappie_matrix trans = make_scrappie_matrix(25, nblock);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(trans);
+        for(size_t c=0 ; c < nblock ; c++){
+            for(size_t r=0 ; r < trans->nr ; r++){
+                trans->data.f[c * trans->stride + r] = 5.0f * (float)rand() / RAND_MAX;
+            }
+        }
+
+        int * path_full = calloc(nblock + 1, sizeof(int));
+        int * path_checkpointed = calloc(nblock + 1, sizeof(int));
+        CU_ASSERT_PTR_NOT_NULL_FATAL(path_full);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(path_checkpointed);
+        float score_full = decode_crf(trans, path_full);
+        float score_checkpointed = decode_crf_checkpointed(trans, path_checkpointed);
+
+        CU_ASSERT_EQUAL(score_full, score_checkpointed);
+        CU_ASSERT_TRUE(equality_arrayi(path_full, path_checkpointed, nblock + 1));
+
+        free(path_checkpointed);
+        free(path_full);
+        trans = free_scrappie_matrix(trans);
+    }
+}
+
+/**  Random CRF transitions, as produced by globalnorm
+ **/
+static scrappie_matrix random_crf_transitions(size_t nblock){
+    scrappie_matrix trans = make_scrappie_matrix(25, nblock);
+    if(NULL != trans){
+        for(size_t c=0 ; c < nblock ; c++){
+            for(size_t r=0 ; r < trans->nr ; r++){
+                trans->data.f[c * trans->stride + r] = 5.0f * (float)rand() / RAND_MAX;
+            }
+        }
+        const float logZ = crf_partition_function(trans) / (float)nblock;
+        for(size_t c=0 ; c < nblock ; c++){
+            for(size_t r=0 ; r < trans->nr ; r++){
+                trans->data.f[c * trans->stride + r] -= logZ;
+            }
+        }
+    }
+    return trans;
+}
+
+/**  Scalar forwards-backwards posterior of CRF using logsumexpf
+ *
+ *   Returns posterior of state at each block [nstate * (nblock + 1)], block major
+ **/
+static float * reference_posterior_crf(const_scrappie_matrix trans, size_t nstate, float * logZ){
+    const size_t nblk = trans->nc;
+    float * fwd = calloc(nstate * (nblk + 1), sizeof(float));
+    float * bwd = calloc(nstate * (nblk + 1), sizeof(float));
+    if(NULL == fwd || NULL == bwd){
+        free(bwd);
+        free(fwd);
+        return NULL;
+    }
+    for(size_t blk=0 ; blk < nblk ; blk++){
+        const float * tcol = trans->data.f + blk * trans->stride;
+        for(size_t st1=0 ; st1 < nstate ; st1++){
+            float x = -HUGE_VALF;
+            for(size_t st2=0 ; st2 < nstate ; st2++){
+                x = logsumexpf(x, tcol[st1 * nstate + st2] + fwd[blk * nstate + st2]);
+            }
+            fwd[(blk + 1) * nstate + st1] = x;
+        }
+    }
+    for(size_t blk=nblk ; blk > 0 ; blk--){
+        const float * tcol = trans->data.f + (blk - 1) * trans->stride;
+        for(size_t st2=0 ; st2 < nstate ; st2++){
+            float x = -HUGE_VALF;
+            for(size_t st1=0 ; st1 < nstate ; st1++){
+                x = logsumexpf(x, tcol[st1 * nstate + st2] + bwd[blk * nstate + st1]);
+            }
+            bwd[(blk - 1) * nstate + st2] = x;
+        }
+    }
+    *logZ = -HUGE_VALF;
+    for(size_t st=0 ; st < nstate ; st++){
+        *logZ = logsumexpf(*logZ, fwd[nblk * nstate + st]);
+    }
+    for(size_t i=0 ; i < nstate * (nblk + 1) ; i++){
+        fwd[i] = expf(fwd[i] + bwd[i] - *logZ);
+    }
+    free(bwd);
+    return fwd;
+}
+
+void test_posterior_crf_equivalent(void) {
+    const size_t nblocks[] = {1, 17, 1000};
+    const size_t nstate = 5;
+    srand(1);
+    for(size_t i=0 ; i < sizeof(nblocks) / sizeof(nblocks[0]) ; i++){
+        const size_t nblock = nblocks[i];
+        scrappie_matrix trans = random_crf_transitions(nblock);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(trans);
+
+        float logZ = NAN;
+        float * refpost = reference_posterior_crf(trans, nstate, &logZ);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(refpost);
+        scrappie_matrix post = posterior_crf(trans);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(post);
+        CU_ASSERT_EQUAL(post->nc, nblock + 1);
+
+        for(size_t blk=0 ; blk <= nblock ; blk++){
+            float tot = 0.0f;
+            for(size_t st=0 ; st < nstate ; st++){
+                tot += post->data.f[blk * post->stride + st];
+            }
+            CU_ASSERT_DOUBLE_EQUAL(tot, 1.0, 1e-5);
+            CU_ASSERT_TRUE(equality_arrayf(refpost + blk * nstate, post->data.f + blk * post->stride,
+                                           nstate, 1e-4));
+        }
+        //  Transitions are globally normalised
+        CU_ASSERT_DOUBLE_EQUAL(logZ, 0.0, 1e-2);
+        CU_ASSERT_DOUBLE_EQUAL(crf_partition_function(trans), logZ, 1e-3);
+
+        free(refpost);
+        post = free_scrappie_matrix(post);
+        trans = free_scrappie_matrix(trans);
+    }
+}
+
+/**  Scalar Viterbi decoding of CRF, as decode_crf before vectorisation
+ **/
+static float reference_decode_crf(const_scrappie_matrix trans, size_t nstate, int * path){
+    const size_t nblk = trans->nc;
+    float * prev = calloc(nstate, sizeof(float));
+    float * curr = calloc(nstate, sizeof(float));
+    int * tb = calloc(nstate * nblk, sizeof(int));
+    for(size_t blk=0 ; blk < nblk ; blk++){
+        {
+            float * tmp = curr;
+            curr = prev;
+            prev = tmp;
+        }
+        for(size_t st1=0 ; st1 < nstate ; st1++){
+            const float * t = trans->data.f + blk * trans->stride + st1 * nstate;
+            curr[st1] = t[0] + prev[0];
+            tb[blk * nstate + st1] = 0;
+            for(size_t st2=1 ; st2 < nstate ; st2++){
+                if(t[st2] + prev[st2] > curr[st1]){
+                    curr[st1] = t[st2] + prev[st2];
+                    tb[blk * nstate + st1] = st2;
+                }
+            }
+        }
+    }
+    const float score = valmaxf(curr, nstate);
+    path[nblk] = argmaxf(curr, nstate);
+    for(size_t blk=nblk ; blk > 0 ; blk--){
+        path[blk - 1] = tb[(blk - 1) * nstate + path[blk]];
+    }
+    free(tb);
+    free(curr);
+    free(prev);
+    return score;
+}
+
+void test_decode_crf_vectorised_equivalent(void) {
+    //  Numbers of states with and without a partial final vector
+    const size_t nstates[] = {4, 5, 7};
+    const size_t nblock = 500;
+    srand(1);
+    for(size_t i=0 ; i < sizeof(nstates) / sizeof(nstates[0]) ; i++){
+        const size_t nstate = nstates[i];
+        scrappie_matrix trans = make_scrappie_matrix(nstate * nstate, nblock);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(trans);
+        for(size_t c=0 ; c < nblock ; c++){
+            for(size_t r=0 ; r < trans->nr ; r++){
+                //  Coarse values so that ties occur
+                trans->data.f[c * trans->stride + r] = (float)(rand() % 8);
+            }
+        }
+
+        int * path_ref = calloc(nblock + 1, sizeof(int));
+        int * path = calloc(nblock + 1, sizeof(int));
+        CU_ASSERT_PTR_NOT_NULL_FATAL(path_ref);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(path);
+        float score_ref = reference_decode_crf(trans, nstate, path_ref);
+        float score = decode_crf(trans, path);
+
+        CU_ASSERT_EQUAL(score_ref, score);
+        CU_ASSERT_TRUE(equality_arrayi(path_ref, path, nblock + 1));
+
+        free(path);
+        free(path_ref);
+        trans = free_scrappie_matrix(trans);
+    }
+}
+
+
+/**  Fused decoding gives path of decode_crf and errors of posterior_crf
+ **/
+void test_decode_crf_quality_equivalent(void) {
+    const size_t nblocks[] = {1, 17, 1000};
+    srand(1);
+    for(size_t i=0 ; i < sizeof(nblocks) / sizeof(nblocks[0]) ; i++){
+        const size_t nblock = nblocks[i];
+        scrappie_matrix trans = random_crf_transitions(nblock);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(trans);
+        int * path_ref = calloc(nblock + 1, sizeof(int));
+        int * path = calloc(nblock + 1, sizeof(int));
+        float * perr = calloc(nblock + 1, sizeof(float));
+        CU_ASSERT_PTR_NOT_NULL_FATAL(path_ref);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(path);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(perr);
+
+        const float score_ref = decode_crf(trans, path_ref);
+        const float score = decode_crf_quality(trans, path, perr);
+        CU_ASSERT_EQUAL(score_ref, score);
+        CU_ASSERT_TRUE(equality_arrayi(path_ref, path, nblock + 1));
+
+        scrappie_matrix post = posterior_crf(trans);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(post);
+        for(size_t blk=0 ; blk <= nblock ; blk++){
+            const float pstate = post->data.f[blk * post->stride + path[blk]];
+            CU_ASSERT_DOUBLE_EQUAL(perr[blk], 1.0f - pstate, 1e-4);
+        }
+
+        char * basecall = crfpath_to_basecall(path, nblock, path_ref);
+        char * quality = crfpath_to_quality(path, perr, nblock);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(basecall);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(quality);
+        CU_ASSERT_EQUAL(strlen(basecall), strlen(quality));
+        for(size_t j=0 ; quality[j] != '\0' ; j++){
+            CU_ASSERT_TRUE(quality[j] >= '!' && quality[j] <= '!' + 50);
+        }
+
+        free(quality);
+        free(basecall);
+        post = free_scrappie_matrix(post);
+        free(perr);
+        free(path);
+        free(path_ref);
+        trans = free_scrappie_matrix(trans);
+    }
+}
+
+
+/**  Specialised decoding of 5-state CRF same as generic
+ **/
+void test_decode_crf5_equivalent(void) {
+    const size_t nblocks[] = {1, 17, 1000};
+    srand(1);
+    for(size_t i=0 ; i < sizeof(nblocks) / sizeof(nblocks[0]) ; i++){
+        const size_t nblock = nblocks[i];
+        scrappie_matrix trans = random_crf_transitions(nblock);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(trans);
+        int * path_ref = calloc(nblock + 1, sizeof(int));
+        int * path = calloc(nblock + 1, sizeof(int));
+        CU_ASSERT_PTR_NOT_NULL_FATAL(path_ref);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(path);
+
+        const float score_ref = decode_crf(trans, path_ref);
+        const float score = decode_crf5(trans, path);
+        CU_ASSERT_EQUAL(score_ref, score);
+        CU_ASSERT_TRUE(equality_arrayi(path_ref, path, nblock + 1));
+
+        free(path);
+        free(path_ref);
+        trans = free_scrappie_matrix(trans);
+    }
+}
+
+
+/**  Whether a path of CRF states obeys a constraint on runs of bases
+ *
+ *   @param maxrun Longest run of a base allowed, blanks within a run not ending it
+ **/
+static bool crf_path_runs_valid(int const * path, size_t npos, int maxrun){
+    int last = -1;
+    int run = 0;
+    for(size_t pos=0 ; pos < npos ; pos++){
+        if(4 == path[pos]){
+            continue;
+        }
+        run = (path[pos] == last) ? (run + 1) : 1;
+        last = path[pos];
+        if(run > maxrun){
+            return false;
+        }
+    }
+    return true;
+}
+
+static float crf_path_score(const_scrappie_matrix trans, int const * path){
+    float score = 0.0f;
+    for(size_t blk=0 ; blk < trans->nc ; blk++){
+        score += trans->data.f[blk * trans->stride + path[blk + 1] * 5 + path[blk]];
+    }
+    return score;
+}
+
+/**  Constrained decoding finds best valid path of all paths enumerated
+ **/
+void test_decode_crf5_constrained_helper(float (*decoder)(const_scrappie_matrix, int *), int maxrun) {
+    const size_t nblock = 6;
+    srand(1);
+    for(size_t trial=0 ; trial < 5 ; trial++){
+        scrappie_matrix trans = random_crf_transitions(nblock);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(trans);
+        int path[nblock + 1];
+        int enumerated[nblock + 1];
+        size_t npath = 1;
+        for(size_t pos=0 ; pos <= nblock ; pos++){
+            npath *= 5;
+        }
+
+        float best = -INFINITY;
+        for(size_t p=0 ; p < npath ; p++){
+            size_t code = p;
+            for(size_t pos=0 ; pos <= nblock ; pos++){
+                enumerated[pos] = code % 5;
+                code /= 5;
+            }
+            if(crf_path_runs_valid(enumerated, nblock + 1, maxrun)){
+                best = fmaxf(best, crf_path_score(trans, enumerated));
+            }
+        }
+
+        const float score = decoder(trans, path);
+        CU_ASSERT_DOUBLE_EQUAL(score, best, 1e-4);
+        CU_ASSERT_TRUE(crf_path_runs_valid(path, nblock + 1, maxrun));
+        CU_ASSERT_DOUBLE_EQUAL(crf_path_score(trans, path), score, 1e-4);
+
+        trans = free_scrappie_matrix(trans);
+    }
+}
+
+void test_decode_crf5_no_repeat(void) {
+    test_decode_crf5_constrained_helper(decode_crf5_no_repeat, 1);
+}
+
+void test_decode_crf5_bounded_homopolymer(void) {
+    test_decode_crf5_constrained_helper(decode_crf5_bounded_homopolymer, CRF5_MAX_HOMOPOLYMER);
+}
+
 static test_with_description tests[] = {
     {"Decoding same as Sloika", test_decode_equivalent_to_sloika},
     {"Decoding of original and vectorised posterior same", test_decode_equivalent},
     {"Decoding of original and vectorised posterior same with stay penalty", test_decode_with_staypen_equivalent},
     {"Decoding of original and vectorised posterior same with skip penalty", test_decode_with_skippen_equivalent},
+    {"Checkpointed decoding same as full traceback", test_decode_checkpointed_equivalent},
+    {"Checkpointed decoding same as full traceback with slip", test_decode_checkpointed_with_slip_equivalent},
+    {"Pruned decoding with unlimited beam same as full", test_decode_pruned_unlimited_equivalent},
+    {"Pruned decoding with unlimited beam same as full with slip", test_decode_pruned_unlimited_with_slip_equivalent},
+    {"Pruned decoding with beam same as full", test_decode_pruned_beam_equivalent},
+    {"Sparse decoding keeping all states same as full", test_decode_sparse_all_states_equivalent},
+    {"Sparse decoding keeping all states same as full with slip", test_decode_sparse_all_states_with_slip_equivalent},
+    {"Sparse decoding same as decoding dense expansion", test_decode_sparse_topk_equivalent},
+    {"Sparse posterior refuses k not less than number of states", test_sparse_posterior_oversize_k},
+    {"Fixed-point decoding same as floating point", test_decode_fixed_equivalent},
+    {"Fixed-point decoding same as floating point with slip", test_decode_fixed_with_slip_equivalent},
+    {"Fused homopolymer traceback same as separate passes", test_decode_transducer_basecall_equivalent},
+    {"Fused homopolymer traceback same as separate passes with slip", test_decode_transducer_basecall_with_slip_equivalent},
+    {"Fused traceback without homopolymer correction same as overlapper", test_decode_transducer_basecall_nochange_equivalent},
+    {"Homopolymer walk of random paths same as separate passes", test_homopolymer_overlapper_equivalent},
+    {"Checkpointed CRF decoding same as full traceback", test_decode_crf_checkpointed_equivalent},
+    {"Vectorised CRF decoding same as scalar", test_decode_crf_vectorised_equivalent},
+    {"Vectorised CRF posterior same as scalar", test_posterior_crf_equivalent},
+    {"Fused CRF decoding with qualities same as separate passes", test_decode_crf_quality_equivalent},
+    {"Specialised 5-state CRF decoding same as generic", test_decode_crf5_equivalent},
+    {"5-state CRF decoding without repeats best of all paths", test_decode_crf5_no_repeat},
+    {"5-state CRF decoding with bounded homopolymers best of all paths", test_decode_crf5_bounded_homopolymer},
     {0}};
 
 /**   Register tests with CUnit
@@ -185,6 +185,58 @@ void test_shift_scale(void){
 
 
 
+static bool equal_event(event_t const * x, event_t const * y){
+    return x->start == y->start && x->length == y->length && x->mean == y->mean
+        && x->stdv == y->stdv && x->pos == y->pos && x->state == y->state;
+}
+
+void test_streaming_matches_whole_signal(void){
+    const size_t n = 5000;
+    float * data = calloc(n, sizeof(float));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+    //  Steps of random length and level with noise
+    float level = 0.0f;
+    for(size_t i=0 ; i < n ; i++){
+        if(0 == rand() % 9){
+            level = 10.0f * rand() / RAND_MAX;
+        }
+        data[i] = level + (float)rand() / RAND_MAX;
+    }
+    raw_table rt = {.n = n, .start = 0, .end = n, .raw = data};
+    event_table et = detect_events(rt, event_detection_defaults);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(et.event);
+    CU_ASSERT_TRUE(et.n > 100);
+
+    //  Push signal in small irregular chunks through a small event buffer
+    event_detector * ed = make_event_detector(event_detection_defaults);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(ed);
+    event_t buffer[16];
+    size_t nevent_total = 0;
+    bool all_equal = true;
+    for(size_t pushed=0, chunk=1 ; pushed < n ; chunk = 1 + (chunk * 7) % 23){
+        const size_t nchunk = (pushed + chunk < n) ? chunk : n - pushed;
+        size_t nevent = 0;
+        pushed += event_detector_push(ed, data + pushed, nchunk, buffer, 5, &nevent);
+        for(size_t ev=0 ; ev < nevent && nevent_total + ev < et.n ; ev++){
+            all_equal &= equal_event(buffer + ev, et.event + nevent_total + ev);
+        }
+        nevent_total += nevent;
+    }
+    CU_ASSERT_TRUE(event_detector_finish_capacity(ed) <= 16);
+    const size_t nevent = event_detector_finish(ed, buffer, 16);
+    for(size_t ev=0 ; ev < nevent && nevent_total + ev < et.n ; ev++){
+        all_equal &= equal_event(buffer + ev, et.event + nevent_total + ev);
+    }
+    nevent_total += nevent;
+    CU_ASSERT_EQUAL(nevent_total, et.n);
+    CU_ASSERT_TRUE(all_equal);
+
+    ed = free_event_detector(ed);
+    free(et.event);
+    free(data);
+}
+
+
 static test_with_description tests[] = {
     {"Cumulative sum and sums", test_cumulative_sums},
     {"Calculation of t-statistic", test_calculation_tstat},
@@ -194,6 +246,7 @@ static test_with_description tests[] = {
     {"Correct event means", test_correct_means},
     {"Correct event stdv", test_correct_stdv},
     {"Event detection is shift-scale invariant", test_shift_scale},
+    {"Streaming event detection matches whole signal", test_streaming_matches_whole_signal},
     {0}};
 
 
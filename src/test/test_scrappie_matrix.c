@@ -2,7 +2,10 @@
 #include <CUnit/Basic.h>
 #include <stdbool.h>
 
+#include <layers.h>
 #include <scrappie_matrix.h>
+#include <scrappie_simd.h>
+#include <scrappie_util.h>
 #include <test_common.h>
 
 /**  Initialise test
@@ -50,11 +53,276 @@ void test_rownormalise_nr11scrappie_matrix(void){
     test_rownormalise_scrappie_matrix_helper(11);
 }
 
+void test_workspace_reuse_scrappie_matrix(void){
+    const bool was_enabled = scrappie_workspace_enable(true);
+    scrappie_matrix mat = make_scrappie_matrix(17, 31);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(mat);
+    for(size_t i=0 ; i < mat->stride * mat->nc ; i++){
+        mat->data.f[i] = 1.0f;
+    }
+    const float * mem = mat->data.f;
+    mat = free_scrappie_matrix(mat);
+    CU_ASSERT(scrappie_workspace_size() > 0);
+
+    //  Smaller matrix reuses memory and is zeroed
+    mat = make_scrappie_matrix(9, 31);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(mat);
+    CU_ASSERT_EQUAL(mat->data.f, mem);
+    for(size_t i=0 ; i < mat->stride * mat->nc ; i++){
+        CU_ASSERT_EQUAL(mat->data.f[i], 0.0f);
+    }
+    mat = free_scrappie_matrix(mat);
+
+    (void)scrappie_workspace_enable(was_enabled);
+    CU_ASSERT_EQUAL(scrappie_workspace_size(), 0);
+}
+
+/**  Matrices backed by huge pages are zeroed, retained by the workspace and
+ *   reused; explicit huge pages fall back to transparent if none are reserved
+ **/
+void test_hugepage_scrappie_matrix_helper(enum scrappie_hugepage_policy policy){
+    const bool was_enabled = scrappie_workspace_enable(true);
+    (void)scrappie_hugepage_set_policy(policy, 1 << 20);
+    //  Small matrix is not backed by huge pages
+    scrappie_matrix small = make_scrappie_matrix(4, 16);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(small);
+    small = free_scrappie_matrix(small);
+    const size_t small_size = scrappie_workspace_size();
+    CU_ASSERT(small_size < (1 << 20));
+
+    scrappie_matrix mat = make_scrappie_matrix(1025, 1024);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(mat);
+    for(size_t i=0 ; i < mat->stride * mat->nc ; i++){
+        CU_ASSERT_EQUAL(mat->data.f[i], 0.0f);
+        mat->data.f[i] = 1.0f;
+    }
+    const float * mem = mat->data.f;
+    mat = free_scrappie_matrix(mat);
+    //  Whole of memory, rounded to huge pages, is retained
+    CU_ASSERT_EQUAL((scrappie_workspace_size() - small_size) % (2 << 20), (2 << 20) - 16);
+
+    scrappie_imatrix imat = make_scrappie_imatrix(1024, 1024);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(imat);
+    CU_ASSERT_EQUAL((const float *)imat->data.f, mem);
+    for(size_t i=0 ; i < imat->stride * imat->nc ; i++){
+        CU_ASSERT_EQUAL(imat->data.f[i], 0);
+    }
+    imat = free_scrappie_imatrix(imat);
+
+    (void)scrappie_hugepage_set_policy(SCRAPPIE_HUGEPAGE_OFF, SCRAPPIE_HUGEPAGE_THRESHOLD);
+    (void)scrappie_workspace_enable(was_enabled);
+    CU_ASSERT_EQUAL(scrappie_workspace_size(), 0);
+}
+
+void test_hugepage_transparent_scrappie_matrix(void){
+    test_hugepage_scrappie_matrix_helper(SCRAPPIE_HUGEPAGE_TRANSPARENT);
+}
+
+void test_hugepage_explicit_scrappie_matrix(void){
+    test_hugepage_scrappie_matrix_helper(SCRAPPIE_HUGEPAGE_EXPLICIT);
+}
+
+void test_hugepage_parse_policy(void){
+    CU_ASSERT_EQUAL(scrappie_hugepage_from_string("off"), SCRAPPIE_HUGEPAGE_OFF);
+    CU_ASSERT_EQUAL(scrappie_hugepage_from_string("transparent"), SCRAPPIE_HUGEPAGE_TRANSPARENT);
+    CU_ASSERT_EQUAL(scrappie_hugepage_from_string("explicit"), SCRAPPIE_HUGEPAGE_EXPLICIT);
+    CU_ASSERT_EQUAL(scrappie_hugepage_from_string("huge"), SCRAPPIE_HUGEPAGE_INVALID);
+}
+
+void test_packed_affine_map_scrappie_matrix(void){
+    //  Sizes chosen so panels and blocks of columns are partially filled
+    const size_t nout[3] = {37, 45, 16};
+    const enum scrappie_simd level_at_start = scrappie_simd_get();
+    for(size_t i=0 ; i < 3 ; i++){
+        scrappie_matrix Xf = random_scrappie_matrix(23, 13, -1.0, 1.0);
+        scrappie_matrix Xb = random_scrappie_matrix(9, 13, -1.0, 1.0);
+        scrappie_matrix Wf = random_scrappie_matrix(23, nout[i], -1.0, 1.0);
+        scrappie_matrix Wb = random_scrappie_matrix(9, nout[i], -1.0, 1.0);
+        scrappie_matrix b = random_scrappie_matrix(nout[i], 1, -1.0, 1.0);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(Xf);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(Xb);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(Wf);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(Wb);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(b);
+
+        scrappie_matrix expected1 = affine_map(Xf, Wf, b, NULL);
+        scrappie_matrix expected2 = affine_map2_activation(Xf, Xb, Wf, Wb, b, tanhf_array_inplace, NULL);
+        CU_ASSERT_FATAL(register_packed_weights(Wf));
+        CU_ASSERT_FATAL(register_packed_weights(Wb));
+        for(int level=SCRAPPIE_SIMD_SSE ; level <= scrappie_simd_supported() ; level++){
+            scrappie_simd_set(level);
+            scrappie_matrix C1 = affine_map(Xf, Wf, b, NULL);
+            scrappie_matrix C2 = affine_map2_activation(Xf, Xb, Wf, Wb, b, tanhf_array_inplace, NULL);
+            CU_ASSERT(equality_scrappie_matrix(expected1, C1, 1e-5));
+            CU_ASSERT(equality_scrappie_matrix(expected2, C2, 1e-5));
+            C1 = free_scrappie_matrix(C1);
+            C2 = free_scrappie_matrix(C2);
+        }
+        scrappie_simd_set(level_at_start);
+        unregister_packed_weights(Wf);
+        unregister_packed_weights(Wb);
+
+        expected2 = free_scrappie_matrix(expected2);
+        expected1 = free_scrappie_matrix(expected1);
+        b = free_scrappie_matrix(b);
+        Wb = free_scrappie_matrix(Wb);
+        Wf = free_scrappie_matrix(Wf);
+        Xb = free_scrappie_matrix(Xb);
+        Xf = free_scrappie_matrix(Xf);
+    }
+}
+
+void test_int8_affine_map_scrappie_matrix(void){
+    //  Odd number of inputs so pairs of inputs are partially filled
+    const size_t nout[2] = {37, 16};
+    const enum scrappie_simd level_at_start = scrappie_simd_get();
+    for(size_t i=0 ; i < 2 ; i++){
+        scrappie_matrix Xf = random_scrappie_matrix(23, 13, -1.0, 1.0);
+        scrappie_matrix Xb = random_scrappie_matrix(9, 13, -1.0, 1.0);
+        scrappie_matrix Wf = random_scrappie_matrix(23, nout[i], -1.0, 1.0);
+        scrappie_matrix Wb = random_scrappie_matrix(9, nout[i], -1.0, 1.0);
+        scrappie_matrix b = random_scrappie_matrix(nout[i], 1, -1.0, 1.0);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(Xf);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(Xb);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(Wf);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(Wb);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(b);
+
+        scrappie_matrix expected = affine_map2(Xf, Xb, Wf, Wb, b, NULL);
+        CU_ASSERT_FATAL(register_packed_weights(Wf));
+        CU_ASSERT_FATAL(register_packed_weights(Wb));
+        scrappie_precision_set(SCRAPPIE_PRECISION_INT8);
+        scrappie_simd_set(SCRAPPIE_SIMD_SSE);
+        scrappie_matrix sse = affine_map2(Xf, Xb, Wf, Wb, b, NULL);
+        //  Quantisation error is about 1% of each product
+        CU_ASSERT(equality_scrappie_matrix(expected, sse, 0.05));
+        //  Integer products are exact so every level agrees
+        for(int level=SCRAPPIE_SIMD_SSE ; level <= scrappie_simd_supported() ; level++){
+            scrappie_simd_set(level);
+            scrappie_matrix C = affine_map2(Xf, Xb, Wf, Wb, b, NULL);
+            CU_ASSERT(equality_scrappie_matrix(sse, C, 1e-5));
+            C = free_scrappie_matrix(C);
+        }
+        scrappie_precision_set(SCRAPPIE_PRECISION_FP32);
+        scrappie_simd_set(level_at_start);
+        unregister_packed_weights(Wf);
+        unregister_packed_weights(Wb);
+
+        sse = free_scrappie_matrix(sse);
+        expected = free_scrappie_matrix(expected);
+        b = free_scrappie_matrix(b);
+        Wb = free_scrappie_matrix(Wb);
+        Wf = free_scrappie_matrix(Wf);
+        Xb = free_scrappie_matrix(Xb);
+        Xf = free_scrappie_matrix(Xf);
+    }
+}
+
+void test_sparse_affine_vector_scrappie_matrix(void){
+    //  Inputs not a multiple of the block size so last blocks are partially filled
+    const size_t nin = 23;
+    const size_t nout = 36;
+    const enum scrappie_simd level_at_start = scrappie_simd_get();
+    scrappie_matrix x = random_scrappie_matrix(nin, 1, -1.0, 1.0);
+    scrappie_matrix W = random_scrappie_matrix(nin, nout, -1.0, 1.0);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(x);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(W);
+
+    sparse_weights sw;
+    CU_ASSERT_FATAL(register_packed_weights(W));
+    //  Dense weights are not worth a sparse copy
+    CU_ASSERT_FALSE(find_sparse_weights(W, &sw));
+    unregister_packed_weights(W);
+
+    //  Prune all but every third block of SCRAPPIE_SPARSE_BLOCK x SCRAPPIE_SPARSE_BLOCK
+    size_t b = 0;
+    for(size_t c=0 ; c < nout ; c += SCRAPPIE_SPARSE_BLOCK){
+        for(size_t r=0 ; r < nin ; r += SCRAPPIE_SPARSE_BLOCK, b++){
+            if(0 == b % 3){
+                continue;
+            }
+            for(size_t cb=c ; cb < c + SCRAPPIE_SPARSE_BLOCK ; cb++){
+                for(size_t rb=r ; rb < r + SCRAPPIE_SPARSE_BLOCK && rb < nin ; rb++){
+                    W->data.f[cb * W->stride + rb] = 0.0f;
+                }
+            }
+        }
+    }
+    float expected[36];
+    for(size_t c=0 ; c < nout ; c++){
+        expected[c] = 0.5f;
+        for(size_t r=0 ; r < nin ; r++){
+            expected[c] += W->data.f[c * W->stride + r] * x->data.f[r];
+        }
+    }
+
+    CU_ASSERT_FATAL(register_packed_weights(W));
+    CU_ASSERT_FATAL(find_sparse_weights(W, &sw));
+    for(int level=SCRAPPIE_SIMD_SSE ; level <= scrappie_simd_supported() ; level++){
+        scrappie_simd_set(level);
+        float y[36];
+        for(size_t c=0 ; c < nout ; c++){
+            y[c] = 0.5f;
+        }
+        sparse_affine_vector(&sw, x->data.f, y);
+        for(size_t c=0 ; c < nout ; c++){
+            CU_ASSERT_DOUBLE_EQUAL(expected[c], y[c], 1e-5);
+        }
+    }
+    scrappie_simd_set(level_at_start);
+    unregister_packed_weights(W);
+
+    W = free_scrappie_matrix(W);
+    x = free_scrappie_matrix(x);
+}
+
+void test_affine_map_window_scrappie_matrix(void){
+    //  Unpadded rows use a view of the input, padded rows and short inputs products per offset
+    const size_t nr[3] = {4, 5, 4};
+    const size_t nc[3] = {31, 31, 2};
+    for(size_t i=0 ; i < 3 ; i++){
+        scrappie_matrix X = random_scrappie_matrix(nr[i], nc[i], -1.0, 1.0);
+        scrappie_matrix W = random_scrappie_matrix(3 * nr[i], 20, -1.0, 1.0);
+        scrappie_matrix b = random_scrappie_matrix(20, 1, -1.0, 1.0);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(X);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(W);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(b);
+        scrappie_matrix X3 = window(X, 3, 1);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(X3);
+
+        scrappie_matrix expected = affine_map(X3, W, b, NULL);
+        scrappie_matrix C = affine_map_window(X, 3, W, b, NULL);
+        CU_ASSERT(equality_scrappie_matrix(expected, C, 1e-5));
+        CU_ASSERT_FATAL(register_packed_weights(W));
+        scrappie_matrix packed_expected = affine_map(X3, W, b, NULL);
+        C = affine_map_window(X, 3, W, b, C);
+        //  A view of the input is mapped by the same kernel as its window
+        CU_ASSERT(equality_scrappie_matrix(packed_expected, C, (0 == i) ? 0.0 : 1e-5));
+        unregister_packed_weights(W);
+
+        C = free_scrappie_matrix(C);
+        packed_expected = free_scrappie_matrix(packed_expected);
+        expected = free_scrappie_matrix(expected);
+        X3 = free_scrappie_matrix(X3);
+        b = free_scrappie_matrix(b);
+        W = free_scrappie_matrix(W);
+        X = free_scrappie_matrix(X);
+    }
+}
+
 static test_with_description tests[] = {
     {"Row normalisation edge case nr  8", test_rownormalise_nr08scrappie_matrix},
     {"Row normalisation edge case nr  9", test_rownormalise_nr09scrappie_matrix},
     {"Row normalisation edge case nr 10", test_rownormalise_nr10scrappie_matrix},
     {"Row normalisation edge case nr 11", test_rownormalise_nr11scrappie_matrix},
+    {"Workspace reuses memory of freed matrices", test_workspace_reuse_scrappie_matrix},
+    {"Transparent huge pages reused by workspace", test_hugepage_transparent_scrappie_matrix},
+    {"Explicit huge pages reused by workspace", test_hugepage_explicit_scrappie_matrix},
+    {"Parse huge page policy", test_hugepage_parse_policy},
+    {"Packed affine map agrees with BLAS", test_packed_affine_map_scrappie_matrix},
+    {"Int8 affine map close to single precision", test_int8_affine_map_scrappie_matrix},
+    {"Windowed affine map agrees with window", test_affine_map_window_scrappie_matrix},
+    {"Sparse map of pruned weights agrees with dense", test_sparse_affine_vector_scrappie_matrix},
     {0}};
 
 /**   Register tests with CUnit
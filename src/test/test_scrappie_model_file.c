@@ -0,0 +1,114 @@
+// Needed for mkstemp
+#define BANANA 1
+#define _DEFAULT_SOURCE
+#define _POSIX_SOURCE 1
+
+#include <CUnit/Basic.h>
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "model_file.h"
+#include "networks.h"
+#include "scrappie_util.h"
+#include "test_common.h"
+
+static char model_tmpfile_name[] = "scrappie_model_file_XXXXXX";
+static scrappie_matrix mat[2] = {NULL, NULL};
+
+/**  Initialise model file test
+ *
+ *   Writes two random matrices to a temporary model file
+ *
+ *  @returns 0 on success, non-zero on failure
+ **/
+int init_test_scrappie_model_file(void) {
+    mat[0] = random_scrappie_matrix(27, 13, -1.0, 1.0);
+    mat[1] = random_scrappie_matrix(5, 1, -1.0, 1.0);
+    if (NULL == mat[0] || NULL == mat[1]) {
+        warnx("Failed to create random scrappie matrix.\n");
+        return -1;
+    }
+
+    (void)umask(022);
+    int fd = mkstemp(model_tmpfile_name);
+    if (-1 == fd) {
+        warnx("Failed to open temporary file to write to.\n");
+        return -1;
+    }
+    close(fd);
+    const char * names[2] = {"layer_W", "layer_b"};
+    const const_scrappie_matrix tensors[2] = {mat[0], mat[1]};
+    return write_model_file(model_tmpfile_name, "test_model", names, tensors, 2) ? 0 : -1;
+}
+
+/**  Clean up after model file test
+ *
+ *  @returns 0 on success, non-zero on failure
+ **/
+int clean_test_scrappie_model_file(void) {
+    mat[0] = free_scrappie_matrix(mat[0]);
+    mat[1] = free_scrappie_matrix(mat[1]);
+    return remove(model_tmpfile_name);
+}
+
+void test_roundtrip_model_file(void) {
+    model_file * mf = load_model_file(model_tmpfile_name);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(mf);
+    CU_ASSERT(0 == strcmp(mf->model, "test_model"));
+    CU_ASSERT_EQUAL_FATAL(mf->ntensor, 2);
+
+    const char * names[2] = {"layer_W", "layer_b"};
+    for (size_t i = 0; i < 2; i++) {
+        const_scrappie_matrix tensor = model_file_tensor(mf, names[i]);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(tensor);
+        CU_ASSERT_EQUAL((uintptr_t)tensor->data.f % SCRAPPIE_MODEL_FILE_ALIGN, 0);
+        CU_ASSERT(equality_scrappie_matrix(mat[i], tensor, 0.0));
+    }
+    CU_ASSERT_PTR_NULL(model_file_tensor(mf, "layer_sW"));
+
+    mf = free_model_file(mf);
+}
+
+void test_model_weights_roundtrip(void) {
+    static char weights_name[] = "scrappie_model_weights_XXXXXX";
+    int fd = mkstemp(weights_name);
+    CU_ASSERT_FATAL(-1 != fd);
+    close(fd);
+    CU_ASSERT_FATAL(write_model_weights(weights_name, "squiggle_r94"));
+
+    const int seq[12] = {0, 1, 2, 3, 3, 2, 1, 0, 0, 2, 1, 3};
+    scrappie_matrix expected = squiggle_r94(seq, 12, true);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(expected);
+
+    //  File must hold the model asked for, and have a tensor for every weight
+    CU_ASSERT_FALSE(load_model_weights(weights_name, "squiggle_r10"));
+    CU_ASSERT_FALSE(load_model_weights(model_tmpfile_name, NULL));
+    CU_ASSERT_FATAL(load_model_weights(weights_name, "squiggle_r94"));
+    scrappie_matrix squiggle = squiggle_r94(seq, 12, true);
+    unload_model_weights();
+
+    CU_ASSERT(equality_scrappie_matrix(expected, squiggle, 0.0));
+    squiggle = free_scrappie_matrix(squiggle);
+    expected = free_scrappie_matrix(expected);
+    remove(weights_name);
+}
+
+static test_with_description tests[] = {
+    {"Model file round trip", test_roundtrip_model_file},
+    {"Network weights from model file", test_model_weights_roundtrip},
+    {0}
+};
+
+/**   Register tests with CUnit
+ *
+ *    @returns 0 on success, non-zero on failure
+ **/
+int register_test_model_file(void) {
+    return scrappie_register_test_suite("Binary model files", init_test_scrappie_model_file,
+                                        clean_test_scrappie_model_file, tests);
+}
@@ -0,0 +1,225 @@
+#include <CUnit/Basic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "layers.h"
+#include "network_graph.h"
+#include "nnfeatures.h"
+#include "scrappie_matrix.h"
+#include "scrappie_simd.h"
+#include "scrappie_util.h"
+#include "test_common.h"
+
+#define NSAMPLE 403
+#define GRU_SIZE 16
+static float signal[NSAMPLE];
+
+/**  Initialise network graph test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int init_test_network_graph(void) {
+    srand(11);
+    for (size_t i = 0; i < NSAMPLE; i++) {
+        signal[i] = 2.0f * rand() / (float)RAND_MAX - 1.0f;
+    }
+    return 0;
+}
+
+/**  Clean up after network graph test
+ *
+ *  @returns 0 on success, non-zero on failure
+ **/
+int clean_test_network_graph(void) {
+    return 0;
+}
+
+typedef struct {
+    scrappie_matrix iW, b, sW, sW2;
+} gru_weights;
+
+static gru_weights random_gru_weights(size_t nin) {
+    return (gru_weights){random_scrappie_matrix(nin, 3 * GRU_SIZE, -0.5, 0.5),
+                         random_scrappie_matrix(3 * GRU_SIZE, 1, -0.5, 0.5),
+                         random_scrappie_matrix(GRU_SIZE, 2 * GRU_SIZE, -0.5, 0.5),
+                         random_scrappie_matrix(GRU_SIZE, GRU_SIZE, -0.5, 0.5)};
+}
+
+static void free_gru_weights(gru_weights * w) {
+    w->iW = free_scrappie_matrix(w->iW);
+    w->b = free_scrappie_matrix(w->b);
+    w->sW = free_scrappie_matrix(w->sW);
+    w->sW2 = free_scrappie_matrix(w->sW2);
+}
+
+void test_recurrent_network_graph(void) {
+    const raw_table rt = {NULL, NSAMPLE, 0, NSAMPLE, signal};
+    scrappie_matrix W = random_scrappie_matrix(44, GRU_SIZE, -0.5, 0.5);
+    scrappie_matrix b = random_scrappie_matrix(GRU_SIZE, 1, -0.5, 0.5);
+    gru_weights g1 = random_gru_weights(GRU_SIZE);
+    gru_weights g2 = random_gru_weights(GRU_SIZE);
+
+    network_graph graph = {5, {GRAPH_FEATURES(), GRAPH_CONVOLUTION(0, W, b, 3),
+                               GRAPH_ACTIVATION(1, tanhf_array_inplace),
+                               GRAPH_GRU(2, g1.iW, g1.b, g1.sW, g1.sW2, true, false),
+                               GRAPH_GRU(3, g2.iW, g2.b, g2.sW, g2.sW2, false, true)}};
+    CU_ASSERT_FATAL(plan_network_graph(&graph));
+    //  Features, then everything else in place of the convolution
+    CU_ASSERT_EQUAL(graph.nbuffer, 2);
+    CU_ASSERT(graph.step[2].fused);
+    CU_ASSERT(graph.step[3].inplace && graph.step[4].inplace);
+    CU_ASSERT_FALSE(graph.step[3].concurrent);
+    CU_ASSERT_EQUAL(network_graph_bytes(&graph, NSAMPLE),
+                    (NSAMPLE + GRU_SIZE / 4 * ((NSAMPLE + 2) / 3)) * sizeof(__m128));
+
+    scrappie_matrix features = nanonet_features_from_raw(rt);
+    scrappie_matrix conv = convolution_activation(features, W, b, 3, tanhf_array_inplace, NULL);
+    scrappie_matrix gru1 = gru_backward_fused(conv, g1.iW, g1.b, g1.sW, g1.sW2, false, NULL);
+    scrappie_matrix expected = gru_forward_fused(gru1, g2.iW, g2.b, g2.sW, g2.sW2, true, NULL);
+    scrappie_matrix out = run_network_graph(&graph, (graph_input){.signal = rt});
+    CU_ASSERT_PTR_NOT_NULL_FATAL(out);
+    CU_ASSERT_EQUAL(out->nc, (NSAMPLE + 2) / 3);
+    CU_ASSERT(equality_scrappie_matrix(out, expected, 0.0));
+
+    out = free_scrappie_matrix(out);
+    expected = free_scrappie_matrix(expected);
+    gru1 = free_scrappie_matrix(gru1);
+    conv = free_scrappie_matrix(conv);
+    features = free_scrappie_matrix(features);
+    free_gru_weights(&g2);
+    free_gru_weights(&g1);
+    b = free_scrappie_matrix(b);
+    W = free_scrappie_matrix(W);
+}
+
+void test_bidirectional_network_graph(void) {
+    const raw_table rt = {NULL, NSAMPLE, 0, NSAMPLE, signal};
+    scrappie_matrix W = random_scrappie_matrix(28, 12, -0.5, 0.5);
+    scrappie_matrix b = random_scrappie_matrix(12, 1, -0.5, 0.5);
+    gru_weights gF = random_gru_weights(12);
+    gru_weights gB = random_gru_weights(12);
+    scrappie_matrix Wf = random_scrappie_matrix(GRU_SIZE, 20, -0.5, 0.5);
+    scrappie_matrix Wb = random_scrappie_matrix(GRU_SIZE, 20, -0.5, 0.5);
+    scrappie_matrix bff = random_scrappie_matrix(20, 1, -0.5, 0.5);
+
+    network_graph graph = {6, {GRAPH_FEATURES(), GRAPH_CONVOLUTION(0, W, b, 2),
+                               GRAPH_ACTIVATION(1, eluf_array_inplace),
+                               GRAPH_GRU(2, gF.iW, gF.b, gF.sW, gF.sW2, false, false),
+                               GRAPH_GRU(2, gB.iW, gB.b, gB.sW, gB.sW2, true, false),
+                               GRAPH_FEEDFORWARD2_TANH(3, 4, Wf, Wb, bff)}};
+    CU_ASSERT_FATAL(plan_network_graph(&graph));
+    //  Directions run together, the first in place of the features
+    CU_ASSERT(graph.step[3].concurrent);
+    CU_ASSERT_FALSE(graph.step[3].inplace || graph.step[4].inplace);
+    CU_ASSERT_EQUAL(graph.step[3].buffer, graph.step[0].buffer);
+    CU_ASSERT_EQUAL(graph.step[5].buffer, graph.step[1].buffer);
+    CU_ASSERT_EQUAL(graph.nbuffer, 3);
+
+    scrappie_matrix features = nanonet_features_from_raw(rt);
+    scrappie_matrix conv = convolution_activation(features, W, b, 2, eluf_array_inplace, NULL);
+    scrappie_matrix fwd = gru_forward_fused(conv, gF.iW, gF.b, gF.sW, gF.sW2, false, NULL);
+    scrappie_matrix bwd = gru_backward_fused(conv, gB.iW, gB.b, gB.sW, gB.sW2, false, NULL);
+    scrappie_matrix expected = feedforward2_tanh(fwd, bwd, Wf, Wb, bff, NULL);
+    scrappie_matrix out = run_network_graph(&graph, (graph_input){.signal = rt});
+    CU_ASSERT_PTR_NOT_NULL_FATAL(out);
+    CU_ASSERT(equality_scrappie_matrix(out, expected, 0.0));
+
+    out = free_scrappie_matrix(out);
+    expected = free_scrappie_matrix(expected);
+    bwd = free_scrappie_matrix(bwd);
+    fwd = free_scrappie_matrix(fwd);
+    conv = free_scrappie_matrix(conv);
+    features = free_scrappie_matrix(features);
+    bff = free_scrappie_matrix(bff);
+    Wb = free_scrappie_matrix(Wb);
+    Wf = free_scrappie_matrix(Wf);
+    free_gru_weights(&gB);
+    free_gru_weights(&gF);
+    b = free_scrappie_matrix(b);
+    W = free_scrappie_matrix(W);
+}
+
+void test_residual_network_graph(void) {
+    const size_t n = 50;
+    int sequence[50];
+    for (size_t i = 0; i < n; i++) {
+        sequence[i] = rand() % 4;
+    }
+    scrappie_matrix E = random_scrappie_matrix(8, 4, -1.0, 1.0);
+    scrappie_matrix W1 = random_scrappie_matrix(40, 8, -0.5, 0.5);
+    scrappie_matrix W2 = random_scrappie_matrix(40, 8, -0.5, 0.5);
+    scrappie_matrix W3 = random_scrappie_matrix(40, 3, -0.5, 0.5);
+    scrappie_matrix b8 = random_scrappie_matrix(8, 1, -0.5, 0.5);
+    scrappie_matrix b3 = random_scrappie_matrix(3, 1, -0.5, 0.5);
+
+    network_graph graph = {7, {GRAPH_EMBEDDING(E), GRAPH_CONVOLUTION(0, W1, b8, 1),
+                               GRAPH_ACTIVATION(1, tanhf_array_inplace),
+                               GRAPH_CONVOLUTION(2, W2, b8, 1),
+                               GRAPH_ACTIVATION(3, tanhf_array_inplace), GRAPH_RESIDUAL(2, 4),
+                               GRAPH_CONVOLUTION(5, W3, b3, 1)}};
+    CU_ASSERT_FATAL(plan_network_graph(&graph));
+    CU_ASSERT(graph.step[5].inplace);
+    CU_ASSERT_EQUAL(graph.step[5].buffer, graph.step[3].buffer);
+    CU_ASSERT_EQUAL(graph.nbuffer, 2);
+    CU_ASSERT_EQUAL(network_graph_bytes(&graph, n), 2 * 2 * n * sizeof(__m128));
+
+    scrappie_matrix X = embedding(sequence, n, E, NULL);
+    scrappie_matrix conv1 = convolution_activation(X, W1, b8, 1, tanhf_array_inplace, NULL);
+    scrappie_matrix conv2 = convolution_activation(conv1, W2, b8, 1, tanhf_array_inplace, NULL);
+    residual_inplace(conv1, conv2);
+    scrappie_matrix expected = convolution(conv2, W3, b3, 1, NULL);
+    scrappie_matrix out = run_network_graph(&graph, (graph_input){.sequence = sequence, .n = n});
+    CU_ASSERT_PTR_NOT_NULL_FATAL(out);
+    CU_ASSERT(equality_scrappie_matrix(out, expected, 0.0));
+
+    out = free_scrappie_matrix(out);
+    expected = free_scrappie_matrix(expected);
+    conv2 = free_scrappie_matrix(conv2);
+    conv1 = free_scrappie_matrix(conv1);
+    X = free_scrappie_matrix(X);
+    b3 = free_scrappie_matrix(b3);
+    b8 = free_scrappie_matrix(b8);
+    W3 = free_scrappie_matrix(W3);
+    W2 = free_scrappie_matrix(W2);
+    W1 = free_scrappie_matrix(W1);
+    E = free_scrappie_matrix(E);
+}
+
+void test_invalid_network_graph(void) {
+    scrappie_matrix W = random_scrappie_matrix(44, GRU_SIZE, -0.5, 0.5);
+    scrappie_matrix b = random_scrappie_matrix(GRU_SIZE, 1, -0.5, 0.5);
+    gru_weights g = random_gru_weights(12);
+
+    //  GRU whose input weights do not match its input
+    network_graph graph = {3, {GRAPH_FEATURES(), GRAPH_CONVOLUTION(0, W, b, 1),
+                               GRAPH_GRU(1, g.iW, g.b, g.sW, g.sW2, false, false)}};
+    CU_ASSERT_FALSE(plan_network_graph(&graph));
+    //  Layer reading a later layer
+    graph = (network_graph){2, {GRAPH_FEATURES(), GRAPH_ACTIVATION(1, tanhf_array_inplace)}};
+    CU_ASSERT_FALSE(plan_network_graph(&graph));
+    //  Activation in place of a tensor read later
+    graph = (network_graph){4, {GRAPH_FEATURES(), GRAPH_CONVOLUTION(0, W, b, 1),
+                                GRAPH_ACTIVATION(1, tanhf_array_inplace), GRAPH_RESIDUAL(1, 2)}};
+    CU_ASSERT_FALSE(plan_network_graph(&graph));
+
+    free_gru_weights(&g);
+    b = free_scrappie_matrix(b);
+    W = free_scrappie_matrix(W);
+}
+
+static test_with_description tests[] = {
+    {"Graph of convolution and GRUs agrees with layers", test_recurrent_network_graph},
+    {"Graph of bidirectional layer agrees with layers", test_bidirectional_network_graph},
+    {"Graph of residual convolutions agrees with layers", test_residual_network_graph},
+    {"Invalid network graphs rejected", test_invalid_network_graph},
+    {0}
+};
+
+/**   Register tests with CUnit
+ *
+ *    @returns 0 on success, non-zero on failure
+ **/
+int register_test_network_graph(void) {
+    return scrappie_register_test_suite("Network graphs", init_test_network_graph,
+                                        clean_test_network_graph, tests);
+}
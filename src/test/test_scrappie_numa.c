@@ -0,0 +1,108 @@
+#include <CUnit/Basic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "scrappie_matrix.h"
+#include "scrappie_numa.h"
+#include "scrappie_util.h"
+#include "test_common.h"
+
+#define MAX_CPU 16
+
+
+/**  Initialise test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int init_test_numa(void) {
+    return 0;
+}
+
+/**  Clean up after test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int clean_test_numa(void) {
+    scrappie_numa_unbind();
+    (void)scrappie_numa_enable(false);
+    return 0;
+}
+
+
+void test_parse_cpulist_numa(void) {
+    int cpu[MAX_CPU];
+    const int expected[] = {0, 1, 2, 3, 8, 10, 11};
+    const size_t n = scrappie_numa_parse_cpulist("0-3,8,10-11\n", cpu, MAX_CPU);
+    CU_ASSERT_EQUAL_FATAL(n, sizeof(expected) / sizeof(int));
+    for (size_t i = 0; i < n; i++) {
+        CU_ASSERT_EQUAL(cpu[i], expected[i]);
+    }
+}
+
+void test_parse_cpulist_truncated_numa(void) {
+    int cpu[MAX_CPU];
+    CU_ASSERT_EQUAL(3, scrappie_numa_parse_cpulist("4-11", cpu, 3));
+    CU_ASSERT_EQUAL(cpu[2], 6);
+}
+
+void test_parse_cpulist_malformed_numa(void) {
+    int cpu[MAX_CPU];
+    CU_ASSERT_EQUAL(0, scrappie_numa_parse_cpulist("3-1", cpu, MAX_CPU));
+    CU_ASSERT_EQUAL(0, scrappie_numa_parse_cpulist("a", cpu, MAX_CPU));
+    CU_ASSERT_EQUAL(0, scrappie_numa_parse_cpulist("1;2", cpu, MAX_CPU));
+    CU_ASSERT_EQUAL(0, scrappie_numa_parse_cpulist("", cpu, MAX_CPU));
+}
+
+void test_bind_disabled_numa(void) {
+    (void)scrappie_numa_enable(false);
+    CU_ASSERT_FALSE(scrappie_numa_bind(0, 1));
+    CU_ASSERT_EQUAL(0, scrappie_numa_node());
+    CU_ASSERT_EQUAL(1, scrappie_numa_nreplica());
+}
+
+/**  Workers are placed on a node and each sees weights it may use
+ **/
+void test_bind_workers_numa(void) {
+    const size_t nnode = scrappie_numa_enable(true);
+    if (0 == nnode) {
+        //  Placement unavailable on this system
+        return;
+    }
+    scrappie_matrix W = random_scrappie_matrix(12, 8, -1.0, 1.0);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(W);
+    CU_ASSERT_TRUE_FATAL(register_packed_weights(W));
+
+    const size_t nworker = 2 * nnode + 1;
+    for (size_t worker = 0; worker < nworker; worker++) {
+        CU_ASSERT_TRUE(scrappie_numa_bind(worker, nworker));
+        CU_ASSERT_TRUE(scrappie_numa_node() < nnode);
+        CU_ASSERT_TRUE(scrappie_numa_node() < scrappie_numa_nreplica() || 1 == scrappie_numa_nreplica());
+        const_scrappie_matrix local = scrappie_local_weights(W);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(local);
+        CU_ASSERT_TRUE(equality_scrappie_matrix(W, local, 0.0));
+        CU_ASSERT_TRUE(1 < scrappie_numa_nreplica() || W == local);
+        scrappie_numa_unbind();
+        CU_ASSERT_EQUAL(0, scrappie_numa_node());
+    }
+
+    unregister_packed_weights(W);
+    W = free_scrappie_matrix(W);
+    (void)scrappie_numa_enable(false);
+}
+
+
+static test_with_description tests[] = {
+    {"Parse list of CPUs", test_parse_cpulist_numa},
+    {"Parse list of CPUs truncated to maximum", test_parse_cpulist_truncated_numa},
+    {"Parse malformed list of CPUs", test_parse_cpulist_malformed_numa},
+    {"Bind worker without placement enabled", test_bind_disabled_numa},
+    {"Bind workers to nodes", test_bind_workers_numa},
+    {0}};
+
+/**   Register tests with CUnit
+ *
+ *    @returns 0 on success, non-zero on failure
+ **/
+int register_test_numa(void) {
+    return scrappie_register_test_suite("Placement of workers on NUMA nodes", init_test_numa, clean_test_numa, tests);
+}
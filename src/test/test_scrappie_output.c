@@ -0,0 +1,132 @@
+#include <CUnit/Basic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+#include "scrappie_output.h"
+#include "test_common.h"
+
+//  Several BGZF blocks of input
+#define NINPUT (3 * BGZF_BLOCK_INPUT + 1234)
+
+static char * input = NULL;
+
+
+/**  Initialise test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int init_test_output(void) {
+    input = malloc(NINPUT);
+    if (NULL == input) {
+        return 1;
+    }
+    srand(1);
+    const char bases[] = "ACGT";
+    for (size_t i = 0; i < NINPUT; i++) {
+        input[i] = (79 == i % 80) ? '\n' : bases[rand() % 4];
+    }
+    return 0;
+}
+
+/**  Clean up after test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int clean_test_output(void) {
+    free(input);
+    input = NULL;
+    return 0;
+}
+
+
+//  Decompress concatenated gzip members, returning number of bytes written to out
+static size_t gunzip_members(const uint8_t * in, size_t nin, char * out, size_t nout) {
+    size_t ndone = 0;
+    size_t nwritten = 0;
+    while (ndone < nin) {
+        z_stream zs = {0};
+        CU_ASSERT_EQUAL_FATAL(Z_OK, inflateInit2(&zs, 16 + MAX_WBITS));
+        zs.next_in = (Bytef *) in + ndone;
+        zs.avail_in = nin - ndone;
+        zs.next_out = (Bytef *) out + nwritten;
+        zs.avail_out = nout - nwritten;
+        CU_ASSERT_EQUAL_FATAL(Z_STREAM_END, inflate(&zs, Z_FINISH));
+        ndone += zs.total_in;
+        nwritten += zs.total_out;
+        inflateEnd(&zs);
+    }
+    return nwritten;
+}
+
+
+void test_printf_output(void) {
+    output_buffer buf = {NULL, 0, 0};
+    for (int i = 0; i < 1000; i++) {
+        CU_ASSERT_TRUE_FATAL(output_buffer_printf(&buf, ">read%d\n%s\n", i, "ACGT"));
+    }
+    CU_ASSERT_TRUE(buf.n <= buf.capacity);
+    CU_ASSERT_EQUAL(0, strncmp(buf.data, ">read0\nACGT\n>read1\n", 19));
+    CU_ASSERT_EQUAL(0, strncmp(buf.data + buf.n - 14, ">read999\nACGT\n", 14));
+    output_buffer_release(&buf);
+    CU_ASSERT_PTR_NULL(buf.data);
+    CU_ASSERT_EQUAL(0, buf.n);
+}
+
+/**  Compressed blocks are BGZF, each recording its length, and decompress to the input
+ **/
+void test_bgzf_output(void) {
+    output_buffer buf = {NULL, 0, 0};
+    CU_ASSERT_TRUE_FATAL(output_buffer_printf(&buf, "%.*s", NINPUT, input));
+    CU_ASSERT_TRUE_FATAL(output_buffer_bgzf(&buf, 6));
+    CU_ASSERT_TRUE(buf.n < NINPUT);
+
+    const uint8_t * data = (const uint8_t *) buf.data;
+    size_t nblock = 0;
+    for (size_t i = 0; i < buf.n; nblock++) {
+        CU_ASSERT_EQUAL_FATAL(0, memcmp(data + i, "\x1f\x8b\x08\x04", 4));
+        CU_ASSERT_EQUAL_FATAL(0, memcmp(data + i + 12, "BC", 2));
+        const size_t block_length = 1 + data[i + 16] + 256 * data[i + 17];
+        const uint8_t * isize = data + i + block_length - 4;
+        CU_ASSERT_TRUE(isize[0] + 256 * isize[1] <= BGZF_BLOCK_INPUT);
+        i += block_length;
+    }
+    CU_ASSERT_EQUAL(nblock, (NINPUT + BGZF_BLOCK_INPUT - 1) / BGZF_BLOCK_INPUT);
+
+    char * out = malloc(NINPUT + 1);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(out);
+    CU_ASSERT_EQUAL(NINPUT, gunzip_members(data, buf.n, out, NINPUT + 1));
+    CU_ASSERT_EQUAL(0, memcmp(out, input, NINPUT));
+    free(out);
+    output_buffer_release(&buf);
+}
+
+void test_bgzf_eof_output(void) {
+    FILE * fh = tmpfile();
+    CU_ASSERT_PTR_NOT_NULL_FATAL(fh);
+    CU_ASSERT_TRUE(write_bgzf_eof(fh));
+    CU_ASSERT_EQUAL(BGZF_EOF_LENGTH, ftell(fh));
+    rewind(fh);
+    uint8_t eof[BGZF_EOF_LENGTH];
+    CU_ASSERT_EQUAL_FATAL(BGZF_EOF_LENGTH, fread(eof, 1, BGZF_EOF_LENGTH, fh));
+    fclose(fh);
+    char out[1];
+    CU_ASSERT_EQUAL(0, gunzip_members(eof, BGZF_EOF_LENGTH, out, 1));
+}
+
+
+static test_with_description tests[] = {
+    {"Formatted output appended to buffer", test_printf_output},
+    {"Output compressed as BGZF blocks", test_bgzf_output},
+    {"BGZF end of file marker is empty", test_bgzf_eof_output},
+    {0}};
+
+/**   Register tests with CUnit
+ *
+ *    @returns 0 on success, non-zero on failure
+ **/
+int register_test_output(void) {
+    return scrappie_register_test_suite("Buffered and compressed output", init_test_output, clean_test_output, tests);
+}
@@ -0,0 +1,112 @@
+// Needed for mkstemp and fdopen
+#define BANANA 1
+#define _DEFAULT_SOURCE
+#define _POSIX_SOURCE 1
+
+#include <CUnit/Basic.h>
+#include <err.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "posterior_file.h"
+#include "scrappie_util.h"
+#include "test_common.h"
+
+static char posterior_tmpfile_name[] = "scrappie_posterior_file_XXXXXX";
+static scrappie_matrix mat[2] = {NULL, NULL};
+
+/**  Initialise posterior file test
+ *
+ *   Writes two random matrices to a temporary posterior file
+ *
+ *  @returns 0 on success, non-zero on failure
+ **/
+int init_test_scrappie_posterior_file(void) {
+    mat[0] = random_scrappie_matrix(25, 13, -1.0, 1.0);
+    mat[1] = random_scrappie_matrix(25, 1, -1.0, 1.0);
+    if (NULL == mat[0] || NULL == mat[1]) {
+        warnx("Failed to create random scrappie matrix.\n");
+        return -1;
+    }
+
+    (void)umask(022);
+    int outfileno = mkstemp(posterior_tmpfile_name);
+    FILE * outfile = (-1 != outfileno) ? fdopen(outfileno, "wb") : NULL;
+    if (NULL == outfile) {
+        warnx("Failed to open temporary file to write to.\n");
+        return -1;
+    }
+    bool ok = write_posterior_record(outfile, mat[0], "rnnrf_r94", "read_one")
+        && write_posterior_record(outfile, mat[1], "rnnrf_r94", "read_two");
+    ok &= (0 == fclose(outfile));
+    return ok ? 0 : -1;
+}
+
+/**  Clean up after posterior file test
+ *
+ *  @returns 0 on success, non-zero on failure
+ **/
+int clean_test_scrappie_posterior_file(void) {
+    mat[0] = free_scrappie_matrix(mat[0]);
+    mat[1] = free_scrappie_matrix(mat[1]);
+    return remove(posterior_tmpfile_name);
+}
+
+void test_roundtrip_posterior_file(void) {
+    posterior_file * pf = open_posterior_file(posterior_tmpfile_name);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(pf);
+    CU_ASSERT_EQUAL_FATAL(pf->nrecord, 2);
+
+    const char * read_id[2] = {"read_one", "read_two"};
+    for (size_t i = 0; i < 2; i++) {
+        const posterior_record_header * record = pf->record[i];
+        CU_ASSERT_EQUAL(record->nstate, mat[i]->nr);
+        CU_ASSERT_EQUAL(record->nblk, mat[i]->nc);
+        CU_ASSERT(0 == strcmp(record->model, "rnnrf_r94"));
+        CU_ASSERT(0 == strcmp(record->read_id, read_id[i]));
+
+        const float * data = posterior_record_data(record);
+        CU_ASSERT_EQUAL((uintptr_t)data % POSTERIOR_FILE_ALIGN, 0);
+
+        scrappie_matrix mat_in = posterior_record_to_matrix(record);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(mat_in);
+        CU_ASSERT(equality_scrappie_matrix(mat[i], mat_in, 0.0));
+        mat_in = free_scrappie_matrix(mat_in);
+    }
+
+    pf = free_posterior_file(pf);
+}
+
+void test_truncated_posterior_file(void) {
+    static char truncated_name[] = "scrappie_posterior_trunc_XXXXXX";
+    int fd = mkstemp(truncated_name);
+    FILE * fh = (-1 != fd) ? fdopen(fd, "wb") : NULL;
+    CU_ASSERT_PTR_NOT_NULL_FATAL(fh);
+    CU_ASSERT(write_posterior_record(fh, mat[0], "rnnrf_r94", "read_one"));
+    fclose(fh);
+    //  Lose last part of data
+    CU_ASSERT_EQUAL(truncate(truncated_name, sizeof(posterior_record_header) + 100), 0);
+
+    CU_ASSERT_PTR_NULL(open_posterior_file(truncated_name));
+    remove(truncated_name);
+}
+
+static test_with_description tests[] = {
+    {"Posterior file round trip", test_roundtrip_posterior_file},
+    {"Truncated posterior file rejected", test_truncated_posterior_file},
+    {0}
+};
+
+/**   Register tests with CUnit
+ *
+ *    @returns 0 on success, non-zero on failure
+ **/
+int register_test_posterior_file(void) {
+    return scrappie_register_test_suite("Binary posterior files", init_test_scrappie_posterior_file,
+                                        clean_test_scrappie_posterior_file, tests);
+}
@@ -1,8 +1,11 @@
 #include <CUnit/Basic.h>
 #include <err.h>
+#include <math.h>
 #include <stdbool.h>
 
 #include "layers.h"
+#include "nnfeatures.h"
+#include "read_filter.h"
 #include "scrappie_common.h"
 #include "scrappie_structures.h"
 #include "scrappie_util.h"
@@ -102,9 +105,166 @@ void test_normalise_signal(void) {
     free(sigarr);
 }
 
+void test_native_signal(void) {
+    const int winlen = 100;
+    raw_table rt = {0};
+    rt.sample = calloc(rawsignal->nc, sizeof(int16_t));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(rt.sample);
+    rt.n = rt.end = rawsignal->nc;
+    rt.offset = 16.0f;
+    rt.unit = 1373.41f / 8192.0f;
+    for(size_t i=0 ; i < rt.n ; i++){
+        rt.sample[i] = (int16_t)rawsignal->data.f[i * 4];
+        CU_ASSERT_EQUAL(rt.sample[i], rawsignal->data.f[i * 4]);
+    }
+
+    //  Histogram median and MAD agree with selection for odd and even lengths
+    for(size_t n=winlen - 1 ; n <= winlen ; n++){
+        float * sigarr = calloc(n, sizeof(float));
+        CU_ASSERT_PTR_NOT_NULL_FATAL(sigarr);
+        for(size_t i=0 ; i < n ; i++){
+            sigarr[i] = rt.sample[i];
+        }
+        float med, mad, imed, imad;
+        medmadf(sigarr, n, NULL, &med, &mad);
+        medmad_int16(rt.sample, n, &imed, &imad);
+        CU_ASSERT_EQUAL(med, imed);
+        CU_ASSERT_DOUBLE_EQUAL(mad, imad, 1e-5 * mad);
+        free(sigarr);
+    }
+
+    rt = trim_raw_by_mad(rt, winlen, 0.0f);
+    CU_ASSERT_PTR_NULL(rt.raw);
+    CU_ASSERT_EQUAL(rt.start, 0);
+    CU_ASSERT_EQUAL(rt.end, (rt.n / winlen) * winlen);
+
+    rt.start += 200;
+    rt.end -= 10;
+    CU_ASSERT_EQUAL_FATAL(rt.end - rt.start, normsignal->nc);
+
+    //  Features of native signal are the normalised signal
+    rt = medmad_normalise_raw(rt);
+    scrappie_matrix features = nanonet_features_from_raw(rt);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(features);
+    CU_ASSERT_TRUE(equality_scrappie_matrix(features, normsignal, 1e-4));
+
+    features = free_scrappie_matrix(features);
+    free(rt.sample);
+}
+
+/**  Trimming and normalising a view leaves the signal untouched, the
+ *   normalised signal only being formed as features are created
+ **/
+void test_view_signal(void) {
+    raw_table rt = {0};
+    rt.raw = calloc(rawsignal->nc, sizeof(float));
+    float * orig = calloc(rawsignal->nc, sizeof(float));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(rt.raw);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(orig);
+    rt.n = rt.end = rawsignal->nc;
+    for(size_t i=0 ; i < rt.n ; i++){
+        rt.raw[i] = orig[i] = (rawsignal->data.f[i * 4] + 16.0f) * (1373.41f / 8192.0f);
+    }
+
+    raw_table view = trim_raw_view(rt, 200, 10, 100, 0.0f);
+    CU_ASSERT_TRUE(view.raw == rt.raw);
+    CU_ASSERT_EQUAL(view.start, 200);
+    CU_ASSERT_EQUAL_FATAL(view.end - view.start, normsignal->nc);
+
+    view = medmad_normalise_raw(view);
+    CU_ASSERT_TRUE(view.scaled);
+    scrappie_matrix features = nanonet_features_from_raw(view);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(features);
+    CU_ASSERT_TRUE(equality_scrappie_matrix(features, normsignal, 1e-4));
+    CU_ASSERT_TRUE(equality_arrayf(rt.raw, orig, rt.n, 0.0));
+
+    //  A view trimmed away is empty but its signal is kept
+    view = trim_raw_view(rt, 200, 10, rt.n + 1, 0.0f);
+    CU_ASSERT_TRUE(view.raw == rt.raw);
+    CU_ASSERT_EQUAL(view.start, view.end);
+
+    features = free_scrappie_matrix(features);
+    free(orig);
+    free(rt.raw);
+}
+
+/**  Native signal and the same signal in pA have the same statistics
+ **/
+void test_filter_read_native(void) {
+    raw_table native = {0};
+    raw_table rt = {0};
+    native.sample = calloc(rawsignal->nc, sizeof(int16_t));
+    rt.raw = calloc(rawsignal->nc, sizeof(float));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(native.sample);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(rt.raw);
+    native.n = native.end = rt.n = rt.end = rawsignal->nc;
+    native.offset = 16.0f;
+    native.unit = 1373.41f / 8192.0f;
+    for(size_t i=0 ; i < native.n ; i++){
+        native.sample[i] = (int16_t)rawsignal->data.f[i * 4];
+        rt.raw[i] = (native.sample[i] + native.offset) * native.unit;
+    }
+
+    read_filter_param param = read_filter_defaults;
+    read_filter_stats stats, native_stats;
+    CU_ASSERT_FALSE(read_filter_enabled(&param));
+    CU_ASSERT_EQUAL(filter_read(rt, &param, &stats), READ_FILTER_PASS);
+    CU_ASSERT_EQUAL(stats.nsample, rt.n);
+    CU_ASSERT_TRUE(isnan(stats.mad));
+    CU_ASSERT_TRUE(isnan(stats.event_rate));
+
+    param.min_mad = 1.0f;
+    param.min_event_rate = 0.01f;
+    CU_ASSERT_TRUE(read_filter_enabled(&param));
+    CU_ASSERT_EQUAL(filter_read(rt, &param, &stats), READ_FILTER_PASS);
+    CU_ASSERT_EQUAL(filter_read(native, &param, &native_stats), READ_FILTER_PASS);
+    CU_ASSERT_DOUBLE_EQUAL(stats.mad, native_stats.mad, 1e-4 * stats.mad);
+    CU_ASSERT_EQUAL(stats.event_rate, native_stats.event_rate);
+
+    free(rt.raw);
+    free(native.sample);
+}
+
+/**  Each bound of the filter rejects reads outside it, and a constant signal
+ *   has neither spread nor events
+ **/
+void test_filter_read_bounds(void) {
+    raw_table rt = {0};
+    rt.raw = array_from_scrappie_matrix(trimsignal);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(rt.raw);
+    rt.n = rt.end = trimsignal->nc;
+    read_filter_stats stats;
+    CU_ASSERT_EQUAL(filter_read(rt, &(read_filter_param){.min_length = rt.n + 1}, NULL), READ_FILTER_SHORT);
+    CU_ASSERT_EQUAL(filter_read(rt, &(read_filter_param){.max_length = rt.n - 1}, NULL), READ_FILTER_LONG);
+    CU_ASSERT_EQUAL(filter_read(rt, &(read_filter_param){.min_length = rt.n, .max_length = rt.n}, NULL),
+                    READ_FILTER_PASS);
+
+    CU_ASSERT_EQUAL(filter_read(rt, &(read_filter_param){.max_mad = 1e-3f}, &stats), READ_FILTER_HIGH_MAD);
+    CU_ASSERT_TRUE(stats.mad > 1e-3f);
+    CU_ASSERT_EQUAL(filter_read(rt, &(read_filter_param){.min_mad = 2.0f * stats.mad}, NULL), READ_FILTER_LOW_MAD);
+    CU_ASSERT_EQUAL(filter_read(rt, &(read_filter_param){.max_event_rate = 1e-3f}, &stats), READ_FILTER_MANY_EVENTS);
+    CU_ASSERT_TRUE(stats.event_rate > 1e-3f && stats.event_rate <= 1.0f);
+    CU_ASSERT_EQUAL(filter_read(rt, &(read_filter_param){.min_event_rate = 2.0f * stats.event_rate}, NULL),
+                    READ_FILTER_FEW_EVENTS);
+
+    for(size_t i=0 ; i < rt.n ; i++){
+        rt.raw[i] = 100.0f;
+    }
+    const read_filter_param blocked = {.min_mad = 1.0f, .min_event_rate = 0.01f};
+    CU_ASSERT_EQUAL(filter_read(rt, &blocked, &stats), READ_FILTER_LOW_MAD);
+    CU_ASSERT_EQUAL(stats.mad, 0.0f);
+    CU_ASSERT_EQUAL(filter_read(rt, &(read_filter_param){.min_event_rate = 0.01f}, &stats), READ_FILTER_FEW_EVENTS);
+
+    free(rt.raw);
+}
+
 static test_with_description tests[] = {
     {"Normalise trimmed signal", test_normalise_signal},
     {"Trimming of raw signal", test_trim_signal},
+    {"Native signal normalised as features are created", test_native_signal},
+    {"Trimmed and normalised view leaves signal untouched", test_view_signal},
+    {"Filter statistics of native signal same as in pA", test_filter_read_native},
+    {"Filter rejects reads outside each bound", test_filter_read_bounds},
     {0}};
 
 /**   Register tests with CUnit
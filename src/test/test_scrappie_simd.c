@@ -0,0 +1,210 @@
+#include <CUnit/Basic.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "test_common.h"
+#include <scrappie_simd.h>
+
+//  Not a multiple of eight or sixteen, so the tails of wider kernels are exercised
+#define NELT 1036
+#define LSTM_SIZE 100
+
+static float input[NELT];
+static float expected[NELT];
+static float observed[NELT];
+static enum scrappie_simd level_at_start = SCRAPPIE_SIMD_SSE;
+
+
+/**  Initialise test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int init_test_simd(void) {
+    level_at_start = scrappie_simd_get();
+    srand(1);
+    for (size_t i = 0; i < NELT; i++) {
+        input[i] = 20.0f * ((float)rand() / RAND_MAX - 0.5f);
+    }
+    return 0;
+}
+
+/**  Clean up after test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int clean_test_simd(void) {
+    scrappie_simd_set(level_at_start);
+    return 0;
+}
+
+
+static bool close_arrays(float const * x, float const * y, size_t n, float tol) {
+    for (size_t i = 0; i < n; i++) {
+        if (isnan(x[i]) != isnan(y[i])) {
+            return false;
+        }
+        if (!isnan(x[i]) && fabsf(x[i] - y[i]) > tol * fmaxf(1.0f, fabsf(x[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**  Compare elementwise kernel at every supported level with SSE version
+ **/
+static void elementwise_helper(void (*func)(float *, size_t), bool absolute) {
+    memcpy(expected, input, NELT * sizeof(float));
+    if (absolute) {
+        for (size_t i = 0; i < NELT; i++) {
+            expected[i] = fabsf(expected[i]);
+        }
+    }
+    memcpy(observed, expected, NELT * sizeof(float));
+    CU_ASSERT_EQUAL_FATAL(scrappie_simd_set(SCRAPPIE_SIMD_SSE), SCRAPPIE_SIMD_SSE);
+    func(expected, NELT);
+
+    const enum scrappie_simd supported = scrappie_simd_supported();
+    for (int level = SCRAPPIE_SIMD_AVX2; level <= supported; level++) {
+        float * x = malloc(NELT * sizeof(float));
+        CU_ASSERT_PTR_NOT_NULL_FATAL(x);
+        memcpy(x, observed, NELT * sizeof(float));
+        CU_ASSERT_EQUAL(scrappie_simd_set(level), level);
+        func(x, NELT);
+        CU_ASSERT_TRUE(close_arrays(expected, x, NELT, 1e-5f));
+        free(x);
+    }
+}
+
+void test_tanh_simd(void) {
+    elementwise_helper(tanhf_array_inplace, false);
+}
+
+void test_exp_simd(void) {
+    elementwise_helper(expf_array_inplace, false);
+}
+
+void test_log_simd(void) {
+    elementwise_helper(logf_array_inplace, true);
+}
+
+void test_log_negative_simd(void) {
+    elementwise_helper(logf_array_inplace, false);
+}
+
+void test_logistic_simd(void) {
+    elementwise_helper(logisticf_array_inplace, false);
+}
+
+void test_elu_simd(void) {
+    elementwise_helper(eluf_array_inplace, false);
+}
+
+void test_normalise_simd(void) {
+    //  Columns with padding of three
+    const size_t nr = 25;
+    const size_t stride = 28;
+    const size_t nc = NELT / stride;
+    memcpy(expected, input, NELT * sizeof(float));
+    for (size_t i = 0; i < NELT; i++) {
+        expected[i] = fabsf(expected[i]);
+    }
+    memcpy(observed, expected, NELT * sizeof(float));
+    scrappie_simd_set(SCRAPPIE_SIMD_SSE);
+    normalise_columns_inplace(expected, nr, stride, nc);
+
+    for (size_t c = 0; c < nc; c++) {
+        float sum = 0.0f;
+        for (size_t r = 0; r < nr; r++) {
+            sum += expected[c * stride + r];
+        }
+        CU_ASSERT_DOUBLE_EQUAL(sum, 1.0f, 1e-5f);
+    }
+
+    const enum scrappie_simd supported = scrappie_simd_supported();
+    for (int level = SCRAPPIE_SIMD_AVX2; level <= supported; level++) {
+        float x[NELT];
+        memcpy(x, observed, NELT * sizeof(float));
+        scrappie_simd_set(level);
+        normalise_columns_inplace(x, nr, stride, nc);
+        CU_ASSERT_TRUE(close_arrays(expected, x, nc * stride, 1e-5f));
+    }
+}
+
+void test_lstm_gates_simd(void) {
+    float state_exp[LSTM_SIZE], out_exp[LSTM_SIZE];
+    memcpy(state_exp, input + 4 * LSTM_SIZE, LSTM_SIZE * sizeof(float));
+    scrappie_simd_set(SCRAPPIE_SIMD_SSE);
+    lstm_gates_array(input, input + 5 * LSTM_SIZE, state_exp, out_exp, LSTM_SIZE);
+
+    const enum scrappie_simd supported = scrappie_simd_supported();
+    for (int level = SCRAPPIE_SIMD_AVX2; level <= supported; level++) {
+        float state[LSTM_SIZE], out[LSTM_SIZE];
+        memcpy(state, input + 4 * LSTM_SIZE, LSTM_SIZE * sizeof(float));
+        scrappie_simd_set(level);
+        lstm_gates_array(input, input + 5 * LSTM_SIZE, state, out, LSTM_SIZE);
+        CU_ASSERT_TRUE(close_arrays(state_exp, state, LSTM_SIZE, 1e-5f));
+        CU_ASSERT_TRUE(close_arrays(out_exp, out, LSTM_SIZE, 1e-5f));
+    }
+}
+
+void test_set_level_clipped_simd(void) {
+    const enum scrappie_simd supported = scrappie_simd_supported();
+    CU_ASSERT_EQUAL(scrappie_simd_set(SCRAPPIE_SIMD_INVALID), supported);
+    CU_ASSERT_EQUAL(scrappie_simd_get(), supported);
+    CU_ASSERT_EQUAL(scrappie_simd_set(SCRAPPIE_SIMD_SSE), SCRAPPIE_SIMD_SSE);
+    CU_ASSERT_EQUAL(scrappie_simd_from_string("avx2"), SCRAPPIE_SIMD_AVX2);
+    CU_ASSERT_EQUAL(scrappie_simd_from_string("mmx"), SCRAPPIE_SIMD_INVALID);
+}
+
+/**  Cheaper tiers of activations, at every supported level, close to accurate
+ **/
+void test_math_tiers_simd(void) {
+    void (*funcs[4])(float *, size_t) = {tanhf_array_inplace, expf_array_inplace,
+                                         logisticf_array_inplace, eluf_array_inplace};
+    const float tol[SCRAPPIE_MATH_INVALID] = {1e-5f, 1e-4f, 0.07f};
+    const enum scrappie_simd supported = scrappie_simd_supported();
+    for (size_t f = 0; f < 4; f++) {
+        memcpy(expected, input, NELT * sizeof(float));
+        scrappie_math_set(SCRAPPIE_MATH_ACCURATE);
+        scrappie_simd_set(SCRAPPIE_SIMD_SSE);
+        funcs[f](expected, NELT);
+        for (int tier = SCRAPPIE_MATH_FAST; tier < SCRAPPIE_MATH_INVALID; tier++) {
+            CU_ASSERT_EQUAL(scrappie_math_set(tier), tier);
+            for (int level = SCRAPPIE_SIMD_SSE; level <= supported; level++) {
+                memcpy(observed, input, NELT * sizeof(float));
+                scrappie_simd_set(level);
+                funcs[f](observed, NELT);
+                CU_ASSERT_TRUE(close_arrays(expected, observed, NELT, tol[tier]));
+            }
+        }
+    }
+    CU_ASSERT_EQUAL(scrappie_math_set(SCRAPPIE_MATH_INVALID), SCRAPPIE_MATH_FASTEST);
+    CU_ASSERT_EQUAL(scrappie_math_set(SCRAPPIE_MATH_ACCURATE), SCRAPPIE_MATH_ACCURATE);
+    CU_ASSERT_EQUAL(scrappie_math_from_string("fast"), SCRAPPIE_MATH_FAST);
+    CU_ASSERT_EQUAL(scrappie_math_from_string("sloppy"), SCRAPPIE_MATH_INVALID);
+}
+
+
+static test_with_description tests[] = {
+    {"Wide tanh same as SSE", test_tanh_simd},
+    {"Wide exp same as SSE", test_exp_simd},
+    {"Wide log same as SSE", test_log_simd},
+    {"Wide log of negative input same as SSE", test_log_negative_simd},
+    {"Wide logistic same as SSE", test_logistic_simd},
+    {"Wide ELU same as SSE", test_elu_simd},
+    {"Wide column normalisation same as SSE", test_normalise_simd},
+    {"Wide LSTM gates same as SSE", test_lstm_gates_simd},
+    {"Requested level clipped to supported", test_set_level_clipped_simd},
+    {"Cheaper accuracy tiers close to accurate", test_math_tiers_simd},
+    {0}};
+
+/**   Register tests with CUnit
+ *
+ *    @returns 0 on success, non-zero on failure
+ **/
+int register_test_simd(void) {
+    return scrappie_register_test_suite("Test runtime dispatched vector kernels", init_test_simd, clean_test_simd, tests);
+}
@@ -1,10 +1,24 @@
+// Needed for mkdtemp
 #define BANANA 1
+#define _DEFAULT_SOURCE
+#define _POSIX_SOURCE 1
+
 #include <CUnit/Basic.h>
+#include <math.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 
 #include <test_common.h>
 
+#include <decode.h>
 #include <networks.h>
+#include <scrappie_util.h>
+#include <simulate.h>
+#include <squiggle_cache.h>
+#include <util.h>
 
 static const int sequence[100] = {
         1, 0, 3, 3, 2, 1, 0, 1, 3, 1, 1, 0, 2, 1, 1, 3, 2, 1, 3, 2,
@@ -46,9 +60,209 @@ void test_short_squiggle_transformed_units(void) {
     squiggle = free_scrappie_matrix(squiggle);
 }
 
+/**  Each sequence of a packed batch is predicted as it is alone, and
+ *   sequences shorter than the window of the convolutions are predicted
+ **/
+void test_squiggle_batch(void) {
+    static char const * bases[] = {"ACGTTGCAACGGTATTACGA", "GAT", NULL, "ACGTNACGT", "",
+                                   "TTTTTTTTTTACACACACAC", "C", "GGCATTCAGGTAAACCCGTTA"};
+    const size_t nseq = sizeof(bases) / sizeof(bases[0]);
+    size_t n[sizeof(bases) / sizeof(bases[0])];
+    for (size_t i = 0; i < nseq; i++) {
+        n[i] = (NULL != bases[i]) ? strlen(bases[i]) : 0;
+    }
+
+    for (int rescale = 0; rescale < 2; rescale++) {
+        scrappie_matrix * squiggle = sequence_to_squiggle_batch(bases, n, nseq, rescale,
+                                                                SCRAPPIE_SQUIGGLE_MODEL_R9_4);
+        CU_ASSERT_PTR_NOT_NULL_FATAL(squiggle);
+        for (size_t i = 0; i < nseq; i++) {
+            //  Missing, empty and sequences with bases other than ACGT are not predicted
+            if (NULL == bases[i] || 0 == n[i] || NULL != strchr(bases[i], 'N')) {
+                CU_ASSERT_PTR_NULL(squiggle[i]);
+                continue;
+            }
+            CU_ASSERT_PTR_NOT_NULL_FATAL(squiggle[i]);
+            CU_ASSERT_EQUAL(squiggle[i]->nc, n[i]);
+            if (n[i] < 9) {
+                //  Too short to be predicted alone, since convolution would overrun the sequence
+                squiggle[i] = free_scrappie_matrix(squiggle[i]);
+                continue;
+            }
+            scrappie_matrix expected = sequence_to_squiggle(bases[i], n[i], rescale,
+                                                            SCRAPPIE_SQUIGGLE_MODEL_R9_4);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(expected);
+            CU_ASSERT_TRUE(equality_scrappie_matrix(squiggle[i], expected, 1e-4));
+            expected = free_scrappie_matrix(expected);
+            squiggle[i] = free_scrappie_matrix(squiggle[i]);
+        }
+        free(squiggle);
+    }
+}
+
+void test_squiggle_cache_roundtrip(void) {
+    static const char bases[] = "ACGTTGCAAC";
+    static const char other[] = "ACGTTGCAAG";
+    const size_t n = 10;
+    char dir[] = "scrappie_squiggle_cache_XXXXXX";
+    CU_ASSERT_PTR_NOT_NULL_FATAL(mkdtemp(dir));
+
+    scrappie_matrix squiggle = random_scrappie_matrix(3, n, -1.0, 1.0);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(squiggle);
+    CU_ASSERT_PTR_NULL(load_cached_squiggle(dir, "squiggle_r94", bases, n, false));
+    CU_ASSERT_TRUE(write_cached_squiggle(dir, "squiggle_r94", bases, n, false, squiggle));
+
+    cached_squiggle * cs = load_cached_squiggle(dir, "squiggle_r94", bases, n, false);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(cs);
+    CU_ASSERT_EQUAL(0, (size_t)cs->squiggle.data.f % 16);
+    CU_ASSERT_TRUE(equality_scrappie_matrix(&cs->squiggle, squiggle, 0.0f));
+
+    //  Different sequence, model or units are not found
+    CU_ASSERT_PTR_NULL(load_cached_squiggle(dir, "squiggle_r94", other, n, false));
+    CU_ASSERT_PTR_NULL(load_cached_squiggle(dir, "squiggle_r10", bases, n, false));
+    CU_ASSERT_PTR_NULL(load_cached_squiggle(dir, "squiggle_r94", bases, n, true));
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/squiggle_r94-%016llx.squiggle", dir,
+             (unsigned long long)squiggle_cache_hash("squiggle_r94", bases, n, false));
+    cs = free_cached_squiggle(cs);
+    CU_ASSERT_EQUAL(0, remove(path));
+    CU_ASSERT_EQUAL(0, rmdir(dir));
+    squiggle = free_scrappie_matrix(squiggle);
+}
+
+/**  Signal following squiggle, dwelling on each position for its expected duration
+ **/
+static raw_table signal_from_squiggle(const_scrappie_matrix squiggle) {
+    size_t n = 0;
+    for(size_t pos=0 ; pos < squiggle->nc ; pos++){
+        n += 1 + (size_t)(1.0f / plogisticf(squiggle->data.f[pos * squiggle->stride + 2]));
+    }
+    raw_table rt = {NULL, n, 0, n, calloc(n, sizeof(float))};
+    if(NULL != rt.raw){
+        for(size_t pos=0, i=0 ; pos < squiggle->nc ; pos++){
+            const float * params = squiggle->data.f + pos * squiggle->stride;
+            const size_t dwell = 1 + (size_t)(1.0f / plogisticf(params[2]));
+            for(size_t j=0 ; j < dwell ; j++, i++){
+                rt.raw[i] = params[0] + ((j % 2) ? 0.5f : -0.5f) * expf(params[1]);
+            }
+        }
+    }
+    return rt;
+}
+
+void test_squiggle_match_banded(void) {
+    scrappie_matrix squiggle = squiggle_r94(sequence, nseqbase, false);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(squiggle);
+    raw_table rt = signal_from_squiggle(squiggle);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(rt.raw);
+    int32_t * path = calloc(rt.n, sizeof(int32_t));
+    int32_t * path_banded = calloc(rt.n, sizeof(int32_t));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(path);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(path_banded);
+
+    const float score = squiggle_match_viterbi(rt, 1.0f, squiggle, 0.0f, 2.0f, 5000.0f, 5.0f, path);
+    CU_ASSERT_TRUE(isfinite(score));
+    CU_ASSERT_EQUAL(path[0], 0);
+    CU_ASSERT_EQUAL(path[rt.n - 1], nseqbase - 1);
+
+    //  Full width band is the unbanded mapping; a narrow band finds the same path
+    const size_t bands[3] = {0, nseqbase, 16};
+    for(size_t b=0 ; b < 3 ; b++){
+        const float score_banded = squiggle_match_viterbi_banded(rt, 1.0f, squiggle, 0.0f, 2.0f, 5000.0f,
+                                                                 5.0f, bands[b], path_banded);
+        CU_ASSERT_EQUAL(score, score_banded);
+        CU_ASSERT_EQUAL(0, memcmp(path, path_banded, rt.n * sizeof(int32_t)));
+    }
+
+    //  Banded forward sums over a subset of the paths of the unbanded
+    const float fscore = squiggle_match_forward(rt, 1.0f, squiggle, 0.0f, 2.0f, 5000.0f, 5.0f);
+    CU_ASSERT_TRUE(fscore >= score);
+    CU_ASSERT_EQUAL(fscore, squiggle_match_forward_banded(rt, 1.0f, squiggle, 0.0f, 2.0f, 5000.0f, 5.0f,
+                                                          nseqbase));
+    const float fscore_banded = squiggle_match_forward_banded(rt, 1.0f, squiggle, 0.0f, 2.0f, 5000.0f,
+                                                              5.0f, 16);
+    CU_ASSERT_TRUE(fscore_banded >= score && fscore_banded <= fscore + 1e-3f);
+
+    free(path_banded);
+    free(path);
+    free(rt.raw);
+    squiggle = free_scrappie_matrix(squiggle);
+}
+
+void test_simulate_fixed_without_noise(void) {
+    scrappie_matrix squiggle = squiggle_r94(sequence, nseqbase, true);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(squiggle);
+    simulate_param param = simulate_defaults;
+    param.noise = SIMULATE_NOISE_NONE;
+
+    size_t nsample = 0;
+    float * signal = simulate_signal(squiggle, param, 1, &nsample);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(signal);
+
+    //  Each position is its level, repeated for its rounded dwell
+    size_t i = 0;
+    for (size_t pos = 0; pos < nseqbase; pos++) {
+        const float * col = squiggle->data.f + pos * squiggle->stride;
+        const float level = param.shift + param.scale * col[0];
+        const size_t dwell = (roundf(col[2]) > 1.0f) ? (size_t)roundf(col[2]) : 1;
+        for (size_t j = 0; j < dwell && i < nsample; j++, i++) {
+            CU_ASSERT_DOUBLE_EQUAL(signal[i], level, 1e-4);
+        }
+    }
+    CU_ASSERT_EQUAL(i, nsample);
+
+    free(signal);
+    squiggle = free_scrappie_matrix(squiggle);
+}
+
+void test_simulate_seed(void) {
+    scrappie_matrix squiggle = squiggle_r94(sequence, nseqbase, true);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(squiggle);
+    simulate_param param = simulate_defaults;
+    param.dwell = SIMULATE_DWELL_GAMMA;
+
+    size_t n1 = 0, n2 = 0, n3 = 0;
+    float * sig1 = simulate_signal(squiggle, param, 42, &n1);
+    float * sig2 = simulate_signal(squiggle, param, 42, &n2);
+    float * sig3 = simulate_signal(squiggle, param, 43, &n3);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(sig1);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(sig2);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(sig3);
+
+    CU_ASSERT_EQUAL(n1, n2);
+    CU_ASSERT_EQUAL(0, memcmp(sig1, sig2, n1 * sizeof(float)));
+    CU_ASSERT_TRUE(n1 != n3 || 0 != memcmp(sig1, sig3, n1 * sizeof(float)));
+
+    free(sig3);
+    free(sig2);
+    free(sig1);
+    squiggle = free_scrappie_matrix(squiggle);
+}
+
+void test_simulate_from_string(void) {
+    float shape = 2.0f;
+    CU_ASSERT_EQUAL(SIMULATE_DWELL_FIXED, simulate_dwell_from_string("fixed", &shape));
+    CU_ASSERT_EQUAL(SIMULATE_DWELL_POISSON, simulate_dwell_from_string("poisson", &shape));
+    CU_ASSERT_EQUAL(SIMULATE_DWELL_GAMMA, simulate_dwell_from_string("gamma", &shape));
+    CU_ASSERT_DOUBLE_EQUAL(shape, 2.0, 1e-6);
+    CU_ASSERT_EQUAL(SIMULATE_DWELL_GAMMA, simulate_dwell_from_string("gamma:0.5", &shape));
+    CU_ASSERT_DOUBLE_EQUAL(shape, 0.5, 1e-6);
+    CU_ASSERT_EQUAL(SIMULATE_DWELL_INVALID, simulate_dwell_from_string("gamma:-1", &shape));
+    CU_ASSERT_EQUAL(SIMULATE_DWELL_INVALID, simulate_dwell_from_string("uniform", &shape));
+    CU_ASSERT_EQUAL(SIMULATE_NOISE_GAUSSIAN, simulate_noise_from_string("gaussian"));
+    CU_ASSERT_EQUAL(SIMULATE_NOISE_INVALID, simulate_noise_from_string("cauchy"));
+}
+
 static test_with_description tests[] = {
     {"Short sequence to squiggle with network parameterisation", test_short_squiggle_original_units},
     {"Short sequence to squiggle with transformed parameterisation", test_short_squiggle_transformed_units},
+    {"Squiggles of packed batch agree with those predicted alone", test_squiggle_batch},
+    {"Round-trip squiggle through cache", test_squiggle_cache_roundtrip},
+    {"Banded mapping of signal to squiggle", test_squiggle_match_banded},
+    {"Simulate signal with fixed dwell and no noise", test_simulate_fixed_without_noise},
+    {"Simulation is reproducible from seed", test_simulate_seed},
+    {"Simulation distributions from strings", test_simulate_from_string},
     {0}};
 
 /**   Register tests with CUnit
@@ -0,0 +1,168 @@
+#include <CUnit/Basic.h>
+#include <err.h>
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "basecall_stream.h"
+#include "networks.h"
+#include "scrappie_structures.h"
+#include "scrappie_util.h"
+#include "test_common.h"
+#include "util.h"
+
+static const char normsignalfile[] = "normalised_signal.crp";
+static const size_t stream_len = 6000;
+
+static scrappie_matrix normsignal = NULL;
+static float * normsig_arr = NULL;
+
+
+/**  Initialise test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int init_test_stream(void) {
+    normsignal = read_scrappie_matrix(normsignalfile);
+    if(NULL == normsignal){
+        return 1;
+    }
+    normsig_arr = array_from_scrappie_matrix(normsignal);
+    if(NULL == normsig_arr){
+        return 1;
+    }
+
+    return 0;
+}
+
+/**  Clean up after test
+ *
+ *   @returns 0 on success, non-zero on failure
+ **/
+int clean_test_stream(void) {
+    free(normsig_arr);
+    normsignal = free_scrappie_matrix(normsignal);
+    return 0;
+}
+
+
+//  Posterior of whole signal, normalised as a stream calibrated on ncalib samples
+static scrappie_matrix full_posterior(enum raw_model_type model, size_t n, size_t ncalib){
+    float * sig = calloc(n, sizeof(float));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(sig);
+    float med, mad;
+    medmadf(normsig_arr, ncalib, NULL, &med, &mad);
+    for (size_t i = 0; i < n; i++) {
+        sig[i] = (normsig_arr[i] - med) / mad;
+    }
+    raw_table rt = {NULL, n, 0, n, sig};
+    scrappie_matrix post = get_posterior_function(model)(rt, 1e-5f, 1.0f, 1.0f, true);
+    free(sig);
+    return post;
+}
+
+
+/**  A stream given all of its signal at once is the posterior of the read
+ **/
+void test_stream_single_push_helper(enum raw_model_type model){
+    CU_ASSERT_FATAL(stream_len <= normsignal->nc);
+    scrappie_matrix post = full_posterior(model, stream_len, stream_len);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(post);
+
+    basecall_stream_param param = basecall_stream_defaults;
+    param.calibration = stream_len + 1;
+    basecall_stream * stream = make_basecall_stream(model, param);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(stream);
+    CU_ASSERT_EQUAL(0, basecall_stream_push(stream, normsig_arr, stream_len));
+    CU_ASSERT_EQUAL(post->nc, basecall_stream_finish(stream));
+
+    const _Mat spost = basecall_stream_posterior(stream);
+    CU_ASSERT_EQUAL_FATAL(spost.nc, post->nc);
+    CU_ASSERT_TRUE(equality_scrappie_matrix(&spost, post, 1e-5));
+
+    stream = free_basecall_stream(stream);
+    post = free_scrappie_matrix(post);
+}
+
+void test_stream_single_push_rgrgr_r94(void){
+    test_stream_single_push_helper(SCRAPPIE_MODEL_RGRGR_R9_4);
+}
+
+void test_stream_single_push_rnnrf_r94(void){
+    test_stream_single_push_helper(SCRAPPIE_MODEL_RNNRF_R9_4);
+}
+
+
+/**  Signal pushed in small chunks gives bases before the stream ends and a
+ *   posterior close to that of the whole read
+ **/
+void test_stream_chunked_push_helper(enum raw_model_type model){
+    const size_t chunk = 400;
+    const basecall_stream_param param = basecall_stream_defaults;
+    scrappie_matrix post = full_posterior(model, stream_len, param.calibration);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(post);
+    basecall_stream * stream = make_basecall_stream(model, param);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(stream);
+
+    size_t ncommitted = 0;
+    bool early_call = false;
+    for (size_t i = 0; i < stream_len; i += chunk) {
+        const size_t n = (i + chunk < stream_len) ? chunk : (stream_len - i);
+        const int nnew = basecall_stream_push(stream, normsig_arr + i, n);
+        CU_ASSERT_FATAL(nnew >= 0);
+        ncommitted += nnew;
+        if (!early_call && ncommitted > 0) {
+            char * basecall = basecall_stream_basecall(stream, 0.0f, 0.0f, 2.0f, NULL, NULL);
+            early_call = (NULL != basecall) && strlen(basecall) > 0;
+            free(basecall);
+        }
+    }
+    CU_ASSERT_TRUE(early_call);
+    CU_ASSERT_TRUE(ncommitted < post->nc);
+    const int nlast = basecall_stream_finish(stream);
+    CU_ASSERT_FATAL(nlast >= 0);
+    CU_ASSERT_EQUAL(ncommitted + nlast, post->nc);
+    CU_ASSERT_EQUAL(-1, basecall_stream_push(stream, normsig_arr, 1));
+
+    //  Most blocks agree on the most probable state
+    const _Mat spost = basecall_stream_posterior(stream);
+    CU_ASSERT_EQUAL_FATAL(spost.nc, post->nc);
+    size_t nagree = 0;
+    for (size_t c = 0; c < post->nc; c++) {
+        const size_t offset = c * post->stride;
+        nagree += argmaxf(spost.data.f + offset, post->nr) == argmaxf(post->data.f + offset, post->nr);
+    }
+    CU_ASSERT_TRUE(nagree >= 0.95 * post->nc);
+
+    stream = free_basecall_stream(stream);
+    post = free_scrappie_matrix(post);
+}
+
+void test_stream_chunked_push_rgrgr_r94(void){
+    test_stream_chunked_push_helper(SCRAPPIE_MODEL_RGRGR_R9_4);
+}
+
+void test_stream_chunked_push_rnnrf_r94(void){
+    test_stream_chunked_push_helper(SCRAPPIE_MODEL_RNNRF_R9_4);
+}
+
+void test_stream_bidirectional_model(void){
+    CU_ASSERT_PTR_NULL(make_basecall_stream(SCRAPPIE_MODEL_RAW, basecall_stream_defaults));
+}
+
+
+static test_with_description tests[] = {
+    {"Stream of rgrgr_r94 given all signal at once", test_stream_single_push_rgrgr_r94},
+    {"Stream of rnnrf_r94 given all signal at once", test_stream_single_push_rnnrf_r94},
+    {"Stream of rgrgr_r94 pushed in chunks", test_stream_chunked_push_rgrgr_r94},
+    {"Stream of rnnrf_r94 pushed in chunks", test_stream_chunked_push_rnnrf_r94},
+    {"Stream of model with bidirectional layers", test_stream_bidirectional_model},
+    {0}};
+
+/**   Register tests with CUnit
+ *
+ *    @returns 0 on success, non-zero on failure
+ **/
+int register_test_stream(void) {
+    return scrappie_register_test_suite("Streaming basecalls", init_test_stream, clean_test_stream, tests);
+}
@@ -1,7 +1,19 @@
+// Needed for mkstemp and fdopen
 #define BANANA 1
+#define _DEFAULT_SOURCE
+#define _POSIX_SOURCE 1
+
 #include <CUnit/Basic.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
 
+#include <packed_reference.h>
+#include <scrappie_profile.h>
+#include <scrappie_seq_helpers.h>
 #include <util.h>
 #include <test_common.h>
 
@@ -33,9 +45,207 @@ void test_median_even_util(void) {
     CU_ASSERT_DOUBLE_EQUAL(med, 1.5f, 1e-5);
 }
 
+void test_select_agrees_with_sort_util(void) {
+    const size_t n = 1001;
+    float *x = calloc(n, sizeof(float));
+    float *sorted = calloc(n, sizeof(float));
+    CU_ASSERT_PTR_NOT_NULL_FATAL(x);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(sorted);
+
+    //  Random, sorted, reversed and heavily duplicated (like quantised signal) input
+    for (int kind = 0; kind < 4; kind++) {
+        for (size_t i = 0; i < n; i++) {
+            switch (kind) {
+            case 0:
+                sorted[i] = (float)rand() / RAND_MAX;
+                break;
+            case 1:
+                sorted[i] = i;
+                break;
+            case 2:
+                sorted[i] = n - i;
+                break;
+            default:
+                sorted[i] = rand() % 7;
+            }
+        }
+        qsort(sorted, n, sizeof(float), floatcmp);
+        for (size_t k = 0; k < n; k += 97) {
+            for (size_t i = 0; i < n; i++) {
+                x[i] = (1 == kind) ? i : ((2 == kind) ? n - i : sorted[(i * 389) % n]);
+            }
+            CU_ASSERT_EQUAL(selectf_inplace(x, n, k), sorted[k]);
+            for (size_t i = 0; i < n; i++) {
+                CU_ASSERT_FATAL((i <= k) ? x[i] <= x[k] : x[i] >= x[k]);
+            }
+        }
+    }
+
+    float med, mad;
+    float data[6] = {1.0f, 9.0f, 2.0f, 4.0f, 7.0f, 3.0f};
+    medmadf(data, 6, sorted, &med, &mad);
+    CU_ASSERT_DOUBLE_EQUAL(med, 3.5f, 1e-5);
+    CU_ASSERT_DOUBLE_EQUAL(mad, 2.0f * 1.4826f, 1e-5);
+    CU_ASSERT_DOUBLE_EQUAL(mad, madf(data, 6, NULL), 1e-5);
+
+    free(sorted);
+    free(x);
+}
+
+void test_read_sequences_from_fasta_util(void) {
+    char fasta_name[] = "scrappie_fasta_file_XXXXXX";
+    int fd = mkstemp(fasta_name);
+    CU_ASSERT_FATAL(-1 != fd);
+    FILE * fh = fdopen(fd, "w");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(fh);
+    fputs(">first description\nACGT\nTTGCA\n>second\nGG\n>third\nCATCAT\n", fh);
+    fclose(fh);
+
+    size_t nseq = 0;
+    scrappie_seq_t * seqs = read_sequences_from_fasta(fasta_name, &nseq);
+    remove(fasta_name);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(seqs);
+    CU_ASSERT_EQUAL_FATAL(nseq, 3);
+    CU_ASSERT(0 == strcmp(seqs[0].name, "first"));
+    CU_ASSERT(0 == strcmp(seqs[0].seq, "ACGTTTGCA"));
+    CU_ASSERT_EQUAL(seqs[0].n, 9);
+    CU_ASSERT(0 == strcmp(seqs[1].name, "second"));
+    CU_ASSERT(0 == strcmp(seqs[1].seq, "GG"));
+    CU_ASSERT_EQUAL(seqs[1].n, 2);
+    CU_ASSERT(0 == strcmp(seqs[2].name, "third"));
+    CU_ASSERT(0 == strcmp(seqs[2].seq, "CATCAT"));
+    CU_ASSERT_EQUAL(seqs[2].n, 6);
+    seqs = free_sequences(seqs, nseq);
+
+    CU_ASSERT_PTR_NULL(read_sequences_from_fasta("no_such_file.fa", &nseq));
+    CU_ASSERT_EQUAL(nseq, 0);
+}
+
+/**  States and bases of packed sequences agree with those of the bases, in memory and from file
+ **/
+void test_packed_reference_util(void) {
+    char name0[] = "first";
+    char name1[] = "second";
+    char seq0[] = "ACGTTGCAacgtGGTACCATGATTACAGATTACAGATTACAGGG";
+    char seq1[] = "TTTAC";
+    scrappie_seq_t seqs[2] = {{strlen(seq0), seq0, name0}, {strlen(seq1), seq1, name1}};
+    const size_t state_len = 5;
+
+    packed_reference * ref = pack_sequences(seqs, 2);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(ref);
+    char ref_name[] = "scrappie_packed_file_XXXXXX";
+    int fd = mkstemp(ref_name);
+    CU_ASSERT_FATAL(-1 != fd);
+    close(fd);
+    CU_ASSERT_TRUE_FATAL(write_packed_reference(ref_name, ref));
+    packed_reference * mapped = open_packed_reference(ref_name);
+    remove(ref_name);
+    CU_ASSERT_PTR_NOT_NULL_FATAL(mapped);
+    CU_ASSERT_TRUE(mapped->mapped);
+
+    packed_reference * refs[2] = {ref, mapped};
+    for (size_t j = 0; j < 2; j++) {
+        CU_ASSERT_EQUAL_FATAL(refs[j]->nseq, 2);
+        CU_ASSERT_EQUAL(packed_reference_max_length(refs[j]), seqs[0].n);
+        for (size_t i = 0; i < 2; i++) {
+            CU_ASSERT(0 == strcmp(packed_reference_name(refs[j], i), seqs[i].name));
+            CU_ASSERT_EQUAL_FATAL(packed_reference_length(refs[j], i), seqs[i].n);
+            char * bases = packed_reference_bases(refs[j], i, NULL);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(bases);
+            CU_ASSERT(0 == strcasecmp(bases, seqs[i].seq));
+            free(bases);
+
+            int * expected = encode_bases_to_integers(seqs[i].seq, seqs[i].n, state_len);
+            int * states = packed_reference_states(refs[j], i, state_len, NULL);
+            CU_ASSERT_PTR_NOT_NULL_FATAL(states);
+            for (size_t pos = 0; pos <= seqs[i].n - state_len; pos++) {
+                CU_ASSERT_EQUAL(states[pos], expected[pos]);
+            }
+            for (size_t pos = 0; pos < seqs[i].n; pos++) {
+                CU_ASSERT_EQUAL(packed_reference_base(refs[j], i, pos), base_to_int(seqs[i].seq[pos], true));
+            }
+            free(states);
+            free(expected);
+        }
+        CU_ASSERT_PTR_NULL(packed_reference_states(refs[j], 1, 6, NULL));
+    }
+    mapped = free_packed_reference(mapped);
+    ref = free_packed_reference(ref);
+
+    char bad[] = "ACGNT";
+    scrappie_seq_t badseq = {strlen(bad), bad, name0};
+    CU_ASSERT_PTR_NULL(pack_sequences(&badseq, 1));
+}
+
+static void spin(double seconds) {
+    const double start = scrappie_profile_now();
+    while (scrappie_profile_now() - start < seconds) {
+    }
+}
+
+void test_profile_stages_util(void) {
+    char profile_name[] = "scrappie_profile_XXXXXX";
+    int fd = mkstemp(profile_name);
+    CU_ASSERT_FATAL(-1 != fd);
+    close(fd);
+
+    //  Nothing is recorded until profile is open
+    const double wait = 0.01;
+    scrappie_profile_begin(SCRAPPIE_STAGE_NETWORK);
+    spin(wait);
+    scrappie_profile_end(SCRAPPIE_STAGE_NETWORK);
+    CU_ASSERT_EQUAL(scrappie_profile_take().seconds[SCRAPPIE_STAGE_NETWORK], 0.0);
+
+    CU_ASSERT_FATAL(scrappie_profile_open(profile_name, SCRAPPIE_PROFILE_TSV, 0.0));
+    scrappie_profile_begin(SCRAPPIE_STAGE_NETWORK);
+    spin(wait);
+    scrappie_profile_begin(SCRAPPIE_STAGE_GRU);
+    spin(wait);
+    //  Layer within a layer is counted as part of the outer layer
+    scrappie_profile_begin(SCRAPPIE_STAGE_FEEDFORWARD);
+    spin(wait);
+    scrappie_profile_end(SCRAPPIE_STAGE_FEEDFORWARD);
+    scrappie_profile_end(SCRAPPIE_STAGE_GRU);
+    //  Stage left unfinished is discarded
+    scrappie_profile_begin(SCRAPPIE_STAGE_SOFTMAX);
+    scrappie_profile_end(SCRAPPIE_STAGE_NETWORK);
+    scrappie_profile_count(1000, 100);
+    scrappie_profile_record record = scrappie_profile_take();
+
+    CU_ASSERT(record.seconds[SCRAPPIE_STAGE_NETWORK] >= wait && record.seconds[SCRAPPIE_STAGE_NETWORK] < 2 * wait);
+    CU_ASSERT(record.seconds[SCRAPPIE_STAGE_GRU] >= 2 * wait && record.seconds[SCRAPPIE_STAGE_GRU] < 3 * wait);
+    CU_ASSERT_EQUAL(record.seconds[SCRAPPIE_STAGE_FEEDFORWARD], 0.0);
+    CU_ASSERT_EQUAL(record.seconds[SCRAPPIE_STAGE_SOFTMAX], 0.0);
+    CU_ASSERT_EQUAL(record.nsample, 1000);
+    CU_ASSERT_EQUAL(record.nbase, 100);
+    CU_ASSERT_EQUAL(scrappie_profile_take().nsample, 0);
+
+    scrappie_profile_write_read("read", record, wait);
+    scrappie_profile_close();
+    CU_ASSERT_FALSE(scrappie_profile_enabled());
+
+    //  Header and a line for the read, with a column for each stage
+    FILE * fh = fopen(profile_name, "r");
+    CU_ASSERT_PTR_NOT_NULL_FATAL(fh);
+    size_t nline = 0;
+    size_t ntab = 0;
+    for (int c = fgetc(fh); EOF != c; c = fgetc(fh)) {
+        nline += ('\n' == c);
+        ntab += ('\t' == c);
+    }
+    fclose(fh);
+    remove(profile_name);
+    CU_ASSERT_EQUAL(nline, 2);
+    CU_ASSERT_EQUAL(ntab, 2 * (5 + SCRAPPIE_NSTAGE));
+}
+
 static test_with_description tests[] = {
     {"Median of odd length array", test_median_odd_util},
     {"Median of even length array", test_median_even_util},
+    {"Selection agrees with sorting", test_select_agrees_with_sort_util},
+    {"Read multiple sequences from fasta", test_read_sequences_from_fasta_util},
+    {"Packed reference agrees with its sequences", test_packed_reference_util},
+    {"Stages of profile timed exclusively", test_profile_stages_util},
     {0}};
 
 /**   Register tests with CUnit
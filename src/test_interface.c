@@ -17,6 +17,14 @@
 #include "sse_mathfun.h"
 #include "util.h"
 
+//  Defined by the python bindings themselves, see python/build.py
+typedef struct {
+    char * basecall;
+    float score;
+    int * pos;
+    size_t nblock;
+} scrappy_basecall;
+
 #include "../python/pyscrap.h"
 
 
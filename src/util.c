@@ -74,13 +74,127 @@ int floatcmp(const void *x, const void *y) {
     return -1;
 }
 
+static inline void swapf(float *x, size_t i, size_t j) {
+    const float tmp = x[i];
+    x[i] = x[j];
+    x[j] = tmp;
+}
+
+/**  Select the k-th smallest element of an array
+ *
+ *  Introselect:  quickselect with a median-of-three pivot, giving expected
+ *  O(n) performance.  Should partitioning fail to make progress, the
+ *  remaining range is sorted, bounding the worst case at O(n log n).
+ *
+ *  @param x An array to select from.  Reordered inplace so that x[k] is
+ *  the k-th smallest element, no element before it is larger and no
+ *  element after it is smaller [in/out]
+ *  @param n Length of array x
+ *  @param k Rank of element to select, counting from zero
+ *
+ *  @return k-th smallest element on success, NAN otherwise.
+ **/
+float selectf_inplace(float *x, size_t n, size_t k) {
+    if (NULL == x || k >= n) {
+        return NAN;
+    }
+
+    size_t lo = 0;
+    size_t hi = n - 1;
+    //  Allowance of partitioning rounds before falling back to sorting
+    int budget = 8;
+    for (size_t m = n; m > 1; m >>= 1) {
+        budget += 2;
+    }
+
+    while (hi > lo) {
+        if (0 == budget--) {
+            qsort(x + lo, hi - lo + 1, sizeof(float), floatcmp);
+            break;
+        }
+        // Order lo, mid and hi so median of three is pivot
+        const size_t mid = lo + (hi - lo) / 2;
+        if (x[mid] < x[lo]) {
+            swapf(x, lo, mid);
+        }
+        if (x[hi] < x[lo]) {
+            swapf(x, lo, hi);
+        }
+        if (x[hi] < x[mid]) {
+            swapf(x, mid, hi);
+        }
+        const float pivot = x[mid];
+
+        //  Hoare partition: on exit x[lo..j] <= pivot, x[i..hi] >= pivot, and
+        //  any elements between are equal to pivot
+        size_t i = lo;
+        size_t j = hi;
+        while (i <= j) {
+            while (i < hi && x[i] < pivot) {
+                i++;
+            }
+            while (j > lo && x[j] > pivot) {
+                j--;
+            }
+            if (i > j) {
+                break;
+            }
+            swapf(x, i, j);
+            i++;
+            if (j == lo) {
+                break;
+            }
+            j--;
+        }
+
+        if (k <= j && j < hi) {
+            hi = j;
+        } else if (k >= i && i > lo) {
+            lo = i;
+        } else if (k > j && k < i) {
+            break;
+        } else {
+            //  No progress.  Only possible with unordered values (NAN)
+            qsort(x + lo, hi - lo + 1, sizeof(float), floatcmp);
+            break;
+        }
+    }
+
+    return x[k];
+}
+
+/**  Quantile of an array, which is reordered inplace
+ *
+ *  @param x An array to calculate quantile from [in/out]
+ *  @param nx Length of array x
+ *  @param p Quantile to calculate
+ *
+ *  @return quantile
+ **/
+static float quantilef_inplace(float *x, size_t nx, float p) {
+    const size_t idx = p * (nx - 1);
+    const float remf = p * (nx - 1) - idx;
+    const float lower = selectf_inplace(x, nx, idx);
+    if (idx < nx - 1) {
+        // Next largest element is smallest of those above idx
+        float upper = x[idx + 1];
+        for (size_t i = idx + 2; i < nx; i++) {
+            if (x[i] < upper) {
+                upper = x[i];
+            }
+        }
+        return (1.0 - remf) * lower + remf * upper;
+    }
+    // Should only occur when p is exactly 1.0
+    return lower;
+}
+
 /**  Quantiles from n array
  *
- *  Using a relatively inefficent qsort resulting in O(n log n)
- *  performance but better performance is possible for small np.
- *  The array p is modified inplace, containing which quantiles to
- *  calculation on input and the quantiles on output; on error, p
- *  is filled with the value NAN.
+ *  Quantiles are found by selection on a copy of the array, with expected
+ *  O(n) performance for each quantile.  The array p is modified inplace,
+ *  containing which quantiles to calculation on input and the quantiles
+ *  on output; on error, p is filled with the value NAN.
  *
  *  @param x An array to calculate quantiles from
  *  @param nx Length of array x
@@ -102,7 +216,6 @@ void quantilef(const float *x, size_t nx, float *p, size_t np) {
         }
         return;
     }
-    // Sort array
     float *space = malloc(nx * sizeof(float));
     if (NULL == space) {
         for (size_t i = 0; i < np; i++) {
@@ -111,18 +224,10 @@ void quantilef(const float *x, size_t nx, float *p, size_t np) {
         return;
     }
     memcpy(space, x, nx * sizeof(float));
-    qsort(space, nx, sizeof(float), floatcmp);
 
-    // Extract quantiles
+    // Extract quantiles, each selection benefiting from the partial order left by the last
     for (size_t i = 0; i < np; i++) {
-        const size_t idx = p[i] * (nx - 1);
-        const float remf = p[i] * (nx - 1) - idx;
-        if (idx < nx - 1) {
-            p[i] = (1.0 - remf) * space[idx] + remf * space[idx + 1];
-        } else {
-            // Should only occur when p is exactly 1.0
-            p[i] = space[idx];
-        }
+        p[i] = quantilef_inplace(space, nx, p[i]);
     }
 
     free(space);
@@ -130,9 +235,6 @@ void quantilef(const float *x, size_t nx, float *p, size_t np) {
 }
 
 /** Median of an array
- *
- *  Using a relatively inefficent qsort resulting in O(n log n)
- *  performance but O(n) is possible.
  *
  *  @param x An array to calculate median of
  *  @param n Length of array
@@ -145,11 +247,126 @@ float medianf(const float *x, size_t n) {
     return p;
 }
 
+/** Median and Median Absolute Deviation of an array
+ *
+ *  Both are calculated by selection within a single scratch array, which
+ *  may be provided by the caller so that it can be reused across calls.
+ *
+ *  @param x An array to calculate the median and MAD of
+ *  @param n Length of array
+ *  @param scratch Array of length at least n to use as workspace.  If NULL,
+ *  workspace is allocated
+ *  @param med Median of array [out]
+ *  @param mad MAD of array, scaled to be consistent with the standard
+ *  deviation of a normal distribution [out]
+ *
+ *  @return void.  On error, med and mad are set to NAN
+ **/
+void medmadf(const float *x, size_t n, float *scratch, float *med, float *mad) {
+    const float mad_scaling_factor = 1.4826;
+    assert(NULL != med && NULL != mad);
+    *med = NAN;
+    *mad = NAN;
+    if (NULL == x || 0 == n) {
+        return;
+    }
+    if (1 == n) {
+        *med = x[0];
+        *mad = 0.0f;
+        return;
+    }
+
+    float *space = (NULL != scratch) ? scratch : malloc(n * sizeof(float));
+    if (NULL == space) {
+        return;
+    }
+
+    memcpy(space, x, n * sizeof(float));
+    const float xmed = quantilef_inplace(space, n, 0.5f);
+    for (size_t i = 0; i < n; i++) {
+        space[i] = fabsf(x[i] - xmed);
+    }
+    *med = xmed;
+    *mad = quantilef_inplace(space, n, 0.5f) * mad_scaling_factor;
+
+    if (space != scratch) {
+        free(space);
+    }
+}
+
+/**  Index of k-th smallest value counted by a histogram
+ **/
+static size_t histogram_select(const uint32_t *count, size_t k) {
+    size_t i = 0;
+    for (size_t cum = count[0]; cum <= k; cum += count[i]) {
+        i++;
+    }
+    return i;
+}
+
+/** Median and Median Absolute Deviation of an array of ADC values
+ *
+ *  The values are integers of limited range, so both are found exactly from
+ *  histograms in two passes over the array, rather than by selection on a
+ *  float copy.  The results are as medmadf would give for the same values.
+ *
+ *  @param x An array to calculate the median and MAD of
+ *  @param n Length of array
+ *  @param med Median of array [out]
+ *  @param mad MAD of array, scaled to be consistent with the standard
+ *  deviation of a normal distribution [out]
+ *
+ *  @return void.  On error, med and mad are set to NAN
+ **/
+void medmad_int16(const int16_t *x, size_t n, float *med, float *mad) {
+    const float mad_scaling_factor = 1.4826;
+    assert(NULL != med && NULL != mad);
+    *med = NAN;
+    *mad = NAN;
+    if (NULL == x || 0 == n) {
+        return;
+    }
+
+    int xmin = x[0];
+    int xmax = x[0];
+    for (size_t i = 1; i < n; i++) {
+        xmin = (x[i] < xmin) ? x[i] : xmin;
+        xmax = (x[i] > xmax) ? x[i] : xmax;
+    }
+    //  Deviations from the median are counted in half units, so are at most twice the range
+    const size_t nbin = 2 * (size_t)(xmax - xmin) + 1;
+    uint32_t *count = calloc(nbin, sizeof(uint32_t));
+    if (NULL == count) {
+        return;
+    }
+
+    //  Median is interpolated between the middle two elements when n is even
+    const size_t k = (n - 1) / 2;
+    for (size_t i = 0; i < n; i++) {
+        count[x[i] - xmin] += 1;
+    }
+    size_t lower = histogram_select(count, k);
+    size_t upper = (n % 2) ? lower : histogram_select(count, k + 1);
+    const size_t med2 = lower + upper;
+
+    memset(count, 0, nbin * sizeof(uint32_t));
+    for (size_t i = 0; i < n; i++) {
+        const size_t x2 = 2 * (size_t)(x[i] - xmin);
+        count[(x2 > med2) ? (x2 - med2) : (med2 - x2)] += 1;
+    }
+    lower = histogram_select(count, k);
+    upper = (n % 2) ? lower : histogram_select(count, k + 1);
+    free(count);
+
+    *med = xmin + 0.5f * med2;
+    *mad = 0.25f * (lower + upper) * mad_scaling_factor;
+}
+
 /** Median Absolute Deviation of an array
  *
  *  @param x An array to calculate the MAD of
  *  @param n Length of array
- *  @param med Median of the array.  If NAN then median is calculated.
+ *  @param med Median of the array.  If NULL then median is calculated.
  *
  *  @return MAD of array on success, NAN otherwise.
  **/
@@ -161,32 +378,26 @@ float madf(const float *x, size_t n, const float *med) {
     if (1 == n) {
         return 0.0f;
     }
+    if (NULL == med) {
+        float xmed, xmad;
+        medmadf(x, n, NULL, &xmed, &xmad);
+        return xmad;
+    }
 
     float *absdiff = malloc(n * sizeof(float));
     if (NULL == absdiff) {
         return NAN;
     }
 
-    const float _med = (NULL == med) ? medianf(x, n) : *med;
-
     for (size_t i = 0; i < n; i++) {
-        absdiff[i] = fabsf(x[i] - _med);
+        absdiff[i] = fabsf(x[i] - *med);
     }
 
-    const float mad = medianf(absdiff, n);
+    const float mad = quantilef_inplace(absdiff, n, 0.5f);
     free(absdiff);
     return mad * mad_scaling_factor;
 }
 
-/** Med-MAD normalisation of an array
- *
- *  Normalise an array using the median and MAD as measures of
- *  location and scale respectively.  The array is updated inplace.
- *
- *  @param x An array containing values to normalise
- *  @param n Length of array
- *  @return void
- **/
 void medmad_normalise_array(float *x, size_t n) {
     if (NULL == x) {
         return;
@@ -196,8 +407,8 @@ void medmad_normalise_array(float *x, size_t n) {
         return;
     }
 
-    const float xmed = medianf(x, n);
-    const float xmad = madf(x, n, &xmed);
+    float xmed, xmad;
+    medmadf(x, n, NULL, &xmed, &xmad);
     for (size_t i = 0; i < n; i++) {
         x[i] = (x[i] - xmed) / xmad;
     }
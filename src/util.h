@@ -238,6 +238,7 @@ static inline __m128 __attribute__ ((__always_inline__)) fast_elufv(__m128 x) {
     return _mm_or_ps(_mm_and_ps(mask, x),  _mm_andnot_ps(mask, y));
 }
 
+int floatcmp(const void *x, const void *y);
 int argmaxf(const float *x, size_t n);
 int argminf(const float *x, size_t n);
 float valmaxf(const float *x, size_t n);
@@ -259,9 +260,12 @@ static inline int imax(int x, int y){
     return (x > y) ? x : y;
 }
 
+float selectf_inplace(float *x, size_t n, size_t k);
 void quantilef(const float *x, size_t nx, float *p, size_t np);
 float medianf(const float *x, size_t n);
 float madf(const float *x, size_t n, const float *med);
+void medmadf(const float *x, size_t n, float *scratch, float *med, float *mad);
+void medmad_int16(const int16_t *x, size_t n, float *med, float *mad);
 void medmad_normalise_array(float *x, size_t n);
 void studentise_array_kahan(float *x, size_t n);
 void difference_array(float *x, size_t n);